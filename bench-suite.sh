@@ -0,0 +1,2 @@
+# emulator and assembler benchmark suite over bench/programs, arguments go to bench/suite (see --help)
+gcc -O2 -o bench/suite bench/suite.c -I . -I uthash-master/src -pthread && bench/suite "$@"
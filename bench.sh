@@ -0,0 +1,2 @@
+# assembler throughput benchmark, arguments go to bench/bench (see --help)
+gcc -O2 -o bench/bench bench/bench.c -I . -I uthash-master/src -pthread && bench/bench "$@"
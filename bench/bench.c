@@ -0,0 +1,257 @@
+/******************************************************************************
+ * Assembler benchmark:
+ * Generates synthetic Tinker programs with a configurable mix of plain
+ * instructions, ld/push/pop macros, labels and .data items, then times
+ * pass1 alone, pass2 alone (after an untimed pass1) and the whole
+ * assembler end to end. Each measurement runs in its own child process,
+ * so the peak RSS reported is that phase's own.
+ *
+ * The assembler is compiled in (main.c with its main renamed), so the
+ * phases are the same functions hw4 runs. Built and run by bench.sh.
+ ******************************************************************************/
+#define main hw4_main
+#include "main.c"
+#undef main
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+
+enum { MIX_PLAIN, MIX_MACRO, MIX_LABEL, MIX_DATA, NUM_MIX };
+
+typedef struct {
+    long lines;
+    int mix[NUM_MIX];
+    uint64_t seed;
+} GenParams;
+
+static uint64_t rng_state;
+
+static uint64_t rng(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static int rng_below(int n) {
+    return (int)(rng() % (uint64_t)n);
+}
+
+static void gen_plain(FILE *f) {
+    int a = rng_below(31), b = rng_below(31), c = rng_below(31);
+    switch (rng_below(10)) {
+    case 0: fprintf(f, "\tadd r%d, r%d, r%d\n", a, b, c); break;
+    case 1: fprintf(f, "\tsub r%d, r%d, r%d\n", a, b, c); break;
+    case 2: fprintf(f, "\tmul r%d, r%d, r%d\n", a, b, c); break;
+    case 3: fprintf(f, "\txor r%d, r%d, r%d\n", a, b, c); break;
+    case 4: fprintf(f, "\taddi r%d, %d\n", a, rng_below(4096)); break;
+    case 5: fprintf(f, "\tshftli r%d, %d\n", a, rng_below(64)); break;
+    case 6: fprintf(f, "\tmov r%d, r%d\n", a, b); break;
+    case 7: fprintf(f, "\tmov r%d, (r%d)(%d)\n", a, b, rng_below(4096) - 2048); break;
+    case 8: fprintf(f, "\tbrgt r%d, r%d, r%d\n", a, b, c); break;
+    default: fprintf(f, "\tnot r%d, r%d\n", a, b); break;
+    }
+}
+
+// write about `p->lines` lines to `path`, returns how many it wrote (0 on
+// error); the labels referenced last are defined at the end
+static long generate(const char *path, const GenParams *p) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    rng_state = p->seed ? p->seed : 88172645463325252ULL;
+    int total = 0;
+    for (int i = 0; i < NUM_MIX; i++) {
+        total += p->mix[i];
+    }
+    long labels = 0, maxRef = -1, written = p->lines;
+    int inData = 0;
+    fputs(".code\n", f);
+    for (long n = 1; n < p->lines; n++) {
+        int pick = rng_below(total), kind = 0;
+        while (pick >= p->mix[kind]) {
+            pick -= p->mix[kind++];
+        }
+        if (inData != (kind == MIX_DATA)) {
+            inData = kind == MIX_DATA;
+            fputs(inData ? ".data\n" : ".code\n", f);
+            n++;
+        }
+        switch (kind) {
+        case MIX_PLAIN:
+            gen_plain(f);
+            break;
+        case MIX_MACRO: {
+            int r = rng_below(31), which = rng_below(8);
+            if (which < 2) {
+                // backward or shortly forward reference
+                long target = labels ? rng_below((int)(labels < 1000000 ? labels : 1000000)) + labels / 2 + 2 : 0;
+                maxRef = target > maxRef ? target : maxRef;
+                fprintf(f, "\tld r%d, :L%ld\n", r, target);
+            } else if (which < 4) {
+                fprintf(f, "\tld r%d, %llu\n", r, (unsigned long long)(rng() >> rng_below(64)));
+            } else if (which < 6) {
+                fprintf(f, "\tpush r%d\n", r);
+            } else {
+                fprintf(f, "\tpop r%d\n", r);
+            }
+            break;
+        }
+        case MIX_LABEL:
+            fprintf(f, ":L%ld\n", labels++);
+            break;
+        default:
+            fprintf(f, "\t%llu\n", (unsigned long long)rng());
+            break;
+        }
+    }
+    if (inData) {
+        fputs(".code\n", f);
+        written++;
+    }
+    while (labels <= maxRef) {
+        fprintf(f, ":L%ld\n\thalt\n", labels++);
+        written += 2;
+    }
+    return fclose(f) == 0 ? written : 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef enum { PHASE_PASS1, PHASE_PASS2, PHASE_ALL } Phase;
+
+static const char *phaseNames[] = { "pass1", "pass2", "end2end" };
+
+// run one phase in a child, returns its wall time and peak RSS (KiB)
+static int measure(Phase phase, const char *input, const char *output, double *wall, long *rssKb) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 0;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        init_lexer();
+        double t0 = now();
+        if (phase == PHASE_PASS1) {
+            pass1(input);
+        } else if (phase == PHASE_PASS2) {
+            pass1(input);
+            t0 = now();
+            pass2(output, 0, 0);
+        } else {
+            char *argv[] = { "hw4", (char *)input, (char *)output, NULL };
+            hw4_main(3, argv);
+        }
+        double t = now() - t0;
+        ssize_t n = write(fds[1], &t, sizeof(t));
+        _exit(n == sizeof(t) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], wall, sizeof(*wall));
+    close(fds[0]);
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) || n != sizeof(*wall)) {
+        fprintf(stderr, "bench: %s failed on %s\n", phaseNames[phase], input);
+        return 0;
+    }
+    *rssKb = ru.ru_maxrss;
+    return 1;
+}
+
+static long parse_size(const char *s) {
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (*end == 'K' || *end == 'k') {
+        v *= 1000, end++;
+    } else if (*end == 'M' || *end == 'm') {
+        v *= 1000000, end++;
+    }
+    return *end || v < 1 ? -1 : v;
+}
+
+static void bench_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--sizes N,...] [--mix plain,macro,label,data] [--seed S] [--dir DIR] [--keep]\n", prog);
+    fprintf(stderr, "  sizes take K/M suffixes (default 1K,10K,100K,1M; up to 100M)\n");
+    fprintf(stderr, "  mix is relative weights (default 50,35,10,5)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *sizes = "1K,10K,100K,1M";
+    const char *dir = "/tmp";
+    int keep = 0;
+    GenParams params = { 0, { 50, 35, 10, 5 }, 0 };
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            sizes = argv[++i];
+        } else if (!strcmp(argv[i], "--mix") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &params.mix[0], &params.mix[1], &params.mix[2], &params.mix[3]) != 4
+                    || params.mix[0] < 0 || params.mix[1] < 0 || params.mix[2] < 0 || params.mix[3] < 0
+                    || params.mix[0] + params.mix[1] + params.mix[2] + params.mix[3] == 0) {
+                fprintf(stderr, "bench: bad --mix '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            params.seed = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (!strcmp(argv[i], "--keep")) {
+            keep = 1;
+        } else {
+            bench_usage(argv[0]);
+            return 1;
+        }
+    }
+    printf("%-8s %-8s %12s %14s %10s %12s\n", "lines", "phase", "seconds", "lines/s", "MB/s", "peak RSS KB");
+    char list[256];
+    snprintf(list, sizeof(list), "%s", sizes);
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        params.lines = parse_size(tok);
+        if (params.lines < 0 || params.lines > 100000000) {
+            fprintf(stderr, "bench: bad size '%s'\n", tok);
+            return 1;
+        }
+        char input[4096], output[4096];
+        snprintf(input, sizeof(input), "%s/bench-%s.tk", dir, tok);
+        snprintf(output, sizeof(output), "%s/bench-%s.out", dir, tok);
+        long lines = generate(input, &params);
+        if (!lines) {
+            return 1;
+        }
+        struct stat st;
+        if (stat(input, &st) < 0) {
+            perror(input);
+            return 1;
+        }
+        for (Phase phase = PHASE_PASS1; phase <= PHASE_ALL; phase++) {
+            double wall;
+            long rss;
+            if (!measure(phase, input, output, &wall, &rss)) {
+                return 1;
+            }
+            printf("%-8s %-8s %12.4f %14.0f %10.1f %12ld\n", tok, phaseNames[phase], wall,
+                   lines / wall, st.st_size / wall / 1e6, rss);
+            fflush(stdout);
+        }
+        if (!keep) {
+            remove(input);
+            remove(output);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,572 @@
+/******************************************************************************
+ * Assembler performance fuzzer:
+ * Looks for inputs the assembler is slow on per byte, not for ones it
+ * crashes on. Each input is timed in a child process through three stages,
+ * the lexer (next_line and lex_line over every line), pass1 and pass2, and
+ * scored in nanoseconds per input byte for each; the FUZZ_KEEP slowest per
+ * stage are kept, and new inputs are mutations of those (or of the seeds).
+ *
+ * The seeds and the mutations lean on what has been slow before: lines of
+ * about 1 KiB and longer, label names near the 49 characters a name keeps
+ * that share all but their last few, names whose label_hash agree in their
+ * low FUZZ_COLLIDE_BITS bits, files that are nearly all ld, push and pop,
+ * and the programs of bench/programs. Mutations insert a block of one of
+ * those, duplicate, drop or splice in runs of lines, or lengthen a line.
+ * An input that stops with an error only scores the stages it got through;
+ * one still running after --timeout seconds scores the timeout in the stage
+ * it was in. A candidate for the kept set is timed twice more, keeping each
+ * stage's best, so one noisy run doesn't get it in. hw4 draws its hash key
+ * per process; here it is fixed, so that colliding names found stay
+ * colliding when the corpus is checked (they are what a leaked key would
+ * let a source do, short of --keyed-hash).
+ *
+ * When it is done the kept inputs are written into the corpus directory
+ * (bench/slow by default) as STAGE-HASH.tk, an existing file of the same
+ * content being left alone, and the files already there are seeds of the
+ * next search. `--check DIR` times every file there instead, in MB/s per
+ * stage, which perf.sh tracks so a cliff the fuzzer found stays fixed.
+ *
+ * Like bench.c, main.c is compiled in, so these are the functions hw4 runs.
+ * Built and run by fuzz.sh.
+ ******************************************************************************/
+#define main hw4_main
+#include "main.c"
+#undef main
+
+#include <dirent.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define FUZZ_KEEP 3             // slowest inputs kept per stage
+#define FUZZ_SEED_BYTES (16 * 1024)
+#define FUZZ_COLLIDE_BITS 12
+#define FUZZ_MAX_SEEDS 64
+
+enum { STAGE_LEX, STAGE_PASS1, STAGE_PASS2, NUM_STAGES };
+
+static const char *stageNames[] = { "lex", "pass1", "pass2" };
+
+typedef struct {
+    char *text;
+    size_t len;
+    double ns[NUM_STAGES];      // per byte; 0 for a stage it didn't get to
+    char *name;                 // of the file it was read from, NULL if made here
+} Input;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static int rng_below(int n) {
+    return (int)(rng() % (uint64_t)n);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generated blocks: each appends lines of one kind to `f`, about `bytes`
+ * of them, with label names made unique by `serial` so blocks can go into
+ * the same input. */
+enum { GEN_LONG, GEN_PREFIX, GEN_COLLIDE, GEN_MACRO, NUM_GENS };
+
+static unsigned serial;
+
+// instructions padded out to lines of about 1 KiB, or a few times that
+static void gen_long(FILE *f, size_t bytes) {
+    for (size_t n = 0; n < bytes; ) {
+        int width = rng_below(4) ? 1000 + rng_below(50) : 1024 * (rng_below(4) + 1) + rng_below(3) - 1;
+        int a = rng_below(31), b = rng_below(31), c = rng_below(31), k = 0;
+        switch (rng_below(3)) {
+        case 0: k = fprintf(f, "\tadd r%d, r%d, r%d ;", a, b, c); break;
+        case 1: k = fprintf(f, "%*sxor r%d, r%d, r%d", width / 2, "", a, b, c); break;
+        default: k = fprintf(f, "\tmov r%d, (r%d)(%d)%*s;", a, b, rng_below(4096) - 2048, width / 3, ""); break;
+        }
+        for (; k < width; k++) {
+            putc(rng_below(8) ? 'x' : ' ', f);
+        }
+        putc('\n', f);
+        n += (size_t)k + 1;
+    }
+}
+
+// labels of 44 to 49 characters (or past it, cut to 49) that differ only
+// in their tails, defined and referenced by ld
+static void gen_prefix(FILE *f, size_t bytes) {
+    char prefix[64];
+    int plen = 40 + rng_below(6);
+    for (int i = 0; i < plen; i++) {
+        prefix[i] = (char)('a' + (i * 7 + (int)serial) % 26);
+    }
+    prefix[plen] = '\0';
+    unsigned first = serial;
+    for (size_t n = 0; n < bytes; serial++) {
+        n += (size_t)fprintf(f, ":%s%u\n\tld r%d, :%s%u\n", prefix, serial, rng_below(31), prefix,
+                             first + (unsigned)rng_below((int)(serial - first + 1)));
+    }
+}
+
+// label names whose label_hash agree in the low FUZZ_COLLIDE_BITS bits,
+// so they share a home slot in the label table until it outgrows them
+static void gen_collide(FILE *f, size_t bytes) {
+    uint32_t mask = (1u << FUZZ_COLLIDE_BITS) - 1, target = (uint32_t)rng() & mask;
+    char name[50];
+    size_t len;
+    for (size_t n = 0; n < bytes; serial++) {
+        for (uint64_t salt = 0; ; salt++) {
+            len = (size_t)snprintf(name, sizeof(name), "C%u_%llu", serial, (unsigned long long)salt);
+            if ((label_hash(name, len) & mask) == target) {
+                break;
+            }
+        }
+        n += (size_t)fprintf(f, ":%s\n\tld r%d, :%s\n", name, rng_below(31), name);
+    }
+}
+
+// nearly nothing but ld with 64-bit values, push and pop
+static void gen_macro(FILE *f, size_t bytes) {
+    for (size_t n = 0; n < bytes; ) {
+        int r = rng_below(31);
+        switch (rng_below(6)) {
+        case 0: n += (size_t)fprintf(f, "\tpush r%d\n", r); break;
+        case 1: n += (size_t)fprintf(f, "\tpop r%d\n", r); break;
+        case 2: n += (size_t)fprintf(f, "\tld r%d, %d\n", r, rng_below(4096)); break;
+        default: n += (size_t)fprintf(f, "\tld r%d, %llu\n", r, (unsigned long long)rng()); break;
+        }
+    }
+}
+
+static void gen_block(FILE *f, int kind, size_t bytes) {
+    switch (kind) {
+    case GEN_LONG: gen_long(f, bytes); break;
+    case GEN_PREFIX: gen_prefix(f, bytes); break;
+    case GEN_COLLIDE: gen_collide(f, bytes); break;
+    default: gen_macro(f, bytes); break;
+    }
+}
+
+/* Inputs as lines: mutations cut and join at line starts. */
+typedef struct {
+    const char *p[1 << 16];
+    size_t n[1 << 16];      // with the newline
+    int count;
+} Lines;
+
+static Lines lines, other;
+
+static void split_lines(Lines *l, const char *text, size_t len) {
+    l->count = 0;
+    for (size_t i = 0; i < len && l->count < (int)(sizeof(l->p) / sizeof(l->p[0])); ) {
+        const char *nl = memchr(text + i, '\n', len - i);
+        size_t end = nl ? (size_t)(nl - text) + 1 : len;
+        l->p[l->count] = text + i;
+        l->n[l->count++] = end - i;
+        i = end;
+    }
+}
+
+static void put_lines(FILE *f, const Lines *l, int from, int to) {
+    for (int i = from; i < to; i++) {
+        fwrite(l->p[i], 1, l->n[i], f);
+    }
+}
+
+// a mutation of `in` (spliced with `mate`), cut to `maxBytes` at a line
+static void mutate(Input *out, const Input *in, const Input *mate, size_t maxBytes) {
+    split_lines(&lines, in->text, in->len);
+    FILE *f = open_memstream(&out->text, &out->len);
+    int count = lines.count, at = count ? rng_below(count + 1) : 0;
+    int span = count ? 1 + rng_below(count < 64 ? count : 64) : 0;
+    int end = at + span < count ? at + span : count;
+    put_lines(f, &lines, 0, at);
+    switch (rng_below(6)) {
+    case 0: case 1:
+        gen_block(f, rng_below(NUM_GENS), (size_t)(256 << rng_below(6)));
+        put_lines(f, &lines, at, count);
+        break;
+    case 2:     // a run of lines twice
+        put_lines(f, &lines, at, end);
+        put_lines(f, &lines, at, count);
+        break;
+    case 3:     // a run of lines dropped
+        put_lines(f, &lines, end, count);
+        break;
+    case 4:     // a run of another input's lines
+        split_lines(&other, mate->text, mate->len);
+        if (other.count) {
+            int from = rng_below(other.count), to = from + 1 + rng_below(other.count - from);
+            put_lines(f, &other, from, to);
+        }
+        put_lines(f, &lines, at, count);
+        break;
+    default:    // a line made longer
+        if (at < count) {
+            size_t n = lines.n[at] - (lines.p[at][lines.n[at] - 1] == '\n');
+            fwrite(lines.p[at], 1, n, f);
+            for (int k = 1 + rng_below(1024); k > 0; k--) {
+                putc(rng_below(4) ? ' ' : ';', f);
+            }
+            putc('\n', f);
+            at++;
+        }
+        put_lines(f, &lines, at, count);
+        break;
+    }
+    fclose(f);
+    if (out->len > maxBytes) {
+        const char *cut = out->text + maxBytes;
+        while (cut > out->text && cut[-1] != '\n') {
+            cut--;
+        }
+        out->len = (size_t)(cut - out->text);
+    }
+}
+
+/* Timing: each stage in a child, which writes its time to a pipe as it
+ * finishes it; the stage running when the child dies of the alarm gets
+ * the timeout. */
+static const char *workDir = "/tmp";
+static volatile uint64_t sink;
+
+static void report(int fd, double t) {
+    if (write(fd, &t, sizeof(t)) != sizeof(t)) {
+        _exit(1);
+    }
+}
+
+static void time_child(const Input *in, const char *path, const char *outPath, int fd, unsigned timeout) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+        dup2(null, STDERR_FILENO);
+        dup2(null, STDOUT_FILENO);
+    }
+    alarm(timeout);
+    double best = 0;
+    for (int rep = 0; rep < 3; rep++) {
+        LineReader r;
+        TokenLine t;
+        const char *line;
+        size_t len;
+        double t0 = now();
+        reader_view(&r, in->text, in->len);
+        while (next_line(&r, &line, &len)) {
+            if (len) {
+                lex_line(&t, line, len, &r.masks);
+                sink += (uint64_t)t.numTokens;
+            }
+        }
+        double s = now() - t0;
+        best = rep == 0 || s < best ? s : best;
+    }
+    report(fd, best);
+    double t0 = now();
+    pass1(path);
+    report(fd, now() - t0);
+    t0 = now();
+    pass2(outPath, 0, 0);
+    report(fd, now() - t0);
+    _exit(0);
+}
+
+// fill in->ns; 0 if the input couldn't be timed at all
+static int time_input(Input *in, unsigned timeout) {
+    char path[4096], outPath[4096];
+    snprintf(path, sizeof(path), "%s/fuzz-%d.tk", workDir, (int)getpid());
+    snprintf(outPath, sizeof(outPath), "%s/fuzz-%d.out", workDir, (int)getpid());
+    FILE *f = fopen(path, "w");
+    if (!f || fwrite(in->text, 1, in->len, f) != in->len || fclose(f) != 0) {
+        perror(path);
+        return 0;
+    }
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        return 0;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        time_child(in, path, outPath, fds[1], timeout);
+    }
+    close(fds[1]);
+    int stages = 0;
+    double t;
+    while (stages < NUM_STAGES && read(fds[0], &t, sizeof(t)) == sizeof(t)) {
+        in->ns[stages++] = in->len ? t * 1e9 / (double)in->len : 0;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (stages < NUM_STAGES && WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM) {
+        in->ns[stages++] = timeout * 1e9 / (double)(in->len ? in->len : 1);
+    }
+    for (int s = stages; s < NUM_STAGES; s++) {
+        in->ns[s] = 0;
+    }
+    remove(path);
+    remove(outPath);
+    return 1;
+}
+
+// time `in` twice more, keeping each stage's best
+static void retime_input(Input *in, unsigned timeout) {
+    Input again = *in;
+    for (int rep = 0; rep < 2; rep++) {
+        if (!time_input(&again, timeout)) {
+            return;
+        }
+        for (int s = 0; s < NUM_STAGES; s++) {
+            in->ns[s] = again.ns[s] < in->ns[s] ? again.ns[s] : in->ns[s];
+        }
+    }
+}
+
+/* The kept set: per stage, the FUZZ_KEEP slowest, slowest first. An input
+ * can be kept for several stages; each slot holds its own copy. */
+static Input kept[NUM_STAGES][FUZZ_KEEP];
+
+static int slowest_slot(int stage, double ns) {
+    for (int k = 0; k < FUZZ_KEEP; k++) {
+        if (!kept[stage][k].text || ns > kept[stage][k].ns[stage]) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static int is_kept(const Input *in, int stage) {
+    for (int k = 0; k < FUZZ_KEEP; k++) {
+        if (kept[stage][k].text && kept[stage][k].len == in->len && !memcmp(kept[stage][k].text, in->text, in->len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void keep(const Input *in, int stage, int k) {
+    free(kept[stage][FUZZ_KEEP - 1].text);
+    memmove(&kept[stage][k + 1], &kept[stage][k], (FUZZ_KEEP - 1 - (size_t)k) * sizeof(Input));
+    kept[stage][k] = *in;
+    kept[stage][k].text = malloc(in->len ? in->len : 1);
+    if (!kept[stage][k].text) {
+        fprintf(stderr, "fuzz: out of memory\n");
+        exit(1);
+    }
+    memcpy(kept[stage][k].text, in->text, in->len);
+}
+
+static Input seeds[FUZZ_MAX_SEEDS];
+static int numSeeds;
+
+static void add_seed(char *text, size_t len, char *name) {
+    if (numSeeds < FUZZ_MAX_SEEDS) {
+        seeds[numSeeds].text = text;
+        seeds[numSeeds].len = len;
+        seeds[numSeeds++].name = name;
+    } else {
+        free(text);
+        free(name);
+    }
+}
+
+// the .tk files in `dir` (not the XOut.tk of bench/programs), as seeds or
+// as the list --check times
+static void load_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        size_t n = strlen(e->d_name);
+        if (n < 4 || strcmp(e->d_name + n - 3, ".tk") || (n >= 6 && !strcmp(e->d_name + n - 6, "Out.tk"))) {
+            continue;
+        }
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        LineReader r;
+        if (!reader_open(&r, path)) {
+            perror(path);
+            continue;
+        }
+        reader_slurp(&r);
+        char *text = malloc(r.size ? r.size : 1), *name = strndup(e->d_name, n - 3);
+        if (!text || !name) {
+            fprintf(stderr, "fuzz: out of memory\n");
+            exit(1);
+        }
+        memcpy(text, r.data, r.size);
+        add_seed(text, r.size, name);
+        reader_close(&r);
+    }
+    closedir(d);
+}
+
+// write the kept inputs into `dir`, with the stage they are slow in and
+// their content's hash as the name; returns how many files were new
+static int save_kept(const char *dir) {
+    int saved = 0;
+    mkdir(dir, 0777);
+    for (int s = 0; s < NUM_STAGES; s++) {
+        for (int k = 0; k < FUZZ_KEEP; k++) {
+            const Input *in = &kept[s][k];
+            int earlier = 0;
+            for (int t = 0; t < s; t++) {
+                earlier |= in->text && is_kept(in, t);
+            }
+            if (!in->text || earlier) {
+                continue;   // none, or written for the stage before
+            }
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s-%016llx.tk", dir, stageNames[s],
+                     (unsigned long long)block_hash(in->text, in->len));
+            if (access(path, F_OK) == 0) {
+                continue;
+            }
+            FILE *f = fopen(path, "w");
+            if (!f || fwrite(in->text, 1, in->len, f) != in->len || fclose(f) != 0) {
+                perror(path);
+                continue;
+            }
+            saved++;
+        }
+    }
+    return saved;
+}
+
+static void fuzz_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--iterations N] [--seconds S] [--seed S] [--max-bytes N] [--min-bytes N]\n"
+                    "          [--timeout S] [--corpus DIR] [--dir DIR] | --check DIR\n", prog);
+    fprintf(stderr, "  searches for the inputs slowest per byte in the lexer, pass1 and pass2 (default 2000\n");
+    fprintf(stderr, "  iterations, inputs of 4 KiB to 32 KiB, a 5 s timeout) and adds them to DIR (bench/slow)\n");
+    fprintf(stderr, "  --check DIR times each .tk file in DIR instead, in MB/s per stage\n");
+}
+
+static int check_corpus(const char *dir, unsigned timeout) {
+    load_dir(dir);
+    printf("%-32s %-6s %12s %10s\n", "file", "stage", "ns/byte", "MB/s");
+    for (int i = 0; i < numSeeds; i++) {
+        Input *in = &seeds[i];
+        if (!time_input(in, timeout)) {
+            return 1;
+        }
+        retime_input(in, timeout);
+        for (int s = 0; s < NUM_STAGES; s++) {
+            if (in->ns[s] > 0) {
+                printf("%-32s %-6s %12.2f %10.2f\n", in->name, stageNames[s], in->ns[s], 1e3 / in->ns[s]);
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 2000;
+    double seconds = 0;
+    size_t maxBytes = 32 * 1024, minBytes = 4 * 1024;
+    unsigned timeout = 5;
+    const char *corpus = "bench/slow", *check = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            rng_state = strtoull(argv[++i], NULL, 10) | 1;
+        } else if (!strcmp(argv[i], "--max-bytes") && i + 1 < argc) {
+            maxBytes = (size_t)atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--min-bytes") && i + 1 < argc) {
+            minBytes = (size_t)atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--timeout") && i + 1 < argc) {
+            timeout = (unsigned)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+            corpus = argv[++i];
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            workDir = argv[++i];
+        } else if (!strcmp(argv[i], "--check") && i + 1 < argc) {
+            check = argv[++i];
+        } else {
+            fuzz_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1 || timeout < 1 || maxBytes < minBytes || maxBytes > (1 << 24)) {
+        fuzz_usage(argv[0]);
+        return 1;
+    }
+    init_lexer();
+    hashKey[0] = hashKey[1] = 0;
+    if (check) {
+        return check_corpus(check, timeout);
+    }
+
+    // seeds: a block of each kind, the bench programs and the corpus so far
+    for (int kind = 0; kind < NUM_GENS; kind++) {
+        char *text;
+        size_t len;
+        FILE *f = open_memstream(&text, &len);
+        fputs(".code\n", f);
+        gen_block(f, kind, FUZZ_SEED_BYTES);
+        fputs("\thalt\n", f);
+        fclose(f);
+        add_seed(text, len, NULL);
+    }
+    load_dir("bench/programs");
+    load_dir(corpus);
+
+    double start = now();
+    long tried = 0, timed = 0;
+    for (; tried < iterations && (seconds <= 0 || now() - start < seconds); tried++) {
+        const Input *parent = &seeds[rng_below(numSeeds)];
+        int stage = rng_below(NUM_STAGES), k = rng_below(FUZZ_KEEP);
+        if (rng_below(4) && kept[stage][k].text) {
+            parent = &kept[stage][k];
+        }
+        Input in = { 0 };
+        mutate(&in, parent, &seeds[rng_below(numSeeds)], maxBytes);
+        if (in.len < minBytes || !time_input(&in, timeout)) {
+            free(in.text);
+            continue;
+        }
+        timed++;
+        int candidate = 0;
+        for (int s = 0; s < NUM_STAGES; s++) {
+            candidate |= slowest_slot(s, in.ns[s]) >= 0 && in.ns[s] > 0;
+        }
+        if (candidate) {
+            retime_input(&in, timeout);
+            for (int s = 0; s < NUM_STAGES; s++) {
+                int slot = slowest_slot(s, in.ns[s]);
+                if (slot >= 0 && in.ns[s] > 0 && !is_kept(&in, s)) {
+                    keep(&in, s, slot);
+                }
+            }
+        }
+        free(in.text);
+    }
+
+    printf("%ld inputs, %ld timed, %.1f s\n", tried, timed, now() - start);
+    printf("%-6s %4s %10s %12s %12s %12s\n", "stage", "rank", "bytes", "lex ns/B", "pass1 ns/B", "pass2 ns/B");
+    for (int s = 0; s < NUM_STAGES; s++) {
+        for (int k = 0; k < FUZZ_KEEP && kept[s][k].text; k++) {
+            const Input *in = &kept[s][k];
+            printf("%-6s %4d %10zu %12.2f %12.2f %12.2f\n", stageNames[s], k + 1, in->len,
+                   in->ns[STAGE_LEX], in->ns[STAGE_PASS1], in->ns[STAGE_PASS2]);
+        }
+    }
+    printf("%d new in %s\n", save_kept(corpus), corpus);
+    return 0;
+}
@@ -0,0 +1,317 @@
+/******************************************************************************
+ * Assembler micro-benchmarks:
+ * Calls single hot functions of the assembler directly on generated line
+ * corpora, so a change to one of them shows up on its own instead of in
+ * the noise of an end-to-end run. Every case runs its whole corpus per
+ * sample, after untimed warm-up passes, and reports nanoseconds per call:
+ * the fastest sample and the 50th, 90th and 99th percentiles.
+ *
+ * Where the assembler has a fast path next to the plain one, both are
+ * cases: the lexer with the block scanner's separator masks and without,
+ * expandLd's fixed 12 words and -O's shortest sequence, and label lookups
+ * by name, by the lexer's precomputed hash and through the frozen table
+ * pass 2 uses (built with LABELS_FROZEN, as build.sh does; add
+ * -DLABELS_UTHASH for the uthash label table).
+ *
+ * main.c is compiled in, like bench.c, so these are the functions hw4 runs.
+ ******************************************************************************/
+#define main hw4_main
+#include "main.c"
+#undef main
+
+#include <time.h>
+
+#define CORPUS_LINES 4096
+#define NUM_LABELS 4096
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static int rng_below(int n) {
+    return (int)(rng() % (uint64_t)n);
+}
+
+// lines of one kind: the raw text, the trimmed views with their masks, and
+// each lexed
+typedef struct {
+    char *text;
+    size_t size;
+    const char *raw[CORPUS_LINES];
+    size_t rawLen[CORPUS_LINES];
+    const char *line[CORPUS_LINES];
+    size_t len[CORPUS_LINES];
+    LineMasks masks[CORPUS_LINES];
+    TokenLine tokens[CORPUS_LINES];
+} Corpus;
+
+typedef enum { LINES_MIXED, LINES_MOV, LINES_MACRO } LineKind;
+
+static void gen_line(FILE *f, LineKind kind) {
+    int a = rng_below(31), b = rng_below(31), c = rng_below(31);
+    fputs(rng_below(2) ? "\t" : "    ", f);
+    int pick = kind == LINES_MOV ? rng_below(4) + 10 : kind == LINES_MACRO ? rng_below(6) + 20 : rng_below(26);
+    switch (pick) {
+    case 0: case 1: case 2: fprintf(f, "add r%d, r%d, r%d", a, b, c); break;
+    case 3: fprintf(f, "addi r%d, %d", a, rng_below(4096)); break;
+    case 4: fprintf(f, "shftli r%d, %d", a, rng_below(64)); break;
+    case 5: fprintf(f, "brgt r%d, r%d, r%d", a, b, c); break;
+    case 6: fprintf(f, "brr %d", rng_below(4096) - 2048); break;
+    case 7: fprintf(f, "mulf r%d, r%d, r%d", a, b, c); break;
+    case 8: fprintf(f, "xor r%d, r%d, r%d ; a comment", a, b, c); break;
+    case 9: fprintf(f, "not r%d, r%d", a, b); break;
+    case 10: fprintf(f, "mov r%d, (r%d)(%d)", a, b, rng_below(4096) - 2048); break;
+    case 11: fprintf(f, "mov r%d, r%d", a, b); break;
+    case 12: fprintf(f, "mov r%d, %d", a, rng_below(4096)); break;
+    case 13: fprintf(f, "mov (r%d)(%d), r%d", a, rng_below(4096) - 2048, b); break;
+    case 20: fprintf(f, "ld r%d, %llu", a, (unsigned long long)(rng() >> rng_below(64))); break;
+    case 21: fprintf(f, "ld r%d, :L%d", a, rng_below(NUM_LABELS)); break;
+    case 22: fprintf(f, "push r%d", a); break;
+    case 23: fprintf(f, "pop r%d", a); break;
+    case 24: fprintf(f, "clr r%d", a); break;
+    default: fprintf(f, "out r%d, r%d", a, b); break;
+    }
+    fputs(rng_below(4) ? "\n" : "  \n", f);
+}
+
+static void corpus_init(Corpus *c, LineKind kind) {
+    FILE *f = open_memstream(&c->text, &c->size);
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        gen_line(f, kind);
+    }
+    fclose(f);
+    LineReader r;
+    reader_view(&r, c->text, c->size);
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        size_t start = r.pos;
+        next_line(&r, &c->line[i], &c->len[i]);
+        c->raw[i] = c->text + start;
+        c->rawLen[i] = r.pos - start - 1;
+        c->masks[i] = r.masks;
+        lex_line(&c->tokens[i], c->line[i], c->len[i], &c->masks[i]);
+    }
+}
+
+static Corpus mixed, movs, macroLines;
+static Output out;
+static char labelNames[NUM_LABELS][16], missNames[NUM_LABELS][16];
+static size_t labelLens[NUM_LABELS];
+static uint32_t labelHashes[NUM_LABELS];
+static volatile uint64_t sink;
+
+// each case runs its corpus once and returns the calls it made
+static int case_trim(void) {
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        const char *p = mixed.raw[i];
+        size_t n = mixed.rawLen[i];
+        trim_view(&p, &n);
+        sink += n;
+    }
+    return CORPUS_LINES;
+}
+
+static int case_lex_masked(void) {
+    TokenLine t;
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        lex_line(&t, mixed.line[i], mixed.len[i], &mixed.masks[i]);
+        sink += (uint64_t)t.numTokens;
+    }
+    return CORPUS_LINES;
+}
+
+static int case_lex_scalar(void) {
+    TokenLine t;
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        lex_line(&t, mixed.line[i], mixed.len[i], NULL);
+        sink += (uint64_t)t.numTokens;
+    }
+    return CORPUS_LINES;
+}
+
+static int case_validate_mov(void) {
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        sink += (uint64_t)validate_mov(&movs.tokens[i]);
+    }
+    return CORPUS_LINES;
+}
+
+static int run_macros(int binary) {
+    out.binary = binary;
+    out.len = 0;
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        const TokenLine *t = &macroLines.tokens[i];
+        sink += (uint64_t)parseMacro(t, t->labelTok >= 0 ? 0x1000 + 8 * i : -1, 48, &out);
+        if (out.len > OUT_BUFFER_SIZE) {
+            out.len = 0;
+        }
+    }
+    return CORPUS_LINES;
+}
+
+static int case_macro_text(void) {
+    return run_macros(0);
+}
+
+static int case_macro_binary(void) {
+    return run_macros(1);
+}
+
+static int run_ld(int shortest) {
+    out.binary = 1;
+    out.len = 0;
+    uint64_t v = 0x123456789ABCDEFULL;
+    for (int i = 0; i < CORPUS_LINES; i++) {
+        v = v * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint64_t L = v >> (i & 63);
+        if (shortest) {
+            expandLdShort(i & 31, L, ld_size(L), &out);
+        } else {
+            expandLd(i & 31, L, &out);
+        }
+    }
+    sink += out.len;
+    return CORPUS_LINES;
+}
+
+static int case_ld(void) {
+    return run_ld(0);
+}
+
+static int case_ld_short(void) {
+    return run_ld(1);
+}
+
+static int case_find_label(void) {
+    for (int i = 0; i < NUM_LABELS; i++) {
+        sink += (uint64_t)(find_label(labelNames[(i * 2654435761u) % NUM_LABELS]) != NULL);
+    }
+    return NUM_LABELS;
+}
+
+static int case_find_label_miss(void) {
+    for (int i = 0; i < NUM_LABELS; i++) {
+        sink += (uint64_t)(find_label(missNames[i]) != NULL);
+    }
+    return NUM_LABELS;
+}
+
+static int case_lookup_hashed(void) {
+    for (int i = 0; i < NUM_LABELS; i++) {
+        int k = (int)((i * 2654435761u) % NUM_LABELS);
+        sink += lookup_label_id(labelNames[k], labelLens[k], labelHashes[k]);
+    }
+    return NUM_LABELS;
+}
+
+typedef struct {
+    const char *name;
+    int (*run)(void);
+    int frozen;     // run with the labels frozen
+} MicroCase;
+
+static const MicroCase cases[] = {
+    { "trim_view", case_trim, 0 },
+    { "lex_line/masked", case_lex_masked, 0 },
+    { "lex_line/scalar", case_lex_scalar, 0 },
+    { "validate_mov", case_validate_mov, 0 },
+    { "parseMacro/text", case_macro_text, 0 },
+    { "parseMacro/binary", case_macro_binary, 0 },
+    { "expandLd", case_ld, 0 },
+    { "expandLdShort", case_ld_short, 0 },
+    { "find_label", case_find_label, 0 },
+    { "find_label/miss", case_find_label_miss, 0 },
+    { "lookup/hashed", case_lookup_hashed, 0 },
+    { "lookup/frozen", case_lookup_hashed, 1 },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void micro_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--samples N] [--warmup N] [NAME...]\n", prog);
+    fprintf(stderr, "  runs the cases whose names start with a NAME (all without);\n");
+    fprintf(stderr, "  each sample is one pass over its corpus (default 200 samples, 20 warm-up passes)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int samples = 200, warmup = 20, first = argc;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            micro_usage(argv[0]);
+            return 1;
+        } else {
+            first = i;
+            break;
+        }
+    }
+    if (samples < 1 || warmup < 0) {
+        micro_usage(argv[0]);
+        return 1;
+    }
+    init_lexer();
+    for (int i = 0; i < NUM_LABELS; i++) {
+        labelLens[i] = (size_t)snprintf(labelNames[i], sizeof(labelNames[i]), "L%d", i);
+        labelHashes[i] = label_hash(labelNames[i], labelLens[i]);
+        add_label(labelNames[i], 0x1000 + 4 * i);
+        snprintf(missNames[i], sizeof(missNames[i]), "M%d", i);
+    }
+    corpus_init(&mixed, LINES_MIXED);
+    corpus_init(&movs, LINES_MOV);
+    corpus_init(&macroLines, LINES_MACRO);
+    open_memory_output(&out, 1);
+    out_reserve(&out, OUT_BUFFER_SIZE + 64 * 48);
+
+    double *ns = malloc((size_t)samples * sizeof(double));
+    if (!ns) {
+        fprintf(stderr, "micro: out of memory\n");
+        return 1;
+    }
+    printf("%-20s %10s %10s %10s %10s\n", "case", "min ns", "p50 ns", "p90 ns", "p99 ns");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        int wanted = first == argc;
+        for (int i = first; i < argc; i++) {
+            wanted |= !strncmp(cases[c].name, argv[i], strlen(argv[i]));
+        }
+        if (!wanted) {
+            continue;
+        }
+        if (cases[c].frozen) {
+            freeze_labels(1);
+        } else {
+            thaw_labels();
+        }
+        for (int i = 0; i < warmup; i++) {
+            cases[c].run();
+        }
+        for (int i = 0; i < samples; i++) {
+            double t0 = now();
+            int calls = cases[c].run();
+            ns[i] = (now() - t0) * 1e9 / calls;
+        }
+        qsort(ns, (size_t)samples, sizeof(double), compare_doubles);
+        printf("%-20s %10.2f %10.2f %10.2f %10.2f\n", cases[c].name, ns[0], ns[(samples - 1) / 2],
+               ns[(samples - 1) * 9 / 10], ns[(samples - 1) * 99 / 100]);
+        fflush(stdout);
+    }
+    thaw_labels();
+    free(ns);
+    return 0;
+}
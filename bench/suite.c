@@ -0,0 +1,162 @@
+/******************************************************************************
+ * Emulator benchmark suite:
+ * Runs the Tinker programs in bench/programs (or the .tk files given):
+ * sorting, a matrix multiply in doubles, hash table probing, recursive
+ * call/return and push/pop-heavy code. Each is assembled in memory through
+ * the library interface (tinker_assemble), timed, then its image is run
+ * under each execution tier, the interpreter alone (--no-jit) and with
+ * the JIT, best of --reps runs. Every run's output is checked against the
+ * first, so a tier that goes wrong shows up as a failure, not a speedup.
+ *
+ * The instructions a program executes are counted once with the profiler,
+ * which counts a fused ld, push or pop sequence as one; MIPS is that count
+ * over a tier's time. Like bench.c, main.c is compiled in, so these are the
+ * functions hw4 runs. Built and run by bench-suite.sh.
+ ******************************************************************************/
+#define main hw4_main
+#include "main.c"
+#undef main
+
+#include <time.h>
+
+static const char *defaultPrograms[] = { "sort.tk", "matmul.tk", "hash.tk", "fib.tk", "stack.tk" };
+
+enum { TIER_INTERP, TIER_JIT, NUM_TIERS };
+
+static const char *tierNames[] = { "interp", "jit" };
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// run `image` once, its `out` values into `out`; returns the wall time, and
+// the instructions executed in *executed if it isn't NULL (profiled, so
+// slower)
+static double run_image(const Output *image, int tier, Output *out, uint64_t *executed) {
+    Machine m;
+    Profile profile;
+    load_image(&m, (const unsigned char *)image->buf, image->len, -1);
+    open_memory_output(out, 0);
+    m.out = out;
+    if (executed) {
+        profile_init(&profile, m.pc);
+        m.profile = &profile;
+    }
+    Jit *jit = tier == TIER_JIT && !executed ? jit_create(1, 0) : NULL;
+    double t0 = now();
+    run_machine(&m, jit);
+    double t = now() - t0;
+    if (executed) {
+        *executed = profile.executed;
+        free_profile(&profile);
+    }
+    jit_free(jit);
+    unload_machine(&m);
+    return t;
+}
+
+// one row of the table for the program at `path`; 0 if it failed
+static int bench_program(const char *path, int reps) {
+    LineReader src;
+    if (!reader_open(&src, path)) {
+        perror(path);
+        return 0;
+    }
+    reader_slurp(&src);
+    long lines = 0;
+    for (size_t i = 0; i < src.size; i++) {
+        lines += src.data[i] == '\n';
+    }
+
+    TinkerContext *ctx = tinker_create();
+    TinkerOptions options = { 1, 0, -1, 0, 0, NULL };
+    const char *bytes;
+    size_t len;
+    double asmTime = 0;
+    for (int i = 0; i < reps; i++) {
+        double t0 = now();
+        if (tinker_assemble(ctx, src.data, src.size, &options, &bytes, &len) != TINKER_OK) {
+            fprintf(stderr, "bench: %s doesn't assemble:\n%s", path, tinker_messages(ctx));
+            tinker_free(ctx);
+            reader_close(&src);
+            return 0;
+        }
+        double t = now() - t0;
+        asmTime = i == 0 || t < asmTime ? t : asmTime;
+    }
+    Output image;
+    open_memory_output(&image, 1);
+    out_bytes(&image, bytes, len);
+    tinker_free(ctx);
+    reader_close(&src);
+
+    Output expected, out;
+    uint64_t executed;
+    run_image(&image, TIER_INTERP, &expected, &executed);
+    double best[NUM_TIERS];
+    int ok = 1;
+    for (int tier = 0; tier < NUM_TIERS; tier++) {
+        for (int i = 0; i < reps; i++) {
+            double t = run_image(&image, tier, &out, NULL);
+            best[tier] = i == 0 || t < best[tier] ? t : best[tier];
+            if (out.len != expected.len || memcmp(out.buf, expected.buf, out.len)) {
+                fprintf(stderr, "bench: %s printed something else under %s\n", path, tierNames[tier]);
+                ok = 0;
+            }
+            free(out.buf);
+        }
+    }
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    printf("%-12s %7ld %9.3f %12.1f %10.4f %9.1f %10.4f %9.1f\n", name, lines, asmTime * 1e3,
+           executed / 1e6, best[TIER_INTERP], executed / best[TIER_INTERP] / 1e6,
+           best[TIER_JIT], executed / best[TIER_JIT] / 1e6);
+    fflush(stdout);
+    free(expected.buf);
+    free(image.buf);
+    return ok;
+}
+
+static void suite_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--reps N] [--dir DIR] [program.tk...]\n", prog);
+    fprintf(stderr, "  runs DIR's suite (default bench/programs) unless programs are given;\n");
+    fprintf(stderr, "  times are the best of N runs (default 5)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = "bench/programs";
+    int reps = 5, first = argc;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1) {
+                fprintf(stderr, "bench: bad --reps '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (argv[i][0] == '-') {
+            suite_usage(argv[0]);
+            return 1;
+        } else {
+            first = i;
+            break;
+        }
+    }
+    printf("%-12s %7s %9s %12s %10s %9s %10s %9s\n", "program", "lines", "asm ms", "M insns",
+           "interp s", "MIPS", "jit s", "MIPS");
+    int ok = 1;
+    if (first < argc) {
+        for (int i = first; i < argc; i++) {
+            ok &= bench_program(argv[i], reps);
+        }
+    } else {
+        for (size_t i = 0; i < sizeof(defaultPrograms) / sizeof(defaultPrograms[0]); i++) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", dir, defaultPrograms[i]);
+            ok &= bench_program(path, reps);
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -1 +1,3 @@
-gcc -o hw4 main.c -I uthash-master/src
\ No newline at end of file
+gcc -o hw4 main.c -I uthash-master/src -pthread
+# micro-benchmarks of single assembler functions (see bench/micro.c)
+gcc -O2 -DLABELS_FROZEN -o bench/micro bench/micro.c -I . -I uthash-master/src -pthread
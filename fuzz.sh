@@ -0,0 +1,2 @@
+# assembler performance fuzzer, adding the slowest inputs it finds to bench/slow; arguments go to bench/fuzz (see --help)
+gcc -O2 -o bench/fuzz bench/fuzz.c -I . -I uthash-master/src -pthread && bench/fuzz "$@"
@@ -1,877 +1,15800 @@
+#define _GNU_SOURCE     // memfd_create
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
-#include <regex.h>
+#include <inttypes.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+#ifdef LABELS_UTHASH
+#define HASH_ALLOCATOR 1    // the label table lives in the label arena
+#endif
+// names from the source are hashed under a per-process key, and every
+// uthash table mixes a seed of its own into its bucket numbers (see "Hash
+// keys" below); --keyed-hash makes uthash's function SipHash-1-3
+static uint64_t hashKey[2];
+static int keyedHash = 0;
+static unsigned table_seed(const void *tbl);
+#define HASH_SEEDED 1
+#define uthash_table_seed(tbl) table_seed(tbl)
+#define HASH_SIP_KEY hashKey
+#define HASH_FUNCTION(keyptr, keylen, hashv) \
+    do {                                     \
+        if (keyedHash) {                     \
+            HASH_SIP(keyptr, keylen, hashv); \
+        } else {                             \
+            HASH_JEN(keyptr, keylen, hashv); \
+        }                                    \
+    } while (0)
+// uthash's tables, buckets and Bloom filters are counted for --stats
+static void *uthash_counted_malloc(size_t n);
+static void uthash_counted_free(void *p, size_t n);
+#define uthash_malloc(sz) uthash_counted_malloc(sz)
+#define uthash_free(ptr, sz) uthash_counted_free(ptr, sz)
 #include "uthash.h"
+#include "utqueue.h"
+#include "tinker.h"
+#ifdef TINKER_LIBRARY
+#define main tinker_main    // linked into another program, see tinker.h
+#endif
 
 /******************************************************************************
- * Label -> Address Map
+ * Statistics (--stats):
+ * Counters bumped while stats.enabled is set, and wall/CPU time per phase,
+ * printed to stderr at exit as text or JSON. Counters are added atomically
+ * since pass2 may run on several threads.
  ******************************************************************************/
+#define MAX_STAT_PHASES 8
+#define NUM_MACRO_KINDS 7   // halt, in, out, clr, ld, push, pop (in Opcode order)
+#define MEM_SIZE_CLASSES 48 // allocation sizes by power of two, the last one open
+
+// what an allocation counted by mem_alloc is for
+typedef enum {
+    MEM_LABELS,     // label arena, ids, the label table and its frozen form
+    MEM_UTHASH,     // uthash_malloc: the tables, buckets and Bloom filters of uthash maps
+    MEM_LINES,      // line reader buffers of streamed input
+    MEM_IR,         // pass1's records and the arrays beside them
+    NUM_MEM_KINDS
+} MemKind;
+
+static const char *memKindNames[NUM_MEM_KINDS] = { "labels", "uthash", "lines", "ir" };
+
 typedef struct {
-    char label[50];
-    int address;        // ie 0x1000 is stored as 4096 (in decimal)
-    UT_hash_handle hh;  // UTHash handle
-} LabelAddress;
+    uint64_t current, peak;     // bytes
+    uint64_t count;             // allocations, a grown array counting again
+} MemCounters;
+
+typedef struct {
+    const char *name;
+    double wall, cpu;
+    uint64_t lines, bytes;  // input read during the phase
+} StatPhase;
 
-static LabelAddress *hashmap = NULL;
+static struct {
+    int enabled;
+    int json;
+    StatPhase phases[MAX_STAT_PHASES];
+    int numPhases;
+    double wallStart, cpuStart;
+    uint64_t lines, bytes;
+    uint64_t macros[NUM_MACRO_KINDS];
+    uint64_t lookups, probes, maxProbe;
+    uint64_t emitted;
+    int scheduled;                      // --schedule ran
+    uint64_t stallsBefore, stallsAfter; // of its runs, see schedule_ir
+    uint64_t includesParsed, includesReused;    // .include units, see include_file
+    MemCounters mem[NUM_MEM_KINDS];
+    uint64_t memCurrent, memPeak;       // of all kinds together
+    uint64_t memSizes[MEM_SIZE_CLASSES];    // class k: up to 2^k bytes
+} stats;
 
-// add a label to the hash map.
-static void add_label(const char *label, int address) {
-    LabelAddress *entry = (LabelAddress *)malloc(sizeof(LabelAddress));
-    if (!entry) {
-        fprintf(stderr, "Error: malloc failed in add_label.\n");
-        return;
+static void stat_add(uint64_t *counter, uint64_t n) {
+    if (stats.enabled) {
+        __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
     }
-    strncpy(entry->label, label, sizeof(entry->label) - 1);
-    entry->label[sizeof(entry->label) - 1] = '\0';
-    entry->address = address;
-    HASH_ADD_STR(hashmap, label, entry);
 }
 
-// find a label by name.
-static LabelAddress *find_label(const char *label) {
-    LabelAddress *entry;
-    HASH_FIND_STR(hashmap, label, entry);
-    return entry;
+static void stat_max(uint64_t *counter, uint64_t v) {
+    uint64_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(counter, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
 }
 
-// free the hashmap
-static void free_hashmap(void) {
-    LabelAddress *cur, *tmp;
-    HASH_ITER(hh, hashmap, cur, tmp) {
-        HASH_DEL(hashmap, cur);
-        free(cur);
+// one label lookup that looked at `probes` slots (0 if the backend can't tell)
+static void count_probes(uint64_t probes) {
+    if (stats.enabled) {
+        stat_add(&stats.lookups, 1);
+        stat_add(&stats.probes, probes);
+        stat_max(&stats.maxProbe, probes);
     }
 }
 
-/******************************************************************************
- * Trim leading/trailing whitespace in-place.
- ******************************************************************************/
-static void trim(char *s) {
-    char *p = s;
-    while (isspace((unsigned char)*p)) {
-        p++;
-    }
-    if (p != s) {
-        memmove(s, p, strlen(p) + 1);
+static double clock_seconds(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void stats_begin(const char *name) {
+    if (!stats.enabled || stats.numPhases == MAX_STAT_PHASES) {
+        return;
     }
-    size_t len = strlen(s);
-    while (len > 0 && isspace((unsigned char)s[len - 1])) {
-        s[len - 1] = '\0';
-        len--;
+    StatPhase *p = &stats.phases[stats.numPhases];
+    p->name = name;
+    p->lines = stats.lines;
+    p->bytes = stats.bytes;
+    stats.wallStart = clock_seconds(CLOCK_MONOTONIC);
+    stats.cpuStart = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static void stats_end(void) {
+    if (!stats.enabled || stats.numPhases == MAX_STAT_PHASES) {
+        return;
     }
+    StatPhase *p = &stats.phases[stats.numPhases++];
+    p->wall = clock_seconds(CLOCK_MONOTONIC) - stats.wallStart;
+    p->cpu = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - stats.cpuStart;
+    p->lines = stats.lines - p->lines;
+    p->bytes = stats.bytes - p->bytes;
 }
 
 /******************************************************************************
- * Helper functions to parse 12-bit ranges
+ * Memory accounting (--stats):
+ * The containers that grow with the input note what they allocate and free,
+ * in bytes, by MemKind: current and peak use, the allocations made and their
+ * sizes. uthash's own allocations come through uthash_malloc and uthash_free,
+ * which are defined to count themselves above its #include. Nothing is
+ * counted unless stats.enabled, which is set before any work starts, so
+ * every free matches a counted allocation.
  ******************************************************************************/
-static int parse_signed_12_bit(const char *str, int *valueOut) {
-    errno = 0;
-    long val = strtol(str, NULL, 0); // allow 0x prefix
-    if ((errno == ERANGE) || (val < -2048) || (val > 2047)) {
-        return 0; // Out of range
+static void mem_alloc(MemKind kind, size_t n) {
+    if (!stats.enabled) {
+        return;
     }
-    *valueOut = (int)val;
-    return 1;
+    MemCounters *c = &stats.mem[kind];
+    stat_max(&c->peak, __atomic_add_fetch(&c->current, n, __ATOMIC_RELAXED));
+    stat_max(&stats.memPeak, __atomic_add_fetch(&stats.memCurrent, n, __ATOMIC_RELAXED));
+    stat_add(&c->count, 1);
+    int k = n > 1 ? 64 - __builtin_clzll((uint64_t)n - 1) : 0;
+    stat_add(&stats.memSizes[k < MEM_SIZE_CLASSES ? k : MEM_SIZE_CLASSES - 1], 1);
 }
 
-static int parse_unsigned_12_bit(const char *str, int *valueOut) {
-    errno = 0;
-    unsigned long val = strtoul(str, NULL, 0); // allow 0x prefix
-    if ((errno == ERANGE) || (val > 4095)) {
-        return 0; // Out of range
+static void mem_free(MemKind kind, size_t n) {
+    if (stats.enabled && n) {
+        __atomic_sub_fetch(&stats.mem[kind].current, n, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&stats.memCurrent, n, __ATOMIC_RELAXED);
     }
-    *valueOut = (int)val;
-    return 1;
 }
 
-/******************************************************************************
- * Macros used in PASS 1 to detect expansions (e.g., ld, push, pop)
- * so we can increment PC by the correct byte-count.
- ******************************************************************************/
-static int starts_with_ld(const char *line) {
-    while (isspace((unsigned char)*line)) { line++; }
-    if (strncmp(line, "ld", 2) == 0) {
-        char c = line[2];
-        if (c == '\0' || isspace((unsigned char)c) || c == ',') {
-            return 1;
-        }
-    }
-    return 0;
+// an array that grew (or was first allocated, from 0) from `from` to `to` bytes
+static void mem_resize(MemKind kind, size_t from, size_t to) {
+    mem_free(kind, from);
+    mem_alloc(kind, to);
 }
 
-static int starts_with_push(const char *line) {
-    while (isspace((unsigned char)*line)) { line++; }
-    if (!strncmp(line, "push", 4)) {
-        char c = line[4];
-        if (c == '\0' || isspace((unsigned char)c)) {
-            return 1;
-        }
+static void *uthash_counted_malloc(size_t n) {
+    void *p = malloc(n);
+    if (p) {
+        mem_alloc(MEM_UTHASH, n);
     }
-    return 0;
+    return p;
 }
 
-static int starts_with_pop(const char *line) {
-    while (isspace((unsigned char)*line)) { line++; }
-    if (!strncmp(line, "pop", 3)) {
-        char c = line[3];
-        if (c == '\0' || isspace((unsigned char)c)) {
-            return 1;
-        }
+static void uthash_counted_free(void *p, size_t n) {
+    if (p) {
+        mem_free(MEM_UTHASH, n);
+        free(p);
     }
-    return 0;
 }
 
 /******************************************************************************
- * validate_brr: brr has two forms:
- *   brr rX  (pc ← pc + rX)  opcode 0x9
- *   brr L   (pc ← pc + L)   opcode 0xa, L can be negative
+ * Diagnostics:
+ * The assembler reports through diag() and gives up through fail() rather
+ * than writing to stderr and calling exit(1), so that a batch assembly job
+ * (--batch --assemble) collects its own messages and ends alone while the
+ * other jobs go on. Outside a job they are just stderr and exit(1). The
+ * worker threads of -j and --pipeline report to the stream of the thread
+ * that started them.
  ******************************************************************************/
-static int validate_brr(const char *line) {
-    char op[32], operand[64];
-    int count = sscanf(line, "%31s %63[^\n]", op, operand);
-    if (count < 2) {
-        fprintf(stderr, "Error: 'brr' missing operand: %s\n", line);
-        return 0;
+typedef struct {
+    jmp_buf env;
+    int outFd;          // the job's open output, -1 if none, closed on failure
+    char *outBuf;
+} AsmTrap;
+
+static __thread AsmTrap *asmTrap;
+static __thread FILE *diagStream;   // where diag() goes, NULL for stderr
+static __thread char *outputTmp;    // --if-changed: the output being written, removed on failure
+
+static FILE *diag(void) {
+    return diagStream ? diagStream : stderr;
+}
+
+// perror, to diag()
+static void diag_errno(const char *what) {
+    fprintf(diag(), "%s: %s\n", what, strerror(errno));
+}
+
+static void fail(void) __attribute__((noreturn));
+
+static void fail(void) {
+    if (outputTmp) {
+        remove(outputTmp);
+        free(outputTmp);
+        outputTmp = NULL;
     }
-    if (operand[0] == 'r') {
-        // brr rX form
-        int rd = atoi(operand + 1);
-        if (rd < 0 || rd > 31) {
-            fprintf(stderr, "Error: 'brr r%d' invalid register.\n", rd);
-            return 0;
-        }
-        return 1; // valid
-    } else {
-        // brr L form => L is signed 12-bit
-        int val;
-        if (!parse_signed_12_bit(operand, &val)) {
-            fprintf(stderr, "Error: 'brr' literal out of [-2048..2047]: %s\n", operand);
-            return 0;
-        }
-        return 1;
+    if (asmTrap) {
+        longjmp(asmTrap->env, 1);
     }
+    exit(1);
 }
 
 /******************************************************************************
- * validate_mov: Tinker has 4 forms of mov:
- *  1) mov rD, (rS)(L)   => 0x10
- *  2) mov rD, rS        => 0x11
- *  3) mov rD, L         => 0x12
- *  4) mov (rD)(L), rS   => 0x13
- * We'll parse them in pass1 to ensure correct usage and immediate range.
- ******************************************************************************/
-static int validate_mov(const char *line) {
-   
-    // quick tokenize
-    char op[32], part1[64], part2[64];
-    int count = sscanf(line, "%31s %63[^,], %63[^\n]", op, part1, part2);
-
-    // if count < 2 => invalid "mov"
-    if (count < 2) {
-        fprintf(stderr, "Error: incomplete 'mov' instruction: %s\n", line);
-        return 0;
-    }
-
-    // if count=2
-    if (count == 2) {
-        char second[64] = {0};
-        if (sscanf(part1, "%63s %63s", part1, second) == 2) {
-            strcpy(part2, second);
-            count = 3;
-        }
-    }
-
-    // have possibly 3 tokens: op, part1, part2
-    // remove trailing spaces or commas from part1, part2
-    {
-        // trim front
-        char *p = part1; 
-        while (isspace((unsigned char)*p) || *p == ',') p++;
-        if (p != part1) memmove(part1, p, strlen(p)+1);
-        p = part2;
-        while (isspace((unsigned char)*p) || *p == ',') p++;
-        if (p != part2) memmove(part2, p, strlen(p)+1);
-        // trim end
-        for (int i = (int)strlen(part1)-1; i >= 0; i--) {
-            if (isspace((unsigned char)part1[i]) || part1[i] == ',') part1[i] = '\0'; else break;
-        }
-        for (int i = (int)strlen(part2)-1; i >= 0; i--) {
-            if (isspace((unsigned char)part2[i]) || part2[i] == ',') part2[i] = '\0'; else break;
-        }
-    }
-
-    // see which form it might be:
-    //  (a) mov rD, rS
-    //  (b) mov rD, L
-    //  (c) mov rD, (rS)(L)
-    //  (d) mov (rD)(L), rS
-    //
-    // detect (d) if part1 starts with '(' or we see "(". 
-    // detect (c) if part2 starts with '('
-    // detect (a) if both part1 and part2 are registers
-    // detect (b) if part1 is register, part2 is immediate
-    //
-
-    // If "part1" starts with '(' => form (d)
-    if (part1[0] == '(') {
-        // (d) mov (rD)(L), rS
-        // part1 => e.g. "(r5)(-8)"
-        // part2 => e.g. "r6"
-        // check part2 is register
-        if (part2[0] != 'r') {
-            fprintf(stderr, "Error: 'mov (rD)(L), rS' => 'rS' is not a register? %s\n", line);
-            return 0;
-        }
-        int rS = atoi(part2+1);
-        if (rS < 0 || rS > 31) {
-            fprintf(stderr, "Error: register out of range in mov (rD)(L), rS => %s\n", line);
-            return 0;
-        }
-        // parse part1 => e.g. "(r5)(-8)"
-        // find rD in the parentheses
-        char *p = strstr(part1, "r");
-        if (!p) {
-            fprintf(stderr, "Error: 'mov (rD)(L), rS': can't find register in %s\n", part1);
-            return 0;
-        }
-        int rD = atoi(p+1);
-        if (rD < 0 || rD > 31) {
-            fprintf(stderr, "Error: 'mov (rD)(L), rS': register out of range => %s\n", line);
-            return 0;
-        }
-        p = strchr(p, '(');
-        if (!p) {
-            fprintf(stderr, "Error: 'mov (rD)(L), rS': missing offset => %s\n", line);
-            return 0;
-        }
-        // p should point to "(" that encloses the offset
-        p++; // skip '('
-        char offsetBuf[32];
-        int i=0;
-        while (*p && *p != ')' && i < 31) {
-            offsetBuf[i++] = *p++;
-        }
-        offsetBuf[i] = '\0';
-        // offsetBuf might be "-8" or "12"
-        // assume signed 12-bit
-        int offsetVal;
-        if (!parse_signed_12_bit(offsetBuf, &offsetVal)) {
-            fprintf(stderr, "Error: offset out of [-2048..2047] in 'mov (rD)(L), rS' => %s\n", offsetBuf);
-            return 0;
-        }
-        // passes validation
-        return 1; 
-    }
+ * Huge pages:
+ * 100M-line inputs put tens of GB in the IR, the label tables and the
+ * memory outputs, and walking them misses the TLB on every 4 KB page. Every
+ * allocation of HUGE_MIN or more is therefore advised MADV_HUGEPAGE, and
+ * label arena blocks that large are mapped with MAP_HUGETLB when the system
+ * has huge pages reserved. Kernels without either just say no and the
+ * memory stays in small pages. A grown array also has the stretch ahead of
+ * its end pre-faulted by a short-lived thread (MADV_POPULATE_WRITE), so
+ * pass1 and the outputs it fills don't stop at each new page.
+ ******************************************************************************/
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#define HUGE_MIN (4 * HUGE_PAGE_SIZE)       // smaller allocations keep small pages
+#define PREFAULT_MAX ((size_t)256 << 20)    // bytes pre-faulted ahead of a grown array
 
-    // otherwise, part1 is presumably "rD"
-    if (part1[0] != 'r') {
-        fprintf(stderr, "Error: mov => expected 'rD' or '(rD)(L)' => got: %s\n", part1);
-        return 0;
-    }
-    int rD = atoi(part1+1);
-    if (rD < 0 || rD > 31) {
-        fprintf(stderr, "Error: register out of range in mov => %s\n", line);
-        return 0;
-    }
+static int noHugetlb;   // MAP_HUGETLB failed once, don't ask again
 
-    // if count < 3 => incomplete
-    if (count < 3) {
-        fprintf(stderr, "Error: incomplete 'mov' => missing second operand: %s\n", line);
-        return 0;
+// ask for huge pages on the 2 MB pages wholly inside [p, p + n)
+static void advise_huge(void *p, size_t n) {
+#ifdef MADV_HUGEPAGE
+    uintptr_t start = ((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)p + n) & ~(HUGE_PAGE_SIZE - 1);
+    if (n >= HUGE_MIN && end > start) {
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
     }
+#else
+    (void)p;
+    (void)n;
+#endif
+}
 
-    // check part2
-    if (part2[0] == 'r') {
-        // (a) mov rD, rS
-        // ie "mov r5, r6"
-        int rS = atoi(part2+1);
-        if (rS < 0 || rS > 31) {
-            fprintf(stderr, "Error: register out of range => %s\n", line);
-            return 0;
+// `n` bytes (a multiple of HUGE_PAGE_SIZE) of zeroed memory, for munmap;
+// NULL if out of memory
+static void *huge_map(size_t n) {
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (!__atomic_load_n(&noHugetlb, __ATOMIC_RELAXED)) {
+        p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            __atomic_store_n(&noHugetlb, 1, __ATOMIC_RELAXED);
         }
-        // Valid
-        return 1;
     }
-    else if (part2[0] == '(') {
-        // (c) mov rD, (rS)(L)
-        // parse the memory form
-        // ie part2="(r6)(-8)"
-        char *p = strstr(part2, "r");
-        if (!p) {
-            fprintf(stderr, "Error: can't find register in 'mov rD, (rS)(L)' => %s\n", line);
-            return 0;
-        }
-        int rS = atoi(p+1);
-        if (rS < 0 || rS > 31) {
-            fprintf(stderr, "Error: register out of range in 'mov rD, (rS)(L)' => %s\n", line);
-            return 0;
-        }
-        p = strchr(p, '(');
-        if (!p) {
-            fprintf(stderr, "Error: missing offset => %s\n", line);
-            return 0;
-        }
-        p++; // skip '('
-        char offsetBuf[32];
-        int i=0;
-        while (*p && *p != ')' && i < 31) {
-            offsetBuf[i++] = *p++;
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
         }
-        offsetBuf[i] = '\0';
-        // parse offset as signed 12-bit
-        int offsetVal;
-        if (!parse_signed_12_bit(offsetBuf, &offsetVal)) {
-            fprintf(stderr, "Error: offset out of [-2048..2047] => %s\n", offsetBuf);
-            return 0;
-        }
-        return 1; 
+        advise_huge(p, n);
     }
-    else {
-        // (b) mov rD, L
-        // We assume an unsigned 12-bit literal for bits 52..63
-        // ie "mov r5, 100"
-        int val;
-        if (!parse_unsigned_12_bit(part2, &val)) {
-            fprintf(stderr, "Error: mov rD, L => L out of [0..4095]: %s\n", part2);
-            return 0;
-        }
-        return 1;
+    return p;
+}
+
+#ifdef MADV_POPULATE_WRITE
+typedef struct {
+    void *start;
+    size_t len;
+} Prefault;
+
+static void *prefault_thread(void *arg) {
+    Prefault pf = *(Prefault *)arg;
+    free(arg);
+    // only faults pages in: harmless if the owner has moved on meanwhile
+    madvise(pf.start, pf.len, MADV_POPULATE_WRITE);
+    return NULL;
+}
+#endif
+
+// fault in the pages of [p, p + n), up to PREFAULT_MAX, on another thread
+static void prefault_async(void *p, size_t n) {
+#ifdef MADV_POPULATE_WRITE
+    uintptr_t start = ((uintptr_t)p + 4095) & ~(uintptr_t)4095;
+    uintptr_t end = ((uintptr_t)p + (n < PREFAULT_MAX ? n : PREFAULT_MAX)) & ~(uintptr_t)4095;
+    Prefault *pf = end > start ? malloc(sizeof(Prefault)) : NULL;
+    if (!pf) {
+        return;
+    }
+    pf->start = (void *)start;
+    pf->len = end - start;
+    pthread_attr_t attr;
+    pthread_t t;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, 64 << 10);
+    if (pthread_create(&t, &attr, prefault_thread, pf) != 0) {
+        free(pf);
     }
+    pthread_attr_destroy(&attr);
+#else
+    (void)p;
+    (void)n;
+#endif
 }
 
 /******************************************************************************
- * For addi, subi, shftri, shftli => 0..4095
- * For everything else with literal => separate checks (brr, mov, etc.)
+ * Label arena:
+ * Label entries and their names are bump-allocated from blocks that double
+ * up to ARENA_BLOCK_MAX (the big ones on huge pages), the name stored right
+ * behind its entry, and released all at once at exit.
+ * Like the label table, the arena, the image segments and the IR are per
+ * thread, so batch assembly jobs on different threads don't share them.
  ******************************************************************************/
-static int validate_instruction_immediate(const char *line) {
-    // do a quick parse: opcode, rD, immediate
-    char op[32], rdPart[32], immPart[64];
-    int count = sscanf(line, "%31s %31s %63[^\n]", op, rdPart, immPart);
-    if (count < 2) return 1; // we won't call it invalid here
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define ARENA_BLOCK_MAX ((size_t)64 << 20)
 
-    if (!strcmp(op, "addi") || !strcmp(op, "subi") || 
-        !strcmp(op, "shftri") || !strcmp(op, "shftli")) 
-    {
-        // must have an unsigned 12-bit immediate
-        if (count < 3) {
-            fprintf(stderr, "Error: missing immediate => %s\n", line);
-            return 0;
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t cap;
+    size_t mapped;  // bytes huge_map'ed, 0 if malloc'ed
+    char data[];
+} ArenaBlock;
+
+static __thread ArenaBlock *labelArena = NULL;
+
+// `n` bytes aligned for any label entry, NULL if out of memory
+static void *arena_alloc(size_t n) {
+    n = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (!labelArena || labelArena->cap - labelArena->used < n) {
+        size_t cap = !labelArena ? ARENA_BLOCK_SIZE
+                   : labelArena->cap >= ARENA_BLOCK_MAX / 2 ? ARENA_BLOCK_MAX : labelArena->cap * 2;
+        cap = n > cap ? n : cap;
+        size_t mapped = 0;
+        ArenaBlock *block;
+        if (sizeof(ArenaBlock) + cap >= HUGE_MIN) {
+            mapped = (sizeof(ArenaBlock) + cap + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+            block = huge_map(mapped);
+            cap = mapped - sizeof(ArenaBlock);
+        } else {
+            block = malloc(sizeof(ArenaBlock) + cap);
         }
-        // rdPart => "rD"
-        if (rdPart[0] != 'r') return 0;
-        int rD = atoi(rdPart+1);
-        if (rD < 0 || rD > 31) {
-            fprintf(stderr, "Error: register out of range => %s\n", line);
-            return 0;
+        if (!block) {
+            return NULL;
         }
-        // immPart might have a leading comma
-        char *p = immPart;
-        while (*p == ',' || isspace((unsigned char)*p)) p++;
-        int val;
-        if (!parse_unsigned_12_bit(p, &val)) {
-            fprintf(stderr, "Error: %s => immediate out of [0..4095]: %s\n", op, p);
-            return 0;
+        mem_alloc(MEM_LABELS, mapped ? mapped : sizeof(ArenaBlock) + cap);
+        block->next = labelArena;
+        block->used = 0;
+        block->cap = cap;
+        block->mapped = mapped;
+        labelArena = block;
+    }
+    void *p = labelArena->data + labelArena->used;
+    labelArena->used += n;
+    return p;
+}
+
+static void arena_release(void) {
+    while (labelArena) {
+        ArenaBlock *next = labelArena->next;
+        mem_free(MEM_LABELS, labelArena->mapped ? labelArena->mapped : sizeof(ArenaBlock) + labelArena->cap);
+        if (labelArena->mapped) {
+            munmap(labelArena, labelArena->mapped);
+        } else {
+            free(labelArena);
         }
-        return 1;
+        labelArena = next;
     }
-    // fallback => do nothing
-    return 1;
 }
 
 /******************************************************************************
- * is_valid_instruction_pass1: check opcode and specialized forms (brr, mov, etc.)
+ * Hash keys:
+ * Label, equ and macro names come from the source, and with a fixed hash a
+ * crafted program could pile its labels onto one Robin Hood probe run or
+ * uthash chain and make every lookup walk it. So hashKey is drawn from
+ * getrandom once per process (init_lexer): label_hash starts its FNV-1a
+ * from it, so collisions can't be worked out ahead of time, and each uthash
+ * table's seed (HASH_SEEDED) is mixed from it and the table's address. FNV
+ * is a weak keyed hash though; --keyed-hash is for sources that can't be
+ * trusted, hashing every name with SipHash-1-3 under the key: slower per
+ * name, but then no collision can be chosen at all. Nothing printed
+ * depends on the key, since labels are sorted wherever table order would
+ * show; only --stats' probe counts vary from run to run.
  ******************************************************************************/
-static int is_valid_instruction_pass1(const char *line) {
-    char op[32];
-    if (sscanf(line, "%31s", op) != 1) {
-        return 0;
-    }
-    const char *ops[] = {
-        "add","addi","sub","subi","mul","div",
-        "and","or","xor","not","shftr","shftri","shftl","shftli",
-        "br","brr","brnz","call","return","brgt",
-        "addf","subf","mulf","divf",
-        "mov",
-        "halt",
-        "in","out","clr","ld","push","pop"
-    };
-    int recognized = 0;
-    int n = (int)(sizeof(ops)/sizeof(ops[0]));
-    for (int i = 0; i < n; i++) {
-        if (!strcmp(op, ops[i])) {
-            recognized = 1;
-            break;
-        }
-    }
-    if (!recognized) {
-        return 0;
+static void init_hash_key(void) {
+    if (getrandom(hashKey, sizeof(hashKey), GRND_NONBLOCK) != (ssize_t)sizeof(hashKey)) {
+        // no entropy yet (early boot) or no getrandom: the clock and the
+        // addresses address space randomization moves
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        hashKey[0] = (uint64_t)ts.tv_nsec * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)&ts;
+        hashKey[1] = (uint64_t)ts.tv_sec * 0xbf58476d1ce4e5b9ull ^ (uint64_t)(uintptr_t)hashKey ^ (uint64_t)getpid();
     }
+}
 
-    if (!strcmp(op, "brr")) {
-        if (!validate_brr(line)) {
-            return 0;
-        }
+static unsigned table_seed(const void *tbl) {
+    return HASH_SEED_MIX((unsigned)hashKey[1], (unsigned)((uintptr_t)tbl >> 4));
+}
+
+/******************************************************************************
+ * Label -> Address Map
+ * The default is a flat Robin Hood table; build with -DLABELS_UTHASH to use
+ * the uthash map instead. Either way entries live in the label arena, so
+ * pointers returned by add_label stay valid until free_hashmap.
+ * Every entry is interned to a dense id as it is added, and its address
+ * lives at that id in labelAddresses, a flat array: the IR resolves each
+ * reference to an id once and reads the address with one load from then
+ * on. Id 0 is no label, its address -1, so an undefined reference needs
+ * no test.
+ * label_hash is the backend's own hash; the lexer stores it in every label
+ * token so a reference is looked up without hashing the name again.
+ * Each thread has its own table; the pass 2 workers of -j and --pipeline
+ * look labels up in the table of the thread that started them, which hands
+ * it over with share_labels / use_labels.
+ ******************************************************************************/
+static __thread int *labelAddresses = NULL;    // by id, ie 0x1000 is stored as 4096 (in decimal)
+static __thread size_t numLabelIds = 0, capLabelIds = 0;
+
+// room for one more id, id 0 included; 0 if out of memory
+static int grow_label_ids(void) {
+    if (numLabelIds < capLabelIds) {
         return 1;
     }
-    else if (!strcmp(op, "mov")) {
-        // parse the line for any of the 4 forms
-        if (!validate_mov(line)) {
-            return 0;
-        }
-        return 1;
+    size_t cap = capLabelIds ? capLabelIds * 2 : 1024;
+    int *grown = cap <= UINT32_MAX ? realloc(labelAddresses, cap * sizeof(int)) : NULL;
+    if (!grown) {
+        return 0;
     }
+    mem_resize(MEM_LABELS, capLabelIds * sizeof(int), cap * sizeof(int));
+    labelAddresses = grown;
+    capLabelIds = cap;
+    advise_huge(grown, cap * sizeof(int));
+    if (numLabelIds == 0) {
+        labelAddresses[numLabelIds++] = -1;
+    }
+    return 1;
+}
 
-    // for addi, subi, etc.
-    if (!validate_instruction_immediate(line)) {
+// a new id with `address`, 0 if out of memory
+static uint32_t new_label_id(int address) {
+    if (!grow_label_ids()) {
         return 0;
     }
+    labelAddresses[numLabelIds] = address;
+    return (uint32_t)numLabelIds++;
+}
 
-    return 1;
+static void free_label_ids(void) {
+    mem_free(MEM_LABELS, capLabelIds * sizeof(int));
+    free(labelAddresses);
+    labelAddresses = NULL;
+    numLabelIds = capLabelIds = 0;
 }
 
-/******************************************************************************
- * PASS 1: Gather labels, track the program counter, ensure valid instructions.
- ******************************************************************************/
-static void pass1(const char *filename) {
-    FILE *fin = fopen(filename, "r");
-    if (!fin) {
-        perror("pass1: fopen");
-        exit(1);
+// the labels frozen for pass 2 (see freeze_labels), NULL while they may change
+typedef struct FrozenLabels FrozenLabels;
+static __thread FrozenLabels *frozenLabels = NULL;
+static void thaw_labels(void);
+
+#ifdef LABELS_UTHASH
+
+typedef struct {
+    const char *label;  // interned in the label arena
+    uint32_t id;        // its address is labelAddresses[id]
+    UT_hash_handle hh;  // UTHash handle
+} LabelAddress;
+
+static __thread LabelAddress *hashmap = NULL;
+static __thread size_t labelReserve = 0;    // buckets to reserve once the table exists
+
+// the table and its buckets come from the label arena too, so free_hashmap
+// drops them with the entries; arrays left behind by an expansion stay in
+// the arena until then
+static void *label_table_malloc(void *ctx, size_t sz) {
+    (void)ctx;
+    return arena_alloc(sz);
+}
+
+static void label_table_free(void *ctx, void *ptr, size_t sz) {
+    (void)ctx;
+    (void)ptr;
+    (void)sz;
+}
+
+static const UT_hash_allocator labelTableAllocator = {
+    label_table_malloc, label_table_free, NULL
+};
+#undef uthash_table_allocator
+#define uthash_table_allocator(head) (&labelTableAllocator)
+
+// the hash uthash itself uses (HASH_FUNCTION)
+static uint32_t label_hash(const char *s, size_t len) {
+    unsigned hashv;
+    HASH_VALUE(s, len, hashv);
+    return hashv;
+}
+
+// add a label by its `len`-byte name and hash, returns the new entry (NULL if
+// out of memory).
+static LabelAddress *add_label_hashed(const char *label, size_t len, uint32_t hash, int address) {
+    thaw_labels();
+    LabelAddress *entry = arena_alloc(sizeof(LabelAddress) + len + 1);
+    if (!entry) {
+        fprintf(diag(), "Error: malloc failed in add_label.\n");
+        return NULL;
     }
-    enum { NONE, CODE, DATA } section = NONE;
-    int programCounter = 0x1000; // tinker code starts at address 0x1000
+    entry->id = new_label_id(address);
+    if (!entry->id) {
+        fprintf(diag(), "Error: malloc failed in add_label.\n");
+        return NULL;
+    }
+    char *name = (char *)(entry + 1);
+    memcpy(name, label, len);
+    name[len] = '\0';
+    entry->label = name;
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, hashmap, name, len, hash, entry);
+    if (labelReserve) {
+        // uthash has no table until the first add
+        HASH_RESERVE(hh, hashmap, labelReserve);
+        labelReserve = 0;
+    }
+    return entry;
+}
 
-    char line[1024];
-    while (fgets(line, sizeof(line), fin)) {
-        line[strcspn(line, "\n")] = '\0';
-        trim(line);
-        if (!line[0] || line[0] == ';') {
-            continue;
-        }
-        // check for disrectives.
-        if (line[0] == '.') {
-            if (!strncmp(line, ".code", 5)) {
-                section = CODE;
-            }
-            else if (!strncmp(line, ".data", 5)) {
-                section = DATA;
-            }
-            continue;
-        }
-        // label definition.
-        if (line[0] == ':') {
-            char labelName[50];
-            if (sscanf(line + 1, "%49s", labelName) == 1) {
-                add_label(labelName, programCounter);
-            }
-            continue;
-        }
-        // process instructions/data
-        if (section == CODE) {
-            // validate the instruction
-            if (!is_valid_instruction_pass1(line)) {
-                fprintf(stderr, "pass1 error: invalid line => %s\n", line);
-                fclose(fin);
-                exit(1);
-            }
-            // macros expansions for pass1 counting:
-            if (starts_with_ld(line)) {
-                // ld => expands to 48 bytes
-                programCounter += 48;
-            }
-            else if (starts_with_push(line)) {
-                // push => expands to 8 bytes
-                programCounter += 8;
-            }
-            else if (starts_with_pop(line)) {
-                // pop => expands to 8 bytes
-                programCounter += 8;
-            }
-            else {
-                // normal instruction => 4 bytes
-                programCounter += 4;
-            }
-        } 
-        else if (section == DATA) {
-            // Each data item is 8 bytes
-            programCounter += 8;
-        }
+// size the table for `count` labels up front, so pass1 never expands it
+static void reserve_label_table(size_t count) {
+    if (count > UINT32_MAX / 2) {
+        count = UINT32_MAX / 2;
+    }
+    if (hashmap) {
+        HASH_RESERVE(hh, hashmap, count);
+    } else {
+        labelReserve = count;
     }
-    fclose(fin);
 }
 
-/******************************************************************************
- * Macro expansions (Pass 2)
- ******************************************************************************/
-static void expandIn(int rD, int rS, FILE *fout) {
-    fprintf(fout, "\tpriv r%d, r%d, r0, 3\n", rD, rS);
+static LabelAddress *find_label_hashed(const char *name, size_t len, uint32_t hash) {
+    LabelAddress *entry;
+    HASH_FIND_BYHASHVALUE(hh, hashmap, name, len, hash, entry);
+    count_probes(0);
+    return entry;
+}
+
+// find a label by name.
+static LabelAddress *find_label(const char *label) {
+    size_t len = strlen(label);
+    return find_label_hashed(label, len, label_hash(label, len));
 }
-static void expandOut(int rD, int rS, FILE *fout) {
-    fprintf(fout, "\tpriv r%d, r%d, r0, 4\n", rD, rS);
+
+// whether lookups find `entry`: of a redefined label's entries only the
+// last added is found
+static int label_is_current(const LabelAddress *entry) {
+    LabelAddress *found;
+    size_t len = strlen(entry->label);
+    HASH_FIND_BYHASHVALUE(hh, hashmap, entry->label, len, label_hash(entry->label, len), found);
+    return found == entry;
+}
+
+// call fn for every entry (a redefined label has several)
+static void visit_labels(void (*fn)(const LabelAddress *, void *), void *ctx) {
+    LabelAddress *cur, *tmp;
+    HASH_ITER(hh, hashmap, cur, tmp) {
+        fn(cur, ctx);
+    }
 }
-static void expandClr(int rD, FILE *fout) {
-    fprintf(fout, "\txor r%d, r%d, r%d\n", rD, rD, rD);
+
+// entries in the map and its bucket count, for --stats
+static void label_table_size(size_t *count, size_t *capacity) {
+    *count = HASH_COUNT(hashmap);
+    *capacity = hashmap ? hashmap->hh.tbl->num_buckets : 0;
 }
-static void expandHalt(FILE *fout) {
-    fprintf(fout, "\tpriv r0, r0, r0, 0\n");
+
+// this thread's table, for worker threads to look labels up in
+typedef struct {
+    LabelAddress *head;
+    int *addresses;
+    FrozenLabels *frozen;
+} LabelTable;
+
+static void share_labels(LabelTable *t) {
+    t->head = hashmap;
+    t->addresses = labelAddresses;
+    t->frozen = frozenLabels;
 }
-static void expandPush(int rD, FILE *fout) {
-    fprintf(fout, "\tmov (r31)(-8), r%d\n", rD);
-    fprintf(fout, "\tsubi r31, 8\n");
+
+// look labels up in `t` (read only) from this thread
+static void use_labels(const LabelTable *t) {
+    hashmap = t->head;
+    labelAddresses = t->addresses;
+    frozenLabels = t->frozen;
 }
-static void expandPop(int rD, FILE *fout) {
-    fprintf(fout, "\tmov r%d, (r31)(0)\n", rD);
-    fprintf(fout, "\taddi r31, 8\n");
+
+// free the hashmap (the table and the entries live in the label arena)
+static void free_hashmap(void) {
+    hashmap = NULL;
+    labelReserve = 0;
+    thaw_labels();
+    arena_release();
+    free_label_ids();
 }
 
-/******************************************************************************
- * expandLd: Expand an ld macro into 12 instructions (48 bytes).
- ******************************************************************************/
-static void expandLd(int rD, uint64_t L, FILE *fout) {
-    fprintf(fout, "\txor r%d, r%d, r%d\n", rD, rD, rD);
+// other tables use uthash_malloc
+#undef uthash_table_allocator
+#define uthash_table_allocator(head) NULL
+
+#else
+
+typedef struct {
+    const char *label;  // interned in the label arena
+    uint32_t id;        // its address is labelAddresses[id]
+} LabelAddress;
+
+// one table slot: the hash and a key prefix inline, so probing rarely
+// touches the entry itself. Empty slots have entry == NULL.
+#define LABEL_INLINE_KEY 18
+
+typedef struct {
+    uint32_t hash;
+    uint16_t len;
+    char key[LABEL_INLINE_KEY];
+    LabelAddress *entry;
+} LabelSlot;
 
-    unsigned long long top12  = (L >> 52) & 0xFFF;
-    unsigned long long mid12a = (L >> 40) & 0xFFF;
-    unsigned long long mid12b = (L >> 28) & 0xFFF;
-    unsigned long long mid12c = (L >> 16) & 0xFFF;
-    unsigned long long mid4   = (L >> 4)  & 0xFFF;
-    unsigned long long last4  = L & 0xF;
+static __thread LabelSlot *labelSlots = NULL;
+static __thread size_t labelMask = 0;        // capacity - 1 (capacity is a power of two)
+static __thread size_t numLabels = 0;
 
-    fprintf(fout, "\taddi r%d, %llu\n", rD, top12);
-    fprintf(fout, "\tshftli r%d, 12\n", rD);
-    fprintf(fout, "\taddi r%d, %llu\n", rD, mid12a);
-    fprintf(fout, "\tshftli r%d, 12\n", rD);
-    fprintf(fout, "\taddi r%d, %llu\n", rD, mid12b);
-    fprintf(fout, "\tshftli r%d, 12\n", rD);
-    fprintf(fout, "\taddi r%d, %llu\n", rD, mid12c);
-    fprintf(fout, "\tshftli r%d, 12\n", rD);
-    fprintf(fout, "\taddi r%d, %llu\n", rD, mid4);
-    fprintf(fout, "\tshftli r%d, 4\n", rD);
-    fprintf(fout, "\taddi r%d, %llu\n", rD, last4);
+// SipHash-1-3 under hashKey, for --keyed-hash; kept out of line so the
+// lexer's inlined FNV-1a stays small
+static __attribute__((noinline)) uint32_t keyed_label_hash(const char *s, size_t len) {
+    unsigned h;
+    HASH_SIP(s, len, h);
+    return h;
 }
 
-/******************************************************************************
- * parseMacro (Pass 2):
- * Handle macros: ld, push, pop, in, out, clr, halt
- ******************************************************************************/
-static void parseMacro(const char *line, FILE *fout) {
-    regex_t regex;
-    regmatch_t matches[4];
-    char op[16];
+// FNV-1a from a basis keyed by hashKey. No mix after it: that cost pass 1
+// 8% on 200K labels, mostly the slot locality FNV gives names that differ
+// in their last characters (L1, L2, ...)
+static uint32_t label_hash(const char *s, size_t len) {
+    if (keyedHash) {
+        return keyed_label_hash(s, len);
+    }
+    uint32_t h = 2166136261u ^ (uint32_t)hashKey[0];
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)s[i]) * 16777619u;
+    }
+    return h;
+}
 
-    if (sscanf(line, "%15s", op) != 1) {
-        fprintf(stderr, "parseMacro: cannot parse op from line: %s\n", line);
-        return;
+// distance of the slot at `idx` from its home slot
+static size_t probe_distance(const LabelSlot *slot, size_t idx) {
+    return (idx - (slot->hash & labelMask)) & labelMask;
+}
+
+static int slot_matches(const LabelSlot *slot, uint32_t hash, const char *name, size_t len) {
+    if (slot->hash != hash || slot->len != len) {
+        return 0;
     }
+    size_t inlineLen = len < LABEL_INLINE_KEY ? len : LABEL_INLINE_KEY;
+    return !memcmp(slot->key, name, inlineLen) &&
+           (len <= LABEL_INLINE_KEY ||
+            !memcmp(slot->entry->label + LABEL_INLINE_KEY, name + LABEL_INLINE_KEY, len - LABEL_INLINE_KEY));
+}
 
-    if (!strcmp(op, "ld")) {
-        const char *pattern =
-          "^[[:space:]]*ld[[:space:]]+r([0-9]+)[[:space:]]*,?[[:space:]]*(:?)([0-9a-fA-FxX:]+)[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for ld\n");
+// Robin Hood insert: a slot closer to its home gives way to the newcomer
+static void insert_slot(LabelSlot slot) {
+    size_t idx = slot.hash & labelMask, dist = 0;
+    for (;;) {
+        LabelSlot *cur = &labelSlots[idx];
+        if (!cur->entry) {
+            *cur = slot;
             return;
         }
-        if (regexec(&regex, line, 4, matches, 0) == 0) {
-            char regBuf[16], immBuf[64];
-            int rD;
-            uint64_t imm;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            rD = atoi(regBuf);
-            if (rD < 0 || rD > 31) {
-                fprintf(stderr, "Error: register out of range in ld => r%d\n", rD);
-                regfree(&regex);
-                return;
-            }
-            len = matches[3].rm_eo - matches[3].rm_so;
-            strncpy(immBuf, line + matches[3].rm_so, len);
-            immBuf[len] = '\0';
+        size_t curDist = probe_distance(cur, idx);
+        if (curDist < dist) {
+            LabelSlot tmp = *cur;
+            *cur = slot;
+            slot = tmp;
+            dist = curDist;
+        }
+        idx = (idx + 1) & labelMask;
+        dist++;
+    }
+}
 
-            if (immBuf[0] == ':') {
-                LabelAddress *entry = find_label(immBuf + 1);
-                if (!entry) {
-                    fprintf(stderr, "Error: label %s not found\n", immBuf+1);
-                    regfree(&regex);
-                    return;
+// keep the load factor at or below 3/4
+static void reserve_labels(size_t need) {
+    size_t cap = labelSlots ? labelMask + 1 : 0;
+    if (need * 4 <= cap * 3) {
+        return;
+    }
+    size_t newCap = cap ? cap * 2 : 1024;
+    while (need * 4 > newCap * 3) {
+        newCap *= 2;
+    }
+    LabelSlot *old = labelSlots;
+    labelSlots = calloc(newCap, sizeof(LabelSlot));
+    if (!labelSlots) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    advise_huge(labelSlots, newCap * sizeof(LabelSlot));
+    mem_resize(MEM_LABELS, cap * sizeof(LabelSlot), newCap * sizeof(LabelSlot));
+    labelMask = newCap - 1;
+    for (size_t i = 0; i < cap; i++) {
+        if (old[i].entry) {
+            insert_slot(old[i]);
+        }
+    }
+    free(old);
+}
+
+// size the table for `count` labels up front, so pass1 never grows it
+static void reserve_label_table(size_t count) {
+    reserve_labels(count);
+}
+
+static LabelAddress *find_label_hashed(const char *name, size_t len, uint32_t hash) {
+    if (!labelSlots) {
+        return NULL;
+    }
+    size_t idx = hash & labelMask, dist = 0;
+    for (;;) {
+        const LabelSlot *slot = &labelSlots[idx];
+        // an empty slot, or one nearer its home than we are, ends the probe
+        if (!slot->entry || probe_distance(slot, idx) < dist) {
+            count_probes(dist + 1);
+            return NULL;
+        }
+        if (slot_matches(slot, hash, name, len)) {
+            count_probes(dist + 1);
+            return slot->entry;
+        }
+        idx = (idx + 1) & labelMask;
+        dist++;
+    }
+}
+
+// add a label by its `len`-byte name and hash, returns its entry (NULL if
+// out of memory). Redefining a label moves it, the last definition wins.
+static LabelAddress *add_label_hashed(const char *label, size_t len, uint32_t hash, int address) {
+    thaw_labels();
+    LabelAddress *entry = find_label_hashed(label, len, hash);
+    if (entry) {
+        labelAddresses[entry->id] = address;
+        return entry;
+    }
+    entry = arena_alloc(sizeof(LabelAddress) + len + 1);
+    if (!entry || !(entry->id = new_label_id(address))) {
+        fprintf(diag(), "Error: malloc failed in add_label.\n");
+        return NULL;
+    }
+    char *name = (char *)(entry + 1);
+    memcpy(name, label, len);
+    name[len] = '\0';
+    entry->label = name;
+
+    reserve_labels(numLabels + 1);
+    LabelSlot slot = { .hash = hash, .len = (uint16_t)len, .entry = entry };
+    memcpy(slot.key, name, len < LABEL_INLINE_KEY ? len : LABEL_INLINE_KEY);
+    insert_slot(slot);
+    numLabels++;
+    return entry;
+}
+
+// find a label by name.
+static LabelAddress *find_label(const char *label) {
+    size_t len = strlen(label);
+    return find_label_hashed(label, len, label_hash(label, len));
+}
+
+// whether lookups find `entry` (a label has one)
+static int label_is_current(const LabelAddress *entry) {
+    (void)entry;
+    return 1;
+}
+
+// call fn for every label
+static void visit_labels(void (*fn)(const LabelAddress *, void *), void *ctx) {
+    for (size_t i = 0; labelSlots && i <= labelMask; i++) {
+        if (labelSlots[i].entry) {
+            fn(labelSlots[i].entry, ctx);
+        }
+    }
+}
+
+// labels in the table and its slot count, for --stats
+static void label_table_size(size_t *count, size_t *capacity) {
+    *count = numLabels;
+    *capacity = labelSlots ? labelMask + 1 : 0;
+}
+
+// this thread's table, for worker threads to look labels up in
+typedef struct {
+    LabelSlot *slots;
+    size_t mask;
+    int *addresses;
+    FrozenLabels *frozen;
+} LabelTable;
+
+static void share_labels(LabelTable *t) {
+    t->slots = labelSlots;
+    t->mask = labelMask;
+    t->addresses = labelAddresses;
+    t->frozen = frozenLabels;
+}
+
+// look labels up in `t` (read only) from this thread
+static void use_labels(const LabelTable *t) {
+    labelSlots = t->slots;
+    labelMask = t->mask;
+    labelAddresses = t->addresses;
+    frozenLabels = t->frozen;
+}
+
+// free the table (the entries live in the label arena)
+static void free_hashmap(void) {
+    mem_free(MEM_LABELS, labelSlots ? (labelMask + 1) * sizeof(LabelSlot) : 0);
+    free(labelSlots);
+    labelSlots = NULL;
+    labelMask = numLabels = 0;
+    thaw_labels();
+    arena_release();
+    free_label_ids();
+}
+
+#endif
+
+static int label_address(const LabelAddress *entry) {
+    return labelAddresses[entry->id];
+}
+
+static void set_label_address(const LabelAddress *entry, int address) {
+    labelAddresses[entry->id] = address;
+}
+
+// add a label to the table, returns its entry (NULL if out of memory)
+static LabelAddress *add_label(const char *label, int address) {
+    size_t len = strlen(label);
+    return add_label_hashed(label, len, label_hash(label, len), address);
+}
+
+/******************************************************************************
+ * Frozen label table
+ * Once pass 1 is done no label is added, and pass 2 only looks them up,
+ * from every worker at once. freeze_labels then builds a minimal perfect
+ * hash over the labels' hashes, PTHash style: the hashes are spread over
+ * buckets of about FROZEN_BUCKET_KEYS (60% of them into 30% of the buckets,
+ * so the crowded ones are placed while most slots are free), and each
+ * bucket, biggest first, gets a pilot that sends all of its hashes to free
+ * positions. There are a few more positions than slots, so the last
+ * buckets find theirs quickly; those past the slots are remapped to the
+ * slots left free. A lookup mixes the hash once, reads the pilot of its
+ * bucket, goes straight to its one slot and compares the name once.
+ * The labels are split by hash into partitions of about
+ * FROZEN_PARTITION_KEYS, each built on its own thread. A hash shared by
+ * several names gets one slot listing them. Adding a label thaws the table;
+ * a bucket that finds no pilot just leaves the labels unfrozen.
+ * Freezing is built in with -DLABELS_FROZEN only: the Robin Hood table,
+ * probed with the lexer's hash and matched on its inline key, already hits
+ * in about 1.1 probes, and the frozen lookup's dependent loads (partition,
+ * pilot, slot) measured slower than that, on top of about 1us per label to
+ * build. Against -DLABELS_UTHASH frozen lookups are faster, but the build
+ * pays off only past a few dozen lookups per label.
+ ******************************************************************************/
+#define FROZEN_BUCKET_KEYS 4
+#define FROZEN_PARTITION_KEYS 65536     // at most 65536 partitions
+#define FROZEN_MAX_PILOT 65536
+#define FROZEN_SPARE 32     // one more position per this many slots
+#define FROZEN_INLINE_KEY 14
+
+#ifdef LABELS_FROZEN
+static const int freezeLabels = 1;
+#else
+static const int freezeLabels = 0;
+#endif
+
+// a label, or as a slot the label with its hash; a key prefix is inline, so
+// the compare rarely touches the name itself
+typedef struct {
+    uint32_t hash;
+    uint32_t id;        // the label's, or where its hash starts in keys if name is NULL
+    uint16_t len;
+    char key[FROZEN_INLINE_KEY];
+    const char *name;   // NULL: several labels share the hash
+} FrozenSlot;
+
+typedef struct {
+    uint16_t *pilots;   // by bucket
+    uint32_t *remap;    // slot of each position from numSlots on
+    FrozenSlot *slots;
+    uint32_t numBuckets, numSlots, numPositions;
+} FrozenPart;
+
+struct FrozenLabels {
+    FrozenSlot *keys;   // every label, sorted by partition and hash
+    FrozenSlot *slots;  // of all the partitions, each starting where its keys do
+    size_t numKeys;
+    FrozenPart *parts;
+    uint32_t numParts;
+    size_t bytes;       // allocated for all of it, for --stats
+};
+
+// the one mix of a hash: its bits 0-15 skew the bucket, 16-31 pick it, 32-47
+// pick the partition and the high half, with the pilot, the position
+static uint64_t frozen_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// the top bits of x's low half scaled to [0, n), without a division
+static uint32_t frozen_range(uint64_t x, uint32_t n) {
+    return (uint32_t)(((x & 0xffffffffu) * n) >> 32);
+}
+
+static uint32_t frozen_part_of(uint64_t x, uint32_t numParts) {
+    return (uint32_t)((((x >> 32) & 0xffff) * numParts) >> 16);
+}
+
+static uint32_t frozen_bucket_of(uint64_t x, uint32_t numBuckets) {
+    uint32_t dense = numBuckets * 3 / 10;
+    if (!dense) {
+        return frozen_range(x, numBuckets);
+    }
+    return (x & 0xffff) < 0x9999 ? frozen_range(x, dense) : dense + frozen_range(x, numBuckets - dense);
+}
+
+static uint32_t frozen_position_of(uint64_t x, uint32_t pilot, uint32_t numPositions) {
+    return frozen_range((x ^ (pilot + 1) * 0x9e3779b97f4a7c15ull) >> 32, numPositions);
+}
+
+static int frozen_key_matches(const FrozenSlot *k, const char *name, size_t len) {
+    size_t inlineLen = len < FROZEN_INLINE_KEY ? len : FROZEN_INLINE_KEY;
+    return k->len == len && !memcmp(k->key, name, inlineLen) &&
+           (len <= FROZEN_INLINE_KEY ||
+            !memcmp(k->name + FROZEN_INLINE_KEY, name + FROZEN_INLINE_KEY, len - FROZEN_INLINE_KEY));
+}
+
+// id of the label `name`, 0 if there is none
+static uint32_t frozen_label_id(const FrozenLabels *f, const char *name, size_t len, uint32_t hash) {
+    uint64_t x = frozen_mix(hash);
+    const FrozenPart *part = &f->parts[frozen_part_of(x, f->numParts)];
+    count_probes(1);
+    if (!part->numSlots) {
+        return 0;
+    }
+    uint32_t pos = frozen_position_of(x, part->pilots[frozen_bucket_of(x, part->numBuckets)], part->numPositions);
+    const FrozenSlot *slot = &part->slots[pos < part->numSlots ? pos : part->remap[pos - part->numSlots]];
+    if (slot->hash != hash) {
+        return 0;
+    }
+    if (slot->name) {
+        return frozen_key_matches(slot, name, len) ? slot->id : 0;
+    }
+    for (size_t k = slot->id; k < f->numKeys && f->keys[k].hash == hash; k++) {
+        if (frozen_key_matches(&f->keys[k], name, len)) {
+            return f->keys[k].id;
+        }
+    }
+    return 0;
+}
+
+static void thaw_labels(void) {
+    if (!frozenLabels) {
+        return;
+    }
+    for (uint32_t i = 0; i < frozenLabels->numParts; i++) {
+        free(frozenLabels->parts[i].pilots);
+        free(frozenLabels->parts[i].remap);
+    }
+    free(frozenLabels->parts);
+    free(frozenLabels->slots);
+    free(frozenLabels->keys);
+    mem_free(MEM_LABELS, frozenLabels->bytes);
+    free(frozenLabels);
+    frozenLabels = NULL;
+}
+
+// id of a label, through the frozen table if there is one
+static uint32_t lookup_label_id(const char *name, size_t len, uint32_t hash) {
+    if (frozenLabels) {
+        return frozen_label_id(frozenLabels, name, len, hash);
+    }
+    const LabelAddress *entry = find_label_hashed(name, len, hash);
+    return entry ? entry->id : 0;
+}
+
+typedef struct {
+    FrozenSlot *keys;
+    size_t count, cap;
+} FrozenKeys;
+
+static int compare_frozen_keys(const void *a, const void *b) {
+    uint32_t x = ((const FrozenSlot *)a)->hash, y = ((const FrozenSlot *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+static void collect_frozen_key(const LabelAddress *entry, void *ctx) {
+    FrozenKeys *keys = ctx;
+    if (!keys->keys || !label_is_current(entry)) {
+        return;     // given up, or a redefinition lookups never see
+    }
+    size_t len = strlen(entry->label);
+    if (keys->count == keys->cap || len > UINT16_MAX) {
+        size_t cap = keys->cap * 2;
+        FrozenSlot *grown = len <= UINT16_MAX ? realloc(keys->keys, cap * sizeof(FrozenSlot)) : NULL;
+        if (!grown) {
+            free(keys->keys);   // out of memory, or a name too long to freeze
+            keys->keys = NULL;
+            return;
+        }
+        keys->keys = grown;
+        keys->cap = cap;
+    }
+    FrozenSlot *key = &keys->keys[keys->count++];
+    *key = (FrozenSlot){ .hash = label_hash(entry->label, len), .id = entry->id, .len = (uint16_t)len,
+                         .name = entry->label };
+    memcpy(key->key, entry->label, len < FROZEN_INLINE_KEY ? len : FROZEN_INLINE_KEY);
+}
+
+typedef struct {
+    FrozenLabels *frozen;
+    size_t *begin;      // by partition, numParts + 1
+    uint32_t next;
+    int failed;
+} FrozenBuild;
+
+// place a partition's hashes, one per group of keys (groups[g] its first
+// key), and point its slots at them
+static int place_frozen_part(FrozenPart *part, const FrozenSlot *keys, const uint32_t *groups, size_t keyBase) {
+    uint32_t m = part->numSlots, numBuckets = part->numBuckets;
+    uint32_t *start = calloc((size_t)numBuckets + 1, sizeof(uint32_t));
+    uint64_t *bucketMix = malloc(((size_t)m + 1) * sizeof(uint64_t));   // the groups' mixes, by bucket
+    uint32_t *order = malloc(((size_t)numBuckets + 1) * sizeof(uint32_t));
+    unsigned char *taken = calloc(part->numPositions, 1);
+    int ok = start && bucketMix && order && taken;
+
+    // the groups by bucket (counting sort), then the buckets biggest first
+    uint32_t maxSize = 0;
+    for (uint32_t g = 0; ok && g < m; g++) {
+        start[frozen_bucket_of(frozen_mix(keys[groups[g]].hash), numBuckets)]++;
+    }
+    for (uint32_t i = 0; ok && i < numBuckets; i++) {
+        maxSize = start[i] > maxSize ? start[i] : maxSize;
+        start[i] += i ? start[i - 1] : 0;
+    }
+    for (uint32_t g = 0; ok && g < m; g++) {
+        uint64_t x = frozen_mix(keys[groups[g]].hash);
+        bucketMix[--start[frozen_bucket_of(x, numBuckets)]] = x;
+    }
+    start[numBuckets] = ok ? m : 0;     // bucket i is start[i] .. start[i + 1]
+    size_t numOrdered = 0;
+    for (uint32_t size = maxSize; ok && size > 0; size--) {
+        for (uint32_t i = 0; i < numBuckets; i++) {
+            if (start[i + 1] - start[i] == size) {
+                order[numOrdered++] = i;
+            }
+        }
+    }
+
+    for (size_t o = 0; ok && o < numOrdered; o++) {
+        uint32_t bucket = order[o], first = start[bucket], end = start[bucket + 1];
+        uint32_t pilot = 0;
+        for (; pilot < FROZEN_MAX_PILOT; pilot++) {
+            uint32_t k = first;
+            for (; k < end; k++) {
+                uint32_t pos = frozen_position_of(bucketMix[k], pilot, part->numPositions);
+                if (taken[pos]) {
+                    break;
+                }
+                taken[pos] = 1;
+            }
+            if (k == end) {
+                part->pilots[bucket] = (uint16_t)pilot;
+                break;
+            }
+            while (k-- > first) {
+                taken[frozen_position_of(bucketMix[k], pilot, part->numPositions)] = 0;
+            }
+        }
+        ok = pilot < FROZEN_MAX_PILOT;
+    }
+
+    // the positions taken past the slots go to the slots left free
+    uint32_t freeSlot = 0;
+    for (uint32_t pos = m; ok && pos < part->numPositions; pos++) {
+        if (taken[pos]) {
+            while (taken[freeSlot]) {
+                freeSlot++;
+            }
+            part->remap[pos - m] = freeSlot++;
+        }
+    }
+    for (uint32_t g = 0; ok && g < m; g++) {
+        const FrozenSlot *key = &keys[groups[g]];
+        uint64_t x = frozen_mix(key->hash);
+        uint32_t pos = frozen_position_of(x, part->pilots[frozen_bucket_of(x, numBuckets)], part->numPositions);
+        FrozenSlot *slot = &part->slots[pos < m ? pos : part->remap[pos - m]];
+        *slot = *key;
+        if (groups[g + 1] - groups[g] > 1) {
+            slot->id = (uint32_t)(keyBase + groups[g]);
+            slot->name = NULL;
+        }
+    }
+    free(start);
+    free(bucketMix);
+    free(order);
+    free(taken);
+    return ok;
+}
+
+// build partition `p`, the keys from begin[p] to begin[p + 1]
+static int build_frozen_part(FrozenBuild *b, uint32_t p) {
+    FrozenLabels *f = b->frozen;
+    FrozenPart *part = &f->parts[p];
+    FrozenSlot *keys = f->keys + b->begin[p];
+    size_t count = b->begin[p + 1] - b->begin[p];
+    qsort(keys, count, sizeof(FrozenSlot), compare_frozen_keys);
+
+    // one group, and one slot, per distinct hash
+    uint32_t *groups = malloc((count + 1) * sizeof(uint32_t));
+    if (!groups) {
+        return 0;
+    }
+    uint32_t m = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || keys[i].hash != keys[i - 1].hash) {
+            groups[m++] = (uint32_t)i;
+        }
+    }
+    groups[m] = (uint32_t)count;
+    part->slots = f->slots + b->begin[p];
+    part->numSlots = m;
+    part->numPositions = m + m / FROZEN_SPARE + 1;
+    part->numBuckets = m ? (m + FROZEN_BUCKET_KEYS - 1) / FROZEN_BUCKET_KEYS : 1;
+    part->pilots = calloc(part->numBuckets, sizeof(uint16_t));
+    part->remap = calloc(part->numPositions - m, sizeof(uint32_t));    // unused positions: slot 0
+    int ok = part->pilots && part->remap && place_frozen_part(part, keys, groups, b->begin[p]);
+    free(groups);
+    return ok;
+}
+
+static void *frozen_worker(void *arg) {
+    FrozenBuild *b = arg;
+    for (;;) {
+        uint32_t p = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (p >= b->frozen->numParts) {
+            return NULL;
+        }
+        if (!build_frozen_part(b, p)) {
+            __atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// freeze this thread's labels for pass 2, on up to `jobs` threads; they stay
+// as they are if that fails (out of memory, or no pilot found)
+static void freeze_labels(int jobs) {
+    thaw_labels();
+    if (!freezeLabels) {
+        return;
+    }
+    FrozenKeys keys = { malloc(1024 * sizeof(FrozenSlot)), 0, 1024 };
+    visit_labels(collect_frozen_key, &keys);
+    if (!keys.keys || !keys.count || keys.count >= UINT32_MAX) {
+        free(keys.keys);
+        return;
+    }
+
+    FrozenLabels *f = calloc(1, sizeof(FrozenLabels));
+    FrozenSlot *sorted = malloc(keys.count * sizeof(FrozenSlot));
+    uint32_t numParts = (uint32_t)((keys.count + FROZEN_PARTITION_KEYS - 1) / FROZEN_PARTITION_KEYS);
+    size_t *begin = calloc((size_t)numParts + 1, sizeof(size_t));
+    if (f) {
+        f->numParts = numParts;
+        f->parts = calloc(numParts, sizeof(FrozenPart));
+        f->slots = calloc(keys.count, sizeof(FrozenSlot));
+    }
+    if (!f || !sorted || !begin || !f->parts || !f->slots) {
+        free(sorted);
+        free(begin);
+        free(keys.keys);
+        if (f) {
+            free(f->parts);
+            free(f->slots);
+            free(f);
+        }
+        return;
+    }
+
+    // scatter the keys by partition
+    for (size_t i = 0; i < keys.count; i++) {
+        begin[frozen_part_of(frozen_mix(keys.keys[i].hash), numParts) + 1]++;
+    }
+    for (uint32_t p = 0; p < numParts; p++) {
+        begin[p + 1] += begin[p];
+    }
+    for (size_t i = 0; i < keys.count; i++) {
+        sorted[begin[frozen_part_of(frozen_mix(keys.keys[i].hash), numParts)]++] = keys.keys[i];
+    }
+    for (uint32_t p = numParts; p > 0; p--) {
+        begin[p] = begin[p - 1];
+    }
+    begin[0] = 0;
+    free(keys.keys);
+    f->keys = sorted;
+    f->numKeys = keys.count;
+
+    FrozenBuild build = { f, begin, 0, 0 };
+    int numThreads = (uint32_t)jobs < numParts ? jobs : (int)numParts;
+    pthread_t *threads = numThreads > 1 ? malloc((size_t)(numThreads - 1) * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (; threads && started < numThreads - 1; started++) {
+        if (pthread_create(&threads[started], NULL, frozen_worker, &build) != 0) {
+            break;
+        }
+    }
+    frozen_worker(&build);  // this thread builds too, or builds them all
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(begin);
+    f->bytes = sizeof(FrozenLabels) + numParts * sizeof(FrozenPart) + 2 * keys.count * sizeof(FrozenSlot);
+    for (uint32_t p = 0; p < numParts; p++) {
+        f->bytes += f->parts[p].numBuckets * sizeof(uint16_t) +
+                    (f->parts[p].numPositions - f->parts[p].numSlots) * sizeof(uint32_t);
+    }
+    mem_alloc(MEM_LABELS, f->bytes);
+    frozenLabels = f;
+    if (build.failed) {
+        thaw_labels();
+    }
+}
+
+// grow a dynamic array so that it holds at least `need` elements
+static void *grow_array(void *arr, size_t *cap, size_t need, size_t elemSize) {
+    if (need <= *cap) {
+        return arr;
+    }
+    size_t newCap = *cap ? *cap : 16;
+    while (newCap < need) {
+        newCap *= 2;
+    }
+    void *p = realloc(arr, newCap * elemSize);
+    if (!p) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    *cap = newCap;
+    if (newCap * elemSize >= HUGE_MIN) {
+        advise_huge(p, newCap * elemSize);
+        prefault_async((char *)p + need * elemSize, (newCap - need) * elemSize);
+    }
+    return p;
+}
+
+// grow_array, counting the array as `kind` for --stats
+static void *grow_counted(MemKind kind, void *arr, size_t *cap, size_t need, size_t elemSize) {
+    if (need <= *cap) {
+        return arr;
+    }
+    size_t from = *cap * elemSize;
+    arr = grow_array(arr, cap, need, elemSize);
+    mem_resize(kind, from, *cap * elemSize);
+    return arr;
+}
+
+/******************************************************************************
+ * Block scanner:
+ * Classifies 64 input bytes at once into bitmasks, bit i for byte i: line
+ * ends, ';' comments, ':' labels, ',' and the other white space (isspace
+ * without '\n'). SSE2 compares 16 bytes per instruction on x86-64; other
+ * targets take the scalar loop. The line reader splits lines from these
+ * masks and hands the lexer each short line's separator masks.
+ ******************************************************************************/
+typedef struct {
+    uint64_t newline, semi, colon, comma, space;
+} ScanMasks;
+
+#if defined(__SSE2__)
+static uint64_t byte_mask16(__m128i eq) {
+    return (uint64_t)(uint16_t)_mm_movemask_epi8(eq);
+}
+
+static void scan_block(const char *p, ScanMasks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 64; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i nl = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+        // ' ' and '\t'..'\r' (bytes >= 0x80 compare as negative)
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                  _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)),
+                                                _mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1))));
+        m->newline |= byte_mask16(nl) << i;
+        m->space |= byte_mask16(_mm_andnot_si128(nl, ws)) << i;
+        m->semi |= byte_mask16(_mm_cmpeq_epi8(x, _mm_set1_epi8(';'))) << i;
+        m->colon |= byte_mask16(_mm_cmpeq_epi8(x, _mm_set1_epi8(':'))) << i;
+        m->comma |= byte_mask16(_mm_cmpeq_epi8(x, _mm_set1_epi8(','))) << i;
+    }
+}
+#else
+static void scan_block(const char *p, ScanMasks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = (uint64_t)1 << i;
+        switch (p[i]) {
+        case '\n': m->newline |= bit; break;
+        case ';':  m->semi |= bit; break;
+        case ':':  m->colon |= bit; break;
+        case ',':  m->comma |= bit; break;
+        case ' ': case '\t': case '\v': case '\f': case '\r': m->space |= bit; break;
+        }
+    }
+}
+#endif
+
+// the masks of the 64 bytes at `pos` of data[0, size); bytes past the end
+// match nothing
+static void scan_at(const char *data, size_t size, size_t pos, ScanMasks *m) {
+    if (pos + 64 <= size) {
+        scan_block(data + pos, m);
+    } else if (pos < size) {
+        char tail[64] = {0};
+        memcpy(tail, data + pos, size - pos);
+        scan_block(tail, m);
+    } else {
+        memset(m, 0, sizeof(*m));
+    }
+}
+
+// bits [off, off + 64) of the 128-bit mask hi:lo
+static uint64_t mask_window(uint64_t lo, uint64_t hi, unsigned off) {
+    return off ? lo >> off | hi << (64 - off) : lo;
+}
+
+// separator masks of one line for the lexer, valid only for lines shorter
+// than 64 bytes; bit i is text[i]
+typedef struct {
+    int valid;
+    uint64_t gap;   // white space and ','
+    uint64_t semi;  // ';'
+} LineMasks;
+
+/******************************************************************************
+ * Line reader:
+ * The input is mmap'ed and handed out as zero-copy (ptr, len) views split at
+ * '\n', so lines have no length limit. If the file can't be mapped (pipes,
+ * empty files, ...) we fall back to streaming it through a growable buffer;
+ * a view then stays valid until the next reader_next call.
+ * Mapped inputs and in-memory views are split by the block scanner, which
+ * keeps the masks of two consecutive blocks: lines are found in the first,
+ * and a line starting in it is covered by both for its LineMasks.
+ ******************************************************************************/
+typedef struct {
+    int fd;
+    const char *data;   // mapped file, or the streaming buffer
+    size_t size;        // bytes available in data
+    size_t pos;         // start of the next line
+    uint64_t base;      // input offset of data[0] (streaming moves it along)
+    int mapped;
+    int eof;            // streaming: no more input to read
+    char *buf;          // streaming buffer
+    size_t bufCap;
+    int scanning;       // data is fixed: lines are split by the block scanner
+    size_t scanPos;     // offset of scan[0]; scan[1] is the block after it
+    ScanMasks scan[2];
+    LineMasks masks;    // of the line reader_next returned last
+} LineReader;
+
+static void reader_scan_start(LineReader *r) {
+    r->scanning = 1;
+    r->scanPos = 0;
+    scan_at(r->data, r->size, 0, &r->scan[0]);
+    scan_at(r->data, r->size, 64, &r->scan[1]);
+}
+
+static void reader_scan_advance(LineReader *r) {
+    r->scanPos += 64;
+    r->scan[0] = r->scan[1];
+    scan_at(r->data, r->size, r->scanPos + 64, &r->scan[1]);
+}
+
+// the next line from the block masks, like reader_next
+static int reader_next_scanned(LineReader *r, const char **line, size_t *len) {
+    if (r->pos >= r->size) {
+        return 0;
+    }
+    size_t start = r->pos, end = r->size;
+    while (start >= r->scanPos + 64) {
+        reader_scan_advance(r);
+    }
+    unsigned off = (unsigned)(start - r->scanPos);
+    uint64_t gap = mask_window(r->scan[0].space | r->scan[0].comma,
+                               r->scan[1].space | r->scan[1].comma, off);
+    uint64_t semi = mask_window(r->scan[0].semi, r->scan[1].semi, off);
+    for (size_t at = start;;) {
+        uint64_t nl = r->scan[0].newline >> (at - r->scanPos);
+        if (nl) {
+            end = at + (size_t)__builtin_ctzll(nl);
+            break;
+        }
+        at = r->scanPos + 64;
+        if (at >= r->size) {
+            break;  // last line without a trailing newline
+        }
+        reader_scan_advance(r);
+    }
+    *line = r->data + start;
+    *len = end - start;
+    r->pos = end < r->size ? end + 1 : end;
+    r->masks.valid = *len < 64;
+    r->masks.gap = gap;
+    r->masks.semi = semi;
+    return 1;
+}
+
+static int reader_open(LineReader *r, const char *filename) {
+    memset(r, 0, sizeof(*r));
+    r->fd = strcmp(filename, "-") ? open(filename, O_RDONLY) : dup(STDIN_FILENO);
+    if (r->fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(r->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            r->data = p;
+            r->size = (size_t)st.st_size;
+            r->mapped = 1;
+            reader_scan_start(r);
+        }
+    }
+    return 1;
+}
+
+// fetch the next line (without its '\n'); returns 0 at end of input
+static int reader_next(LineReader *r, const char **line, size_t *len) {
+    if (r->scanning) {
+        return reader_next_scanned(r, line, len);
+    }
+    r->masks.valid = 0;
+    for (;;) {
+        if (r->pos < r->size) {
+            const char *start = r->data + r->pos;
+            const char *nl = memchr(start, '\n', r->size - r->pos);
+            if (nl) {
+                *line = start;
+                *len = (size_t)(nl - start);
+                r->pos += *len + 1;
+                return 1;
+            }
+            if (r->mapped || r->eof) {
+                // last line without a trailing newline
+                *line = start;
+                *len = r->size - r->pos;
+                r->pos = r->size;
+                return 1;
+            }
+        }
+        if (r->mapped || r->eof) {
+            return 0;
+        }
+        // streaming: keep the partial line, then read more behind it
+        size_t keep = r->size - r->pos;
+        if (r->pos > 0) {
+            memmove(r->buf, r->buf + r->pos, keep);
+        }
+        r->base += r->pos;
+        r->pos = 0;
+        r->size = keep;
+        r->buf = grow_counted(MEM_LINES, r->buf, &r->bufCap, keep + 65536, 1);
+        ssize_t n = read(r->fd, r->buf + keep, r->bufCap - keep);
+        if (n <= 0) {
+            r->eof = 1;
+        } else {
+            r->size += (size_t)n;
+        }
+        r->data = r->buf;
+    }
+}
+
+static void reader_close(LineReader *r) {
+    if (r->mapped) {
+        munmap((void *)r->data, r->size);
+    }
+    mem_free(MEM_LINES, r->bufCap);
+    free(r->buf);
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+// a reader that read()s even a regular file, holding only the lines it is at
+static int reader_open_streamed(LineReader *r, const char *filename) {
+    memset(r, 0, sizeof(*r));
+    r->fd = open(filename, O_RDONLY);
+    return r->fd >= 0;
+}
+
+// make the whole input available at once (streamed input is read to EOF)
+static void reader_slurp(LineReader *r) {
+    while (!r->mapped && !r->eof) {
+        r->buf = grow_counted(MEM_LINES, r->buf, &r->bufCap, r->size + 65536, 1);
+        ssize_t n = read(r->fd, r->buf + r->size, r->bufCap - r->size);
+        if (n <= 0) {
+            r->eof = 1;
+        } else {
+            r->size += (size_t)n;
+        }
+        r->data = r->buf;
+    }
+    if (!r->scanning) {
+        reader_scan_start(r);
+    }
+}
+
+// a reader over part of an input already in memory
+static void reader_view(LineReader *r, const char *data, size_t size) {
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+    r->data = data;
+    r->size = size;
+    r->eof = 1;
+    reader_scan_start(r);
+}
+
+// number of label definitions (lines whose first non-blank is ':') in what
+// the reader holds in memory; a streaming reader has nothing to scan yet.
+static size_t count_label_lines(const LineReader *r) {
+    size_t n = 0;
+    int blankSoFar = 1;  // the line running into the block has no non-blank yet
+    for (size_t pos = 0; pos < r->size; pos += 64) {
+        ScanMasks m;
+        scan_at(r->data, r->size, pos, &m);
+        uint64_t in = r->size - pos >= 64 ? ~0ull : ((uint64_t)1 << (r->size - pos)) - 1;
+        uint64_t solid = ~(m.space | m.newline) & in;
+        // a ':' counts if nothing solid precedes it on its line
+        for (uint64_t c = m.colon; c; c &= c - 1) {
+            uint64_t before = (c & -c) - 1, nl = m.newline & before;
+            n += nl ? !(solid & before & ~((2ull << (63 - __builtin_clzll(nl))) - 1))
+                    : blankSoFar && !(solid & before);
+        }
+        if (m.newline) {
+            blankSoFar = !(solid & ~((2ull << (63 - __builtin_clzll(m.newline))) - 1));
+        } else {
+            blankSoFar = blankSoFar && !solid;
+        }
+    }
+    return n;
+}
+
+/******************************************************************************
+ * Trim leading/trailing whitespace of a line view (no copying).
+ ******************************************************************************/
+static void trim_view(const char **line, size_t *len) {
+    const char *p = *line;
+    size_t n = *len;
+    while (n > 0 && isspace((unsigned char)*p)) {
+        p++;
+        n--;
+    }
+    while (n > 0 && isspace((unsigned char)p[n - 1])) {
+        n--;
+    }
+    *line = p;
+    *len = n;
+}
+
+/******************************************************************************
+ * Lexer:
+ * One table-driven scan per line turns the text into a TokenLine: the opcode
+ * id plus a compact operand array (registers, immediates, label references
+ * and (rX)(L) memory operands). The validators and the macro emitter below
+ * all consume a TokenLine instead of re-scanning the text themselves.
+ ******************************************************************************/
+// operand shape of a mnemonic, which picks its pass1 check, its IR fields
+// and its encoding
+typedef enum {
+    SHAPE_RRR,  // rD, rS, rT
+    SHAPE_RR,   // rD, rS
+    SHAPE_R,    // rD
+    SHAPE_NONE, // no operands
+    SHAPE_RL,   // rD, L with L in [0..4095] or a label
+    SHAPE_BRR,  // rX, or L in [-2048..2047] or a label
+    SHAPE_MOV,  // the four mov forms
+    SHAPE_LD    // rD, a 64-bit literal or a label
+} OperandShape;
+
+/* The assembly ISA, one row per mnemonic in Opcode order:
+ *   X(id, mnemonic, shape, machine opcode, bytes)
+ * The machine opcode is the MOP_ suffix, NONE for the macros; brr and mov
+ * name their register form and pick the others by operand kind. bytes is
+ * the size once expanded (ld: without -O, which sizes it by its value).
+ * The Opcode enum, opNames, opForms and opMops are all generated from it.
+ * Keep halt .. pop last and together: NUM_MACRO_KINDS counts from OP_HALT. */
+#define TINKER_ISA(X) \
+    X(ADD,    "add",    SHAPE_RRR,  ADD,    4) \
+    X(ADDI,   "addi",   SHAPE_RL,   ADDI,   4) \
+    X(SUB,    "sub",    SHAPE_RRR,  SUB,    4) \
+    X(SUBI,   "subi",   SHAPE_RL,   SUBI,   4) \
+    X(MUL,    "mul",    SHAPE_RRR,  MUL,    4) \
+    X(DIV,    "div",    SHAPE_RRR,  DIV,    4) \
+    X(AND,    "and",    SHAPE_RRR,  AND,    4) \
+    X(OR,     "or",     SHAPE_RRR,  OR,     4) \
+    X(XOR,    "xor",    SHAPE_RRR,  XOR,    4) \
+    X(NOT,    "not",    SHAPE_RR,   NOT,    4) \
+    X(SHFTR,  "shftr",  SHAPE_RRR,  SHFTR,  4) \
+    X(SHFTRI, "shftri", SHAPE_RL,   SHFTRI, 4) \
+    X(SHFTL,  "shftl",  SHAPE_RRR,  SHFTL,  4) \
+    X(SHFTLI, "shftli", SHAPE_RL,   SHFTLI, 4) \
+    X(BR,     "br",     SHAPE_R,    BR,     4) \
+    X(BRR,    "brr",    SHAPE_BRR,  BRR_R,  4) \
+    X(BRNZ,   "brnz",   SHAPE_RR,   BRNZ,   4) \
+    X(CALL,   "call",   SHAPE_R,    CALL,   4) \
+    X(RETURN, "return", SHAPE_NONE, RETURN, 4) \
+    X(BRGT,   "brgt",   SHAPE_RRR,  BRGT,   4) \
+    X(ADDF,   "addf",   SHAPE_RRR,  ADDF,   4) \
+    X(SUBF,   "subf",   SHAPE_RRR,  SUBF,   4) \
+    X(MULF,   "mulf",   SHAPE_RRR,  MULF,   4) \
+    X(DIVF,   "divf",   SHAPE_RRR,  DIVF,   4) \
+    X(MOV,    "mov",    SHAPE_MOV,  MOV_RR, 4) \
+    X(HALT,   "halt",   SHAPE_NONE, NONE,   4) \
+    X(IN,     "in",     SHAPE_RR,   NONE,   4) \
+    X(OUT,    "out",    SHAPE_RR,   NONE,   4) \
+    X(CLR,    "clr",    SHAPE_R,    NONE,   4) \
+    X(LD,     "ld",     SHAPE_LD,   NONE,   48) \
+    X(PUSH,   "push",   SHAPE_R,    NONE,   8) \
+    X(POP,    "pop",    SHAPE_R,    NONE,   8)
+
+#define ISA_OPCODE(id, name, shape, mop, bytes) OP_##id,
+#define ISA_NAME(id, name, shape, mop, bytes) name,
+#define ISA_FORM(id, name, shape, mop, bytes) { shape, bytes },
+#define ISA_MOP(id, name, shape, mop, bytes) MOP_##mop,
+
+typedef enum {
+    OP_NONE = -1,
+    TINKER_ISA(ISA_OPCODE)
+    NUM_OPCODES
+} Opcode;
+
+// mnemonics, indexed by Opcode
+static const char *opNames[NUM_OPCODES] = { TINKER_ISA(ISA_NAME) };
+
+// operand shape and expanded size, indexed by Opcode
+static const struct {
+    uint8_t shape;      // OperandShape
+    uint8_t size;
+} opForms[NUM_OPCODES] = { TINKER_ISA(ISA_FORM) };
+
+/* Perfect hash over the mnemonics: the first two and last two characters
+ * plus the length, multiplied and reduced to 6 bits. OPCODE_HASH_MUL was
+ * found by search so that all 32 mnemonics land in distinct slots; a hit is
+ * still confirmed with one memcmp. Mnemonics are 2..6 characters long. */
+#define OPCODE_HASH_MUL 0xf7297565u
+
+static unsigned opcode_hash(const char *s, size_t len) {
+    uint32_t k = (uint32_t)(unsigned char)s[0] |
+                 (uint32_t)(unsigned char)s[1] << 8 |
+                 (uint32_t)(unsigned char)s[len - 2] << 16 |
+                 (uint32_t)(unsigned char)s[len - 1] << 24;
+    return ((k + (uint32_t)len) * OPCODE_HASH_MUL) >> 26;
+}
+
+// slot => Opcode + 1 (0 = empty slot)
+static const signed char opcodeSlots[64] = {
+    [1] = OP_SUBF + 1, [3] = OP_ADD + 1, [6] = OP_POP + 1,
+    [9] = OP_DIV + 1, [12] = OP_SUB + 1, [13] = OP_SUBI + 1,
+    [14] = OP_BRR + 1, [16] = OP_AND + 1, [17] = OP_HALT + 1,
+    [18] = OP_CALL + 1, [21] = OP_MUL + 1, [23] = OP_SHFTRI + 1,
+    [24] = OP_LD + 1, [27] = OP_OUT + 1, [28] = OP_OR + 1,
+    [30] = OP_CLR + 1, [32] = OP_SHFTL + 1, [33] = OP_BRNZ + 1,
+    [36] = OP_MOV + 1, [38] = OP_XOR + 1, [39] = OP_SHFTLI + 1,
+    [42] = OP_IN + 1, [45] = OP_PUSH + 1, [47] = OP_NOT + 1,
+    [49] = OP_DIVF + 1, [51] = OP_ADDF + 1, [52] = OP_MULF + 1,
+    [55] = OP_SHFTR + 1, [56] = OP_RETURN + 1, [59] = OP_BR + 1,
+    [60] = OP_BRGT + 1, [63] = OP_ADDI + 1,
+};
+
+static Opcode lookup_opcode(const char *s, size_t len) {
+    if (len < 2 || len > 6) {
+        return OP_NONE;
+    }
+    int op = opcodeSlots[opcode_hash(s, len)] - 1;
+    if (op < 0 || memcmp(opNames[op], s, len) != 0 || opNames[op][len] != '\0') {
+        return OP_NONE;
+    }
+    return (Opcode)op;
+}
+
+typedef enum {
+    TOK_REG,    // rN
+    TOK_IMM,    // 12, -8, 0x1f, 017 (strtoull-style base prefixes)
+    TOK_LABEL,  // :name  (start/len cover the name, not the ':')
+    TOK_MEM,    // (rN)(L)
+    TOK_EXPR,   // :table+64, (:end-:start)/8: a constant or an address (see
+                // "Constant expressions")
+    TOK_BAD     // anything else
+} TokenKind;
+
+typedef struct {
+    uint8_t kind;       // TokenKind
+    uint8_t negative;   // literal had a '-' sign
+    uint8_t overflow;   // literal doesn't fit in 64 bits
+    int reg;            // TOK_REG / TOK_MEM register number (unchecked)
+    uint32_t start;     // token text, as an offset into the line
+    uint32_t len;
+    union {
+        uint64_t value; // TOK_IMM / TOK_MEM literal magnitude
+        uint32_t hash;  // TOK_LABEL: label_hash of the name (cut like add_label's)
+        uint64_t weight;    // TOK_EXPR: 1 for an address, 0 for a constant
+    };
+} Token;
+
+#define MAX_OPERANDS 6
+
+typedef struct {
+    const char *text;   // the trimmed line
+    size_t len;
+    Opcode op;          // OP_NONE if the first word isn't a mnemonic
+    int numTokens;      // operands, capped at MAX_OPERANDS
+    int extra;          // there were more than MAX_OPERANDS operands
+    int labelTok;       // first TOK_LABEL or TOK_EXPR operand, -1 if none
+    Token tok[MAX_OPERANDS];
+} TokenLine;
+
+#define LINE_ARGS(t)     (int)(t)->len, (t)->text
+#define TOKEN_ARGS(t, k) (int)(k)->len, (t)->text + (k)->start
+
+enum {
+    CC_OTHER, CC_SPACE, CC_COMMA, CC_SEMI, CC_COLON,
+    CC_LPAREN, CC_RPAREN, CC_SIGN, CC_DIGIT, CC_ALPHA
+};
+static unsigned char charClass[256];
+
+static void init_lexer(void) {
+    init_hash_key();
+    for (int c = 0; c < 256; c++) {
+        charClass[c] = isspace(c) ? CC_SPACE :
+                       isdigit(c) ? CC_DIGIT :
+                       (isalpha(c) || c == '_') ? CC_ALPHA : CC_OTHER;
+    }
+    charClass[','] = CC_COMMA;
+    charClass[';'] = CC_SEMI;
+    charClass[':'] = CC_COLON;
+    charClass['('] = CC_LPAREN;
+    charClass[')'] = CC_RPAREN;
+    charClass['-'] = CC_SIGN;
+    charClass['+'] = CC_SIGN;
+}
+
+#define CLASS(c) charClass[(unsigned char)(c)]
+
+// operands end at whitespace, ',' or a ';' comment
+static int is_separator(const char *p, const char *end) {
+    if (p >= end) {
+        return 1;
+    }
+    int cc = CLASS(*p);
+    return cc == CC_SPACE || cc == CC_COMMA || cc == CC_SEMI;
+}
+
+// length of the label name copy_label_name keeps from [p, end)
+static size_t label_name_len(const char *p, const char *end) {
+    size_t n = (size_t)(end - p);
+    return n < 49 ? n : 49;
+}
+
+// digit value of c in the given base, -1 if it isn't one
+static int digit_value(int c, int base) {
+    int d;
+    if (c >= '0' && c <= '9') d = c - '0';
+    else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+    else return -1;
+    return d < base ? d : -1;
+}
+
+/* SWAR digit runs: eight characters are loaded as one word, the first in the
+ * low byte (little-endian, as the emulator's memory accesses assume), the
+ * length of the leading run of digits comes from one mask and a ctz, and the
+ * run is combined in three shift/multiply steps instead of a multiply-add
+ * per digit. With fewer than eight characters left there are at most seven
+ * digits, which the plain loops take. */
+#define SWAR_BYTES(b) (0x0101010101010101ull * (uint8_t)(b))
+
+static uint64_t load_chars(const char *p) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return w;
+}
+
+// number of leading bytes of w that are '0'..'9' (0..8)
+static unsigned decimal_run(uint64_t w) {
+    uint64_t low = w & SWAR_BYTES(0x7f);
+    uint64_t bad = (w | (low + SWAR_BYTES(0x46)) | ~(low + SWAR_BYTES(0x50))) & SWAR_BYTES(0x80);
+    return bad ? (unsigned)__builtin_ctzll(bad) >> 3 : 8;
+}
+
+// number of leading bytes of w that are hex digits (letters in either case);
+// letters gets a 1 in each byte holding a letter
+static unsigned hex_run(uint64_t w, uint64_t *letters) {
+    uint64_t low = w & SWAR_BYTES(0x7f), folded = low | SWAR_BYTES(0x20);
+    uint64_t digit = (low + SWAR_BYTES(0x50)) & ~(low + SWAR_BYTES(0x46));
+    uint64_t alpha = (folded + SWAR_BYTES(0x1f)) & ~(folded + SWAR_BYTES(0x19));
+    uint64_t bad = (w | ~(digit | alpha)) & SWAR_BYTES(0x80);
+    *letters = (alpha & SWAR_BYTES(0x80)) >> 7;
+    return bad ? (unsigned)__builtin_ctzll(bad) >> 3 : 8;
+}
+
+// value of the first n (1..8) decimal digits of w
+static uint64_t decimal_chunk(uint64_t w, unsigned n) {
+    w = (w - SWAR_BYTES('0')) << (8 * (8 - n));
+    w = (w * 10 + (w >> 8)) & 0x00ff00ff00ff00ffull;
+    w = (w * 100 + (w >> 16)) & 0x0000ffff0000ffffull;
+    return (w * 10000 + (w >> 32)) & 0xffffffffull;
+}
+
+// value of the first n (1..8) hex digits of w; letters has 1 in each letter byte
+static uint64_t hex_chunk(uint64_t w, uint64_t letters, unsigned n) {
+    w = ((w & SWAR_BYTES(0x0f)) + letters * 9) << (8 * (8 - n));
+    w = ((w << 4) + (w >> 8)) & 0x00ff00ff00ff00ffull;
+    w = ((w << 8) + (w >> 16)) & 0x0000ffff0000ffffull;
+    return ((w << 16) + (w >> 32)) & 0xffffffffull;
+}
+
+static const uint64_t pow10_8[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+// integer literal with an optional sign; base from the prefix like strtoull
+// (0x => hex, leading 0 => octal). Returns the end of the literal, or NULL if
+// there are no digits. Decimal and hex digits go eight at a time while the
+// value can't overflow (16 digits), the checked loop below takes the rest.
+static const char *lex_number(const char *p, const char *end, Token *tk) {
+    tk->negative = 0;
+    tk->overflow = 0;
+    tk->value = 0;
+    if (p < end && CLASS(*p) == CC_SIGN) {
+        tk->negative = (*p == '-');
+        p++;
+    }
+    int base = 10;
+    if (p < end && *p == '0') {
+        base = 8;
+        if (p + 2 < end && (p[1] == 'x' || p[1] == 'X') && digit_value(p[2], 16) >= 0) {
+            base = 16;
+            p += 2;
+        }
+    }
+    const char *digits = p;
+    for (int chunk = 0; chunk < 2 && base != 8 && end - p >= 8; chunk++) {
+        uint64_t w = load_chars(p), letters;
+        unsigned n = base == 10 ? decimal_run(w) : hex_run(w, &letters);
+        if (n == 0) {
+            break;
+        }
+        tk->value = base == 10 ? tk->value * pow10_8[n] + decimal_chunk(w, n)
+                               : tk->value << (4 * n) | hex_chunk(w, letters, n);
+        p += n;
+        if (n < 8) {
+            break;
+        }
+    }
+    int d;
+    while (p < end && (d = digit_value(*p, base)) >= 0) {
+        if (tk->value > (UINT64_MAX - (uint64_t)d) / (uint64_t)base) {
+            tk->overflow = 1;
+        }
+        tk->value = tk->value * (uint64_t)base + (uint64_t)d;
+        p++;
+    }
+    return p > digits ? p : NULL;
+}
+
+// (rN)(L) memory operand; returns its end or NULL if it is malformed
+static const char *lex_memory(const char *p, const char *end, Token *tk) {
+    if (p >= end || *p != '(' || ++p >= end || *p != 'r') {
+        return NULL;
+    }
+    p++;
+    if (p >= end || CLASS(*p) != CC_DIGIT) {
+        return NULL;
+    }
+    int reg = 0;
+    while (p < end && CLASS(*p) == CC_DIGIT) {
+        if (reg < 1000) {
+            reg = reg * 10 + (*p - '0');
+        }
+        p++;
+    }
+    if (p + 1 >= end || p[0] != ')' || p[1] != '(') {
+        return NULL;
+    }
+    p = lex_number(p + 2, end, tk);
+    if (!p || p >= end || *p != ')') {
+        return NULL;
+    }
+    tk->reg = reg;
+    return p + 1;
+}
+
+/******************************************************************************
+ * Constant expressions and .equ symbols:
+ *     .equ ROW, 8 * 4         ROW stands for 8 * 4 from here on
+ *     ld r2, :table+ROW       an operand folded at assembly time
+ *     addi r3, (:end-:start)/8
+ * An operand that isn't a register, literal, label or memory operand is an
+ * expression if it parses as one: literals, :label references, .equ names
+ * and ( ), with unary - and +, then * / % and then + - on 64-bit integers.
+ * It can't contain white space (that ends an operand), .equ's can. A label
+ * name in an expression ends at an operator, so ':a-1' is 'a' less 1 as
+ * long as that parses. A name must be defined above its first use, which
+ * lets the lexer tell an expression from a bad operand and keeps .equ's
+ * from being circular; labels may come later.
+ * pass2 folds the expression into a literal and emits the line as if it
+ * had been written that way, range checks included. A symbol is evaluated
+ * where it is used, with the final label addresses. Labels count as their
+ * addresses: the labels added less those subtracted must come to 0 (a
+ * constant) or 1 (an address, which 'brr' branches to relative to itself),
+ * and only constants multiply or divide. An object (-c) can't relocate an
+ * address expression. .equ's, like macros, need a sequential pass1: -j
+ * assembles such a program on one thread, --pipeline, --cache and
+ * --low-memory reject it, and so does a streamed stdin.
+ ******************************************************************************/
+#define EXPR_DEPTH 64   // ( ) and .equ names within each other
+
+typedef struct EquSymbol {
+    const char *name;   // in the input
+    size_t nameLen;
+    int depth;          // how deep the expression nests
+    int weight;         // labels added less labels subtracted
+    UT_hash_handle hh;
+    size_t exprLen;
+    char expr[];        // without its white space
+} EquSymbol;
+
+static __thread EquSymbol *equs;
+
+static void free_equs(void) {
+    EquSymbol *s, *tmp;
+    HASH_ITER(hh, equs, s, tmp) {
+        HASH_DEL(equs, s);
+        free(s);
+    }
+}
+
+static EquSymbol *find_equ(const char *name, size_t len) {
+    EquSymbol *s;
+    HASH_FIND(hh, equs, name, len, s);
+    return s;
+}
+
+static int is_name_char(char c) {
+    return CLASS(c) == CC_ALPHA || CLASS(c) == CC_DIGIT;
+}
+
+// the name at the start of `line`, 0 if there is none
+static size_t name_length(const char *line, size_t len) {
+    if (!len || CLASS(line[0]) != CC_ALPHA) {
+        return 0;
+    }
+    size_t n = 1;
+    while (n < len && is_name_char(line[n])) {
+        n++;
+    }
+    return n;
+}
+
+static int is_expr_operator(char c) {
+    return c == '+' || c == '-' || c == '*' || c == '/' || c == '%' || c == '(' || c == ')';
+}
+
+// the end of the label name at p (after the ':')
+static const char *expr_label_end(const char *p, const char *end) {
+    while (p < end && !is_expr_operator(*p)) {
+        p++;
+    }
+    return p;
+}
+
+typedef enum {
+    EXPR_OK,
+    EXPR_SYNTAX,        // not an expression (or one nesting too deep)
+    EXPR_UNDEFINED,     // names a label that isn't defined
+    EXPR_DIVIDE,        // divides by zero
+    EXPR_SCALE          // multiplies or divides an address
+} ExprStatus;
+
+typedef struct {
+    int64_t value;
+    int weight;         // labels added less labels subtracted
+} ExprValue;
+
+typedef struct {
+    const char *p, *end;
+    int eval;           // 0: only check the syntax
+    int depth, maxDepth;
+    ExprStatus status;
+    const char *missing;    // EXPR_UNDEFINED: the label's name
+    size_t missingLen;
+} ExprParser;
+
+static int expr_fail(ExprParser *e, ExprStatus status) {
+    if (e->status == EXPR_OK) {
+        e->status = status;
+    }
+    return 0;
+}
+
+static int expr_nest(ExprParser *e, int depth) {
+    if (e->depth + depth > EXPR_DEPTH) {
+        return expr_fail(e, EXPR_SYNTAX);
+    }
+    if (e->depth + depth > e->maxDepth) {
+        e->maxDepth = e->depth + depth;
+    }
+    return 1;
+}
+
+static int expr_sum(ExprParser *e, ExprValue *v);
+
+static ExprStatus expr_parse(const char *p, const char *end, int eval, int depth, ExprValue *v,
+                             ExprParser *e) {
+    *e = (ExprParser){ p, end, eval, depth, depth, EXPR_OK, NULL, 0 };
+    if (!expr_sum(e, v) || e->p != end) {
+        expr_fail(e, EXPR_SYNTAX);
+    }
+    return e->status;
+}
+
+// a literal, :label, .equ name or ( ... )
+static int expr_primary(ExprParser *e, ExprValue *v) {
+    const char *p = e->p, *end = e->end;
+    v->value = 0;
+    v->weight = 0;
+    if (p >= end) {
+        return expr_fail(e, EXPR_SYNTAX);
+    }
+    if (*p == '(') {
+        e->p++;
+        e->depth++;
+        if (!expr_nest(e, 0) || !expr_sum(e, v)) {
+            return 0;
+        }
+        e->depth--;
+        if (e->p >= end || *e->p != ')') {
+            return expr_fail(e, EXPR_SYNTAX);
+        }
+        e->p++;
+        return 1;
+    }
+    if (CLASS(*p) == CC_DIGIT) {
+        Token tk;
+        const char *q = lex_number(p, end, &tk);
+        if (tk.overflow || (q < end && is_name_char(*q))) {
+            return expr_fail(e, EXPR_SYNTAX);
+        }
+        v->value = (int64_t)tk.value;
+        e->p = q;
+        return 1;
+    }
+    if (*p == ':') {
+        const char *name = p + 1, *q = expr_label_end(name, end);
+        if (q == name) {
+            return expr_fail(e, EXPR_SYNTAX);
+        }
+        e->p = q;
+        v->weight = 1;
+        if (e->eval) {
+            size_t n = label_name_len(name, q);
+            uint32_t id = lookup_label_id(name, n, label_hash(name, n));
+            if (!id || labelAddresses[id] < 0) {
+                e->missing = name;
+                e->missingLen = n;
+                return expr_fail(e, EXPR_UNDEFINED);
+            }
+            v->value = labelAddresses[id];
+        }
+        return 1;
+    }
+    size_t n = name_length(p, (size_t)(end - p));
+    EquSymbol *s = n ? find_equ(p, n) : NULL;
+    if (!s || !expr_nest(e, s->depth + 1)) {
+        return expr_fail(e, EXPR_SYNTAX);
+    }
+    e->p = p + n;
+    v->weight = s->weight;
+    if (e->eval) {
+        ExprParser inner;
+        if (expr_parse(s->expr, s->expr + s->exprLen, 1, e->depth + 1, v, &inner) != EXPR_OK) {
+            e->missing = inner.missing;
+            e->missingLen = inner.missingLen;
+            return expr_fail(e, inner.status);
+        }
+    }
+    return 1;
+}
+
+// a primary after any number of signs
+static int expr_unary(ExprParser *e, ExprValue *v) {
+    int negate = 0;
+    while (e->p < e->end && (*e->p == '-' || *e->p == '+')) {
+        negate ^= *e->p++ == '-';
+    }
+    if (!expr_primary(e, v)) {
+        return 0;
+    }
+    if (negate) {
+        v->value = (int64_t)(0 - (uint64_t)v->value);
+        v->weight = -v->weight;
+    }
+    return 1;
+}
+
+static int expr_product(ExprParser *e, ExprValue *v) {
+    if (!expr_unary(e, v)) {
+        return 0;
+    }
+    while (e->p < e->end && (*e->p == '*' || *e->p == '/' || *e->p == '%')) {
+        char op = *e->p++;
+        ExprValue r;
+        if (!expr_unary(e, &r)) {
+            return 0;
+        }
+        if (v->weight || r.weight) {
+            return expr_fail(e, EXPR_SCALE);
+        }
+        if (!e->eval) {
+            continue;
+        }
+        if (op != '*' && r.value == 0) {
+            return expr_fail(e, EXPR_DIVIDE);
+        }
+        if (op == '*') {
+            v->value = (int64_t)((uint64_t)v->value * (uint64_t)r.value);
+        } else if (r.value == -1) {
+            v->value = op == '/' ? (int64_t)(0 - (uint64_t)v->value) : 0;
+        } else {
+            v->value = op == '/' ? v->value / r.value : v->value % r.value;
+        }
+    }
+    return 1;
+}
+
+static int expr_sum(ExprParser *e, ExprValue *v) {
+    if (!expr_product(e, v)) {
+        return 0;
+    }
+    while (e->p < e->end && (*e->p == '+' || *e->p == '-')) {
+        char op = *e->p++;
+        ExprValue r;
+        if (!expr_product(e, &r)) {
+            return 0;
+        }
+        if (op == '+') {
+            v->value = (int64_t)((uint64_t)v->value + (uint64_t)r.value);
+            v->weight += r.weight;
+        } else {
+            v->value = (int64_t)((uint64_t)v->value - (uint64_t)r.value);
+            v->weight -= r.weight;
+        }
+    }
+    return 1;
+}
+
+// 1 if [p, end) is an expression; *depth is how deep it nests and *weight
+// the labels it adds less those it subtracts
+static int is_expression(const char *p, const char *end, int *depth, int *weight) {
+    ExprParser e;
+    ExprValue v;
+    if (expr_parse(p, end, 0, 0, &v, &e) != EXPR_OK) {
+        return 0;
+    }
+    *depth = e.maxDepth;
+    *weight = v.weight;
+    return 1;
+}
+
+// the value of an operand expression, -1 if it has none or one outside
+// 0..INT32_MAX (a label address's range)
+static int expression_int(const char *p, size_t len) {
+    ExprParser e;
+    ExprValue v;
+    if (expr_parse(p, p + len, 1, 0, &v, &e) != EXPR_OK || v.value < 0 || v.value > INT32_MAX) {
+        return -1;
+    }
+    return (int)v.value;
+}
+
+// 1 if [p, end) is an expression an operand can be: a constant or an address
+static int is_operand_expression(const char *p, const char *end, Token *tk) {
+    int depth, weight;
+    if (!is_expression(p, end, &depth, &weight) || (weight != 0 && weight != 1)) {
+        return 0;
+    }
+    tk->weight = (uint64_t)weight;
+    return 1;
+}
+
+// 1 if a label operand from lex_line has an operator in it
+static int has_expr_operator(const char *p, const char *end) {
+    return expr_label_end(p, end) != end;
+}
+
+static int equ_directive(const char *line, size_t len) {
+    return len > 4 && !memcmp(line, ".equ", 4) && isspace((unsigned char)line[4]);
+}
+
+// a program with .equ's, which only a sequential pass1 can define
+static int has_equs(const char *data, size_t size) {
+    return memmem(data, size, ".equ", 4) != NULL;
+}
+
+// pass1 of '.equ NAME, EXPR' (the comma is optional); 0 after reporting an
+// invalid one
+static int define_equ(const char *line, size_t len) {
+    const char *p = line + 4, *end = line + len;
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    const char *name = p;
+    size_t nameLen = name_length(p, (size_t)(end - p));
+    p += nameLen;
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (p < end && *p == ',') {
+        p++;
+    }
+    const char *exprEnd = memchr(p, ';', (size_t)(end - p));
+    exprEnd = exprEnd ? exprEnd : end;
+    EquSymbol *s = malloc(sizeof(EquSymbol) + (size_t)(exprEnd - p));
+    if (!s) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    // white space may separate operators from what they apply to
+    size_t n = 0;
+    int joined = 0;
+    for (const char *q = p; q < exprEnd; q++) {
+        if (!isspace((unsigned char)*q)) {
+            joined |= n && q > p && isspace((unsigned char)q[-1]) &&
+                       !is_expr_operator(s->expr[n - 1]) && !is_expr_operator(*q);
+            s->expr[n++] = *q;
+        }
+    }
+    int depth, weight;
+    if (!nameLen || (name[0] == 'r' && nameLen > 1 && strspn(name + 1, "0123456789") >= nameLen - 1) ||
+        (name + nameLen < end && !isspace((unsigned char)name[nameLen]) && name[nameLen] != ',') ||
+        joined || !is_expression(s->expr, s->expr + n, &depth, &weight)) {
+        free(s);
+        fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+        return 0;
+    }
+    if (find_equ(name, nameLen)) {
+        free(s);
+        fprintf(diag(), "pass1 error: %.*s is already defined => %.*s\n", (int)nameLen, name, (int)len, line);
+        return 0;
+    }
+    s->name = name;
+    s->nameLen = nameLen;
+    s->depth = depth;
+    s->weight = weight;
+    s->exprLen = n;
+    HASH_ADD_KEYPTR(hh, equs, s->name, s->nameLen, s);
+    return 1;
+}
+
+// Runs of word and gap characters for lex_line: with the reader's masks
+// each run ends at a ctz, else (long lines, text not from a reader) the
+// bytes are classified one at a time.
+typedef struct {
+    const char *text, *end;
+    int masked;
+    uint64_t sep;       // separators, and every bit from the line end up
+    uint64_t nongap;    // bytes that aren't white space or ',', likewise
+} LexScan;
+
+static void lex_scan_init(LexScan *s, const char *text, size_t len, const LineMasks *mk) {
+    s->text = text;
+    s->end = text + len;
+    s->masked = mk && mk->valid && len < 64;
+    s->sep = s->nongap = 0;
+    if (s->masked) {
+        uint64_t stop = ~0ull << len;
+        s->sep = mk->gap | mk->semi | stop;
+        s->nongap = ~mk->gap | stop;
+    }
+}
+
+static int lex_separator(const LexScan *s, const char *p) {
+    return s->masked ? (int)(s->sep >> (p - s->text)) & 1 : is_separator(p, s->end);
+}
+
+// the first separator at or after p
+static const char *lex_word_end(const LexScan *s, const char *p) {
+    if (s->masked) {
+        return p + __builtin_ctzll(s->sep >> (p - s->text));
+    }
+    while (!is_separator(p, s->end)) {
+        p++;
+    }
+    return p;
+}
+
+// the first byte at or after p that isn't white space or ','
+static const char *lex_gap_end(const LexScan *s, const char *p) {
+    if (s->masked) {
+        return p + __builtin_ctzll(s->nongap >> (p - s->text));
+    }
+    while (p < s->end && (CLASS(*p) == CC_SPACE || CLASS(*p) == CC_COMMA)) {
+        p++;
+    }
+    return p;
+}
+
+// mk: the line's masks from next_line, or NULL
+static void lex_line(TokenLine *t, const char *text, size_t len, const LineMasks *mk) {
+    const char *p = text, *end = text + len;
+    LexScan scan;
+    lex_scan_init(&scan, text, len, mk);
+    t->text = text;
+    t->len = len;
+    t->numTokens = 0;
+    t->extra = 0;
+    t->labelTok = -1;
+
+    // mnemonic
+    const char *word = p;
+    p = lex_word_end(&scan, p);
+    t->op = lookup_opcode(word, (size_t)(p - word));
+
+    // operands
+    for (;;) {
+        p = lex_gap_end(&scan, p);
+        if (p >= end || CLASS(*p) == CC_SEMI) {
+            break;
+        }
+        Token scratch, *tk = &scratch;
+        if (t->numTokens < MAX_OPERANDS) {
+            tk = &t->tok[t->numTokens];
+        }
+        memset(tk, 0, sizeof(*tk));
+        const char *start = p, *q = NULL;
+        switch (CLASS(*p)) {
+        case CC_COLON:
+            q = lex_word_end(&scan, p + 1);
+            if (q > p + 1) {
+                tk->kind = TOK_LABEL;
+                start = p + 1;
+                tk->hash = label_hash(start, label_name_len(start, q));
+            } else {
+                q = NULL;
+            }
+            break;
+        case CC_LPAREN:
+            q = lex_memory(p, end, tk);
+            tk->kind = TOK_MEM;
+            break;
+        case CC_DIGIT:
+        case CC_SIGN:
+            q = lex_number(p, end, tk);
+            tk->kind = TOK_IMM;
+            break;
+        case CC_ALPHA:
+            if (*p == 'r' && p + 1 < end && CLASS(p[1]) == CC_DIGIT) {
+                q = p + 1;
+                while (q < end && CLASS(*q) == CC_DIGIT) {
+                    if (tk->reg < 1000) {
+                        tk->reg = tk->reg * 10 + (*q - '0');
+                    }
+                    q++;
+                }
+                tk->kind = TOK_REG;
+            }
+            break;
+        }
+        if (tk->kind == TOK_LABEL && has_expr_operator(start, q) && is_operand_expression(p, q, tk)) {
+            tk->kind = TOK_EXPR;
+            start = p;
+        } else if (!q || !lex_separator(&scan, q)) {
+            // not a well-formed operand => swallow the whole word, unless
+            // it is an expression
+            q = lex_word_end(&scan, p);
+            tk->kind = is_operand_expression(p, q, tk) ? TOK_EXPR : TOK_BAD;
+        }
+        tk->start = (uint32_t)(start - text);
+        tk->len = (uint32_t)(q - start);
+        if (t->numTokens < MAX_OPERANDS) {
+            if ((tk->kind == TOK_LABEL || tk->kind == TOK_EXPR) && t->labelTok < 0) {
+                t->labelTok = t->numTokens;
+            }
+            t->numTokens++;
+        } else {
+            t->extra = 1;
+        }
+        p = q;
+    }
+}
+
+// copy a label name (stopping at a separator) into a LabelAddress-sized buffer
+static int copy_label_name(const char *p, const char *end, char out[50]) {
+    int n = 0;
+    while (!is_separator(p, end) && n < 49) {
+        out[n++] = *p++;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static void token_label(const TokenLine *t, const Token *tk, char out[50]) {
+    const char *p = t->text + tk->start;
+    copy_label_name(p, p + tk->len, out);
+}
+
+/******************************************************************************
+ * Helper functions to check 12-bit ranges
+ * A label reference or an expression is accepted wherever a literal is; its
+ * value is only known in pass 2.
+ ******************************************************************************/
+static int is_signed_12_bit(const Token *tk) {
+    if (tk->kind == TOK_LABEL || tk->kind == TOK_EXPR) {
+        return 1;
+    }
+    if ((tk->kind != TOK_IMM && tk->kind != TOK_MEM) || tk->overflow) {
+        return 0;
+    }
+    return tk->negative ? tk->value <= 2048 : tk->value <= 2047;
+}
+
+static int is_unsigned_12_bit(const Token *tk) {
+    if (tk->kind == TOK_LABEL || tk->kind == TOK_EXPR) {
+        return 1;
+    }
+    if (tk->kind != TOK_IMM || tk->overflow) {
+        return 0;
+    }
+    return tk->value <= 4095 && (!tk->negative || tk->value == 0);
+}
+
+static int is_register(const Token *tk) {
+    return tk->kind == TOK_REG && tk->reg <= 31;
+}
+
+/******************************************************************************
+ * validate_brr: brr has two forms:
+ *   brr rX  (pc ← pc + rX)  opcode 0x9
+ *   brr L   (pc ← pc + L)   opcode 0xa, L can be negative
+ ******************************************************************************/
+static int validate_brr(const TokenLine *t) {
+    if (t->numTokens < 1) {
+        fprintf(diag(), "Error: 'brr' missing operand: %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    const Token *operand = &t->tok[0];
+    if (operand->kind == TOK_REG) {
+        // brr rX form
+        if (operand->reg > 31) {
+            fprintf(diag(), "Error: 'brr r%d' invalid register.\n", operand->reg);
+            return 0;
+        }
+        return 1; // valid
+    }
+    // brr L form => L is signed 12-bit
+    if (!is_signed_12_bit(operand)) {
+        fprintf(diag(), "Error: 'brr' literal out of [-2048..2047]: %.*s\n", TOKEN_ARGS(t, operand));
+        return 0;
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * validate_mov: Tinker has 4 forms of mov:
+ *  1) mov rD, (rS)(L)   => 0x10
+ *  2) mov rD, rS        => 0x11
+ *  3) mov rD, L         => 0x12
+ *  4) mov (rD)(L), rS   => 0x13
+ * We'll check them in pass1 to ensure correct usage and immediate range.
+ ******************************************************************************/
+static int validate_mov(const TokenLine *t) {
+    if (t->numTokens < 1) {
+        fprintf(diag(), "Error: incomplete 'mov' instruction: %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    const Token *dst = &t->tok[0];
+    const Token *src = t->numTokens > 1 ? &t->tok[1] : NULL;
+
+    if (dst->kind == TOK_MEM) {
+        // (d) mov (rD)(L), rS
+        if (!src || src->kind != TOK_REG) {
+            fprintf(diag(), "Error: 'mov (rD)(L), rS' => 'rS' is not a register? %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (src->reg > 31) {
+            fprintf(diag(), "Error: register out of range in mov (rD)(L), rS => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (dst->reg > 31) {
+            fprintf(diag(), "Error: 'mov (rD)(L), rS': register out of range => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (!is_signed_12_bit(dst)) {
+            fprintf(diag(), "Error: offset out of [-2048..2047] in 'mov (rD)(L), rS' => %.*s\n", TOKEN_ARGS(t, dst));
+            return 0;
+        }
+        return 1;
+    }
+
+    if (dst->kind == TOK_BAD && t->text[dst->start] == '(') {
+        fprintf(diag(), "Error: malformed memory operand in 'mov (rD)(L), rS' => %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    // otherwise, the first operand must be "rD"
+    if (dst->kind != TOK_REG) {
+        fprintf(diag(), "Error: mov => expected 'rD' or '(rD)(L)' => got: %.*s\n", TOKEN_ARGS(t, dst));
+        return 0;
+    }
+    if (dst->reg > 31) {
+        fprintf(diag(), "Error: register out of range in mov => %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    if (!src) {
+        fprintf(diag(), "Error: incomplete 'mov' => missing second operand: %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+
+    switch (src->kind) {
+    case TOK_REG:
+        // (a) mov rD, rS
+        if (src->reg > 31) {
+            fprintf(diag(), "Error: register out of range => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        return 1;
+    case TOK_MEM:
+        // (c) mov rD, (rS)(L)
+        if (src->reg > 31) {
+            fprintf(diag(), "Error: register out of range in 'mov rD, (rS)(L)' => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (!is_signed_12_bit(src)) {
+            fprintf(diag(), "Error: offset out of [-2048..2047] => %.*s\n", TOKEN_ARGS(t, src));
+            return 0;
+        }
+        return 1;
+    default:
+        if (src->kind == TOK_BAD && t->text[src->start] == '(') {
+            fprintf(diag(), "Error: malformed memory operand in 'mov rD, (rS)(L)' => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        // (b) mov rD, L
+        // We assume an unsigned 12-bit literal for bits 52..63
+        if (!is_unsigned_12_bit(src)) {
+            fprintf(diag(), "Error: mov rD, L => L out of [0..4095]: %.*s\n", TOKEN_ARGS(t, src));
+            return 0;
+        }
+        return 1;
+    }
+}
+
+/******************************************************************************
+ * For addi, subi, shftri, shftli (SHAPE_RL) => rD, 0..4095
+ ******************************************************************************/
+static int validate_instruction_immediate(const TokenLine *t) {
+    // must have a register and an unsigned 12-bit immediate
+    if (t->numTokens < 2) {
+        fprintf(diag(), "Error: missing immediate => %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    if (!is_register(&t->tok[0])) {
+        fprintf(diag(), "Error: register out of range => %.*s\n", LINE_ARGS(t));
+        return 0;
+    }
+    if (!is_unsigned_12_bit(&t->tok[1])) {
+        fprintf(diag(), "Error: %s => immediate out of [0..4095]: %.*s\n",
+                opNames[t->op], TOKEN_ARGS(t, &t->tok[1]));
+        return 0;
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * is_valid_instruction_pass1: check opcode and specialized forms (brr, mov, etc.)
+ ******************************************************************************/
+static int is_valid_instruction_pass1(const TokenLine *t) {
+    if (t->op == OP_NONE) {
+        return 0;
+    }
+    switch (opForms[t->op].shape) {
+    case SHAPE_BRR:
+        return validate_brr(t);
+    case SHAPE_MOV:
+        // check the operands for any of the 4 forms
+        return validate_mov(t);
+    case SHAPE_RL:
+        return validate_instruction_immediate(t);
+    default:
+        // the other shapes are checked by the encoder
+        return 1;
+    }
+}
+
+// bytes an instruction occupies once its macros are expanded
+static int instruction_size(Opcode op) {
+    return opForms[op].size;
+}
+
+// fetch the next trimmed line view; returns 0 at end of input
+static int next_line(LineReader *r, const char **line, size_t *len) {
+    if (!reader_next(r, line, len)) {
+        return 0;
+    }
+    stat_add(&stats.lines, 1);
+    stat_add(&stats.bytes, *len + 1);
+    const char *raw = *line;
+    trim_view(line, len);
+    if (r->masks.valid) {
+        r->masks.gap >>= *line - raw;
+        r->masks.semi >>= *line - raw;
+    }
+    return 1;
+}
+
+static int is_directive(const char *line, size_t len, const char *name) {
+    return len == strlen(name) && !memcmp(line, name, len);
+}
+
+static int starts_with(const char *line, size_t len, const char *prefix) {
+    size_t n = strlen(prefix);
+    return len >= n && !memcmp(line, prefix, n);
+}
+
+typedef enum { NONE, CODE, DATA } Section;
+
+// section selected by a directive line (pass1 matches on the prefix)
+static Section directive_section(const char *line, size_t len, Section current) {
+    if (starts_with(line, len, ".code")) {
+        return CODE;
+    }
+    if (starts_with(line, len, ".data")) {
+        return DATA;
+    }
+    return current;
+}
+
+/******************************************************************************
+ * Bulk data directives, in .data:
+ *   .quad V1, V2, ...   one 8-byte item per literal
+ *   .fill N[, V]        N items of V (0 if left out)
+ *   .incbin FILE        the bytes of FILE (relative to the working directory,
+ *                       optionally quoted), zero-padded to a multiple of 8
+ * pass1 sizes them from the line alone (and the file's size) instead of
+ * parsing a line per item. Binary output writes the items directly, an
+ * .incbin straight from a mapping of the file; text output expands them to
+ * one item per line, so it stays plain .data items. A ';' starts a comment.
+ * They are invalid in .code and, like other lines, ignored outside any
+ * section; a malformed one is invalid anywhere.
+ ******************************************************************************/
+#define BULK_MAX_BYTES (1 << 30)
+
+typedef enum { BULK_NONE, BULK_QUAD, BULK_FILL, BULK_INCBIN } BulkKind;
+
+// the kind of a '.' line and its operands, trimmed and without a comment
+static BulkKind bulk_kind(const char *line, size_t len, const char **args, size_t *argsLen) {
+    static const struct { const char *name; BulkKind kind; } names[] = {
+        { ".quad", BULK_QUAD }, { ".fill", BULK_FILL }, { ".incbin", BULK_INCBIN },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        size_t n = strlen(names[i].name);
+        if (!starts_with(line, len, names[i].name) || (len > n && !isspace((unsigned char)line[n]))) {
+            continue;
+        }
+        const char *semi = memchr(line + n, ';', len - n);
+        *args = line + n;
+        *argsLen = (semi ? (size_t)(semi - line) : len) - n;
+        trim_view(args, argsLen);
+        return names[i].kind;
+    }
+    return BULK_NONE;
+}
+
+// the next comma-separated item of [*p, end), trimmed; 0 after the last
+// one (*p is then NULL)
+static int next_bulk_item(const char **p, const char *end, const char **item, size_t *itemLen) {
+    if (!*p) {
+        return 0;
+    }
+    const char *comma = memchr(*p, ',', (size_t)(end - *p));
+    *item = *p;
+    *itemLen = (size_t)((comma ? comma : end) - *p);
+    trim_view(item, itemLen);
+    *p = comma ? comma + 1 : NULL;
+    return 1;
+}
+
+// the NUL-terminated file name of an .incbin, 0 if it has none or is too long
+static int incbin_path(const char *args, size_t argsLen, char path[4096]) {
+    if (argsLen >= 2 && args[0] == '"' && args[argsLen - 1] == '"') {
+        args++;
+        argsLen -= 2;
+    }
+    if (argsLen == 0 || argsLen >= 4096 || memchr(args, '\0', argsLen)) {
+        return 0;
+    }
+    memcpy(path, args, argsLen);
+    path[argsLen] = '\0';
+    return 1;
+}
+
+// the item count of a .fill, -1 if it isn't one
+static int64_t fill_count(const char *item, size_t len) {
+    Token tk;
+    const char *end = lex_number(item, item + len, &tk);
+    if (!end || end != item + len || tk.negative || tk.overflow || tk.value > BULK_MAX_BYTES / 8) {
+        return -1;
+    }
+    return (int64_t)tk.value;
+}
+
+// 0 if the line is no bulk directive; otherwise 1, with *size its bytes, or
+// -1 if it is malformed
+static int bulk_data_size(const char *line, size_t len, int *size) {
+    const char *args;
+    size_t argsLen;
+    BulkKind kind = bulk_kind(line, len, &args, &argsLen);
+    const char *p = args, *end = args + argsLen, *item;
+    size_t itemLen;
+    int64_t bytes = -1;
+    switch (kind) {
+    case BULK_NONE:
+        return 0;
+    case BULK_QUAD:
+        bytes = 0;
+        while (next_bulk_item(&p, end, &item, &itemLen)) {
+            if (!itemLen) {
+                bytes = -1;
+                break;
+            }
+            bytes += 8;
+        }
+        break;
+    case BULK_FILL: {
+        int64_t count = next_bulk_item(&p, end, &item, &itemLen) ? fill_count(item, itemLen) : -1;
+        int hasValue = next_bulk_item(&p, end, &item, &itemLen);
+        if (count >= 0 && (!hasValue || (itemLen && !next_bulk_item(&p, end, &item, &itemLen)))) {
+            bytes = 8 * count;
+        }
+        break;
+    }
+    case BULK_INCBIN: {
+        char path[4096];
+        struct stat st;
+        if (incbin_path(args, argsLen, path) && stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size <= BULK_MAX_BYTES - 8) {
+            bytes = (st.st_size + 7) & ~(int64_t)7;
+        }
+        break;
+    }
+    }
+    *size = bytes > BULK_MAX_BYTES ? -1 : (int)bytes;
+    return 1;
+}
+
+/******************************************************************************
+ * Alignment (.align N, in .code):
+ * Pads with 'addi r0, 0' to the next multiple of N, a power of two from 4
+ * to ALIGN_MAX, so what follows (a loop head, say) starts on a cache line.
+ * The padding depends on the address, which the chunked modes don't know
+ * while they size a piece of the input: -j assembles a program with .align
+ * on one thread, --pipeline and --cache (so --serve too) reject it. It is
+ * invalid in .data and in an object, which the linker places, and ignored
+ * outside any section. With -O, '--align-loops N' aligns every label that
+ * a later branch goes back to.
+ ******************************************************************************/
+#define ALIGN_MAX 4096
+
+// 0 if the line is no .align; otherwise its N, or -1 if it is malformed
+static int align_directive(const char *line, size_t len) {
+    if (!starts_with(line, len, ".align") || (len > 6 && !isspace((unsigned char)line[6]))) {
+        return 0;
+    }
+    const char *args = line + 6;
+    size_t argsLen = len - 6;
+    const char *semi = memchr(args, ';', argsLen);
+    if (semi) {
+        argsLen = (size_t)(semi - args);
+    }
+    trim_view(&args, &argsLen);
+    Token tk;
+    const char *end = argsLen ? lex_number(args, args + argsLen, &tk) : NULL;
+    if (!end || end != args + argsLen || tk.negative || tk.overflow || tk.value < 4 ||
+        tk.value > ALIGN_MAX || (tk.value & (tk.value - 1))) {
+        return -1;
+    }
+    return (int)tk.value;
+}
+
+// the bytes from `pc` to the next multiple of `n`
+static int align_padding(int pc, int n) {
+    return -pc & (n - 1);
+}
+
+// a program with .align, which only a sequential pass1 can place
+static int has_align(const char *data, size_t size) {
+    return memmem(data, size, ".align", 6) != NULL;
+}
+
+/******************************************************************************
+ * Image segments:
+ * Runs of consecutive .code or .data bytes, recorded while sizing the program
+ * so the binary writer knows its segment table before emitting anything.
+ ******************************************************************************/
+typedef struct {
+    Section kind;       // CODE or DATA
+    uint64_t address;
+    uint64_t size;
+} ImageSegment;
+
+typedef struct {
+    ImageSegment *items;
+    size_t num, cap;
+} SegmentList;
+
+static __thread SegmentList imageSegments;  // the program's image
+
+// account for `bytes` bytes at `address` in section `kind`
+static void add_segment_bytes(SegmentList *list, Section kind, int address, int bytes) {
+    if (list->num > 0) {
+        ImageSegment *last = &list->items[list->num - 1];
+        if (last->kind == kind && last->address + last->size == (uint64_t)address) {
+            last->size += (uint64_t)bytes;
+            return;
+        }
+    }
+    list->items = grow_array(list->items, &list->cap, list->num + 1, sizeof(ImageSegment));
+    list->items[list->num].kind = kind;
+    list->items[list->num].address = (uint64_t)address;
+    list->items[list->num].size = (uint64_t)bytes;
+    list->num++;
+}
+
+static void note_segment_bytes(Section kind, int address, int bytes) {
+    add_segment_bytes(&imageSegments, kind, address, bytes);
+}
+
+static void free_segments(void) {
+    free(imageSegments.items);
+    imageSegments.items = NULL;
+    imageSegments.num = imageSegments.cap = 0;
+}
+
+/******************************************************************************
+ * Machine instructions:
+ * Tinker encodes every instruction in 32 bits:
+ *   opcode[31:27] rd[26:22] rs[21:17] rt[16:12] L[11:0]
+ * The macro expansions and the encoder emit through emit_insn, which either
+ * prints the instruction as text or appends its little-endian encoding.
+ ******************************************************************************/
+enum {
+    MOP_AND = 0x0, MOP_OR = 0x1, MOP_XOR = 0x2, MOP_NOT = 0x3,
+    MOP_SHFTR = 0x4, MOP_SHFTRI = 0x5, MOP_SHFTL = 0x6, MOP_SHFTLI = 0x7,
+    MOP_BR = 0x8, MOP_BRR_R = 0x9, MOP_BRR_L = 0xa, MOP_BRNZ = 0xb,
+    MOP_CALL = 0xc, MOP_RETURN = 0xd, MOP_BRGT = 0xe, MOP_PRIV = 0xf,
+    MOP_MOV_LOAD = 0x10, MOP_MOV_RR = 0x11, MOP_MOV_RL = 0x12, MOP_MOV_STORE = 0x13,
+    MOP_ADDF = 0x14, MOP_SUBF = 0x15, MOP_MULF = 0x16, MOP_DIVF = 0x17,
+    MOP_ADD = 0x18, MOP_ADDI = 0x19, MOP_SUB = 0x1a, MOP_SUBI = 0x1b,
+    MOP_MUL = 0x1c, MOP_DIV = 0x1d,
+    NUM_MOPS,
+    MOP_NONE = -1   // an Opcode that is a macro
+};
+
+// operand layout of a machine instruction (also its text form)
+typedef enum {
+    FMT_RRR,    // op rd, rs, rt
+    FMT_RR,     // op rd, rs
+    FMT_RL,     // op rd, L
+    FMT_R,      // op rd
+    FMT_L,      // op L
+    FMT_NONE,   // op
+    FMT_PRIV,   // priv rd, rs, rt, L
+    FMT_LOAD,   // mov rd, (rs)(L)
+    FMT_STORE   // mov (rd)(L), rs
+} InsnFormat;
+
+/* The machine instructions, X(MOP_ suffix, name, InsnFormat): machineOps,
+ * which the encoder prints with, and disasmOps, which the disassembler
+ * decodes with, are both generated from it. */
+#define TINKER_MACHINE_OPS(X) \
+    X(AND, "and", FMT_RRR)          X(OR, "or", FMT_RRR) \
+    X(XOR, "xor", FMT_RRR)          X(NOT, "not", FMT_RR) \
+    X(SHFTR, "shftr", FMT_RRR)      X(SHFTRI, "shftri", FMT_RL) \
+    X(SHFTL, "shftl", FMT_RRR)      X(SHFTLI, "shftli", FMT_RL) \
+    X(BR, "br", FMT_R)              X(BRR_R, "brr", FMT_R) \
+    X(BRR_L, "brr", FMT_L)          X(BRNZ, "brnz", FMT_RR) \
+    X(CALL, "call", FMT_R)          X(RETURN, "return", FMT_NONE) \
+    X(BRGT, "brgt", FMT_RRR)        X(PRIV, "priv", FMT_PRIV) \
+    X(MOV_LOAD, "mov", FMT_LOAD)    X(MOV_RR, "mov", FMT_RR) \
+    X(MOV_RL, "mov", FMT_RL)        X(MOV_STORE, "mov", FMT_STORE) \
+    X(ADDF, "addf", FMT_RRR)        X(SUBF, "subf", FMT_RRR) \
+    X(MULF, "mulf", FMT_RRR)        X(DIVF, "divf", FMT_RRR) \
+    X(ADD, "add", FMT_RRR)          X(ADDI, "addi", FMT_RL) \
+    X(SUB, "sub", FMT_RRR)          X(SUBI, "subi", FMT_RL) \
+    X(MUL, "mul", FMT_RRR)          X(DIV, "div", FMT_RRR)
+
+#define MACHINE_OP_ROW(id, name, format) [MOP_##id] = { name, format },
+
+static const struct {
+    const char *name;
+    InsnFormat format;
+} machineOps[NUM_MOPS] = { TINKER_MACHINE_OPS(MACHINE_OP_ROW) };
+
+// machine opcode of each Opcode (of brr and mov, the register form)
+static const int8_t opMops[NUM_OPCODES] = { TINKER_ISA(ISA_MOP) };
+
+// ld, push, pop, in, out, clr and halt expand to several instructions
+static int is_macro_op(Opcode op) {
+    return (unsigned)op < NUM_OPCODES && opMops[op] == MOP_NONE;
+}
+
+/******************************************************************************
+ * Intermediate representation:
+ * pass1 turns every source line it keeps into one 16-byte IrInsn, .data
+ * literals go to a separate word array, and label operands become indices
+ * into a reference table resolved once all labels are known. Layout
+ * relaxation and pass2 (text or binary) then work on the records instead of
+ * the text. A line the IR has no exact form for (a malformed operand, a
+ * line outside any section, ...) is kept as IR_RAW and pass2 lexes its
+ * source text again, so its output and diagnostics stay what they were.
+ ******************************************************************************/
+// record kinds beyond the Opcodes
+enum {
+    IR_DIRECTIVE = NUM_OPCODES, // a '.' line; rd is the section after it, imm is 1
+                                // if the line is exactly .code or .data
+    IR_DATA,                    // a .data literal, word indexes ir.words
+    IR_RAW,                     // emitted from the source text, imm is its size
+    IR_BRANCH,                  // relaxed 'ld rX, :label; br rX', a brr to the label
+    IR_MACHINE,                 // one machine instruction made by the peephole pass
+    IR_STACK,                   // one push/pop of a coalesced run, see coalesce_stack
+    IR_POOL,                    // ld of a pooled constant, word indexes ir.pool
+    IR_NOP,                     // emits nothing (the br of a relaxed pair)
+    IR_ALIGN                    // padding to a multiple of 1 << rs, imm is its size
+};
+
+#define IR_LABEL 0x80           // in mop: the literal operand is a label reference
+#define POOL_MAX 512            // entries of the --pool table
+#define POOL_OFFSET(i) (8 * (int64_t)(i) - 2048)   // of entry i from the base register
+
+typedef struct {
+    uint8_t op;         // Opcode or IR_* kind
+    uint8_t mop;        // machine opcode of a non-macro instruction, | IR_LABEL
+    uint8_t rd;
+    uint8_t rs;         // OP_LD: 4-byte words its expansion occupies, IR_POOL: base register
+    uint32_t line;      // source line, indexes ir.lines
+    union {
+        int64_t imm;    // literal operand (the full 64-bit value for ld)
+        uint32_t ref;   // IR_LABEL: indexes ir.refs
+        uint32_t word;  // IR_DATA: indexes ir.words
+        uint8_t rt;     // three-register forms
+    };
+} IrInsn;
+
+typedef char IrInsnSize[sizeof(IrInsn) == 16 ? 1 : -1];
+
+typedef struct {
+    const char *text;   // trimmed line, in the input pass1 read
+    uint32_t len;
+    uint32_t number;    // 1-based line number
+} IrLine;
+
+typedef struct {
+    uint32_t id;            // the label's, 0 until resolved or if it is undefined
+    uint32_t line;          // the referencing line
+    uint32_t start;         // label name (after the ':') within the line
+    uint32_t len;
+    uint32_t hash;          // label_hash from the lexer
+    uint32_t expr;          // 1: start and len cover an expression instead
+} IrRef;
+
+// a label definition, attached to the record that follows it
+typedef struct {
+    LabelAddress *entry;
+    size_t insn;
+} IrLabel;
+
+typedef struct {
+    IrInsn *insns;
+    size_t num, cap;
+    IrLine *lines;
+    size_t numLines, capLines;
+    IrRef *refs;
+    size_t numRefs, capRefs;
+    uint64_t *words;
+    size_t numWords, capWords;
+    IrLabel *labels;
+    size_t numLabels, capLabels;
+    uint64_t *pool;         // --pool constants, placed after the image
+    size_t numPool, capPool;
+    size_t poolInsn;        // the ld of the pool base register
+    int poolAddress;
+    LineReader source;      // pass1's input, which ir.lines point into
+    int haveSource;
+} Ir;
+
+static __thread Ir ir;
+
+static IrInsn *ir_append(int op, const char *line, size_t len, uint32_t number) {
+    ir.lines = grow_counted(MEM_IR, ir.lines, &ir.capLines, ir.numLines + 1, sizeof(IrLine));
+    ir.lines[ir.numLines] = (IrLine){ line, (uint32_t)len, number };
+    ir.insns = grow_counted(MEM_IR, ir.insns, &ir.cap, ir.num + 1, sizeof(IrInsn));
+    IrInsn *in = &ir.insns[ir.num++];
+    memset(in, 0, sizeof(*in));
+    in->op = (uint8_t)op;
+    in->line = (uint32_t)ir.numLines++;
+    return in;
+}
+
+// make `tk` (a label or an expression) the record's literal operand
+static void ir_label_operand(IrInsn *in, const TokenLine *t, const Token *tk) {
+    ir.refs = grow_counted(MEM_IR, ir.refs, &ir.capRefs, ir.numRefs + 1, sizeof(IrRef));
+    const char *name = t->text + tk->start;
+    if (tk->kind == TOK_EXPR) {
+        ir.refs[ir.numRefs] = (IrRef){ 0, in->line, tk->start, tk->len, 0, 1 };
+    } else {
+        ir.refs[ir.numRefs] = (IrRef){ 0, in->line, tk->start,
+                                       (uint32_t)label_name_len(name, name + tk->len), tk->hash, 0 };
+    }
+    in->mop |= IR_LABEL;
+    in->ref = (uint32_t)ir.numRefs++;
+}
+
+// literal, label or expression operand at slot `i`; only the line's first
+// label or expression counts, and a brr's expression must be an address
+static int ir_value_operand(IrInsn *in, const TokenLine *t, int i) {
+    const Token *tk = &t->tok[i];
+    if (tk->kind == TOK_LABEL || tk->kind == TOK_EXPR) {
+        if (t->labelTok != i || (tk->kind == TOK_EXPR && t->op == OP_BRR && !tk->weight)) {
+            return 0;
+        }
+        ir_label_operand(in, t, tk);
+        return 1;
+    }
+    if (tk->kind != TOK_IMM || tk->overflow) {
+        return 0;
+    }
+    in->imm = tk->negative ? -(int64_t)tk->value : (int64_t)tk->value;
+    return 1;
+}
+
+// fill in the operands of a validated .code line; 0 if it has no exact form
+static int ir_operands(IrInsn *in, const TokenLine *t) {
+    const Token *a = &t->tok[0], *b = &t->tok[1];
+    int regs = 0;   // leading register operands, all in range
+    while (regs < t->numTokens && is_register(&t->tok[regs])) {
+        regs++;
+    }
+    if (t->extra || (t->labelTok >= 0 && t->labelTok != t->numTokens - 1)) {
+        return 0;
+    }
+    in->mop = is_macro_op(t->op) ? 0 : (uint8_t)opMops[t->op];
+    in->rd = regs > 0 ? (uint8_t)a->reg : 0;
+    in->rs = regs > 1 ? (uint8_t)b->reg : 0;
+    switch (opForms[t->op].shape) {
+    case SHAPE_RRR:
+        if (t->numTokens != 3 || regs != 3) {
+            return 0;
+        }
+        in->rt = (uint8_t)t->tok[2].reg;
+        return 1;
+    case SHAPE_RR:
+        return t->numTokens == 2 && regs == 2;
+    case SHAPE_R:
+        return t->numTokens == 1 && regs == 1;
+    case SHAPE_NONE:
+        return t->numTokens == 0;
+    case SHAPE_RL:
+        return t->numTokens == 2 && regs >= 1 && ir_value_operand(in, t, 1);
+    case SHAPE_BRR:
+        if (t->numTokens != 1) {
+            return 0;
+        }
+        if (regs == 1) {
+            in->mop = MOP_BRR_R;
+            return 1;
+        }
+        in->mop = MOP_BRR_L;
+        return ir_value_operand(in, t, 0);
+    case SHAPE_MOV:
+        if (t->numTokens != 2) {
+            return 0;
+        }
+        if (a->kind == TOK_MEM) {
+            in->mop = MOP_MOV_STORE;
+            in->rd = (uint8_t)a->reg;
+            in->rs = (uint8_t)b->reg;
+            in->imm = a->negative ? -(int64_t)a->value : (int64_t)a->value;
+        } else if (b->kind == TOK_REG) {
+            in->mop = MOP_MOV_RR;
+        } else if (b->kind == TOK_MEM) {
+            in->mop = MOP_MOV_LOAD;
+            in->rs = (uint8_t)b->reg;
+            in->imm = b->negative ? -(int64_t)b->value : (int64_t)b->value;
+        } else {
+            in->mop = MOP_MOV_RL;
+            return ir_value_operand(in, t, 1);
+        }
+        return 1;
+    case SHAPE_LD:
+        in->rs = 12;
+        return t->numTokens == 2 && regs == 1 && !b->negative && ir_value_operand(in, t, 1);
+    default:
+        return 0;
+    }
+}
+
+// a validated .code line
+static void ir_add_code(const TokenLine *t, uint32_t number, int size) {
+    IrInsn *in = ir_append(t->op, t->text, t->len, number);
+    size_t refs = ir.numRefs;
+    if (!ir_operands(in, t)) {
+        ir.numRefs = refs;
+        memset(in, 0, sizeof(*in));
+        in->op = IR_RAW;
+        in->line = (uint32_t)(ir.numLines - 1);
+        in->imm = size;
+    }
+}
+
+// a .data line: its literal, or the raw text if it is not just a literal
+static void ir_add_data(const char *line, size_t len, uint32_t number) {
+    Token tk;
+    const char *end = lex_number(line, line + len, &tk);
+    if (!end || end != line + len || tk.overflow) {
+        ir_append(IR_RAW, line, len, number)->imm = 8;
+        return;
+    }
+    ir.words = grow_counted(MEM_IR, ir.words, &ir.capWords, ir.numWords + 1, sizeof(uint64_t));
+    ir.words[ir.numWords] = tk.negative ? (uint64_t)0 - tk.value : tk.value;
+    ir_append(IR_DATA, line, len, number)->word = (uint32_t)ir.numWords++;
+}
+
+// look up every label operand, once all definitions are in
+static void ir_resolve_refs(void) {
+    if (!grow_label_ids()) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    for (size_t i = 0; i < ir.numRefs; i++) {
+        IrRef *r = &ir.refs[i];
+        if (!r->expr) {
+            r->id = lookup_label_id(ir.lines[r->line].text + r->start, r->len, r->hash);
+        }
+    }
+}
+
+// address of a record's label operand, -1 if the label is undefined; the
+// value of an expression, -1 if it has none or one outside 0..INT32_MAX
+// (emit_ir_source then reports it or takes it as it is)
+static int ir_label_address(const IrInsn *in) {
+    const IrRef *r = &ir.refs[in->ref];
+    if (r->expr) {
+        return expression_int(ir.lines[r->line].text + r->start, r->len);
+    }
+    return labelAddresses[r->id];
+}
+
+// bytes a record occupies
+static int ir_size(const IrInsn *in) {
+    if (in->op < NUM_OPCODES) {
+        return in->op == OP_LD ? 4 * in->rs : opForms[in->op].size;
+    }
+    switch (in->op) {
+    case IR_DATA:
+        return 8;
+    case IR_RAW:
+    case IR_ALIGN:
+        return (int)in->imm;
+    case IR_STACK:
+        return in->rs ? 8 : 4;
+    case IR_DIRECTIVE:
+    case IR_NOP:
+        return 0;
+    default:
+        return 4;
+    }
+}
+
+static void free_macros(void);
+
+static void free_ir(void) {
+    free_macros();
+    free_equs();
+    if (ir.haveSource) {
+        reader_close(&ir.source);
+    }
+    mem_free(MEM_IR, ir.cap * sizeof(IrInsn) + ir.capLines * sizeof(IrLine) + ir.capRefs * sizeof(IrRef) +
+                     ir.capWords * sizeof(uint64_t) + ir.capLabels * sizeof(IrLabel) + ir.capPool * sizeof(uint64_t));
+    free(ir.insns);
+    free(ir.lines);
+    free(ir.refs);
+    free(ir.words);
+    free(ir.labels);
+    free(ir.pool);
+    memset(&ir, 0, sizeof(ir));
+}
+
+/******************************************************************************
+ * Macros (.macro NAME [P, ...] ... .endm):
+ * A definition is compiled once into a template: each body line is cut into
+ * literal pieces, which point into the input, and parameter slots (\P, and
+ * \@ for a number unique to each invocation). An invocation 'NAME A, ...'
+ * renders the pieces with its arguments into a text arena, which the IR
+ * records point into as they point into the input, and each line goes
+ * through pass1 as if it had been written there.
+ * A .code line is lexed and validated on its first invocation only: its
+ * record is kept, along with the fields (rd, rs, rt) its register
+ * parameters filled, and later invocations whose arguments there are
+ * registers again copy the record and patch those fields. Other lines
+ * (labels, directives, data, immediate or label arguments, nested
+ * invocations) are lexed as rendered.
+ * Invocations nest up to MACRO_DEPTH deep. A macro can't be named like an
+ * instruction, nor defined twice or inside another. The chunked modes see
+ * no definitions in other chunks: -j assembles a program with macros on one
+ * thread, --pipeline and --cache reject it, and so does a streamed stdin
+ * (-s reads it whole).
+ ******************************************************************************/
+#define MACRO_DEPTH 16
+#define MACRO_MAX_PARAMS 16
+#define MACRO_UNIQUE (-2)           // the \@ slot
+#define MACRO_TEXT_BLOCK (64 * 1024)
+
+typedef struct {
+    const char *text;   // literal text, in the input
+    uint32_t len;
+    int param;          // then this parameter's argument, -1 for none, or MACRO_UNIQUE
+} MacroPiece;
+
+typedef struct {
+    size_t firstPiece, numPieces;
+    int compiled;       // 1: insn is the record of the first .code invocation, -1: lex every time
+    int size;           // bytes of that record
+    IrInsn insn;
+    int numRegSlots;
+    uint8_t regParam[3], regField[3];   // parameter -> 0 rd, 1 rs, 2 rt
+    size_t refPiece;    // IR_LABEL: the reference is in this literal piece ...
+    uint32_t refOffset; // ... at this offset
+    IrRef ref;
+} MacroLine;
+
+typedef struct Macro {
+    const char *name;   // in the input
+    size_t nameLen;
+    int numParams;
+    const char *params[MACRO_MAX_PARAMS];
+    size_t paramLens[MACRO_MAX_PARAMS];
+    MacroLine *lines;
+    size_t numLines, capLines;
+    MacroPiece *pieces;
+    size_t numPieces, capPieces;
+    UT_hash_handle hh;
+} Macro;
+
+typedef struct MacroText {
+    struct MacroText *next;
+    size_t used, size;
+    char text[];
+} MacroText;
+
+static __thread struct {
+    Macro *table;
+    MacroText *text;        // the arena rendered lines live in
+    uint32_t invocations;   // for \@
+    int depth;
+} macros;
+
+static void free_macros(void) {
+    Macro *m, *tmp;
+    HASH_ITER(hh, macros.table, m, tmp) {
+        HASH_DEL(macros.table, m);
+        free(m->lines);
+        free(m->pieces);
+        free(m);
+    }
+    while (macros.text) {
+        MacroText *next = macros.text->next;
+        free(macros.text);
+        macros.text = next;
+    }
+    memset(&macros, 0, sizeof(macros));
+}
+
+// `len` bytes in the text arena, valid until free_ir
+static char *macro_text(size_t len) {
+    MacroText *b = macros.text;
+    if (!b || b->size - b->used < len) {
+        size_t size = len > MACRO_TEXT_BLOCK ? len : MACRO_TEXT_BLOCK;
+        b = malloc(sizeof(MacroText) + size);
+        if (!b) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        b->next = macros.text;
+        b->used = 0;
+        b->size = size;
+        macros.text = b;
+    }
+    char *p = b->text + b->used;
+    b->used += len;
+    return p;
+}
+
+// 1 for .macro, 2 for .endm, else 0
+static int macro_directive(const char *line, size_t len) {
+    if (len >= 6 && !memcmp(line, ".macro", 6) && (len == 6 || isspace((unsigned char)line[6]))) {
+        return 1;
+    }
+    if (len >= 5 && !memcmp(line, ".endm", 5) && (len == 5 || isspace((unsigned char)line[5]) || line[5] == ';')) {
+        return 2;
+    }
+    return 0;
+}
+
+// a program with macros, which only a sequential pass1 can expand
+static int has_macros(const char *data, size_t size) {
+    return memmem(data, size, ".macro", 6) != NULL;
+}
+
+static Macro *find_macro(const char *name, size_t len) {
+    Macro *m;
+    HASH_FIND(hh, macros.table, name, len, m);
+    return m;
+}
+
+// the macro a line invokes, if any
+static Macro *macro_call(const char *line, size_t len) {
+    size_t n = name_length(line, len);
+    if (!n || (n < len && !isspace((unsigned char)line[n]) && line[n] != ';') ||
+        lookup_opcode(line, n) != OP_NONE) {
+        return NULL;
+    }
+    return find_macro(line, n);
+}
+
+// cut a body line into pieces; 0 (reported) if it names no parameter
+static int compile_macro_line(Macro *m, const char *line, size_t len, uint32_t number) {
+    m->lines = grow_array(m->lines, &m->capLines, m->numLines + 1, sizeof(MacroLine));
+    MacroLine *ml = &m->lines[m->numLines++];
+    memset(ml, 0, sizeof(*ml));
+    ml->firstPiece = m->numPieces;
+    const char *end = line + len, *lit = line, *slash;
+    const char *semi = memchr(line, ';', len);    // a comment is literal
+    const char *scanEnd = semi ? semi : end;
+    while (lit < scanEnd && (slash = memchr(lit, '\\', (size_t)(scanEnd - lit))) != NULL) {
+        int param = -1;
+        size_t n = 1;
+        if (slash + 1 < scanEnd && slash[1] == '@') {
+            param = MACRO_UNIQUE;
+        } else {
+            n = name_length(slash + 1, (size_t)(scanEnd - slash - 1));
+            for (int i = 0; n && i < m->numParams; i++) {
+                if (m->paramLens[i] == n && !memcmp(m->params[i], slash + 1, n)) {
+                    param = i;
+                }
+            }
+        }
+        if (param == -1) {
+            fprintf(diag(), "pass1 error: line %u: no such macro parameter => %.*s\n", number, (int)len, line);
+            return 0;
+        }
+        m->pieces = grow_array(m->pieces, &m->capPieces, m->numPieces + 1, sizeof(MacroPiece));
+        m->pieces[m->numPieces++] = (MacroPiece){ lit, (uint32_t)(slash - lit), param };
+        lit = slash + 1 + n;
+    }
+    if (lit < end || ml->firstPiece == m->numPieces) {
+        m->pieces = grow_array(m->pieces, &m->capPieces, m->numPieces + 1, sizeof(MacroPiece));
+        m->pieces[m->numPieces++] = (MacroPiece){ lit, (uint32_t)(end - lit), -1 };
+    }
+    ml->numPieces = m->numPieces - ml->firstPiece;
+    return 1;
+}
+
+// a .macro line and its body, up to .endm, from `fin`; 0 after reporting an error
+static int define_macro(LineReader *fin, const char *line, size_t len, uint32_t *number) {
+    const char *p = line + 6, *end = line + len;
+    const char *semi = memchr(p, ';', (size_t)(end - p));
+    if (semi) {
+        end = semi;
+    }
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    size_t n = name_length(p, (size_t)(end - p));
+    if (!n || (p + n < end && !isspace((unsigned char)p[n]) && p[n] != ',') ||
+        lookup_opcode(p, n) != OP_NONE || find_macro(p, n)) {
+        fprintf(diag(), "pass1 error: invalid macro name => %.*s\n", (int)len, line);
+        return 0;
+    }
+    Macro *m = calloc(1, sizeof(Macro));
+    if (!m) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    m->name = p;
+    m->nameLen = n;
+    // parameters: names separated by ',' and/or white space
+    for (p += n;;) {
+        while (p < end && (isspace((unsigned char)*p) || *p == ',')) {
+            p++;
+        }
+        if (p >= end) {
+            break;
+        }
+        n = name_length(p, (size_t)(end - p));
+        if (!n || m->numParams == MACRO_MAX_PARAMS) {
+            fprintf(diag(), "pass1 error: invalid macro parameters => %.*s\n", (int)len, line);
+            free(m);
+            return 0;
+        }
+        m->params[m->numParams] = p;
+        m->paramLens[m->numParams++] = n;
+        p += n;
+    }
+
+    uint32_t first = *number;
+    const char *body;
+    size_t bodyLen;
+    int ok = 1, closed = 0;
+    while (ok && !closed && next_line(fin, &body, &bodyLen)) {
+        (*number)++;
+        if (!bodyLen || body[0] == ';') {
+            continue;
+        }
+        switch (body[0] == '.' ? macro_directive(body, bodyLen) : 0) {
+        case 1:
+            fprintf(diag(), "pass1 error: line %u: .macro inside a macro => %.*s\n",
+                    *number, (int)bodyLen, body);
+            ok = 0;
+            break;
+        case 2:
+            closed = 1;
+            break;
+        default:
+            ok = compile_macro_line(m, body, bodyLen, *number);
+            break;
+        }
+    }
+    if (ok && !closed) {
+        fprintf(diag(), "pass1 error: line %u: .macro without .endm => %.*s\n", first, (int)len, line);
+        ok = 0;
+    }
+    if (!ok) {
+        free(m->lines);
+        free(m->pieces);
+        free(m);
+        return 0;
+    }
+    HASH_ADD_KEYPTR(hh, macros.table, m->name, m->nameLen, m);
+    return 1;
+}
+
+static int pass1_line(const char *line, size_t len, uint32_t number, const LineMasks *masks,
+                      Section *section, int *programCounter);
+
+// the register an argument names (r0 to r31), -1 if it is anything else
+static int register_argument(const char *arg, size_t len) {
+    if (len < 2 || len > 3 || arg[0] != 'r' || CLASS(arg[1]) != CC_DIGIT ||
+        (len == 3 && (arg[1] == '0' || CLASS(arg[2]) != CC_DIGIT))) {
+        return -1;
+    }
+    int reg = len == 3 ? (arg[1] - '0') * 10 + (arg[2] - '0') : arg[1] - '0';
+    return reg <= 31 ? reg : -1;
+}
+
+// one invocation's arguments, \@ included
+typedef struct {
+    const char *text[MACRO_MAX_PARAMS];
+    size_t len[MACRO_MAX_PARAMS];
+    char unique[11];
+    size_t uniqueLen;
+} MacroArgs;
+
+static const char *macro_arg(const MacroArgs *a, int param, size_t *len) {
+    if (param == MACRO_UNIQUE) {
+        *len = a->uniqueLen;
+        return a->unique;
+    }
+    *len = param < 0 ? 0 : a->len[param];
+    return a->text[param < 0 ? 0 : param];
+}
+
+// where piece `k` of a line starts in its rendering
+static size_t macro_piece_offset(const Macro *m, const MacroLine *ml, const MacroArgs *a, size_t k) {
+    size_t at = 0, argLen;
+    for (size_t i = 0; i < k; i++) {
+        const MacroPiece *pc = &m->pieces[ml->firstPiece + i];
+        macro_arg(a, pc->param, &argLen);
+        at += pc->len + argLen;
+    }
+    return at;
+}
+
+// a body line with the arguments in, in the text arena
+static const char *render_macro_line(const Macro *m, const MacroLine *ml, const MacroArgs *a, size_t *len) {
+    const MacroPiece *pc = &m->pieces[ml->firstPiece];
+    if (ml->numPieces == 1 && pc->param == -1) {
+        *len = pc->len;
+        return pc->text;    // no parameter: the line in the input
+    }
+    size_t total = macro_piece_offset(m, ml, a, ml->numPieces);
+    char *text = macro_text(total), *q = text;
+    for (size_t i = 0; i < ml->numPieces; i++) {
+        size_t argLen;
+        const char *arg = macro_arg(a, pc[i].param, &argLen);
+        memcpy(q, pc[i].text, pc[i].len);
+        memcpy(q + pc[i].len, arg, argLen);
+        q += pc[i].len + argLen;
+    }
+    *len = total;
+    return text;
+}
+
+// after the first invocation of a .code line made the last record: keep it
+// if every parameter in the line was a whole register operand, and a label
+// reference sits in a literal piece
+static void compile_macro_insn(const Macro *m, MacroLine *ml, const MacroArgs *a, const TokenLine *t) {
+    const IrInsn *in = &ir.insns[ir.num - 1];
+    const MacroPiece *pc = &m->pieces[ml->firstPiece];
+    ml->compiled = -1;
+    if (in->op == IR_RAW) {
+        return;
+    }
+    for (size_t i = 0; i < ml->numPieces; i++) {
+        if (pc[i].param == -1) {
+            continue;
+        }
+        size_t argLen, at = macro_piece_offset(m, ml, a, i) + pc[i].len;
+        macro_arg(a, pc[i].param, &argLen);
+        int field = -1;
+        for (int k = 0; k < 3 && k < t->numTokens; k++) {
+            if (t->tok[k].kind == TOK_REG && t->tok[k].start == at && t->tok[k].len == argLen) {
+                field = k;
+            }
+        }
+        if (pc[i].param == MACRO_UNIQUE || field < 0 || ml->numRegSlots == 3) {
+            return;
+        }
+        ml->regParam[ml->numRegSlots] = (uint8_t)pc[i].param;
+        ml->regField[ml->numRegSlots++] = (uint8_t)field;
+    }
+    if (in->mop & IR_LABEL) {
+        uint32_t start = ir.refs[in->ref].start;
+        size_t i = 0;
+        for (; i < ml->numPieces; i++) {
+            size_t at = macro_piece_offset(m, ml, a, i);
+            if (start >= at && start + ir.refs[in->ref].len <= at + pc[i].len) {
+                ml->refOffset = (uint32_t)(start - at);
+                break;
+            }
+        }
+        if (i == ml->numPieces) {
+            return;
+        }
+        ml->refPiece = i;
+        ml->ref = ir.refs[in->ref];
+    }
+    ml->insn = *in;
+    ml->compiled = 1;
+}
+
+// a later invocation of a compiled .code line; 0 if its arguments don't fit
+static int instantiate_macro_insn(const Macro *m, const MacroLine *ml, const MacroArgs *a, uint32_t number,
+                                  int *programCounter) {
+    int regs[3];
+    for (int k = 0; k < ml->numRegSlots; k++) {
+        if ((regs[k] = register_argument(a->text[ml->regParam[k]], a->len[ml->regParam[k]])) < 0) {
+            return 0;
+        }
+    }
+    size_t len;
+    const char *text = render_macro_line(m, ml, a, &len);
+    IrInsn *in = ir_append(ml->insn.op, text, len, number);
+    uint32_t line = in->line;
+    *in = ml->insn;
+    in->line = line;
+    for (int k = 0; k < ml->numRegSlots; k++) {
+        uint8_t *field = ml->regField[k] == 0 ? &in->rd : ml->regField[k] == 1 ? &in->rs : &in->rt;
+        *field = (uint8_t)regs[k];
+    }
+    if (in->mop & IR_LABEL) {
+        ir.refs = grow_counted(MEM_IR, ir.refs, &ir.capRefs, ir.numRefs + 1, sizeof(IrRef));
+        IrRef *r = &ir.refs[ir.numRefs];
+        *r = ml->ref;
+        r->line = line;
+        r->start = (uint32_t)(macro_piece_offset(m, ml, a, ml->refPiece) + ml->refOffset);
+        in->ref = (uint32_t)ir.numRefs++;
+    }
+    note_segment_bytes(CODE, *programCounter, ml->size);
+    *programCounter += ml->size;
+    return 1;
+}
+
+// an invocation of `m`: pass1 of its body with the arguments in; 0 after
+// reporting an invalid line
+static int expand_macro(Macro *m, const char *line, size_t len, uint32_t number,
+                        Section *section, int *programCounter) {
+    MacroArgs a;
+    const char *p = line + m->nameLen, *end = line + len;
+    const char *semi = memchr(p, ';', (size_t)(end - p));
+    if (semi) {
+        end = semi;
+    }
+    int n = 0;
+    while (p < end && isspace((unsigned char)*p)) {
+        p++;
+    }
+    while (p < end && n < MACRO_MAX_PARAMS + 1) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *argEnd = comma ? comma : end;
+        const char *arg = p;
+        size_t argLen = (size_t)(argEnd - p);
+        trim_view(&arg, &argLen);
+        if (n < MACRO_MAX_PARAMS) {
+            a.text[n] = arg;
+            a.len[n] = argLen;
+        }
+        n++;
+        p = comma ? comma + 1 : end;
+    }
+    if (n != m->numParams) {
+        fprintf(diag(), "pass1 error: %.*s takes %d argument(s) => %.*s\n",
+                (int)m->nameLen, m->name, m->numParams, (int)len, line);
+        return 0;
+    }
+    if (macros.depth == MACRO_DEPTH) {
+        fprintf(diag(), "pass1 error: macros nested over %d deep => %.*s\n", MACRO_DEPTH, (int)len, line);
+        return 0;
+    }
+    a.uniqueLen = (size_t)snprintf(a.unique, sizeof(a.unique), "%u", macros.invocations++);
+
+    macros.depth++;
+    int ok = 1;
+    for (size_t i = 0; ok && i < m->numLines; i++) {
+        MacroLine *ml = &m->lines[i];
+        if (ml->compiled == 1 && *section == CODE && instantiate_macro_insn(m, ml, &a, number, programCounter)) {
+            continue;
+        }
+        size_t renderedLen, textLen;
+        const char *rendered = render_macro_line(m, ml, &a, &renderedLen), *text = rendered;
+        textLen = renderedLen;
+        trim_view(&text, &textLen);
+        if (!textLen || text[0] == ';') {
+            continue;
+        }
+        size_t before = ir.num;
+        ok = pass1_line(text, textLen, number, NULL, section, programCounter);
+        if (ok && !ml->compiled && *section == CODE && ir.num == before + 1) {
+            TokenLine t;
+            lex_line(&t, text, textLen, NULL);
+            ml->compiled = -1;
+            if (t.op != OP_NONE && ir.insns[before].op == t.op && text == rendered && textLen == renderedLen) {
+                ml->size = instruction_size(t.op);
+                compile_macro_insn(m, ml, &a, &t);
+            }
+        }
+    }
+    macros.depth--;
+    return ok;
+}
+
+/******************************************************************************
+ * Include units (.include FILE):
+ * Assembles FILE (relative to the working directory, optionally quoted) as
+ * if its lines stood in place of the directive: they continue in its
+ * section and at its address, and leave their last section behind. A ';'
+ * starts a comment.
+ * The first .include of a text parses it into a unit: its IR records and
+ * label definitions, with indices and addresses relative to where it
+ * starts. Including the same text in the same section again copies the
+ * records in, rebases them and adds the labels at the new address, instead
+ * of lexing and validating every line again. Units are kept for the life
+ * of the process and shared by its threads, so the jobs of --assemble and
+ * the builds of --serve reuse each other's, and are keyed by a digest of
+ * the text, so an edited file is parsed afresh. A unit is only copied where
+ * its parse can't have depended on the program around it: one with .align,
+ * .equ, .macro or .include lines of its own, or included while a macro or
+ * an .equ is defined, is parsed every time.
+ * Like .align it needs a sequential pass1: -j and --serve assemble such a
+ * program on one thread; --pipeline, --cache, --low-memory and streamed
+ * input reject it.
+ ******************************************************************************/
+#define INCLUDE_DEPTH 16    // .include within included files
+
+#define DIGEST_SEED 14695981039346656037ull
+
+// FNV-1a over `n` more bytes, from `h` (DIGEST_SEED to start)
+static uint64_t digest_bytes(uint64_t h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+typedef struct {
+    uint64_t hash;          // digest of the text
+    uint64_t size;
+    uint64_t section;       // the one the text starts in
+} IncludeKey;
+
+typedef struct {
+    char name[50];
+    int offset;             // from the unit's start address
+    size_t insn;            // the record it is attached to, within the unit
+} IncludeLabel;
+
+typedef struct IncludeUnit {
+    IncludeKey key;
+    LineReader file;        // the text, which IR lines point into
+    int cached;             // the records below can be copied in
+    IrInsn *insns;          // line, ref and word relative to the unit
+    size_t num;
+    IrLine *lines;
+    size_t numLines;
+    IrRef *refs;            // line relative to the unit
+    size_t numRefs;
+    uint64_t *words;
+    size_t numWords;
+    IncludeLabel *labels;
+    size_t numLabels;
+    int size;               // bytes from the start address to the end
+    Section endSection;
+    struct IncludeUnit *next;   // every unit, in the table or not
+    UT_hash_handle hh;
+} IncludeUnit;
+
+static struct {
+    pthread_mutex_t lock;
+    IncludeUnit *table;
+    IncludeUnit *all;
+} includes = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL };
+
+static __thread int includeDepth;
+
+static int pass1_lines(LineReader *fin, Section *section, int *programCounter);
+
+static int include_directive(const char *line, size_t len) {
+    return len > 8 && !memcmp(line, ".include", 8) && isspace((unsigned char)line[8]);
+}
+
+// a program with .include's, which only a sequential pass1 can splice in
+static int has_includes(const char *data, size_t size) {
+    return memmem(data, size, ".include", 8) != NULL;
+}
+
+// a copy of `n` items of `size` bytes; NULL if out of memory (or n is 0)
+static void *copy_items(const void *items, size_t n, size_t size) {
+    void *p = n ? malloc(n * size) : NULL;
+    if (p) {
+        memcpy(p, items, n * size);
+    }
+    return p;
+}
+
+// keep what pass1 appended to the IR since `from` as the unit's records,
+// which started at `startPc`; u stays uncached if out of memory
+static void save_unit(IncludeUnit *u, const Ir *from, int startPc, Section section, int programCounter) {
+    u->num = ir.num - from->num;
+    u->numLines = ir.numLines - from->numLines;
+    u->numRefs = ir.numRefs - from->numRefs;
+    u->numWords = ir.numWords - from->numWords;
+    u->numLabels = ir.numLabels - from->numLabels;
+    u->insns = copy_items(ir.insns + from->num, u->num, sizeof(IrInsn));
+    u->lines = copy_items(ir.lines + from->numLines, u->numLines, sizeof(IrLine));
+    u->refs = copy_items(ir.refs + from->numRefs, u->numRefs, sizeof(IrRef));
+    u->words = copy_items(ir.words + from->numWords, u->numWords, sizeof(uint64_t));
+    u->labels = u->numLabels ? malloc(u->numLabels * sizeof(IncludeLabel)) : NULL;
+    if ((u->num && !u->insns) || (u->numLines && !u->lines) || (u->numRefs && !u->refs) ||
+        (u->numWords && !u->words) || (u->numLabels && !u->labels)) {
+        free(u->insns);
+        free(u->lines);
+        free(u->refs);
+        free(u->words);
+        free(u->labels);
+        return;
+    }
+    for (size_t i = 0; i < u->num; i++) {
+        IrInsn *in = &u->insns[i];
+        in->line -= (uint32_t)from->numLines;
+        if (in->mop & IR_LABEL) {
+            in->ref -= (uint32_t)from->numRefs;
+        } else if (in->op == IR_DATA) {
+            in->word -= (uint32_t)from->numWords;
+        }
+    }
+    for (size_t i = 0; i < u->numRefs; i++) {
+        u->refs[i].line -= (uint32_t)from->numLines;
+    }
+    for (size_t i = 0; i < u->numLabels; i++) {
+        const IrLabel *l = &ir.labels[from->numLabels + i];
+        IncludeLabel *to = &u->labels[i];
+        // a label defined twice is where its last definition put it
+        strcpy(to->name, l->entry->label);
+        to->offset = label_address(l->entry) - startPc;
+        to->insn = l->insn - from->num;
+    }
+    u->size = programCounter - startPc;
+    u->endSection = section;
+    u->cached = 1;
+}
+
+// append a cached unit's records to the IR, at *programCounter, as pass1
+// of its lines would have
+static void splice_unit(const IncludeUnit *u, Section *section, int *programCounter) {
+    size_t insnBase = ir.num, lineBase = ir.numLines, refBase = ir.numRefs, wordBase = ir.numWords;
+    ir.insns = grow_counted(MEM_IR, ir.insns, &ir.cap, ir.num + u->num, sizeof(IrInsn));
+    ir.lines = grow_counted(MEM_IR, ir.lines, &ir.capLines, ir.numLines + u->numLines, sizeof(IrLine));
+    ir.refs = grow_counted(MEM_IR, ir.refs, &ir.capRefs, ir.numRefs + u->numRefs, sizeof(IrRef));
+    ir.words = grow_counted(MEM_IR, ir.words, &ir.capWords, ir.numWords + u->numWords, sizeof(uint64_t));
+    memcpy(ir.lines + lineBase, u->lines, u->numLines * sizeof(IrLine));
+    memcpy(ir.words + wordBase, u->words, u->numWords * sizeof(uint64_t));
+    for (size_t i = 0; i < u->numRefs; i++) {
+        ir.refs[refBase + i] = u->refs[i];
+        ir.refs[refBase + i].line += (uint32_t)lineBase;
+    }
+    Section s = *section;
+    int pc = *programCounter;
+    for (size_t i = 0; i < u->num; i++) {
+        IrInsn *in = &ir.insns[insnBase + i];
+        *in = u->insns[i];
+        in->line += (uint32_t)lineBase;
+        if (in->mop & IR_LABEL) {
+            in->ref += (uint32_t)refBase;
+        } else if (in->op == IR_DATA) {
+            in->word += (uint32_t)wordBase;
+        }
+        if (in->op == IR_DIRECTIVE) {
+            s = (Section)in->rd;
+        }
+        int size = ir_size(in);
+        if (size && s != NONE) {
+            note_segment_bytes(s, pc, size);
+        }
+        pc += size;
+    }
+    ir.num += u->num;
+    ir.numLines += u->numLines;
+    ir.numRefs += u->numRefs;
+    ir.numWords += u->numWords;
+    for (size_t i = 0; i < u->numLabels; i++) {
+        LabelAddress *entry = add_label(u->labels[i].name, *programCounter + u->labels[i].offset);
+        if (entry) {
+            ir.labels = grow_counted(MEM_IR, ir.labels, &ir.capLabels, ir.numLabels + 1, sizeof(IrLabel));
+            ir.labels[ir.numLabels++] = (IrLabel){ entry, insnBase + u->labels[i].insn };
+        }
+    }
+    *programCounter += u->size;
+    *section = u->endSection;
+}
+
+// pass1 of a unit's text
+static int parse_unit(const IncludeUnit *u, Section *section, int *programCounter) {
+    LineReader view;
+    reader_view(&view, u->file.data, u->file.size);
+    includeDepth++;
+    int ok = pass1_lines(&view, section, programCounter);
+    includeDepth--;
+    stat_add(&stats.includesParsed, 1);
+    return ok;
+}
+
+// pass1 of an .include line; 0 after reporting an error
+static int include_file(const char *line, size_t len, Section *section, int *programCounter) {
+    const char *args = line + 8;
+    size_t argsLen = len - 8;
+    const char *semi = memchr(args, ';', argsLen);
+    if (semi) {
+        argsLen = (size_t)(semi - args);
+    }
+    trim_view(&args, &argsLen);
+    char path[4096];
+    if (!incbin_path(args, argsLen, path)) {
+        fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+        return 0;
+    }
+    if (includeDepth >= INCLUDE_DEPTH) {
+        fprintf(diag(), "pass1 error: .include nested too deeply => %.*s\n", (int)len, line);
+        return 0;
+    }
+    LineReader file;
+    if (!strcmp(path, "-") || !reader_open(&file, path)) {
+        fprintf(diag(), "pass1 error: can't open %s => %.*s\n", path, (int)len, line);
+        return 0;
+    }
+    reader_slurp(&file);
+    IncludeKey key = { digest_bytes(DIGEST_SEED, file.data, file.size), file.size, (uint64_t)*section };
+    IncludeUnit *u;
+    pthread_mutex_lock(&includes.lock);
+    HASH_FIND(hh, includes.table, &key, sizeof(key), u);
+    pthread_mutex_unlock(&includes.lock);
+    int reusable = !macros.table && !equs;
+    if (u) {
+        reader_close(&file);
+        if (u->cached && reusable) {
+            splice_unit(u, section, programCounter);
+            stat_add(&stats.includesReused, 1);
+            return 1;
+        }
+        return parse_unit(u, section, programCounter);
+    }
+    u = calloc(1, sizeof(*u));
+    if (!u) {
+        reader_close(&file);
+        fprintf(diag(), "Error: out of memory.\n");
+        return 0;
+    }
+    u->key = key;
+    u->file = file;
+    Ir from = ir;
+    int startPc = *programCounter;
+    int ok = parse_unit(u, section, programCounter);
+    if (ok && reusable && !has_align(file.data, file.size) && !has_equs(file.data, file.size) &&
+        !has_macros(file.data, file.size) && !has_includes(file.data, file.size)) {
+        save_unit(u, &from, startPc, *section, *programCounter);
+    }
+    // kept even if another thread added the same text meanwhile, or pass1
+    // failed: the IR points into it
+    pthread_mutex_lock(&includes.lock);
+    u->next = includes.all;
+    includes.all = u;
+    IncludeUnit *other;
+    HASH_FIND(hh, includes.table, &key, sizeof(key), other);
+    if (ok && !other) {
+        HASH_ADD(hh, includes.table, key, sizeof(key), u);
+    }
+    pthread_mutex_unlock(&includes.lock);
+    return ok;
+}
+
+/******************************************************************************
+ * PASS 1: Gather labels, track the program counter, ensure valid instructions.
+ ******************************************************************************/
+// pass1 of one line (non-empty, not a comment); masks as for lex_line.
+// Returns 0 after reporting an invalid line.
+static int pass1_line(const char *line, size_t len, uint32_t number, const LineMasks *masks,
+                      Section *section, int *programCounter) {
+    TokenLine t;
+    // check for disrectives.
+    int size, align;
+    if (line[0] == '.' && macro_directive(line, len)) {
+        fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+        return 0;
+    }
+    if (line[0] == '.' && (align = align_directive(line, len)) && (align < 0 || *section != NONE)) {
+        if (align < 0 || *section == DATA) {
+            fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+            return 0;
+        }
+        IrInsn *in = ir_append(IR_ALIGN, line, len, number);
+        in->rs = (uint8_t)__builtin_ctz((unsigned)align);
+        in->imm = align_padding(*programCounter, align);
+        if (in->imm) {
+            note_segment_bytes(CODE, *programCounter, (int)in->imm);
+        }
+        *programCounter += (int)in->imm;
+        return 1;
+    }
+    if (line[0] == '.' && bulk_data_size(line, len, &size) && (size < 0 || *section != NONE)) {
+        if (size < 0 || *section == CODE) {
+            fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+            return 0;
+        }
+        if (size) {
+            note_segment_bytes(DATA, *programCounter, size);
+        }
+        *programCounter += size;
+        ir_append(IR_RAW, line, len, number)->imm = size;
+        return 1;
+    }
+    if (line[0] == '.' && equ_directive(line, len)) {
+        return define_equ(line, len);   // no record: the output has only its values
+    }
+    if (line[0] == '.' && include_directive(line, len)) {
+        return include_file(line, len, section, programCounter);
+    }
+    if (line[0] == '.') {
+        *section = directive_section(line, len, *section);
+        IrInsn *in = ir_append(IR_DIRECTIVE, line, len, number);
+        in->rd = (uint8_t)*section;
+        in->imm = is_directive(line, len, ".code") || is_directive(line, len, ".data");
+        return 1;
+    }
+    // label definition.
+    if (line[0] == ':') {
+        char labelName[50];
+        if (copy_label_name(line + 1, line + len, labelName)) {
+            LabelAddress *entry = add_label(labelName, *programCounter);
+            if (entry) {
+                ir.labels = grow_counted(MEM_IR, ir.labels, &ir.capLabels, ir.numLabels + 1, sizeof(IrLabel));
+                ir.labels[ir.numLabels++] = (IrLabel){ entry, ir.num };
+            }
+        }
+        return 1;
+    }
+    // macro invocation, in any section
+    Macro *m;
+    if (macros.table && (m = macro_call(line, len)) != NULL) {
+        return expand_macro(m, line, len, number, section, programCounter);
+    }
+    // process instructions/data
+    if (*section == CODE) {
+        // validate the instruction
+        lex_line(&t, line, len, masks);
+        if (!is_valid_instruction_pass1(&t)) {
+            fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+            return 0;
+        }
+        // macros expansions for pass1 counting
+        int size = instruction_size(t.op);
+        note_segment_bytes(CODE, *programCounter, size);
+        *programCounter += size;
+        ir_add_code(&t, number, size);
+    } 
+    else if (*section == DATA) {
+        // Each data item is 8 bytes
+        note_segment_bytes(DATA, *programCounter, 8);
+        *programCounter += 8;
+        ir_add_data(line, len, number);
+    }
+    else {
+        // no address; pass2 still copies it through in text mode
+        ir_append(IR_RAW, line, len, number);
+    }
+    return 1;
+}
+
+// pass1 over the lines of `fin`, continuing from *section / *programCounter,
+// appending to the IR. The line views must stay valid until free_ir.
+// Returns 0 after reporting an invalid line.
+static int pass1_lines(LineReader *fin, Section *section, int *programCounter) {
+    const char *line;
+    size_t len;
+    uint32_t number = 0;
+    while (next_line(fin, &line, &len)) {
+        number++;
+        if (!len || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == '.' && macro_directive(line, len) == 1) {
+            if (!define_macro(fin, line, len, &number)) {
+                return 0;
+            }
+            continue;
+        }
+        if (!pass1_line(line, len, number, &fin->masks, section, programCounter)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// pass1 over ir.source, which holds the whole input
+static void pass1_source(void) {
+    reserve_label_table(count_label_lines(&ir.source));
+    Section section = NONE;
+    int programCounter = 0x1000; // tinker code starts at address 0x1000
+    if (!pass1_lines(&ir.source, &section, &programCounter)) {
+        fail();
+    }
+    ir_resolve_refs();
+}
+
+static void pass1(const char *filename) {
+    if (!reader_open(&ir.source, filename)) {
+        diag_errno("pass1: open");
+        fail();
+    }
+    ir.haveSource = 1;
+    reader_slurp(&ir.source);   // a pipe too: the IR points into the input
+    pass1_source();
+}
+
+/******************************************************************************
+ * Output buffer:
+ * Everything pass2 and single-pass produce is formatted into one large
+ * buffer that goes out with a single write() whenever it fills up, instead
+ * of one stdio call per emitted instruction. A memory output (fd < 0) grows
+ * its buffer instead, for chunks assembled in parallel.
+ ******************************************************************************/
+#define OUT_BUFFER_SIZE (1 << 20)
+#define OUT_MAX_ITEM 64     // longest single item (an instruction) out_reserve hands out
+
+// label reference left for the linker (object output)
+typedef enum {
+    RELOC_ABS12 = 0,    // 12-bit L field holds the address
+    RELOC_PCREL12 = 1,  // brr: L holds the address relative to the brr
+    RELOC_LD = 2,       // the 12 words of an ld sequence load the address
+    RELOC_LD24 = 3      // the 4 words of an expandLd24 sequence load the address
+} RelocKind;
+
+typedef struct {
+    int address;        // of the instruction (sequence)
+    RelocKind kind;
+    char name[50];
+} PendingReloc;
+
+typedef struct {
+    PendingReloc *items;
+    size_t num, cap;
+} RelocList;
+
+typedef struct {
+    int fd;
+    int binary;     // write encoded words instead of text
+    int optimize;   // ld uses the shortest sequence, sized by layout_ir
+    int errors;     // lines that could not be encoded
+    char *buf;
+    size_t len;
+    size_t cap;
+    RelocList *relocs;  // object output: label references become relocations
+    char *tmp;          // --if-changed: the file written instead of the output, NULL if none
+    uint64_t digest;    // with tmp: of the bytes written so far
+    uint64_t written;
+} Output;
+
+/* --if-changed: a file output is written to OUTPUT.tmp, hashed on its way
+ * out, and only renamed over OUTPUT if it differs from what OUTPUT.digest
+ * recorded (digest, size and mtime) the last time OUTPUT was written.
+ * Otherwise OUTPUT is left alone, mtime included, so downstream builds see
+ * no change. */
+static int ifChanged;
+
+static void write_all(int fd, const char *p, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t w = write(fd, p + done, n - done);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            diag_errno("write output");
+            fail();
+        }
+        done += (size_t)w;
+    }
+}
+
+// count `n` bytes about to go to the output file
+static void out_account(Output *out, const char *p, size_t n) {
+    stat_add(&stats.emitted, n);
+    if (out->tmp) {
+        out->digest = digest_bytes(out->digest, p, n);
+        out->written += n;
+    }
+}
+
+// `n` bytes straight to the output file, behind everything flushed
+static void out_write(Output *out, const char *p, size_t n) {
+    out_account(out, p, n);
+    write_all(out->fd, p, n);
+}
+
+static void out_flush(Output *out) {
+    out_write(out, out->buf, out->len);
+    out->len = 0;
+}
+
+// room for at least `n` more bytes (n <= OUT_BUFFER_SIZE)
+static char *out_reserve(Output *out, size_t n) {
+    if (out->len + n > out->cap) {
+        if (out->fd >= 0) {
+            out_flush(out);
+        } else {
+            out->buf = grow_array(out->buf, &out->cap, out->len + n, 1);
+        }
+    }
+    return out->buf + out->len;
+}
+
+static void out_bytes(Output *out, const void *data, size_t n) {
+    const char *p = data;
+    while (n > 0) {
+        size_t chunk = n < OUT_BUFFER_SIZE ? n : OUT_BUFFER_SIZE;
+        memcpy(out_reserve(out, chunk), p, chunk);
+        out->len += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+static void out_char(Output *out, char c) {
+    *out_reserve(out, 1) = c;
+    out->len++;
+}
+
+// decimal digits of v at p, returns the end
+static char *format_int(char *p, int64_t v) {
+    char tmp[20];
+    int n = 0;
+    uint64_t u = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+    if (v < 0) {
+        *p++ = '-';
+    }
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    while (n) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+static void out_int(Output *out, int64_t v) {
+    char *start = out_reserve(out, 20);
+    out->len += (size_t)(format_int(start, v) - start);
+}
+
+static char *format_str(char *p, const char *s) {
+    while (*s) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char *format_reg(char *p, int r) {
+    *p++ = 'r';
+    if (r >= 10) {
+        *p++ = (char)('0' + r / 10);
+    }
+    *p++ = (char)('0' + r % 10);
+    return p;
+}
+
+static uint32_t encode_insn(int mop, int rd, int rs, int rt, int64_t L) {
+    return (uint32_t)mop << 27 | (uint32_t)(rd & 31) << 22 |
+           (uint32_t)(rs & 31) << 17 | (uint32_t)(rt & 31) << 12 |
+           (uint32_t)(L & 0xFFF);
+}
+
+static void put_le32(Output *out, uint32_t v) {
+    unsigned char *b = (unsigned char *)out_reserve(out, 4);
+    b[0] = (unsigned char)v;
+    b[1] = (unsigned char)(v >> 8);
+    b[2] = (unsigned char)(v >> 16);
+    b[3] = (unsigned char)(v >> 24);
+    out->len += 4;
+}
+
+static void put_le64(Output *out, uint64_t v) {
+    put_le32(out, (uint32_t)v);
+    put_le32(out, (uint32_t)(v >> 32));
+}
+
+static void emit_insn(Output *out, int mop, int rd, int rs, int rt, int64_t L) {
+    if (out->binary) {
+        put_le32(out, encode_insn(mop, rd, rs, rt, L));
+        return;
+    }
+    // registers are 0..31, so a line never exceeds OUT_MAX_ITEM
+    char *start = out_reserve(out, OUT_MAX_ITEM), *p = start;
+    *p++ = '\t';
+    p = format_str(p, machineOps[mop].name);
+    switch (machineOps[mop].format) {
+    case FMT_RRR:
+    case FMT_PRIV:
+        *p++ = ' ';
+        p = format_reg(p, rd);
+        p = format_str(p, ", ");
+        p = format_reg(p, rs);
+        p = format_str(p, ", ");
+        p = format_reg(p, rt);
+        if (machineOps[mop].format == FMT_PRIV) {
+            p = format_str(p, ", ");
+            p = format_int(p, L);
+        }
+        break;
+    case FMT_RR:
+        *p++ = ' ';
+        p = format_reg(p, rd);
+        p = format_str(p, ", ");
+        p = format_reg(p, rs);
+        break;
+    case FMT_RL:
+        *p++ = ' ';
+        p = format_reg(p, rd);
+        p = format_str(p, ", ");
+        p = format_int(p, L);
+        break;
+    case FMT_R:
+        *p++ = ' ';
+        p = format_reg(p, rd);
+        break;
+    case FMT_L:
+        *p++ = ' ';
+        p = format_int(p, L);
+        break;
+    case FMT_NONE:
+        break;
+    case FMT_LOAD:
+        *p++ = ' ';
+        p = format_reg(p, rd);
+        p = format_str(p, ", (");
+        p = format_reg(p, rs);
+        p = format_str(p, ")(");
+        p = format_int(p, L);
+        *p++ = ')';
+        break;
+    case FMT_STORE:
+        p = format_str(p, " (");
+        p = format_reg(p, rd);
+        p = format_str(p, ")(");
+        p = format_int(p, L);
+        p = format_str(p, "), ");
+        p = format_reg(p, rs);
+        break;
+    }
+    *p++ = '\n';
+    out->len += (size_t)(p - start);
+}
+
+// a source line copied through, tab-prefixed
+static void emit_text_line(Output *out, const char *text, size_t len) {
+    out_char(out, '\t');
+    out_bytes(out, text, len);
+    out_char(out, '\n');
+}
+
+/******************************************************************************
+ * Macro expansions (Pass 2)
+ ******************************************************************************/
+static void expandIn(int rD, int rS, Output *out) {
+    emit_insn(out, MOP_PRIV, rD, rS, 0, 3);
+}
+static void expandOut(int rD, int rS, Output *out) {
+    emit_insn(out, MOP_PRIV, rD, rS, 0, 4);
+}
+static void expandClr(int rD, Output *out) {
+    emit_insn(out, MOP_XOR, rD, rD, rD, 0);
+}
+static void expandHalt(Output *out) {
+    emit_insn(out, MOP_PRIV, 0, 0, 0, 0);
+}
+static void expandPush(int rD, Output *out) {
+    emit_insn(out, MOP_MOV_STORE, 31, rD, 0, -8);
+    emit_insn(out, MOP_SUBI, 31, 0, 0, 8);
+}
+static void expandPop(int rD, Output *out) {
+    emit_insn(out, MOP_MOV_LOAD, rD, 31, 0, 0);
+    emit_insn(out, MOP_ADDI, 31, 0, 0, 8);
+}
+
+/******************************************************************************
+ * expandLd: Expand an ld macro into 12 instructions (48 bytes).
+ ******************************************************************************/
+static void expandLd(int rD, uint64_t L, Output *out) {
+    emit_insn(out, MOP_XOR, rD, rD, rD, 0);
+
+    int64_t top12  = (int64_t)((L >> 52) & 0xFFF);
+    int64_t mid12a = (int64_t)((L >> 40) & 0xFFF);
+    int64_t mid12b = (int64_t)((L >> 28) & 0xFFF);
+    int64_t mid12c = (int64_t)((L >> 16) & 0xFFF);
+    int64_t mid4   = (int64_t)((L >> 4)  & 0xFFF);
+    int64_t last4  = (int64_t)(L & 0xF);
+
+    emit_insn(out, MOP_ADDI, rD, 0, 0, top12);
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 12);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, mid12a);
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 12);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, mid12b);
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 12);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, mid12c);
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 12);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, mid4);
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 4);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, last4);
+}
+
+/******************************************************************************
+ * Short ld sequences (-O):
+ * The value is split into 12-bit chunks from the bottom (the top chunk has
+ * the remaining 4 bits). After the clearing xor, the highest non-zero chunk
+ * is added, and each following non-zero chunk is shifted in and added.
+ * Shifts across zero chunks are merged, so ld r1, 0 is a single xor and a
+ * value below 4096 is xor + addi.
+ ******************************************************************************/
+#define LD_MAX_STEPS 12
+
+typedef struct {
+    int mop;        // MOP_ADDI or MOP_SHFTLI (the leading xor is implied)
+    int64_t imm;
+} LdStep;
+
+// steps after the xor for value L, returns their count
+static int ld_steps(uint64_t L, LdStep steps[LD_MAX_STEPS]) {
+    int n = 0, started = 0, shift = 0;
+    for (int low = 60; low >= 0; low -= 12) {
+        int64_t chunk = (int64_t)((L >> low) & 0xFFF);
+        if (started) {
+            shift += 12;
+        }
+        if (chunk) {
+            if (shift) {
+                steps[n++] = (LdStep){MOP_SHFTLI, shift};
+                shift = 0;
+            }
+            steps[n++] = (LdStep){MOP_ADDI, chunk};
+            started = 1;
+        }
+    }
+    if (shift) {
+        steps[n++] = (LdStep){MOP_SHFTLI, shift};
+    }
+    return n;
+}
+
+// bytes of the shortest ld sequence for value L
+static int ld_size(uint64_t L) {
+    LdStep steps[LD_MAX_STEPS];
+    return 4 * (1 + ld_steps(L, steps));
+}
+
+// shortest ld sequence, padded with 'addi rD, 0' to the `bytes` the layout reserved
+static void expandLdShort(int rD, uint64_t L, int bytes, Output *out) {
+    LdStep steps[LD_MAX_STEPS];
+    int n = ld_steps(L, steps);
+    emit_insn(out, MOP_XOR, rD, rD, rD, 0);
+    for (int i = 0; i < n; i++) {
+        emit_insn(out, steps[i].mop, rD, 0, 0, steps[i].imm);
+    }
+    for (int pad = 4 * (1 + n); pad < bytes; pad += 4) {
+        emit_insn(out, MOP_ADDI, rD, 0, 0, 0);
+    }
+}
+
+// 'ld rD, :label' in an object under -O: a fixed form the linker can patch
+// with any address below 2^24, which covers all of memory
+#define LD24_SIZE 16
+
+static void expandLd24(int rD, uint64_t L, Output *out) {
+    emit_insn(out, MOP_XOR, rD, rD, rD, 0);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, (int64_t)((L >> 12) & 0xFFF));
+    emit_insn(out, MOP_SHFTLI, rD, 0, 0, 12);
+    emit_insn(out, MOP_ADDI, rD, 0, 0, (int64_t)(L & 0xFFF));
+}
+
+// true if the operands are exactly `n` tokens, all registers
+static int operands_are_registers(const TokenLine *t, int n) {
+    if (t->numTokens != n || t->extra) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (t->tok[i].kind != TOK_REG) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * parseMacro (Pass 2):
+ * Handle macros: ld, push, pop, in, out, clr, halt. labelAddress is the
+ * already resolved value of the line's label reference (-1 if unknown) and
+ * size the bytes the layout reserved for the line.
+ * Returns 0 if the macro could not be expanded.
+ ******************************************************************************/
+static int parseMacro(const TokenLine *t, int labelAddress, int size, Output *out) {
+    const Token *a = &t->tok[0], *b = &t->tok[1];
+    stat_add(&stats.macros[t->op - OP_HALT], 1);
+    switch (t->op) {
+    case OP_LD: {
+        if (t->numTokens != 2 || t->extra || a->kind != TOK_REG ||
+            (b->kind != TOK_IMM && b->kind != TOK_LABEL) || b->negative) {
+            fprintf(diag(), "Error parsing ld macro: %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (a->reg > 31) {
+            fprintf(diag(), "Error: register out of range in ld => r%d\n", a->reg);
+            return 0;
+        }
+        uint64_t imm;
+        if (b->kind == TOK_LABEL) {
+            if (labelAddress < 0) {
+                char lbl[50];
+                token_label(t, b, lbl);
+                fprintf(diag(), "Error: label %s not found\n", lbl);
+                return 0;
+            }
+            imm = (uint64_t)labelAddress;
+        } else {
+            if (b->overflow) {
+                fprintf(diag(), "Error: 'ld' immediate out of 64-bit range => %.*s\n", TOKEN_ARGS(t, b));
+                return 0;
+            }
+            imm = b->value;
+        }
+        if (out->optimize) {
+            expandLdShort(a->reg, imm, size, out);
+        } else {
+            expandLd(a->reg, imm, out);
+        }
+        return 1;
+    }
+    case OP_PUSH:
+    case OP_POP:
+        if (!operands_are_registers(t, 1)) {
+            fprintf(diag(), "Error parsing %s macro: %.*s\n", opNames[t->op], LINE_ARGS(t));
+            return 0;
+        }
+        if (a->reg > 31) {
+            fprintf(diag(), "Error: register out of range in %s => %.*s\n", opNames[t->op], LINE_ARGS(t));
+            return 0;
+        }
+        if (t->op == OP_PUSH) {
+            expandPush(a->reg, out);
+        } else {
+            expandPop(a->reg, out);
+        }
+        return 1;
+    case OP_IN:
+    case OP_OUT:
+        if (!operands_are_registers(t, 2)) {
+            fprintf(diag(), "Error parsing %s macro: %.*s\n", opNames[t->op], LINE_ARGS(t));
+            return 0;
+        }
+        if (a->reg > 31 || b->reg > 31) {
+            fprintf(diag(), "Error: register out of range in '%s': %.*s\n", opNames[t->op], LINE_ARGS(t));
+            return 0;
+        }
+        if (t->op == OP_IN) {
+            expandIn(a->reg, b->reg, out);
+        } else {
+            expandOut(a->reg, b->reg, out);
+        }
+        return 1;
+    case OP_CLR:
+        if (!operands_are_registers(t, 1)) {
+            fprintf(diag(), "Error parsing clr macro: %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        if (a->reg > 31) {
+            fprintf(diag(), "Error: register out of range in clr => %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        expandClr(a->reg, out);
+        return 1;
+    case OP_HALT:
+        if (t->numTokens != 0) {
+            fprintf(diag(), "Error parsing halt macro: %.*s\n", LINE_ARGS(t));
+            return 0;
+        }
+        expandHalt(out);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/******************************************************************************
+ * Instruction encoder (binary output):
+ * Maps a lexed, non-macro instruction onto its machine opcode and operand
+ * fields. pass1 has only checked brr, mov and the immediate forms, so the
+ * operand shapes of everything else are checked here.
+ ******************************************************************************/
+static int encode_error(const TokenLine *t, const char *why) {
+    fprintf(diag(), "Error: cannot encode '%.*s': %s\n", LINE_ARGS(t), why);
+    return 0;
+}
+
+// value of a literal or label operand
+static int operand_value(const Token *tk, int labelAddress, int64_t *value) {
+    if (tk->kind == TOK_LABEL) {
+        if (labelAddress < 0) {
+            return 0;
+        }
+        *value = labelAddress;
+        return 1;
+    }
+    if (tk->kind != TOK_IMM || tk->overflow) {
+        return 0;
+    }
+    *value = tk->negative ? -(int64_t)tk->value : (int64_t)tk->value;
+    return 1;
+}
+
+// t: a non-macro instruction
+static int encode_instruction(const TokenLine *t, int labelAddress, Output *out) {
+    const Token *a = &t->tok[0], *b = &t->tok[1];
+    if (t->op == OP_NONE) {
+        return encode_error(t, "unknown instruction");
+    }
+    int mop = opMops[t->op];
+    int64_t L;
+    switch (opForms[t->op].shape) {
+    case SHAPE_RRR:
+        if (!operands_are_registers(t, 3) || !is_register(a) || !is_register(b) ||
+            !is_register(&t->tok[2])) {
+            return encode_error(t, "expected 'rD, rS, rT'");
+        }
+        emit_insn(out, mop, a->reg, b->reg, t->tok[2].reg, 0);
+        return 1;
+    case SHAPE_RR:
+        if (!operands_are_registers(t, 2) || !is_register(a) || !is_register(b)) {
+            return encode_error(t, "expected 'rD, rS'");
+        }
+        emit_insn(out, mop, a->reg, b->reg, 0, 0);
+        return 1;
+    case SHAPE_R:
+        if (!operands_are_registers(t, 1) || !is_register(a)) {
+            return encode_error(t, "expected 'rD'");
+        }
+        emit_insn(out, mop, a->reg, 0, 0, 0);
+        return 1;
+    case SHAPE_NONE:
+        if (t->numTokens != 0) {
+            return encode_error(t, "return takes no operands");
+        }
+        emit_insn(out, mop, 0, 0, 0, 0);
+        return 1;
+    case SHAPE_RL:
+        if (!operand_value(b, labelAddress, &L) || L < 0 || L > 4095) {
+            return encode_error(t, "immediate out of [0..4095]");
+        }
+        emit_insn(out, mop, a->reg, 0, 0, L);
+        return 1;
+    case SHAPE_BRR:
+        if (a->kind == TOK_REG) {
+            emit_insn(out, MOP_BRR_R, a->reg, 0, 0, 0);
+            return 1;
+        }
+        // a label target was already turned into a pc-relative offset,
+        // which is negative for a backward branch
+        if (a->kind == TOK_LABEL) {
+            L = labelAddress;
+        } else if (!operand_value(a, labelAddress, &L)) {
+            return encode_error(t, "offset out of [-2048..2047]");
+        }
+        if (L < -2048 || L > 2047) {
+            return encode_error(t, "offset out of [-2048..2047]");
+        }
+        emit_insn(out, MOP_BRR_L, 0, 0, 0, L);
+        return 1;
+    case SHAPE_MOV:
+        if (a->kind == TOK_MEM) {
+            emit_insn(out, MOP_MOV_STORE, a->reg, b->reg, 0,
+                      a->negative ? -(int64_t)a->value : (int64_t)a->value);
+        } else if (b->kind == TOK_REG) {
+            emit_insn(out, MOP_MOV_RR, a->reg, b->reg, 0, 0);
+        } else if (b->kind == TOK_MEM) {
+            emit_insn(out, MOP_MOV_LOAD, a->reg, b->reg, 0,
+                      b->negative ? -(int64_t)b->value : (int64_t)b->value);
+        } else {
+            if (!operand_value(b, labelAddress, &L) || L < 0 || L > 4095) {
+                return encode_error(t, "literal out of [0..4095]");
+            }
+            emit_insn(out, MOP_MOV_RL, a->reg, 0, 0, L);
+        }
+        return 1;
+    default:
+        return encode_error(t, "unknown instruction");
+    }
+}
+
+// the value of a .data item: a literal (negative values are two's complement)
+static int data_value(const char *line, size_t len, uint64_t *value) {
+    Token tk;
+    const char *end = lex_number(line, line + len, &tk);
+    if (!end || end != line + len || tk.overflow) {
+        fprintf(diag(), "Error: cannot encode data item '%.*s'\n", (int)len, line);
+        return 0;
+    }
+    *value = tk.negative ? (uint64_t)0 - tk.value : tk.value;
+    return 1;
+}
+
+// one 64-bit .data item
+static int encode_data(const char *line, size_t len, Output *out) {
+    uint64_t value;
+    if (!data_value(line, len, &value)) {
+        return 0;
+    }
+    put_le64(out, value);
+    return 1;
+}
+
+// one item of a bulk directive, as a .data line of its own
+static void emit_data_item(const char *item, size_t len, Output *out) {
+    if (!out->binary) {
+        emit_text_line(out, item, len);
+    } else if (!encode_data(item, len, out)) {
+        out->errors++;
+    }
+}
+
+static void emit_fill(const char *item, size_t len, int64_t count, Output *out) {
+    if (!out->binary) {
+        for (int64_t i = 0; i < count; i++) {
+            emit_text_line(out, item, len);
+        }
+        return;
+    }
+    uint64_t value;
+    if (!data_value(item, len, &value)) {
+        out->errors++;
+        return;
+    }
+    // the value 512 times over, copied out a block at a time
+    unsigned char block[4096];
+    for (int k = 0; k < 8; k++) {
+        block[k] = (unsigned char)(value >> 8 * k);
+    }
+    for (size_t k = 8; k < sizeof(block); k *= 2) {
+        memcpy(block + k, block, k);
+    }
+    for (uint64_t left = 8 * (uint64_t)count; left > 0;) {
+        size_t n = left < sizeof(block) ? (size_t)left : sizeof(block);
+        out_bytes(out, block, n);
+        left -= n;
+    }
+}
+
+// the file of an .incbin that pass1 sized to `size` bytes
+static void emit_incbin(const char *args, size_t argsLen, int size, Output *out) {
+    char path[4096];
+    incbin_path(args, argsLen, path);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || ((st.st_size + 7) & ~(off_t)7) != size) {
+        fprintf(diag(), "Error: '%s' changed during assembly\n", path);
+        out->errors++;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    size_t n = (size_t)st.st_size;
+    const unsigned char *data = n ? mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        diag_errno("mmap .incbin");
+        out->errors++;
+        return;
+    }
+    unsigned char tail[8] = { 0 };
+    if (!out->binary) {
+        for (size_t k = 0; k < n; k += 8) {
+            const unsigned char *w = data + k;
+            if (n - k < 8) {
+                memcpy(tail, w, n - k);
+                w = tail;
+            }
+            uint64_t v = 0;
+            for (int b = 7; b >= 0; b--) {
+                v = v << 8 | w[b];
+            }
+            out_char(out, '\t');
+            out_int(out, (int64_t)v);
+            out_char(out, '\n');
+        }
+    } else if (out->fd >= 0) {
+        // straight from the mapping to the file, not through the buffer
+        out_flush(out);
+        out_write(out, (const char *)data, n);
+        out_bytes(out, tail, (size_t)size - n);
+    } else {
+        out_bytes(out, data, n);
+        out_bytes(out, tail, (size_t)size - n);
+    }
+    if (n) {
+        munmap((void *)data, n);
+    }
+}
+
+// the items of a bulk directive pass1 sized to `size` bytes
+static void emit_bulk_data(const char *line, size_t len, int size, Output *out) {
+    const char *args, *item;
+    size_t argsLen, itemLen;
+    BulkKind kind = bulk_kind(line, len, &args, &argsLen);
+    const char *p = args, *end = args + argsLen;
+    if (kind == BULK_QUAD) {
+        while (next_bulk_item(&p, end, &item, &itemLen)) {
+            emit_data_item(item, itemLen, out);
+        }
+    } else if (kind == BULK_FILL) {
+        next_bulk_item(&p, end, &item, &itemLen);
+        int64_t count = fill_count(item, itemLen);
+        if (!next_bulk_item(&p, end, &item, &itemLen)) {
+            item = "0";
+            itemLen = 1;
+        }
+        emit_fill(item, itemLen, count, out);
+    } else {
+        emit_incbin(args, argsLen, size, out);
+    }
+}
+
+// the `size` bytes of .align padding, as no-ops
+static void emit_padding(int size, Output *out) {
+    for (int i = 0; i < size; i += 4) {
+        emit_insn(out, MOP_ADDI, 0, 0, 0, 0);
+    }
+}
+
+/******************************************************************************
+ * Binary image (.tko), all fields little-endian:
+ *   header   "TKO1", u32 segment count, u64 entry address
+ *   segments u32 kind (0 = code, 1 = data), u32 reserved, u64 address, u64 size
+ *   payload  the segment bytes, back to back, in table order
+ ******************************************************************************/
+static void write_image_header(Output *out) {
+    out_bytes(out, "TKO1", 4);
+    put_le32(out, (uint32_t)imageSegments.num);
+    put_le64(out, 0x1000);
+    for (size_t i = 0; i < imageSegments.num; i++) {
+        const ImageSegment *seg = &imageSegments.items[i];
+        put_le32(out, seg->kind == CODE ? 0 : 1);
+        put_le32(out, 0);
+        put_le64(out, seg->address);
+        put_le64(out, seg->size);
+    }
+}
+
+/******************************************************************************
+ * emit_line (Pass 2): expand macros, substitute a label reference with its
+ * address and print everything else as-is (text), or encode the line
+ * (binary). labelAddress is the resolved reference (-1 if the label is
+ * undefined), pc the line's address and size its length in bytes. pass2
+ * uses it for the lines the IR keeps as text; the parallel, cached and
+ * streaming paths for every line.
+ ******************************************************************************/
+// the value of the line's expression operand, as the operand's literal
+// (relative to pc for 'brr'); 0 after reporting why it has none
+static int expression_operand(const TokenLine *t, int pc, Output *out, int64_t *value) {
+    const Token *ref = &t->tok[t->labelTok];
+    const char *expr = t->text + ref->start;
+    ExprParser e;
+    ExprValue v;
+    ExprStatus status = expr_parse(expr, expr + ref->len, 1, 0, &v, &e);
+    if (out->relocs && ref->weight) {
+        fprintf(diag(), "Error: an object can't relocate an address expression => %.*s\n", LINE_ARGS(t));
+        out->errors++;
+        return 0;
+    }
+    if (status == EXPR_UNDEFINED) {
+        fprintf(diag(), "Warning: label '%.*s' not found.\n", (int)e.missingLen, e.missing);
+        if (out->binary) {
+            out->errors++;
+        } else {
+            emit_text_line(out, t->text, t->len);
+        }
+        return 0;
+    }
+    if (status != EXPR_OK) {
+        fprintf(diag(), "Error: division by zero => %.*s\n", LINE_ARGS(t));
+        out->errors++;
+        return 0;
+    }
+    *value = v.weight && t->op == OP_BRR ? (int64_t)((uint64_t)v.value - (uint64_t)pc) : v.value;
+    return 1;
+}
+
+static void emit_line(const TokenLine *t, int labelAddress, int pc, int size, Output *out) {
+    if (t->labelTok >= 0 && t->tok[t->labelTok].kind == TOK_EXPR) {
+        const Token *ref = &t->tok[t->labelTok];
+        int64_t value;
+        if (!expression_operand(t, pc, out, &value)) {
+            return;
+        }
+        if (!is_macro_op(t->op) && !out->binary) {
+            // cut at the expression and replace it with its value, like a label
+            out_char(out, '\t');
+            out_bytes(out, t->text, ref->start);
+            out_int(out, value);
+            out_char(out, '\n');
+            return;
+        }
+        // else the line as if the value had been written there
+        char literal[24], buf[256];
+        int n = t->op == OP_LD ? snprintf(literal, sizeof(literal), "%" PRIu64, (uint64_t)value)
+                               : snprintf(literal, sizeof(literal), "%" PRId64, value);
+        size_t tail = t->len - ref->start - ref->len, len = ref->start + (size_t)n + tail;
+        char *text = len <= sizeof(buf) ? buf : malloc(len);
+        if (!text) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        memcpy(text, t->text, ref->start);
+        memcpy(text + ref->start, literal, (size_t)n);
+        memcpy(text + ref->start + n, t->text + ref->start + ref->len, tail);
+        TokenLine folded;
+        lex_line(&folded, text, len, NULL);
+        emit_line(&folded, -1, pc, size, out);
+        if (text != buf) {
+            free(text);
+        }
+        return;
+    }
+    if (t->labelTok >= 0 && out->relocs) {
+        // objects leave every reference to the linker
+        RelocList *relocs = out->relocs;
+        relocs->items = grow_array(relocs->items, &relocs->cap, relocs->num + 1, sizeof(PendingReloc));
+        PendingReloc *r = &relocs->items[relocs->num++];
+        r->address = pc;
+        r->kind = t->op == OP_LD ? (size == LD24_SIZE ? RELOC_LD24 : RELOC_LD)
+                : t->op == OP_BRR ? RELOC_PCREL12 : RELOC_ABS12;
+        token_label(t, &t->tok[t->labelTok], r->name);
+        labelAddress = t->op == OP_BRR ? pc : 0;
+    }
+    if (t->labelTok >= 0) {
+        const Token *ref = &t->tok[t->labelTok];
+        if (labelAddress < 0) {
+            char lbl[50];
+            token_label(t, ref, lbl);
+            fprintf(diag(), "Warning: label '%s' not found.\n", lbl);
+            if (out->binary) {
+                out->errors++;
+            } else {
+                emit_text_line(out, t->text, t->len);
+            }
+            return;
+        }
+        // 'brr :label' branches relative to the brr itself
+        if (t->op == OP_BRR) {
+            labelAddress -= pc;
+        }
+        if (!is_macro_op(t->op) && !out->binary) {
+            // cut at the ':' and replace the reference with its address
+            out_char(out, '\t');
+            out_bytes(out, t->text, ref->start - 1);
+            out_int(out, labelAddress);
+            out_char(out, '\n');
+            return;
+        }
+    }
+    // if the line is a macro, expand; otherwise output as-is
+    if (is_macro_op(t->op)) {
+        if (!parseMacro(t, labelAddress, size, out)) {
+            out->errors++;
+        }
+    } else if (out->binary) {
+        if (!encode_instruction(t, labelAddress, out)) {
+            out->errors++;
+        }
+    } else {
+        emit_text_line(out, t->text, t->len);
+    }
+}
+
+// resolve the label reference of a lexed line, -1 if none or undefined; of
+// an expression, the address it comes to (-1 for a constant)
+static int resolve_label_ref(const TokenLine *t) {
+    if (t->labelTok < 0) {
+        return -1;
+    }
+    const Token *ref = &t->tok[t->labelTok];
+    if (ref->kind == TOK_EXPR) {
+        return ref->weight ? expression_int(t->text + ref->start, ref->len) : -1;
+    }
+    const char *name = t->text + ref->start;
+    uint32_t id = lookup_label_id(name, label_name_len(name, name + ref->len), ref->hash);
+    return id ? labelAddresses[id] : -1;
+}
+
+// an output collecting into memory, see pass2_parallel
+static void open_memory_output(Output *out, int binary) {
+    out->fd = -1;
+    out->binary = binary;
+    out->optimize = 0;
+    out->errors = 0;
+    out->buf = NULL;
+    out->len = out->cap = 0;
+    out->relocs = NULL;
+    out->tmp = NULL;
+}
+
+// `path` with `suffix` appended, malloc'ed
+static char *suffixed_path(const char *path, const char *suffix) {
+    size_t len = strlen(path), n = strlen(suffix);
+    char *p = malloc(len + n + 1);
+    if (!p) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    memcpy(p, path, len);
+    memcpy(p + len, suffix, n + 1);
+    return p;
+}
+
+// an output to the file open as `fd` (-1 if the open failed)
+static int open_output_fd(Output *out, int fd, int binary, int optimize) {
+    out->fd = fd;
+    out->binary = binary;
+    out->optimize = optimize;
+    out->errors = 0;
+    out->len = 0;
+    out->cap = OUT_BUFFER_SIZE;
+    out->relocs = NULL;
+    out->tmp = NULL;
+    if (out->fd < 0) {
+        return 0;
+    }
+    out->buf = malloc(OUT_BUFFER_SIZE);
+    if (!out->buf) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    if (asmTrap) {
+        asmTrap->outFd = out->fd;
+        asmTrap->outBuf = out->buf;
+    }
+    if (binary) {
+        write_image_header(out);
+    }
+    return 1;
+}
+
+static int open_output(Output *out, const char *outfile, int binary, int optimize) {
+    if (!strcmp(outfile, "-")) {
+        return open_output_fd(out, dup(STDOUT_FILENO), binary, optimize);
+    }
+    if (!ifChanged) {
+        return open_output_fd(out, open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644), binary, optimize);
+    }
+    char *tmp = suffixed_path(outfile, ".tmp");
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmp);
+        return 0;
+    }
+    outputTmp = tmp;
+    open_output_fd(out, fd, binary, optimize);
+    out->tmp = tmp;
+    out->digest = DIGEST_SEED;
+    out->written = 0;
+    return 1;
+}
+
+// what OUTPUT.digest holds for an output with `digest` and status `st`
+static void format_digest(char *line, size_t size, uint64_t digest, const struct stat *st) {
+    snprintf(line, size, "%016" PRIx64 " %llu %lld.%09ld\n", digest, (unsigned long long)st->st_size,
+             (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec);
+}
+
+// --if-changed: out->tmp (closed) becomes `outfile` unless it is what
+// outfile's digest says outfile already holds
+static void replace_if_changed(Output *out, const char *outfile) {
+    char *digestFile = suffixed_path(outfile, ".digest");
+    char have[128] = "", want[128];
+    FILE *f = fopen(digestFile, "r");
+    if (f) {
+        if (!fgets(have, sizeof(have), f)) {
+            have[0] = '\0';
+        }
+        fclose(f);
+    }
+    struct stat st;
+    if (stat(outfile, &st) == 0 && (uint64_t)st.st_size == out->written) {
+        format_digest(want, sizeof(want), out->digest, &st);
+        if (!strcmp(want, have)) {
+            remove(out->tmp);
+            free(digestFile);
+            return;
+        }
+    }
+    if (rename(out->tmp, outfile) < 0 || stat(outfile, &st) < 0) {
+        diag_errno("replace output");
+        free(digestFile);
+        fail();
+    }
+    // a digest that can't be saved only costs a rewrite next time
+    format_digest(want, sizeof(want), out->digest, &st);
+    char *digestTmp = suffixed_path(digestFile, ".tmp");
+    f = fopen(digestTmp, "w");
+    if (!f || fputs(want, f) < 0 || fclose(f) != 0 || rename(digestTmp, digestFile) < 0) {
+        diag_errno("save output digest");
+        remove(digestTmp);
+    }
+    free(digestTmp);
+    free(digestFile);
+}
+
+// close the output; a binary image with encoding errors is removed
+static void close_output(Output *out, const char *outfile) {
+    out_flush(out);
+    free(out->buf);
+    if (asmTrap) {
+        asmTrap->outFd = -1;
+        asmTrap->outBuf = NULL;
+    }
+    if (close(out->fd) < 0) {
+        diag_errno("close output");
+        fail();
+    }
+    if (out->binary && out->errors) {
+        fprintf(diag(), "Error: %d line(s) could not be encoded, no image written.\n", out->errors);
+        if (strcmp(outfile, "-")) {
+            remove(outfile);
+        }
+        fail();
+    }
+    if (out->tmp) {
+        replace_if_changed(out, outfile);
+        free(out->tmp);
+        out->tmp = outputTmp = NULL;
+    }
+}
+
+/******************************************************************************
+ * PASS 2: Output file generation (macro expansion + label substitution)
+ ******************************************************************************/
+// pass2 over the lines of `fin`, starting in `section` at `programCounter`
+static void pass2_lines(LineReader *fin, Output *out, Section section, int programCounter) {
+    const char *line;
+    size_t len;
+    TokenLine t;
+    while (next_line(fin, &line, &len)) {
+        if (!len || line[0] == ';') {
+            continue;
+        }
+        // Directives
+        int size;
+        if (line[0] == '.' && section == DATA && bulk_data_size(line, len, &size)) {
+            emit_bulk_data(line, len, size, out);   // pass1 checked it
+            programCounter += size;
+            continue;
+        }
+        if (line[0] == '.') {
+            section = directive_section(line, len, section);
+        }
+        if (is_directive(line, len, ".code")) {
+            if (!out->binary) out_bytes(out, ".code\n", 6);
+            continue;
+        }
+        if (is_directive(line, len, ".data")) {
+            if (!out->binary) out_bytes(out, ".data\n", 6);
+            continue;
+        }
+        // skip label definitions
+        if (line[0] == ':') {
+            continue;
+        }
+        lex_line(&t, line, len, &fin->masks);
+        int pc = programCounter;
+        if (line[0] != '.' && section == CODE) {
+            programCounter += instruction_size(t.op);
+        } else if (line[0] != '.' && section == DATA) {
+            programCounter += 8;
+        }
+        if (out->binary) {
+            // only lines pass1 gave an address end up in the image
+            if (line[0] == '.' || section == NONE) {
+                continue;
+            }
+            if (section == DATA) {
+                if (!encode_data(line, len, out)) {
+                    out->errors++;
+                }
+                continue;
+            }
+        }
+        emit_line(&t, resolve_label_ref(&t), pc, programCounter - pc, out);
+    }
+}
+
+// emit a record from its source text, exactly as pass2_lines treats the line
+static void emit_ir_source(const IrInsn *in, Section section, int pc, int size, Output *out) {
+    const IrLine *l = &ir.lines[in->line];
+    if (out->binary) {
+        // only lines pass1 gave an address end up in the image
+        if (l->text[0] == '.' || section == NONE) {
+            return;
+        }
+        if (section == DATA) {
+            if (!encode_data(l->text, l->len, out)) {
+                out->errors++;
+            }
+            return;
+        }
+    }
+    TokenLine t;
+    lex_line(&t, l->text, l->len, NULL);
+    emit_line(&t, resolve_label_ref(&t), pc, size, out);
+}
+
+// emit an instruction record from its fields, as emit_line would. address is
+// its label operand's value; returns 0 if that value can't be encoded, to let
+// emit_ir_source report it.
+static int emit_ir_insn(const IrInsn *in, int address, int pc, int size, Output *out) {
+    int label = in->mop & IR_LABEL;
+    int mop = in->mop & ~IR_LABEL;
+    int64_t L = label ? address : in->imm;
+    if (is_macro_op((Opcode)in->op)) {
+        stat_add(&stats.macros[in->op - OP_HALT], 1);
+        switch (in->op) {
+        case OP_LD:
+            if (out->optimize) {
+                expandLdShort(in->rd, (uint64_t)L, size, out);
+            } else {
+                expandLd(in->rd, (uint64_t)L, out);
+            }
+            break;
+        case OP_PUSH:
+            expandPush(in->rd, out);
+            break;
+        case OP_POP:
+            expandPop(in->rd, out);
+            break;
+        case OP_IN:
+            expandIn(in->rd, in->rs, out);
+            break;
+        case OP_OUT:
+            expandOut(in->rd, in->rs, out);
+            break;
+        case OP_CLR:
+            expandClr(in->rd, out);
+            break;
+        default:
+            expandHalt(out);
+            break;
+        }
+        return 1;
+    }
+    // 'brr :label' branches relative to the brr itself
+    if (label && in->op == OP_BRR) {
+        L -= pc;
+    }
+    if (!out->binary) {
+        const IrLine *l = &ir.lines[in->line];
+        if (!label) {
+            emit_text_line(out, l->text, l->len);
+            return 1;
+        }
+        // cut at the ':' (or the expression) and replace the reference with its value
+        const IrRef *r = &ir.refs[in->ref];
+        out_char(out, '\t');
+        out_bytes(out, l->text, r->expr ? r->start : r->start - 1);
+        out_int(out, L);
+        out_char(out, '\n');
+        return 1;
+    }
+    if (label && (mop == MOP_BRR_L ? L < -2048 || L > 2047 : L < 0 || L > 4095)) {
+        return 0;
+    }
+    if (machineOps[mop].format == FMT_RRR) {
+        emit_insn(out, mop, in->rd, in->rs, in->rt, 0);
+    } else {
+        emit_insn(out, mop, in->rd, in->rs, 0, L);
+    }
+    return 1;
+}
+
+static void emit_ir(const IrInsn *in, Section section, int pc, int size, Output *out) {
+    const IrLine *l = &ir.lines[in->line];
+    switch (in->op) {
+    case IR_DIRECTIVE:
+        if (!in->imm) {
+            break;
+        }
+        if (!out->binary) {
+            out_bytes(out, l->text, l->len);
+            out_char(out, '\n');
+        }
+        return;
+    case IR_DATA:
+        if (out->binary) {
+            put_le64(out, ir.words[in->word]);
+        } else {
+            emit_text_line(out, l->text, l->len);
+        }
+        return;
+    case IR_RAW:
+        if (l->text[0] == '.') {
+            emit_bulk_data(l->text, l->len, size, out);
+            return;
+        }
+        break;
+    case IR_NOP:
+        return;
+    case IR_ALIGN:
+        emit_padding(size, out);
+        return;
+    case IR_BRANCH:
+        emit_insn(out, MOP_BRR_L, 0, 0, 0, ir_label_address(in) - pc);
+        return;
+    case IR_STACK:
+        if (in->mop == MOP_MOV_STORE) {
+            emit_insn(out, MOP_MOV_STORE, 31, in->rd, 0, in->imm);
+            if (in->rs) {
+                emit_insn(out, MOP_SUBI, 31, 0, 0, 8 * in->rs);
+            }
+        } else {
+            emit_insn(out, MOP_MOV_LOAD, in->rd, 31, 0, in->imm);
+            if (in->rs) {
+                emit_insn(out, MOP_ADDI, 31, 0, 0, 8 * in->rs);
+            }
+        }
+        return;
+    case IR_POOL:
+        emit_insn(out, MOP_MOV_LOAD, in->rd, in->rs, 0, POOL_OFFSET(in->word));
+        return;
+    case IR_MACHINE:
+        if (machineOps[in->mop].format == FMT_RRR) {
+            emit_insn(out, in->mop, in->rd, in->rs, in->rt, 0);
+        } else {
+            emit_insn(out, in->mop, in->rd, in->rs, 0, in->imm);
+        }
+        return;
+    default: {
+        int address = 0;
+        if (in->mop & IR_LABEL) {
+            address = ir_label_address(in);
+            if (address < 0 || out->relocs) {
+                break;  // the warning, or a relocation
+            }
+        }
+        if (emit_ir_insn(in, address, pc, size, out)) {
+            return;
+        }
+        break;
+    }
+    }
+    emit_ir_source(in, section, pc, size, out);
+}
+
+// pass2 over the IR pass1 built
+static void pass2_ir(Output *out) {
+    Section section = NONE;
+    int pc = 0x1000;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        int size = ir_size(in);
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        }
+        emit_ir(in, section, pc, size, out);
+        pc += size;
+    }
+    if (ir.numPool && !out->binary) {
+        out_bytes(out, ".data\n", 6);
+    }
+    for (size_t i = 0; i < ir.numPool; i++) {
+        if (out->binary) {
+            put_le64(out, ir.pool[i]);
+        } else {
+            out_char(out, '\t');
+            out_int(out, (int64_t)ir.pool[i]);
+            out_char(out, '\n');
+        }
+    }
+}
+
+static void pass2(const char *outfile, int binary, int optimize) {
+    Output out;
+    if (!open_output(&out, outfile, binary, optimize)) {
+        diag_errno("pass2: fopen output");
+        fail();
+    }
+    pass2_ir(&out);
+    close_output(&out, outfile);
+    free_ir();
+}
+
+/******************************************************************************
+ * Parallel assembly (-j N):
+ * The input is split into chunks at line boundaries and both passes run on a
+ * pool of worker threads.
+ *
+ * Pass 1 sizes every chunk on its own. Until its first .code/.data directive
+ * a chunk can't know its section, so that prefix is sized for both .code and
+ * .data (and validated as code); from the directive on, addresses are
+ * relative to the end of the prefix. Labels and segments are kept per chunk
+ * with those relative addresses. A serial prefix sum over the chunks then
+ * fixes each chunk's starting section and address and merges its labels and
+ * segments, in order, so redefinitions and errors resolve as in pass1.
+ *
+ * Pass 2 then expands every chunk into its own memory output and the chunk
+ * buffers are written out in order. Warnings of different chunks may
+ * interleave on stderr.
+ ******************************************************************************/
+#define CHUNKS_PER_JOB 4
+#define MIN_CHUNK_BYTES (64 * 1024)
+
+typedef struct {
+    const char *name;   // in the input (not terminated)
+    int len;
+    int inPrefix;       // defined before the chunk's first directive
+    int codeOffset;     // inPrefix: address if the chunk starts in .code ...
+    int dataOffset;     // ... or in .data; otherwise relative to the prefix end
+} ChunkLabel;
+
+typedef struct {
+    const char *begin;
+    size_t size;
+    Section section;    // state at the first line of the chunk
+    int pc;
+    // pass 1, relative to the chunk
+    int sawDirective;
+    Section endSection; // section after the last directive
+    int prefixCode;     // prefix bytes when starting in .code
+    int prefixData;     // prefix bytes when starting in .data
+    int bodyBytes;      // bytes from the first directive on
+    const char *prefixError;    // first invalid prefix line (if in .code)
+    const char *error;          // first invalid line after the prefix
+    size_t prefixErrorLen, errorLen;
+    ChunkLabel *labels;
+    size_t numLabels, capLabels;
+    SegmentList segments;       // relative to the prefix end
+    // pass 2
+    Output out;
+    struct BlockState *block;   // --cache bookkeeping
+} Chunk;
+
+typedef struct {
+    Chunk *chunks;
+    size_t numChunks;
+    size_t next;        // next chunk to take, shared by the workers
+    void (*work)(Chunk *);
+    LabelTable labels;  // pass 2 looks labels up in the caller's table
+    FILE *diag;         // and reports to its diag()
+} ChunkQueue;
+
+// split data into at most `want` chunks, each ending after a '\n'
+static size_t split_chunks(const char *data, size_t size, size_t want, Chunk **out) {
+    if (want > size / MIN_CHUNK_BYTES) {
+        want = size / MIN_CHUNK_BYTES ? size / MIN_CHUNK_BYTES : 1;
+    }
+    Chunk *chunks = calloc(want, sizeof(Chunk));
+    if (!chunks) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    size_t n = 0, start = 0;
+    for (size_t i = 1; i <= want && start < size; i++) {
+        size_t end = i == want ? size : size / want * i;
+        if (end < start) {
+            end = start;
+        }
+        const char *nl = memchr(data + end, '\n', size - end);
+        end = nl && i < want ? (size_t)(nl - data) + 1 : size;
+        chunks[n].begin = data + start;
+        chunks[n].size = end - start;
+        n++;
+        start = end;
+    }
+    *out = chunks;
+    return n;
+}
+
+static void add_chunk_label(Chunk *c, const char *p, const char *end) {
+    int n = 0;
+    while (!is_separator(p + n, end) && n < 49) {
+        n++;
+    }
+    if (!n) {
+        return;
+    }
+    c->labels = grow_array(c->labels, &c->capLabels, c->numLabels + 1, sizeof(ChunkLabel));
+    ChunkLabel *l = &c->labels[c->numLabels++];
+    l->name = p;
+    l->len = n;
+    l->inPrefix = !c->sawDirective;
+    l->codeOffset = c->sawDirective ? c->bodyBytes : c->prefixCode;
+    l->dataOffset = c->sawDirective ? c->bodyBytes : c->prefixData;
+}
+
+// pass 1 over one chunk, without knowing the section it starts in
+static void pass1_chunk(Chunk *c) {
+    LineReader view;
+    reader_view(&view, c->begin, c->size);
+    const char *line;
+    size_t len;
+    TokenLine t;
+    while (next_line(&view, &line, &len)) {
+        if (!len || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == '.' && (align_directive(line, len) || macro_directive(line, len) ||
+                               equ_directive(line, len) || include_directive(line, len))) {
+            // its padding depends on where the chunk starts; a macro or
+            // .equ is defined for the chunks after its own, an .include
+            // may be either
+            c->error = line;
+            c->errorLen = len;
+            return;
+        }
+        int size;
+        if (line[0] == '.' && bulk_data_size(line, len, &size)) {
+            if (size < 0 || (c->sawDirective && c->endSection == CODE)) {
+                c->error = line;
+                c->errorLen = len;
+                return;
+            }
+            if (!c->sawDirective) {
+                // data bytes, or an invalid line if the prefix is code
+                if (!c->prefixError) {
+                    c->prefixError = line;
+                    c->prefixErrorLen = len;
+                }
+                c->prefixData += size;
+            } else if (c->endSection == DATA) {
+                if (size) {
+                    add_segment_bytes(&c->segments, DATA, c->bodyBytes, size);
+                }
+                c->bodyBytes += size;
+            }
+            continue;
+        }
+        if (line[0] == '.') {
+            Section next = directive_section(line, len, c->sawDirective ? c->endSection : NONE);
+            if (c->sawDirective || starts_with(line, len, ".code") || starts_with(line, len, ".data")) {
+                c->sawDirective = 1;
+                c->endSection = next;
+            }
+            continue;
+        }
+        if (line[0] == ':') {
+            add_chunk_label(c, line + 1, line + len);
+            continue;
+        }
+        if (!c->sawDirective) {
+            // the prefix might be code or data
+            lex_line(&t, line, len, &view.masks);
+            if (!c->prefixError && !is_valid_instruction_pass1(&t)) {
+                c->prefixError = line;
+                c->prefixErrorLen = len;
+            }
+            c->prefixCode += instruction_size(t.op);
+            c->prefixData += 8;
+        } else if (c->endSection == CODE) {
+            lex_line(&t, line, len, &view.masks);
+            if (!is_valid_instruction_pass1(&t)) {
+                c->error = line;
+                c->errorLen = len;
+                return;     // nothing after this line matters
+            }
+            int size = instruction_size(t.op);
+            add_segment_bytes(&c->segments, CODE, c->bodyBytes, size);
+            c->bodyBytes += size;
+        } else if (c->endSection == DATA) {
+            add_segment_bytes(&c->segments, DATA, c->bodyBytes, 8);
+            c->bodyBytes += 8;
+        }
+    }
+}
+
+static void pass2_chunk(Chunk *c) {
+    LineReader view;
+    reader_view(&view, c->begin, c->size);
+    pass2_lines(&view, &c->out, c->section, c->pc);
+}
+
+static void *chunk_worker(void *arg) {
+    ChunkQueue *queue = arg;
+    use_labels(&queue->labels);
+    diagStream = queue->diag;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->numChunks) {
+            return NULL;
+        }
+        queue->work(&queue->chunks[i]);
+    }
+}
+
+// run `work` on every chunk using up to `jobs` threads
+static void run_chunks(Chunk *chunks, size_t numChunks, int jobs, void (*work)(Chunk *)) {
+    ChunkQueue queue = { chunks, numChunks, 0, work, { 0 }, diag() };
+    share_labels(&queue.labels);
+    int numThreads = (size_t)jobs < numChunks ? jobs : (int)numChunks;
+    pthread_t *threads = malloc((size_t)numThreads * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    int started = 0;
+    for (; started < numThreads; started++) {
+        if (pthread_create(&threads[started], NULL, chunk_worker, &queue) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        chunk_worker(&queue);   // no threads available, do the work here
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+// prefix sum over the sized chunks: place them, then merge labels and segments
+static int place_chunks(Chunk *chunks, size_t numChunks) {
+    Section section = NONE;
+    int programCounter = 0x1000;
+    for (size_t i = 0; i < numChunks; i++) {
+        Chunk *c = &chunks[i];
+        c->section = section;
+        c->pc = programCounter;
+        if (section == CODE && c->prefixError) {
+            fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)c->prefixErrorLen, c->prefixError);
+            return 0;
+        }
+        int prefix = section == CODE ? c->prefixCode : section == DATA ? c->prefixData : 0;
+        for (size_t k = 0; k < c->numLabels; k++) {
+            const ChunkLabel *l = &c->labels[k];
+            char name[50];
+            memcpy(name, l->name, (size_t)l->len);
+            name[l->len] = '\0';
+            int offset = !l->inPrefix ? prefix + l->codeOffset :
+                         section == CODE ? l->codeOffset : section == DATA ? l->dataOffset : 0;
+            add_label(name, programCounter + offset);
+        }
+        if (prefix) {
+            note_segment_bytes(section, programCounter, prefix);
+        }
+        for (size_t k = 0; k < c->segments.num; k++) {
+            const ImageSegment *seg = &c->segments.items[k];
+            note_segment_bytes(seg->kind, programCounter + prefix + (int)seg->address, (int)seg->size);
+        }
+        if (c->error && align_directive(c->error, c->errorLen)) {
+            fprintf(diag(), "pass1 error: .align needs sequential assembly (not --pipeline or --cache) => %.*s\n",
+                    (int)c->errorLen, c->error);
+            return 0;
+        }
+        if (c->error && (macro_directive(c->error, c->errorLen) || equ_directive(c->error, c->errorLen) ||
+                         include_directive(c->error, c->errorLen))) {
+            fprintf(diag(), "pass1 error: %s needs sequential assembly (not --pipeline or --cache) => %.*s\n",
+                    equ_directive(c->error, c->errorLen) ? ".equ" :
+                    include_directive(c->error, c->errorLen) ? ".include" : ".macro", (int)c->errorLen, c->error);
+            return 0;
+        }
+        if (c->error) {
+            fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)c->errorLen, c->error);
+            return 0;
+        }
+        if (c->sawDirective) {
+            section = c->endSection;
+        }
+        programCounter += prefix + c->bodyBytes;
+    }
+    return 1;
+}
+
+static void assemble_parallel(const char *infile, const char *outfile, int binary, int jobs) {
+    LineReader fin;
+    if (!reader_open(&fin, infile)) {
+        diag_errno("open input");
+        fail();
+    }
+    reader_slurp(&fin);
+    if (has_align(fin.data, fin.size) || has_macros(fin.data, fin.size) || has_equs(fin.data, fin.size) ||
+        has_includes(fin.data, fin.size)) {
+        // one thread, then: pass1 + pass2 over the input already read
+        ir.source = fin;
+        ir.haveSource = 1;
+        pass1_source();
+        pass2(outfile, binary, 0);
+        return;
+    }
+    reserve_label_table(count_label_lines(&fin));
+    Chunk *chunks;
+    size_t numChunks = split_chunks(fin.data, fin.size, (size_t)jobs * CHUNKS_PER_JOB, &chunks);
+
+    run_chunks(chunks, numChunks, jobs, pass1_chunk);
+    if (!place_chunks(chunks, numChunks)) {
+        reader_close(&fin);
+        fail();
+    }
+    freeze_labels(jobs);
+    for (size_t i = 0; i < numChunks; i++) {
+        free(chunks[i].labels);
+        free(chunks[i].segments.items);
+        open_memory_output(&chunks[i].out, binary);
+    }
+    run_chunks(chunks, numChunks, jobs, pass2_chunk);
+
+    Output out;
+    if (!open_output(&out, outfile, binary, 0)) {
+        diag_errno("fopen output");
+        reader_close(&fin);
+        fail();
+    }
+    out_flush(&out);    // the image header goes first
+    for (size_t i = 0; i < numChunks; i++) {
+        out_write(&out, chunks[i].out.buf, chunks[i].out.len);
+        out.errors += chunks[i].out.errors;
+        free(chunks[i].out.buf);
+    }
+    free(chunks);
+    reader_close(&fin);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Asynchronous I/O (io_uring):
+ * On network storage the serial part of --pipeline is the writer blocking in
+ * write(), and that of --batch --assemble the workers faulting in cold
+ * inputs. Both hand that I/O to the kernel through an io_uring, set up with
+ * the raw system calls:
+ *   - the --pipeline writer queues each expanded chunk as a write at its
+ *     offset in the output and frees it when the write completes, so it
+ *     goes on feeding the workers meanwhile. The offsets keep the chunks in
+ *     order, which linked writes only would within one submission;
+ *   - --batch --assemble reads the inputs of the next jobs, ahead of the
+ *     workers, into a registered scratch buffer whose contents are dropped:
+ *     the point is the page cache the workers then map them from.
+ * Where io_uring is missing or refused (an old kernel or header, a seccomp
+ * filter, kernel.io_uring_disabled), and for an output that is not a
+ * regular file, the writer write()s as before and the readahead asks
+ * posix_fadvise instead.
+ ******************************************************************************/
+#define URING_ENTRIES 32
+
+typedef struct {
+    int fd;             // -1 if there is no ring
+    unsigned pending;   // queued, not submitted yet
+    unsigned inFlight;  // submitted, not completed yet
+#ifdef HAVE_IO_URING
+    unsigned *sqHead, *sqTail, *sqArray, sqMask;
+    unsigned *cqHead, *cqTail, cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+#endif
+} Uring;
+
+#ifdef HAVE_IO_URING
+// a ring of URING_ENTRIES; 0 (u->fd -1) if the kernel has none to give
+static int uring_open(Uring *u) {
+    struct io_uring_params p;
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0) {
+        u->fd = -1;
+        return 0;
+    }
+    u->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->sqRingSize = u->cqRingSize = u->sqRingSize > u->cqRingSize ? u->sqRingSize : u->cqRingSize;
+    }
+    u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    u->cqRing = p.features & IORING_FEAT_SINGLE_MMAP ? u->sqRing
+              : mmap(NULL, u->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqRing == MAP_FAILED || u->cqRing == MAP_FAILED || u->sqes == MAP_FAILED) {
+        // the mappings that did work go with the descriptor's last reference
+        close(u->fd);
+        u->fd = -1;
+        return 0;
+    }
+    char *sq = u->sqRing, *cq = u->cqRing;
+    u->sqHead = (unsigned *)(sq + p.sq_off.head);
+    u->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    u->sqArray = (unsigned *)(sq + p.sq_off.array);
+    u->sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    u->cqHead = (unsigned *)(cq + p.cq_off.head);
+    u->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    u->cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 1;
+}
+
+static void uring_close(Uring *u) {
+    if (u->fd < 0) {
+        return;
+    }
+    munmap(u->sqes, URING_ENTRIES * sizeof(struct io_uring_sqe));
+    if (u->cqRing != u->sqRing) {
+        munmap(u->cqRing, u->cqRingSize);
+    }
+    munmap(u->sqRing, u->sqRingSize);
+    close(u->fd);
+    u->fd = -1;
+}
+
+// register `n` bytes at `buf` as fixed buffer 0; 0 if the kernel won't
+static int uring_register(Uring *u, void *buf, size_t n) {
+    struct iovec iov = { buf, n };
+    return syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+// queue a read or write of `n` bytes at `offset`; the caller makes room
+// first (uring_full)
+static void uring_queue(Uring *u, int op, int fd, void *buf, size_t n, uint64_t offset, uint64_t data) {
+    unsigned tail = *u->sqTail;
+    unsigned slot = tail & u->sqMask;
+    struct io_uring_sqe *sqe = &u->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = (uint32_t)n;
+    sqe->off = offset;
+    sqe->user_data = data;
+    u->sqArray[slot] = slot;
+    __atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+    u->pending++;
+}
+
+// submit what is queued and wait for `wait` completions; -1 with errno on
+// failure
+static int uring_enter(Uring *u, unsigned wait) {
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, u->fd, u->pending, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0) {
+            u->pending -= (unsigned)n;
+            u->inFlight += (unsigned)n;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+// the next completion, 0 if none is there yet
+static int uring_reap(Uring *u, uint64_t *data, int32_t *res) {
+    unsigned head = *u->cqHead;
+    if (head == __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    const struct io_uring_cqe *cqe = &u->cqes[head & u->cqMask];
+    *data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(u->cqHead, head + 1, __ATOMIC_RELEASE);
+    u->inFlight--;
+    return 1;
+}
+
+static int uring_full(const Uring *u) {
+    return u->pending + u->inFlight >= URING_ENTRIES;
+}
+#else
+static int uring_open(Uring *u) {
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+    return 0;
+}
+
+static void uring_close(Uring *u) {
+    (void)u;
+}
+#endif
+
+/* --pipeline output: each chunk's buffer is owned by the writer from
+ * pipe_output_chunk on and freed once it is in the file. */
+typedef struct {
+    Uring ring;         // fd -1: write() each chunk instead
+    int fd;             // the output's
+    uint64_t offset;    // where the next chunk goes
+    struct PipeWrite {
+        char *buf;
+        size_t len, done;
+        uint64_t offset;
+    } *writes;          // by chunk number
+} PipeOutput;
+
+static void pipe_output_open(PipeOutput *po, const Output *out, size_t numChunks) {
+    struct stat st;
+    off_t at;
+    po->writes = NULL;
+    if (fstat(out->fd, &st) < 0 || !S_ISREG(st.st_mode) || (at = lseek(out->fd, 0, SEEK_CUR)) < 0 ||
+        !uring_open(&po->ring)) {
+        po->ring.fd = -1;
+        return;
+    }
+    po->writes = calloc(numChunks ? numChunks : 1, sizeof(struct PipeWrite));
+    if (!po->writes) {
+        uring_close(&po->ring);
+        return;
+    }
+    po->fd = out->fd;
+    po->offset = (uint64_t)at;
+}
+
+#ifdef HAVE_IO_URING
+// submit what is queued and handle the completions in; with `wait`, wait
+// for one first
+static void pipe_output_reap(PipeOutput *po, int wait) {
+    uint64_t i;
+    int32_t res;
+    if (uring_enter(&po->ring, wait ? 1 : 0) < 0) {
+        diag_errno("io_uring_enter");
+        fail();
+    }
+    while (uring_reap(&po->ring, &i, &res)) {
+        struct PipeWrite *w = &po->writes[i];
+        if (res <= 0) {
+            errno = res < 0 ? -res : EIO;
+            diag_errno("write output");
+            fail();
+        }
+        w->done += (size_t)res;
+        if (w->done < w->len) {
+            // a short write: the rest takes the slot this one left
+            uring_queue(&po->ring, IORING_OP_WRITE, po->fd, w->buf + w->done, w->len - w->done,
+                        w->offset + w->done, i);
+        } else {
+            free(w->buf);
+            w->buf = NULL;
+        }
+    }
+}
+#endif
+
+static void pipe_output_chunk(PipeOutput *po, Output *out, size_t i, char *buf, size_t len) {
+    if (po->ring.fd < 0) {
+        out_write(out, buf, len);
+        free(buf);
+        return;
+    }
+#ifdef HAVE_IO_URING
+    out_account(out, buf, len);
+    while (uring_full(&po->ring)) {
+        pipe_output_reap(po, 1);
+    }
+    po->writes[i] = (struct PipeWrite){ buf, len, 0, po->offset };
+    po->offset += len;
+    if (len) {
+        uring_queue(&po->ring, IORING_OP_WRITE, po->fd, buf, len, po->writes[i].offset, i);
+    }
+    pipe_output_reap(po, 0);
+#else
+    (void)i;
+#endif
+}
+
+// wait for every write; the file position ends up behind the last chunk
+static void pipe_output_close(PipeOutput *po, Output *out) {
+#ifdef HAVE_IO_URING
+    while (po->ring.fd >= 0 && po->ring.pending + po->ring.inFlight) {
+        pipe_output_reap(po, 1);
+    }
+    if (po->ring.fd >= 0 && lseek(out->fd, (off_t)po->offset, SEEK_SET) < 0) {
+        diag_errno("seek output");
+        fail();
+    }
+#else
+    (void)out;
+#endif
+    uring_close(&po->ring);
+    free(po->writes);
+}
+
+/******************************************************************************
+ * Pipelined assembly (--pipeline):
+ * Like -j, but reading, sizing, expanding and writing overlap instead of
+ * running one after the other:
+ *   - a reader thread read()s the input into chunks of PIPE_CHUNK_BYTES (cut
+ *     after the last '\n', the partial line carried into the next chunk) and
+ *     hands them to the main thread through a bounded SPSC ring, which sizes
+ *     each chunk (pass1_chunk) as it arrives;
+ *   - once every label is placed, the main thread feeds chunk numbers to N
+ *     parser workers through an MPMC ring, the workers expand them
+ *     (pass2_chunk) and report back through a second ring, and the main
+ *     thread writes the expanded chunks out in order as soon as the chunks
+ *     before them are written.
+ * At most PIPE_WINDOW_PER_JOB chunks per worker are expanded ahead of the
+ * writer, so the outputs held in memory stay bounded. As with -j, an error
+ * only stops its own chunk, so later chunks may still report theirs.
+ ******************************************************************************/
+#define PIPE_CHUNK_BYTES (256 * 1024)
+#define PIPE_READ_AHEAD 8
+#define PIPE_WINDOW_PER_JOB 4
+#define PIPE_DONE ((size_t)-1)
+
+typedef struct {
+    int fd;
+    UT_spsc chunks;     // Chunk *, NULL after the last one
+} PipeReader;
+
+typedef struct {
+    Chunk **chunks;
+    UT_mpmc work;       // chunk numbers to expand, PIPE_DONE to stop
+    UT_mpmc done;       // chunk numbers expanded
+    LabelTable labels;  // the main thread's, once every label is placed
+    FILE *diag;
+} PipeWorkers;
+
+static void *pipe_reader(void *arg) {
+    PipeReader *r = arg;
+    char *carry = NULL;
+    size_t carryLen = 0;
+    int eof = 0;
+    while (!eof) {
+        size_t cap = carryLen + PIPE_CHUNK_BYTES;
+        char *buf = malloc(cap);
+        if (!buf) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        if (carryLen) {
+            memcpy(buf, carry, carryLen);
+        }
+        size_t len = carryLen;
+        while (len < cap) {
+            ssize_t n = read(r->fd, buf + len, cap - len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                eof = 1;
+                break;
+            }
+            len += (size_t)n;
+        }
+        // keep the partial last line for the next chunk
+        size_t end = len;
+        if (!eof) {
+            while (end > carryLen && buf[end - 1] != '\n') {
+                end--;
+            }
+            if (end == carryLen) {
+                // no line ends in this chunk (the carry never has a '\n'):
+                // all of it is carried, and the next chunk is larger
+                free(carry);
+                carry = buf;
+                carryLen = len;
+                continue;
+            }
+        }
+        free(carry);
+        carryLen = len - end;
+        carry = carryLen ? malloc(carryLen) : NULL;
+        if (carryLen && !carry) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        if (carryLen) {
+            memcpy(carry, buf + end, carryLen);
+        }
+        if (end == 0) {
+            free(buf);
+            continue;
+        }
+        Chunk *c = calloc(1, sizeof(Chunk));
+        if (!c) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        c->begin = buf;
+        c->size = end;
+        utspsc_push(&r->chunks, &c);
+    }
+    free(carry);
+    Chunk *last = NULL;
+    utspsc_push(&r->chunks, &last);
+    return NULL;
+}
+
+static void *pipe_worker(void *arg) {
+    PipeWorkers *w = arg;
+    use_labels(&w->labels);
+    diagStream = w->diag;
+    for (;;) {
+        size_t i;
+        utmpmc_pop(&w->work, &i);
+        if (i == PIPE_DONE) {
+            return NULL;
+        }
+        pass2_chunk(w->chunks[i]);
+        utmpmc_push(&w->done, &i);
+    }
+}
+
+static void assemble_pipelined(const char *infile, const char *outfile, int binary, int jobs) {
+    PipeReader reader;
+    reader.fd = strcmp(infile, "-") ? open(infile, O_RDONLY) : dup(STDIN_FILENO);
+    if (reader.fd < 0) {
+        diag_errno("open input");
+        fail();
+    }
+    utspsc_init(&reader.chunks, PIPE_READ_AHEAD, sizeof(Chunk *));
+    pthread_t readerThread;
+    if (pthread_create(&readerThread, NULL, pipe_reader, &reader) != 0) {
+        diag_errno("pthread_create");
+        fail();
+    }
+
+    // pass 1 as the chunks come in
+    Chunk **chunks = NULL;
+    size_t numChunks = 0, capChunks = 0;
+    for (;;) {
+        Chunk *c;
+        utspsc_pop(&reader.chunks, &c);
+        if (!c) {
+            break;
+        }
+        pass1_chunk(c);
+        chunks = grow_array(chunks, &capChunks, numChunks + 1, sizeof(Chunk *));
+        chunks[numChunks++] = c;
+    }
+    pthread_join(readerThread, NULL);
+    utspsc_done(&reader.chunks);
+    close(reader.fd);
+
+    // place_chunks wants them contiguous; the texts stay where they are
+    Chunk *placed = malloc((numChunks ? numChunks : 1) * sizeof(Chunk));
+    if (!placed) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    for (size_t i = 0; i < numChunks; i++) {
+        placed[i] = *chunks[i];
+        free(chunks[i]);
+        chunks[i] = &placed[i];
+    }
+    if (!place_chunks(placed, numChunks)) {
+        fail();
+    }
+    freeze_labels(jobs);
+    for (size_t i = 0; i < numChunks; i++) {
+        free(placed[i].labels);
+        free(placed[i].segments.items);
+        open_memory_output(&placed[i].out, binary);
+    }
+
+    Output out;
+    if (!open_output(&out, outfile, binary, 0)) {
+        diag_errno("fopen output");
+        fail();
+    }
+    out_flush(&out);    // the image header goes first
+    PipeOutput po;
+    pipe_output_open(&po, &out, numChunks);
+
+    // pass 2: workers expand, this thread writes in order
+    size_t window = (size_t)jobs * PIPE_WINDOW_PER_JOB;
+    PipeWorkers workers;
+    workers.chunks = chunks;
+    share_labels(&workers.labels);
+    workers.diag = diag();
+    utmpmc_init(&workers.work, window + (size_t)jobs, sizeof(size_t));
+    utmpmc_init(&workers.done, window, sizeof(size_t));
+    pthread_t *threads = malloc((size_t)jobs * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, pipe_worker, &workers) != 0) {
+            break;
+        }
+    }
+    unsigned char *expanded = calloc(numChunks ? numChunks : 1, 1);
+    if (!expanded) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    size_t fed = 0, written = 0;
+    while (written < numChunks) {
+        // the window never exceeds either ring, so these pushes don't block
+        while (fed < numChunks && fed - written < window) {
+            if (started == 0) {
+                pass2_chunk(&placed[fed]);  // no threads available
+                expanded[fed++] = 1;
+            } else {
+                utmpmc_push(&workers.work, &fed);
+                fed++;
+            }
+        }
+        if (!expanded[written]) {
+            size_t i;
+            utmpmc_pop(&workers.done, &i);
+            expanded[i] = 1;
+        }
+        for (; written < fed && expanded[written]; written++) {
+            Chunk *c = &placed[written];
+            pipe_output_chunk(&po, &out, written, c->out.buf, c->out.len);
+            out.errors += c->out.errors;
+            free((char *)c->begin);
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        size_t stop = PIPE_DONE;
+        utmpmc_push(&workers.work, &stop);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(expanded);
+    utmpmc_done(&workers.work);
+    utmpmc_done(&workers.done);
+    pipe_output_close(&po, &out);
+    free(placed);
+    free(chunks);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Low-memory assembly (--low-memory):
+ * For inputs larger than memory. pass1 read()s the input once and keeps no
+ * IR and no text: pass1_line's records are dropped as soon as they are
+ * made, leaving the label table, the image segments and, every INDEX_LINES
+ * lines, an IndexEntry with the input offset of the next line and the
+ * section and address pass1 was at there. Pass 2 then expands the stretches
+ * between entries on -j workers, each pread()ing its stretch by offset,
+ * while this thread writes them out in order, at most PIPE_WINDOW_PER_JOB
+ * stretches per worker ahead. Memory stays O(labels + lines / INDEX_LINES).
+ * The input must be a file; .align and .macro, which pass2_lines has no
+ * state for, are rejected.
+ ******************************************************************************/
+#define INDEX_LINES 4096
+
+typedef struct {
+    uint64_t offset;    // of the stretch's first line
+    int pc;
+    Section section;    // at that line
+} IndexEntry;
+
+typedef struct {
+    IndexEntry *entries;
+    size_t num, cap;
+    uint64_t size;      // of the input
+} LineIndex;
+
+typedef struct {
+    int fd;
+    int binary;
+    const LineIndex *index;
+    Chunk *window;      // stretch i expands in window[i % windowSize]
+    size_t windowSize;
+    UT_mpmc work;       // stretch numbers to expand, PIPE_DONE to stop
+    UT_mpmc done;       // stretch numbers expanded
+    LabelTable labels;
+    FILE *diag;
+} IndexWorkers;
+
+// pass 1 over `fin` into the label table and `index`; 0 after reporting an invalid line
+static int pass1_indexed(LineReader *fin, LineIndex *index) {
+    Section section = NONE;
+    int programCounter = 0x1000;
+    const char *line;
+    size_t len;
+    for (uint64_t number = 0;; ) {
+        if (number % INDEX_LINES == 0) {
+            index->entries = grow_array(index->entries, &index->cap, index->num + 1, sizeof(IndexEntry));
+            index->entries[index->num++] = (IndexEntry){ fin->base + fin->pos, programCounter, section };
+        }
+        if (!next_line(fin, &line, &len)) {
+            break;
+        }
+        number++;
+        if (!len || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == '.' && (align_directive(line, len) || macro_directive(line, len) ||
+                               equ_directive(line, len) || include_directive(line, len))) {
+            fprintf(diag(), "pass1 error: %s can't be used with --low-memory => %.*s\n",
+                    line[1] == 'a' ? ".align" : equ_directive(line, len) ? ".equ" :
+                    include_directive(line, len) ? ".include" : ".macro", (int)len, line);
+            return 0;
+        }
+        if (!pass1_line(line, len, (uint32_t)number, &fin->masks, &section, &programCounter)) {
+            return 0;
+        }
+        ir.num = ir.numLines = ir.numRefs = ir.numWords = ir.numLabels = 0;
+    }
+    index->size = fin->base + fin->pos;
+    if (index->num > 1 && index->entries[index->num - 1].offset == index->size) {
+        index->num--;   // an empty last stretch
+    }
+    return 1;
+}
+
+static void expand_stretch(IndexWorkers *w, size_t i) {
+    Chunk *c = &w->window[i % w->windowSize];
+    const IndexEntry *e = &w->index->entries[i];
+    uint64_t end = i + 1 < w->index->num ? e[1].offset : w->index->size;
+    size_t size = (size_t)(end - e->offset);
+    char *buf = malloc(size ? size : 1);
+    if (!buf) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    for (size_t got = 0; got < size;) {
+        ssize_t n = pread(w->fd, buf + got, size - got, (off_t)(e->offset + got));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(diag(), "Error: the input changed while it was assembled\n");
+            fail();
+        }
+        got += (size_t)n;
+    }
+    memset(c, 0, sizeof(*c));
+    c->begin = buf;
+    c->size = size;
+    c->section = e->section;
+    c->pc = e->pc;
+    open_memory_output(&c->out, w->binary);
+    pass2_chunk(c);
+}
+
+static void *index_worker(void *arg) {
+    IndexWorkers *w = arg;
+    use_labels(&w->labels);
+    diagStream = w->diag;
+    for (;;) {
+        size_t i;
+        utmpmc_pop(&w->work, &i);
+        if (i == PIPE_DONE) {
+            return NULL;
+        }
+        expand_stretch(w, i);
+        utmpmc_push(&w->done, &i);
+    }
+}
+
+static void assemble_indexed(const char *infile, const char *outfile, int binary, int jobs) {
+    LineReader fin;
+    if (!reader_open_streamed(&fin, infile)) {
+        diag_errno("open input");
+        fail();
+    }
+    LineIndex index = { NULL, 0, 0, 0 };
+    if (!pass1_indexed(&fin, &index)) {
+        fail();
+    }
+    freeze_labels(jobs);
+
+    Output out;
+    if (!open_output(&out, outfile, binary, 0)) {
+        diag_errno("fopen output");
+        fail();
+    }
+    out_flush(&out);    // the image header goes first
+
+    // pass 2: workers expand, this thread writes in order
+    IndexWorkers workers;
+    workers.fd = fin.fd;
+    workers.binary = binary;
+    workers.index = &index;
+    workers.windowSize = (size_t)jobs * PIPE_WINDOW_PER_JOB;
+    workers.window = calloc(workers.windowSize, sizeof(Chunk));
+    share_labels(&workers.labels);
+    workers.diag = diag();
+    utmpmc_init(&workers.work, workers.windowSize + (size_t)jobs, sizeof(size_t));
+    utmpmc_init(&workers.done, workers.windowSize, sizeof(size_t));
+    pthread_t *threads = malloc((size_t)jobs * sizeof(pthread_t));
+    unsigned char *expanded = calloc(workers.windowSize, 1);   // by window slot
+    if (!workers.window || !threads || !expanded) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, index_worker, &workers) != 0) {
+            break;
+        }
+    }
+    size_t fed = 0, written = 0;
+    while (written < index.num) {
+        // the window never exceeds either ring, so these pushes don't block
+        while (fed < index.num && fed - written < workers.windowSize) {
+            if (started == 0) {
+                expand_stretch(&workers, fed);  // no threads available
+                expanded[fed++ % workers.windowSize] = 1;
+            } else {
+                utmpmc_push(&workers.work, &fed);
+                fed++;
+            }
+        }
+        if (!expanded[written % workers.windowSize]) {
+            size_t i;
+            utmpmc_pop(&workers.done, &i);
+            expanded[i % workers.windowSize] = 1;
+        }
+        for (; written < fed && expanded[written % workers.windowSize]; written++) {
+            Chunk *c = &workers.window[written % workers.windowSize];
+            out_write(&out, c->out.buf, c->out.len);
+            out.errors += c->out.errors;
+            free(c->out.buf);
+            free((char *)c->begin);
+            expanded[written % workers.windowSize] = 0;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        size_t stop = PIPE_DONE;
+        utmpmc_push(&workers.work, &stop);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(expanded);
+    free(workers.window);
+    utmpmc_done(&workers.work);
+    utmpmc_done(&workers.done);
+    free(index.entries);
+    reader_close(&fin);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Incremental cache (--cache FILE):
+ * The input is split into blocks at label definitions. For each block the
+ * cache keeps, keyed by a hash of its text:
+ *   - its pass 1 results as pass1_chunk computes them (they don't depend on
+ *     where the block ends up), and
+ *   - its pass 2 output with what that output depended on: the section the
+ *     block started in, the values of the labels it references and, if it
+ *     has a pc-relative 'brr :label', its address.
+ * A rebuild only sizes blocks whose text changed and only expands blocks
+ * whose text or dependencies changed; everything else is copied from the
+ * cache. Blocks that produced diagnostics are not cached, so warnings are
+ * repeated. The file is in native byte order and is rewritten after every
+ * successful run; --serve keeps the same image in memory instead. Entries
+ * stay in block order, so most blocks find theirs right after the last one
+ * found, without a search.
+ ******************************************************************************/
+#define CACHE_MAGIC "TKC1"
+
+// fixed-size records, written to the cache file as they are
+typedef struct {
+    uint64_t hash;
+    uint64_t size;              // block bytes
+    int32_t sawDirective;
+    int32_t endSection;
+    int32_t prefixCode;
+    int32_t prefixData;
+    int32_t bodyBytes;
+    int32_t prefixErrorOffset;  // -1 if the prefix is valid code
+    uint32_t prefixErrorLen;
+    uint32_t numLabels;
+    uint32_t numSegments;
+    uint32_t numRefs;
+    int32_t hasOutput;
+    int32_t section;            // pass 2 started in this section ...
+    int32_t pc;                 // ... at this address (-1: any address)
+    uint32_t binary;            // the output is a binary image fragment
+    uint64_t outputLen;
+} CacheEntryHeader;
+
+typedef struct {
+    uint32_t offset;            // name in the block text
+    int32_t len;
+    int32_t inPrefix;
+    int32_t codeOffset;
+    int32_t dataOffset;
+} CacheLabel;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t address;
+    uint64_t size;
+} CacheSegment;
+
+typedef struct {
+    uint32_t offset;            // label reference in the block text
+    int32_t len;
+    int32_t value;              // its value when the output was made
+} CacheRef;
+
+typedef struct {
+    CacheEntryHeader h;
+    const char *labels;         // CacheLabel[numLabels], unaligned
+    const char *segments;       // CacheSegment[numSegments]
+    const char *refs;           // CacheRef[numRefs]
+    const char *output;
+} CacheEntry;
+
+typedef struct {
+    LineReader file;            // the whole cache file
+    CacheEntry *entries;        // in file (block) order
+    uint32_t *byHash;           // entries' indices, sorted by hash
+    size_t numEntries;
+} BlockCache;
+
+// per-block cache state (Chunk.block)
+typedef struct BlockState {
+    uint64_t hash;
+    const CacheEntry *entry;    // cached entry with the same text, if any
+    int reused;                 // pass 2 output taken from the cache
+    CacheRef *refs;             // label references (misses only)
+    size_t numRefs, capRefs;
+    int pcRelative;
+} BlockState;
+
+static uint64_t block_hash(const char *p, size_t n) {
+    return digest_bytes(DIGEST_SEED, p, n);
+}
+
+// for qsort, which has no context argument
+static __thread const CacheEntry *sortingEntries;
+
+static int compare_entries(const void *a, const void *b) {
+    uint64_t x = sortingEntries[*(const uint32_t *)a].h.hash;
+    uint64_t y = sortingEntries[*(const uint32_t *)b].h.hash;
+    return x < y ? -1 : x > y;
+}
+
+// index the cache image in cache->file; entries past a malformed one are dropped
+static void parse_cache(BlockCache *cache) {
+    size_t size = cache->file.size;
+    const char *p = cache->file.data, *end = p + size;
+    uint64_t count;
+    if (size < 12 || memcmp(p, CACHE_MAGIC, 4)) {
+        return;
+    }
+    memcpy(&count, p + 4, sizeof(count));
+    p += 12;
+    size_t cap = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        CacheEntry e;
+        if ((size_t)(end - p) < sizeof(e.h)) {
+            break;
+        }
+        memcpy(&e.h, p, sizeof(e.h));
+        p += sizeof(e.h);
+        uint64_t need = (uint64_t)e.h.numLabels * sizeof(CacheLabel) +
+                        (uint64_t)e.h.numSegments * sizeof(CacheSegment) +
+                        (uint64_t)e.h.numRefs * sizeof(CacheRef) + e.h.outputLen;
+        if (need > (uint64_t)(end - p)) {
+            break;
+        }
+        e.labels = p;
+        p += e.h.numLabels * sizeof(CacheLabel);
+        e.segments = p;
+        p += e.h.numSegments * sizeof(CacheSegment);
+        e.refs = p;
+        p += e.h.numRefs * sizeof(CacheRef);
+        e.output = p;
+        p += e.h.outputLen;
+        cache->entries = grow_array(cache->entries, &cap, cache->numEntries + 1, sizeof(CacheEntry));
+        cache->entries[cache->numEntries++] = e;
+    }
+    cache->byHash = malloc(cache->numEntries * sizeof(uint32_t) + 1);
+    if (!cache->byHash) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    for (size_t i = 0; i < cache->numEntries; i++) {
+        cache->byHash[i] = (uint32_t)i;
+    }
+    sortingEntries = cache->entries;
+    qsort(cache->byHash, cache->numEntries, sizeof(uint32_t), compare_entries);
+}
+
+// load a cache file; a missing or malformed one just leaves the cache empty
+static void load_cache(BlockCache *cache, const char *filename) {
+    memset(cache, 0, sizeof(*cache));
+    if (!reader_open(&cache->file, filename)) {
+        cache->file.fd = -1;
+        return;
+    }
+    reader_slurp(&cache->file);
+    parse_cache(cache);
+}
+
+// the entry for a block, trying the one at `guess` (where the block after
+// the last one found would be, blocks mostly staying in order) first
+static const CacheEntry *find_cache_entry(const BlockCache *cache, uint64_t hash, size_t size, size_t guess) {
+    const CacheEntry *e = cache->entries;
+    if (guess < cache->numEntries && e[guess].h.hash == hash && e[guess].h.size == size) {
+        return &e[guess];
+    }
+    size_t lo = 0, hi = cache->numEntries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e[cache->byHash[mid]].h.hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < cache->numEntries && e[cache->byHash[lo]].h.hash == hash; lo++) {
+        if (e[cache->byHash[lo]].h.size == size) {
+            return &e[cache->byHash[lo]];
+        }
+    }
+    return NULL;
+}
+
+static void free_cache(BlockCache *cache) {
+    free(cache->entries);
+    free(cache->byHash);
+    reader_close(&cache->file);
+}
+
+// split the input into blocks, each starting at a label definition
+static void add_block(Chunk **blocks, size_t *n, size_t *cap, const char *begin, size_t size) {
+    *blocks = grow_array(*blocks, cap, *n + 1, sizeof(Chunk));
+    memset(&(*blocks)[*n], 0, sizeof(Chunk));
+    (*blocks)[*n].begin = begin;
+    (*blocks)[*n].size = size;
+    (*n)++;
+}
+
+// label definitions found from the block masks, as in count_label_lines
+static size_t split_blocks(const char *data, size_t size, Chunk **out) {
+    Chunk *blocks = NULL;
+    size_t n = 0, cap = 0, start = 0, lineStart = 0;
+    int blankSoFar = 1;
+    for (size_t pos = 0; pos < size; pos += 64) {
+        ScanMasks m;
+        scan_at(data, size, pos, &m);
+        uint64_t in = size - pos >= 64 ? ~0ull : ((uint64_t)1 << (size - pos)) - 1;
+        uint64_t solid = ~(m.space | m.newline) & in;
+        for (uint64_t c = m.colon; c; c &= c - 1) {
+            uint64_t before = (c & -c) - 1, nl = m.newline & before;
+            size_t at = lineStart;
+            int label = blankSoFar && !(solid & before);
+            if (nl) {
+                int last = 63 - __builtin_clzll(nl);
+                at = pos + (size_t)last + 1;
+                label = !(solid & before & ~((2ull << last) - 1));
+            }
+            if (label && at > start) {
+                add_block(&blocks, &n, &cap, data + start, at - start);
+                start = at;
+            }
+        }
+        if (m.newline) {
+            int last = 63 - __builtin_clzll(m.newline);
+            lineStart = pos + (size_t)last + 1;
+            blankSoFar = !(solid & ~((2ull << last) - 1));
+        } else {
+            blankSoFar = blankSoFar && !solid;
+        }
+    }
+    if (start < size || n == 0) {
+        add_block(&blocks, &n, &cap, data + start, size - start);
+    }
+    *out = blocks;
+    return n;
+}
+
+// take a block's pass 1 results from its cache entry
+static void restore_pass1(Chunk *c, const CacheEntry *e) {
+    c->sawDirective = e->h.sawDirective;
+    c->endSection = (Section)e->h.endSection;
+    c->prefixCode = e->h.prefixCode;
+    c->prefixData = e->h.prefixData;
+    c->bodyBytes = e->h.bodyBytes;
+    if (e->h.prefixErrorOffset >= 0) {
+        c->prefixError = c->begin + e->h.prefixErrorOffset;
+        c->prefixErrorLen = e->h.prefixErrorLen;
+    }
+    // sized exactly: there can be millions of blocks
+    c->labels = malloc(e->h.numLabels * sizeof(ChunkLabel) + 1);
+    c->segments.items = malloc(e->h.numSegments * sizeof(ImageSegment) + 1);
+    if (!c->labels || !c->segments.items) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    c->capLabels = e->h.numLabels;
+    c->segments.cap = e->h.numSegments;
+    for (uint32_t i = 0; i < e->h.numLabels; i++) {
+        CacheLabel l;
+        memcpy(&l, e->labels + i * sizeof(l), sizeof(l));
+        c->labels[i] = (ChunkLabel){ c->begin + l.offset, l.len, l.inPrefix, l.codeOffset, l.dataOffset };
+    }
+    c->numLabels = e->h.numLabels;
+    for (uint32_t i = 0; i < e->h.numSegments; i++) {
+        CacheSegment seg;
+        memcpy(&seg, e->segments + i * sizeof(seg), sizeof(seg));
+        add_segment_bytes(&c->segments, (Section)seg.kind, (int)seg.address, (int)seg.size);
+    }
+}
+
+// value of the label named at `name` (len bytes), -1 if undefined
+static int label_value(const char *name, int len) {
+    char lbl[50];
+    memcpy(lbl, name, (size_t)len);
+    lbl[len] = '\0';
+    LabelAddress *entry = find_label(lbl);
+    return entry ? label_address(entry) : -1;
+}
+
+// can the cached output of the block be used as it is?
+static int cached_output_matches(const Chunk *c, const CacheEntry *e, int binary) {
+    if (!e->h.hasOutput || (int)e->h.binary != binary || e->h.section != (int32_t)c->section ||
+        (e->h.pc >= 0 && e->h.pc != c->pc)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < e->h.numRefs; i++) {
+        CacheRef ref;
+        memcpy(&ref, e->refs + i * sizeof(ref), sizeof(ref));
+        if (label_value(c->begin + ref.offset, ref.len) != ref.value) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void add_cache_ref(BlockState *b, const Chunk *c, const char *name, int len, int value) {
+    b->refs = grow_array(b->refs, &b->capRefs, b->numRefs + 1, sizeof(CacheRef));
+    CacheRef *ref = &b->refs[b->numRefs++];
+    ref->offset = (uint32_t)(name - c->begin);
+    ref->len = len;
+    ref->value = value;
+}
+
+// the label references of a block and whether its output depends on its address
+static void collect_refs(Chunk *c, BlockState *b) {
+    LineReader view;
+    reader_view(&view, c->begin, c->size);
+    const char *line;
+    size_t len;
+    TokenLine t;
+    while (next_line(&view, &line, &len)) {
+        if (!len || line[0] == ';' || line[0] == '.' || line[0] == ':') {
+            continue;
+        }
+        lex_line(&t, line, len, &view.masks);
+        if (t.labelTok < 0) {
+            continue;
+        }
+        const Token *tk = &t.tok[t.labelTok];
+        if (tk->kind == TOK_EXPR) {
+            // every label in it
+            const char *p = line + tk->start, *end = p + tk->len;
+            while ((p = memchr(p, ':', (size_t)(end - p))) != NULL) {
+                const char *name = ++p;
+                p = expr_label_end(p, end);
+                int n = (int)label_name_len(name, p);
+                add_cache_ref(b, c, name, n, label_value(name, n));
+            }
+        } else {
+            char lbl[50];
+            token_label(&t, tk, lbl);
+            add_cache_ref(b, c, line + tk->start, (int)strlen(lbl), resolve_label_ref(&t));
+        }
+        if (t.op == OP_BRR) {
+            b->pcRelative = 1;
+        }
+    }
+}
+
+static void pass1_block(Chunk *c) {
+    if (!c->block->entry) {
+        pass1_chunk(c);
+    }
+}
+
+static void pass2_block(Chunk *c) {
+    BlockState *b = c->block;
+    if (!b->reused) {
+        pass2_chunk(c);
+        collect_refs(c, b);
+    }
+}
+
+static void append_cache_entry(Output *w, const Chunk *c, const BlockState *b, int binary) {
+    CacheEntryHeader h;
+    memset(&h, 0, sizeof(h));
+    h.hash = b->hash;
+    h.size = c->size;
+    h.sawDirective = c->sawDirective;
+    h.endSection = c->endSection;
+    h.prefixCode = c->prefixCode;
+    h.prefixData = c->prefixData;
+    h.bodyBytes = c->bodyBytes;
+    h.prefixErrorOffset = c->prefixError ? (int32_t)(c->prefixError - c->begin) : -1;
+    h.prefixErrorLen = (uint32_t)c->prefixErrorLen;
+    h.numLabels = (uint32_t)c->numLabels;
+    h.numSegments = (uint32_t)c->segments.num;
+    h.binary = (uint32_t)binary;
+    h.section = c->section;
+    const CacheEntry *e = b->entry;
+    if (b->reused) {
+        h.hasOutput = 1;
+        h.pc = e->h.pc;
+        h.numRefs = e->h.numRefs;
+        h.outputLen = e->h.outputLen;
+    } else {
+        h.hasOutput = !c->out.errors;
+        for (size_t i = 0; i < b->numRefs; i++) {
+            h.hasOutput &= b->refs[i].value >= 0;   // keep the warning for next time
+        }
+        h.pc = b->pcRelative ? c->pc : -1;
+        h.numRefs = h.hasOutput ? (uint32_t)b->numRefs : 0;
+        h.outputLen = h.hasOutput ? c->out.len : 0;
+    }
+    out_bytes(w, &h, sizeof(h));
+    for (size_t i = 0; i < c->numLabels; i++) {
+        const ChunkLabel *l = &c->labels[i];
+        CacheLabel cl = { (uint32_t)(l->name - c->begin), l->len, l->inPrefix, l->codeOffset, l->dataOffset };
+        out_bytes(w, &cl, sizeof(cl));
+    }
+    for (size_t i = 0; i < c->segments.num; i++) {
+        const ImageSegment *seg = &c->segments.items[i];
+        CacheSegment cs = { (uint32_t)seg->kind, 0, seg->address, seg->size };
+        out_bytes(w, &cs, sizeof(cs));
+    }
+    if (b->reused) {
+        out_bytes(w, e->refs, e->h.numRefs * sizeof(CacheRef));
+        out_bytes(w, e->output, e->h.outputLen);
+    } else if (h.hasOutput) {
+        out_bytes(w, b->refs, b->numRefs * sizeof(CacheRef));
+        out_bytes(w, c->out.buf, c->out.len);
+    }
+}
+
+// the cache image of the blocks of a build
+static void write_cache(Output *w, const Chunk *blocks, size_t numBlocks, int binary) {
+    uint64_t count = numBlocks;
+    out_bytes(w, CACHE_MAGIC, 4);
+    out_bytes(w, &count, sizeof(count));
+    for (size_t i = 0; i < numBlocks; i++) {
+        append_cache_entry(w, &blocks[i], blocks[i].block, binary);
+    }
+}
+
+// write the new cache next to the old one, then replace it
+static void save_cache(const char *filename, const Chunk *blocks, size_t numBlocks, int binary) {
+    size_t len = strlen(filename);
+    char *tmp = malloc(len + 5);
+    if (!tmp) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    memcpy(tmp, filename, len);
+    memcpy(tmp + len, ".tmp", 5);
+    Output w;
+    if (!open_output_fd(&w, open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644), 0, 0)) {
+        diag_errno("cache: open");
+        free(tmp);
+        return;
+    }
+    write_cache(&w, blocks, numBlocks, binary);
+    out_flush(&w);
+    free(w.buf);
+    if (close(w.fd) < 0 || rename(tmp, filename) < 0) {
+        diag_errno("cache: write");
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+// a program split into blocks and assembled against a cache
+typedef struct {
+    Chunk *blocks;
+    BlockState *states;
+    size_t numBlocks;
+    int changed;        // some output was not taken from the cache
+} BlockBuild;
+
+// both passes over the blocks of the source in `fin`; returns 0 after
+// reporting an invalid line, leaving `b` to free_blocks
+static int build_blocks(BlockBuild *b, const LineReader *fin, const BlockCache *cache, int binary,
+                        int jobs) {
+    Chunk *blocks;
+    size_t numBlocks = split_blocks(fin->data, fin->size, &blocks);
+    BlockState *states = calloc(numBlocks, sizeof(BlockState));
+    b->blocks = blocks;
+    b->states = states;
+    b->numBlocks = numBlocks;
+    b->changed = numBlocks != cache->numEntries;
+    if (!states) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+
+    // pass 1: unchanged blocks come from the cache
+    size_t guess = 0;
+    for (size_t i = 0; i < numBlocks; i++) {
+        BlockState *st = &states[i];
+        blocks[i].block = st;
+        st->hash = block_hash(blocks[i].begin, blocks[i].size);
+        // the text doesn't cover what an .incbin includes
+        if (memmem(blocks[i].begin, blocks[i].size, ".incbin", 7)) {
+            continue;
+        }
+        st->entry = find_cache_entry(cache, st->hash, blocks[i].size, guess);
+        if (st->entry) {
+            restore_pass1(&blocks[i], st->entry);
+            guess = (size_t)(st->entry - cache->entries) + 1;
+        }
+    }
+    run_chunks(blocks, numBlocks, jobs, pass1_block);
+    if (!place_chunks(blocks, numBlocks)) {
+        return 0;
+    }
+    freeze_labels(jobs);
+
+    // pass 2: blocks whose text and dependencies are unchanged are copied
+    for (size_t i = 0; i < numBlocks; i++) {
+        BlockState *st = &states[i];
+        st->reused = st->entry && cached_output_matches(&blocks[i], st->entry, binary);
+        b->changed |= !st->reused;
+        open_memory_output(&blocks[i].out, binary);
+    }
+    run_chunks(blocks, numBlocks, jobs, pass2_block);
+    return 1;
+}
+
+// the output of every block, in order
+static void emit_blocks(const BlockBuild *b, Output *out) {
+    for (size_t i = 0; i < b->numBlocks; i++) {
+        const BlockState *st = &b->states[i];
+        if (st->reused) {
+            out_bytes(out, st->entry->output, st->entry->h.outputLen);
+        } else {
+            out_bytes(out, b->blocks[i].out.buf, b->blocks[i].out.len);
+            out->errors += b->blocks[i].out.errors;
+        }
+    }
+}
+
+static void free_blocks(BlockBuild *b) {
+    for (size_t i = 0; i < b->numBlocks; i++) {
+        free(b->blocks[i].labels);
+        free(b->blocks[i].segments.items);
+        free(b->blocks[i].out.buf);
+        if (b->states) {
+            free(b->states[i].refs);
+        }
+    }
+    free(b->blocks);
+    free(b->states);
+    memset(b, 0, sizeof(*b));
+}
+
+static void assemble_cached(const char *infile, const char *outfile, int binary, int jobs,
+                            const char *cachefile) {
+    LineReader fin;
+    if (!reader_open(&fin, infile)) {
+        diag_errno("open input");
+        fail();
+    }
+    reader_slurp(&fin);
+    BlockCache cache;
+    load_cache(&cache, cachefile);
+    BlockBuild build;
+    if (!build_blocks(&build, &fin, &cache, binary, jobs)) {
+        reader_close(&fin);
+        fail();
+    }
+
+    Output out;
+    if (!open_output(&out, outfile, binary, 0)) {
+        diag_errno("fopen output");
+        reader_close(&fin);
+        fail();
+    }
+    emit_blocks(&build, &out);
+    // an unchanged program leaves the cache as it is
+    if (build.changed && !(binary && out.errors)) {
+        save_cache(cachefile, build.blocks, build.numBlocks, binary);
+    }
+
+    free_blocks(&build);
+    free_cache(&cache);
+    reader_close(&fin);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Dead code elimination (--dce, with -O):
+ * Drops the code no execution reaches, before the other -O passes. .code is
+ * cut into blocks at labels and directives; from the block at the entry
+ * point, a reached block reaches the blocks its label operands name (the
+ * 'ld rX, :label' of a br or call, a 'brr :label'), the target of a
+ * 'brr N', and the block after it unless it ends in br, brr, return or
+ * halt. An ld literal or a .data word that is exactly the address of a
+ * block keeps it too, for jump tables. This assumes code is only entered
+ * that way: a computed address (a label plus an offset) is not followed,
+ * and a reached 'brr rX' leaves the program as it is. Data is always kept;
+ * the labels of dropped code name whatever follows it, and layout places
+ * everything at its new address.
+ ******************************************************************************/
+typedef struct {
+    int *pcs;           // pass1 address of each record, and of the end
+    int *block;         // code block of each record, -1 outside .code
+    int *start;         // first record of each block
+    char *reached;
+    int *stack;
+    size_t numBlocks, depth;
+} DceState;
+
+// the block starting at `address`, -1 if no code block does
+static int dce_block_at(const DceState *s, int64_t address) {
+    size_t lo = 0, hi = ir.num;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->pcs[mid] < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo < ir.num && ir_size(&ir.insns[lo]) == 0) {
+        lo++;
+    }
+    if (lo == ir.num || s->pcs[lo] != address || s->block[lo] < 0 ||
+        (size_t)s->start[s->block[lo]] != lo) {
+        return -1;
+    }
+    return s->block[lo];
+}
+
+static void dce_reach(DceState *s, int b) {
+    if (b >= 0 && !s->reached[b]) {
+        s->reached[b] = 1;
+        s->stack[s->depth++] = b;
+    }
+}
+
+// follow block b; 0 if it branches somewhere no label names
+static int dce_follow(DceState *s, int b) {
+    size_t i = (size_t)s->start[b];
+    for (; i < ir.num && s->block[i] == b; i++) {
+        const IrInsn *in = &ir.insns[i];
+        if (in->op == IR_RAW) {
+            TokenLine t;
+            lex_line(&t, ir.lines[in->line].text, ir.lines[in->line].len, NULL);
+            int address = resolve_label_ref(&t);
+            if (t.op == OP_BRR && (t.labelTok < 0 || (t.tok[t.labelTok].kind == TOK_EXPR && address < 0))) {
+                return 0;
+            }
+            dce_reach(s, dce_block_at(s, address));
+        } else if (in->mop & IR_LABEL) {
+            dce_reach(s, dce_block_at(s, ir_label_address(in)));
+        } else if (in->op == OP_BRR) {
+            if (in->mop == MOP_BRR_R) {
+                return 0;
+            }
+            dce_reach(s, dce_block_at(s, s->pcs[i] + in->imm));
+        } else if (in->op == OP_LD) {
+            dce_reach(s, dce_block_at(s, in->imm));
+        }
+    }
+    int op = ir.insns[i - 1].op;
+    if (op != OP_BR && op != OP_BRR && op != OP_RETURN && op != OP_HALT && (size_t)b + 1 < s->numBlocks) {
+        dce_reach(s, b + 1);
+    }
+    return 1;
+}
+
+// the blocks reached from the entry point; 0 to keep everything
+static int dce_mark(DceState *s) {
+    Section section = NONE;
+    size_t li = 0, first = ir.num;
+    int pc = 0x1000;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        int labelled = 0;
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            labelled = 1;
+        }
+        s->pcs[i] = pc;
+        s->block[i] = -1;
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        } else if (section == CODE) {
+            if (labelled || i == 0 || s->block[i - 1] < 0) {
+                s->start[s->numBlocks++] = (int)i;
+            }
+            s->block[i] = (int)s->numBlocks - 1;
+        }
+        if (first == ir.num && section != NONE && ir_size(in) > 0) {
+            first = i;
+        }
+        pc += ir_size(in);
+    }
+    s->pcs[ir.num] = pc;
+    if (first == ir.num || s->block[first] < 0) {
+        fprintf(diag(), "Warning: --dce needs the image to start with code, not using it\n");
+        return 0;
+    }
+    dce_reach(s, s->block[first]);
+    for (size_t i = 0; i < ir.num; i++) {
+        if (ir.insns[i].op == IR_DATA) {
+            dce_reach(s, dce_block_at(s, (int64_t)ir.words[ir.insns[i].word]));
+        }
+    }
+    while (s->depth) {
+        if (!dce_follow(s, s->stack[--s->depth])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void dce_ir(void) {
+    DceState s = { NULL, NULL, NULL, NULL, NULL, 0, 0 };
+    s.pcs = malloc((ir.num + 1) * sizeof(int));
+    s.block = malloc((ir.num + 1) * sizeof(int));
+    s.start = malloc((ir.num + 1) * sizeof(int));
+    s.stack = malloc((ir.num + 1) * sizeof(int));
+    s.reached = calloc(ir.num + 1, 1);
+    if (!s.pcs || !s.block || !s.start || !s.stack || !s.reached) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    if (dce_mark(&s)) {
+        size_t j = 0, li = 0;
+        for (size_t i = 0; i < ir.num; i++) {
+            // labels of dropped records name whatever is kept next
+            for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+                ir.labels[li].insn = j;
+            }
+            if (s.block[i] < 0 || s.reached[s.block[i]]) {
+                ir.insns[j++] = ir.insns[i];
+            }
+        }
+        for (; li < ir.numLabels; li++) {
+            ir.labels[li].insn = j;
+        }
+        ir.num = j;
+    }
+    free(s.pcs);
+    free(s.block);
+    free(s.start);
+    free(s.stack);
+    free(s.reached);
+}
+
+/******************************************************************************
+ * Profile-guided layout (--profile-use FILE, with -O):
+ * Reorders .code by the folded stacks a '-r --profile FILE' run wrote, so
+ * the code that ran is contiguous and code that never ran sits at the end
+ * of its section. The unit moved is a chain: records from a label after a
+ * br, brr, return or halt up to the next such end, so every fall-through
+ * stays as it is. The profile counts instructions per called function, so
+ * a chain that starts a function (a label the profile names, or one a
+ * 'ld rX, :label; call rX' calls) weighs what its function ran and the
+ * chains after it weigh the same. Chains are ordered by weight, the first
+ * chain of each .code section (the entry point) staying in front; equal
+ * weights keep their order. Layout then relaxes the branches that now
+ * fall in range. A 'brr' by a register or to another chain by a fixed
+ * offset leaves the layout as it is.
+ ******************************************************************************/
+typedef struct {
+    int64_t address;        // pass1's, which a profile of the plain image has too
+    uint64_t count;
+} ProfileWeight;
+
+static int compare_weight_addresses(const void *a, const void *b) {
+    const ProfileWeight *x = a, *y = b;
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+typedef struct {
+    size_t start, end;      // records
+    uint64_t weight;
+} LayoutChain;
+
+static int compare_chain_weights(const void *a, const void *b) {
+    const LayoutChain *x = a, *y = b;
+    if (x->weight != y->weight) {
+        return x->weight > y->weight ? -1 : 1;
+    }
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// the instructions each function ran, by address
+static ProfileWeight *read_profile_weights(const char *path, size_t *num) {
+    LineReader r;
+    if (!reader_open(&r, path)) {
+        fprintf(diag(), "Error: cannot open profile '%s'\n", path);
+        fail();
+    }
+    ProfileWeight *w = NULL;
+    size_t cap = 0;
+    *num = 0;
+    const char *line;
+    size_t len;
+    while (reader_next(&r, &line, &len)) {
+        // "caller;...;function count", a function being label[+0xN] or 0xN
+        const char *space = memrchr(line, ' ', len);
+        if (!space) {
+            continue;
+        }
+        uint64_t count = strtoull(space + 1, NULL, 10);
+        const char *leaf = space;
+        while (leaf > line && leaf[-1] != ';') {
+            leaf--;
+        }
+        int64_t address = -1;
+        if (space - leaf > 2 && leaf[0] == '0' && leaf[1] == 'x') {
+            address = strtoll(leaf + 2, NULL, 16);
+        } else {
+            const char *plus = memchr(leaf, '+', (size_t)(space - leaf));
+            size_t n = (size_t)((plus ? plus : space) - leaf);
+            const LabelAddress *entry = n ? find_label_hashed(leaf, n, label_hash(leaf, n)) : NULL;
+            address = entry ? label_address(entry) : -1;
+        }
+        if (address >= 0 && count) {
+            w = grow_array(w, &cap, *num + 1, sizeof(ProfileWeight));
+            w[(*num)++] = (ProfileWeight){ address, count };
+        }
+    }
+    reader_close(&r);
+    qsort(w, *num, sizeof(ProfileWeight), compare_weight_addresses);
+    size_t unique = 0;
+    for (size_t i = 0; i < *num; i++) {
+        if (unique && w[unique - 1].address == w[i].address) {
+            w[unique - 1].count += w[i].count;
+        } else {
+            w[unique++] = w[i];
+        }
+    }
+    *num = unique;
+    return w;
+}
+
+static const ProfileWeight *find_weight(const ProfileWeight *w, size_t num, int64_t address) {
+    ProfileWeight key = { address, 0 };
+    return bsearch(&key, w, num, sizeof(ProfileWeight), compare_weight_addresses);
+}
+
+static int ends_chain(const IrInsn *in) {
+    return in->op == OP_BR || in->op == OP_BRR || in->op == OP_RETURN || in->op == OP_HALT;
+}
+
+// 0 if record i branches by an offset layout can't keep, see above
+static int chain_branch_movable(size_t i, const int *pcs, const LayoutChain *c) {
+    const IrInsn *in = &ir.insns[i];
+    if (in->op == IR_RAW) {
+        TokenLine t;
+        lex_line(&t, ir.lines[in->line].text, ir.lines[in->line].len, NULL);
+        return t.op != OP_BRR ||
+               (t.labelTok >= 0 && (t.tok[t.labelTok].kind == TOK_LABEL || resolve_label_ref(&t) >= 0));
+    }
+    if (in->op != OP_BRR || (in->mop & IR_LABEL)) {
+        return 1;
+    }
+    int64_t target = pcs[i] + in->imm;
+    return in->mop == MOP_BRR_L && target >= pcs[c->start] && target <= pcs[c->end];
+}
+
+static void profile_layout_ir(const char *path) {
+    size_t numWeights;
+    ProfileWeight *weights = read_profile_weights(path, &numWeights);
+    // called labels, weight 0 unless the profile has them
+    ProfileWeight *called = NULL;
+    size_t numCalled = 0, capCalled = 0;
+    for (size_t i = 0; i + 1 < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        if (in->op == OP_LD && (in->mop & IR_LABEL) && ir.refs[in->ref].id &&
+            ir.insns[i + 1].op == OP_CALL && ir.insns[i + 1].rd == in->rd) {
+            called = grow_array(called, &capCalled, numCalled + 1, sizeof(ProfileWeight));
+            called[numCalled++] = (ProfileWeight){ ir_label_address(in), 0 };
+        }
+    }
+    qsort(called, numCalled, sizeof(ProfileWeight), compare_weight_addresses);
+
+    int *pcs = malloc((ir.num + 1) * sizeof(int));
+    LayoutChain *chains = malloc((ir.num + 1) * sizeof(LayoutChain));
+    size_t *order = malloc((ir.num + 1) * sizeof(size_t));
+    if (!pcs || !chains || !order) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    int pc = 0x1000;
+    for (size_t i = 0; i < ir.num; i++) {
+        pcs[i] = pc;
+        pc += ir_size(&ir.insns[i]);
+    }
+    pcs[ir.num] = pc;
+
+    // chains with their weights; directives and .data are units that stay
+    Section section = NONE;
+    size_t numChains = 0, li = 0;
+    int matched = 0, movable = 1;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        const ProfileWeight *own = NULL;
+        int labelled = 0;
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            int address = label_address(ir.labels[li].entry);
+            const ProfileWeight *found = find_weight(weights, numWeights, address);
+            if (!found) {
+                found = find_weight(called, numCalled, address);
+            }
+            if (found && (!own || found->count > own->count)) {
+                own = found;
+            }
+            labelled = 1;
+        }
+        matched |= own && own->count;
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        }
+        if (in->op == IR_DIRECTIVE || section != CODE) {
+            chains[numChains++] = (LayoutChain){ i, i + 1, UINT64_MAX };
+            continue;
+        }
+        LayoutChain *last = numChains ? &chains[numChains - 1] : NULL;
+        if (!last || last->weight == UINT64_MAX || (labelled && ends_chain(&ir.insns[i - 1]))) {
+            // a function's later chains weigh what it ran
+            uint64_t inherited = last && last->weight != UINT64_MAX ? last->weight : 0;
+            chains[numChains++] = (LayoutChain){ i, i + 1, own ? own->count : inherited };
+        } else {
+            if (own && own->count > last->weight) {
+                last->weight = own->count;
+            }
+            last->end = i + 1;
+        }
+    }
+    for (size_t c = 0; c < numChains && movable; c++) {
+        if (chains[c].weight == UINT64_MAX) {
+            continue;
+        }
+        for (size_t i = chains[c].start; i < chains[c].end && movable; i++) {
+            if (!chain_branch_movable(i, pcs, &chains[c])) {
+                fprintf(diag(), "Warning: --profile-use keeps the layout, line %u branches by an offset\n",
+                        ir.lines[ir.insns[i].line].number);
+                movable = 0;
+            }
+        }
+    }
+    if (movable && !matched) {
+        fprintf(diag(), "Warning: --profile-use: no function of '%s' ran in this program, keeping the layout\n", path);
+        movable = 0;
+    }
+    if (movable) {
+        // sort the chains between fixed units, after the first one of each run
+        size_t c = 0;
+        while (c < numChains) {
+            if (chains[c].weight == UINT64_MAX) {
+                c++;
+                continue;
+            }
+            size_t end = c + 1;
+            while (end < numChains && chains[end].weight != UINT64_MAX) {
+                end++;
+            }
+            if (end - c > 2) {
+                qsort(&chains[c + 1], end - c - 1, sizeof(LayoutChain), compare_chain_weights);
+            }
+            c = end;
+        }
+        // records in the new order, labels moving with their records
+        IrInsn *insns = malloc((ir.num + 1) * sizeof(IrInsn));
+        size_t *labelCount = calloc(ir.num + 2, sizeof(size_t));
+        IrLabel *labels = malloc((ir.numLabels + 1) * sizeof(IrLabel));
+        if (!insns || !labelCount || !labels) {
+            fprintf(diag(), "Error: out of memory.\n");
+            fail();
+        }
+        size_t j = 0;
+        for (c = 0; c < numChains; c++) {
+            for (size_t i = chains[c].start; i < chains[c].end; i++) {
+                order[i] = j;
+                insns[j++] = ir.insns[i];
+            }
+        }
+        order[ir.num] = ir.num;
+        for (li = 0; li < ir.numLabels; li++) {
+            labelCount[order[ir.labels[li].insn] + 1]++;
+        }
+        for (size_t i = 1; i <= ir.num + 1; i++) {
+            labelCount[i] += labelCount[i - 1];
+        }
+        for (li = 0; li < ir.numLabels; li++) {
+            size_t insn = order[ir.labels[li].insn];
+            labels[labelCount[insn]++] = (IrLabel){ ir.labels[li].entry, insn };
+        }
+        memcpy(ir.insns, insns, ir.num * sizeof(IrInsn));
+        memcpy(ir.labels, labels, ir.numLabels * sizeof(IrLabel));
+        free(insns);
+        free(labelCount);
+        free(labels);
+    }
+    free(pcs);
+    free(chains);
+    free(order);
+    free(weights);
+    free(called);
+}
+
+/******************************************************************************
+ * Peephole optimizer (-O):
+ * Runs over the IR before layout and rewrites adjacent records that no label
+ * separates (something may branch to the second one):
+ *   push rX; pop rX          => mov (r31)(-8), rX
+ *   push rX; pop rY          => mov (r31)(-8), rX; mov rY, rX
+ *   pop rX;  push rX         => mov rX, (r31)(0)
+ *   clr rX;  ld rX, ...      => ld rX, ...  (the ld starts with that xor)
+ * and drops 'addi/subi/shftli/shftri rX, 0' and 'mov rX, rX'. r31 is the
+ * stack pointer, so push and pop of r31 are left alone. A push leaves its
+ * value in the slot below r31, where call puts the return address and
+ * return reads it, so its store stays. The zero chunks of an ld are already
+ * skipped by the short ld sequences. Records are compacted in place and
+ * every label moves with the record it names, so layout relaxation places
+ * them at their new addresses.
+ ******************************************************************************/
+// a record that has no effect
+static int is_noop_record(const IrInsn *in) {
+    switch (in->op) {
+    case OP_ADDI: case OP_SUBI: case OP_SHFTLI: case OP_SHFTRI:
+        return !(in->mop & IR_LABEL) && in->imm == 0;
+    case OP_MOV:
+        return in->mop == MOP_MOV_RR && in->rd == in->rs;
+    default:
+        return 0;
+    }
+}
+
+static void make_machine(IrInsn *in, int mop, int rd, int rs, int64_t imm) {
+    in->op = IR_MACHINE;
+    in->mop = (uint8_t)mop;
+    in->rd = (uint8_t)rd;
+    in->rs = (uint8_t)rs;
+    in->imm = imm;
+}
+
+// rewrite the pair a, b; returns the records left of it (2 = unchanged)
+static int peephole_pair(IrInsn *a, IrInsn *b) {
+    if (a->op == OP_PUSH && b->op == OP_POP && a->rd != 31 && b->rd != 31) {
+        int from = a->rd, to = b->rd;
+        make_machine(a, MOP_MOV_STORE, 31, from, -8);
+        if (from == to) {
+            return 1;
+        }
+        make_machine(b, MOP_MOV_RR, to, from, 0);
+        return 2;
+    }
+    if (a->op == OP_POP && b->op == OP_PUSH && a->rd == b->rd && a->rd != 31) {
+        make_machine(a, MOP_MOV_LOAD, a->rd, 31, 0);
+        return 1;
+    }
+    if (a->op == OP_CLR && b->op == OP_LD && a->rd == b->rd) {
+        *a = *b;
+        return 1;
+    }
+    return 2;
+}
+
+static void peephole_ir(void) {
+    size_t j = 0, li = 0;
+    for (size_t i = 0; i < ir.num; i++) {
+        // labels in front of record i now stand in front of slot j
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            ir.labels[li].insn = j;
+        }
+        ir.insns[j++] = ir.insns[i];
+        for (;;) {
+            size_t before = j;
+            size_t k = li;
+            while (k > 0 && ir.labels[k - 1].insn >= j) {
+                k--;
+            }
+            int labelled = k > 0 && ir.labels[k - 1].insn == j - 1;
+            if (is_noop_record(&ir.insns[j - 1])) {
+                j--;
+            } else if (j >= 2 && !labelled) {
+                j = j - 2 + (size_t)peephole_pair(&ir.insns[j - 2], &ir.insns[j - 1]);
+            }
+            if (j == before) {
+                break;
+            }
+            // labels of removed records name whatever comes next
+            for (k = li; k > 0 && ir.labels[k - 1].insn > j; k--) {
+                ir.labels[k - 1].insn = j;
+            }
+            if (j == 0) {
+                break;
+            }
+        }
+    }
+    for (; li < ir.numLabels; li++) {
+        ir.labels[li].insn = j;
+    }
+    ir.num = j;
+}
+
+/******************************************************************************
+ * Known register values (-O):
+ * Two scans over each basic block, a run of records that ends at a branch,
+ * call, return, halt or a record that is not an instruction:
+ *   forwards, the value each register holds, from clr, ld of a literal or
+ *     label, 'mov rX, rY' and 'xor/sub rX, rY, rY'. A label clears them
+ *     (something may branch there), so does the end of a block. A clr or ld
+ *     of the value its register already holds is dropped, and an ld of a
+ *     value another register holds becomes 'mov rX, rY';
+ *   backwards, the registers read before they are written again, all of
+ *     them where a block ends. A clr or ld of a register that is not is
+ *     dropped: 'clr rX; ...; ld rX, ...' keeps the ld alone.
+ * Runs after the peephole pass, so adjacent pairs are already gone, and
+ * before layout, which sizes what is left: labels of dropped records name
+ * the next record, as the peephole pass moves them.
+ ******************************************************************************/
+typedef struct {
+    uint8_t kind;   // KNOWN_*
+    int64_t value;  // the literal, or the label id
+} KnownValue;
+
+enum { KNOWN_NONE, KNOWN_IMM, KNOWN_LABEL };
+
+// registers a record reads and writes; 0 if it ends a block
+static int register_effects(const IrInsn *in, uint32_t *reads, uint32_t *writes) {
+    int mop = in->mop & ~IR_LABEL;
+    *reads = *writes = 0;
+    switch (in->op) {
+    case OP_LD: case OP_CLR:
+        *writes = 1u << in->rd;
+        return 1;
+    case OP_PUSH:
+        *reads = 1u << in->rd | 1u << 31;
+        *writes = 1u << 31;
+        return 1;
+    case OP_POP:
+        *reads = 1u << 31;
+        *writes = 1u << in->rd | 1u << 31;
+        return 1;
+    case OP_IN:
+        *reads = 1u << in->rs;
+        *writes = 1u << in->rd;
+        return 1;
+    case OP_OUT:
+        *reads = 1u << in->rd | 1u << in->rs;
+        return 1;
+    case IR_MACHINE:
+        break;
+    default:
+        if (in->op >= NUM_OPCODES || is_macro_op((Opcode)in->op)) {
+            return 0;
+        }
+        break;
+    }
+    if (mop >= MOP_BR && mop <= MOP_PRIV) {
+        return 0;
+    }
+    switch (machineOps[mop].format) {
+    case FMT_RRR:
+        if (!((mop == MOP_XOR || mop == MOP_SUB) && in->rs == in->rt)) {
+            *reads = 1u << in->rs | 1u << in->rt;
+        }
+        break;
+    case FMT_RR:
+    case FMT_LOAD:
+        *reads = 1u << in->rs;
+        break;
+    case FMT_RL:
+        *reads = 1u << in->rd;
+        break;
+    case FMT_STORE:
+        *reads = 1u << in->rd | 1u << in->rs;
+        return 1;
+    default:
+        return 0;
+    }
+    *writes = 1u << in->rd;
+    return 1;
+}
+
+// the registers live before a record, given those live after it: every
+// register is live where a block ends
+static uint32_t live_before(const IrInsn *in, uint32_t live) {
+    uint32_t reads, writes;
+    if (in->op == IR_NOP) {
+        return live;
+    }
+    if (!register_effects(in, &reads, &writes)) {
+        return UINT32_MAX;
+    }
+    return (live & ~writes) | reads;
+}
+
+// the value a clr or ld record loads, KNOWN_NONE if it is not one
+static KnownValue loaded_value(const IrInsn *in) {
+    KnownValue v = { KNOWN_NONE, 0 };
+    if (in->op == OP_CLR) {
+        v.kind = KNOWN_IMM;
+    } else if (in->op == OP_LD && !(in->mop & IR_LABEL)) {
+        v.kind = KNOWN_IMM;
+        v.value = in->imm;
+    } else if (in->op == OP_LD && !ir.refs[in->ref].expr && ir.refs[in->ref].id) {
+        v.kind = KNOWN_LABEL;
+        v.value = ir.refs[in->ref].id;
+    }
+    return v;
+}
+
+static void known_values_ir(void) {
+    KnownValue known[32];
+    size_t li = 0;
+    memset(known, 0, sizeof(known));
+    for (size_t i = 0; i < ir.num; i++) {
+        IrInsn *in = &ir.insns[i];
+        if (li < ir.numLabels && ir.labels[li].insn == i) {
+            memset(known, 0, sizeof(known));
+            while (li < ir.numLabels && ir.labels[li].insn == i) {
+                li++;
+            }
+        }
+        KnownValue v = loaded_value(in);
+        if (v.kind != KNOWN_NONE) {
+            if (known[in->rd].kind == v.kind && known[in->rd].value == v.value) {
+                in->op = IR_NOP;
+                continue;
+            }
+            // a 'ld rX, :label; br rX' pair becomes a brr, keep it whole
+            int pair = i + 1 < ir.num && ir.insns[i + 1].op == OP_BR && ir.insns[i + 1].rd == in->rd;
+            for (int r = 0; r < 32 && in->op == OP_LD && !pair; r++) {
+                if (known[r].kind == v.kind && known[r].value == v.value) {
+                    make_machine(in, MOP_MOV_RR, in->rd, r, 0);
+                }
+            }
+            known[in->rd] = v;
+            continue;
+        }
+        uint32_t reads, writes;
+        if (!register_effects(in, &reads, &writes)) {
+            memset(known, 0, sizeof(known));
+            continue;
+        }
+        int mop = in->mop & ~IR_LABEL;
+        KnownValue copied = { KNOWN_NONE, 0 };
+        if (in->op == IR_MACHINE || !is_macro_op((Opcode)in->op)) {
+            if (mop == MOP_MOV_RR) {
+                copied = known[in->rs];
+            } else if ((mop == MOP_XOR || mop == MOP_SUB) && in->rs == in->rt) {
+                copied.kind = KNOWN_IMM;
+            }
+        }
+        for (int r = 0; r < 32; r++) {
+            if (writes >> r & 1) {
+                known[r].kind = KNOWN_NONE;
+            }
+        }
+        if (copied.kind != KNOWN_NONE) {
+            known[in->rd] = copied;
+        }
+    }
+
+    uint32_t live = UINT32_MAX;
+    for (size_t i = ir.num; i-- > 0;) {
+        IrInsn *in = &ir.insns[i];
+        if ((in->op == OP_LD || in->op == OP_CLR) && !(live >> in->rd & 1)) {
+            in->op = IR_NOP;
+            continue;
+        }
+        live = live_before(in, live);
+    }
+
+    size_t j = 0;
+    li = 0;
+    for (size_t i = 0; i < ir.num; i++) {
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            ir.labels[li].insn = j;
+        }
+        if (ir.insns[i].op != IR_NOP) {
+            ir.insns[j++] = ir.insns[i];
+        }
+    }
+    for (; li < ir.numLabels; li++) {
+        ir.labels[li].insn = j;
+    }
+    ir.num = j;
+}
+
+/******************************************************************************
+ * Stack coalescing (-O):
+ * A run of N pushes becomes N stores at (r31)(-8) .. (r31)(-8N) and a single
+ * 'subi r31, 8N'; a run of N pops becomes N loads at (r31)(0) .. (r31)(8N-8)
+ * and a single 'addi r31, 8N'. Each push/pop keeps its record (IR_STACK, the
+ * offset in imm); the last one of the run also carries the adjustment, in
+ * 8-byte units in rs. Runs stop at a label, at r31 itself and at
+ * STACK_RUN_MAX, which keeps every offset within 12 bits. Layout sizes the
+ * records like any other, so labels after a run move accordingly.
+ ******************************************************************************/
+#define STACK_RUN_MAX 255
+
+static void coalesce_stack(void) {
+    size_t li = 0;
+    size_t i = 0;
+    while (i < ir.num) {
+        int op = ir.insns[i].op;
+        size_t n = 1;
+        if ((op == OP_PUSH || op == OP_POP) && ir.insns[i].rd != 31) {
+            while (i + n < ir.num && n < STACK_RUN_MAX && ir.insns[i + n].op == op &&
+                   ir.insns[i + n].rd != 31) {
+                // something may branch into the middle of the run
+                while (li < ir.numLabels && ir.labels[li].insn < i + n) {
+                    li++;
+                }
+                if (li < ir.numLabels && ir.labels[li].insn == i + n) {
+                    break;
+                }
+                n++;
+            }
+        }
+        if (n > 1) {
+            for (size_t k = 0; k < n; k++) {
+                IrInsn *in = &ir.insns[i + k];
+                in->mop = op == OP_PUSH ? MOP_MOV_STORE : MOP_MOV_LOAD;
+                in->op = IR_STACK;
+                in->imm = op == OP_PUSH ? -8 * (int64_t)(k + 1) : 8 * (int64_t)k;
+                in->rs = k == n - 1 ? (uint8_t)n : 0;
+            }
+        }
+        i += n;
+    }
+}
+
+/******************************************************************************
+ * Constant pool (--pool rN):
+ * Every ld of a literal that takes three or more instructions loads it with
+ * one 'mov rD, (rN)(off)' from a deduplicated table of 8-byte constants
+ * placed after the image instead. rN is reserved for the table: an ld at
+ * the entry point sets it to the table address + 2048, so the signed 12-bit
+ * offsets reach POOL_MAX constants; the program must not use rN itself.
+ * Layout places the table, so this runs after the other -O passes.
+ ******************************************************************************/
+// 1 if a code line of the program names register `reg`
+static int program_uses_register(int reg) {
+    Section section = NONE;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+            continue;
+        }
+        if (section != CODE) {
+            continue;
+        }
+        TokenLine t;
+        lex_line(&t, ir.lines[in->line].text, ir.lines[in->line].len, NULL);
+        for (int k = 0; k < t.numTokens; k++) {
+            if ((t.tok[k].kind == TOK_REG || t.tok[k].kind == TOK_MEM) && t.tok[k].reg == reg) {
+                fprintf(diag(), "Error: --pool register r%d is used at line %u\n",
+                        reg, ir.lines[in->line].number);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// index of `v` in the pool, adding it; -1 once the pool is full
+static int pool_index(uint64_t v, int32_t slots[2 * POOL_MAX]) {
+    uint32_t h = (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> 54);   // 10 bits
+    for (;; h = (h + 1) & (2 * POOL_MAX - 1)) {
+        if (slots[h] < 0) {
+            if (ir.numPool == POOL_MAX) {
+                return -1;
+            }
+            ir.pool = grow_counted(MEM_IR, ir.pool, &ir.capPool, ir.numPool + 1, sizeof(uint64_t));
+            ir.pool[ir.numPool] = v;
+            slots[h] = (int32_t)ir.numPool;
+            return (int)ir.numPool++;
+        }
+        if (ir.pool[slots[h]] == v) {
+            return slots[h];
+        }
+    }
+}
+
+static void build_pool(int reg) {
+    if (program_uses_register(reg)) {
+        fail();
+    }
+    // the image must start with code for the entry to set up rN
+    size_t first = ir.num;
+    Section section = NONE;
+    for (size_t i = 0; i < ir.num && first == ir.num; i++) {
+        if (ir.insns[i].op == IR_DIRECTIVE) {
+            section = (Section)ir.insns[i].rd;
+        } else if (section != NONE && ir_size(&ir.insns[i]) > 0) {
+            first = i;
+        }
+    }
+    if (first == ir.num || section != CODE) {
+        fprintf(diag(), "Warning: --pool needs the image to start with code, not using it\n");
+        return;
+    }
+    int32_t slots[2 * POOL_MAX];
+    memset(slots, -1, sizeof(slots));
+    for (size_t i = 0; i < ir.num; i++) {
+        IrInsn *in = &ir.insns[i];
+        if (in->op != OP_LD || (in->mop & IR_LABEL) || ld_size((uint64_t)in->imm) < 12) {
+            continue;
+        }
+        int index = pool_index((uint64_t)in->imm, slots);
+        if (index >= 0) {
+            in->op = IR_POOL;
+            in->rs = (uint8_t)reg;
+            in->word = (uint32_t)index;
+        }
+    }
+    if (!ir.numPool) {
+        return;
+    }
+    // insert 'ld rN, <table + 2048>' at the entry; layout fills in the value
+    ir.insns = grow_counted(MEM_IR, ir.insns, &ir.cap, ir.num + 1, sizeof(IrInsn));
+    memmove(&ir.insns[first + 1], &ir.insns[first], (ir.num - first) * sizeof(IrInsn));
+    ir.num++;
+    IrInsn *ld = &ir.insns[first];
+    memset(ld, 0, sizeof(*ld));
+    ld->op = OP_LD;
+    ld->rd = (uint8_t)reg;
+    ld->rs = 1;
+    // a line of its own, number 0, for the listing
+    static const char poolLine[] = "; --pool base register";
+    ir.lines = grow_counted(MEM_IR, ir.lines, &ir.capLines, ir.numLines + 1, sizeof(IrLine));
+    ir.lines[ir.numLines] = (IrLine){ poolLine, sizeof(poolLine) - 1, 0 };
+    ld->line = (uint32_t)ir.numLines++;
+    for (size_t i = 0; i < ir.numLabels; i++) {
+        if (ir.labels[i].insn >= first) {
+            ir.labels[i].insn++;
+        }
+    }
+    ir.poolInsn = first;
+}
+
+/******************************************************************************
+ * Loop alignment (--align-loops N, with -O):
+ * Puts an .align N record in front of every .code record a later branch
+ * goes back to: the label of a 'brr :label' or of an 'ld rX, :label' (not
+ * the target of a call, 'ld rX, :label; call rX') past the label, or of
+ * one ahead of it whose rX a br, brnz or brgt past the label branches to
+ * before rX is loaded again. The padding in front of a loop head runs
+ * once, on the way into the loop; layout sizes it like a written .align.
+ ******************************************************************************/
+static int compare_label_entries(const void *a, const void *b) {
+    const IrLabel *x = a, *y = b;
+    if (x->entry->id != y->entry->id) {
+        return x->entry->id < y->entry->id ? -1 : 1;
+    }
+    return x->insn < y->insn ? -1 : x->insn > y->insn;
+}
+
+// the record label `id` names (its last definition's), ir.num if none
+static size_t label_record(const IrLabel *byEntry, uint32_t id) {
+    size_t lo = 0, hi = ir.numLabels;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (byEntry[mid].entry->id <= id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo && byEntry[lo - 1].entry->id == id ? byEntry[lo - 1].insn : ir.num;
+}
+
+// 1 if 'ld rX, :label' (ahead of the label's record `target`) is for a
+// br, brnz or brgt to rX past the label, before rX is loaded again
+static int loads_loop_head(const IrInsn *ld, size_t target) {
+    Section section = CODE;
+    for (size_t k = target; k < ir.num && section == CODE; k++) {
+        const IrInsn *in = &ir.insns[k];
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        } else if ((in->op == OP_BR || in->op == OP_BRNZ || in->op == OP_BRGT) && in->rd == ld->rd) {
+            return 1;
+        } else if (in->op == OP_LD && in->rd == ld->rd) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void align_loops(int n) {
+    static const char alignLines[][12] = {
+        ".align 4", ".align 8", ".align 16", ".align 32", ".align 64", ".align 128",
+        ".align 256", ".align 512", ".align 1024", ".align 2048", ".align 4096",
+    };
+    IrLabel *byEntry = malloc((ir.numLabels + 1) * sizeof(IrLabel));
+    unsigned char *code = calloc(ir.num + 1, 1);
+    unsigned char *head = calloc(ir.num + 1, 1);
+    size_t *moved = malloc((ir.num + 1) * sizeof(size_t));
+    if (!byEntry || !code || !head || !moved) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    memcpy(byEntry, ir.labels, ir.numLabels * sizeof(IrLabel));
+    qsort(byEntry, ir.numLabels, sizeof(IrLabel), compare_label_entries);
+    Section section = NONE;
+    for (size_t i = 0; i < ir.num; i++) {
+        if (ir.insns[i].op == IR_DIRECTIVE) {
+            section = (Section)ir.insns[i].rd;
+        }
+        code[i] = ir.insns[i].op != IR_DIRECTIVE && section == CODE;
+    }
+    size_t heads = 0;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        if (!code[i] || !(in->mop & IR_LABEL) || !ir.refs[in->ref].id ||
+            (in->op != OP_BRR && in->op != OP_LD) ||
+            (in->op == OP_LD && i + 1 < ir.num && ir.insns[i + 1].op == OP_CALL &&
+             ir.insns[i + 1].rd == in->rd)) {
+            continue;
+        }
+        size_t target = label_record(byEntry, ir.refs[in->ref].id);
+        if (target == ir.num || !code[target] || head[target] || (target > i && !loads_loop_head(in, target))) {
+            continue;
+        }
+        head[target] = 1;
+        heads++;
+    }
+    if (heads) {
+        ir.lines = grow_counted(MEM_IR, ir.lines, &ir.capLines, ir.numLines + 1, sizeof(IrLine));
+        const char *text = alignLines[__builtin_ctz((unsigned)n) - 2];
+        ir.lines[ir.numLines] = (IrLine){ text, (uint32_t)strlen(text), 0 };
+        // back to front, each head moving past the padding in front of it
+        ir.insns = grow_counted(MEM_IR, ir.insns, &ir.cap, ir.num + heads, sizeof(IrInsn));
+        size_t j = ir.num + heads;
+        moved[ir.num] = j;
+        for (size_t i = ir.num; i-- > 0;) {
+            ir.insns[--j] = ir.insns[i];
+            moved[i] = j;
+            if (head[i]) {
+                IrInsn *pad = &ir.insns[--j];
+                memset(pad, 0, sizeof(*pad));
+                pad->op = IR_ALIGN;
+                pad->rs = (uint8_t)__builtin_ctz((unsigned)n);
+                pad->line = (uint32_t)ir.numLines;
+            }
+        }
+        ir.numLines++;
+        ir.num += heads;
+        for (size_t k = 0; k < ir.numLabels; k++) {
+            ir.labels[k].insn = moved[ir.labels[k].insn];
+        }
+    }
+    free(byEntry);
+    free(code);
+    free(head);
+    free(moved);
+}
+
+/******************************************************************************
+ * Layout relaxation (-O):
+ * An ld of a label is sized by the label's address, which depends on the
+ * size of everything before it. Sizes start at their minimum and only grow
+ * until no record changes, so the iteration always terminates; a sequence
+ * that later turns out shorter than its slot is padded when emitted. The
+ * padding of an .align follows its address, and may shrink, but rounding
+ * up never moves what comes after it back, so addresses still only grow.
+ *
+ * 'ld rX, :label' directly followed by 'br rX' starts out as a single brr to
+ * the label and falls back to the ld + br pair once the offset no longer
+ * fits in 12 bits (again only growing). The pair must not straddle a label
+ * definition, since something may branch to the br. The brr leaves rX as it
+ * was, so the pair is relaxed only if rX is dead at the label (liveness as in
+ * known_values_ir: written there before it is read, within the label's block).
+ *
+ * For an object (-c -O) the final addresses are the linker's, so there are
+ * no branch pairs and every ld of a label takes the fixed LD24_SIZE form,
+ * enough for any address in memory, with a RELOC_LD24 relocation.
+ ******************************************************************************/
+// record i starts an 'ld rX, :label; br rX' pair
+static int is_branch_pair(size_t i) {
+    if (i + 1 >= ir.num) {
+        return 0;
+    }
+    const IrInsn *ld = &ir.insns[i], *br = &ir.insns[i + 1];
+    return ld->op == OP_LD && (ld->mop & IR_LABEL) && br->op == OP_BR && br->rd == ld->rd;
+}
+
+// the registers live where each label is defined, by label id: all of them
+// for a label the IR does not define
+static uint32_t *label_liveness(void) {
+    uint32_t *byId = malloc((numLabelIds + 1) * sizeof(uint32_t));
+    uint32_t *before = malloc((ir.num + 1) * sizeof(uint32_t));
+    if (!byId || !before) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    before[ir.num] = UINT32_MAX;
+    for (size_t i = ir.num; i-- > 0;) {
+        before[i] = live_before(&ir.insns[i], before[i + 1]);
+    }
+    for (size_t id = 0; id < numLabelIds; id++) {
+        byId[id] = UINT32_MAX;
+    }
+    for (size_t li = 0; li < ir.numLabels; li++) {
+        byId[ir.labels[li].entry->id] = before[ir.labels[li].insn];
+    }
+    free(before);
+    return byId;
+}
+
+// the pair at record i may become a brr: its register is dead at the label
+static int branch_pair_relaxable(size_t i, const uint32_t *liveAtLabel) {
+    const IrRef *r = &ir.refs[ir.insns[i].ref];
+    return !r->expr && r->id < numLabelIds && !(liveAtLabel[r->id] >> ir.insns[i].rd & 1);
+}
+
+// undo a relaxed branch pair at record i
+static void unrelax_branch(size_t i) {
+    ir.insns[i].op = OP_LD;
+    ir.insns[i].rs = 1;     // grows with the rest of the ld records
+    ir.insns[i + 1].op = OP_BR;
+}
+
+// bytes needed by a record placed at pc, at the current label addresses
+static int required_size(const IrInsn *in, int pc) {
+    if (in->op == IR_ALIGN) {
+        return align_padding(pc, 1 << in->rs);
+    }
+    if (in->op == IR_BRANCH) {
+        int address = ir_label_address(in);
+        int offset = address - pc;
+        return address >= 0 && offset >= -2048 && offset <= 2047 ? 4 : -1;
+    }
+    if (in->op != OP_LD) {
+        return ir_size(in);
+    }
+    if (in->mop & IR_LABEL) {
+        int address = ir_label_address(in);
+        return address < 0 ? ir_size(in) : ld_size((uint64_t)address);
+    }
+    return ld_size((uint64_t)in->imm);
+}
+
+static void layout_ir(int object) {
+    size_t li = 0;
+    uint32_t *liveAtLabel = object ? NULL : label_liveness();
+    for (size_t i = 0; i < ir.num; i++) {
+        if (ir.insns[i].op == OP_LD) {
+            ir.insns[i].rs = object && (ir.insns[i].mop & IR_LABEL) ? LD24_SIZE / 4 : 1;
+        }
+        if (object) {
+            continue;   // where a label ends up is the linker's business
+        }
+        while (li < ir.numLabels && ir.labels[li].insn <= i) {
+            li++;
+        }
+        int labelBetween = li < ir.numLabels && ir.labels[li].insn == i + 1;
+        if (!labelBetween && is_branch_pair(i) && branch_pair_relaxable(i, liveAtLabel)) {
+            ir.insns[i].op = IR_BRANCH;
+            ir.insns[i + 1].op = IR_NOP;
+        }
+    }
+    free(liveAtLabel);
+    int *pcs = malloc((ir.num + 1) * sizeof(int));
+    if (!pcs) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    int changed;
+    do {
+        // place every record and label at the current sizes
+        int pc = 0x1000;
+        li = 0;
+        for (size_t i = 0; i < ir.num; i++) {
+            for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+                set_label_address(ir.labels[li].entry, pc);
+            }
+            pcs[i] = pc;
+            pc += ir_size(&ir.insns[i]);
+        }
+        for (; li < ir.numLabels; li++) {
+            set_label_address(ir.labels[li].entry, pc);
+        }
+        if (ir.numPool) {
+            ir.poolAddress = pc;
+            ir.insns[ir.poolInsn].imm = (int64_t)pc + 2048;
+        }
+        changed = 0;
+        for (size_t i = 0; i < ir.num; i++) {
+            IrInsn *in = &ir.insns[i];
+            int need = required_size(in, pcs[i]);
+            if (need < 0) {
+                // branch out of range => back to ld + br
+                unrelax_branch(i);
+                changed = 1;
+            } else if (in->op == IR_ALIGN && need != ir_size(in)) {
+                in->imm = need;
+                changed = 1;
+            } else if (need > ir_size(in)) {
+                in->rs = (uint8_t)(need / 4);
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    free_segments();
+    Section section = NONE;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        } else if (section != NONE) {
+            note_segment_bytes(section, pcs[i], ir_size(in));
+        }
+    }
+    if (ir.numPool) {
+        note_segment_bytes(DATA, ir.poolAddress, (int)(8 * ir.numPool));
+    }
+    free(pcs);
+}
+
+/******************************************************************************
+ * Relocatable objects (-c) and the link step (--link):
+ * An object is one source file assembled as a binary image at 0x1000, with
+ * a symbol table and a relocation for every label reference. All labels a
+ * file defines are exported; labels it references but doesn't define are
+ * imported. All fields are little-endian:
+ *   header   "TKR1", u32 segments, u32 symbols, u32 relocations, u64 payload bytes
+ *   segments u32 kind (0 = code, 1 = data), u32 reserved, u64 address, u64 size
+ *   symbols  u32 defined, u32 name length, u64 value, name bytes
+ *   relocs   u64 address, u32 kind (RELOC_*), u32 symbol index
+ *   payload  the segment bytes, back to back
+ * The linker places the objects one after another in command-line order,
+ * resolves every symbol (a label exported twice is an error) and patches
+ * the relocated fields into a single .tko image.
+ ******************************************************************************/
+#define OBJECT_MAGIC "TKR1"
+
+typedef struct {
+    const char *name;
+    int len;
+    int defined;
+    int64_t value;
+} ObjectSymbol;
+
+static int compare_symbols(const void *a, const void *b) {
+    const ObjectSymbol *x = a, *y = b;
+    int n = x->len < y->len ? x->len : y->len;
+    int c = memcmp(x->name, y->name, (size_t)n);
+    return c ? c : x->len - y->len;
+}
+
+typedef struct {
+    ObjectSymbol *items;
+    size_t num, cap;
+} SymbolList;
+
+static void add_object_symbol(const LabelAddress *entry, void *ctx) {
+    SymbolList *syms = ctx;
+    if (find_label(entry->label) != entry) {
+        return;     // an older, redefined entry
+    }
+    syms->items = grow_array(syms->items, &syms->cap, syms->num + 1, sizeof(ObjectSymbol));
+    syms->items[syms->num++] = (ObjectSymbol){ entry->label, (int)strlen(entry->label), 1, label_address(entry) };
+}
+
+static uint32_t symbol_index(const SymbolList *syms, const char *name) {
+    ObjectSymbol key = { name, (int)strlen(name), 0, 0 };
+    const ObjectSymbol *s = bsearch(&key, syms->items, syms->num, sizeof(ObjectSymbol), compare_symbols);
+    return (uint32_t)(s - syms->items);
+}
+
+static void assemble_object(const char *infile, const char *outfile, int optimize) {
+    pass1(infile);
+    for (size_t i = 0; i < ir.num; i++) {
+        if (ir.insns[i].op == IR_ALIGN) {
+            fprintf(diag(), "Error: .align at line %u, but the linker places an object\n",
+                    ir.lines[ir.insns[i].line].number);
+            fail();
+        }
+    }
+    if (optimize) {
+        peephole_ir();
+        known_values_ir();
+        coalesce_stack();
+        layout_ir(1);
+    }
+
+    RelocList relocs = { NULL, 0, 0 };
+    Output code;
+    open_memory_output(&code, 1);
+    code.optimize = optimize;
+    code.relocs = &relocs;
+    pass2_ir(&code);
+    free_ir();
+    if (code.errors) {
+        fprintf(diag(), "Error: %d line(s) could not be encoded, no object written.\n", code.errors);
+        fail();
+    }
+
+    // exports, then every referenced label nobody defines
+    SymbolList syms = { NULL, 0, 0 };
+    visit_labels(add_object_symbol, &syms);
+    for (size_t i = 0; i < relocs.num; i++) {
+        if (!find_label(relocs.items[i].name)) {
+            syms.items = grow_array(syms.items, &syms.cap, syms.num + 1, sizeof(ObjectSymbol));
+            syms.items[syms.num++] = (ObjectSymbol){ relocs.items[i].name, (int)strlen(relocs.items[i].name), 0, 0 };
+        }
+    }
+    qsort(syms.items, syms.num, sizeof(ObjectSymbol), compare_symbols);
+    size_t unique = 0;
+    for (size_t i = 0; i < syms.num; i++) {
+        if (!unique || compare_symbols(&syms.items[unique - 1], &syms.items[i])) {
+            syms.items[unique++] = syms.items[i];
+        }
+    }
+    syms.num = unique;
+
+    Output out;
+    if (!open_output(&out, outfile, 0, 0)) {
+        diag_errno("open output");
+        fail();
+    }
+    out_bytes(&out, OBJECT_MAGIC, 4);
+    put_le32(&out, (uint32_t)imageSegments.num);
+    put_le32(&out, (uint32_t)syms.num);
+    put_le32(&out, (uint32_t)relocs.num);
+    put_le64(&out, code.len);
+    for (size_t i = 0; i < imageSegments.num; i++) {
+        const ImageSegment *seg = &imageSegments.items[i];
+        put_le32(&out, seg->kind == CODE ? 0 : 1);
+        put_le32(&out, 0);
+        put_le64(&out, seg->address);
+        put_le64(&out, seg->size);
+    }
+    for (size_t i = 0; i < syms.num; i++) {
+        put_le32(&out, (uint32_t)syms.items[i].defined);
+        put_le32(&out, (uint32_t)syms.items[i].len);
+        put_le64(&out, (uint64_t)syms.items[i].value);
+        out_bytes(&out, syms.items[i].name, (size_t)syms.items[i].len);
+    }
+    for (size_t i = 0; i < relocs.num; i++) {
+        put_le64(&out, (uint64_t)relocs.items[i].address);
+        put_le32(&out, relocs.items[i].kind);
+        put_le32(&out, symbol_index(&syms, relocs.items[i].name));
+    }
+    out_bytes(&out, code.buf, code.len);
+    close_output(&out, outfile);
+    free(code.buf);
+    free(relocs.items);
+    free(syms.items);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+    return (uint64_t)get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+static void set_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+typedef struct {
+    const char *path;
+    LineReader file;
+    const unsigned char *segments, *relocs, *payload;
+    uint32_t numSegments, numRelocs;
+    uint64_t payloadSize;
+    ObjectSymbol *symbols;
+    uint32_t numSymbols;
+    int64_t delta;      // placed address - assembled address
+} LinkUnit;
+
+static int link_error(const LinkUnit *u, const char *why) {
+    fprintf(diag(), "Error: %s: %s\n", u->path, why);
+    return 0;
+}
+
+// map an object and index its tables
+static int read_object(LinkUnit *u) {
+    if (!reader_open(&u->file, u->path)) {
+        diag_errno(u->path);
+        return 0;
+    }
+    reader_slurp(&u->file);
+    const unsigned char *p = (const unsigned char *)u->file.data, *end = p + u->file.size;
+    if (u->file.size < 24 || memcmp(p, OBJECT_MAGIC, 4)) {
+        return link_error(u, "not a Tinker object");
+    }
+    u->numSegments = get_le32(p + 4);
+    u->numSymbols = get_le32(p + 8);
+    u->numRelocs = get_le32(p + 12);
+    u->payloadSize = get_le64(p + 16);
+    p += 24;
+    if ((uint64_t)(end - p) < (uint64_t)u->numSegments * 24) {
+        return link_error(u, "truncated object");
+    }
+    u->segments = p;
+    p += (size_t)u->numSegments * 24;
+    u->symbols = calloc(u->numSymbols + 1, sizeof(ObjectSymbol));
+    if (!u->symbols) {
+        return link_error(u, "out of memory");
+    }
+    for (uint32_t i = 0; i < u->numSymbols; i++) {
+        if (end - p < 16) {
+            return link_error(u, "truncated object");
+        }
+        ObjectSymbol *s = &u->symbols[i];
+        s->defined = (int)get_le32(p);
+        s->len = (int)get_le32(p + 4);
+        s->value = (int64_t)get_le64(p + 8);
+        p += 16;
+        if (s->len <= 0 || s->len > 49 || end - p < s->len) {
+            return link_error(u, "bad symbol name");
+        }
+        s->name = (const char *)p;
+        p += s->len;
+    }
+    if ((uint64_t)(end - p) < (uint64_t)u->numRelocs * 16 + u->payloadSize) {
+        return link_error(u, "truncated object");
+    }
+    u->relocs = p;
+    p += (size_t)u->numRelocs * 16;
+    u->payload = p;
+    return 1;
+}
+
+// final value of symbol `index` of unit u, -1 if nobody defines it
+static int64_t symbol_value(const LinkUnit *u, uint32_t index) {
+    const ObjectSymbol *s = &u->symbols[index];
+    if (s->defined) {
+        return s->value + u->delta;
+    }
+    char name[50];
+    memcpy(name, s->name, (size_t)s->len);
+    name[s->len] = '\0';
+    LabelAddress *entry = find_label(name);
+    return entry ? label_address(entry) : -1;
+}
+
+// apply the relocations of unit u to its copy of the payload
+static int relocate_unit(const LinkUnit *u, unsigned char *payload) {
+    for (uint32_t i = 0; i < u->numRelocs; i++) {
+        const unsigned char *r = u->relocs + (size_t)i * 16;
+        uint64_t address = get_le64(r);
+        uint32_t kind = get_le32(r + 8), sym = get_le32(r + 12);
+        uint64_t offset = address - 0x1000;
+        if (sym >= u->numSymbols || address < 0x1000 ||
+            offset + (kind == RELOC_LD ? 48 : kind == RELOC_LD24 ? LD24_SIZE : 4) > u->payloadSize) {
+            return link_error(u, "bad relocation");
+        }
+        int64_t value = symbol_value(u, sym);
+        const ObjectSymbol *s = &u->symbols[sym];
+        if (value < 0) {
+            fprintf(diag(), "Error: %s: undefined label '%.*s'\n", u->path, s->len, s->name);
+            return 0;
+        }
+        int64_t pc = (int64_t)address + u->delta;
+        unsigned char *field = payload + offset;
+        uint32_t word = get_le32(field);
+        if (kind == RELOC_PCREL12) {
+            value -= pc;
+            if (value < -2048 || value > 2047) {
+                fprintf(diag(), "Error: %s: brr to '%.*s' out of range\n", u->path, s->len, s->name);
+                return 0;
+            }
+            set_le32(field, (word & ~0xFFFu) | (uint32_t)(value & 0xFFF));
+        } else if (kind == RELOC_ABS12) {
+            if (value > 4095) {
+                fprintf(diag(), "Error: %s: '%.*s' does not fit a 12-bit literal\n", u->path, s->len, s->name);
+                return 0;
+            }
+            set_le32(field, (word & ~0xFFFu) | (uint32_t)value);
+        } else if (kind == RELOC_LD) {
+            Output seq;
+            open_memory_output(&seq, 1);
+            expandLd((int)(word >> 22 & 31), (uint64_t)value, &seq);
+            memcpy(field, seq.buf, seq.len);
+            free(seq.buf);
+        } else if (kind == RELOC_LD24) {
+            if (value >= 1 << 24) {
+                fprintf(diag(), "Error: %s: '%.*s' does not fit a 24-bit ld\n", u->path, s->len, s->name);
+                return 0;
+            }
+            Output seq;
+            open_memory_output(&seq, 1);
+            expandLd24((int)(word >> 22 & 31), (uint64_t)value, &seq);
+            memcpy(field, seq.buf, seq.len);
+            free(seq.buf);
+        } else {
+            return link_error(u, "unknown relocation kind");
+        }
+    }
+    return 1;
+}
+
+static void link_objects(const char *outfile, char **objects, int numObjects) {
+    LinkUnit *units = calloc((size_t)numObjects, sizeof(LinkUnit));
+    if (!units) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    // place the units and collect their exports
+    int64_t base = 0x1000;
+    uint64_t total = 0;
+    for (int k = 0; k < numObjects; k++) {
+        LinkUnit *u = &units[k];
+        u->path = objects[k];
+        if (!read_object(u)) {
+            fail();
+        }
+        u->delta = base - 0x1000;
+        for (uint32_t i = 0; i < u->numSymbols; i++) {
+            const ObjectSymbol *s = &u->symbols[i];
+            if (!s->defined) {
+                continue;
+            }
+            char name[50];
+            memcpy(name, s->name, (size_t)s->len);
+            name[s->len] = '\0';
+            if (find_label(name)) {
+                fprintf(diag(), "Error: %s: label '%s' is defined in more than one object\n", u->path, name);
+                fail();
+            }
+            add_label(name, (int)(s->value + u->delta));
+        }
+        for (uint32_t i = 0; i < u->numSegments; i++) {
+            const unsigned char *seg = u->segments + (size_t)i * 24;
+            note_segment_bytes(get_le32(seg) ? DATA : CODE, (int)(get_le64(seg + 8) + (uint64_t)u->delta),
+                               (int)get_le64(seg + 16));
+        }
+        base += (int64_t)u->payloadSize;
+        total += u->payloadSize;
+    }
+
+    unsigned char *image = malloc(total + 1);
+    if (!image) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    uint64_t at = 0;
+    int ok = 1;
+    for (int k = 0; k < numObjects; k++) {
+        memcpy(image + at, units[k].payload, units[k].payloadSize);
+        ok &= relocate_unit(&units[k], image + at);
+        at += units[k].payloadSize;
+    }
+    if (!ok) {
+        fail();
+    }
+    Output out;
+    if (!open_output(&out, outfile, 1, 0)) {
+        diag_errno("open output");
+        fail();
+    }
+    out_bytes(&out, image, total);
+    close_output(&out, outfile);
+    free(image);
+    for (int k = 0; k < numObjects; k++) {
+        free(units[k].symbols);
+        reader_close(&units[k].file);
+    }
+    free(units);
+}
+
+/******************************************************************************
+ * Streaming assembly (input "-"):
+ * Input that can only be read once is assembled as it arrives. A line is
+ * emitted as soon as everything before it has been and its label reference
+ * (if any) is defined; once a line waits on a forward reference, the lines
+ * after it queue up behind it so the output keeps source order. Memory is
+ * bounded by that queue, not by the program. A reference resolves to the
+ * definition known when its line is emitted, and a reference still pending
+ * at EOF is reported as an undefined label. A pass1 error stops assembly
+ * with the output produced so far already written.
+ ******************************************************************************/
+typedef struct {
+    char *text;         // copy of the trimmed line
+    size_t len;
+    int pc;
+    int size;
+} QueuedLine;
+
+typedef struct {
+    QueuedLine *items;
+    size_t head, num, cap;
+} LineQueue;
+
+static void queue_push(LineQueue *q, const char *line, size_t len, int pc, int size) {
+    if (q->head == q->num) {
+        q->head = q->num = 0;
+    } else if (q->head > 1024 && q->head > q->num / 2) {
+        memmove(q->items, q->items + q->head, (q->num - q->head) * sizeof(QueuedLine));
+        q->num -= q->head;
+        q->head = 0;
+    }
+    q->items = grow_array(q->items, &q->cap, q->num + 1, sizeof(QueuedLine));
+    QueuedLine *l = &q->items[q->num++];
+    l->text = malloc(len + 1);
+    if (!l->text) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    memcpy(l->text, line, len);
+    l->len = len;
+    l->pc = pc;
+    l->size = size;
+}
+
+// emit one line in text form, `atEof` emits it even if its label is undefined
+static int stream_emit(Output *out, const char *line, size_t len, int pc, int size, int atEof) {
+    if (is_directive(line, len, ".code") || is_directive(line, len, ".data")) {
+        out_bytes(out, line, len);
+        out_char(out, '\n');
+        return 1;
+    }
+    if (line[0] == '.' && size > 0) {
+        if (align_directive(line, len) > 0) {
+            emit_padding(size, out);
+        } else {
+            emit_bulk_data(line, len, size, out);
+        }
+        return 1;
+    }
+    TokenLine t;
+    lex_line(&t, line, len, NULL);
+    int labelAddress = resolve_label_ref(&t);
+    if (t.labelTok >= 0 && labelAddress < 0 && !atEof) {
+        return 0;
+    }
+    emit_line(&t, labelAddress, pc, size, out);
+    return 1;
+}
+
+// emit queued lines from the front until one is still waiting
+static void drain_queue(LineQueue *q, Output *out, int atEof) {
+    while (q->head < q->num) {
+        QueuedLine *l = &q->items[q->head];
+        if (!stream_emit(out, l->text, l->len, l->pc, l->size, atEof)) {
+            return;
+        }
+        free(l->text);
+        q->head++;
+    }
+}
+
+static void stream_assemble(const char *infile, const char *outfile) {
+    LineReader fin;
+    if (!reader_open(&fin, infile)) {
+        diag_errno("open input");
+        fail();
+    }
+    Output out;
+    if (!open_output(&out, outfile, 0, 0)) {
+        diag_errno("open output");
+        fail();
+    }
+    LineQueue queue = { NULL, 0, 0, 0 };
+    Section section = NONE;
+    int programCounter = 0x1000;
+    const char *line;
+    size_t len;
+    TokenLine t;
+    while (next_line(&fin, &line, &len)) {
+        if (!len || line[0] == ';') {
+            continue;
+        }
+        if (line[0] == ':') {
+            char labelName[50];
+            if (copy_label_name(line + 1, line + len, labelName)) {
+                add_label(labelName, programCounter);
+                drain_queue(&queue, &out, 0);
+            }
+            continue;
+        }
+        int pc = programCounter, size = 0, align;
+        if (line[0] == '.' && (macro_directive(line, len) || equ_directive(line, len) ||
+                               include_directive(line, len))) {
+            out_flush(&out);
+            fprintf(diag(), "pass1 error: %s needs the whole input (-s) => %.*s\n",
+                    equ_directive(line, len) ? ".equ" : include_directive(line, len) ? ".include" : ".macro",
+                    (int)len, line);
+            fail();
+        }
+        if (line[0] == '.' && (align = align_directive(line, len)) && (align < 0 || section != NONE)) {
+            if (align < 0 || section == DATA) {
+                out_flush(&out);
+                fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+                fail();
+            }
+            size = align_padding(programCounter, align);
+            if (!size) {
+                continue;
+            }
+            programCounter += size;
+        } else if (line[0] == '.' && bulk_data_size(line, len, &size) && (size < 0 || section != NONE)) {
+            if (size < 0 || section == CODE) {
+                out_flush(&out);
+                fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+                fail();
+            }
+            if (!size) {
+                continue;   // nothing to emit
+            }
+            programCounter += size;
+        } else if (line[0] == '.') {
+            size = 0;
+            section = directive_section(line, len, section);
+        } else {
+            lex_line(&t, line, len, &fin.masks);
+            if (section == CODE) {
+                if (!is_valid_instruction_pass1(&t)) {
+                    out_flush(&out);
+                    fprintf(diag(), "pass1 error: invalid line => %.*s\n", (int)len, line);
+                    fail();
+                }
+                size = instruction_size(t.op);
+            } else if (section == DATA) {
+                size = 8;
+            }
+            programCounter += size;
+        }
+        if (queue.head < queue.num || !stream_emit(&out, line, len, pc, size, 0)) {
+            queue_push(&queue, line, len, pc, size);
+        }
+    }
+    drain_queue(&queue, &out, 1);
+    free(queue.items);
+    reader_close(&fin);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Listing (-l):
+ * Instead of the output, writes every line pass1 kept with its line number
+ * and address, each word it encodes to with the instruction disassembled
+ * and the labels defined before it, then a symbol map sorted by address
+ * (here with -O, where the listing is of the optimized layout):
+ *         00001000  :main
+ *      3  00001000  ld r1, 7
+ *         00001000  10421000  xor r1, r1, r1
+ *         00001004  c8400007  addi r1, 7
+ *      4  00001008  brr :main
+ *         00001008  50000ff8  brr -8
+ * ; symbols
+ *         00001000  main
+ * The instruction follows a tab, as in the text output. Blank lines, comments and label lines have no line of their own; a label
+ * is listed where it points.
+ ******************************************************************************/
+/* The decoder of -l, --emit-c and -d: per machine opcode, the line up to
+ * its operands (tab, name and, if it has operands, a space) as 8 bytes to
+ * copy whole, its length and its operand layout. An opcode beyond the
+ * table reads as `.word` and the word in hex. */
+#define DISASM_OP_ROW(id, name, format) \
+    [MOP_##id] = { "\t" name " ", sizeof(name) + (format != FMT_NONE), format },
+
+static const struct {
+    char text[9];
+    uint8_t len;
+    uint8_t format;     // InsnFormat
+} disasmOps[NUM_MOPS] = { TINKER_MACHINE_OPS(DISASM_OP_ROW) };
+
+// the text of machine word w at p, as emit_insn prints it; returns the end
+// (at most OUT_MAX_ITEM bytes on)
+static char *disasm_word(char *p, uint32_t w) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned mop = w >> 27, rd = w >> 22 & 31, rs = w >> 17 & 31, rt = w >> 12 & 31;
+    int64_t L = w & 0xFFF;
+    if (mop >= NUM_MOPS) {
+        p = format_str(p, "\t.word 0x");
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            *p++ = hex[w >> shift & 15];
+        }
+        *p++ = '\n';
+        return p;
+    }
+    InsnFormat format = (InsnFormat)disasmOps[mop].format;
+    if (mop == MOP_BRR_L || format == FMT_LOAD || format == FMT_STORE) {
+        L = L & 0x800 ? L - 0x1000 : L;     // signed 12-bit
+    }
+    memcpy(p, disasmOps[mop].text, 8);
+    p += disasmOps[mop].len;
+    switch (format) {
+    case FMT_RRR:
+    case FMT_PRIV:
+        p = format_reg(p, (int)rd);
+        p = format_str(p, ", ");
+        p = format_reg(p, (int)rs);
+        p = format_str(p, ", ");
+        p = format_reg(p, (int)rt);
+        if (mop == MOP_PRIV) {
+            p = format_str(p, ", ");
+            p = format_int(p, L);
+        }
+        break;
+    case FMT_RR:
+        p = format_reg(p, (int)rd);
+        p = format_str(p, ", ");
+        p = format_reg(p, (int)rs);
+        break;
+    case FMT_RL:
+        p = format_reg(p, (int)rd);
+        p = format_str(p, ", ");
+        p = format_int(p, L);
+        break;
+    case FMT_R:
+        p = format_reg(p, (int)rd);
+        break;
+    case FMT_L:
+        p = format_int(p, L);
+        break;
+    case FMT_NONE:
+        break;
+    case FMT_LOAD:
+        p = format_reg(p, (int)rd);
+        p = format_str(p, ", (");
+        p = format_reg(p, (int)rs);
+        p = format_str(p, ")(");
+        p = format_int(p, L);
+        *p++ = ')';
+        break;
+    case FMT_STORE:
+        *p++ = '(';
+        p = format_reg(p, (int)rd);
+        p = format_str(p, ")(");
+        p = format_int(p, L);
+        p = format_str(p, "), ");
+        p = format_reg(p, (int)rs);
+        break;
+    }
+    *p++ = '\n';
+    return p;
+}
+
+// the text form of machine word w
+static void disassemble(Output *out, uint32_t w) {
+    char *p = out_reserve(out, OUT_MAX_ITEM);
+    out->len += (size_t)(disasm_word(p, w) - p);
+}
+
+static void list_bytes(Output *out, const unsigned char *p, size_t n, int pc, Section section) {
+    char buf[64];
+    size_t step = section == DATA ? 8 : 4;
+    for (size_t k = 0; k + step <= n; k += step, pc += (int)step) {
+        if (step == 8) {
+            out_bytes(out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  %016" PRIx64 "\n",
+                                                   pc, get_le64(p + k)));
+        } else {
+            out_bytes(out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  %08x",
+                                                   pc, get_le32(p + k)));
+            disassemble(out, get_le32(p + k));
+        }
+    }
+}
+
+static int compare_symbol_values(const void *a, const void *b) {
+    const ObjectSymbol *x = a, *y = b;
+    return x->value != y->value ? (x->value < y->value ? -1 : 1) : compare_symbols(a, b);
+}
+
+static void write_listing(const char *outfile, int optimize) {
+    Output out, word;
+    if (!open_output(&out, outfile, 0, 0)) {
+        diag_errno("listing: open output");
+        fail();
+    }
+    char buf[64];
+    Section section = NONE;
+    int pc = 0x1000;
+    size_t li = 0;
+    for (size_t i = 0; i <= ir.num; i++) {
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            const LabelAddress *entry = ir.labels[li].entry;
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  :", label_address(entry)));
+            out_bytes(&out, entry->label, strlen(entry->label));
+            out_char(&out, '\n');
+        }
+        if (i == ir.num) {
+            break;
+        }
+        const IrInsn *in = &ir.insns[i];
+        const IrLine *l = &ir.lines[in->line];
+        int size = ir_size(in);
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        }
+        if (l->number) {
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "%6u  %08x  ", l->number, pc));
+        } else {
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  ", pc));
+        }
+        out_bytes(&out, l->text, l->len);
+        out_char(&out, '\n');
+        open_memory_output(&word, 1);
+        word.optimize = optimize;
+        emit_ir(in, section, pc, size, &word);
+        list_bytes(&out, (const unsigned char *)word.buf, word.len, pc, section);
+        free(word.buf);
+        pc += size;
+    }
+    for (size_t i = 0; i < ir.numPool; i++, pc += 8) {
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  %016" PRIx64 "\n",
+                                               pc, ir.pool[i]));
+    }
+
+    SymbolList syms = { NULL, 0, 0 };
+    visit_labels(add_object_symbol, &syms);
+    qsort(syms.items, syms.num, sizeof(ObjectSymbol), compare_symbol_values);
+    out_bytes(&out, "; symbols\n", 10);
+    for (size_t i = 0; i < syms.num; i++) {
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "        %08x  ", (int)syms.items[i].value));
+        out_bytes(&out, syms.items[i].name, (size_t)syms.items[i].len);
+        out_char(&out, '\n');
+    }
+    free(syms.items);
+    close_output(&out, outfile);
+}
+
+/******************************************************************************
+ * Symbol tables (--symbols FILE, .tks), all fields little-endian:
+ *   header   "TKS1", u32 symbols, u32 lines, u32 string bytes
+ *   symbols  u64 address, u32 name offset, u32 name length, by address
+ *   lines    u32 address, u32 source line, by address
+ *   strings  the names, back to back
+ * Written next to the image from the label table and the IR: a symbol per
+ * label, a line entry wherever the source line changes. -r --symbols maps
+ * one and names the pcs of --profile and the data of --cache-model from it
+ * by binary search, so a .tko image is reported by label, as its source
+ * would be.
+ ******************************************************************************/
+typedef struct {
+    LineReader file;
+    uint32_t numSymbols, numLines;
+    const unsigned char *symbols, *lines, *strings;
+} SymbolTable;
+
+static void write_symbols(const char *path) {
+    SymbolList syms = { NULL, 0, 0 };
+    visit_labels(add_object_symbol, &syms);
+    qsort(syms.items, syms.num, sizeof(ObjectSymbol), compare_symbol_values);
+    Output lines;
+    open_memory_output(&lines, 1);
+    Section section = NONE;
+    int pc = 0x1000;
+    uint32_t numLines = 0, last = 0;
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        uint32_t number = ir.lines[in->line].number;
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        } else if (section != NONE && ir_size(in) && number && number != last) {
+            put_le32(&lines, (uint32_t)pc);
+            put_le32(&lines, number);
+            numLines++;
+            last = number;
+        }
+        pc += ir_size(in);
+    }
+
+    Output out;
+    if (!open_output(&out, path, 0, 0)) {
+        diag_errno("symbols: open output");
+        fail();
+    }
+    uint32_t offset = 0;
+    for (size_t i = 0; i < syms.num; i++) {
+        offset += (uint32_t)syms.items[i].len;
+    }
+    out_bytes(&out, "TKS1", 4);
+    put_le32(&out, (uint32_t)syms.num);
+    put_le32(&out, numLines);
+    put_le32(&out, offset);
+    offset = 0;
+    for (size_t i = 0; i < syms.num; i++) {
+        put_le64(&out, (uint64_t)syms.items[i].value);
+        put_le32(&out, offset);
+        put_le32(&out, (uint32_t)syms.items[i].len);
+        offset += (uint32_t)syms.items[i].len;
+    }
+    out_bytes(&out, lines.buf, lines.len);
+    for (size_t i = 0; i < syms.num; i++) {
+        out_bytes(&out, syms.items[i].name, (size_t)syms.items[i].len);
+    }
+    close_output(&out, path);
+    free(lines.buf);
+    free(syms.items);
+}
+
+// map the table at `path`; exits if it isn't one
+static void open_symbol_table(SymbolTable *t, const char *path) {
+    if (!reader_open(&t->file, path)) {
+        perror("open symbols");
+        exit(1);
+    }
+    reader_slurp(&t->file);
+    const unsigned char *p = (const unsigned char *)t->file.data;
+    size_t size = t->file.size;
+    if (size < 16 || memcmp(p, "TKS1", 4)) {
+        fprintf(stderr, "Error: '%s' is not a symbol table\n", path);
+        exit(1);
+    }
+    t->numSymbols = get_le32(p + 4);
+    t->numLines = get_le32(p + 8);
+    uint64_t need = 16 + 16 * (uint64_t)t->numSymbols + 8 * (uint64_t)t->numLines + get_le32(p + 12);
+    if (need != size) {
+        fprintf(stderr, "Error: '%s' is a damaged symbol table\n", path);
+        exit(1);
+    }
+    t->symbols = p + 16;
+    t->lines = t->symbols + 16 * (size_t)t->numSymbols;
+    t->strings = t->lines + 8 * (size_t)t->numLines;
+    for (uint32_t i = 0; i < t->numSymbols; i++) {
+        const unsigned char *s = t->symbols + 16 * (size_t)i;
+        if ((uint64_t)get_le32(s + 8) + get_le32(s + 12) > get_le32(p + 12)) {
+            fprintf(stderr, "Error: '%s' is a damaged symbol table\n", path);
+            exit(1);
+        }
+    }
+}
+
+// the program's labels by address: the table's if there is one, else the label table's
+static void program_symbols(SymbolList *syms, const SymbolTable *t) {
+    syms->items = NULL;
+    syms->num = syms->cap = 0;
+    if (!t) {
+        visit_labels(add_object_symbol, syms);
+        qsort(syms->items, syms->num, sizeof(ObjectSymbol), compare_symbol_values);
+        return;
+    }
+    syms->items = grow_array(NULL, &syms->cap, t->numSymbols ? t->numSymbols : 1, sizeof(ObjectSymbol));
+    for (uint32_t i = 0; i < t->numSymbols; i++) {
+        const unsigned char *s = t->symbols + 16 * (size_t)i;
+        syms->items[i] = (ObjectSymbol){ (const char *)t->strings + get_le32(s + 8), (int)get_le32(s + 12), 1,
+                                         (int64_t)get_le64(s) };
+    }
+    syms->num = t->numSymbols;
+}
+
+// the source line of the code or data at `address`, 0 if the table doesn't know
+static uint32_t source_line(const SymbolTable *t, uint64_t address) {
+    size_t lo = 0, hi = t->numLines;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (get_le32(t->lines + 8 * mid) <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? get_le32(t->lines + 8 * (lo - 1) + 4) : 0;
+}
+
+/******************************************************************************
+ * Instruction scheduling (--schedule SPEC, with -O):
+ * Runs after layout, when every ld has its final length and every label
+ * its address. The records between two labels that only compute, move,
+ * load and store (ld, push, pop, clr and the plain instructions but the
+ * branches) are expanded into machine instructions, and each run of up to
+ * SCHED_WINDOW of them is list-scheduled for a single-issue in-order core:
+ * every cycle issues the ready instruction with the longest latency path
+ * below it, the earlier one on a tie, so independent expansions (two lds
+ * into different registers, say) interleave instead of waiting on each
+ * other. An instruction depends on the ones whose registers it reads
+ * (their latency), writes (1) or overwrites before they read (0), and a
+ * load or store on the stores before it, a store on the loads before it
+ * too; 'xor/sub rX, rY, rY' reads nothing. A run is rewritten as
+ * IR_MACHINE records only if that saves stall cycles, and keeps its size,
+ * so nothing moves. SPEC is 'default' or class=cycles pairs replacing some
+ * of SCHEDULE_DEFAULT; the stalls before and after go to --stats.
+ ******************************************************************************/
+#define SCHED_WINDOW 256
+#define SCHEDULE_DEFAULT "alu=1,mul=3,div=12,float=4,fdiv=12,load=3,store=1"
+
+typedef enum { LAT_ALU, LAT_MUL, LAT_DIV, LAT_FLOAT, LAT_FDIV, LAT_LOAD, LAT_STORE, NUM_LATENCIES } LatencyClass;
+
+static const char *const latencyNames[NUM_LATENCIES] = {
+    "alu", "mul", "div", "float", "fdiv", "load", "store"
+};
+
+typedef struct {
+    int cycles[NUM_LATENCIES];
+} ScheduleModel;
+
+// the class=cycles pairs of `list` into `model`; 0 if one is invalid
+static int parse_latencies(const char *list, ScheduleModel *model) {
+    const char *s = list;
+    while (*s) {
+        int k = 0;
+        size_t n = 0;
+        for (; k < NUM_LATENCIES; k++) {
+            n = strlen(latencyNames[k]);
+            if (!strncmp(s, latencyNames[k], n) && s[n] == '=') {
+                break;
+            }
+        }
+        if (k == NUM_LATENCIES || !isdigit((unsigned char)s[n + 1])) {
+            return 0;
+        }
+        char *end;
+        long cycles = strtol(s + n + 1, &end, 10);
+        if (cycles < 1 || cycles > 255 || (*end && *end != ',')) {
+            return 0;
+        }
+        model->cycles[k] = (int)cycles;
+        s = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+static int parse_schedule_spec(const char *spec, ScheduleModel *model) {
+    parse_latencies(SCHEDULE_DEFAULT, model);
+    if (!strcmp(spec, "default") || (*spec && parse_latencies(spec, model))) {
+        return 1;
+    }
+    fprintf(diag(), "Error: invalid --schedule '%s' (e.g. %s)\n", spec, SCHEDULE_DEFAULT);
+    return 0;
+}
+
+static LatencyClass latency_class(int mop) {
+    switch (mop) {
+    case MOP_MUL:
+        return LAT_MUL;
+    case MOP_DIV:
+        return LAT_DIV;
+    case MOP_ADDF: case MOP_SUBF: case MOP_MULF:
+        return LAT_FLOAT;
+    case MOP_DIVF:
+        return LAT_FDIV;
+    case MOP_MOV_LOAD:
+        return LAT_LOAD;
+    case MOP_MOV_STORE:
+        return LAT_STORE;
+    default:
+        return LAT_ALU;
+    }
+}
+
+typedef struct {
+    IrInsn insn;        // the instruction as an IR_MACHINE record
+    int latency;
+    int reads[2], numReads, write;  // registers, write -1 if none
+    int height;         // cycles from its issue to the end of the run's longest path below it
+    int preds;          // not issued yet
+    int ready;          // cycle its operands are ready in
+    int issued;
+} SchedNode;
+
+typedef struct {
+    const ScheduleModel *model;
+    SchedNode nodes[SCHED_WINDOW];
+    int num;
+    signed char dep[SCHED_WINDOW][SCHED_WINDOW];  // [i][j], j > i: j waits this long after i, -1 if not
+    int order[SCHED_WINDOW];
+    size_t first, end;  // records the run replaces
+    int macros[NUM_MACRO_KINDS];
+} SchedRun;
+
+// `w` as an IR_MACHINE record of the run; 0 if a run can't hold it
+static int sched_node(SchedNode *n, uint32_t w, uint32_t line, const ScheduleModel *model) {
+    int mop = (int)(w >> 27);
+    if (mop >= NUM_MOPS || (mop >= MOP_BR && mop <= MOP_PRIV)) {
+        return 0;
+    }
+    IrInsn *in = &n->insn;
+    memset(in, 0, sizeof(*in));
+    in->op = IR_MACHINE;
+    in->mop = (uint8_t)mop;
+    in->rd = (uint8_t)(w >> 22 & 31);
+    in->rs = (uint8_t)(w >> 17 & 31);
+    in->line = line;
+    n->numReads = 0;
+    n->write = in->rd;
+    switch (machineOps[mop].format) {
+    case FMT_RRR:
+        in->rt = (uint8_t)(w >> 12 & 31);
+        if ((w & 0xFFF) != 0) {
+            return 0;
+        }
+        if (!((mop == MOP_XOR || mop == MOP_SUB) && in->rs == in->rt)) {
+            n->reads[n->numReads++] = in->rs;
+            n->reads[n->numReads++] = in->rt;
+        }
+        break;
+    case FMT_RR:
+    case FMT_LOAD:
+        n->reads[n->numReads++] = in->rs;
+        break;
+    case FMT_RL:
+        n->reads[n->numReads++] = in->rd;
+        break;
+    case FMT_STORE:
+        n->reads[n->numReads++] = in->rd;
+        n->reads[n->numReads++] = in->rs;
+        n->write = -1;
+        break;
+    default:
+        return 0;
+    }
+    if (machineOps[mop].format != FMT_RRR) {
+        int64_t L = w & 0xFFF;
+        if (machineOps[mop].format == FMT_LOAD || machineOps[mop].format == FMT_STORE) {
+            L = L & 0x800 ? L - 0x1000 : L;
+        }
+        if (w >> 12 & 31) {
+            return 0;
+        }
+        in->imm = L;
+    }
+    n->latency = model->cycles[latency_class(mop)];
+    return 1;
+}
+
+// add record i at `pc` to the run; 0 (leaving the run as it was) if it can't be
+static int sched_add(SchedRun *r, size_t i, int pc) {
+    const IrInsn *in = &ir.insns[i];
+    int size = ir_size(in);
+    switch (in->op) {
+    case IR_DIRECTIVE: case IR_DATA: case IR_RAW: case IR_NOP: case IR_BRANCH: case IR_ALIGN:
+    case OP_HALT: case OP_IN: case OP_OUT:
+        return 0;
+    default:
+        break;
+    }
+    if (size == 0 || r->num + size / 4 > SCHED_WINDOW || (ir.numPool && i == ir.poolInsn) ||
+        ((in->mop & IR_LABEL) && ir_label_address(in) < 0)) {
+        return 0;
+    }
+    Output words;
+    open_memory_output(&words, 1);
+    words.optimize = 1;
+    emit_ir(in, CODE, pc, size, &words);
+    if (is_macro_op((Opcode)in->op)) {
+        stat_add(&stats.macros[in->op - OP_HALT], UINT64_MAX);  // a trial, not pass2's expansion
+    }
+    int ok = words.len == (size_t)size && !words.errors;
+    for (int k = 0; ok && k < size / 4; k++) {
+        ok = sched_node(&r->nodes[r->num + k], get_le32((const unsigned char *)words.buf + 4 * k),
+                        in->line, r->model);
+    }
+    free(words.buf);
+    if (!ok) {
+        return 0;
+    }
+    if (r->num == 0) {
+        r->first = i;
+    }
+    r->num += size / 4;
+    r->end = i + 1;
+    if (is_macro_op((Opcode)in->op)) {
+        r->macros[in->op - OP_HALT]++;
+    }
+    return 1;
+}
+
+static void sched_dependences(SchedRun *r) {
+    for (int j = 0; j < r->num; j++) {
+        const SchedNode *b = &r->nodes[j];
+        int bLoad = b->insn.mop == MOP_MOV_LOAD, bStore = b->insn.mop == MOP_MOV_STORE;
+        for (int i = 0; i < j; i++) {
+            const SchedNode *a = &r->nodes[i];
+            int aLoad = a->insn.mop == MOP_MOV_LOAD, aStore = a->insn.mop == MOP_MOV_STORE;
+            int d = -1;
+            for (int k = 0; k < b->numReads; k++) {
+                if (b->reads[k] == a->write) {
+                    d = a->latency;
+                }
+            }
+            if (aStore && (bLoad || bStore)) {
+                d = d > a->latency ? d : a->latency;
+            }
+            if (d < 1 && a->write >= 0 && a->write == b->write) {
+                d = 1;
+            }
+            for (int k = 0; d < 0 && k < a->numReads; k++) {
+                if (a->reads[k] == b->write) {
+                    d = 0;
+                }
+            }
+            if (d < 0 && aLoad && bStore) {
+                d = 0;
+            }
+            r->dep[i][j] = (signed char)d;
+        }
+    }
+}
+
+// stall cycles of the run issued in `order`
+static uint64_t sched_stalls(const SchedRun *r, const int *order) {
+    int issue[SCHED_WINDOW];
+    int cycle = -1;
+    uint64_t stalls = 0;
+    for (int k = 0; k < r->num; k++) {
+        int j = order[k], at = cycle + 1;
+        for (int m = 0; m < k; m++) {
+            int i = order[m];
+            if (i < j && r->dep[i][j] >= 0 && issue[i] + r->dep[i][j] > at) {
+                at = issue[i] + r->dep[i][j];
+            }
+        }
+        stalls += (uint64_t)(at - cycle - 1);
+        issue[j] = cycle = at;
+    }
+    return stalls;
+}
+
+// list-schedule the run into r->order
+static void sched_list(SchedRun *r) {
+    for (int i = r->num - 1; i >= 0; i--) {
+        SchedNode *a = &r->nodes[i];
+        a->height = a->latency;
+        a->preds = 0;
+        a->ready = 0;
+        a->issued = 0;
+        for (int j = i + 1; j < r->num; j++) {
+            if (r->dep[i][j] >= 0 && r->dep[i][j] + r->nodes[j].height > a->height) {
+                a->height = r->dep[i][j] + r->nodes[j].height;
+            }
+        }
+    }
+    for (int j = 0; j < r->num; j++) {
+        for (int i = 0; i < j; i++) {
+            r->nodes[j].preds += r->dep[i][j] >= 0;
+        }
+    }
+    int cycle = 0;
+    for (int k = 0; k < r->num; k++) {
+        // the tallest ready node, else the one ready soonest
+        int best = -1;
+        for (int j = 0; j < r->num; j++) {
+            const SchedNode *n = &r->nodes[j];
+            if (n->issued || n->preds) {
+                continue;
+            }
+            if (best < 0) {
+                best = j;
+                continue;
+            }
+            const SchedNode *b = &r->nodes[best];
+            int nReady = n->ready <= cycle, bReady = b->ready <= cycle;
+            if (nReady != bReady ? nReady
+                                 : nReady ? n->height > b->height
+                                          : n->ready < b->ready || (n->ready == b->ready && n->height > b->height)) {
+                best = j;
+            }
+        }
+        SchedNode *n = &r->nodes[best];
+        int at = n->ready > cycle ? n->ready : cycle;
+        n->issued = 1;
+        r->order[k] = best;
+        for (int j = best + 1; j < r->num; j++) {
+            if (r->dep[best][j] >= 0) {
+                r->nodes[j].preds--;
+                if (at + r->dep[best][j] > r->nodes[j].ready) {
+                    r->nodes[j].ready = at + r->dep[best][j];
+                }
+            }
+        }
+        cycle = at + 1;
+    }
+}
+
+// schedule the run and append what replaces its records to `insns`
+static void sched_flush(SchedRun *r, IrInsn **insns, size_t *num, size_t *cap, size_t *newIndex) {
+    if (r->num == 0) {
+        return;
+    }
+    int original[SCHED_WINDOW];
+    for (int k = 0; k < r->num; k++) {
+        original[k] = k;
+    }
+    sched_dependences(r);
+    sched_list(r);
+    uint64_t before = sched_stalls(r, original), after = sched_stalls(r, r->order);
+    stat_add(&stats.stallsBefore, before);
+    if (after < before) {
+        stat_add(&stats.stallsAfter, after);
+        *insns = grow_counted(MEM_IR, *insns, cap, *num + (size_t)r->num, sizeof(IrInsn));
+        for (size_t i = r->first; i < r->end; i++) {
+            newIndex[i] = *num;
+        }
+        for (int k = 0; k < r->num; k++) {
+            (*insns)[(*num)++] = r->nodes[r->order[k]].insn;
+        }
+        for (int k = 0; k < NUM_MACRO_KINDS; k++) {
+            stat_add(&stats.macros[k], (uint64_t)r->macros[k]);
+        }
+    } else {
+        stat_add(&stats.stallsAfter, before);
+        *insns = grow_counted(MEM_IR, *insns, cap, *num + (r->end - r->first), sizeof(IrInsn));
+        for (size_t i = r->first; i < r->end; i++) {
+            newIndex[i] = *num;
+            (*insns)[(*num)++] = ir.insns[i];
+        }
+    }
+    r->num = 0;
+    memset(r->macros, 0, sizeof(r->macros));
+}
+
+static void schedule_ir(const ScheduleModel *model) {
+    SchedRun *r = calloc(1, sizeof(SchedRun));
+    size_t *newIndex = malloc((ir.num + 1) * sizeof(size_t));
+    if (!r || !newIndex) {
+        fprintf(diag(), "Error: out of memory.\n");
+        fail();
+    }
+    r->model = model;
+    IrInsn *insns = NULL;
+    size_t num = 0, cap = 0, li = 0;
+    Section section = NONE;
+    int pc = 0x1000;
+    __atomic_store_n(&stats.scheduled, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < ir.num; i++) {
+        const IrInsn *in = &ir.insns[i];
+        int labelBefore = 0;
+        for (; li < ir.numLabels && ir.labels[li].insn == i; li++) {
+            labelBefore = 1;
+        }
+        if (in->op == IR_DIRECTIVE) {
+            section = (Section)in->rd;
+        }
+        if (labelBefore || r->num + ir_size(in) / 4 > SCHED_WINDOW) {
+            sched_flush(r, &insns, &num, &cap, newIndex);
+        }
+        if (section != CODE || !sched_add(r, i, pc)) {
+            sched_flush(r, &insns, &num, &cap, newIndex);
+            insns = grow_counted(MEM_IR, insns, &cap, num + 1, sizeof(IrInsn));
+            newIndex[i] = num;
+            insns[num++] = *in;
+        }
+        pc += ir_size(in);
+    }
+    sched_flush(r, &insns, &num, &cap, newIndex);
+    newIndex[ir.num] = num;
+    for (size_t k = 0; k < ir.numLabels; k++) {
+        ir.labels[k].insn = newIndex[ir.labels[k].insn];
+    }
+    if (ir.numPool) {
+        ir.poolInsn = newIndex[ir.poolInsn];
+    }
+    mem_free(MEM_IR, ir.cap * sizeof(IrInsn));
+    free(ir.insns);
+    ir.insns = insns;
+    ir.num = num;
+    ir.cap = cap;
+    free(newIndex);
+    free(r);
+}
+
+/******************************************************************************
+ * Single-pass assembly (-s, -O, -l):
+ * pass1 reads the input once into the IR and every label reference is
+ * resolved from it, so this is the regular pass1 + pass2, optionally with
+ * layout relaxation in between, or the listing instead of pass2.
+ ******************************************************************************/
+typedef struct {
+    int binary;
+    int singlePass;
+    int optimize;
+    int poolReg;            // --pool rN, -1 for none
+    int dce;
+    const char *profileUse; // --profile-use, NULL for none
+    int alignLoops;         // --align-loops N, 0 for none
+    const ScheduleModel *schedule;  // --schedule, NULL for none
+    const char *symbols;    // --symbols FILE, NULL for none
+    int listing;
+    int object;
+} AsmOptions;
+
+// the -O passes over the IR, with the ones options ask for
+static void optimize_ir(const AsmOptions *o) {
+    if (o->profileUse) {
+        profile_layout_ir(o->profileUse);
+    }
+    if (o->dce) {
+        dce_ir();
+    }
+    peephole_ir();
+    known_values_ir();
+    coalesce_stack();
+    if (o->alignLoops) {
+        align_loops(o->alignLoops);
+    }
+    if (o->poolReg >= 0) {
+        build_pool(o->poolReg);
+    }
+    layout_ir(0);
+    if (o->schedule) {
+        schedule_ir(o->schedule);
+    }
+}
+
+static void single_pass(const char *infile, const char *outfile, const AsmOptions *o) {
+    pass1(infile);
+    if (o->optimize) {
+        optimize_ir(o);
+    }
+    if (o->symbols) {
+        write_symbols(o->symbols);
+    }
+    if (o->listing) {
+        write_listing(outfile, o->optimize);
+        free_ir();
+    } else {
+        pass2(outfile, o->binary, o->optimize);
+    }
+}
+
+/******************************************************************************
+ * Library interface (tinker.h):
+ * Assembles a source held in memory as single_pass would, into the
+ * context's memory output, with the messages collected and a failure
+ * returned through the same trap a batch assembly job uses. The IR points
+ * straight into the caller's source, which is only read.
+ ******************************************************************************/
+struct TinkerContext {
+    Output out;         // the last call's output; its buffer is reused
+    char *messages;     // the last call's messages
+    size_t messagesLen;
+};
+
+static pthread_once_t tinkerOnce = PTHREAD_ONCE_INIT;
+
+// assemble the `len` bytes at `src` into `out`, an image if `binary`,
+// optimized with `passes` unless NULL; -r assembles the program it runs
+// through here too. The labels stay, the IR is left for the caller to free.
+static void assemble_source(const char *src, size_t len, int binary, const AsmOptions *passes, Output *out) {
+    reader_view(&ir.source, src, len);
+    ir.haveSource = 1;
+    pass1_source();
+    if (passes) {
+        optimize_ir(passes);
+    }
+    out->optimize = passes != NULL;     // pass2 encodes what the passes left
+    if (binary) {
+        write_image_header(out);
+    }
+    pass2_ir(out);
+}
+
+// the part of a call that may fail(), back to its setjmp
+static int assemble_trapped(AsmTrap *trap, const char *src, size_t len, const TinkerOptions *o,
+                            Output *out) {
+    if (setjmp(trap->env)) {
+        return TINKER_ERROR;
+    }
+    int n = o->alignLoops;
+    if (n && (n < 4 || n > ALIGN_MAX || (n & (n - 1)))) {
+        fprintf(diag(), "Error: invalid alignLoops %d (a power of two from 4 to %d)\n", n, ALIGN_MAX);
+        return TINKER_ERROR;
+    }
+    ScheduleModel model;
+    if (o->schedule && !parse_schedule_spec(o->schedule, &model)) {
+        return TINKER_ERROR;
+    }
+    AsmOptions passes = { 1, 1, 1, o->poolReg, o->dce, NULL, o->alignLoops, o->schedule ? &model : NULL, NULL, 0, 0 };
+    assemble_source(src, len, o->binary, o->optimize ? &passes : NULL, out);
+    if (o->binary && out->errors) {
+        fprintf(diag(), "Error: %d line(s) could not be encoded, no image written.\n", out->errors);
+        return TINKER_ERROR;
+    }
+    return TINKER_OK;
+}
+
+TinkerContext *tinker_create(void) {
+    pthread_once(&tinkerOnce, init_lexer);
+    TinkerContext *ctx = calloc(1, sizeof(TinkerContext));
+    if (ctx) {
+        open_memory_output(&ctx->out, 0);
+    }
+    return ctx;
+}
+
+int tinker_assemble(TinkerContext *ctx, const char *src, size_t len, const TinkerOptions *options,
+                    const char **out, size_t *outLen) {
+    static const TinkerOptions textOutput = { 0, 0, -1, 0, 0, NULL };
+    const TinkerOptions *o = options ? options : &textOutput;
+    *out = NULL;
+    *outLen = 0;
+    free(ctx->messages);
+    ctx->messages = NULL;
+    ctx->messagesLen = 0;
+    AsmTrap trap, *outer = asmTrap;
+    FILE *messages = open_memstream(&ctx->messages, &ctx->messagesLen), *outerDiag = diagStream;
+    if (!messages) {
+        return TINKER_ERROR;
+    }
+    trap.outFd = -1;
+    trap.outBuf = NULL;
+    ctx->out.binary = o->binary;
+    ctx->out.optimize = o->optimize;
+    ctx->out.errors = 0;
+    ctx->out.len = 0;
+    asmTrap = &trap;
+    diagStream = messages;
+    int status = assemble_trapped(&trap, src, len, o, &ctx->out);
+    asmTrap = outer;
+    diagStream = outerDiag;
+    fclose(messages);
+    free_ir();
+    free_hashmap();
+    free_segments();
+    if (status == TINKER_OK) {
+        *out = ctx->out.buf;
+        *outLen = ctx->out.len;
+    }
+    return status;
+}
+
+const char *tinker_messages(const TinkerContext *ctx) {
+    return ctx->messages ? ctx->messages : "";
+}
+
+void tinker_free(TinkerContext *ctx) {
+    if (ctx) {
+        free(ctx->out.buf);
+        free(ctx->messages);
+        free(ctx);
+    }
+}
+
+/******************************************************************************
+ * main
+ ******************************************************************************/
+/******************************************************************************
+ * Emulator (--run):
+ * Executes a binary .tko image. Memory is MEM_SIZE bytes of an anonymous
+ * mapping, so the kernel only backs the 4 KiB pages a program touches;
+ * segments are loaded at their addresses, r31 starts at MEM_SIZE (the stack grows down)
+ * and execution starts at the image entry. Dispatch is direct-threaded
+ * over the pre-decoded words below: each handler jumps straight to the
+ * next one's, and one running on to the next word skips the checks of pc
+ * a branch needs. `in` reads a decimal value from stdin on
+ * port 0, `out` prints a value and a newline on port 1; halt ends the run.
+ * Any other trap, an illegal opcode, a misaligned or out-of-range access
+ * and a division by zero stop with "Simulation error".
+ *
+ * --max-insns N stops a run that would go past N instructions (an ld
+ * sequence being its words) with "instruction limit exceeded". The budget
+ * is charged a straight run of words at a time, at the taken branch that
+ * ends it, so the dispatch between branches stays as it was; once a run
+ * could use it up, the entry of the word it runs out at is swapped for one
+ * that stops there, so the limit is exact.
+ *
+ * Port 0 reads ahead IN_BUFFER_SIZE bytes at a time and parses the values
+ * itself (as scanf's %llu would), or reads a file given with --input from a
+ * read-only mapping of it. Port 1 formats the values itself into stdout's
+ * buffer, OUT_PORT_BUFFER bytes unless it is a terminal, so the writes are
+ * coalesced; that buffer is flushed before an error is printed. Either can
+ * be a ring of raw words in a shared file instead (see Port rings).
+ *
+ * A .tko file run with -r is not read: memory is placed so the file's
+ * payload sits at the same offset in a page as in the file, and the whole
+ * pages of each segment are the file's own pages, mapped privately into
+ * memory. The kernel reads a page when it is first touched and copies it
+ * when it is written (code too, which programs may store into); only the
+ * partial pages at a segment's ends are copied at load.
+ *
+ * A source file (`hw4 run prog.tk`, the same as -r) is assembled into a
+ * memory image by the library's assemble_source, optimized with -O and its
+ * passes if given, and loaded from there: no image file is written or read
+ * back, and its labels name pcs for --profile and --break.
+ ******************************************************************************/
+#define MEM_SIZE (512 * 1024)
+#define IMAGE_PAGE 4096
+#define IN_BUFFER_SIZE (64 * 1024)
+#define OUT_PORT_BUFFER (64 * 1024)
+
+// port 0: values are parsed from [p, end), refilled from fd when used up
+typedef struct {
+    const char *p, *end;
+    int fd;                 // -1 once there is no more to read
+    char *buf;              // IN_BUFFER_SIZE bytes, for fd's reads
+    void *map;              // the --input file's mapping, if there is one
+    size_t mapSize;
+} InPort;
+
+// read `path` for port 0: mapped if it is a regular file, else through fd
+static void open_input_port(InPort *in, const char *path) {
+    memset(in, 0, sizeof(*in));
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: can't open '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        in->fd = fd;
+        return;
+    }
+    in->fd = -1;
+    if (st.st_size > 0) {
+        in->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in->map == MAP_FAILED) {
+            fprintf(stderr, "Error: can't map '%s': %s\n", path, strerror(errno));
+            exit(1);
+        }
+        in->mapSize = (size_t)st.st_size;
+        in->p = in->map;
+        in->end = in->p + in->mapSize;
+    }
+    close(fd);
+}
+
+static void close_input_port(InPort *in) {
+    if (in->map) {
+        munmap(in->map, in->mapSize);
+    }
+    if (in->fd > STDIN_FILENO) {
+        close(in->fd);
+    }
+    free(in->buf);
+}
+
+static int in_fill(InPort *in) {
+    if (in->fd < 0) {
+        return 0;
+    }
+    if (!in->buf && !(in->buf = malloc(IN_BUFFER_SIZE))) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    ssize_t n;
+    do {
+        n = read(in->fd, in->buf, IN_BUFFER_SIZE);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        in->fd = -1;
+        return 0;
+    }
+    in->p = in->buf;
+    in->end = in->buf + n;
+    return 1;
+}
+
+// the next byte, not taken, or -1 at the end of the input
+static int in_peek(InPort *in) {
+    if (in->p == in->end && !in_fill(in)) {
+        return -1;
+    }
+    return (unsigned char)*in->p;
+}
+
+// the next decimal value, 0 if there is none: like %llu, white space
+// first, a sign negates and an overflow reads as UINT64_MAX
+static int in_value(InPort *in, uint64_t *value) {
+    int c;
+    while ((c = in_peek(in)) >= 0 && isspace(c)) {
+        in->p++;
+    }
+    int negative = c == '-';
+    if (c == '-' || c == '+') {
+        in->p++;
+        c = in_peek(in);
+    }
+    if (c < '0' || c > '9') {
+        return 0;
+    }
+    uint64_t v = 0;
+    int overflow = 0;
+    do {
+        // the digits in the buffer, then those after a refill
+        const char *p = in->p, *end = in->end;
+        // eight digits at a time while that can't overflow (as in lex_number)
+        while (end - p >= 8 && v < 100000000000ull) {
+            uint64_t w = load_chars(p);
+            unsigned n = decimal_run(w);
+            if (n == 0) {
+                break;
+            }
+            v = v * pow10_8[n] + decimal_chunk(w, n);
+            p += n;
+            if (n < 8) {
+                break;
+            }
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            unsigned digit = (unsigned)(*p - '0');
+            overflow |= v > (UINT64_MAX - digit) / 10;
+            v = v * 10 + digit;
+        }
+        in->p = p;
+    } while (in->p == in->end && in_fill(in));
+    *value = overflow ? UINT64_MAX : negative ? -v : v;
+    return 1;
+}
+
+// `v` in decimal and a newline, ending at `end`; returns where it starts
+static char *format_value_line(char *end, uint64_t v) {
+    *--end = '\n';
+    do {
+        *--end = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return end;
+}
+
+/******************************************************************************
+ * Port rings (-r --in-ring FILE, --out-ring FILE):
+ * `out` on port 1 pushes its value, and `in` on port 0 pops one, as a raw
+ * 8-byte word through a UT_spsc queue in a shared file, for a process on
+ * the other side to read or write in place, instead of as decimal text
+ * through stdout or stdin. The emulator makes each FILE anew when the run
+ * starts (an old one is unlinked first, so readers still mapping it are
+ * left alone):
+ *   0    PortRingHeader: the magic "TKRING1\0" (stored last, once the
+ *        queue is set up), the capacity in words, and `done`
+ *   128  the UT_spsc of utqueue.h, placed with utspsc_init_at: map the
+ *        file, wait for the magic, and use the queue at offset 128 with
+ *        utspsc_trypop_n or utspsc_peek_n/utspsc_skip (or utspsc_push_n)
+ * The producer sets `done` once it has pushed its last word: the emulator
+ * for --out-ring when the run ends, error or not, and the other process
+ * for --in-ring, after which `in` on an empty ring has no input. A full
+ * --out-ring, or an empty --in-ring without `done`, waits for the other
+ * side.
+ ******************************************************************************/
+#define PORT_RING_WORDS (64 * 1024)
+#define PORT_RING_HEADER 128
+#define PORT_RING_MAGIC 0x0031474E49524B54ULL  // "TKRING1\0", little-endian
+
+typedef struct {
+    uint64_t magic;
+    uint32_t words;
+    uint32_t done;          // atomic
+} PortRingHeader;
+
+typedef struct PortRing {
+    PortRingHeader *header;
+    UT_spsc *q;             // PORT_RING_HEADER bytes into the file
+    size_t size;
+} PortRing;
+
+static void open_port_ring(PortRing *r, const char *path) {
+    r->size = PORT_RING_HEADER + utspsc_size(PORT_RING_WORDS, sizeof(uint64_t));
+    if (unlink(path) != 0 && errno != ENOENT) {
+        fprintf(stderr, "Error: can't replace '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)r->size) != 0) {
+        fprintf(stderr, "Error: can't make '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    void *map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: can't map '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    r->header = map;
+    r->q = (UT_spsc *)((char *)map + PORT_RING_HEADER);
+    utspsc_init_at(r->q, PORT_RING_WORDS, sizeof(uint64_t));
+    r->header->words = PORT_RING_WORDS;
+    __atomic_store_n(&r->header->magic, PORT_RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+// the emulator's side is done with `r`; an --out-ring is marked done
+static void close_port_ring(PortRing *r, int producer) {
+    if (producer) {
+        __atomic_store_n(&r->header->done, 1, __ATOMIC_RELEASE);
+    }
+    munmap(r->header, r->size);
+}
+
+static void ring_put(PortRing *r, uint64_t v) {
+    for (size_t spins = 0; !utspsc_trypush(r->q, &v); spins++) {
+        utqueue_wait(spins);
+    }
+}
+
+// the next word, 0 if the ring is empty and done
+static int ring_get(PortRing *r, uint64_t *v) {
+    for (size_t spins = 0; !utspsc_trypop(r->q, v); spins++) {
+        // done is set after the last push: one more look once it is
+        if (__atomic_load_n(&r->header->done, __ATOMIC_ACQUIRE)) {
+            return utspsc_trypop(r->q, v);
+        }
+        utqueue_wait(spins);
+    }
+    return 1;
+}
+
+#define NO_BUDGET ((uint64_t)1 << 62)   // no --max-insns: more than any run gets through
+#define STOP_PATCH 2                    // Machine.stop: a --patch-fifo patch is ready
+
+typedef struct {
+    uint64_t reg[32];
+    uint64_t pc;
+    unsigned char *mem;
+    unsigned char *memMap;      // the mapping mem lies in, see load_image
+    size_t memMapSize;
+    struct DecodedInsn *code;   // run_machine's tables, see unload_machine
+    uint64_t *constants;
+    unsigned char *inFused;
+    Output *out;                // captured `out` values, NULL for stdout
+    InPort in;
+    PortRing *inRing, *outRing; // --in-ring, --out-ring, NULL without
+    int stop;                   // stop at the next taken branch (a timeout), atomic; STOP_PATCH patches there
+    uint64_t budget;            // instructions left to run (--max-insns), NO_BUDGET for no limit
+    int pauseAtIn;              // return before the first `in` runs...
+    int paused;                 // ...and set this, leaving pc on it
+    struct Profile *profile;    // --profile counts, NULL when not profiling
+    struct Breakpoints *breaks; // --break, NULL for none
+    struct CacheModel *cache;   // --cache-model, NULL without
+    struct Trace *trace;        // --record or --replay, NULL without
+    struct Patcher *patcher;    // --patch-fifo, NULL without
+} Machine;
+
+// a batch job's run returns here from sim_error instead of exiting
+typedef struct {
+    jmp_buf env;
+    Output *out;
+} SimTrap;
+
+static __thread SimTrap *simTrap;
+
+// `size` zero bytes that only take memory once written to
+static void *map_zeroed(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void sim_error(uint64_t pc, const char *what) {
+    if (simTrap) {
+        char buf[128];
+        int n = snprintf(buf, sizeof(buf), "Simulation error: %s at pc 0x%llx\n", what, (unsigned long long)pc);
+        out_bytes(simTrap->out, buf, (size_t)n);
+        longjmp(simTrap->env, 1);
+    }
+    fflush(stdout);
+    fprintf(stderr, "Simulation error: %s at pc 0x%llx\n", what, (unsigned long long)pc);
+    exit(1);
+}
+
+// load `size` bytes of a .tko image into a fresh machine; `fd` is the file
+// they are a mapping of, whose pages then become memory, or -1
+static void load_image(Machine *m, const unsigned char *p, size_t size, int fd) {
+    memset(m, 0, sizeof(*m));
+    m->in.fd = STDIN_FILENO;
+    m->budget = NO_BUDGET;
+    m->reg[31] = MEM_SIZE;
+    m->pc = 0;
+    if (size < 16 || memcmp(p, "TKO1", 4)) {
+        m->mem = m->memMap = map_zeroed(m->memMapSize = MEM_SIZE);
+        sim_error(m->pc, "not a Tinker image");
+    }
+    uint32_t numSegments = get_le32(p + 4);
+    size_t shift = 0;
+    if (fd >= 0 && numSegments > 0 && (size - 16) / 24 >= numSegments) {
+        // line the first segment up with its page offset in the file
+        shift = (size_t)(16 + (uint64_t)numSegments * 24 - get_le64(p + 24)) & (IMAGE_PAGE - 1);
+    }
+    m->memMapSize = MEM_SIZE + (shift ? IMAGE_PAGE : 0);
+    m->memMap = map_zeroed(m->memMapSize);
+    m->mem = m->memMap + shift;
+    m->pc = get_le64(p + 8);
+    if ((size - 16) / 24 < numSegments) {
+        sim_error(m->pc, "truncated image");
+    }
+    const unsigned char *seg = p + 16, *payload = seg + (size_t)numSegments * 24;
+    size_t left = size - 16 - (size_t)numSegments * 24;
+    for (uint32_t i = 0; i < numSegments; i++, seg += 24) {
+        uint64_t address = get_le64(seg + 8), bytes = get_le64(seg + 16);
+        if (bytes > left || address > MEM_SIZE || bytes > MEM_SIZE - address) {
+            sim_error(m->pc, "segment outside memory");
+        }
+        unsigned char *to = m->mem + address;
+        size_t offset = (size_t)(payload - p), head = 0, pages = 0;
+        if (fd >= 0 && ((uintptr_t)to - offset) % IMAGE_PAGE == 0) {
+            head = (IMAGE_PAGE - offset % IMAGE_PAGE) % IMAGE_PAGE;
+            pages = bytes > head ? (bytes - head) & ~(size_t)(IMAGE_PAGE - 1) : 0;
+            if (pages && mmap(to + head, pages, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                              fd, (off_t)(offset + head)) == MAP_FAILED) {
+                pages = 0;
+            }
+            if (!pages) {
+                head = 0;
+            }
+        }
+        memcpy(to, payload, head);
+        memcpy(to + head + pages, payload + head + pages, bytes - head - pages);
+        payload += bytes;
+        left -= bytes;
+    }
+}
+
+static uint64_t mem_load(const Machine *m, uint64_t pc, uint64_t address) {
+    if (address > MEM_SIZE - 8) {
+        sim_error(pc, "load outside memory");
+    }
+    uint64_t v;
+    memcpy(&v, m->mem + address, 8);
+    return v;
+}
+
+static void mem_store(Machine *m, uint64_t pc, uint64_t address, uint64_t v) {
+    if (address > MEM_SIZE - 8) {
+        sim_error(pc, "store outside memory");
+    }
+    memcpy(m->mem + address, &v, 8);
+}
+
+static double as_double(uint64_t v) {
+    double d;
+    memcpy(&d, &v, 8);
+    return d;
+}
+
+static uint64_t from_double(double d) {
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    return v;
+}
+
+// sign-extend a 12-bit field
+static int64_t simm12(uint32_t L) {
+    return (int64_t)(L ^ 0x800) - 0x800;
+}
+
+/******************************************************************************
+ * Pre-decoded instructions:
+ * Each word from CODE_BASE up is decoded the first time it is executed into
+ * a DecodedInsn (handler, registers, immediate already extended), kept in a
+ * flat array indexed by (pc - CODE_BASE) / 4. priv gets a handler per trap.
+ * The array is mapped like memory and its entries are set to decode one
+ * 4 KiB page of code (CODE_PAGE_WORDS entries) at a time, when control
+ * first reaches the page: on a taken branch, or when decoding a word whose
+ * sequence may run into the next page. A short program touches a page or
+ * two of the table instead of all of it.
+ * A store clears the entries of the words it overwrites back to the decode
+ * handler, so self-modifying code is decoded again. Code below CODE_BASE
+ * can't be executed.
+ *
+ * The sequences from expandLd, expandPush and expandPop are fused into one
+ * entry at their first word: a 48-byte ld sets rD to its constant, a push
+ * or pop does both of its steps. The other words keep their own entries,
+ * so branching into a sequence still works, and they are marked so that
+ * a store into them also drops the fused entry covering them.
+ *
+ * Likewise, a word followed by one it pairs with in EMU_PAIRS (addi then
+ * brnz, a mov load then add, ...) gets a superinstruction: one handler runs
+ * the first and goes straight on to the second's handler, which runs with
+ * the second word's entry, without dispatching on it. The pairs are the
+ * ones --profile counts run back to back most in the bench programs; C
+ * can't make handlers at run time, and hot code on x86-64 gets translated
+ * by the JIT anyway, so the set is fixed when the emulator is built.
+ ******************************************************************************/
+#define CODE_BASE 0x1000
+#define NUM_DECODED ((MEM_SIZE - CODE_BASE) / 4)
+#define LD_WORDS 12
+
+static uint32_t word_at(const unsigned char *mem, uint64_t address) {
+    uint32_t w;
+    memcpy(&w, mem + address, 4);
+    return w;
+}
+
+static int is_insn(uint32_t w, int mop, uint32_t rd, uint32_t L) {
+    return (int)(w >> 27) == mop && (w >> 22 & 31) == rd && (w & 0xFFF) == L;
+}
+
+// the constant loaded by the expandLd sequence into rD whose LD_WORDS words
+// are at p, 0 if they aren't one
+static int ld_sequence_value(const unsigned char *p, uint32_t rD, uint64_t *value) {
+    uint64_t v = 0;
+    for (int i = 1; i < LD_WORDS; i++) {
+        uint32_t w = word_at(p, 4 * (uint64_t)i);
+        if (i % 2) {
+            if (!is_insn(w, MOP_ADDI, rD, w & 0xFFF)) {
+                return 0;
+            }
+            v += w & 0xFFF;
+        } else {
+            if (!is_insn(w, MOP_SHFTLI, rD, i == LD_WORDS - 2 ? 4 : 12)) {
+                return 0;
+            }
+            v <<= w & 0xFFF;
+        }
+    }
+    *value = v;
+    return 1;
+}
+
+// the constant loaded by an expandLd sequence into rD at `pc`, 0 if there's none
+static int fused_ld_value(const unsigned char *mem, uint64_t pc, uint32_t rD, uint64_t *value) {
+    return pc <= MEM_SIZE - 4 * LD_WORDS && ld_sequence_value(mem + pc, rD, value);
+}
+
+/* The handlers of run_machine. A GNU C build keeps a handler's address in
+ * each DecodedInsn, and every handler ends in its own computed goto to the
+ * next one (direct threading). With -DTINKER_SWITCH_DISPATCH, or a
+ * compiler without labels as values, an entry holds the handler's number
+ * and the jumps go through a switch instead. */
+#define EMU_HANDLERS(X) \
+    X(decode) X(bad_pc) X(ld) X(push) X(pop) \
+    X(and) X(or) X(xor) X(not) X(shftr) X(shftri) X(shftl) X(shftli) \
+    X(br) X(brr_r) X(brr_l) X(brnz) X(call) X(return) X(brgt) \
+    X(mov_load) X(mov_rr) X(mov_rl) X(mov_store) \
+    X(addf) X(subf) X(mulf) X(divf) X(add) X(addi) X(sub) X(subi) X(mul) X(div) \
+    X(halt) X(in) X(out) X(illegal_trap) X(illegal) X(limit) X(breakpoint) \
+    X(addi_brnz) X(subi_brnz) X(sub_brnz) X(xor_brnz) X(addi_brgt) X(mov_load_brgt) \
+    X(mov_load_add) X(mov_load_mov_load) X(mulf_addf) X(shftli_add)
+
+/* The superinstructions among them, X(first, second, FIRST_MOP, SECOND_MOP):
+ * the pairs of words the bench programs run back to back most, by the
+ * pair counts of --profile. The first of a pair never branches or stores. */
+#define EMU_PAIRS(X) \
+    X(addi, brnz, ADDI, BRNZ) X(subi, brnz, SUBI, BRNZ) X(sub, brnz, SUB, BRNZ) \
+    X(xor, brnz, XOR, BRNZ) X(addi, brgt, ADDI, BRGT) X(mov_load, brgt, MOV_LOAD, BRGT) \
+    X(mov_load, add, MOV_LOAD, ADD) X(mov_load, mov_load, MOV_LOAD, MOV_LOAD) \
+    X(mulf, addf, MULF, ADDF) X(shftli, add, SHFTLI, ADD)
+
+// whether the machine opcodes `first` then `second` run as one superinstruction
+static int is_emu_pair(unsigned first, unsigned second) {
+#define EMU_PAIR_CASE(a, b, A, B) case MOP_##A << 5 | MOP_##B:
+    switch (first << 5 | second) {
+    EMU_PAIRS(EMU_PAIR_CASE)
+        return 1;
+    default:
+        return 0;
+    }
+#undef EMU_PAIR_CASE
+}
+
+#if defined(__GNUC__) && !defined(TINKER_SWITCH_DISPATCH)
+#define EMU_THREADED 1
+typedef int32_t EmuHandler;     // the handler's address less that of decode
+#if !defined(__clang__)
+// GCC would merge the identical dispatch tails back into a few shared jumps
+#define EMU_KEEP_TAILS __attribute__((optimize("no-crossjumping")))
+#endif
+#endif
+#ifndef EMU_KEEP_TAILS
+#define EMU_KEEP_TAILS
+#endif
+#ifndef EMU_THREADED
+#define EMU_HANDLER_ID(name) EMU_##name,
+typedef enum { EMU_HANDLERS(EMU_HANDLER_ID) NUM_EMU_HANDLERS } EmuHandlerId;
+typedef uint8_t EmuHandler;
+#endif
+
+typedef struct DecodedInsn {
+    EmuHandler handler;
+    uint8_t rd, rs, rt;
+    int32_t imm;        // sign-extended for brr L and mov loads/stores
+} DecodedInsn;
+
+#define CODE_PAGE_WORDS 1024
+#define NUM_CODE_PAGES (NUM_DECODED / CODE_PAGE_WORDS)
+
+typedef char CodePagesFit[NUM_CODE_PAGES * CODE_PAGE_WORDS == NUM_DECODED ? 1 : -1];
+
+// the registers and immediate of the word `w` into `e`, not its handler
+static void decode_fields(DecodedInsn *e, uint32_t w) {
+    uint32_t op = w >> 27, L = w & 0xFFF;
+    e->rd = w >> 22 & 31;
+    e->rs = w >> 17 & 31;
+    e->rt = w >> 12 & 31;
+    e->imm = op == MOP_BRR_L || op == MOP_MOV_LOAD || op == MOP_MOV_STORE ? (int32_t)simm12(L) : (int32_t)L;
+}
+
+/******************************************************************************
+ * Basic-block JIT (x86-64):
+ * A branch target the interpreter reaches JIT_HOT times is translated into
+ * native code up to its first br, brr, brnz, brgt, call or return. Each op
+ * works on host registers, loading its operands from the register file and
+ * storing the result back; the 48-byte ld sequence becomes one 64-bit move.
+ * Every block exit is an inline cache: up to JIT_SITE_SLOTS compares of the
+ * next pc against targets seen there before, each jumping straight to that
+ * target's block. A site starts empty and leaves to jit_run on a miss,
+ * which fills its next slot once the target is translated (monomorphic
+ * first, then polymorphic); a site with all slots taken falls back to a
+ * shared stub that looks the next pc up in the table of translated blocks.
+ * Dropping all blocks drops the caches with them.
+ *
+ * Anything a block can't do natively (priv, div, divf, an access that
+ * fails its bounds check, a store into a word that has been decoded)
+ * leaves to the interpreter at that instruction, which then runs it.
+ * Accesses relative to r31 (pushes, pops, call, return, mov with base r31)
+ * share their bounds checks within a block: a check that r31 + offset is
+ * in memory, and at least JIT_STACK_SLACK bytes above its bottom, also
+ * covers the offsets down to JIT_STACK_SLACK below it and up to the
+ * highest one checked, counted from r31 as it was then through the addi
+ * and subi of r31 since; an access inside that range runs unchecked, and
+ * any other write to r31 forgets it. So a run of pushes, the pops that
+ * undo them and the call or return among them cost one check, or two. A
+ * stack within JIT_STACK_SLACK bytes of address 0 takes the interpreter. A
+ * store the interpreter makes into translated code drops all blocks; a
+ * hot patch (--patch-fifo) drops only those over the words it changes,
+ * and the inline caches that still lead to one go on to its next
+ * translation through its old entry.
+ * Under --max-insns a block starts by comparing the budget with its length,
+ * leaving to the interpreter if it can't run all of it, and each exit takes
+ * the words run up to it from the budget.
+ *
+ * Host registers inside blocks: rbx = &reg[16] (so every register is a
+ * disp8 away), r12 = memory, r13 = block table, r14 = the decoded-word map,
+ * r15 = &Jit.slowExit, rbp = Jit.budget, rcx = the site on a cache miss.
+ *
+ * Blocks are compiled on a thread of their own, so the interpreter never
+ * waits for one: a block that gets hot is queued (its heat stays at
+ * JIT_HOT meanwhile) and interpreted on. The compiler translates a copy of
+ * the words it reads and hands the block back with that copy; jit_run
+ * installs it in the table on the next taken branch, unless memory has
+ * changed under it or the blocks were dropped since it was asked for
+ * (Jit.flushes), and only then marks its words translated. The code
+ * buffer is the compiler's: a flush only clears the table, and the
+ * compiler starts over at the buffer's start with its next block. A full
+ * buffer comes back as a request to flush. Batch jobs, whose workers
+ * already fill the cores, and runs where the thread can't start compile
+ * blocks in place when they get hot.
+ ******************************************************************************/
+#if defined(__x86_64__)
+#define HAVE_JIT 1
+#define JIT_CODE_SIZE (16 << 20)
+#define JIT_HOT 32
+#define JIT_MAX_INSNS 64
+#define JIT_MAX_INSN_BYTES 96     // with a budget's charges
+#define JIT_SITE_SLOTS 4
+#define JIT_STACK_SLACK 4096
+#define JIT_SITE_HEAD 11        // stop check
+#define JIT_SITE_SLOT 12        // cmp rax, pc; je block
+#define JIT_SITE_BYTES (JIT_SITE_HEAD + JIT_SITE_SLOTS * JIT_SITE_SLOT + 12)
+#define JIT_QUEUE 16
+#define JIT_SPAN_WORDS (JIT_MAX_INSNS * LD_WORDS)   // a block translates at most these
+#define COVER_DECODED 1
+#define COVER_JIT 2
+
+typedef uint64_t (*JitEntry)(uint64_t *regs, unsigned char *mem, void **table,
+                             unsigned char *covered, uint32_t *slowExit, void *block);
+
+typedef struct {
+    uint32_t idx;           // of the block's pc
+    unsigned char *entry;
+} JitRetired;
+
+typedef struct {
+    uint32_t slowExit;      // set by native code: 1 = run pc in the interpreter
+    uint32_t stop;          // [r15 + 4], atomic: the chain stub leaves blocks when set
+    unsigned char *site;    // [r15 + 8]: the inline cache that missed, or NULL
+    uint64_t budget;        // [r15 + 16]: instructions left to run, if budgeted (rbp in blocks)
+    int budgeted;           // blocks count what they run against budget
+    unsigned char *code;    // RWX buffer: the entry stub, then blocks
+    size_t used, reset;     // bytes used, and where blocks start
+    unsigned char *chain, *slow, *siteMiss;
+    unsigned flushes;       // bumped when blocks are dropped
+    void **table;           // native block per CODE_BASE-relative word, or NULL
+    uint16_t *span;         // words the block in table translates
+    JitRetired *retired;    // entries of blocks a hot patch dropped, since the last flush
+    size_t numRetired, capRetired;
+    uint16_t *heat;
+    unsigned char *covered; // COVER_* per word of memory, padded for dword reads
+    JitEntry entry;
+    // the compiler thread, if there is one
+    int threaded;
+    pthread_t thread;
+    sem_t wake;             // posted per request
+    UT_spsc requests;       // JitRequest
+    UT_spsc done;           // JitDone
+    unsigned inFlight;      // requests not handed back yet
+    unsigned compiledFlushes;   // the compiler's: flushes when it last started over
+    unsigned char *snapshot;    // the compiler's copy of memory, MEM_SIZE bytes
+} Jit;
+
+typedef struct {
+    uint32_t idx;           // of the block's pc; UINT32_MAX stops the thread
+    unsigned flushes;       // Jit.flushes when it was asked for
+    uint32_t words;         // copied into code
+    uint32_t code[JIT_SPAN_WORDS];  // memory from the block's pc
+} JitRequest;
+
+typedef struct {
+    JitRequest request;
+    void *block;            // NULL if its first word can't be translated
+    int full;               // no room left: flush, then ask again
+    uint32_t words;         // translated, from the block's pc
+} JitDone;
+
+static __thread unsigned char *jit_p;    // batch jobs compile on several threads
+static __thread uint64_t jit_block;      // the pc of the block being compiled
+
+static void jit_bytes(const void *p, size_t n) {
+    memcpy(jit_p, p, n);
+    jit_p += n;
+}
+
+#define JIT(...) jit_bytes((const unsigned char[]){__VA_ARGS__}, sizeof((const unsigned char[]){__VA_ARGS__}))
+
+static void jit_u32(uint32_t v) {
+    memcpy(jit_p, &v, 4);
+    jit_p += 4;
+}
+
+// displacement of Tinker register `r` from rbx
+static unsigned char jit_reg(int r) {
+    return (unsigned char)((r - 16) * 8);
+}
+
+// mov host (0 = rax, 1 = rcx, 2 = rdx), [reg r]
+static void jit_load_reg(int host, int r) {
+    JIT(0x48, 0x8B, (unsigned char)(0x43 | host << 3), jit_reg(r));
+}
+
+// mov [reg r], host
+static void jit_store_reg(int host, int r) {
+    JIT(0x48, 0x89, (unsigned char)(0x43 | host << 3), jit_reg(r));
+}
+
+// jmp rel32 to `target`
+static void jit_jump(const unsigned char *target) {
+    JIT(0xE9);
+    jit_u32((uint32_t)(target - (jit_p + 4)));
+}
+
+// leave through `stub` with rax = pc
+static void jit_exit(const unsigned char *stub, uint64_t pc) {
+    JIT(0xB8);
+    jit_u32((uint32_t)pc);
+    jit_jump(stub);
+}
+
+// with a budget: take the words of the block before `pc` from it
+static void jit_charge(const Jit *j, uint64_t pc) {
+    if (j->budgeted && pc > jit_block) {
+        JIT(0x48, 0x81, 0xED);          // sub rbp, words
+        jit_u32((uint32_t)((pc - jit_block) >> 2));
+    }
+}
+
+// leave to run `pc` in the interpreter
+static void jit_leave(const Jit *j, uint64_t pc) {
+    jit_charge(j, pc);
+    jit_exit(j->slow, pc);
+}
+
+// leave to run `pc` in the interpreter unless the flags say `cc` (a jcc
+// rel8 opcode)
+static void jit_leave_unless(const Jit *j, unsigned char cc, uint64_t pc) {
+    JIT(cc, 0);
+    unsigned char *skip = jit_p;
+    jit_leave(j, pc);
+    skip[-1] = (unsigned char)(jit_p - skip);
+}
+
+// rax = address of an 8-byte access at `pc`; leave if it's outside memory
+static void jit_check_address(const Jit *j, uint64_t pc) {
+    JIT(0x48, 0x3D);                // cmp rax, MEM_SIZE - 8
+    jit_u32(MEM_SIZE - 8);
+    jit_leave_unless(j, 0x76, pc);  // jbe
+}
+
+// rax + disp = store address: leave if it touches a decoded word
+static void jit_check_code(const Jit *j, int32_t disp, uint64_t pc) {
+    if (disp) {
+        JIT(0x48, 0x8D, 0x88);      // lea rcx, [rax + disp]
+        jit_u32((uint32_t)disp);
+    } else {
+        JIT(0x48, 0x89, 0xC1);      // mov rcx, rax
+    }
+    JIT(0x48, 0xC1, 0xE9, 0x02,     // shr rcx, 2
+        0x41, 0xF7, 0x04, 0x0E);    // test dword [r14 + rcx], 0xFFFFFF
+    jit_u32(0xFFFFFF);
+    jit_leave_unless(j, 0x74, pc);  // jz
+}
+
+// rax = store address: leave if it's outside memory or touches a decoded word
+static void jit_check_store(const Jit *j, uint64_t pc) {
+    jit_check_address(j, pc);
+    jit_check_code(j, 0, pc);
+}
+
+// what a block knows of r31 at the instruction being translated
+typedef struct {
+    int known;              // lo and hi hold
+    int64_t delta;          // r31 now minus r31 at the last check
+    int64_t lo, hi;         // offsets from r31 at the last check that are in memory
+} JitStack;
+
+// rax + the displacement returned = r31 + imm, for an 8-byte access at
+// `pc`; checked, leaving if it's outside memory or within JIT_STACK_SLACK
+// bytes of address 0, unless the checks before it cover it
+static int32_t jit_stack_address(const Jit *j, JitStack *s, int64_t imm, uint64_t pc) {
+    int64_t off = s->delta + imm;
+    jit_load_reg(0, 31);
+    if (s->known && off >= s->lo && off <= s->hi) {
+        return (int32_t)imm;
+    }
+    JIT(0x48, 0x05);                // add rax, imm - JIT_STACK_SLACK
+    jit_u32((uint32_t)(imm - JIT_STACK_SLACK));
+    JIT(0x48, 0x3D);                // cmp rax, MEM_SIZE - 8 - JIT_STACK_SLACK
+    jit_u32(MEM_SIZE - 8 - JIT_STACK_SLACK);
+    jit_leave_unless(j, 0x76, pc);  // jbe
+    if (!s->known || off - JIT_STACK_SLACK < s->lo) {
+        s->lo = off - JIT_STACK_SLACK;
+    }
+    if (!s->known || off > s->hi) {
+        s->hi = off;
+    }
+    s->known = 1;
+    return JIT_STACK_SLACK;
+}
+
+// mov rax, [r12 + rax + disp]
+static void jit_load_mem(int32_t disp) {
+    JIT(0x49, 0x8B, 0x84, 0x04);
+    jit_u32((uint32_t)disp);
+}
+
+// mov [r12 + rax + disp], rdx
+static void jit_store_mem(int32_t disp) {
+    JIT(0x49, 0x89, 0x94, 0x04);
+    jit_u32((uint32_t)disp);
+}
+
+// leave the block with rax = next pc through an empty inline cache
+static void jit_site(const Jit *j) {
+    unsigned char *site = jit_p;
+    JIT(0x41, 0x83, 0x7F, 0x04, 0,  // cmp dword [r15 + 4], 0
+        0x0F, 0x85);                // jne chain
+    jit_u32((uint32_t)(j->chain - (jit_p + 4)));
+    for (int i = 0; i < JIT_SITE_SLOTS; i++) {
+        JIT(0x48, 0x3D);            // cmp rax, -1 (no pc): a free slot
+        jit_u32(0xFFFFFFFF);
+        JIT(0x0F, 0x84);            // je chain
+        jit_u32((uint32_t)(j->chain - (jit_p + 4)));
+    }
+    JIT(0x48, 0x8D, 0x0D);          // lea rcx, [site]
+    jit_u32((uint32_t)(site - (jit_p + 4)));
+    jit_jump(j->siteMiss);
+}
+
+// point the next free slot of `site` at `block`, the translation of `pc`;
+// the last one also sends further misses to the chain stub
+static void jit_fill_site(const Jit *j, unsigned char *site, uint64_t pc, const unsigned char *block) {
+    for (int i = 0; i < JIT_SITE_SLOTS; i++) {
+        unsigned char *slot = site + JIT_SITE_HEAD + i * JIT_SITE_SLOT;
+        int32_t rel;
+        memcpy(&rel, slot + 8, 4);
+        if (slot + JIT_SITE_SLOT + rel != j->chain) {
+            continue;
+        }
+        uint32_t v = (uint32_t)pc;
+        memcpy(slot + 2, &v, 4);
+        v = (uint32_t)(block - (slot + JIT_SITE_SLOT));
+        memcpy(slot + 8, &v, 4);
+        if (i == JIT_SITE_SLOTS - 1) {
+            unsigned char *end = site + JIT_SITE_BYTES;
+            v = (uint32_t)(j->chain - end);
+            memcpy(end - 4, &v, 4);
+        }
+        return;
+    }
+}
+
+static void jit_flush(Jit *j) {
+    memset(j->table, 0, NUM_DECODED * sizeof(void *));
+    memset(j->heat, 0, NUM_DECODED * sizeof(uint16_t));
+    for (size_t i = 0; i < MEM_SIZE / 4; i++) {
+        j->covered[i] &= ~COVER_JIT;
+    }
+    j->numRetired = 0;
+    if (!j->threaded) {
+        j->used = j->reset;
+    }
+    __atomic_store_n(&j->flushes, j->flushes + 1, __ATOMIC_RELEASE);
+}
+
+static void *jit_compile(Jit *j, const unsigned char *mem, uint64_t pc, uint32_t *words);
+
+// the compiler thread: requests in, blocks out
+static void *jit_compiler(void *arg) {
+    Jit *j = arg;
+    JitDone d;
+    for (;;) {
+        sem_wait(&j->wake);
+        if (!utspsc_trypop(&j->requests, &d.request)) {
+            continue;
+        }
+        if (d.request.idx == UINT32_MAX) {
+            return NULL;
+        }
+        unsigned flushes = __atomic_load_n(&j->flushes, __ATOMIC_ACQUIRE);
+        if (flushes != j->compiledFlushes) {
+            j->used = j->reset;     // none of the old blocks runs any more
+            j->compiledFlushes = flushes;
+        }
+        d.block = NULL;
+        d.full = 0;
+        d.words = 0;
+        if (d.request.flushes != flushes) {
+            // asked for before a flush: answered with nothing
+        } else if (JIT_CODE_SIZE - j->used < JIT_MAX_INSNS * JIT_MAX_INSN_BYTES + JIT_SITE_BYTES) {
+            d.full = 1;
+        } else {
+            uint64_t pc = CODE_BASE + 4 * (uint64_t)d.request.idx;
+            memcpy(j->snapshot + pc, d.request.code, 4 * (size_t)d.request.words);
+            d.block = jit_compile(j, j->snapshot, pc, &d.words);
+        }
+        utspsc_push(&j->done, &d);
+    }
+}
+
+// `threaded` for a compiler thread; without one (or if it can't start),
+// blocks are compiled in place. `budgeted` blocks keep Jit.budget.
+static Jit *jit_create(int threaded, int budgeted) {
+    Jit *j = calloc(1, sizeof(Jit));
+    if (!j) {
+        return NULL;
+    }
+    j->budgeted = budgeted;
+    j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    j->table = calloc(NUM_DECODED, sizeof(void *));
+    j->span = calloc(NUM_DECODED, sizeof(uint16_t));
+    j->heat = calloc(NUM_DECODED, sizeof(uint16_t));
+    j->covered = calloc(MEM_SIZE / 4 + 4, 1);
+    if (j->code == MAP_FAILED || !j->table || !j->span || !j->heat || !j->covered) {
+        // no executable memory: the interpreter runs everything
+        if (j->code != MAP_FAILED) {
+            munmap(j->code, JIT_CODE_SIZE);
+        }
+        free(j->table);
+        free(j->span);
+        free(j->heat);
+        free(j->covered);
+        free(j);
+        return NULL;
+    }
+    jit_p = j->code;
+    j->entry = (JitEntry)(void *)jit_p;
+    JIT(0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,    // push rbx, rbp, r12-r15
+        0x48, 0x89, 0xFB,           // mov rbx, rdi
+        0x49, 0x89, 0xF4,           // mov r12, rsi
+        0x49, 0x89, 0xD5,           // mov r13, rdx
+        0x49, 0x89, 0xCE,           // mov r14, rcx
+        0x4D, 0x89, 0xC7,           // mov r15, r8
+        0x49, 0x8B, 0x6F, 0x10,     // mov rbp, [r15 + 16]
+        0x41, 0xFF, 0xE1);          // jmp r9
+    j->slow = jit_p;
+    JIT(0x41, 0xC7, 0x07, 1, 0, 0, 0,   // mov dword [r15], 1
+        0xEB, 54);                      // jmp the epilogue
+    j->chain = jit_p;
+    JIT(0x41, 0x83, 0x7F, 0x04, 0,  // cmp dword [r15 + 4], 0
+        0x75, 40,                   // jne miss
+        0x48, 0x89, 0xC1,           // mov rcx, rax
+        0x48, 0x81, 0xE9);          // sub rcx, CODE_BASE
+    jit_u32(CODE_BASE);
+    JIT(0x48, 0x81, 0xF9);          // cmp rcx, NUM_DECODED * 4
+    jit_u32(NUM_DECODED * 4);
+    JIT(0x73, 21,                   // jae miss
+        0xF6, 0xC1, 0x03,           // test cl, 3
+        0x75, 16,                   // jnz miss
+        0x48, 0xC1, 0xE9, 0x02,     // shr rcx, 2
+        0x49, 0x8B, 0x54, 0xCD, 0x00,   // mov rdx, [r13 + rcx * 8]
+        0x48, 0x85, 0xD2,           // test rdx, rdx
+        0x74, 2,                    // jz miss
+        0xFF, 0xE2);                // jmp rdx
+    unsigned char *miss = jit_p;
+    JIT(0x41, 0xC7, 0x07, 0, 0, 0, 0,   // mov dword [r15], 0
+        // epilogue:
+        0x49, 0x89, 0x6F, 0x10,     // mov [r15 + 16], rbp
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,    // pop r15-r12, rbp, rbx
+        0xC3);                      // ret
+    j->siteMiss = jit_p;
+    JIT(0x49, 0x89, 0x4F, 0x08);    // mov [r15 + 8], rcx
+    jit_jump(miss);
+    j->reset = j->used = (size_t)(jit_p - j->code);
+    if (threaded && (j->snapshot = calloc(MEM_SIZE, 1))) {
+        utspsc_init(&j->requests, JIT_QUEUE, sizeof(JitRequest));
+        utspsc_init(&j->done, JIT_QUEUE, sizeof(JitDone));
+        sem_init(&j->wake, 0, 0);
+        j->threaded = pthread_create(&j->thread, NULL, jit_compiler, j) == 0;
+        if (!j->threaded) {
+            sem_destroy(&j->wake);
+            utspsc_done(&j->requests);
+            utspsc_done(&j->done);
+            free(j->snapshot);
+        }
+    }
+    return j;
+}
+
+static void jit_free(Jit *j) {
+    if (j) {
+        if (j->threaded) {
+            JitRequest stop = { .idx = UINT32_MAX };
+            utspsc_push(&j->requests, &stop);
+            sem_post(&j->wake);
+            pthread_join(j->thread, NULL);
+            sem_destroy(&j->wake);
+            utspsc_done(&j->requests);
+            utspsc_done(&j->done);
+            free(j->snapshot);
+        }
+        munmap(j->code, JIT_CODE_SIZE);
+        free(j->table);
+        free(j->span);
+        free(j->retired);
+        free(j->heat);
+        free(j->covered);
+        free(j);
+    }
+}
+
+// translate the block at `pc` into the free end of the code buffer, NULL if
+// its first instruction can't be; *words is how many words from `pc` it
+// translated
+static void *jit_compile(Jit *j, const unsigned char *mem, uint64_t pc, uint32_t *words) {
+    unsigned char *start = j->code + j->used, *budget = NULL;
+    jit_p = start;
+    uint64_t blockPc = jit_block = pc;
+    JitStack stack = { 0 };
+    if (j->budgeted) {
+        // the interpreter runs the block if the budget can't take all of it
+        JIT(0x48, 0x81, 0xFD);          // cmp rbp, words
+        budget = jit_p;
+        jit_u32(0);
+        jit_leave_unless(j, 0x73, pc);  // jae
+    }
+    for (int n = 0; ; n++) {
+        if (n == JIT_MAX_INSNS || pc > MEM_SIZE - 4) {
+            JIT(0xB8);                  // mov eax, pc
+            jit_u32((uint32_t)pc);
+            jit_charge(j, pc);
+            jit_site(j);
+            break;
+        }
+        uint32_t w = word_at(mem, pc), op = w >> 27, L = w & 0xFFF;
+        int rd = w >> 22 & 31, rs = w >> 17 & 31, rt = w >> 12 & 31;
+        uint64_t value;
+        int words = 1, ends = 0;
+        switch (op) {
+        case MOP_AND: case MOP_OR: case MOP_XOR: case MOP_ADD: case MOP_SUB: case MOP_MUL:
+            if (op == MOP_XOR && rd == rs && rd == rt && fused_ld_value(mem, pc, rd, &value)) {
+                JIT(0x48, 0xB8);    // mov rax, imm64
+                jit_bytes(&value, 8);
+                jit_store_reg(0, rd);
+                words = LD_WORDS;
+                break;
+            }
+            jit_load_reg(0, rs);
+            if (op == MOP_MUL) {
+                JIT(0x48, 0x0F, 0xAF, 0x43, jit_reg(rt));   // imul rax, [rt]
+            } else {
+                static const unsigned char alu[] = {
+                    [MOP_AND] = 0x23, [MOP_OR] = 0x0B, [MOP_XOR] = 0x33,
+                    [MOP_ADD] = 0x03, [MOP_SUB] = 0x2B,
+                };
+                JIT(0x48, alu[op], 0x43, jit_reg(rt));  // op rax, [rt]
+            }
+            jit_store_reg(0, rd);
+            break;
+        case MOP_NOT:
+            jit_load_reg(0, rs);
+            JIT(0x48, 0xF7, 0xD0);                      // not rax
+            jit_store_reg(0, rd);
+            break;
+        case MOP_SHFTR: case MOP_SHFTL:
+            jit_load_reg(1, rt);
+            jit_load_reg(0, rs);
+            JIT(0x48, 0xD3, op == MOP_SHFTR ? 0xE8 : 0xE0,    // shr/shl rax, cl
+                0x31, 0xD2,                             // xor edx, edx
+                0x48, 0x83, 0xF9, 0x40,                 // cmp rcx, 64
+                0x48, 0x0F, 0x43, 0xC2);                // cmovae rax, rdx
+            jit_store_reg(0, rd);
+            break;
+        case MOP_SHFTRI: case MOP_SHFTLI:
+            if (L < 64) {
+                JIT(0x48, 0xC1, op == MOP_SHFTRI ? 0x6B : 0x63, jit_reg(rd), (unsigned char)L);
+            } else {
+                JIT(0x48, 0xC7, 0x43, jit_reg(rd));     // mov qword [rd], 0
+                jit_u32(0);
+            }
+            break;
+        case MOP_ADDI: case MOP_SUBI:
+            JIT(0x48, 0x81, op == MOP_ADDI ? 0x43 : 0x6B, jit_reg(rd));   // add/sub qword [rd], L
+            jit_u32(L);
+            if (rd == 31) {
+                stack.delta += op == MOP_ADDI ? (int64_t)L : -(int64_t)L;
+            }
+            break;
+        case MOP_MOV_RR:
+            jit_load_reg(0, rs);
+            jit_store_reg(0, rd);
+            break;
+        case MOP_MOV_RL:
+            jit_load_reg(0, rd);
+            JIT(0x48, 0x25);                            // and rax, ~0xFFF
+            jit_u32(0xFFFFF000);
+            JIT(0x48, 0x0D);                            // or rax, L
+            jit_u32(L);
+            jit_store_reg(0, rd);
+            break;
+        case MOP_MOV_LOAD:
+            if (rs == 31) {
+                jit_load_mem(jit_stack_address(j, &stack, simm12(L), pc));
+                jit_store_reg(0, rd);
+                break;
+            }
+            jit_load_reg(0, rs);
+            JIT(0x48, 0x05);                            // add rax, simm12
+            jit_u32((uint32_t)simm12(L));
+            jit_check_address(j, pc);
+            JIT(0x49, 0x8B, 0x04, 0x04);                // mov rax, [r12 + rax]
+            jit_store_reg(0, rd);
+            break;
+        case MOP_MOV_STORE:
+            if (rd == 31) {
+                int32_t disp = jit_stack_address(j, &stack, simm12(L), pc);
+                jit_check_code(j, disp, pc);
+                jit_load_reg(2, rs);
+                jit_store_mem(disp);
+                break;
+            }
+            jit_load_reg(0, rd);
+            JIT(0x48, 0x05);
+            jit_u32((uint32_t)simm12(L));
+            jit_check_store(j, pc);
+            jit_load_reg(2, rs);
+            JIT(0x49, 0x89, 0x14, 0x04);                // mov [r12 + rax], rdx
+            break;
+        case MOP_ADDF: case MOP_SUBF: case MOP_MULF: {
+            static const unsigned char sse[] = {
+                [MOP_ADDF] = 0x58, [MOP_SUBF] = 0x5C, [MOP_MULF] = 0x59,
+            };
+            JIT(0xF2, 0x0F, 0x10, 0x43, jit_reg(rs),    // movsd xmm0, [rs]
+                0xF2, 0x0F, sse[op], 0x43, jit_reg(rt), // addsd/subsd/mulsd xmm0, [rt]
+                0xF2, 0x0F, 0x11, 0x43, jit_reg(rd));   // movsd [rd], xmm0
+            break;
+        }
+        case MOP_BR:
+            jit_load_reg(0, rd);
+            ends = 1;
+            break;
+        case MOP_BRR_R:
+            jit_load_reg(0, rd);
+            JIT(0x48, 0x05);                            // add rax, pc
+            jit_u32((uint32_t)pc);
+            ends = 1;
+            break;
+        case MOP_BRR_L:
+            JIT(0xB8);                                  // mov eax, pc + L
+            jit_u32((uint32_t)(pc + (uint64_t)simm12(L)));
+            ends = 1;
+            break;
+        case MOP_BRNZ: case MOP_BRGT:
+            if (op == MOP_BRNZ) {
+                JIT(0x48, 0x83, 0x7B, jit_reg(rs), 0);  // cmp qword [rs], 0
+            } else {
+                jit_load_reg(2, rs);
+                JIT(0x48, 0x3B, 0x53, jit_reg(rt));     // cmp rdx, [rt]
+            }
+            jit_load_reg(0, rd);
+            JIT(0xB9);                                  // mov ecx, pc + 4
+            jit_u32((uint32_t)(pc + 4));
+            JIT(0x48, 0x0F, op == MOP_BRNZ ? 0x44 : 0x4E, 0xC1);    // cmovz/cmovle rax, rcx
+            ends = 1;
+            break;
+        case MOP_CALL: {
+            int32_t disp = jit_stack_address(j, &stack, -8, pc);
+            jit_check_code(j, disp, pc);
+            JIT(0xBA);                                  // mov edx, pc + 4
+            jit_u32((uint32_t)(pc + 4));
+            jit_store_mem(disp);
+            jit_load_reg(0, rd);
+            ends = 1;
+            break;
+        }
+        case MOP_RETURN:
+            jit_load_mem(jit_stack_address(j, &stack, -8, pc));
+            ends = 1;
+            break;
+        default:
+            // priv, div, divf and illegal words run in the interpreter
+            if (n == 0) {
+                return NULL;
+            }
+            jit_leave(j, pc);
+            ends = 2;
+            break;
+        }
+        if (ends == 2) {
+            break;
+        }
+        if (rd == 31 && op != MOP_ADDI && op != MOP_SUBI && op != MOP_MOV_STORE) {
+            stack.known = 0;    // r31 = something else: start over at the next check
+            stack.delta = 0;
+        }
+        pc += 4 * words;
+        if (ends) {
+            jit_charge(j, pc);
+            jit_site(j);
+            break;
+        }
+    }
+    j->used = (size_t)(jit_p - j->code);
+    *words = (uint32_t)((pc - blockPc) >> 2);
+    if (budget) {
+        memcpy(budget, words, 4);
+    }
+    return start;
+}
+
+// make `block`, the translation of the `words` words at `pc`, reachable;
+// the entries retired at `pc` jump straight to it
+static void jit_install(Jit *j, uint64_t pc, void *block, uint32_t words) {
+    uint32_t idx = (uint32_t)((pc - CODE_BASE) >> 2);
+    for (uint32_t i = 0; i < words; i++) {
+        j->covered[(pc >> 2) + i] |= COVER_JIT;
+    }
+    j->table[idx] = block;
+    j->span[idx] = (uint16_t)words;
+    unsigned char *saved = jit_p;
+    for (size_t i = 0; i < j->numRetired; i++) {
+        if (j->retired[i].idx == idx) {
+            jit_p = j->retired[i].entry;
+            jit_jump(block);
+        }
+    }
+    jit_p = saved;
+}
+
+// drop just the blocks that translate a word of [from, to) (a hot patch):
+// the inline caches that still lead to one's entry go on from there to
+// the chain stub with its pc, and to its next translation once there is
+// one (jit_install)
+static void jit_retire(Jit *j, uint64_t from, uint64_t to) {
+    if (to <= CODE_BASE) {
+        return;
+    }
+    uint64_t lo = from > CODE_BASE ? (from - CODE_BASE) >> 2 : 0;
+    uint64_t hi = (to - CODE_BASE + 3) >> 2;
+    unsigned char *saved = jit_p;
+    for (uint64_t idx = lo > JIT_SPAN_WORDS ? lo - JIT_SPAN_WORDS : 0; idx < hi && idx < NUM_DECODED; idx++) {
+        if (j->table[idx] && idx + j->span[idx] > lo) {
+            jit_p = j->table[idx];
+            jit_exit(j->chain, CODE_BASE + 4 * idx);
+            j->retired = grow_array(j->retired, &j->capRetired, j->numRetired + 1, sizeof(JitRetired));
+            j->retired[j->numRetired++] = (JitRetired){ (uint32_t)idx, j->table[idx] };
+            j->table[idx] = NULL;
+            j->heat[idx] = 0;
+        }
+    }
+    jit_p = saved;
+}
+
+// the block at `idx` is hot: ask the compiler thread for it, or compile it
+// here without one; NULL if there's no block to run yet
+static void *jit_request(Jit *j, Machine *m, uint64_t idx) {
+    uint64_t pc = CODE_BASE + 4 * idx;
+    if (!j->threaded) {
+        j->heat[idx] = 0;
+        if (JIT_CODE_SIZE - j->used < JIT_MAX_INSNS * JIT_MAX_INSN_BYTES + JIT_SITE_BYTES) {
+            jit_flush(j);
+        }
+        uint32_t words;
+        void *block = jit_compile(j, m->mem, pc, &words);
+        if (block) {
+            jit_install(j, pc, block, words);
+        }
+        return block;
+    }
+    if (j->inFlight == JIT_QUEUE) {
+        j->heat[idx] = 0;           // asked again when it's hot again
+        return NULL;
+    }
+    JitRequest req = { .idx = (uint32_t)idx, .flushes = j->flushes };
+    req.words = MEM_SIZE - pc < 4 * JIT_SPAN_WORDS ? (uint32_t)((MEM_SIZE - pc) >> 2) : JIT_SPAN_WORDS;
+    memcpy(req.code, m->mem + pc, 4 * (size_t)req.words);
+    utspsc_push(&j->requests, &req);
+    sem_post(&j->wake);
+    j->inFlight++;
+    return NULL;
+}
+
+// install what the compiler thread has finished, unless memory has changed
+// under it or it was asked for before the blocks were dropped
+static void jit_collect(Jit *j, Machine *m) {
+    JitDone d;
+    while (utspsc_trypop(&j->done, &d)) {
+        j->inFlight--;
+        uint32_t idx = d.request.idx;
+        uint64_t pc = CODE_BASE + 4 * (uint64_t)idx;
+        if (d.request.flushes != j->flushes) {
+            continue;
+        }
+        if (d.full) {
+            jit_flush(j);
+        } else if (!d.block || memcmp(m->mem + pc, d.request.code, 4 * (size_t)d.words)) {
+            j->heat[idx] = 0;
+        } else {
+            jit_install(j, pc, d.block, d.words);
+        }
+    }
+}
+
+// run translated blocks from `pc` while there are any, returns where the
+// interpreter goes on
+static uint64_t jit_run(Jit *j, Machine *m, uint64_t pc) {
+    unsigned char *site = NULL;
+    for (;;) {
+        uint64_t idx = (pc - CODE_BASE) >> 2;
+        if ((pc & 3) || idx >= NUM_DECODED) {
+            return pc;
+        }
+        if (j->inFlight) {
+            jit_collect(j, m);
+        }
+        void *block = j->table[idx];
+        unsigned flushes = j->flushes;
+        if (!block) {
+            // a block at JIT_HOT has been asked for
+            if (j->heat[idx] == JIT_HOT || ++j->heat[idx] < JIT_HOT) {
+                return pc;
+            }
+            block = jit_request(j, m, idx);
+            if (!block) {
+                return pc;
+            }
+        }
+        if (site && flushes == j->flushes) {
+            jit_fill_site(j, site, pc, block);
+        }
+        pc = j->entry(m->reg + 16, m->mem, j->table, j->covered, &j->slowExit, block);
+        site = j->site;
+        j->site = NULL;
+        if (j->slowExit || __atomic_load_n(&j->stop, __ATOMIC_RELAXED)) {
+            return pc;
+        }
+    }
+}
+#else
+typedef struct { unsigned char *covered; uint64_t budget; } Jit;
+#define COVER_DECODED 1
+#define COVER_JIT 2
+static Jit *jit_create(int threaded, int budgeted) { (void)threaded; (void)budgeted; return NULL; }
+static void jit_free(Jit *j) { (void)j; }
+static void jit_flush(Jit *j) { (void)j; }
+static void jit_retire(Jit *j, uint64_t from, uint64_t to) { (void)j; (void)from; (void)to; }
+static uint64_t jit_run(Jit *j, Machine *m, uint64_t pc) { (void)j; (void)m; return pc; }
+#endif
+
+/******************************************************************************
+ * Profiling (--profile):
+ * With -r, the interpreter counts the instructions it dispatches at each pc
+ * (a fused ld, push or pop counts once, at its first word; a superinstruction
+ * as its two words), the pairs of machine opcodes run one straight after
+ * the other, and follows call and return through a tree of call stacks,
+ * one node per path of call targets from the entry. When the run ends,
+ * also on a simulation error, stderr gets the counts summed by enclosing
+ * label (the nearest label at or before the pc), the hottest pcs and the
+ * hottest pairs (marked "fused" when they run as a superinstruction), and
+ * FILE a line per call stack with the instructions run in it, the folded
+ * format flamegraph.pl and speedscope read:
+ *     main;sum;add 1200
+ * The labels are the assembler's, from assembling the source; a .tko image
+ * brings none, and addresses name everything. Translated blocks aren't
+ * counted, so --profile runs without the JIT. Calls past PROFILE_MAX_DEPTH
+ * (a `call` used as a jump, say) stay in the deepest frame until as many
+ * returns have run.
+ ******************************************************************************/
+#define PROFILE_MAX_DEPTH 1024
+#define PROFILE_TOP_PCS 10
+#define PROFILE_TOP_PAIRS 10
+
+typedef struct {
+    uint64_t frame;         // the address called (the entry for node 0)
+    uint64_t self;          // instructions run with this stack
+    uint32_t parent, child, sibling;    // 0 for none
+    uint32_t depth;
+} ProfileNode;
+
+typedef struct Profile {
+    uint64_t *counts;       // per word from CODE_BASE
+    uint64_t executed;
+    uint64_t attributed;    // of executed, what the nodes hold
+    ProfileNode *nodes;
+    size_t numNodes, capNodes;
+    uint32_t current;
+    uint64_t overflow;      // calls past PROFILE_MAX_DEPTH not yet returned
+    uint64_t pairs[32][32]; // by machine opcode: one word run straight after the other
+} Profile;
+
+static void profile_init(Profile *p, uint64_t entry) {
+    memset(p, 0, sizeof(*p));
+    p->counts = map_zeroed(NUM_DECODED * sizeof(uint64_t));
+    p->nodes = grow_array(NULL, &p->capNodes, 1, sizeof(ProfileNode));
+    p->nodes[0] = (ProfileNode){ entry, 0, 0, 0, 0, 0 };
+    p->numNodes = 1;
+}
+
+static void free_profile(Profile *p) {
+    munmap(p->counts, NUM_DECODED * sizeof(uint64_t));
+    free(p->nodes);
+}
+
+// the word at `pc` runs straight after the one before it
+static void profile_pair(Profile *p, const unsigned char *mem, uint64_t pc) {
+    p->pairs[word_at(mem, pc - 4) >> 27][word_at(mem, pc) >> 27]++;
+}
+
+// give the instructions run since the stack last changed to its node
+static void profile_settle(Profile *p) {
+    p->nodes[p->current].self += p->executed - p->attributed;
+    p->attributed = p->executed;
+}
+
+static void profile_call(Profile *p, uint64_t target) {
+    profile_settle(p);
+    if (p->nodes[p->current].depth == PROFILE_MAX_DEPTH) {
+        p->overflow++;
+        return;
+    }
+    uint32_t n = p->nodes[p->current].child, last = 0;
+    while (n && p->nodes[n].frame != target) {
+        last = n;
+        n = p->nodes[n].sibling;
+    }
+    if (!n) {
+        n = (uint32_t)p->numNodes;
+        p->nodes = grow_array(p->nodes, &p->capNodes, p->numNodes + 1, sizeof(ProfileNode));
+        p->nodes[p->numNodes++] = (ProfileNode){ target, 0, p->current, 0, 0, p->nodes[p->current].depth + 1 };
+        if (last) {
+            p->nodes[last].sibling = n;
+        } else {
+            p->nodes[p->current].child = n;
+        }
+    }
+    p->current = n;
+}
+
+static void profile_return(Profile *p) {
+    profile_settle(p);
+    if (p->overflow) {
+        p->overflow--;
+    } else if (p->current) {
+        p->current = p->nodes[p->current].parent;
+    }
+}
+
+// index + 1 of the last symbol at or before `address`, 0 if there is none
+static size_t enclosing_symbol(const SymbolList *syms, uint64_t address) {
+    size_t lo = 0, hi = syms->num;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((uint64_t)syms->items[mid].value <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// `address` as its enclosing label, +0x offset past it with `offset`
+static void profile_name(char *buf, size_t size, const SymbolList *syms, uint64_t address, int offset) {
+    size_t i = enclosing_symbol(syms, address);
+    if (i == 0) {
+        snprintf(buf, size, "0x%llx", (unsigned long long)address);
+        return;
+    }
+    const ObjectSymbol *s = &syms->items[i - 1];
+    uint64_t past = address - (uint64_t)s->value;
+    if (offset && past) {
+        snprintf(buf, size, "%.*s+0x%llx", s->len, s->name, (unsigned long long)past);
+    } else {
+        snprintf(buf, size, "%.*s", s->len, s->name);
+    }
+}
+
+typedef struct {
+    uint64_t count;
+    uint64_t address;       // the label's, or the pc's
+} ProfileCount;
+
+static int compare_profile_counts(const void *a, const void *b) {
+    const ProfileCount *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+// a machine opcode by its emulator handler's name, which tells the mov
+// and brr forms apart
+static const char *profile_op_name(unsigned mop) {
+    switch (mop) {
+    case MOP_BRR_R: return "brr_r";
+    case MOP_BRR_L: return "brr_l";
+    case MOP_MOV_LOAD: return "mov_load";
+    case MOP_MOV_RR: return "mov_rr";
+    case MOP_MOV_RL: return "mov_rl";
+    case MOP_MOV_STORE: return "mov_store";
+    default: return mop < NUM_MOPS ? machineOps[mop].name : "illegal";
+    }
+}
+
+// the folded stacks into `outfile`, the flat report to stderr
+static void write_profile(Profile *p, const char *outfile, const SymbolTable *table) {
+    profile_settle(p);
+    SymbolList syms;
+    program_symbols(&syms, table);
+
+    Output out;
+    if (!open_output(&out, outfile, 0, 0)) {
+        perror("profile: open output");
+        exit(1);
+    }
+    uint32_t stack[PROFILE_MAX_DEPTH + 1];
+    char name[160];
+    for (size_t i = 0; i < p->numNodes; i++) {
+        if (!p->nodes[i].self) {
+            continue;
+        }
+        size_t depth = 0;
+        for (uint32_t n = (uint32_t)i; n; n = p->nodes[n].parent) {
+            stack[depth++] = n;
+        }
+        stack[depth++] = 0;
+        while (depth--) {
+            profile_name(name, sizeof(name), &syms, p->nodes[stack[depth]].frame, 1);
+            out_bytes(&out, name, strlen(name));
+            out_char(&out, depth ? ';' : ' ');
+        }
+        out_bytes(&out, name, (size_t)snprintf(name, sizeof(name), "%llu\n", (unsigned long long)p->nodes[i].self));
+    }
+    close_output(&out, outfile);
+
+    // by enclosing label (slot 0: before the first), then by pc
+    ProfileCount *labels = calloc(syms.num + 1, sizeof(ProfileCount));
+    ProfileCount *pcs = NULL;
+    size_t numPcs = 0, capPcs = 0;
+    if (!labels) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    labels[0].address = UINT64_MAX;
+    for (size_t i = 1; i <= syms.num; i++) {
+        labels[i].address = (uint64_t)syms.items[i - 1].value;
+    }
+    for (size_t i = 0; i < NUM_DECODED; i++) {
+        if (p->counts[i]) {
+            uint64_t pc = CODE_BASE + 4 * (uint64_t)i;
+            labels[enclosing_symbol(&syms, pc)].count += p->counts[i];
+            pcs = grow_array(pcs, &capPcs, numPcs + 1, sizeof(ProfileCount));
+            pcs[numPcs++] = (ProfileCount){ p->counts[i], pc };
+        }
+    }
+    qsort(labels, syms.num + 1, sizeof(ProfileCount), compare_profile_counts);
+    qsort(pcs, numPcs, sizeof(ProfileCount), compare_profile_counts);
+    double total = p->executed ? (double)p->executed : 1;
+    FILE *f = stderr;
+    fprintf(f, "%-32s %14s %7s\n", "label", "instructions", "%");
+    for (size_t i = 0; i <= syms.num && labels[i].count; i++) {
+        if (labels[i].address == UINT64_MAX) {
+            snprintf(name, sizeof(name), "(before any label)");
+        } else {
+            profile_name(name, sizeof(name), &syms, labels[i].address, 0);
+        }
+        fprintf(f, "%-32s %14llu %7.2f\n", name, (unsigned long long)labels[i].count, 100 * labels[i].count / total);
+    }
+    fprintf(f, "%-32s %14s %7s\n", "pc", "instructions", "%");
+    for (size_t i = 0; i < numPcs && i < PROFILE_TOP_PCS; i++) {
+        char at[sizeof(name) + 36];   // 16 hex digits, a space, " (line N)"
+        profile_name(name, sizeof(name), &syms, pcs[i].address, 1);
+        uint32_t line = table ? source_line(table, pcs[i].address) : 0;
+        if (line) {
+            snprintf(at, sizeof(at), "%08llx %s (line %u)", (unsigned long long)pcs[i].address, name, line);
+        } else {
+            snprintf(at, sizeof(at), "%08llx %s", (unsigned long long)pcs[i].address, name);
+        }
+        fprintf(f, "%-32s %14llu %7.2f\n", at, (unsigned long long)pcs[i].count, 100 * pcs[i].count / total);
+    }
+    // the hottest pairs, address = first << 5 | second
+    ProfileCount pairs[32 * 32];
+    for (unsigned i = 0; i < 32 * 32; i++) {
+        pairs[i] = (ProfileCount){ p->pairs[i >> 5][i & 31], i };
+    }
+    qsort(pairs, 32 * 32, sizeof(ProfileCount), compare_profile_counts);
+    fprintf(f, "%-32s %14s %7s\n", "pair", "instructions", "%");
+    for (size_t i = 0; i < PROFILE_TOP_PAIRS && pairs[i].count; i++) {
+        unsigned first = (unsigned)pairs[i].address >> 5, second = (unsigned)pairs[i].address & 31;
+        snprintf(name, sizeof(name), "%s+%s%s", profile_op_name(first), profile_op_name(second),
+                 is_emu_pair(first, second) ? " (fused)" : "");
+        fprintf(f, "%-32s %14llu %7.2f\n", name, (unsigned long long)pairs[i].count, 100 * pairs[i].count / total);
+    }
+    fprintf(f, "total: %llu instructions, %zu call stacks\n", (unsigned long long)p->executed, p->numNodes);
+    free(pcs);
+    free(labels);
+    free(syms.items);
+}
+
+/******************************************************************************
+ * Cache model (--cache-model):
+ * With -r, every data access of a mov load or store (push and pop included)
+ * goes through a model of the memory hierarchy: an L1 and, behind it, an
+ * L2 data cache and a TLB, each set-associative with LRU replacement, as
+ * configured by SPEC, a comma-separated list of
+ *     l1=SIZE:WAYS:LINE  l2=SIZE:WAYS:LINE  tlb=ENTRIES:WAYS:PAGE
+ * (sizes take k and m, a level left out isn't modelled; "default" is
+ * l1=32k:8:64,l2=256k:8:64,tlb=64:4:4k). Stores allocate like loads. An
+ * access that spans two lines or pages touches both, and misses if either
+ * does; L2 sees the accesses that missed L1. When the run ends stderr
+ * gets each level's miss rate and, per label in a .data segment, the
+ * accesses to it (up to the next label or the segment's end) and their
+ * miss rates; the rest, the stack say, counts as "(not in .data)". The JIT
+ * is off with --cache-model, as translated blocks aren't observed.
+ ******************************************************************************/
+#define CACHE_L1 0
+#define CACHE_L2 1
+#define CACHE_TLB 2
+#define NUM_CACHE_LEVELS 3
+#define CACHE_DEFAULT "l1=32k:8:64,l2=256k:8:64,tlb=64:4:4k"
+
+static const char *cacheLevelNames[NUM_CACHE_LEVELS] = { "l1", "l2", "tlb" };
+
+typedef struct {
+    int enabled;
+    uint64_t size, ways, line;  // the tlb's size is entries * page, its line a page
+} CacheConfig;
+
+typedef struct {
+    CacheConfig config;
+    uint64_t sets;
+    int lineShift;
+    uint64_t *tags;             // sets * ways, line number + 1 (0: empty)
+    uint64_t *lastUse;
+    uint64_t accesses, misses;
+} CacheLevel;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t misses[NUM_CACHE_LEVELS];
+} CacheCounts;
+
+typedef struct CacheModel {
+    CacheLevel level[NUM_CACHE_LEVELS];
+    uint64_t clock;
+    SymbolList syms;            // by address
+    uint64_t (*data)[2];        // the .data segments, [start, end)
+    size_t numData, capData;
+    CacheCounts *labels;        // slot 0 for addresses in no .data label
+} CacheModel;
+
+// a SIZE: digits, then k or m
+static int parse_cache_number(const char **s, uint64_t *v) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(*s, &end, 10);
+    if (end == *s || errno) {
+        return 0;
+    }
+    if (*end == 'k' || *end == 'K') {
+        n <<= 10;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        n <<= 20;
+        end++;
+    }
+    *v = n;
+    *s = end;
+    return 1;
+}
+
+static int is_power_of_two(uint64_t v) {
+    return v && !(v & (v - 1));
+}
+
+// parse SPEC into config; 0 (with a message) if it's malformed
+static int parse_cache_spec(const char *spec, CacheConfig config[NUM_CACHE_LEVELS]) {
+    memset(config, 0, NUM_CACHE_LEVELS * sizeof(CacheConfig));
+    const char *s = !strcmp(spec, "default") ? CACHE_DEFAULT : spec;
+    while (*s) {
+        int level = -1;
+        for (int i = 0; i < NUM_CACHE_LEVELS; i++) {
+            size_t len = strlen(cacheLevelNames[i]);
+            if (!strncmp(s, cacheLevelNames[i], len) && s[len] == '=') {
+                level = i;
+                s += len + 1;
+            }
+        }
+        uint64_t a, ways, line;
+        if (level < 0 || !parse_cache_number(&s, &a) || *s++ != ':' || !parse_cache_number(&s, &ways)
+                || *s++ != ':' || !parse_cache_number(&s, &line) || (*s && *s++ != ',')) {
+            fprintf(stderr, "Error: invalid --cache-model '%s' (e.g. %s)\n", spec, CACHE_DEFAULT);
+            return 0;
+        }
+        CacheConfig *c = &config[level];
+        c->enabled = 1;
+        c->size = level == CACHE_TLB ? a * line : a;
+        c->ways = ways;
+        c->line = line;
+        if (!is_power_of_two(line) || !ways || c->size % (ways * line)
+                || !is_power_of_two(c->size / (ways * line)) || ways > 1024) {
+            fprintf(stderr, "Error: --cache-model %s: the line and set count must be powers of two\n",
+                    cacheLevelNames[level]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// a model of config, counting by the labels and .data segments of `image`
+static void cache_model_init(CacheModel *cm, const CacheConfig config[NUM_CACHE_LEVELS],
+                             const unsigned char *image, const SymbolTable *table) {
+    memset(cm, 0, sizeof(*cm));
+    for (int i = 0; i < NUM_CACHE_LEVELS; i++) {
+        CacheLevel *c = &cm->level[i];
+        c->config = config[i];
+        if (!c->config.enabled) {
+            continue;
+        }
+        c->sets = c->config.size / (c->config.ways * c->config.line);
+        while ((1ull << c->lineShift) < c->config.line) {
+            c->lineShift++;
+        }
+        c->tags = calloc(c->sets * c->config.ways, sizeof(uint64_t));
+        c->lastUse = calloc(c->sets * c->config.ways, sizeof(uint64_t));
+        if (!c->tags || !c->lastUse) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(1);
+        }
+    }
+    program_symbols(&cm->syms, table);
+    // the header load_image has checked
+    uint32_t numSegments = get_le32(image + 4);
+    for (uint32_t i = 0; i < numSegments; i++) {
+        const unsigned char *seg = image + 16 + (size_t)i * 24;
+        if (get_le32(seg) == 1 && get_le64(seg + 16)) {
+            cm->data = grow_array(cm->data, &cm->capData, cm->numData + 1, sizeof(*cm->data));
+            cm->data[cm->numData][0] = get_le64(seg + 8);
+            cm->data[cm->numData][1] = get_le64(seg + 8) + get_le64(seg + 16);
+            cm->numData++;
+        }
+    }
+    cm->labels = calloc(cm->syms.num + 1, sizeof(CacheCounts));
+    if (!cm->labels) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+}
+
+static void free_cache_model(CacheModel *cm) {
+    for (int i = 0; i < NUM_CACHE_LEVELS; i++) {
+        free(cm->level[i].tags);
+        free(cm->level[i].lastUse);
+    }
+    free(cm->syms.items);
+    free(cm->data);
+    free(cm->labels);
+}
+
+// 1 if the line (or page) holding `address` is in c; brings it in if not
+static int cache_touch(CacheLevel *c, uint64_t address, uint64_t clock) {
+    uint64_t line = address >> c->lineShift;
+    uint64_t *tags = c->tags + (line & (c->sets - 1)) * c->config.ways;
+    uint64_t *lastUse = c->lastUse + (tags - c->tags);
+    size_t victim = 0;
+    for (size_t w = 0; w < c->config.ways; w++) {
+        if (tags[w] == line + 1) {
+            lastUse[w] = clock;
+            return 1;
+        }
+        if (lastUse[w] < lastUse[victim]) {
+            victim = w;
+        }
+    }
+    tags[victim] = line + 1;
+    lastUse[victim] = clock;
+    return 0;
+}
+
+// 1 if every line or page of the 8 bytes at `address` is in c
+static int cache_access_level(CacheLevel *c, uint64_t address, uint64_t clock) {
+    int hit = cache_touch(c, address, clock);
+    if ((address >> c->lineShift) != ((address + 7) >> c->lineShift)) {
+        hit &= cache_touch(c, address + 7, clock);
+    }
+    c->accesses++;
+    c->misses += !hit;
+    return hit;
+}
+
+// the CacheCounts slot of `address`: the .data label holding it, else 0
+static size_t cache_label_slot(const CacheModel *cm, uint64_t address) {
+    for (size_t i = 0; i < cm->numData; i++) {
+        if (address >= cm->data[i][0] && address < cm->data[i][1]) {
+            size_t s = enclosing_symbol(&cm->syms, address);
+            return s && (uint64_t)cm->syms.items[s - 1].value >= cm->data[i][0] ? s : 0;
+        }
+    }
+    return 0;
+}
+
+static void cache_access(CacheModel *cm, uint64_t address) {
+    CacheCounts *counts = &cm->labels[cache_label_slot(cm, address)];
+    uint64_t clock = ++cm->clock;
+    counts->accesses++;
+    if (cm->level[CACHE_L1].config.enabled && !cache_access_level(&cm->level[CACHE_L1], address, clock)) {
+        counts->misses[CACHE_L1]++;
+        if (cm->level[CACHE_L2].config.enabled && !cache_access_level(&cm->level[CACHE_L2], address, clock)) {
+            counts->misses[CACHE_L2]++;
+        }
+    } else if (!cm->level[CACHE_L1].config.enabled && cm->level[CACHE_L2].config.enabled
+               && !cache_access_level(&cm->level[CACHE_L2], address, clock)) {
+        counts->misses[CACHE_L2]++;
+    }
+    if (cm->level[CACHE_TLB].config.enabled && !cache_access_level(&cm->level[CACHE_TLB], address, clock)) {
+        counts->misses[CACHE_TLB]++;
+    }
+}
+
+static double miss_percent(uint64_t misses, uint64_t accesses) {
+    return accesses ? 100.0 * (double)misses / (double)accesses : 0;
+}
+
+// the --cache-model report, to stderr
+static void write_cache_report(const CacheModel *cm) {
+    FILE *f = stderr;
+    // sizes in bytes, the tlb's in entries of a `line` page
+    fprintf(f, "%-6s %10s %7s %5s %14s %14s %8s\n", "level", "size", "ways", "line", "accesses", "misses", "miss %");
+    for (int i = 0; i < NUM_CACHE_LEVELS; i++) {
+        const CacheLevel *c = &cm->level[i];
+        if (c->config.enabled) {
+            fprintf(f, "%-6s %10llu %7llu %5llu %14llu %14llu %8.2f\n", cacheLevelNames[i],
+                    (unsigned long long)(i == CACHE_TLB ? c->config.size / c->config.line : c->config.size),
+                    (unsigned long long)c->config.ways,
+                    (unsigned long long)c->config.line, (unsigned long long)c->accesses,
+                    (unsigned long long)c->misses, miss_percent(c->misses, c->accesses));
+        }
+    }
+    // L2's rate per label is of all the label's accesses, like the others
+    fprintf(f, "%-24s %14s %8s %8s %8s\n", "label", "accesses", "l1 %", "l2 %", "tlb %");
+    for (size_t i = 1; i <= cm->syms.num + 1; i++) {
+        size_t slot = i <= cm->syms.num ? i : 0;
+        const CacheCounts *counts = &cm->labels[slot];
+        if (!counts->accesses) {
+            continue;
+        }
+        char name[64];
+        if (slot) {
+            snprintf(name, sizeof(name), "%.*s", cm->syms.items[slot - 1].len, cm->syms.items[slot - 1].name);
+        } else {
+            snprintf(name, sizeof(name), "(not in .data)");
+        }
+        fprintf(f, "%-24s %14llu", name, (unsigned long long)counts->accesses);
+        for (int l = 0; l < NUM_CACHE_LEVELS; l++) {
+            if (cm->level[l].config.enabled) {
+                fprintf(f, " %8.2f", miss_percent(counts->misses[l], counts->accesses));
+            } else {
+                fprintf(f, " %8s", "-");
+            }
+        }
+        fputc('\n', f);
+    }
+}
+
+/******************************************************************************
+ * Traces (--record, --replay):
+ * The only thing a run doesn't determine itself is what `in` reads, so a
+ * trace holds those values and, every TRACE_INTERVAL of them and at the
+ * end, a checkpoint of pc and registers to hold a replay to. -r --record
+ * FILE writes one as the program runs; -r --replay FILE runs the same
+ * image with `in` reading the trace's values instead, at full speed (the
+ * JIT included), and stops with "replay diverged" at the first checkpoint
+ * that differs, or if the run ends otherwise than the recorded one.
+ * Everything is a LEB128 varint, so small values take a byte or two; no
+ * compression library is linked.
+ *     "TKT1", u64 hash of the image, varint interval
+ *     per full interval: its values, then a checkpoint
+ *     the remaining values, then the final checkpoint
+ *     u64 number of values, u8 how the run ended (0 halt, 1 error)
+ * A checkpoint is pc, r0 ... r31, taken after the `in` that fills its
+ * interval (pc on that `in`) or at the end; after a simulation error the
+ * pc is the entry's, the registers are as the error left them.
+ ******************************************************************************/
+#define TRACE_MAGIC "TKT1"
+#define TRACE_INTERVAL 4096
+#define TRACE_TRAILER 9
+
+typedef struct Trace {
+    int replay;
+    Output out;                     // recording
+    LineReader file;                // replay: the whole trace
+    const unsigned char *p, *end;   // replay: the next varint, the trailer
+    uint64_t interval;
+    uint64_t inputs;                // values so far
+    uint64_t untilCheckpoint;       // values left in this interval
+    uint64_t total;                 // replay: values in the trace
+    int ended;                      // replay: how the recorded run ended
+} Trace;
+
+static void put_varint(Output *out, uint64_t v) {
+    unsigned char *p = (unsigned char *)out_reserve(out, 10), *start = p;
+    for (; v > 0x7F; v >>= 7) {
+        *p++ = (unsigned char)(v | 0x80);
+    }
+    *p++ = (unsigned char)v;
+    out->len += (size_t)(p - start);
+}
+
+static uint64_t get_varint(Trace *t) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && t->p < t->end; shift += 7) {
+        unsigned char b = *t->p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    fflush(stdout);
+    fprintf(stderr, "Error: the trace is truncated or corrupt\n");
+    exit(1);
+}
+
+static void put_checkpoint(Trace *t, uint64_t pc, const uint64_t *reg) {
+    put_varint(&t->out, pc);
+    for (int i = 0; i < 32; i++) {
+        put_varint(&t->out, reg[i]);
+    }
+}
+
+static void trace_diverged(const Trace *t, const char *what) {
+    fflush(stdout);
+    fprintf(stderr, "Error: replay diverged after %llu input(s): %s\n", (unsigned long long)t->inputs, what);
+    exit(1);
+}
+
+static void check_checkpoint(Trace *t, uint64_t pc, const uint64_t *reg) {
+    for (int i = -1; i < 32; i++) {
+        uint64_t want = get_varint(t), have = i < 0 ? pc : reg[i];
+        if (want != have) {
+            char what[96], name[8];
+            snprintf(name, sizeof(name), i < 0 ? "pc" : "r%d", i);
+            snprintf(what, sizeof(what), "%s is 0x%llx, the trace has 0x%llx", name,
+                     (unsigned long long)have, (unsigned long long)want);
+            trace_diverged(t, what);
+        }
+    }
+}
+
+static void trace_record_begin(Trace *t, const char *path, uint64_t imageHash) {
+    memset(t, 0, sizeof(*t));
+    t->interval = TRACE_INTERVAL;
+    if (!open_output(&t->out, path, 0, 0)) {
+        perror("record: open output");
+        exit(1);
+    }
+    out_bytes(&t->out, TRACE_MAGIC, 4);
+    put_le64(&t->out, imageHash);
+    put_varint(&t->out, t->interval);
+    t->untilCheckpoint = t->interval;
+}
+
+static void trace_replay_begin(Trace *t, const char *path, uint64_t imageHash) {
+    memset(t, 0, sizeof(*t));
+    t->replay = 1;
+    if (!reader_open(&t->file, path)) {
+        perror("replay: open trace");
+        exit(1);
+    }
+    reader_slurp(&t->file);
+    const unsigned char *p = (const unsigned char *)t->file.data;
+    size_t size = t->file.size;
+    if (size < 13 + TRACE_TRAILER || memcmp(p, TRACE_MAGIC, 4)) {
+        fprintf(stderr, "Error: '%s' is not a trace\n", path);
+        exit(1);
+    }
+    if (get_le64(p + 4) != imageHash) {
+        fprintf(stderr, "Error: '%s' was recorded from another image\n", path);
+        exit(1);
+    }
+    t->p = p + 12;
+    t->end = p + size - TRACE_TRAILER;
+    t->total = get_le64(t->end);
+    t->ended = t->end[8];
+    t->interval = t->untilCheckpoint = get_varint(t);
+    if (!t->interval) {
+        fprintf(stderr, "Error: the trace is truncated or corrupt\n");
+        exit(1);
+    }
+}
+
+// replay: the next value `in` reads, 0 once the recorded run had no more
+static int trace_value(Trace *t, uint64_t *value) {
+    if (t->inputs == t->total) {
+        return 0;
+    }
+    *value = get_varint(t);
+    return 1;
+}
+
+// after an `in` at pc read `value`: record it, and the interval's checkpoint
+static void trace_input(Trace *t, uint64_t pc, const uint64_t *reg, uint64_t value) {
+    if (!t->replay) {
+        put_varint(&t->out, value);
+    }
+    t->inputs++;
+    if (--t->untilCheckpoint == 0) {
+        t->untilCheckpoint = t->interval;
+        if (t->replay) {
+            check_checkpoint(t, pc, reg);
+        } else {
+            put_checkpoint(t, pc, reg);
+        }
+    }
+}
+
+// the run ended, with a simulation error if `failed`
+static void trace_end(Trace *t, const Machine *m, int failed, const char *path) {
+    if (!t->replay) {
+        put_checkpoint(t, m->pc, m->reg);
+        put_le64(&t->out, t->inputs);
+        out_char(&t->out, (char)failed);
+        close_output(&t->out, path);
+        return;
+    }
+    if (t->inputs != t->total) {
+        trace_diverged(t, "the trace has more input");
+    }
+    if (failed != t->ended) {
+        trace_diverged(t, failed ? "a simulation error, the recorded run halted"
+                                 : "halted, the recorded run had a simulation error");
+    }
+    check_checkpoint(t, m->pc, m->reg);
+    reader_close(&t->file);
+}
+
+/******************************************************************************
+ * Breakpoints and watchpoints (--break, --watchpoint):
+ * -r --break PC (a number or a label, repeatable) reports the pc and the
+ * registers to stderr each time the instruction there is about to run, and
+ * carries on. It costs nothing between hits: decode gives the word's entry
+ * the `breakpoint` handler and keeps the one it would have had, which the
+ * breakpoint then jumps to, and won't fuse a sequence over a breakpoint.
+ * A store into the word decodes it again, breakpoint and all. Breakpoints
+ * run without the JIT, whose blocks would step over them.
+ * -r --watchpoint ADDRESS (a number or a label, repeatable) reports each store that changes the
+ * 8 bytes there, old and new value. The host pages holding them are made
+ * read-only; a store into one faults, and the fault handler opens the page
+ * and single-steps the store (the trap flag), after which it compares the
+ * watched words and closes the page again. Nothing else runs any
+ * differently, translated blocks included. Watchpoints need an x86-64
+ * host.
+ ******************************************************************************/
+#define MAX_BREAKS 64
+#define MAX_WATCHES 16
+
+typedef struct Breakpoints {
+    unsigned char *at;          // a byte per word, set where there is a breakpoint
+    EmuHandler *handler;        // the entry each one's word would have had
+    SymbolList syms;            // naming pcs
+} Breakpoints;
+
+static void breakpoints_init(Breakpoints *b, const SymbolList *syms) {
+    b->at = map_zeroed(NUM_DECODED);
+    b->handler = map_zeroed(NUM_DECODED * sizeof(EmuHandler));
+    b->syms = *syms;
+}
+
+static void free_breakpoints(Breakpoints *b) {
+    munmap(b->at, NUM_DECODED);
+    munmap(b->handler, NUM_DECODED * sizeof(EmuHandler));
+    free(b->syms.items);
+}
+
+// the instruction at pc is about to run
+static void breakpoint_hit(const Machine *m, uint64_t pc) {
+    char name[160];
+    profile_name(name, sizeof(name), &m->breaks->syms, pc, 1);
+    fflush(stdout);
+    fprintf(stderr, "break 0x%llx (%s):", (unsigned long long)pc, name);
+    for (int i = 0; i < 32; i++) {
+        if (m->reg[i]) {
+            fprintf(stderr, " r%d=0x%llx", i, (unsigned long long)m->reg[i]);
+        }
+    }
+    fputc('\n', stderr);
+}
+
+// the address --break or --watchpoint `spec` names: a number, or a label
+// of `syms` (with or without its colon)
+static uint64_t debug_address(const char *option, const char *spec, const SymbolList *syms) {
+    char *end;
+    uint64_t address = strtoull(spec, &end, 0);
+    if (end != spec && *end == '\0' && *spec != '-') {
+        return address;
+    }
+    const char *name = spec + (*spec == ':');
+    for (size_t i = 0; i < syms->num; i++) {
+        const ObjectSymbol *s = &syms->items[i];
+        if ((size_t)s->len == strlen(name) && !memcmp(s->name, name, (size_t)s->len)) {
+            return (uint64_t)s->value;
+        }
+    }
+    fprintf(stderr, "Error: %s: no label '%s' (an image needs --symbols for its labels)\n", option, spec);
+    exit(1);
+}
+
+// at most how many words from word `idx` a fused sequence may take: not
+// past a breakpoint
+static uint64_t breakpoint_room(const Breakpoints *b, uint64_t idx, uint64_t room) {
+    for (uint64_t i = 1; i < room && i < LD_WORDS && idx + i < NUM_DECODED; i++) {
+        if (b->at[idx + i]) {
+            return i;
+        }
+    }
+    return room;
+}
+
+typedef struct {
+    unsigned char *mem;
+    size_t pageSize;
+    int num;
+    uint64_t address[MAX_WATCHES];
+    uint64_t old[MAX_WATCHES];          // the values before the store being stepped
+    char name[MAX_WATCHES][160];
+    uintptr_t open[2];                  // the pages the store opened (one may straddle two)
+    int numOpen;
+} Watches;
+
+static Watches *watches;    // the run's, for the signal handlers
+
+#if defined(__x86_64__)
+#define TRAP_FLAG 0x100
+
+// make the pages holding every watched word read-only (`prot` PROT_READ)
+// or writable again
+static void protect_watches(const Watches *w, int prot) {
+    for (int i = 0; i < w->num; i++) {
+        uintptr_t first = (uintptr_t)(w->mem + w->address[i]) & ~(uintptr_t)(w->pageSize - 1);
+        uintptr_t last = (uintptr_t)(w->mem + w->address[i] + 7) & ~(uintptr_t)(w->pageSize - 1);
+        mprotect((void *)first, last - first + w->pageSize, prot);
+    }
+}
+
+// a store into a watched page: open it and step the store
+static void watch_fault(int sig, siginfo_t *si, void *context) {
+    Watches *w = watches;
+    unsigned char *a = si->si_addr;
+    if (!w || a < w->mem || a >= w->mem + MEM_SIZE || w->numOpen == 2) {
+        signal(sig, SIG_DFL);   // not a watch: fault again, for real
+        return;
+    }
+    uintptr_t page = (uintptr_t)a & ~(uintptr_t)(w->pageSize - 1);
+    mprotect((void *)page, w->pageSize, PROT_READ | PROT_WRITE);
+    if (w->numOpen == 0) {
+        for (int i = 0; i < w->num; i++) {
+            memcpy(&w->old[i], w->mem + w->address[i], 8);
+        }
+    }
+    w->open[w->numOpen++] = page;
+    ((ucontext_t *)context)->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+}
+
+// the store has run: report the watched words it changed, close its pages.
+// Only a guest store faults, never stdio, so this may print.
+static void watch_step(int sig, siginfo_t *si, void *context) {
+    (void)sig;
+    (void)si;
+    Watches *w = watches;
+    ((ucontext_t *)context)->uc_mcontext.gregs[REG_EFL] &= ~(greg_t)TRAP_FLAG;
+    for (int i = 0; i < w->num; i++) {
+        uint64_t v;
+        memcpy(&v, w->mem + w->address[i], 8);
+        if (v != w->old[i]) {
+            char line[256];
+            int n = snprintf(line, sizeof(line), "watch 0x%llx (%s): 0x%llx -> 0x%llx\n",
+                             (unsigned long long)w->address[i], w->name[i],
+                             (unsigned long long)w->old[i], (unsigned long long)v);
+            if (write(STDERR_FILENO, line, (size_t)n) < 0) {
+                // nowhere to say so
+            }
+        }
+    }
+    for (int i = 0; i < w->numOpen; i++) {
+        mprotect((void *)w->open[i], w->pageSize, PROT_READ);
+    }
+    w->numOpen = 0;
+}
+
+// set the watches going on `w->mem`; the handlers they replace go into `saved`
+static void start_watches(Watches *w, struct sigaction saved[2]) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = watch_fault;
+    sigaction(SIGSEGV, &sa, &saved[0]);
+    sa.sa_sigaction = watch_step;
+    sigaction(SIGTRAP, &sa, &saved[1]);
+    watches = w;
+    protect_watches(w, PROT_READ);
+}
+
+static void stop_watches(Watches *w, const struct sigaction saved[2]) {
+    protect_watches(w, PROT_READ | PROT_WRITE);
+    watches = NULL;
+    sigaction(SIGSEGV, &saved[0], NULL);
+    sigaction(SIGTRAP, &saved[1], NULL);
+}
+#else
+static void start_watches(Watches *w, struct sigaction saved[2]) {
+    (void)w;
+    (void)saved;
+    fprintf(stderr, "Error: --watchpoint needs an x86-64 host\n");
+    exit(1);
+}
+
+static void stop_watches(Watches *w, const struct sigaction saved[2]) { (void)w; (void)saved; }
+#endif
+
+// the run is over: stop the watches `w` (NULL for none), drop the breakpoints
+static void finish_debugging(Machine *m, Watches *w, const struct sigaction saved[2]) {
+    if (w) {
+        stop_watches(w, saved);
+    }
+    if (m->breaks) {
+        free_breakpoints(m->breaks);
+        m->breaks = NULL;
+    }
+}
+
+/******************************************************************************
+ * Hot patching (-r --patch-fifo PATH):
+ * A running program takes new code for one labeled block at a time, from
+ * lines 'LABEL [FILE]' written to the FIFO at PATH (made if missing), say
+ * with echo. The block is what lies between :LABEL and the next label:
+ * in the running image up to the next label's address (or the end of the
+ * code segment), in FILE (the program's own source by default) the lines
+ * up to the next label the running program has, or a section directive.
+ * A thread reads the requests and assembles the block's lines (without
+ * -O) on its own tables, at the block's address and with the running
+ * program's labels for everything the block doesn't define. If the new code fits, it goes
+ * in place, padded with 'addi r0, 0'. Otherwise it goes past the image (in
+ * memory the program is taken not to use), and the block's first words
+ * become a jump there: a brr if it is near enough, else an address load
+ * into a register the new code sets before it reads it, and a br. Unless
+ * it ends in br, brr, return or halt, the moved code jumps back to where
+ * the old block ended the same way.
+ * The interpreter puts a patch into memory at the next taken branch (a
+ * translated block stops at its next exit to get there), like a store
+ * from the program: only the decoded entries of the words it changes go
+ * back to decode, and only the translated blocks over them are dropped.
+ * Code already running in the old words may go on in the new ones.
+ ******************************************************************************/
+#define PATCH_SCAN_WORDS 64     // looked at for a free register
+
+typedef struct Patch {
+    char label[50];
+    uint64_t start, end;        // the block's words in the running image
+    uint64_t at;                // where the new code goes: start, or past the image
+    Output body;                // the new code (padded to end in place)
+    int jumpBack;               // moved, and may run off its end
+} Patch;
+
+typedef struct Patcher {
+    Machine *m;
+    Jit *jit;
+    int fd;                     // the FIFO
+    const char *source;         // FILE if a request names none, NULL for an image
+    SymbolList syms;            // the running program's labels, by address
+    SegmentList code;           // its code segments
+    uint64_t top;               // where the next moved block goes
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t applied;
+    Patch *pending;             // for the interpreter, NULL if none
+    int done;                   // the run is over
+} Patcher;
+
+// a register the code at `p` (`n` bytes) sets before it reads one, so a
+// jump to it may load the address there; -1 if a branch comes first
+static int free_register(const unsigned char *p, size_t n) {
+    static const ScheduleModel operandsOnly;
+    uint32_t read = 0;
+    for (size_t k = 0; k + 4 <= n && k < 4 * PATCH_SCAN_WORDS; k += 4) {
+        SchedNode node;
+        if (!sched_node(&node, word_at(p, k), 0, &operandsOnly)) {
+            return -1;
+        }
+        for (int i = 0; i < node.numReads; i++) {
+            read |= 1u << node.reads[i];
+        }
+        if (node.write >= 0 && !(read >> node.write & 1)) {
+            return node.write;
+        }
+    }
+    return -1;
+}
+
+// a jump from `from` to `to` in `room` bytes into `out`: a brr if `to` is
+// near, else `reg` (-1 for none) loaded with it and a br; 0 if neither fits
+static int patch_jump(Output *out, uint64_t from, uint64_t to, int reg, uint64_t room) {
+    int64_t offset = (int64_t)(to - from);
+    if (offset >= -2048 && offset < 2048 && room >= 4) {
+        emit_insn(out, MOP_BRR_L, 0, 0, 0, offset);
+        return 1;
+    }
+    if (reg < 0 || room < LD24_SIZE + 4) {
+        return 0;
+    }
+    expandLd24(reg, to, out);
+    emit_insn(out, MOP_BR, reg, 0, 0, 0);
+    return 1;
+}
+
+// whether control never runs on past the word `w`
+static int ends_block(uint32_t w) {
+    uint32_t op = w >> 27;
+    return op == MOP_BR || op == MOP_BRR_R || op == MOP_BRR_L || op == MOP_RETURN ||
+           (op == MOP_PRIV && (w & 0xFFF) == 0);
+}
+
+// write `n` bytes of new code at `at`, dropping what was decoded or
+// translated from the words they change, as a store does
+static void patch_words(Machine *m, Jit *jit, DecodedInsn *code, const unsigned char *inFused,
+                        EmuHandler decode, uint64_t at, const void *bytes, size_t n) {
+    memcpy(m->mem + at, bytes, n);
+    for (uint64_t w = at; w < at + n; w += 4) {
+        if (w >= CODE_BASE) {
+            uint64_t i = (w - CODE_BASE) >> 2;
+            code[i].handler = decode;
+            for (uint64_t j = i; inFused[i] && j > 0 && j + LD_WORDS > i + 1; j--) {
+                code[j - 1].handler = decode;
+            }
+        }
+    }
+    if (jit) {
+        jit_retire(jit, at, at + n);
+    }
+}
+
+// run_machine, at a taken branch: put the pending patch into memory
+static void apply_patch(Machine *m, Jit *jit, DecodedInsn *code, const unsigned char *inFused,
+                        EmuHandler decode) {
+    Patcher *pt = m->patcher;
+    pthread_mutex_lock(&pt->lock);
+    Patch *p = pt->pending;
+    __atomic_store_n(&m->stop, 0, __ATOMIC_RELAXED);
+    if (jit) {
+        __atomic_store_n(&jit->stop, 0, __ATOMIC_RELAXED);
+    }
+    if (p->at == p->start) {
+        patch_words(m, jit, code, inFused, decode, p->at, p->body.buf, p->body.len);
+        fprintf(stderr, "patch: %s: %zu bytes in place at 0x%llx\n", p->label, p->body.len,
+                (unsigned long long)p->at);
+    } else {
+        // the jumps first, so nothing is written unless both fit
+        Output back, there;
+        open_memory_output(&back, 1);
+        open_memory_output(&there, 1);
+        const char *unfit = NULL;
+        if (p->jumpBack && !patch_jump(&back, p->at + p->body.len, p->end,
+                                       free_register(m->mem + p->end, MEM_SIZE - p->end), LD24_SIZE + 4)) {
+            unfit = "no jump back fits: the code after it sets no register before reading it";
+        } else if (!patch_jump(&there, p->start, p->at,
+                               free_register((const unsigned char *)p->body.buf, p->body.len), p->end - p->start)) {
+            unfit = "no jump to it fits: that takes 20 bytes, and a register the new code sets first";
+        }
+        if (!unfit) {
+            patch_words(m, jit, code, inFused, decode, p->at, p->body.buf, p->body.len);
+            patch_words(m, jit, code, inFused, decode, p->at + p->body.len, back.buf, back.len);
+            patch_words(m, jit, code, inFused, decode, p->start, there.buf, there.len);
+            fprintf(stderr, "patch: %s: %zu bytes moved to 0x%llx, jump at 0x%llx\n", p->label, p->body.len,
+                    (unsigned long long)p->at, (unsigned long long)p->start);
+        } else {
+            fprintf(stderr, "patch: %s: grew past its %llu bytes, and %s\n", p->label,
+                    (unsigned long long)(p->end - p->start), unfit);
+        }
+        free(back.buf);
+        free(there.buf);
+    }
+    pt->pending = NULL;
+    free(p->body.buf);
+    free(p);
+    pthread_cond_signal(&pt->applied);
+    pthread_mutex_unlock(&pt->lock);
+}
+
+// assemble the block `text` of `label` at `address` into `out`, on this
+// thread's tables, with the running program's other labels; 0 after
+// reporting an error
+static int assemble_block(const Patcher *pt, const char *label, const char *text, size_t len, uint64_t address,
+                          Output *out) {
+    AsmTrap trap;
+    trap.outFd = -1;
+    trap.outBuf = NULL;
+    asmTrap = &trap;
+    volatile int ok = 0;
+    open_memory_output(out, 1);
+    if (!setjmp(trap.env)) {
+        for (size_t i = 0; i < pt->syms.num; i++) {
+            const ObjectSymbol *s = &pt->syms.items[i];
+            if ((size_t)s->len != strlen(label) || memcmp(s->name, label, (size_t)s->len)) {
+                add_label_hashed(s->name, (size_t)s->len, label_hash(s->name, (size_t)s->len), (int)s->value);
+            }
+        }
+        reader_view(&ir.source, text, len);
+        ir.haveSource = 1;
+        Section section = CODE;
+        int pc = (int)address;
+        if (pass1_lines(&ir.source, &section, &pc)) {
+            ir_resolve_refs();
+            // pass2_ir, from `address` in .code
+            section = CODE;
+            pc = (int)address;
+            for (size_t i = 0; i < ir.num; i++) {
+                const IrInsn *in = &ir.insns[i];
+                int size = ir_size(in);
+                emit_ir(in, section, pc, size, out);
+                pc += size;
+            }
+            ok = !out->errors;
+        }
+    }
+    asmTrap = NULL;
+    free_ir();
+    free_hashmap();
+    free_segments();
+    if (!ok) {
+        free(out->buf);
+    }
+    return ok;
+}
+
+// the running program's label `name`, NULL if it has none
+static const ObjectSymbol *patch_symbol(const Patcher *pt, const char *name, size_t len) {
+    for (size_t i = 0; i < pt->syms.num; i++) {
+        const ObjectSymbol *s = &pt->syms.items[i];
+        if ((size_t)s->len == len && !memcmp(s->name, name, len)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// the lines of block `label` in `text`: from its label line up to the next
+// label the running program has or a section directive; 0 if it isn't in
+// .code there
+static int find_block(const Patcher *pt, const char *text, size_t size, const char *label,
+                      const char **begin, const char **end) {
+    LineReader r;
+    reader_view(&r, text, size);
+    const char *line;
+    size_t len;
+    Section section = NONE;
+    *begin = NULL;
+    *end = text + size;
+    while (next_line(&r, &line, &len)) {
+        char name[50];
+        if (len && line[0] == '.') {
+            if (*begin) {
+                *end = line;
+                break;
+            }
+            section = directive_section(line, len, section);
+        } else if (len && line[0] == ':' && copy_label_name(line + 1, line + len, name)) {
+            if (*begin && patch_symbol(pt, name, strlen(name))) {
+                *end = line;
+                break;
+            }
+            if (!*begin && section == CODE && !strcmp(name, label)) {
+                *begin = line;
+            }
+        }
+    }
+    return *begin != NULL;
+}
+
+// a request line: reassemble the block and hand it to the interpreter
+static void patch_request(Patcher *pt, const char *req, size_t len) {
+    const char *label = req, *path = req;
+    size_t labelLen = 0;
+    trim_view(&label, &len);
+    if (!len) {
+        return;
+    }
+    if (label[0] == ':') {
+        label++;
+        len--;
+    }
+    while (labelLen < len && !isspace((unsigned char)label[labelLen])) {
+        labelLen++;
+    }
+    path = label + labelLen;
+    size_t pathLen = len - labelLen;
+    trim_view(&path, &pathLen);
+    char name[50], file[4096];
+    if (!labelLen || labelLen >= sizeof(name)) {
+        fprintf(stderr, "patch: expected 'LABEL [FILE]' => %.*s\n", (int)len, label);
+        return;
+    }
+    memcpy(name, label, labelLen);
+    name[labelLen] = '\0';
+    if (pathLen ? !incbin_path(path, pathLen, file) : !pt->source) {
+        fprintf(stderr, "patch: %s: which file? (an image runs from no source)\n", name);
+        return;
+    }
+    if (!pathLen) {
+        snprintf(file, sizeof(file), "%s", pt->source);
+    }
+    const ObjectSymbol *s = patch_symbol(pt, name, labelLen);
+    const ImageSegment *seg = NULL;
+    for (size_t i = 0; s && i < pt->code.num; i++) {
+        if ((uint64_t)s->value >= pt->code.items[i].address &&
+            (uint64_t)s->value < pt->code.items[i].address + pt->code.items[i].size) {
+            seg = &pt->code.items[i];
+        }
+    }
+    if (!seg) {
+        fprintf(stderr, "patch: %s: no such label in the running program's code\n", name);
+        return;
+    }
+    uint64_t start = (uint64_t)s->value, end = seg->address + seg->size;
+    for (size_t i = 0; i < pt->syms.num; i++) {
+        uint64_t v = (uint64_t)pt->syms.items[i].value;
+        if (v > start && v < end) {
+            end = v;
+            break;
+        }
+    }
+    LineReader f;
+    if (!reader_open(&f, file)) {
+        fprintf(stderr, "patch: %s: can't open %s: %s\n", name, file, strerror(errno));
+        return;
+    }
+    reader_slurp(&f);
+    const char *begin, *stop;
+    Patch *p = calloc(1, sizeof(*p));
+    if (!p) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    int ok = find_block(pt, f.data, f.size, name, &begin, &stop);
+    if (!ok) {
+        fprintf(stderr, "patch: %s: no :%s in .code in %s\n", name, name, file);
+    } else if ((ok = assemble_block(pt, name, begin, (size_t)(stop - begin), start, &p->body)) &&
+               p->body.len > end - start) {
+        // too big: assembled again where it goes instead
+        free(p->body.buf);
+        uint64_t at = pt->top;
+        if ((ok = assemble_block(pt, name, begin, (size_t)(stop - begin), at, &p->body))) {
+            p->jumpBack = !p->body.len || !ends_block(word_at((const unsigned char *)p->body.buf, p->body.len - 4));
+            uint64_t need = p->body.len + (p->jumpBack ? LD24_SIZE + 4 : 0);
+            if (at + need > MEM_SIZE) {
+                fprintf(stderr, "patch: %s: no room past the image for %llu bytes\n", name,
+                        (unsigned long long)need);
+                free(p->body.buf);
+                ok = 0;
+            } else {
+                pt->top += need;
+                p->at = at;
+            }
+        }
+    } else if (ok) {
+        emit_padding((int)(end - start - p->body.len), &p->body);
+        p->at = start;
+    }
+    reader_close(&f);
+    if (!ok) {
+        free(p);
+        return;
+    }
+    snprintf(p->label, sizeof(p->label), "%s", name);
+    p->start = start;
+    p->end = end;
+    pthread_mutex_lock(&pt->lock);
+    while (pt->pending && !pt->done) {
+        pthread_cond_wait(&pt->applied, &pt->lock);
+    }
+    if (pt->done) {
+        free(p->body.buf);
+        free(p);
+    } else {
+        pt->pending = p;
+        int idle = 0;
+        __atomic_compare_exchange_n(&pt->m->stop, &idle, STOP_PATCH, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        if (pt->jit) {
+            __atomic_store_n(&pt->jit->stop, 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&pt->lock);
+}
+
+// the patch thread: request lines from the FIFO, one at a time; it is
+// cancelled only while it waits for them
+static void *patch_worker(void *arg) {
+    Patcher *pt = arg;
+    char buf[8192];
+    size_t used = 0;
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    for (;;) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ssize_t n = read(pt->fd, buf + used, sizeof(buf) - used);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return NULL;
+        }
+        used += (size_t)n;
+        char *line = buf, *nl;
+        while ((nl = memchr(line, '\n', used - (size_t)(line - buf))) != NULL) {
+            patch_request(pt, line, (size_t)(nl - line));
+            line = nl + 1;
+        }
+        used -= (size_t)(line - buf);
+        memmove(buf, line, used);
+        if (used == sizeof(buf)) {
+            fprintf(stderr, "patch: request line too long\n");
+            used = 0;
+        }
+    }
+}
+
+// set up --patch-fifo for `m`, running `image` (`size` bytes) from `source`
+// (NULL for an image file) with the labels of `table` or the label table
+static void open_patcher(Patcher *pt, const char *path, Machine *m, const unsigned char *image, size_t size,
+                         const char *source, const SymbolTable *table) {
+    memset(pt, 0, sizeof(*pt));
+    pt->m = m;
+    pt->source = source;
+    program_symbols(&pt->syms, table);
+    qsort(pt->syms.items, pt->syms.num, sizeof(ObjectSymbol), compare_symbol_values);
+    if (!pt->syms.num) {
+        fprintf(stderr, "Error: --patch-fifo needs the program's labels (run its source, or give --symbols)\n");
+        exit(1);
+    }
+    uint32_t numSegments = size >= 16 ? get_le32(image + 4) : 0;
+    for (uint32_t i = 0; i < numSegments && 16 + 24 * (size_t)(i + 1) <= size; i++) {
+        const unsigned char *seg = image + 16 + 24 * (size_t)i;
+        uint64_t address = get_le64(seg + 8), bytes = get_le64(seg + 16);
+        if (address + bytes > pt->top) {
+            pt->top = address + bytes;
+        }
+        if (get_le32(seg) == 0) {
+            add_segment_bytes(&pt->code, CODE, (int)address, (int)bytes);
+        }
+    }
+    pt->top = (pt->top + 7) & ~(uint64_t)7;
+    struct stat st;
+    if (mkfifo(path, 0600) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: can't make the FIFO '%s': %s\n", path, strerror(errno));
+        exit(1);
+    }
+    // read and write, so it neither waits for a writer nor sees the end
+    // when one closes it
+    pt->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (pt->fd < 0 || fstat(pt->fd, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+        fprintf(stderr, "Error: '%s' is not a FIFO\n", path);
+        exit(1);
+    }
+    pthread_mutex_init(&pt->lock, NULL);
+    pthread_cond_init(&pt->applied, NULL);
+    m->patcher = pt;
+}
+
+static void start_patcher(Patcher *pt, Jit *jit) {
+    pt->jit = jit;
+    if (pthread_create(&pt->thread, NULL, patch_worker, pt) != 0) {
+        fprintf(stderr, "Error: can't start the --patch-fifo thread\n");
+        exit(1);
+    }
+}
+
+// the run is over: a patch not applied yet is dropped
+static void stop_patcher(Patcher *pt) {
+    pthread_mutex_lock(&pt->lock);
+    pt->done = 1;
+    pthread_cond_broadcast(&pt->applied);
+    pthread_mutex_unlock(&pt->lock);
+    pthread_cancel(pt->thread);
+    pthread_join(pt->thread, NULL);
+    if (pt->pending) {
+        free(pt->pending->body.buf);
+        free(pt->pending);
+    }
+    close(pt->fd);
+    pthread_mutex_destroy(&pt->lock);
+    pthread_cond_destroy(&pt->applied);
+    free(pt->syms.items);
+    free(pt->code.items);
+    pt->m->patcher = NULL;
+}
+
+// --max-insns: put the `limit` entry that ends a run at word `at` (NUM_DECODED
+// for none) instead of at `old`, whose entry (`*saved`) goes back unless it
+// has been written over since; returns `at`. The entries before it go back
+// to `decode`, which won't fuse a sequence the budget can't hold, so none
+// steps over it.
+static uint64_t move_budget_limit(DecodedInsn *code, uint64_t old, DecodedInsn *saved, uint64_t at,
+                                  EmuHandler limit, EmuHandler decode) {
+    if (at == old) {
+        return at;
+    }
+    if (old < NUM_DECODED && code[old].handler == limit) {
+        code[old] = *saved;
+    }
+    if (at < NUM_DECODED) {
+        for (uint64_t i = at >= LD_WORDS ? at - LD_WORDS + 1 : 0; i < at; i++) {
+            code[i].handler = decode;
+        }
+        *saved = code[at];
+        code[at].handler = limit;
+    }
+    return at;
+}
+
+EMU_KEEP_TAILS static void run_machine(Machine *m, Jit *jit) {
+#ifdef EMU_THREADED
+#define H(name) (EmuHandler)(&&op_##name - &&op_decode)
+#define JUMP(handler) goto *(&&op_decode + (handler))
+#else
+#define H(name) EMU_##name
+#define EMU_CASE(name) case EMU_##name: goto op_##name;
+#define JUMP(handler) do { switch (handler) { EMU_HANDLERS(EMU_CASE) } } while (0)
+#endif
+    static const EmuHandler dispatch[32] = {
+        H(and), H(or), H(xor), H(not),
+        H(shftr), H(shftri), H(shftl), H(shftli),
+        H(br), H(brr_r), H(brr_l), H(brnz),
+        H(call), H(return), H(brgt), H(illegal_trap),
+        H(mov_load), H(mov_rr), H(mov_rl), H(mov_store),
+        H(addf), H(subf), H(mulf), H(divf),
+        H(add), H(addi), H(sub), H(subi),
+        H(mul), H(div), H(illegal), H(illegal),
+    };
+    static const EmuHandler privDispatch[8] = {
+        H(halt), H(illegal_trap), H(illegal_trap), H(in),
+        H(out), H(illegal_trap), H(illegal_trap), H(illegal_trap),
+    };
+    // one more entry behind the last word, for running off the end
+    DecodedInsn *code = m->code = map_zeroed((NUM_DECODED + 1) * sizeof(DecodedInsn));
+    uint64_t *constants = m->constants = map_zeroed(NUM_DECODED * sizeof(uint64_t));
+    unsigned char *inFused = m->inFused = map_zeroed(NUM_DECODED);
+    unsigned char pageReady[NUM_CODE_PAGES] = {0};
+    Profile *prof = m->profile;
+    CacheModel *cache = m->cache;
+    Breakpoints *breaks = m->breaks;
+    uint64_t *r = m->reg;
+    uint64_t pc = m->pc, idx, a;
+    const DecodedInsn *d;
+    // --max-insns: the budget runs out at word `base` of the straight run
+    // from pc (the budget plus pc's word), which taken branches move on by
+    // the words they skip; in memory, a `limit` entry at limitIdx stops it
+    uint64_t base = m->budget + ((pc - CODE_BASE) >> 2), limitIdx = NUM_DECODED;
+    DecodedInsn limitSaved;
+    EmuHandler resume;      // what a limit or breakpoint entry stands in for
+
+// jump to the handler of the instruction at pc
+#define DISPATCH() do { \
+        idx = (pc - CODE_BASE) >> 2; \
+        if ((pc & 3) || idx >= NUM_DECODED) { \
+            FAIL("bad pc"); \
+        } \
+        if (prof) { \
+            prof->counts[idx]++; \
+            prof->executed++; \
+        } \
+        d = &code[idx]; \
+        JUMP(d->handler); \
+    } while (0)
+// on to the word after d: no alignment or range to check, the entry behind
+// the last word fails
+#define STEP() do { \
+        pc += 4; \
+        idx++; \
+        d++; \
+        if (prof && idx < NUM_DECODED) { \
+            prof->counts[idx]++; \
+            prof->executed++; \
+            profile_pair(prof, m->mem, pc); \
+        } \
+    } while (0)
+#define NEXT() do { STEP(); JUMP(d->handler); } while (0)
+// the budget could run out in memory, at base
+#define BUDGET_LIMIT() do { \
+        if (base < NUM_DECODED && base != limitIdx) { \
+            limitIdx = move_budget_limit(code, limitIdx, &limitSaved, base, H(limit), H(decode)); \
+        } \
+    } while (0)
+// entries of the page holding word i (if there is one) are set to decode
+#define PAGE_READY(i) do { \
+        uint64_t page_ = (i) / CODE_PAGE_WORDS; \
+        if (page_ < NUM_CODE_PAGES && !pageReady[page_]) { \
+            pageReady[page_] = 1; \
+            for (size_t k_ = 0; k_ < CODE_PAGE_WORDS; k_++) { \
+                code[page_ * CODE_PAGE_WORDS + k_].handler = H(decode); \
+            } \
+        } \
+    } while (0)
+// a taken branch, the one at idx: translated blocks run from here if
+// there are any
+#define BRANCH() do { \
+        base -= idx + 1; \
+        if (jit) { \
+            jit->budget = base; \
+            pc = jit_run(jit, m, pc); \
+            base = jit->budget; \
+        } \
+        base += (pc - CODE_BASE) >> 2; \
+        if (__atomic_load_n(&m->stop, __ATOMIC_RELAXED)) { \
+            if (__atomic_load_n(&m->stop, __ATOMIC_RELAXED) != STOP_PATCH) { \
+                FAIL("time limit exceeded"); \
+            } \
+            apply_patch(m, jit, code, inFused, H(decode)); \
+        } \
+        PAGE_READY((pc - CODE_BASE) >> 2); \
+        BUDGET_LIMIT(); \
+        DISPATCH(); \
+    } while (0)
+#define FAIL(what) sim_error(pc, what)
+#define LOAD(address) mem_load(m, pc, address)
+// a store to `address` invalidates the (up to three) words it touches,
+// and every entry that may have fused a sequence running into them
+#define STORE(address, v) do { \
+        a = (address); \
+        mem_store(m, pc, a, v); \
+        for (uint64_t w = a; w < a + 8; w = (w | 3) + 1) { \
+            if (w >= CODE_BASE) { \
+                uint64_t i = (w - CODE_BASE) >> 2; \
+                code[i].handler = H(decode); \
+                if (jit && (jit->covered[w >> 2] & COVER_JIT)) { \
+                    jit_flush(jit); \
+                } \
+                for (uint64_t j = i; inFused[i] && j > 0 && j + LD_WORDS > i + 1; j--) { \
+                    code[j - 1].handler = H(decode); \
+                } \
+            } \
+        } \
+    } while (0)
+#define RD r[d->rd]
+#define RS r[d->rs]
+#define RT r[d->rt]
+#define MOV_LOAD() do { \
+        a = RS + (uint64_t)(int64_t)d->imm; \
+        if (cache) { \
+            cache_access(cache, a); \
+        } \
+        RD = LOAD(a); \
+    } while (0)
+
+    code[NUM_DECODED].handler = H(bad_pc);
+    PAGE_READY((pc - CODE_BASE) >> 2);
+    BUDGET_LIMIT();
+    DISPATCH();
+op_bad_pc:
+    FAIL("bad pc");
+op_limit:
+    if (idx != base) {
+        // left from an earlier run: what it replaced runs
+        code[idx] = limitSaved;
+        limitIdx = NUM_DECODED;
+        resume = d->handler;
+        goto run_resume;
+    }
+    __atomic_store_n(&m->stop, 1, __ATOMIC_RELAXED);
+    FAIL("instruction limit exceeded");
+op_breakpoint:
+    breakpoint_hit(m, pc);
+    resume = breaks->handler[idx];
+run_resume:
+    JUMP(resume);   // one dispatch site for both, which the switch build needs few of
+op_decode: {
+        uint32_t w;
+        memcpy(&w, m->mem + pc, 4);
+        uint32_t op = w >> 27, L = w & 0xFFF;
+        PAGE_READY(idx + LD_WORDS);    // the longest step from here
+        uint64_t room = base - idx;     // words the budget has left
+        if (!room) {
+            goto op_limit;      // a store or a fresh page wrote over the limit entry
+        }
+        if (breaks) {
+            room = breakpoint_room(breaks, idx, room);
+        }
+        DecodedInsn *e = &code[idx];
+        decode_fields(e, w);
+        e->handler = op == MOP_PRIV ? privDispatch[L < 8 ? L : 7] : dispatch[op];
+        int fusedWords = 1;
+        if (op == MOP_XOR && e->rd == e->rs && e->rd == e->rt && room >= LD_WORDS
+                && fused_ld_value(m->mem, pc, e->rd, &constants[idx])) {
+            e->handler = H(ld);
+            fusedWords = LD_WORDS;
+        } else if (room >= 2 && pc <= MEM_SIZE - 8 && op == MOP_MOV_STORE && e->rd == 31 && e->imm == -8
+                && is_insn(word_at(m->mem, pc + 4), MOP_SUBI, 31, 8)) {
+            e->handler = H(push);
+            fusedWords = 2;
+        } else if (room >= 2 && pc <= MEM_SIZE - 8 && op == MOP_MOV_LOAD && e->rs == 31 && e->imm == 0
+                && is_insn(word_at(m->mem, pc + 4), MOP_ADDI, 31, 8)) {
+            e->handler = H(pop);
+            fusedWords = 2;
+        } else if (room >= 2 && pc <= MEM_SIZE - 8) {
+            // the second word's fields are what the pair's handler runs it with
+            uint32_t next = word_at(m->mem, pc + 4);
+            EmuHandler single = e->handler;
+            switch (op << 5 | next >> 27) {
+#define EMU_PAIR_CASE(a, b, A, B) case MOP_##A << 5 | MOP_##B: e->handler = H(a##_##b); break;
+            EMU_PAIRS(EMU_PAIR_CASE)
+#undef EMU_PAIR_CASE
+            }
+            if (e->handler != single) {
+                decode_fields(&code[idx + 1], next);
+                fusedWords = 2;
+            }
+        }
+        for (int i = 1; i < fusedWords; i++) {
+            inFused[idx + i] = 1;
+        }
+        for (int i = 0; jit && i < fusedWords; i++) {
+            jit->covered[(pc >> 2) + i] |= COVER_DECODED;
+        }
+        if (breaks && breaks->at[idx]) {
+            breaks->handler[idx] = e->handler;
+            e->handler = H(breakpoint);
+        }
+        JUMP(e->handler);
+    }
+op_ld:      RD = constants[idx]; pc += 4 * LD_WORDS; DISPATCH();
+op_push:
+    if (cache) {
+        cache_access(cache, r[31] - 8);
+    }
+    STORE(r[31] - 8, RS);
+    if (code[idx].handler != H(push)) {
+        NEXT();     // the store overwrote the subi, run what's there now
+    }
+    r[31] -= 8;
+    pc += 8;
+    DISPATCH();
+op_pop:
+    if (cache) {
+        cache_access(cache, r[31]);
+    }
+    RD = LOAD(r[31]);
+    r[31] += 8;
+    pc += 8;
+    DISPATCH();
+op_and:     RD = RS & RT; NEXT();
+op_or:      RD = RS | RT; NEXT();
+op_xor:     RD = RS ^ RT; NEXT();
+op_not:     RD = ~RS; NEXT();
+op_shftr:   RD = RT < 64 ? RS >> RT : 0; NEXT();
+op_shftri:  RD = d->imm < 64 ? RD >> d->imm : 0; NEXT();
+op_shftl:   RD = RT < 64 ? RS << RT : 0; NEXT();
+op_shftli:  RD = d->imm < 64 ? RD << d->imm : 0; NEXT();
+op_br:      pc = RD; BRANCH();
+op_brr_r:   pc += RD; BRANCH();
+op_brr_l:   pc += (uint64_t)(int64_t)d->imm; BRANCH();
+op_brnz:
+    if (RS) {
+        pc = RD;
+        BRANCH();
+    }
+    NEXT();
+op_call:
+    STORE(r[31] - 8, pc + 4);
+    pc = RD;
+    if (prof) {
+        profile_call(prof, pc);
+    }
+    BRANCH();
+op_return:
+    pc = LOAD(r[31] - 8);
+    if (prof) {
+        profile_return(prof);
+    }
+    BRANCH();
+op_brgt:
+    if ((int64_t)RS > (int64_t)RT) {
+        pc = RD;
+        BRANCH();
+    }
+    NEXT();
+op_halt:
+    m->pc = pc;
+    return;
+op_in:
+    if (m->pauseAtIn) {
+        m->paused = 1;
+        m->pc = pc;
+        m->budget = base - idx;     // the in hasn't run
+        return;
+    }
+    if (RS != 0) {
+        FAIL("unsupported input port");
+    }
+    if (m->trace) {
+        if (!(m->trace->replay ? trace_value(m->trace, &RD) :
+              m->inRing ? ring_get(m->inRing, &RD) : in_value(&m->in, &RD))) {
+            FAIL("no input");
+        }
+        trace_input(m->trace, pc, r, RD);
+    } else if (!(m->inRing ? ring_get(m->inRing, &RD) : in_value(&m->in, &RD))) {
+        FAIL("no input");
+    }
+    NEXT();
+op_out:
+    if (RD != 1) {
+        FAIL("unsupported output port");
+    }
+    if (m->outRing) {
+        ring_put(m->outRing, RS);
+    } else {
+        char buf[24], *text = format_value_line(buf + sizeof(buf), RS);
+        size_t n = (size_t)(buf + sizeof(buf) - text);
+        if (m->out) {
+            out_bytes(m->out, text, n);
+        } else {
+            fwrite_unlocked(text, 1, n, stdout);
+        }
+    }
+    NEXT();
+op_illegal_trap:
+    FAIL("unsupported trap");
+op_mov_load:
+    MOV_LOAD();
+    NEXT();
+op_mov_rr:    RD = RS; NEXT();
+op_mov_rl:    RD = (RD & ~(uint64_t)0xFFF) | (uint64_t)d->imm; NEXT();
+op_mov_store:
+    a = RD + (uint64_t)(int64_t)d->imm;
+    if (cache) {
+        cache_access(cache, a);
+    }
+    STORE(a, RS);
+    NEXT();
+op_addf:    RD = from_double(as_double(RS) + as_double(RT)); NEXT();
+op_subf:    RD = from_double(as_double(RS) - as_double(RT)); NEXT();
+op_mulf:    RD = from_double(as_double(RS) * as_double(RT)); NEXT();
+op_divf:
+    if (as_double(RT) == 0.0) {
+        FAIL("division by zero");
+    }
+    RD = from_double(as_double(RS) / as_double(RT));
+    NEXT();
+op_add:     RD = RS + RT; NEXT();
+op_addi:    RD += (uint64_t)d->imm; NEXT();
+op_sub:     RD = RS - RT; NEXT();
+op_subi:    RD -= (uint64_t)d->imm; NEXT();
+op_mul:     RD = RS * RT; NEXT();
+op_div:
+    if (!RT) {
+        FAIL("division by zero");
+    }
+    // INT64_MIN / -1 wraps like the other integer ops
+    RD = (int64_t)RT == -1 ? -RS : (uint64_t)((int64_t)RS / (int64_t)RT);
+    NEXT();
+op_illegal:
+    FAIL("illegal instruction");
+// superinstructions: the first word's step, then straight into the second's
+// handler with its entry
+op_addi_brnz:   RD += (uint64_t)d->imm; STEP(); goto op_brnz;
+op_subi_brnz:   RD -= (uint64_t)d->imm; STEP(); goto op_brnz;
+op_sub_brnz:    RD = RS - RT; STEP(); goto op_brnz;
+op_xor_brnz:    RD = RS ^ RT; STEP(); goto op_brnz;
+op_addi_brgt:   RD += (uint64_t)d->imm; STEP(); goto op_brgt;
+op_mulf_addf:   RD = from_double(as_double(RS) * as_double(RT)); STEP(); goto op_addf;
+op_shftli_add:  RD = d->imm < 64 ? RD << d->imm : 0; STEP(); goto op_add;
+op_mov_load_brgt:
+    MOV_LOAD();
+    STEP();
+    goto op_brgt;
+op_mov_load_add:
+    MOV_LOAD();
+    STEP();
+    goto op_add;
+op_mov_load_mov_load:
+    MOV_LOAD();
+    STEP();
+    goto op_mov_load;
+#undef MOV_LOAD
+#undef RT
+#undef RS
+#undef RD
+#undef STORE
+#undef LOAD
+#undef FAIL
+#undef BRANCH
+#undef BUDGET_LIMIT
+#undef PAGE_READY
+#undef NEXT
+#undef STEP
+#undef DISPATCH
+#undef JUMP
+#undef EMU_CASE
+#undef H
+}
+
+// release what load_image (or restore_machine) and run_machine mapped
+static void unload_machine(Machine *m) {
+    close_input_port(&m->in);
+    munmap(m->memMap, m->memMapSize);
+    if (m->code) {
+        munmap(m->code, (NUM_DECODED + 1) * sizeof(DecodedInsn));
+        munmap(m->constants, NUM_DECODED * sizeof(uint64_t));
+        munmap(m->inFused, NUM_DECODED);
+    }
+}
+
+/******************************************************************************
+ * Compressed images (-z, .tkz), all fields little-endian:
+ *   header   "TKZ1", u32 chunk bytes, u64 image bytes
+ *   chunks   u32 stored bytes (bit 31 set: stored as-is), then the chunk
+ * A .tko image cut into TKZ_CHUNK-byte chunks, each an LZ4 block (the
+ * block format only, coded here) unless that doesn't make it smaller. The
+ * chunks are compressed on -j threads and decompressed one after the other
+ * straight out of the mapped file, a chunk (16 pages) at a time, by
+ * load_program; -r, --batch and --emit-c take either kind of image.
+ ******************************************************************************/
+#define TKZ_CHUNK (64 << 10)
+#define TKZ_RAW 0x80000000u
+#define LZ_HASH_BITS 14
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static uint32_t lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// the bytes after a 15 in a token: runs of 255, then the rest
+static unsigned char *lz_put_length(unsigned char *op, size_t n) {
+    for (; n >= 255; n -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (unsigned char)n;
+    return op;
+}
+
+// `lit` literals from `anchor`, then a match of `match` bytes (0 for none) `offset` back
+static unsigned char *lz_put_sequence(unsigned char *op, const unsigned char *anchor, size_t lit,
+                                      size_t offset, size_t match) {
+    size_t ml = match ? match - 4 : 0;
+    unsigned char *token = op++;
+    *token = (unsigned char)((lit < 15 ? lit : 15) << 4 | (ml < 15 ? ml : 15));
+    if (lit >= 15) {
+        op = lz_put_length(op, lit - 15);
+    }
+    memcpy(op, anchor, lit);
+    op += lit;
+    if (match) {
+        *op++ = (unsigned char)offset;
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= 15) {
+            op = lz_put_length(op, ml - 15);
+        }
+    }
+    return op;
+}
+
+// the `n` bytes at src as an LZ4 block at dst (LZ_BOUND(n) bytes of room), its size
+static size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const unsigned char *ip = src + 1, *anchor = src, *end = src + n;
+    // a match starts 12 bytes and ends 5 bytes before the end at the latest
+    const unsigned char *matchStart = n > 12 ? end - 12 : src, *matchEnd = end - 5;
+    unsigned char *op = dst;
+    while (ip < matchStart) {
+        uint32_t v, r;
+        memcpy(&v, ip, 4);
+        uint32_t h = lz_hash(v);
+        const unsigned char *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+        memcpy(&r, ref, 4);
+        if (r != v || ip - ref > 65535) {
+            ip++;
+            continue;
+        }
+        const unsigned char *mp = ip + 4, *rp = ref + 4;
+        while (mp < matchEnd && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+        op = lz_put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(mp - ip));
+        ip = anchor = mp;
+    }
+    op = lz_put_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    return (size_t)(op - dst);
+}
+
+static int lz_get_length(const unsigned char **ip, const unsigned char *end, size_t *n) {
+    unsigned char b;
+    do {
+        if (*ip == end) {
+            return 0;
+        }
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 1;
+}
+
+// decompress the LZ4 block of `n` bytes at src into exactly `size` bytes at dst; 0 if it's damaged
+static int lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t size) {
+    const unsigned char *ip = src, *end = src + n;
+    unsigned char *op = dst, *oend = dst + size;
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4, match = token & 15, offset;
+        if ((lit == 15 && !lz_get_length(&ip, end, &lit)) ||
+            lit > (size_t)(end - ip) || lit > (size_t)(oend - op)) {
+            return 0;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == end) {
+            break;      // the last sequence is only literals
+        }
+        if (end - ip < 2) {
+            return 0;
+        }
+        offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (match == 15 && !lz_get_length(&ip, end, &match)) {
+            return 0;
+        }
+        match += 4;
+        if (!offset || offset > (size_t)(op - dst) || match > (size_t)(oend - op)) {
+            return 0;
+        }
+        for (size_t i = 0; i < match; i++) {
+            op[i] = op[i - offset];     // overlapping runs repeat
+        }
+        op += match;
+    }
+    return op == oend;
+}
+
+typedef struct {
+    const unsigned char *src;
+    size_t size;
+    unsigned char *dst;     // LZ_BOUND(size) bytes
+    size_t stored;
+    int raw;
+} TkzChunk;
+
+typedef struct {
+    TkzChunk *chunks;
+    size_t numChunks;
+    size_t next;            // atomic
+} TkzQueue;
+
+static void *tkz_worker(void *arg) {
+    TkzQueue *queue = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->numChunks) {
+            return NULL;
+        }
+        TkzChunk *c = &queue->chunks[i];
+        c->stored = lz_compress(c->src, c->size, c->dst);
+        c->raw = c->stored >= c->size;
+    }
+}
+
+// compress the .tko image `infile` to `outfile` on up to `jobs` threads
+static void compress_image(const char *infile, const char *outfile, int jobs) {
+    LineReader fin;
+    if (!reader_open(&fin, infile)) {
+        perror("open input");
+        exit(1);
+    }
+    reader_slurp(&fin);
+    const unsigned char *p = (const unsigned char *)fin.data;
+    if (fin.size < 16 || memcmp(p, "TKO1", 4)) {
+        fprintf(stderr, "Error: '%s' is not a Tinker image\n", infile);
+        exit(1);
+    }
+    size_t numChunks = (fin.size + TKZ_CHUNK - 1) / TKZ_CHUNK;
+    TkzChunk *chunks = calloc(numChunks, sizeof(TkzChunk));
+    unsigned char *space = malloc(numChunks * LZ_BOUND(TKZ_CHUNK));
+    pthread_t *threads = malloc((size_t)jobs * sizeof(pthread_t));
+    if (!chunks || !space || !threads) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < numChunks; i++) {
+        chunks[i].src = p + i * TKZ_CHUNK;
+        chunks[i].size = i + 1 < numChunks ? TKZ_CHUNK : fin.size - i * TKZ_CHUNK;
+        chunks[i].dst = space + i * LZ_BOUND(TKZ_CHUNK);
+    }
+    TkzQueue queue = { chunks, numChunks, 0 };
+    int started = 0;
+    for (; started < jobs - 1 && (size_t)started + 1 < numChunks; started++) {
+        if (pthread_create(&threads[started], NULL, tkz_worker, &queue) != 0) {
+            break;
+        }
+    }
+    tkz_worker(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    Output out;
+    if (!open_output(&out, outfile, 0, 0)) {
+        perror("open output");
+        exit(1);
+    }
+    out_bytes(&out, "TKZ1", 4);
+    put_le32(&out, TKZ_CHUNK);
+    put_le64(&out, (uint64_t)fin.size);
+    for (size_t i = 0; i < numChunks; i++) {
+        const TkzChunk *c = &chunks[i];
+        if (c->raw) {
+            put_le32(&out, (uint32_t)c->size | TKZ_RAW);
+            out_bytes(&out, c->src, c->size);
+        } else {
+            put_le32(&out, (uint32_t)c->stored);
+            out_bytes(&out, c->dst, c->stored);
+        }
+    }
+    close_output(&out, outfile);
+    free(threads);
+    free(space);
+    free(chunks);
+    reader_close(&fin);
+}
+
+// the .tko image a .tkz of `size` bytes at p holds, into `image`; 0 if it's damaged
+static int decompress_image(const unsigned char *p, size_t size, Output *image) {
+    if (size < 16) {
+        return 0;
+    }
+    size_t chunkBytes = get_le32(p + 4);
+    uint64_t left = get_le64(p + 8);
+    if (chunkBytes == 0 || chunkBytes > OUT_BUFFER_SIZE) {
+        return 0;
+    }
+    const unsigned char *ip = p + 16, *end = p + size;
+    while (left > 0) {
+        size_t want = left < chunkBytes ? (size_t)left : chunkBytes;
+        if (end - ip < 4) {
+            return 0;
+        }
+        uint32_t stored = get_le32(ip);
+        ip += 4;
+        size_t n = stored & ~TKZ_RAW;
+        if (n > (size_t)(end - ip)) {
+            return 0;
+        }
+        unsigned char *to = (unsigned char *)out_reserve(image, want);
+        if (stored & TKZ_RAW) {
+            if (n != want) {
+                return 0;
+            }
+            memcpy(to, ip, n);
+        } else if (!lz_decompress(ip, n, to, want)) {
+            return 0;
+        }
+        image->len += want;
+        ip += n;
+        left -= want;
+    }
+    return ip == end;
+}
+
+// whether `path` starts like a .tko image
+static int is_image_file(const char *path) {
+    char magic[4];
+    int fd = open(path, O_RDONLY);
+    int image = fd >= 0 && read(fd, magic, 4) == 4 && !memcmp(magic, "TKO1", 4);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return image;
+}
+
+// the .tko image of `infile`, decompressing a .tkz or assembling a source file
+// first (optimized with `passes`, unless NULL); returns 1 for a source file
+static int load_program(const char *infile, Output *image, const AsmOptions *passes) {
+    LineReader fin;
+    int source = 0;
+    if (!reader_open(&fin, infile)) {
+        perror("open input");
+        exit(1);
+    }
+    reader_slurp(&fin);
+    open_memory_output(image, 1);
+    if (fin.size >= 4 && !memcmp(fin.data, "TKZ1", 4)) {
+        if (!decompress_image((const unsigned char *)fin.data, fin.size, image)) {
+            fprintf(stderr, "Error: '%s' is a damaged compressed image\n", infile);
+            exit(1);
+        }
+    } else if (fin.size >= 4 && !memcmp(fin.data, "TKO1", 4)) {
+        out_bytes(image, fin.data, fin.size);
+    } else {
+        assemble_source(fin.data, fin.size, 1, passes, image);
+        free_ir();
+        if (image->errors) {
+            fprintf(stderr, "Error: %d line(s) could not be encoded, nothing to run.\n", image->errors);
+            exit(1);
+        }
+        source = 1;
+    }
+    reader_close(&fin);
+    return source;
+}
+
+// what -r runs with, besides the image
+typedef struct {
+    int useJit;
+    const char *profileFile;        // --profile
+    const char *inputFile;          // --input
+    const CacheConfig *cache;       // --cache-model, NULL without
+    const char *recordFile;         // --record
+    const char *replayFile;         // --replay
+    const char *symbolsFile;        // --symbols
+    uint64_t maxInsns;              // --max-insns, NO_BUDGET without
+    const char *breaks[MAX_BREAKS]; // --break, as given
+    int numBreaks;
+    const char *watchpoints[MAX_WATCHES];   // --watchpoint, as given
+    int numWatchpoints;
+    const AsmOptions *passes;       // -O and its passes, for a source file; NULL without
+    const char *patchFifo;          // --patch-fifo
+    const char *inRing;             // --in-ring
+    const char *outRing;            // --out-ring
+} RunOptions;
+
+// run `infile`: a .tko image as-is, anything else is assembled first
+static void run_program(const char *infile, const RunOptions *opt) {
+    static char outBuffer[OUT_PORT_BUFFER];
+    if (!isatty(STDOUT_FILENO)) {
+        setvbuf(stdout, outBuffer, _IOFBF, sizeof(outBuffer));
+    }
+    Output image = { 0 };
+    LineReader fin;
+    Machine m;
+    int source = 0;
+    if (reader_open(&fin, infile) && fin.mapped && fin.size >= 4 && !memcmp(fin.data, "TKO1", 4)) {
+        image.buf = (char *)fin.data;
+        image.len = fin.size;
+        load_image(&m, (const unsigned char *)fin.data, fin.size, fin.fd);
+    } else {
+        reader_close(&fin);
+        source = load_program(infile, &image, opt->passes);
+        load_image(&m, (const unsigned char *)image.buf, image.len, -1);
+    }
+    SymbolTable symbols;
+    if (opt->symbolsFile) {
+        open_symbol_table(&symbols, opt->symbolsFile);
+    }
+    const SymbolTable *table = opt->symbolsFile ? &symbols : NULL;
+    CacheModel cache;
+    if (opt->cache) {
+        cache_model_init(&cache, opt->cache, (const unsigned char *)image.buf, table);
+        m.cache = &cache;
+    }
+    Trace trace;
+    if (opt->recordFile) {
+        trace_record_begin(&trace, opt->recordFile, block_hash(image.buf, image.len));
+        m.trace = &trace;
+    } else if (opt->replayFile) {
+        trace_replay_begin(&trace, opt->replayFile, block_hash(image.buf, image.len));
+        m.trace = &trace;
+    }
+    Patcher patcher;
+    if (opt->patchFifo) {
+        open_patcher(&patcher, opt->patchFifo, &m, (const unsigned char *)image.buf, image.len,
+                     source ? infile : NULL, table);
+    }
+    if (fin.mapped) {
+        reader_close(&fin);
+    } else {
+        free(image.buf);
+    }
+    if (opt->inputFile) {
+        open_input_port(&m.in, opt->inputFile);
+    }
+    PortRing inRing, outRing;
+    if (opt->inRing) {
+        open_port_ring(&inRing, opt->inRing);
+        m.inRing = &inRing;
+    }
+    if (opt->outRing) {
+        open_port_ring(&outRing, opt->outRing);
+        m.outRing = &outRing;
+    }
+    m.budget = opt->maxInsns;
+    Breakpoints breaks;
+    Watches watch;
+    struct sigaction savedSignals[2];
+    if (opt->numBreaks || opt->numWatchpoints) {
+        SymbolList syms;
+        program_symbols(&syms, table);
+        watch.mem = m.mem;
+        watch.pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        watch.num = opt->numWatchpoints;
+        watch.numOpen = 0;
+        for (int i = 0; i < watch.num; i++) {
+            uint64_t address = debug_address("--watchpoint", opt->watchpoints[i], &syms);
+            if (address > MEM_SIZE - 8) {
+                fprintf(stderr, "Error: --watchpoint 0x%llx is outside memory\n", (unsigned long long)address);
+                exit(1);
+            }
+            watch.address[i] = address;
+            profile_name(watch.name[i], sizeof(watch.name[i]), &syms, address, 1);
+        }
+        if (opt->numBreaks) {
+            breakpoints_init(&breaks, &syms);
+            m.breaks = &breaks;
+        } else {
+            free(syms.items);
+        }
+        for (int i = 0; i < opt->numBreaks; i++) {
+            uint64_t pc = debug_address("--break", opt->breaks[i], &breaks.syms);
+            if ((pc & 3) || pc < CODE_BASE || pc >= MEM_SIZE) {
+                fprintf(stderr, "Error: --break 0x%llx is not a code address\n", (unsigned long long)pc);
+                exit(1);
+            }
+            breaks.at[(pc - CODE_BASE) >> 2] = 1;
+        }
+        if (watch.num) {
+            start_watches(&watch, savedSignals);
+        }
+    }
+    // translated blocks don't count or see data accesses, and step over
+    // breakpoints
+    int observed = opt->profileFile || opt->cache;
+    Jit *jit = opt->useJit && !observed && !m.breaks ? jit_create(1, m.budget != NO_BUDGET) : NULL;
+    if (m.patcher) {
+        start_patcher(&patcher, jit);
+    }
+    if (!observed && !m.trace && !m.inRing && !m.outRing) {
+        run_machine(&m, jit);
+        if (m.patcher) {
+            stop_patcher(&patcher);
+        }
+        fflush(stdout);
+        finish_debugging(&m, opt->numWatchpoints ? &watch : NULL, savedSignals);
+        if (table) {
+            reader_close(&symbols.file);
+        }
+        jit_free(jit);
+        unload_machine(&m);
+        return;
+    }
+    // the reports are written, and an --out-ring marked done, after a
+    // simulation error too
+    Profile profile;
+    Output error;
+    SimTrap trap;
+    if (opt->profileFile) {
+        profile_init(&profile, m.pc);
+        m.profile = &profile;
+    }
+    open_memory_output(&error, 0);
+    trap.out = &error;
+    simTrap = &trap;
+    if (!setjmp(trap.env)) {
+        run_machine(&m, jit);
+    }
+    simTrap = NULL;
+    if (m.patcher) {
+        stop_patcher(&patcher);
+    }
+    fflush(stdout);
+    finish_debugging(&m, opt->numWatchpoints ? &watch : NULL, savedSignals);
+    if (error.len) {
+        fwrite(error.buf, 1, error.len, stderr);
+    }
+    if (m.trace) {
+        trace_end(&trace, &m, error.len > 0, opt->recordFile);
+    }
+    if (m.inRing) {
+        close_port_ring(&inRing, 0);
+    }
+    if (m.outRing) {
+        close_port_ring(&outRing, 1);
+    }
+    if (opt->profileFile) {
+        write_profile(&profile, opt->profileFile, table);
+        free_profile(&profile);
+    }
+    if (opt->cache) {
+        write_cache_report(&cache);
+        free_cache_model(&cache);
+    }
+    if (table) {
+        reader_close(&symbols.file);
+    }
+    jit_free(jit);
+    unload_machine(&m);
+    free(error.buf);
+    if (error.len) {
+        exit(1);
+    }
+}
+
+/******************************************************************************
+ * Snapshots:
+ * A paused machine's registers, pc and memory, to start more runs from.
+ * The memory goes into an anonymous file (memfd) that every restored
+ * machine maps privately, so the kernel shares each page between them
+ * until a run writes to it: N runs from one snapshot take the pages they
+ * change, not N copies. All-zero pages are not written and stay holes.
+ * The decode tables and translated blocks are caches and are not kept;
+ * a restored run rebuilds them as it goes.
+ ******************************************************************************/
+#define SNAPSHOT_PAGE 4096
+
+typedef struct {
+    uint64_t reg[32];
+    uint64_t pc;
+    uint64_t budget;
+    int fd;
+} Snapshot;
+
+// 0 if the memory can't be saved (no memfd), and nothing is kept
+static int snapshot_machine(const Machine *m, Snapshot *s) {
+    static const unsigned char zeroPage[SNAPSHOT_PAGE];
+    int fd = memfd_create("tinker-snapshot", MFD_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    if (ftruncate(fd, MEM_SIZE) != 0) {
+        close(fd);
+        return 0;
+    }
+    for (size_t a = 0; a < MEM_SIZE; a += SNAPSHOT_PAGE) {
+        if (memcmp(m->mem + a, zeroPage, SNAPSHOT_PAGE) &&
+            pwrite(fd, m->mem + a, SNAPSHOT_PAGE, (off_t)a) != SNAPSHOT_PAGE) {
+            close(fd);
+            return 0;
+        }
+    }
+    memcpy(s->reg, m->reg, sizeof(s->reg));
+    s->pc = m->pc;
+    s->budget = m->budget;
+    s->fd = fd;
+    return 1;
+}
+
+// a fresh machine in the snapshot's state, its memory copy-on-write
+static void restore_machine(Machine *m, const Snapshot *s) {
+    memset(m, 0, sizeof(*m));
+    m->in.fd = STDIN_FILENO;
+    memcpy(m->reg, s->reg, sizeof(m->reg));
+    m->pc = s->pc;
+    m->budget = s->budget;
+    m->mem = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, s->fd, 0);
+    if (m->mem == MAP_FAILED) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    m->memMap = m->mem;
+    m->memMapSize = MEM_SIZE;
+}
+
+static void free_snapshot(Snapshot *s) {
+    close(s->fd);
+}
+
+/******************************************************************************
+ * Batch runs (--batch):
+ * Runs every job of a manifest in one process, on a pool of -j threads. A
+ * manifest line is an image (or source file) and optionally a file whose
+ * decimal values `in` reads; blank lines and lines starting with '#' are
+ * skipped. The images are loaded (and assembled) up front, once per
+ * distinct name, then the threads claim jobs in order from a shared
+ * counter, so a thread that finishes early takes the next job instead of
+ * idling. A job's `out` values and its simulation error are captured, and
+ * printed per job in manifest order once all have run:
+ *     ### <manifest line>
+ *     <output>
+ *     ### ok | error | timeout
+ * With --timeout, the main thread stops a job after that many seconds at
+ * its next taken branch (also ending translated blocks); --max-insns stops
+ * one at its limit, also reported as a timeout. The exit status is 0 if
+ * every job reached halt.
+ *
+ * An image named by several jobs is first run once on its own up to its
+ * first `in` (the part that can't depend on the input), and the jobs start
+ * from a snapshot of that point, with its output, instead of from the
+ * entry; a job's timeout counts from there, its instruction limit from the
+ * entry. If that run halts, fails or
+ * times out before any `in`, no job would get further, and they all take
+ * its output and status without running.
+ *
+ * With --lockstep, the jobs of an image run in groups whose lanes step
+ * together (see run_lockstep), a group to a worker.
+ ******************************************************************************/
+typedef enum { JOB_OK, JOB_ERROR, JOB_TIMEOUT } JobStatus;
+
+typedef struct {
+    char *name;             // as given in the manifest
+    Output image;
+    size_t uses;            // jobs running it
+    size_t grouped;         // --lockstep: where its jobs start in Batch.groupJobs, then end
+    int snapped;            // the jobs start from `snapshot`
+    int settled;            // the jobs end as the prefix run did, with `status`
+    Snapshot snapshot;
+    Output prefixOut;       // what the prefix run printed, if either is set
+    JobStatus status;
+    UT_hash_handle hh;
+} BatchImage;
+
+typedef struct {
+    const char *line;       // the manifest line, for the report
+    size_t lineLen;
+    BatchImage *program;
+    int prefix;             // the run that takes program's snapshot
+    InPort input;           // the input file, mapped; empty without one
+    Output out;
+    JobStatus status;
+} BatchJob;
+
+struct Batch;
+
+typedef struct {
+    struct Batch *batch;
+    BatchJob *running;      // the current job, NULL between jobs
+    Machine *machine;       // and what the watchdog stops on a timeout
+    Jit *jit;
+    double deadline;
+    pthread_mutex_t lock;   // guards the four above against the watchdog
+} BatchWorker;
+
+typedef struct Batch {
+    BatchJob *jobs;
+    size_t numJobs;
+    size_t next;            // claimed with an atomic increment
+    int useJit;
+    double timeout;         // seconds, 0 for none
+    uint64_t budget;        // --max-insns per job, NO_BUDGET for none
+    int done;               // workers that ran out of jobs
+    // --lockstep: group i runs the jobs at groupJobs[groups[i]..groups[i + 1])
+    BatchJob **groupJobs;
+    size_t *groups;
+    size_t numGroups;
+} Batch;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// set `m` up to run `job` of `b`; 0 if the job has already ended as its
+// prefix run did
+static int start_batch_job(const Batch *b, BatchJob *job, Machine *m) {
+    BatchImage *program = job->program;
+    open_memory_output(&job->out, 0);
+    if (program->settled) {
+        out_bytes(&job->out, program->prefixOut.buf, program->prefixOut.len);
+        job->status = program->status;
+        return 0;
+    }
+    if (program->snapped) {
+        restore_machine(m, &program->snapshot);
+        out_bytes(&job->out, program->prefixOut.buf, program->prefixOut.len);
+    } else {
+        load_image(m, (const unsigned char *)program->image.buf, program->image.len, -1);
+        m->budget = b->budget;
+    }
+    m->out = &job->out;
+    m->in.p = job->input.p;
+    m->in.end = job->input.end;
+    m->in.fd = -1;
+    m->pauseAtIn = job->prefix;
+    return 1;
+}
+
+// run `job` on `m` (set up by start_batch_job) until it ends, stopping it
+// at `deadline`, and release the machine
+static void finish_batch_job(BatchWorker *w, BatchJob *job, Machine *m, double deadline) {
+    BatchImage *program = job->program;
+    SimTrap trap;
+    Jit *jit = w->batch->useJit ? jit_create(0, w->batch->budget != NO_BUDGET) : NULL;
+    pthread_mutex_lock(&w->lock);
+    w->machine = m;
+    w->jit = jit;
+    w->deadline = deadline;
+    w->running = job;
+    pthread_mutex_unlock(&w->lock);
+    trap.out = &job->out;
+    simTrap = &trap;
+    if (!setjmp(trap.env)) {
+        run_machine(m, jit);
+        job->status = JOB_OK;
+    } else {
+        job->status = __atomic_load_n(&m->stop, __ATOMIC_RELAXED) ? JOB_TIMEOUT : JOB_ERROR;
+    }
+    simTrap = NULL;
+    pthread_mutex_lock(&w->lock);
+    w->running = NULL;
+    pthread_mutex_unlock(&w->lock);
+    if (job->prefix) {
+        program->settled = !m->paused;
+        program->snapped = m->paused && snapshot_machine(m, &program->snapshot);
+        program->status = job->status;
+        program->prefixOut = job->out;
+        job->out.buf = NULL;
+    }
+    jit_free(jit);
+    unload_machine(m);
+}
+
+static void run_batch_job(BatchWorker *w, BatchJob *job) {
+    Machine m;
+    if (start_batch_job(w->batch, job, &m)) {
+        finish_batch_job(w, job, &m, now_seconds() + w->batch->timeout);
+    }
+}
+
+/* Lockstep groups (--lockstep): the jobs of an image run LOCKSTEP_LANES at
+ * a time in step, on one worker. A group keeps every register as a vector
+ * of its lanes' values, so an op that isn't a memory access or a trap is a
+ * few vector instructions for all of them; each lane keeps its own memory,
+ * input and output. Words are decoded once per group from the first lane's
+ * memory, and an ld sequence is one step. A word that some lane has stored
+ * into is compared across the lanes when it is decoded again.
+ * A lane leaves the group wherever it would do something the others don't:
+ * at a branch whose target most of the lanes don't share, or at an
+ * instruction that would fail for it (which then fails in its own run).
+ * The lanes that left, and all of them at a trap the group doesn't run or
+ * a timeout, finish one after the other by themselves, as jobs do without
+ * --lockstep and against the same deadline. The lanes share one
+ * --max-insns budget, charged at taken branches; near its end they leave
+ * to count their own steps. A build for x86-64 picks the
+ * widest vector unit the host has (AVX-512, AVX2 or SSE2) when it starts. */
+#if defined(__GNUC__)
+#define HAVE_LOCKSTEP 1
+#define LOCKSTEP_LANES 8
+
+// registers across the lanes, lane i in element i
+typedef uint64_t LaneWords __attribute__((vector_size(8 * LOCKSTEP_LANES), aligned(8)));
+typedef int64_t LaneInts __attribute__((vector_size(8 * LOCKSTEP_LANES), aligned(8)));
+typedef double LaneDoubles __attribute__((vector_size(8 * LOCKSTEP_LANES), aligned(8)));
+
+#if defined(__x86_64__) && !defined(__clang__)
+#define LOCKSTEP_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define LOCKSTEP_CLONES
+#endif
+
+enum { LS_DECODE = 0, LS_LD = 33, LS_BAD_PC };  // else a MOP_* + 1 (of any 5-bit opcode)
+
+typedef struct {
+    uint8_t op;             // LS_*
+    uint8_t rd, rs, rt;
+    int32_t imm;            // extended as run_machine's
+} LockstepInsn;
+
+typedef struct {
+    LaneWords reg[32];
+    unsigned active;        // lanes still in step
+    unsigned halted;        // lanes that ran to halt in step
+    int lanes;
+    uint64_t budget;        // --max-insns: left before the current straight run
+    Machine m[LOCKSTEP_LANES];
+    LockstepInsn *code;     // per word from CODE_BASE, and LS_BAD_PC behind the last
+    uint64_t *constants;    // of LS_LD entries
+    unsigned char *dirty;   // per word of memory: some lane stored into it
+} Lockstep;
+
+// the lanes in `mask` leave the group to go on by themselves from `pc`,
+// with `budget` instructions left
+static void lockstep_leave(Lockstep *g, unsigned mask, uint64_t pc, uint64_t budget) {
+    mask &= g->active;
+    for (; mask; mask &= mask - 1) {
+        int l = __builtin_ctz(mask);
+        for (int i = 0; i < 32; i++) {
+            g->m[l].reg[i] = g->reg[i][l];
+        }
+        g->m[l].pc = pc;
+        g->m[l].budget = budget;
+        g->active &= ~(1u << l);
+    }
+}
+
+// decode the word at `pc` for the lanes that all have it there (the others
+// leave with `budget`)
+static void lockstep_decode(Lockstep *g, uint64_t pc, uint64_t budget) {
+    const unsigned char *mem = g->m[__builtin_ctz(g->active)].mem;
+    uint32_t w = word_at(mem, pc);
+    if (g->dirty[pc >> 2]) {
+        for (unsigned mask = g->active; mask; mask &= mask - 1) {
+            int l = __builtin_ctz(mask);
+            if (word_at(g->m[l].mem, pc) != w) {
+                lockstep_leave(g, 1u << l, pc, budget);
+            }
+        }
+    }
+    uint64_t idx = (pc - CODE_BASE) >> 2;
+    LockstepInsn *e = &g->code[idx];
+    uint32_t op = w >> 27, L = w & 0xFFF;
+    e->op = (uint8_t)(op + 1);
+    e->rd = w >> 22 & 31;
+    e->rs = w >> 17 & 31;
+    e->rt = w >> 12 & 31;
+    e->imm = op == MOP_BRR_L || op == MOP_MOV_LOAD || op == MOP_MOV_STORE ? (int32_t)simm12(L) : (int32_t)L;
+    if (op == MOP_XOR && e->rd == e->rs && e->rd == e->rt && pc <= MEM_SIZE - 4 * LD_WORDS) {
+        for (int i = 0; i < LD_WORDS; i++) {
+            if (g->dirty[(pc >> 2) + i]) {
+                return;
+            }
+        }
+        if (fused_ld_value(mem, pc, e->rd, &g->constants[idx])) {
+            e->op = LS_LD;
+        }
+    }
+}
+
+// a lane stored 8 bytes at `a`: the words they touch are decoded again
+static void lockstep_stored(Lockstep *g, uint64_t a) {
+    for (uint64_t w = a >> 2; w <= (a + 7) >> 2; w++) {
+        g->dirty[w] = 1;
+        if (w < CODE_BASE / 4) {
+            continue;
+        }
+        uint64_t i = w - CODE_BASE / 4;
+        for (uint64_t j = i + 1; j-- > 0 && j + LD_WORDS > i;) {
+            g->code[j].op = LS_DECODE;
+        }
+    }
+}
+
+// the lanes go on to next[lane]: those whose target most of them share
+// stay, the others leave; returns where the group goes on
+static uint64_t lockstep_diverge(Lockstep *g, const LaneWords *next) {
+    int lead = __builtin_ctz(g->active), best = lead, bestCount = 0;
+    for (unsigned mask = g->active; mask; mask &= mask - 1) {
+        int l = __builtin_ctz(mask), count = 0;
+        for (unsigned other = g->active; other; other &= other - 1) {
+            count += (*next)[__builtin_ctz(other)] == (*next)[l];
+        }
+        if (count > bestCount) {
+            best = l;
+            bestCount = count;
+        }
+        if (2 * count > __builtin_popcount(g->active)) {
+            break;
+        }
+    }
+    uint64_t pc = (*next)[best];
+    for (unsigned mask = g->active; mask; mask &= mask - 1) {
+        int l = __builtin_ctz(mask);
+        if ((*next)[l] != pc) {
+            lockstep_leave(g, 1u << l, (*next)[l], g->budget);
+        }
+    }
+    return pc;
+}
+
+// a taken branch to next[lane], ending a run of `words`; returns where the
+// group goes on
+static inline uint64_t lockstep_branch(Lockstep *g, const LaneWords *next, uint64_t words) {
+    g->budget -= words;
+    uint64_t pc = (*next)[__builtin_ctz(g->active)];
+    unsigned same = 0;
+    for (int l = 0; l < LOCKSTEP_LANES; l++) {
+        same |= (unsigned)((*next)[l] == pc) << l;
+    }
+    if ((same & g->active) != g->active) {
+        pc = lockstep_diverge(g, next);
+    }
+    if (__atomic_load_n(&g->m[0].stop, __ATOMIC_RELAXED)) {
+        // timed out: each lane stops at its next taken branch by itself
+        for (unsigned mask = g->active; mask; mask &= mask - 1) {
+            g->m[__builtin_ctz(mask)].stop = 1;
+        }
+        lockstep_leave(g, g->active, pc, g->budget);
+    }
+    return pc;
+}
+
+// run the group's lanes in step from `pc` until none is left
+LOCKSTEP_CLONES static void run_lockstep_lanes(Lockstep *g, uint64_t pc) {
+    LaneWords *r = g->reg, next;
+    const LockstepInsn *e;
+    uint64_t idx, a, v, runIdx;
+#define RD r[e->rd]
+#define RS r[e->rs]
+#define RT r[e->rt]
+#define LANES(l) for (unsigned mask_ = g->active, l; mask_ && (l = (unsigned)__builtin_ctz(mask_), 1); mask_ &= mask_ - 1)
+// the budget left before the instruction at idx
+#define LEFT() (g->budget - (idx - runIdx))
+#define LEAVE(l) lockstep_leave(g, 1u << (l), pc, LEFT())
+#define BRANCH() do { \
+        pc = lockstep_branch(g, &next, idx - runIdx + 1); \
+        goto jump; \
+    } while (0)
+// after an op some lanes may have left at
+#define ANY_LEFT() do { \
+        if (!g->active) { \
+            return; \
+        } \
+    } while (0)
+#define DOUBLES(x) ((LaneDoubles)(x))
+jump:
+    // pc is a branch target: the word after one is checked by the entry behind the last
+    ANY_LEFT();
+    idx = runIdx = (pc - CODE_BASE) >> 2;
+    // the run could outlast the budget: the lanes count their own steps
+    if ((pc & 3) || idx >= NUM_DECODED || g->budget < NUM_DECODED - idx) {
+        lockstep_leave(g, g->active, pc, g->budget);
+        return;
+    }
+    for (;;) {
+        e = &g->code[idx];
+        switch (e->op) {
+        case LS_DECODE: lockstep_decode(g, pc, LEFT()); continue;
+        case LS_BAD_PC: lockstep_leave(g, g->active, pc, LEFT()); return;
+        case LS_LD:
+            RD = (LaneWords){0} + g->constants[idx];
+            pc += 4 * LD_WORDS;
+            idx += LD_WORDS;
+            continue;
+        case MOP_AND + 1: RD = RS & RT; break;
+        case MOP_OR + 1: RD = RS | RT; break;
+        case MOP_XOR + 1: RD = RS ^ RT; break;
+        case MOP_NOT + 1: RD = ~RS; break;
+        case MOP_SHFTR + 1: RD = (RS >> (RT & 63)) & (LaneWords)(RT < 64); break;
+        case MOP_SHFTRI + 1: RD = e->imm < 64 ? RD >> e->imm : (LaneWords){0}; break;
+        case MOP_SHFTL + 1: RD = (RS << (RT & 63)) & (LaneWords)(RT < 64); break;
+        case MOP_SHFTLI + 1: RD = e->imm < 64 ? RD << e->imm : (LaneWords){0}; break;
+        case MOP_BR + 1: next = RD; BRANCH();
+        case MOP_BRR_R + 1: next = pc + RD; BRANCH();
+        case MOP_BRR_L + 1: next = (LaneWords){0} + (pc + (uint64_t)(int64_t)e->imm); BRANCH();
+        case MOP_BRNZ + 1: case MOP_BRGT + 1: {
+            LaneWords taken = e->op == MOP_BRNZ + 1 ? (LaneWords)(RS != 0) : (LaneWords)((LaneInts)RS > (LaneInts)RT);
+            next = (RD & taken) | ((pc + 4) & ~taken);
+            BRANCH();
+        }
+        case MOP_CALL + 1:
+            LANES(l) {
+                if ((a = r[31][l] - 8) > MEM_SIZE - 8) {
+                    LEAVE(l);
+                    continue;
                 }
-                imm = entry->address;
-            } else {
-                errno = 0;
-                char *endptr = NULL;
-                uint64_t tmpVal = strtoull(immBuf, &endptr, 0);
-                if (errno == ERANGE) {
-                    fprintf(stderr, "Error: 'ld' immediate out of 64-bit range => %s\n", immBuf);
-                    regfree(&regex);
-                    return;
+                v = pc + 4;
+                memcpy(g->m[l].mem + a, &v, 8);
+                lockstep_stored(g, a);
+            }
+            ANY_LEFT();
+            next = RD;
+            BRANCH();
+        case MOP_RETURN + 1:
+            LANES(l) {
+                if ((a = r[31][l] - 8) > MEM_SIZE - 8) {
+                    LEAVE(l);
+                    continue;
+                }
+                memcpy(&v, g->m[l].mem + a, 8);
+                next[l] = v;
+            }
+            ANY_LEFT();
+            BRANCH();
+        case MOP_PRIV + 1:
+            if (e->imm == 0) {
+                // halt
+                for (unsigned mask = g->active; mask; mask &= mask - 1) {
+                    g->m[__builtin_ctz(mask)].pc = pc;
+                }
+                g->halted |= g->active;
+                g->active = 0;
+                return;
+            }
+            if (e->imm == 3) {
+                // in
+                LANES(l) {
+                    if (RS[l] != 0 || !in_value(&g->m[l].in, &v)) {
+                        LEAVE(l);
+                        continue;
+                    }
+                    RD[l] = v;
+                }
+                ANY_LEFT();
+                break;
+            }
+            if (e->imm == 4) {
+                // out
+                LANES(l) {
+                    if (RD[l] != 1) {
+                        LEAVE(l);
+                        continue;
+                    }
+                    char buf[24], *text = format_value_line(buf + sizeof(buf), RS[l]);
+                    out_bytes(g->m[l].out, text, (size_t)(buf + sizeof(buf) - text));
+                }
+                ANY_LEFT();
+                break;
+            }
+            lockstep_leave(g, g->active, pc, LEFT());
+            return;
+        case MOP_MOV_LOAD + 1:
+            LANES(l) {
+                if ((a = RS[l] + (uint64_t)(int64_t)e->imm) > MEM_SIZE - 8) {
+                    LEAVE(l);
+                    continue;
+                }
+                memcpy(&v, g->m[l].mem + a, 8);
+                RD[l] = v;
+            }
+            ANY_LEFT();
+            break;
+        case MOP_MOV_RR + 1: RD = RS; break;
+        case MOP_MOV_RL + 1: RD = (RD & ~(uint64_t)0xFFF) | (uint64_t)e->imm; break;
+        case MOP_MOV_STORE + 1:
+            LANES(l) {
+                if ((a = RD[l] + (uint64_t)(int64_t)e->imm) > MEM_SIZE - 8) {
+                    LEAVE(l);
+                    continue;
+                }
+                v = RS[l];
+                memcpy(g->m[l].mem + a, &v, 8);
+                lockstep_stored(g, a);
+            }
+            ANY_LEFT();
+            break;
+        case MOP_ADDF + 1: RD = (LaneWords)(DOUBLES(RS) + DOUBLES(RT)); break;
+        case MOP_SUBF + 1: RD = (LaneWords)(DOUBLES(RS) - DOUBLES(RT)); break;
+        case MOP_MULF + 1: RD = (LaneWords)(DOUBLES(RS) * DOUBLES(RT)); break;
+        case MOP_DIVF + 1:
+            LANES(l) {
+                if (as_double(RT[l]) == 0.0) {
+                    LEAVE(l);
+                    continue;
+                }
+                RD[l] = from_double(as_double(RS[l]) / as_double(RT[l]));
+            }
+            ANY_LEFT();
+            break;
+        case MOP_ADD + 1: RD = RS + RT; break;
+        case MOP_ADDI + 1: RD += (uint64_t)e->imm; break;
+        case MOP_SUB + 1: RD = RS - RT; break;
+        case MOP_SUBI + 1: RD -= (uint64_t)e->imm; break;
+        case MOP_MUL + 1: RD = RS * RT; break;
+        case MOP_DIV + 1:
+            LANES(l) {
+                if (!RT[l]) {
+                    LEAVE(l);
+                    continue;
+                }
+                RD[l] = (int64_t)RT[l] == -1 ? -RS[l] : (uint64_t)((int64_t)RS[l] / (int64_t)RT[l]);
+            }
+            ANY_LEFT();
+            break;
+        default:
+            // illegal words
+            lockstep_leave(g, g->active, pc, LEFT());
+            return;
+        }
+        pc += 4;
+        idx++;
+    }
+#undef DOUBLES
+#undef ANY_LEFT
+#undef BRANCH
+#undef LEAVE
+#undef LEFT
+#undef LANES
+#undef RT
+#undef RS
+#undef RD
+}
+
+// run the `n` jobs (of one image, at most LOCKSTEP_LANES) as a group
+static void run_lockstep(BatchWorker *w, BatchJob **jobs, size_t n) {
+    Lockstep *g = calloc(1, sizeof(Lockstep));
+    BatchJob *laneJobs[LOCKSTEP_LANES];
+    if (!g) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (start_batch_job(w->batch, jobs[i], &g->m[g->lanes])) {
+            laneJobs[g->lanes++] = jobs[i];
+        }
+    }
+    double deadline = now_seconds() + w->batch->timeout;
+    if (g->lanes > 1) {
+        // the lanes start alike, from the image or the snapshot
+        for (int i = 0; i < 32; i++) {
+            g->reg[i] = (LaneWords){0} + g->m[0].reg[i];
+        }
+        g->active = (1u << g->lanes) - 1;
+        g->budget = g->m[0].budget;
+        g->code = map_zeroed((NUM_DECODED + 1) * sizeof(LockstepInsn));
+        g->code[NUM_DECODED].op = LS_BAD_PC;
+        g->constants = map_zeroed(NUM_DECODED * sizeof(uint64_t));
+        g->dirty = map_zeroed(MEM_SIZE / 4);
+        pthread_mutex_lock(&w->lock);
+        w->machine = &g->m[0];
+        w->jit = NULL;
+        w->deadline = deadline;
+        w->running = laneJobs[0];
+        pthread_mutex_unlock(&w->lock);
+        run_lockstep_lanes(g, g->m[0].pc);
+        pthread_mutex_lock(&w->lock);
+        w->running = NULL;
+        pthread_mutex_unlock(&w->lock);
+        munmap(g->code, (NUM_DECODED + 1) * sizeof(LockstepInsn));
+        munmap(g->constants, NUM_DECODED * sizeof(uint64_t));
+        munmap(g->dirty, MEM_SIZE / 4);
+    }
+    for (int l = 0; l < g->lanes; l++) {
+        if (g->halted >> l & 1) {
+            laneJobs[l]->status = JOB_OK;
+            unload_machine(&g->m[l]);
+        } else {
+            finish_batch_job(w, laneJobs[l], &g->m[l], deadline);
+        }
+    }
+    free(g);
+}
+#endif
+
+static void *batch_worker(void *arg) {
+    BatchWorker *w = arg;
+    Batch *b = w->batch;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= (b->groups ? b->numGroups : b->numJobs)) {
+            __atomic_add_fetch(&b->done, 1, __ATOMIC_RELEASE);
+            return NULL;
+        }
+#ifdef HAVE_LOCKSTEP
+        if (b->groups) {
+            run_lockstep(w, b->groupJobs + b->groups[i], b->groups[i + 1] - b->groups[i]);
+            continue;
+        }
+#endif
+        run_batch_job(w, &b->jobs[i]);
+    }
+}
+
+// stop the jobs that ran past their deadline until all workers are done
+static void watch_batch(Batch *b, BatchWorker *workers, int numWorkers) {
+    const struct timespec tick = { 0, 10 * 1000 * 1000 };
+    while (__atomic_load_n(&b->done, __ATOMIC_ACQUIRE) < numWorkers) {
+        nanosleep(&tick, NULL);
+        double now = now_seconds();
+        for (int i = 0; i < numWorkers; i++) {
+            BatchWorker *w = &workers[i];
+            pthread_mutex_lock(&w->lock);
+            if (w->running && now > w->deadline) {
+                __atomic_store_n(&w->machine->stop, 1, __ATOMIC_RELAXED);
+                if (w->jit) {
+                    __atomic_store_n(&w->jit->stop, 1, __ATOMIC_RELAXED);
+                }
+            }
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+}
+
+// run all of b's jobs on up to `jobs` threads
+static void run_batch_jobs(Batch *b, int jobs) {
+    size_t items = b->groups ? b->numGroups : b->numJobs;
+    int numWorkers = (size_t)jobs < items ? jobs : (int)items;
+    BatchWorker *workers = calloc((size_t)numWorkers + 1, sizeof(BatchWorker));
+    pthread_t *threads = malloc(((size_t)numWorkers + 1) * sizeof(pthread_t));
+    if (!workers || !threads) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    int started = 0;
+    for (; started < numWorkers; started++) {
+        workers[started].batch = b;
+        pthread_mutex_init(&workers[started].lock, NULL);
+        if (pthread_create(&threads[started], NULL, batch_worker, &workers[started]) != 0) {
+            pthread_mutex_destroy(&workers[started].lock);
+            break;
+        }
+    }
+    if (started == 0 && items) {
+        // no threads available: run the jobs here, without timeouts
+        workers[0].batch = b;
+        pthread_mutex_init(&workers[0].lock, NULL);
+        batch_worker(&workers[0]);
+        pthread_mutex_destroy(&workers[0].lock);
+    } else if (b->timeout > 0) {
+        watch_batch(b, workers, started);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    free(threads);
+    free(workers);
+}
+
+// the loaded image called `name`, loading it on first use
+static BatchImage *batch_image(BatchImage **images, const char *name) {
+    BatchImage *program;
+    HASH_FIND_STR(*images, name, program);
+    if (!program) {
+        program = calloc(1, sizeof(BatchImage));
+        if (!program || !(program->name = strdup(name))) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(1);
+        }
+        load_program(name, &program->image, NULL);
+        free_hashmap();
+        free_segments();
+        HASH_ADD_KEYPTR(hh, *images, program->name, strlen(program->name), program);
+    }
+    program->uses++;
+    return program;
+}
+
+#ifdef HAVE_LOCKSTEP
+// --lockstep: b's jobs in groups of up to LOCKSTEP_LANES of the same image
+static void group_batch(Batch *b, BatchImage *images) {
+    BatchImage *program, *tmp;
+    b->groupJobs = malloc((b->numJobs + 1) * sizeof(BatchJob *));
+    b->groups = malloc((b->numJobs + 1) * sizeof(size_t));
+    if (!b->groupJobs || !b->groups) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    size_t at = 0;
+    HASH_ITER(hh, images, program, tmp) {
+        program->grouped = at;
+        at += program->uses;
+    }
+    for (size_t i = 0; i < b->numJobs; i++) {
+        b->groupJobs[b->jobs[i].program->grouped++] = &b->jobs[i];
+    }
+    at = 0;
+    HASH_ITER(hh, images, program, tmp) {
+        for (; at < program->grouped; at += LOCKSTEP_LANES) {
+            b->groups[b->numGroups++] = at;
+        }
+        at = program->grouped;
+    }
+    b->groups[b->numGroups] = b->numJobs;
+}
+#endif
+
+static void run_batch(const char *manifest, int jobs, int useJit, double timeout, uint64_t budget, int lockstep) {
+    LineReader fin;
+    if (!reader_open(&fin, manifest)) {
+        perror("open manifest");
+        exit(1);
+    }
+    reader_slurp(&fin);
+    Batch b = { NULL, 0, 0, useJit, timeout, budget, 0, NULL, NULL, 0 };
+    BatchImage *images = NULL, *program, *tmp;
+    size_t cap = 0;
+    const char *line;
+    size_t len;
+    while (next_line(&fin, &line, &len)) {
+        if (!len || line[0] == '#') {
+            continue;
+        }
+        // image, then optionally the input file
+        char text[8192], image[4096], input[4096];
+        if (len >= sizeof(text)) {
+            fprintf(stderr, "Error: manifest line too long => %.60s...\n", line);
+            exit(1);
+        }
+        memcpy(text, line, len);
+        text[len] = '\0';
+        int fields = sscanf(text, "%4095s %4095s", image, input);
+        b.jobs = grow_array(b.jobs, &cap, b.numJobs + 1, sizeof(BatchJob));
+        BatchJob *job = &b.jobs[b.numJobs++];
+        memset(job, 0, sizeof(*job));
+        job->line = line;
+        job->lineLen = len;
+        job->program = batch_image(&images, image);
+        job->input.fd = -1;
+        if (fields == 2) {
+            open_input_port(&job->input, input);
+            if (job->input.fd >= 0) {
+                fprintf(stderr, "Error: batch input '%s' is not a regular file\n", input);
+                exit(1);
+            }
+        }
+    }
+
+    // snapshots first, for the images that more than one job runs
+    Batch prefixes = { NULL, 0, 0, useJit, timeout, budget, 0, NULL, NULL, 0 };
+    size_t prefixCap = 0;
+    HASH_ITER(hh, images, program, tmp) {
+        if (program->uses > 1) {
+            prefixes.jobs = grow_array(prefixes.jobs, &prefixCap, prefixes.numJobs + 1, sizeof(BatchJob));
+            BatchJob *job = &prefixes.jobs[prefixes.numJobs++];
+            memset(job, 0, sizeof(*job));
+            job->program = program;
+            job->prefix = 1;
+        }
+    }
+    run_batch_jobs(&prefixes, jobs);
+    for (size_t i = 0; i < prefixes.numJobs; i++) {
+        free(prefixes.jobs[i].out.buf);
+    }
+    free(prefixes.jobs);
+#ifdef HAVE_LOCKSTEP
+    if (lockstep) {
+        group_batch(&b, images);
+    }
+#else
+    (void)lockstep;
+#endif
+    run_batch_jobs(&b, jobs);
+
+    static const char *statusNames[] = { "ok", "error", "timeout" };
+    int failed = 0;
+    for (size_t i = 0; i < b.numJobs; i++) {
+        BatchJob *job = &b.jobs[i];
+        printf("### %.*s\n", (int)job->lineLen, job->line);
+        fwrite(job->out.buf, 1, job->out.len, stdout);
+        printf("### %s\n", statusNames[job->status]);
+        failed |= job->status != JOB_OK;
+        free(job->out.buf);
+        close_input_port(&job->input);
+    }
+    fflush(stdout);
+    HASH_ITER(hh, images, program, tmp) {
+        HASH_DEL(images, program);
+        if (program->snapped) {
+            free_snapshot(&program->snapshot);
+        }
+        free(program->prefixOut.buf);
+        free(program->image.buf);
+        free(program->name);
+        free(program);
+    }
+    free(b.jobs);
+    free(b.groupJobs);
+    free(b.groups);
+    reader_close(&fin);
+    if (failed) {
+        exit(1);
+    }
+}
+
+/******************************************************************************
+ * Batch assembly (--batch --assemble):
+ * Assembles every job of a manifest in one process, on a pool of -j threads,
+ * with the options given (-b, -s, -O, --pool, -l or -c). A manifest line is
+ * an input file and the output to write; blank lines and lines starting
+ * with '#' are skipped. The threads claim jobs in order from a shared
+ * counter, and each assembles its jobs one after another on its own label
+ * table, arena, segments and IR, which a job leaves empty for the next.
+ * A job's messages are collected, and printed to stderr in manifest order
+ * once all have run, for the jobs that printed any or failed:
+ *     ### <manifest line>
+ *     <messages>
+ *     ### ok | error
+ * A failed job ends alone, leaving what it wrote (as a failed hw4 does);
+ * its output and IR are released, smaller buffers it held may not be. The
+ * exit status is 0 if every job succeeded.
+ ******************************************************************************/
+
+typedef struct {
+    const char *line;       // the manifest line, for the report
+    size_t lineLen;
+    char *input;
+    char *output;
+    char *messages;         // what the job printed
+    size_t messagesLen;
+    int failed;
+} AsmJob;
+
+typedef struct {
+    AsmJob *jobs;
+    size_t numJobs;
+    size_t next;            // claimed with an atomic increment
+    const AsmOptions *options;
+} AsmBatch;
+
+// assemble one job as main would, on this thread's tables
+static void run_asm_job(const AsmOptions *o, AsmJob *job) {
+    AsmTrap trap;
+    diagStream = open_memstream(&job->messages, &job->messagesLen);
+    if (!diagStream) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    trap.outFd = -1;
+    trap.outBuf = NULL;
+    asmTrap = &trap;
+    if (!setjmp(trap.env)) {
+        if (o->object) {
+            assemble_object(job->input, job->output, o->optimize);
+        } else if (o->singlePass || o->optimize || o->listing) {
+            single_pass(job->input, job->output, o);
+        } else {
+            pass1(job->input);
+            pass2(job->output, o->binary, 0);
+        }
+    } else {
+        job->failed = 1;
+        if (trap.outFd >= 0) {
+            close(trap.outFd);
+            free(trap.outBuf);
+        }
+        free_ir();
+    }
+    asmTrap = NULL;
+    fclose(diagStream);
+    diagStream = NULL;
+    free_hashmap();
+    free_segments();
+}
+
+static void *asm_batch_worker(void *arg) {
+    AsmBatch *b = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->numJobs) {
+            return NULL;
+        }
+        run_asm_job(b->options, &b->jobs[i]);
+    }
+}
+
+#define READAHEAD_JOBS_PER_THREAD 2
+#define READAHEAD_PIECE (1 << 20)
+#define READAHEAD_MAX ((off_t)256 << 20)   // of one input
+
+// the main thread's part while the workers run: the inputs of the next
+// jobs into the page cache, see "Asynchronous I/O"
+static void batch_readahead(AsmBatch *b, int threads) {
+    Uring ring;
+    char *scratch = NULL;
+    if (uring_open(&ring)) {
+        scratch = malloc(READAHEAD_PIECE);
+        if (!scratch) {
+            uring_close(&ring);
+        }
+#ifdef HAVE_IO_URING
+        else if (!uring_register(&ring, scratch, READAHEAD_PIECE)) {
+            free(scratch);
+            uring_close(&ring);
+        }
+#endif
+    }
+    size_t ahead = (size_t)threads * READAHEAD_JOBS_PER_THREAD;
+    for (size_t i = 0; i < b->numJobs; i++) {
+        while (i >= __atomic_load_n(&b->next, __ATOMIC_RELAXED) + ahead) {
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+        }
+        if (i < __atomic_load_n(&b->next, __ATOMIC_RELAXED)) {
+            continue;   // a worker has it already
+        }
+        int fd = open(b->jobs[i].input, O_RDONLY);
+        struct stat st;
+        if (fd < 0) {
+            continue;   // the job reports it
+        }
+        if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            close(fd);
+            continue;
+        }
+        off_t size = st.st_size < READAHEAD_MAX ? st.st_size : READAHEAD_MAX;
+        if (ring.fd < 0) {
+            posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+            close(fd);
+            continue;
+        }
+#ifdef HAVE_IO_URING
+        for (off_t at = 0; at < size; at += READAHEAD_PIECE) {
+            uint64_t data;
+            int32_t res;
+            while (uring_full(&ring)) {
+                if (uring_enter(&ring, 1) < 0) {
+                    break;
+                }
+                while (uring_reap(&ring, &data, &res)) {
+                }
+            }
+            if (uring_full(&ring)) {
+                break;
+            }
+            size_t n = size - at < READAHEAD_PIECE ? (size_t)(size - at) : READAHEAD_PIECE;
+            uring_queue(&ring, IORING_OP_READ_FIXED, fd, scratch, n, (uint64_t)at, 0);
+        }
+        // the ring holds the file from submission on
+        uring_enter(&ring, 0);
+#endif
+        close(fd);
+    }
+#ifdef HAVE_IO_URING
+    while (ring.fd >= 0 && ring.pending + ring.inFlight) {
+        uint64_t data;
+        int32_t res;
+        if (uring_enter(&ring, 1) < 0) {
+            break;
+        }
+        while (uring_reap(&ring, &data, &res)) {
+        }
+    }
+#endif
+    uring_close(&ring);
+    free(scratch);
+}
+
+static void assemble_batch(const char *manifest, int jobs, const AsmOptions *options) {
+    LineReader fin;
+    if (!reader_open(&fin, manifest)) {
+        perror("open manifest");
+        exit(1);
+    }
+    reader_slurp(&fin);
+    AsmBatch b = { NULL, 0, 0, options };
+    size_t cap = 0;
+    const char *line;
+    size_t len;
+    while (next_line(&fin, &line, &len)) {
+        if (!len || line[0] == '#') {
+            continue;
+        }
+        char text[8192], input[4096], output[4096];
+        if (len >= sizeof(text)) {
+            fprintf(stderr, "Error: manifest line too long => %.60s...\n", line);
+            exit(1);
+        }
+        memcpy(text, line, len);
+        text[len] = '\0';
+        if (sscanf(text, "%4095s %4095s", input, output) != 2 || !strcmp(input, "-") || !strcmp(output, "-")) {
+            fprintf(stderr, "Error: a manifest line is an input file and an output file => %s\n", text);
+            exit(1);
+        }
+        b.jobs = grow_array(b.jobs, &cap, b.numJobs + 1, sizeof(AsmJob));
+        AsmJob *job = &b.jobs[b.numJobs++];
+        memset(job, 0, sizeof(*job));
+        job->line = line;
+        job->lineLen = len;
+        job->input = strdup(input);
+        job->output = strdup(output);
+        if (!job->input || !job->output) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(1);
+        }
+    }
+
+    int numThreads = (size_t)jobs < b.numJobs ? jobs : (int)b.numJobs;
+    pthread_t *threads = malloc(((size_t)numThreads + 1) * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    int started = 0;
+    for (; started < numThreads; started++) {
+        if (pthread_create(&threads[started], NULL, asm_batch_worker, &b) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        asm_batch_worker(&b);   // no threads available, do the work here
+    } else {
+        batch_readahead(&b, started);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    int failed = 0;
+    for (size_t i = 0; i < b.numJobs; i++) {
+        AsmJob *job = &b.jobs[i];
+        if (job->messagesLen || job->failed) {
+            fprintf(stderr, "### %.*s\n", (int)job->lineLen, job->line);
+            fwrite(job->messages, 1, job->messagesLen, stderr);
+            fprintf(stderr, "### %s\n", job->failed ? "error" : "ok");
+        }
+        failed |= job->failed;
+        free(job->messages);
+        free(job->input);
+        free(job->output);
+    }
+    free(b.jobs);
+    reader_close(&fin);
+    if (failed) {
+        exit(1);
+    }
+}
+
+/******************************************************************************
+ * Assembler server (--serve SOCKET):
+ * Listens on a Unix socket and keeps, for every input and output pair it
+ * was asked about, the block cache of the last build in memory, so a
+ * rebuild skips both starting hw4 and reading and writing the cache file,
+ * and only sizes and expands the blocks that changed (see --cache). A
+ * client sends one line, with paths relative to the server's directory:
+ *     build <input> <output>   assemble once, then the connection closes
+ *     watch <input> <output>   assemble now and whenever the input is
+ *                              saved again, until the client hangs up
+ * and gets a report per build, its messages and then a status line:
+ *     ### ok | error <milliseconds> ms
+ * Saves are seen through inotify on the input's directory (an editor may
+ * replace the file rather than write it). -b and -j apply to every build.
+ * hw4 --connect SOCKET [--watch] <input> <output> is a client.
+ ******************************************************************************/
+#define SERVE_MAX_REQUEST 8192
+
+typedef struct Project {
+    char *key;              // "<input>\n<output>"
+    char *input;
+    char *output;
+    const char *name;       // input's file name, within `input`
+    int wd;                 // inotify watch on its directory, -1 if none
+    Output image;           // the last build's cache image
+    BlockCache cache;       // indexing `image`
+    int *watchers;          // client sockets that asked to watch
+    size_t numWatchers, capWatchers;
+    UT_hash_handle hh;
+} Project;
+
+typedef struct {
+    int binary;
+    int jobs;
+    int listenFd;
+    int inotifyFd;
+    Project *projects;
+} Server;
+
+// send all of `n` bytes to a client; 0 if it went away
+static int send_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return 0;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 1;
+}
+
+// the part of a build that may fail(), back to its setjmp; returns 1 if
+// the output was written
+static int build_trapped(Server *srv, Project *p, AsmTrap *trap, LineReader *fin, BlockBuild *build) {
+    if (setjmp(trap->env)) {
+        return 0;
+    }
+    if (!reader_open(fin, p->input)) {
+        diag_errno("open input");
+        return 0;
+    }
+    reader_slurp(fin);
+    if (has_includes(fin->data, fin->size)) {
+        // sequentially, past the block cache, but with the server's units
+        ir.source = *fin;
+        ir.haveSource = 1;
+        memset(fin, 0, sizeof(*fin));
+        fin->fd = -1;
+        pass1_source();
+        pass2(p->output, srv->binary, 0);
+        return 1;
+    }
+    if (!build_blocks(build, fin, &p->cache, srv->binary, srv->jobs)) {
+        return 0;
+    }
+    Output out;
+    if (!open_output(&out, p->output, srv->binary, 0)) {
+        diag_errno("fopen output");
+        return 0;
+    }
+    emit_blocks(build, &out);
+    if (build->changed && !(srv->binary && out.errors)) {
+        // the new image copies what it keeps from the old one
+        Output image;
+        open_memory_output(&image, 0);
+        write_cache(&image, build->blocks, build->numBlocks, srv->binary);
+        free_cache(&p->cache);
+        free(p->image.buf);
+        p->image = image;
+        memset(&p->cache, 0, sizeof(p->cache));
+        reader_view(&p->cache.file, image.buf, image.len);
+        parse_cache(&p->cache);
+    }
+    close_output(&out, p->output);
+    return 1;
+}
+
+// rebuild p and send the report to `fds`; returns, per client, whether it
+// is still there in alive[] (may be NULL)
+static void build_project(Server *srv, Project *p, const int *fds, size_t numFds, int *alive) {
+    double start = now_seconds();
+    char *messages = NULL;
+    size_t messagesLen = 0;
+    diagStream = open_memstream(&messages, &messagesLen);
+    if (!diagStream) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    AsmTrap trap;
+    trap.outFd = -1;
+    trap.outBuf = NULL;
+    asmTrap = &trap;
+    LineReader fin;
+    memset(&fin, 0, sizeof(fin));
+    fin.fd = -1;
+    BlockBuild build;
+    memset(&build, 0, sizeof(build));
+    int ok = build_trapped(srv, p, &trap, &fin, &build);
+    asmTrap = NULL;
+    if (trap.outFd >= 0) {
+        close(trap.outFd);
+        free(trap.outBuf);
+    }
+    free_blocks(&build);
+    reader_close(&fin);
+    free_ir();
+    free_hashmap();
+    free_segments();
+    fprintf(diagStream, "### %s %.2f ms\n", ok ? "ok" : "error", (now_seconds() - start) * 1000);
+    fclose(diagStream);
+    diagStream = NULL;
+    for (size_t i = 0; i < numFds; i++) {
+        int sent = send_all(fds[i], messages, messagesLen);
+        if (alive) {
+            alive[i] = sent;
+        }
+    }
+    free(messages);
+}
+
+// the project for an input and output, set up on first use
+static Project *find_project(Server *srv, const char *input, const char *output) {
+    size_t inLen = strlen(input), outLen = strlen(output);
+    // the key, then input and output again as strings of their own
+    char *key = malloc(2 * (inLen + outLen + 2));
+    if (!key) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    memcpy(key, input, inLen);
+    key[inLen] = '\n';
+    memcpy(key + inLen + 1, output, outLen + 1);
+    Project *p;
+    HASH_FIND_STR(srv->projects, key, p);
+    if (p) {
+        free(key);
+        return p;
+    }
+    p = calloc(1, sizeof(Project));
+    if (!p) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    p->key = key;
+    p->input = key + inLen + outLen + 2;
+    memcpy(p->input, key, inLen + outLen + 2);
+    p->input[inLen] = '\0';
+    p->output = p->input + inLen + 1;
+    const char *slash = strrchr(p->input, '/');
+    p->name = slash ? slash + 1 : p->input;
+    p->wd = -1;
+    p->cache.file.fd = -1;
+    open_memory_output(&p->image, 0);
+    HASH_ADD_KEYPTR(hh, srv->projects, p->key, strlen(p->key), p);
+    return p;
+}
+
+// watch the directory p's input is in
+static void watch_project(Server *srv, Project *p) {
+    if (p->wd >= 0) {
+        return;
+    }
+    size_t dirLen = (size_t)(p->name - p->input);
+    char *dir = strdup(dirLen ? p->input : ".");
+    if (!dir) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    if (dirLen > 1) {
+        dir[dirLen - 1] = '\0';   // without the trailing slash
+    } else if (dirLen == 1) {
+        dir[1] = '\0';            // the root
+    }
+    p->wd = inotify_add_watch(srv->inotifyFd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (p->wd < 0) {
+        perror("inotify_add_watch");
+    }
+    free(dir);
+}
+
+static void drop_watcher(Project *p, size_t i) {
+    close(p->watchers[i]);
+    p->watchers[i] = p->watchers[--p->numWatchers];
+}
+
+// build the projects with new inputs, once each however many events
+static void serve_events(Server *srv) {
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    Project *p, *tmp;
+    ssize_t n;
+    while ((n = read(srv->inotifyFd, buf, sizeof(buf))) > 0) {
+        for (char *q = buf; q < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)q;
+            q += sizeof(*ev) + ev->len;
+            HASH_ITER(hh, srv->projects, p, tmp) {
+                if (p->wd == ev->wd && ev->len && p->numWatchers && !strcmp(ev->name, p->name)) {
+                    p->wd = -p->wd - 2;     // due for a build; restored below
+                }
+            }
+        }
+    }
+    HASH_ITER(hh, srv->projects, p, tmp) {
+        if (p->wd < -1) {
+            p->wd = -p->wd - 2;
+            int *alive = malloc(p->numWatchers * sizeof(int));
+            if (!alive) {
+                fprintf(stderr, "Error: out of memory.\n");
+                exit(1);
+            }
+            size_t num = p->numWatchers;
+            build_project(srv, p, p->watchers, num, alive);
+            for (size_t i = num; i-- > 0;) {
+                if (!alive[i]) {
+                    drop_watcher(p, i);
+                }
+            }
+            free(alive);
+        }
+    }
+}
+
+// a request from a new client: build, or build and watch
+static void serve_client(Server *srv, int fd) {
+    char request[SERVE_MAX_REQUEST], input[4096], output[4096], verb[16];
+    size_t len = 0;
+    while (len < sizeof(request) - 1 && !memchr(request, '\n', len)) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    request[len] = '\0';
+    if (sscanf(request, "%15s %4095s %4095s", verb, input, output) != 3 ||
+        (strcmp(verb, "build") && strcmp(verb, "watch"))) {
+        static const char bad[] = "Error: the request is 'build|watch <input> <output>'\n### error 0.00 ms\n";
+        send_all(fd, bad, sizeof(bad) - 1);
+        close(fd);
+        return;
+    }
+    Project *p = find_project(srv, input, output);
+    int watch = !strcmp(verb, "watch");
+    if (watch) {
+        watch_project(srv, p);
+    }
+    int alive;
+    build_project(srv, p, &fd, 1, &alive);
+    if (watch && alive) {
+        p->watchers = grow_array(p->watchers, &p->capWatchers, p->numWatchers + 1, sizeof(int));
+        p->watchers[p->numWatchers++] = fd;
+    } else {
+        close(fd);
+    }
+}
+
+static void serve(const char *socketPath, int binary, int jobs) {
+    Server srv = { binary, jobs, -1, -1, NULL };
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long => %s\n", socketPath);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socketPath);
+    srv.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    srv.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (srv.listenFd < 0 || srv.inotifyFd < 0) {
+        perror("serve");
+        exit(1);
+    }
+    unlink(socketPath);     // left behind by an earlier server
+    if (bind(srv.listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(srv.listenFd, 64) < 0) {
+        perror("serve: bind");
+        exit(1);
+    }
+    struct pollfd *fds = NULL;
+    Project **owners = NULL;
+    size_t cap = 0, ownerCap = 0;
+    for (;;) {
+        // the socket, inotify, and every watching client (to see it hang up)
+        size_t n = 2;
+        Project *p, *tmp;
+        HASH_ITER(hh, srv.projects, p, tmp) {
+            n += p->numWatchers;
+        }
+        fds = grow_array(fds, &cap, n, sizeof(struct pollfd));
+        owners = grow_array(owners, &ownerCap, n, sizeof(Project *));
+        fds[0] = (struct pollfd){ srv.listenFd, POLLIN, 0 };
+        fds[1] = (struct pollfd){ srv.inotifyFd, POLLIN, 0 };
+        n = 2;
+        HASH_ITER(hh, srv.projects, p, tmp) {
+            for (size_t i = 0; i < p->numWatchers; i++) {
+                owners[n] = p;
+                fds[n++] = (struct pollfd){ p->watchers[i], POLLIN, 0 };
+            }
+        }
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+        // a watcher has nothing more to say: any input is it hanging up
+        for (size_t k = n; k-- > 2;) {
+            if (fds[k].revents) {
+                p = owners[k];
+                for (size_t i = 0; i < p->numWatchers; i++) {
+                    if (p->watchers[i] == fds[k].fd) {
+                        drop_watcher(p, i);
+                        break;
+                    }
                 }
-                imm = tmpVal;
             }
-            expandLd(rD, imm, fout);
-        } else {
-            fprintf(stderr, "Error parsing ld macro: %s\n", line);
         }
-        regfree(&regex);
-    }
-    else if (!strcmp(op, "push")) {
-        const char *pattern =
-          "^[[:space:]]*push[[:space:]]+r([0-9]+)[[:space:]]*,?[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for push\n");
-            return;
+        if (fds[1].revents) {
+            serve_events(&srv);
         }
-        if (regexec(&regex, line, 2, matches, 0) == 0) {
-            char regBuf[16];
-            int rD;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            rD = atoi(regBuf);
-            if (rD < 0 || rD > 31) {
-                fprintf(stderr, "Error: register out of range in push => %s\n", line);
-                regfree(&regex);
-                return;
+        if (fds[0].revents) {
+            int fd = accept4(srv.listenFd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serve_client(&srv, fd);
             }
-            expandPush(rD, fout);
-        } else {
-            fprintf(stderr, "Error parsing push macro: %s\n", line);
         }
-        regfree(&regex);
     }
-    else if (!strcmp(op, "pop")) {
-        const char *pattern =
-          "^[[:space:]]*pop[[:space:]]+r([0-9]+)[[:space:]]*,?[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for pop\n");
-            return;
+}
+
+// hw4 --connect: send a request and copy the reports to stderr; the status
+// is that of the last report
+static int connect_server(const char *socketPath, int watch, const char *input, const char *output) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long => %s\n", socketPath);
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return 1;
+    }
+    // the server resolves relative paths from its own directory
+    char cwd[4096], request[SERVE_MAX_REQUEST];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        perror("getcwd");
+        return 1;
+    }
+    int len = snprintf(request, sizeof(request), "%s %s%s%s %s%s%s\n", watch ? "watch" : "build",
+                       input[0] == '/' ? "" : cwd, input[0] == '/' ? "" : "/", input,
+                       output[0] == '/' ? "" : cwd, output[0] == '/' ? "" : "/", output);
+    if (len < 0 || (size_t)len >= sizeof(request) || !send_all(fd, request, (size_t)len)) {
+        fprintf(stderr, "Error: could not send the request\n");
+        return 1;
+    }
+    int ok = 0;
+    char buf[65536], line[256];
+    size_t lineLen = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0 || (n < 0 && errno == EINTR)) {
+        if (n < 0) {
+            continue;
         }
-        if (regexec(&regex, line, 2, matches, 0) == 0) {
-            char regBuf[16];
-            int rD;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            rD = atoi(regBuf);
-            if (rD < 0 || rD > 31) {
-                fprintf(stderr, "Error: register out of range in pop => %s\n", line);
-                regfree(&regex);
-                return;
+        fwrite(buf, 1, (size_t)n, stderr);
+        // track the status line
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\n') {
+                if (lineLen < sizeof(line) - 1) {
+                    line[lineLen++] = buf[i];
+                }
+                continue;
             }
-            expandPop(rD, fout);
-        } else {
-            fprintf(stderr, "Error parsing pop macro: %s\n", line);
+            line[lineLen] = '\0';
+            if (!strncmp(line, "### ", 4)) {
+                ok = !strncmp(line, "### ok", 6);
+            }
+            lineLen = 0;
         }
-        regfree(&regex);
     }
-    else if (!strcmp(op, "in")) {
-        const char *pattern =
-          "^[[:space:]]*in[[:space:]]+r([0-9]+)[[:space:]]*,?[[:space:]]*r([0-9]+)[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for in\n");
-            return;
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+/******************************************************************************
+ * C translation (--emit-c):
+ * Writes a C program that runs the image (assembling a source file first)
+ * natively: cc -O2 prog.c. The code segments become one function, main,
+ * with the registers as locals and a label at the start of every block:
+ * the entry, each label the assembler defined in code, each code segment,
+ * each brr target and each return point after a call. A word runs as the C statement it
+ * stands for, so the host compiler folds an ld's sequence to a constant
+ * and keeps registers in host registers. brr to a block is a goto; br,
+ * brnz, brgt, call, return and brr rX take a computed goto through a
+ * table of the blocks' label addresses, indexed by word. The segments are
+ * copied into a MEM_SIZE array before the entry; loads and stores check
+ * bounds, and errors print as the emulator's do.
+ * The code is translated once, so a program that writes into its code
+ * (or jumps to a word that isn't a block start) is not supported: the
+ * first fails silently, as the store only reaches memory, the second
+ * stops with "untranslated jump target".
+ ******************************************************************************/
+static const char emitCRuntime[] =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static unsigned char mem[MEM_SIZE];\n"
+    "\n"
+    "static void tk_fail(uint64_t pc, const char *what) {\n"
+    "    fflush(stdout);\n"
+    "    fprintf(stderr, \"Simulation error: %s at pc 0x%llx\\n\", what, (unsigned long long)pc);\n"
+    "    exit(1);\n"
+    "}\n"
+    "\n"
+    "static uint64_t tk_load(uint64_t pc, uint64_t address) {\n"
+    "    uint64_t v;\n"
+    "    if (address > MEM_SIZE - 8) {\n"
+    "        tk_fail(pc, \"load outside memory\");\n"
+    "    }\n"
+    "    memcpy(&v, mem + address, 8);\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static void tk_store(uint64_t pc, uint64_t address, uint64_t v) {\n"
+    "    if (address > MEM_SIZE - 8) {\n"
+    "        tk_fail(pc, \"store outside memory\");\n"
+    "    }\n"
+    "    memcpy(mem + address, &v, 8);\n"
+    "}\n"
+    "\n"
+    "static double tk_f(uint64_t v) {\n"
+    "    double d;\n"
+    "    memcpy(&d, &v, 8);\n"
+    "    return d;\n"
+    "}\n"
+    "\n"
+    "static uint64_t tk_u(double d) {\n"
+    "    uint64_t v;\n"
+    "    memcpy(&v, &d, 8);\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static uint64_t tk_divf(uint64_t pc, uint64_t a, uint64_t b) {\n"
+    "    if (tk_f(b) == 0.0) {\n"
+    "        tk_fail(pc, \"division by zero\");\n"
+    "    }\n"
+    "    return tk_u(tk_f(a) / tk_f(b));\n"
+    "}\n"
+    "\n"
+    "static uint64_t tk_div(uint64_t pc, uint64_t a, uint64_t b) {\n"
+    "    if (!b) {\n"
+    "        tk_fail(pc, \"division by zero\");\n"
+    "    }\n"
+    "    return (int64_t)b == -1 ? -a : (uint64_t)((int64_t)a / (int64_t)b);\n"
+    "}\n"
+    "\n"
+    "static uint64_t tk_in(uint64_t pc, uint64_t port) {\n"
+    "    unsigned long long v;\n"
+    "    if (port != 0) {\n"
+    "        tk_fail(pc, \"unsupported input port\");\n"
+    "    }\n"
+    "    if (scanf(\"%llu\", &v) != 1) {\n"
+    "        tk_fail(pc, \"no input\");\n"
+    "    }\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static void tk_out(uint64_t pc, uint64_t port, uint64_t v) {\n"
+    "    if (port != 1) {\n"
+    "        tk_fail(pc, \"unsupported output port\");\n"
+    "    }\n"
+    "    printf(\"%llu\\n\", (unsigned long long)v);\n"
+    "}\n"
+    "\n";
+
+typedef struct {
+    uint64_t address, size;
+    const unsigned char *bytes;
+    int code;
+} CSegment;
+
+// `w` at `pc` as C statements, into out
+static void emit_c_insn(Output *out, uint64_t pc, uint32_t w, const unsigned char *blockStart,
+                        uint64_t codeEnd) {
+    char buf[256];
+    int mop = w >> 27;
+    uint32_t L = w & 0xFFF;
+    unsigned d = w >> 22 & 31, s = w >> 17 & 31, t = w >> 12 & 31;
+    unsigned long long a = (unsigned long long)pc;
+    int n = 0;
+    // jump to the value of expression `e` (a format for one register)
+#define JUMP_TO(e, ...) snprintf(buf, sizeof(buf), "    t = " e "; goto dispatch;\n", __VA_ARGS__)
+    switch (mop) {
+    case MOP_AND: n = snprintf(buf, sizeof(buf), "    r%u = r%u & r%u;\n", d, s, t); break;
+    case MOP_OR: n = snprintf(buf, sizeof(buf), "    r%u = r%u | r%u;\n", d, s, t); break;
+    case MOP_XOR: n = snprintf(buf, sizeof(buf), "    r%u = r%u ^ r%u;\n", d, s, t); break;
+    case MOP_NOT: n = snprintf(buf, sizeof(buf), "    r%u = ~r%u;\n", d, s); break;
+    case MOP_SHFTR: n = snprintf(buf, sizeof(buf), "    r%u = r%u < 64 ? r%u >> r%u : 0;\n", d, t, s, t); break;
+    case MOP_SHFTL: n = snprintf(buf, sizeof(buf), "    r%u = r%u < 64 ? r%u << r%u : 0;\n", d, t, s, t); break;
+    case MOP_SHFTRI:
+        n = L < 64 ? snprintf(buf, sizeof(buf), "    r%u >>= %u;\n", d, L) : snprintf(buf, sizeof(buf), "    r%u = 0;\n", d);
+        break;
+    case MOP_SHFTLI:
+        n = L < 64 ? snprintf(buf, sizeof(buf), "    r%u <<= %u;\n", d, L) : snprintf(buf, sizeof(buf), "    r%u = 0;\n", d);
+        break;
+    case MOP_BR: n = JUMP_TO("r%u", d); break;
+    case MOP_BRR_R: n = JUMP_TO("0x%llxu + r%u", a, d); break;
+    case MOP_BRR_L: {
+        uint64_t target = pc + (uint64_t)simm12(L);
+        if (target >= CODE_BASE && target < codeEnd && !(target & 3) && blockStart[(target - CODE_BASE) >> 2]) {
+            n = snprintf(buf, sizeof(buf), "    goto L_%llx;\n", (unsigned long long)target);
+        } else {
+            n = JUMP_TO("0x%llxu", (unsigned long long)target);
         }
-        if (regexec(&regex, line, 3, matches, 0) == 0) {
-            char regBuf[16], regBuf2[16];
-            int rD, rS;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            len = matches[2].rm_eo - matches[2].rm_so;
-            strncpy(regBuf2, line + matches[2].rm_so, len);
-            regBuf2[len] = '\0';
-            rD = atoi(regBuf);
-            rS = atoi(regBuf2);
-            if (rD < 0 || rD > 31 || rS < 0 || rS > 31) {
-                fprintf(stderr, "Error: register out of range in 'in': %s\n", line);
-                regfree(&regex);
-                return;
-            }
-            expandIn(rD, rS, fout);
+        break;
+    }
+    case MOP_BRNZ: n = snprintf(buf, sizeof(buf), "    if (r%u) {\n        t = r%u;\n        goto dispatch;\n    }\n", s, d); break;
+    case MOP_CALL:
+        n = snprintf(buf, sizeof(buf), "    tk_store(0x%llxu, r31 - 8, 0x%llxu);\n    t = r%u;\n    goto dispatch;\n", a, a + 4, d);
+        break;
+    case MOP_RETURN: n = JUMP_TO("tk_load(0x%llxu, r31 - 8)", a); break;
+    case MOP_BRGT:
+        n = snprintf(buf, sizeof(buf), "    if ((int64_t)r%u > (int64_t)r%u) {\n        t = r%u;\n        goto dispatch;\n    }\n", s, t, d);
+        break;
+    case MOP_PRIV:
+        if (L == 0) {
+            n = snprintf(buf, sizeof(buf), "    goto halt;\n");
+        } else if (L == 3) {
+            n = snprintf(buf, sizeof(buf), "    r%u = tk_in(0x%llxu, r%u);\n", d, a, s);
+        } else if (L == 4) {
+            n = snprintf(buf, sizeof(buf), "    tk_out(0x%llxu, r%u, r%u);\n", a, d, s);
         } else {
-            fprintf(stderr, "Error parsing in macro: %s\n", line);
+            n = snprintf(buf, sizeof(buf), "    tk_fail(0x%llxu, \"unsupported trap\");\n", a);
         }
-        regfree(&regex);
+        break;
+    case MOP_MOV_LOAD:
+        n = snprintf(buf, sizeof(buf), "    r%u = tk_load(0x%llxu, r%u + (uint64_t)%lld);\n", d, a, s, (long long)simm12(L));
+        break;
+    case MOP_MOV_RR: n = snprintf(buf, sizeof(buf), "    r%u = r%u;\n", d, s); break;
+    case MOP_MOV_RL: n = snprintf(buf, sizeof(buf), "    r%u = (r%u & ~(uint64_t)0xFFF) | %u;\n", d, d, L); break;
+    case MOP_MOV_STORE:
+        n = snprintf(buf, sizeof(buf), "    tk_store(0x%llxu, r%u + (uint64_t)%lld, r%u);\n", a, d, (long long)simm12(L), s);
+        break;
+    case MOP_ADDF: n = snprintf(buf, sizeof(buf), "    r%u = tk_u(tk_f(r%u) + tk_f(r%u));\n", d, s, t); break;
+    case MOP_SUBF: n = snprintf(buf, sizeof(buf), "    r%u = tk_u(tk_f(r%u) - tk_f(r%u));\n", d, s, t); break;
+    case MOP_MULF: n = snprintf(buf, sizeof(buf), "    r%u = tk_u(tk_f(r%u) * tk_f(r%u));\n", d, s, t); break;
+    case MOP_DIVF: n = snprintf(buf, sizeof(buf), "    r%u = tk_divf(0x%llxu, r%u, r%u);\n", d, a, s, t); break;
+    case MOP_ADD: n = snprintf(buf, sizeof(buf), "    r%u = r%u + r%u;\n", d, s, t); break;
+    case MOP_ADDI: n = snprintf(buf, sizeof(buf), "    r%u += %u;\n", d, L); break;
+    case MOP_SUB: n = snprintf(buf, sizeof(buf), "    r%u = r%u - r%u;\n", d, s, t); break;
+    case MOP_SUBI: n = snprintf(buf, sizeof(buf), "    r%u -= %u;\n", d, L); break;
+    case MOP_MUL: n = snprintf(buf, sizeof(buf), "    r%u = r%u * r%u;\n", d, s, t); break;
+    case MOP_DIV: n = snprintf(buf, sizeof(buf), "    r%u = tk_div(0x%llxu, r%u, r%u);\n", d, a, s, t); break;
+    default: n = snprintf(buf, sizeof(buf), "    tk_fail(0x%llxu, \"illegal instruction\");\n", a); break;
     }
-    else if (!strcmp(op, "out")) {
-        const char *pattern =
-          "^[[:space:]]*out[[:space:]]+r([0-9]+)[[:space:]]*,?[[:space:]]*r([0-9]+)[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for out\n");
-            return;
+#undef JUMP_TO
+    out_bytes(out, buf, (size_t)n);
+}
+
+static void emit_c(const char *infile, const char *outfile) {
+    Output image;
+    load_program(infile, &image, NULL);
+    const unsigned char *p = (const unsigned char *)image.buf;
+    size_t size = image.len;
+    if (size < 16 || memcmp(p, "TKO1", 4) || (size - 16) / 24 < get_le32(p + 4)) {
+        fprintf(stderr, "Error: '%s' is not a Tinker image\n", infile);
+        exit(1);
+    }
+    uint32_t numSegments = get_le32(p + 4);
+    uint64_t entry = get_le64(p + 8);
+    CSegment *segs = calloc(numSegments ? numSegments : 1, sizeof(CSegment));
+    unsigned char *blockStart = calloc(NUM_DECODED, 1);
+    if (!segs || !blockStart) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    const unsigned char *payload = p + 16 + (size_t)numSegments * 24;
+    size_t left = size - 16 - (size_t)numSegments * 24;
+    uint64_t codeEnd = CODE_BASE;      // past the last code word
+    for (uint32_t i = 0; i < numSegments; i++) {
+        const unsigned char *seg = p + 16 + (size_t)i * 24;
+        CSegment *cs = &segs[i];
+        cs->code = get_le32(seg) == 0;
+        cs->address = get_le64(seg + 8);
+        cs->size = get_le64(seg + 16);
+        cs->bytes = payload;
+        if (cs->size > left || cs->address > MEM_SIZE || cs->size > MEM_SIZE - cs->address) {
+            fprintf(stderr, "Error: '%s' has a segment outside memory\n", infile);
+            exit(1);
         }
-        if (regexec(&regex, line, 3, matches, 0) == 0) {
-            char regBuf[16], regBuf2[16];
-            int rD, rS;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            len = matches[2].rm_eo - matches[2].rm_so;
-            strncpy(regBuf2, line + matches[2].rm_so, len);
-            regBuf2[len] = '\0';
-            rD = atoi(regBuf);
-            rS = atoi(regBuf2);
-            if (rD < 0 || rD > 31 || rS < 0 || rS > 31) {
-                fprintf(stderr, "Error: register out of range in 'out': %s\n", line);
-                regfree(&regex);
-                return;
-            }
-            expandOut(rD, rS, fout);
-        } else {
-            fprintf(stderr, "Error parsing out macro: %s\n", line);
+        if (cs->code && (cs->address < CODE_BASE || (cs->address & 3) || (cs->size & 3))) {
+            fprintf(stderr, "Error: the code segment at 0x%llx can't be translated\n",
+                    (unsigned long long)cs->address);
+            exit(1);
         }
-        regfree(&regex);
+        if (cs->code && cs->address + cs->size > codeEnd) {
+            codeEnd = cs->address + cs->size;
+        }
+        payload += cs->size;
+        left -= cs->size;
     }
-    else if (!strcmp(op, "clr")) {
-        const char *pattern =
-          "^[[:space:]]*clr[[:space:]]+r([0-9]+)[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for clr\n");
-            return;
+    // a word is only translated where a code segment holds it
+    unsigned char *isCode = calloc(NUM_DECODED, 1);
+    if (!isCode) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < numSegments; i++) {
+        for (uint64_t a = segs[i].address; segs[i].code && a < segs[i].address + segs[i].size; a += 4) {
+            isCode[(a - CODE_BASE) >> 2] = 1;
         }
-        if (regexec(&regex, line, 2, matches, 0) == 0) {
-            char regBuf[16];
-            int rD;
-            int len = matches[1].rm_eo - matches[1].rm_so;
-            strncpy(regBuf, line + matches[1].rm_so, len);
-            regBuf[len] = '\0';
-            rD = atoi(regBuf);
-            if (rD < 0 || rD > 31) {
-                fprintf(stderr, "Error: register out of range in clr => %s\n", line);
-                regfree(&regex);
-                return;
+    }
+#define CODE_WORD(a) ((a) >= CODE_BASE && (a) < codeEnd && !((a) & 3) && isCode[((a) - CODE_BASE) >> 2])
+    if (!CODE_WORD(entry)) {
+        fprintf(stderr, "Error: the entry 0x%llx is not in code\n", (unsigned long long)entry);
+        exit(1);
+    }
+    blockStart[(entry - CODE_BASE) >> 2] = 1;
+    for (uint32_t i = 0; i < numSegments; i++) {
+        if (segs[i].code && segs[i].size) {
+            blockStart[(segs[i].address - CODE_BASE) >> 2] = 1;   // run into from the one before
+        }
+    }
+    SymbolList syms = { NULL, 0, 0 };
+    visit_labels(add_object_symbol, &syms);
+    for (size_t i = 0; i < syms.num; i++) {
+        uint64_t a = (uint64_t)syms.items[i].value;
+        if (CODE_WORD(a)) {
+            blockStart[(a - CODE_BASE) >> 2] = 1;
+        }
+    }
+    free(syms.items);
+    for (uint32_t i = 0; i < numSegments; i++) {
+        for (uint64_t off = 0; segs[i].code && off < segs[i].size; off += 4) {
+            uint64_t pc = segs[i].address + off, next = 0;
+            uint32_t w = get_le32(segs[i].bytes + off);
+            if (w >> 27 == MOP_CALL) {
+                next = pc + 4;
+            } else if (w >> 27 == MOP_BRR_L) {
+                next = pc + (uint64_t)simm12(w & 0xFFF);
+            }
+            if (next && CODE_WORD(next)) {
+                blockStart[(next - CODE_BASE) >> 2] = 1;
             }
-            expandClr(rD, fout);
-        } else {
-            fprintf(stderr, "Error parsing clr macro: %s\n", line);
         }
-        regfree(&regex);
     }
-    else if (!strcmp(op, "halt")) {
-        const char *pattern = 
-          "^[[:space:]]*halt[[:space:]]*$";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0) {
-            fprintf(stderr, "Could not compile regex for halt\n");
-            return;
+
+    Output out, text;
+    if (!open_output(&out, outfile, 0, 0)) {
+        perror("emit-c: open output");
+        exit(1);
+    }
+    char buf[256];
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf),
+        "// %s, translated by --emit-c; build with a compiler that has computed goto (GCC, Clang)\n"
+        "#define MEM_SIZE %du\n", infile, MEM_SIZE));
+    out_bytes(&out, emitCRuntime, sizeof(emitCRuntime) - 1);
+    for (uint32_t i = 0; i < numSegments; i++) {
+        if (!segs[i].size) {
+            continue;
         }
-        if (regexec(&regex, line, 0, NULL, 0) == 0) {
-            expandHalt(fout);
-        } else {
-            fprintf(stderr, "Error parsing halt macro: %s\n", line);
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "static const unsigned char segment%u[] = {", i));
+        for (uint64_t k = 0; k < segs[i].size; k++) {
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "%s0x%02x,", k % 16 ? " " : "\n    ", segs[i].bytes[k]));
         }
-        regfree(&regex);
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "\n};\n\n"));
     }
-    else {
-        // not recognized – print the line as-is.
-        fprintf(fout, "\t%s\n", line);
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "int main(void) {\n"));
+    for (int r = 0; r < 32; r += 8) {
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf),
+            "    uint64_t r%d = 0, r%d = 0, r%d = 0, r%d = 0, r%d = 0, r%d = 0, r%d = 0, r%d = %s;\n",
+            r, r + 1, r + 2, r + 3, r + 4, r + 5, r + 6, r + 7, r == 24 ? "MEM_SIZE" : "0"));
+    }
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    uint64_t t;\n"));
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    static void *const blocks[%llu] = {\n",
+                                           (unsigned long long)((codeEnd - CODE_BASE) >> 2)));
+    for (uint64_t a = CODE_BASE; a < codeEnd; a += 4) {
+        if (blockStart[(a - CODE_BASE) >> 2]) {
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "        [%llu] = &&L_%llx,\n",
+                                                   (unsigned long long)((a - CODE_BASE) >> 2), (unsigned long long)a));
+        }
+    }
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    };\n"));
+    for (uint32_t i = 0; i < numSegments; i++) {
+        if (segs[i].size) {
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    memcpy(mem + 0x%llx, segment%u, sizeof(segment%u));\n",
+                                                   (unsigned long long)segs[i].address, i, i));
+        }
+    }
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    goto L_%llx;\n", (unsigned long long)entry));
+    for (uint32_t i = 0; i < numSegments; i++) {
+        if (!segs[i].code || !segs[i].size) {
+            continue;
+        }
+        for (uint64_t off = 0; off < segs[i].size; off += 4) {
+            uint64_t pc = segs[i].address + off;
+            uint32_t w = get_le32(segs[i].bytes + off);
+            if (blockStart[(pc - CODE_BASE) >> 2]) {
+                out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "L_%llx:\n", (unsigned long long)pc));
+            }
+            // the word, disassembled, as a comment
+            open_memory_output(&text, 0);
+            disassemble(&text, w);
+            out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    // %08llx  %.*s\n", (unsigned long long)pc,
+                                                   (int)text.len - 2, text.buf + 1));
+            free(text.buf);
+            emit_c_insn(&out, pc, w, blockStart, codeEnd);
+        }
+        // running off the segment's end
+        uint64_t end = segs[i].address + segs[i].size;
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "    t = 0x%llxu;\n    goto dispatch;\n", (unsigned long long)end));
     }
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf),
+        "dispatch:\n"
+        "    if (t < 0x%x || t >= MEM_SIZE || (t & 3)) {\n"
+        "        tk_fail(t, \"bad pc\");\n"
+        "    }\n"
+        "    if (t >= 0x%llxu || !blocks[(t - 0x%x) >> 2]) {\n"
+        "        tk_fail(t, \"untranslated jump target\");\n"
+        "    }\n"
+        "    goto *blocks[(t - 0x%x) >> 2];\n", CODE_BASE, (unsigned long long)codeEnd, CODE_BASE, CODE_BASE));
+    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "halt:\n    fflush(stdout);\n    return 0;\n}\n"));
+#undef CODE_WORD
+    close_output(&out, outfile);
+    free(isCode);
+    free(blockStart);
+    free(segs);
+    free(image.buf);
 }
 
-// check if line is one of the recognized macros
-static int is_macro_line(const char *line) {
-    char op[16];
-    if (sscanf(line, "%15s", op) != 1) {
+/******************************************************************************
+ * Disassembler (-d, --disassemble):
+ * Writes a .tko or .tkz image (or a source file, assembled first) back as
+ * the text the assembler outputs: a .code or .data line per segment, then
+ * a line per code word, decoded by disasm_word, and a signed item per 8
+ * data bytes. A segment that doesn't start where the one before it ended
+ * (the first at 0x1000) gets a `; at 0x...` comment after its directive,
+ * an entry other than 0x1000 a `; entry 0x...` line first, and bytes left
+ * over at a segment's end a comment too. A .tko file is read straight from
+ * its mapping.
+ * The segments are cut into DISASM_CHUNK-byte chunks formatted into memory
+ * on -j threads, DISASM_ROUND chunks a thread at a time, and written out
+ * in order in between, so the text of a large image is never all in memory.
+ * With --fold, the sequences the macros expand to go back to the macros:
+ * ld (its 12-word form), push, pop, in, out, halt and clr, each only where
+ * expanding it gives exactly the words there. Assembling the folded text
+ * without -O (which sizes ld by its value) gives the image back. No word
+ * after the first of a sequence can start one, so a chunk only has to
+ * skip the rest of a sequence begun before it.
+ ******************************************************************************/
+#define DISASM_CHUNK (256 << 10)
+#define DISASM_ROUND 4
+
+typedef struct {
+    const unsigned char *bytes;     // the segment's
+    uint64_t size;                  // the segment's bytes
+    uint64_t start, end;            // the chunk, as offsets into bytes
+    int code;
+    int first, last;                // of the segment
+    Output text;
+} DisasmChunk;
+
+typedef struct {
+    DisasmChunk *chunks;
+    size_t numChunks;
+    size_t next;            // atomic
+    int fold;
+} DisasmQueue;
+
+// the macro whose expansion starts the `words` code words at p, as a line
+// into `text` (unless NULL), expanded into `scratch`; its length in words,
+// 0 if there is none
+static int fold_macro(Output *text, Output *scratch, const unsigned char *p, uint64_t words) {
+    uint32_t w = get_le32(p);
+    int rd = w >> 22 & 31, rs = w >> 17 & 31;
+    uint64_t value;
+    char line[48];
+    int n = 0;
+    scratch->len = 0;
+    switch (w >> 27) {
+    case MOP_XOR:
+        if (words >= LD_WORDS && ld_sequence_value(p, (uint32_t)rd, &value)) {
+            expandLd(rd, value, scratch);
+            n = snprintf(line, sizeof(line), "\tld r%d, %llu\n", rd, (unsigned long long)value);
+        } else {
+            expandClr(rd, scratch);
+            n = snprintf(line, sizeof(line), "\tclr r%d\n", rd);
+        }
+        break;
+    case MOP_MOV_STORE:
+        expandPush(rs, scratch);
+        n = snprintf(line, sizeof(line), "\tpush r%d\n", rs);
+        break;
+    case MOP_MOV_LOAD:
+        expandPop(rd, scratch);
+        n = snprintf(line, sizeof(line), "\tpop r%d\n", rd);
+        break;
+    case MOP_PRIV:
+        if ((w & 0xFFF) == 0) {
+            expandHalt(scratch);
+            n = snprintf(line, sizeof(line), "\thalt\n");
+        } else if ((w & 0xFFF) == 3) {
+            expandIn(rd, rs, scratch);
+            n = snprintf(line, sizeof(line), "\tin r%d, r%d\n", rd, rs);
+        } else if ((w & 0xFFF) == 4) {
+            expandOut(rd, rs, scratch);
+            n = snprintf(line, sizeof(line), "\tout r%d, r%d\n", rd, rs);
+        }
+        break;
+    }
+    if (!n || scratch->len > 4 * words || memcmp(scratch->buf, p, scratch->len)) {
         return 0;
     }
-    if (!strcmp(op, "ld")   || !strcmp(op, "push") ||
-        !strcmp(op, "pop")  || !strcmp(op, "in")   ||
-        !strcmp(op, "out")  || !strcmp(op, "clr")  ||
-        !strcmp(op, "halt"))
-    {
-        return 1;
+    if (text) {
+        out_bytes(text, line, (size_t)n);
     }
-    return 0;
+    return (int)(scratch->len / 4);
 }
 
-/******************************************************************************
- * PASS 2: Output file generation (macro expansion + label substitution)
- ******************************************************************************/
-static void pass2(const char *infile, const char *outfile) {
-    FILE *fin = fopen(infile, "r");
-    if (!fin) {
-        perror("pass2: fopen input");
+static void disasm_chunk(DisasmChunk *c, int fold) {
+    Output *text = &c->text, scratch;
+    open_memory_output(text, 0);
+    open_memory_output(&scratch, 1);
+    uint64_t k = c->start;
+    if (!c->code) {
+        for (; k + 8 <= c->end; k += 8) {
+            out_char(text, '\t');
+            out_int(text, (int64_t)get_le64(c->bytes + k));
+            out_char(text, '\n');
+        }
+    } else {
+        // past a sequence that starts before the chunk and runs into it
+        for (uint64_t back = 4; fold && back < 4 * LD_WORDS && back <= k; back += 4) {
+            int n = fold_macro(NULL, &scratch, c->bytes + k - back, (c->size - (k - back)) / 4);
+            if (4 * (uint64_t)n > back) {
+                k += 4 * (uint64_t)n - back;
+                break;
+            }
+        }
+        while (k + 4 <= c->end) {
+            int n = fold ? fold_macro(text, &scratch, c->bytes + k, (c->size - k) / 4) : 0;
+            if (n) {
+                k += 4 * (uint64_t)n;
+                continue;
+            }
+            char *p = out_reserve(text, OUT_MAX_ITEM);
+            text->len += (size_t)(disasm_word(p, get_le32(c->bytes + k)) - p);
+            k += 4;
+        }
+    }
+    free(scratch.buf);
+}
+
+static void *disasm_worker(void *arg) {
+    DisasmQueue *queue = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->numChunks) {
+            return NULL;
+        }
+        disasm_chunk(&queue->chunks[i], queue->fold);
+    }
+}
+
+// disassemble `infile` into `outfile` on up to `jobs` threads, folding
+// expansions back into macros with `fold`
+static void disassemble_image(const char *infile, const char *outfile, int fold, int jobs) {
+    Output image = { 0 };
+    LineReader fin;
+    const unsigned char *p;
+    size_t size;
+    int mapped = reader_open(&fin, infile) && fin.mapped && fin.size >= 4 && !memcmp(fin.data, "TKO1", 4);
+    if (mapped) {
+        p = (const unsigned char *)fin.data;
+        size = fin.size;
+    } else {
+        reader_close(&fin);
+        load_program(infile, &image, NULL);
+        p = (const unsigned char *)image.buf;
+        size = image.len;
+    }
+    if (size < 16 || memcmp(p, "TKO1", 4) || (size - 16) / 24 < get_le32(p + 4)) {
+        fprintf(stderr, "Error: '%s' is not a Tinker image\n", infile);
+        exit(1);
+    }
+    uint32_t numSegments = get_le32(p + 4);
+    uint64_t entry = get_le64(p + 8);
+    const unsigned char *payload = p + 16 + (size_t)numSegments * 24;
+    size_t left = size - 16 - (size_t)numSegments * 24;
+    DisasmChunk *chunks = NULL;
+    size_t numChunks = 0, capChunks = 0;
+    for (uint32_t i = 0; i < numSegments; i++) {
+        const unsigned char *seg = p + 16 + (size_t)i * 24;
+        uint64_t segSize = get_le64(seg + 16);
+        if (segSize > left) {
+            fprintf(stderr, "Error: '%s' has a segment past its end\n", infile);
+            exit(1);
+        }
+        uint64_t start = 0;
+        do {
+            uint64_t end = segSize - start > DISASM_CHUNK ? start + DISASM_CHUNK : segSize;
+            chunks = grow_array(chunks, &capChunks, numChunks + 1, sizeof(DisasmChunk));
+            chunks[numChunks++] = (DisasmChunk){ payload, segSize, start, end, get_le32(seg) == 0,
+                                                 start == 0, end == segSize, { 0 } };
+            start = end;
+        } while (start < segSize);
+        payload += segSize;
+        left -= segSize;
+    }
+
+    Output out;
+    if (!open_output(&out, outfile, 0, 0)) {
+        perror("disassemble: open output");
         exit(1);
     }
-    FILE *fout = fopen(outfile, "w");
-    if (!fout) {
-        perror("pass2: fopen output");
-        fclose(fin);
+    char buf[64];
+    if (entry != CODE_BASE) {
+        out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "; entry 0x%llx\n", (unsigned long long)entry));
+    }
+    pthread_t *threads = malloc((size_t)jobs * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Error: out of memory.\n");
         exit(1);
     }
+    uint64_t expect = CODE_BASE;     // where the next segment would go
+    uint32_t segment = 0;
+    for (size_t done = 0; done < numChunks; ) {
+        size_t round = (size_t)jobs * DISASM_ROUND;
+        DisasmQueue queue = { chunks + done, numChunks - done < round ? numChunks - done : round, 0, fold };
+        int started = 0;
+        for (; started < jobs - 1 && (size_t)started + 1 < queue.numChunks; started++) {
+            if (pthread_create(&threads[started], NULL, disasm_worker, &queue) != 0) {
+                break;
+            }
+        }
+        disasm_worker(&queue);
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        for (size_t i = 0; i < queue.numChunks; i++) {
+            DisasmChunk *c = &queue.chunks[i];
+            if (c->first) {
+                const unsigned char *seg = p + 16 + (size_t)segment++ * 24;
+                uint64_t address = get_le64(seg + 8);
+                out_bytes(&out, c->code ? ".code\n" : ".data\n", 6);
+                if (address != expect) {
+                    out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "; at 0x%llx\n",
+                                                           (unsigned long long)address));
+                }
+                expect = address + c->size;
+            }
+            out_bytes(&out, c->text.buf, c->text.len);
+            free(c->text.buf);
+            uint64_t over = c->size % (c->code ? 4 : 8);
+            if (c->last && over) {
+                out_bytes(&out, buf, (size_t)snprintf(buf, sizeof(buf), "; %llu more byte(s)\n",
+                                                       (unsigned long long)over));
+            }
+        }
+        done += queue.numChunks;
+    }
+    close_output(&out, outfile);
+    free(threads);
+    free(chunks);
+    if (mapped) {
+        reader_close(&fin);
+    } else {
+        free(image.buf);
+    }
+}
 
-    char line[1024];
-    while (fgets(line, sizeof(line), fin)) {
-        line[strcspn(line, "\n")] = '\0';
-        trim(line);
-        if (!line[0] || line[0] == ';') {
-            continue;
+// size class `k` of stats.memSizes as "<=4K"
+static void format_size_class(char *buf, size_t size, int k) {
+    static const char units[] = " KMGT";
+    if (k == MEM_SIZE_CLASSES - 1) {
+        snprintf(buf, size, ">%dT", 1 << (k - 1 - 40));
+        return;
+    }
+    int u = k / 10 < 4 ? k / 10 : 4;
+    snprintf(buf, size, "<=%llu%.*s", 1ULL << (k - 10 * u), u > 0, &units[u]);
+}
+
+// print the --stats report to stderr
+static void print_stats(void) {
+    size_t count, capacity;
+    label_table_size(&count, &capacity);
+    double avgProbes = stats.lookups ? (double)stats.probes / (double)stats.lookups : 0;
+    FILE *f = stderr;
+    if (stats.json) {
+        fprintf(f, "{\"phases\":[");
+        for (int i = 0; i < stats.numPhases; i++) {
+            const StatPhase *p = &stats.phases[i];
+            fprintf(f, "%s{\"name\":\"%s\",\"wall\":%.6f,\"cpu\":%.6f,\"lines\":%llu,\"bytes\":%llu}",
+                    i ? "," : "", p->name, p->wall, p->cpu,
+                    (unsigned long long)p->lines, (unsigned long long)p->bytes);
         }
-        // Directives
-        if (!strcmp(line, ".code")) {
-            fprintf(fout, ".code\n");
-            continue;
+        fprintf(f, "],\"macros\":{");
+        for (int i = 0; i < NUM_MACRO_KINDS; i++) {
+            fprintf(f, "%s\"%s\":%llu", i ? "," : "", opNames[OP_HALT + i], (unsigned long long)stats.macros[i]);
         }
-        if (!strcmp(line, ".data")) {
-            fprintf(fout, ".data\n");
-            continue;
+        fprintf(f, "},\"labels\":{\"count\":%zu,\"capacity\":%zu,\"lookups\":%llu,\"probes\":%llu,\"max_probe\":%llu},",
+                count, capacity, (unsigned long long)stats.lookups,
+                (unsigned long long)stats.probes, (unsigned long long)stats.maxProbe);
+        if (stats.scheduled) {
+            fprintf(f, "\"stalls\":{\"before\":%llu,\"after\":%llu},",
+                    (unsigned long long)stats.stallsBefore, (unsigned long long)stats.stallsAfter);
         }
-        // skip label definitions
-        if (line[0] == ':') {
-            continue;
+        if (stats.includesParsed || stats.includesReused) {
+            fprintf(f, "\"includes\":{\"parsed\":%llu,\"reused\":%llu},",
+                    (unsigned long long)stats.includesParsed, (unsigned long long)stats.includesReused);
         }
-        // replace label references with it's address
-        char *colon = strchr(line, ':');
-        if (colon) {
-            char lbl[50];
-            if (sscanf(colon + 1, "%49s", lbl) == 1) {
-                LabelAddress *entry = find_label(lbl);
-                if (entry) {
-                    *colon = '\0'; // cut at colon
-                    char buffer[1024];
-                    snprintf(buffer, sizeof(buffer), "\t%s%d", line, entry->address);
-                    if (is_macro_line(buffer)) {
-                        parseMacro(buffer, fout);
-                    } else {
-                        fprintf(fout, "%s\n", buffer);
-                    }
-                    continue;
-                } else {
-                    fprintf(stderr, "Warning: label '%s' not found.\n", lbl);
-                    fprintf(fout, "\t%s\n", line);
-                    continue;
-                }
+        fprintf(f, "\"memory\":{\"current\":%llu,\"peak\":%llu",
+                (unsigned long long)stats.memCurrent, (unsigned long long)stats.memPeak);
+        for (int i = 0; i < NUM_MEM_KINDS; i++) {
+            const MemCounters *c = &stats.mem[i];
+            fprintf(f, ",\"%s\":{\"current\":%llu,\"peak\":%llu,\"allocations\":%llu}", memKindNames[i],
+                    (unsigned long long)c->current, (unsigned long long)c->peak, (unsigned long long)c->count);
+        }
+        fprintf(f, ",\"sizes\":{");
+        for (int k = 0, first = 1; k < MEM_SIZE_CLASSES; k++) {
+            if (stats.memSizes[k]) {
+                char name[24];
+                format_size_class(name, sizeof(name), k);
+                fprintf(f, "%s\"%s\":%llu", first ? "" : ",", name, (unsigned long long)stats.memSizes[k]);
+                first = 0;
             }
         }
-        // if the line is a macro, expand; otherwise output as-is
-        if (is_macro_line(line)) {
-            parseMacro(line, fout);
-        } else {
-            fprintf(fout, "\t%s\n", line);
+        fprintf(f, "}},");
+        fprintf(f, "\"bytes_emitted\":%llu}\n", (unsigned long long)stats.emitted);
+        return;
+    }
+    fprintf(f, "%-12s %10s %10s %12s %14s\n", "phase", "wall s", "cpu s", "lines", "bytes");
+    for (int i = 0; i < stats.numPhases; i++) {
+        const StatPhase *p = &stats.phases[i];
+        fprintf(f, "%-12s %10.4f %10.4f %12llu %14llu\n", p->name, p->wall, p->cpu,
+                (unsigned long long)p->lines, (unsigned long long)p->bytes);
+    }
+    fprintf(f, "macros:");
+    for (int i = 0; i < NUM_MACRO_KINDS; i++) {
+        fprintf(f, " %s %llu", opNames[OP_HALT + i], (unsigned long long)stats.macros[i]);
+    }
+    fprintf(f, "\nlabels: %zu in %zu slots, %llu lookups, %.2f probes avg, %llu max\n",
+            count, capacity, (unsigned long long)stats.lookups, avgProbes, (unsigned long long)stats.maxProbe);
+    if (stats.scheduled) {
+        fprintf(f, "stalls: %llu before scheduling, %llu after\n",
+                (unsigned long long)stats.stallsBefore, (unsigned long long)stats.stallsAfter);
+    }
+    if (stats.includesParsed || stats.includesReused) {
+        fprintf(f, "includes: %llu parsed, %llu reused\n",
+                (unsigned long long)stats.includesParsed, (unsigned long long)stats.includesReused);
+    }
+    fprintf(f, "emitted: %llu bytes\n", (unsigned long long)stats.emitted);
+    fprintf(f, "%-12s %14s %14s %12s\n", "memory", "current", "peak", "allocations");
+    uint64_t allocations = 0;
+    for (int i = 0; i < NUM_MEM_KINDS; i++) {
+        const MemCounters *c = &stats.mem[i];
+        fprintf(f, "%-12s %14llu %14llu %12llu\n", memKindNames[i], (unsigned long long)c->current,
+                (unsigned long long)c->peak, (unsigned long long)c->count);
+        allocations += c->count;
+    }
+    fprintf(f, "%-12s %14llu %14llu %12llu\nsizes:", "total", (unsigned long long)stats.memCurrent,
+            (unsigned long long)stats.memPeak, (unsigned long long)allocations);
+    for (int k = 0; k < MEM_SIZE_CLASSES; k++) {
+        if (stats.memSizes[k]) {
+            char name[24];
+            format_size_class(name, sizeof(name), k);
+            fprintf(f, " %s %llu", name, (unsigned long long)stats.memSizes[k]);
         }
     }
-
-    fclose(fin);
-    fclose(fout);
+    fprintf(f, "\n");
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <inputfile> <outputfile>\n", prog);
+    fprintf(stderr, "       %s --link <outputfile> <object>...\n", prog);
+    fprintf(stderr, "       %s run [-O ...] [options] <image.tko | inputfile>   (or --run, -r)\n", prog);
+    fprintf(stderr, "       %s --batch [-j N] [--timeout SECONDS] [--max-insns N] [--lockstep] <manifest>\n", prog);
+    fprintf(stderr, "       %s --batch --assemble [-j N] [options] <manifest>\n", prog);
+    fprintf(stderr, "       %s --serve SOCKET [-b] [-j N]\n", prog);
+    fprintf(stderr, "       %s --connect SOCKET [--watch] <inputfile> <outputfile>\n", prog);
+    fprintf(stderr, "  '-' reads stdin (streamed; -b reads it all first) or writes stdout\n");
+    fprintf(stderr, "  -s, --single-pass   assemble as a single phase (the IR is built in one read either way)\n");
+    fprintf(stderr, "  -O, --optimize      peephole pass, dead clears and repeated loads dropped, coalesced push/pop runs, shortest ld sequences and 'ld rX, :label; br rX' as brr where rX is dead at the label, found by relaxation\n");
+    fprintf(stderr, "  --pool rN           -O, loading long ld constants from a table through reserved register rN\n");
+    fprintf(stderr, "  --dce               -O, dropping code no label, branch or fall-through from the entry point reaches\n");
+    fprintf(stderr, "  --profile-use FILE  -O, placing code by how much it ran in a --profile FILE, code that never ran last\n");
+    fprintf(stderr, "  --align-loops N     -O, padding every label a later branch goes back to to a multiple of N bytes\n");
+    fprintf(stderr, "  --schedule SPEC     -O, reordering straight-line code for latencies (alu=1,mul=3,... or 'default'), stalls to --stats\n");
+    fprintf(stderr, "  -j, --jobs N        run both passes on N threads (two-pass mode only)\n");
+    fprintf(stderr, "  --pipeline          overlap reading, both passes and writing; -j N sets the expanding threads\n");
+    fprintf(stderr, "  --cache FILE        reuse unchanged blocks from FILE (two-pass mode only)\n");
+    fprintf(stderr, "  --low-memory        keep only the labels and a line index of a file input; -j N sets the pass 2 threads\n");
+    fprintf(stderr, "  -c, --object        write a relocatable object for --link (with -O: 16-byte ld of labels)\n");
+    fprintf(stderr, "  --symbols FILE      also write the labels and a line table to FILE (.tks); -r: name pcs and data from FILE\n");
+    fprintf(stderr, "  --if-changed        leave each output file untouched if its content is what OUTPUT.digest recorded\n");
+    fprintf(stderr, "  -l, --listing       write a listing (addresses, words, expansions, symbol map) instead\n");
+    fprintf(stderr, "  --emit-c            write a C program that runs the image natively (cc -O2) instead\n");
+    fprintf(stderr, "  -d, --disassemble   write an image (.tko, .tkz) back as assembly text, on -j threads\n");
+    fprintf(stderr, "  --fold              -d: write the ld, push, pop, in, out, halt and clr expansions as the macros\n");
+    fprintf(stderr, "  --link              link objects into one binary .tko image\n");
+    fprintf(stderr, "  -b, --binary        write a binary .tko image instead of expanded assembly\n");
+    fprintf(stderr, "  -z, --compress      write the image compressed (.tkz, on -j threads); an image input is just compressed\n");
+    fprintf(stderr, "  -r, --run           execute an image, assembling a source file in memory first (with -O and its passes)\n");
+    fprintf(stderr, "  --batch             run the images (and input files) a manifest lists, on -j threads\n");
+    fprintf(stderr, "  --timeout SECONDS   --batch: stop a job that runs longer\n");
+    fprintf(stderr, "  --max-insns N       -r, --batch: stop a program (a job) after N instructions\n");
+    fprintf(stderr, "  --lockstep          --batch: run the jobs of an image 8 at a time in step, in vector registers\n");
+    fprintf(stderr, "  --assemble          --batch: assemble the input and output files a manifest lists instead, on -j threads\n");
+    fprintf(stderr, "  --serve SOCKET      assemble on request from a Unix socket, keeping each program's --cache in memory\n");
+    fprintf(stderr, "  --connect SOCKET    have a --serve server assemble, printing its messages\n");
+    fprintf(stderr, "  --watch             --connect: and again whenever the input is saved, until interrupted\n");
+    fprintf(stderr, "  --profile FILE      -r: count instructions per pc and label (to stderr) and write call stacks to FILE, folded\n");
+    fprintf(stderr, "  --cache-model SPEC  -r: model caches for mov loads and stores (l1=SIZE:WAYS:LINE,l2=...,tlb=ENTRIES:WAYS:PAGE or 'default'), miss rates per .data label to stderr\n");
+    fprintf(stderr, "  --record FILE       -r: write the `in` values and register checkpoints to FILE\n");
+    fprintf(stderr, "  --replay FILE       -r: take the `in` values from a --record trace, checking the checkpoints\n");
+    fprintf(stderr, "  --input FILE        -r: `in` reads FILE (mapped) instead of stdin\n");
+    fprintf(stderr, "  --in-ring FILE      -r: `in` pops raw words from a ring buffer the run makes in the shared file FILE\n");
+    fprintf(stderr, "  --out-ring FILE     -r: `out` pushes raw words to a ring buffer in the shared file FILE instead of stdout\n");
+    fprintf(stderr, "  --break PC          -r: print the registers to stderr whenever the instruction at PC (or a label) runs\n");
+    fprintf(stderr, "  --watchpoint ADDR   -r: print each store that changes the 8 bytes at ADDR (or a label) to stderr\n");
+    fprintf(stderr, "  --patch-fifo PATH   -r: reassemble a labeled block into the running program for each line 'LABEL [FILE]' written to the FIFO PATH\n");
+    fprintf(stderr, "  --no-jit            run without translating hot blocks to native code\n");
+    fprintf(stderr, "  --keyed-hash        hash label, equ and macro names with SipHash-1-3 (for untrusted sources)\n");
+    fprintf(stderr, "  --stats[=json]      print per-phase times, counters and memory use to stderr\n");
+}
 
-
-/******************************************************************************
- * main
- ******************************************************************************/
 int main(int argc, char *argv[]) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <inputfile> <outputfile>\n", argv[0]);
+    int singlePass = 0;
+    int binary = 0;
+    int compress = 0;
+    int optimize = 0;
+    int poolReg = -1;
+    int dce = 0;
+    const char *profileUse = NULL;
+    int alignLoops = 0;
+    ScheduleModel scheduleModel;
+    const ScheduleModel *schedule = NULL;
+    int jobs = 1;
+    int pipeline = 0;
+    int lowMemory = 0;
+    const char *cachefile = NULL;
+    const char *symbolsFile = NULL;
+    int object = 0;
+    int listing = 0;
+    int emitC = 0;
+    int disasm = 0;
+    int fold = 0;
+    int link = 0;
+    int run = 0;
+    int batch = 0;
+    int assemble = 0;
+    const char *serveSocket = NULL;
+    const char *connectSocket = NULL;
+    int watch = 0;
+    double timeout = 0;
+    int lockstep = 0;
+    int useJit = 1;
+    RunOptions runOptions = { 1, NULL, NULL, NULL, NULL, NULL, NULL, NO_BUDGET, { NULL }, 0, { NULL }, 0, NULL, NULL, NULL, NULL };
+    CacheConfig cacheConfig[NUM_CACHE_LEVELS];
+    int argi = 1;
+    if (argc > 1 && !strcmp(argv[1], "run")) {
+        run = 1;    // hw4 run [options] prog is hw4 -r [options] prog
+        argi++;
+    }
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (!strcmp(argv[argi], "-s") || !strcmp(argv[argi], "--single-pass")) {
+            singlePass = 1;
+        } else if (!strcmp(argv[argi], "-O") || !strcmp(argv[argi], "--optimize")) {
+            optimize = 1;
+        } else if (!strcmp(argv[argi], "--pool") && argi + 1 < argc) {
+            const char *r = argv[++argi];
+            char *end = NULL;
+            long n = r[0] == 'r' ? strtol(r + 1, &end, 10) : -1;
+            if (n < 0 || n > 30 || end == r + 1 || *end != '\0') {
+                fprintf(stderr, "Error: invalid --pool register '%s' (r0 to r30)\n", r);
+                return 1;
+            }
+            poolReg = (int)n;
+            optimize = 1;
+        } else if (!strcmp(argv[argi], "--dce")) {
+            dce = 1;
+            optimize = 1;
+        } else if (!strcmp(argv[argi], "--profile-use") && argi + 1 < argc) {
+            profileUse = argv[++argi];
+            optimize = 1;
+        } else if (!strcmp(argv[argi], "--align-loops") && argi + 1 < argc) {
+            char *end;
+            long n = strtol(argv[++argi], &end, 10);
+            if (*end != '\0' || n < 4 || n > ALIGN_MAX || (n & (n - 1))) {
+                fprintf(stderr, "Error: invalid --align-loops '%s' (a power of two from 4 to %d)\n", argv[argi], ALIGN_MAX);
+                return 1;
+            }
+            alignLoops = (int)n;
+            optimize = 1;
+        } else if (!strcmp(argv[argi], "--schedule") && argi + 1 < argc) {
+            if (!parse_schedule_spec(argv[++argi], &scheduleModel)) {
+                return 1;
+            }
+            schedule = &scheduleModel;
+            optimize = 1;
+        } else if ((!strcmp(argv[argi], "-j") || !strcmp(argv[argi], "--jobs")) && argi + 1 < argc) {
+            char *end;
+            long n = strtol(argv[++argi], &end, 10);
+            if (*end != '\0' || n < 1 || n > 1024) {
+                fprintf(stderr, "Error: invalid job count '%s'\n", argv[argi]);
+                return 1;
+            }
+            jobs = (int)n;
+        } else if (!strcmp(argv[argi], "--pipeline")) {
+            pipeline = 1;
+        } else if (!strcmp(argv[argi], "--low-memory")) {
+            lowMemory = 1;
+        } else if (!strcmp(argv[argi], "--cache") && argi + 1 < argc) {
+            cachefile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--symbols") && argi + 1 < argc) {
+            symbolsFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--if-changed")) {
+            ifChanged = 1;
+        } else if (!strcmp(argv[argi], "-c") || !strcmp(argv[argi], "--object")) {
+            object = 1;
+        } else if (!strcmp(argv[argi], "-l") || !strcmp(argv[argi], "--listing")) {
+            listing = 1;
+        } else if (!strcmp(argv[argi], "--emit-c")) {
+            emitC = 1;
+        } else if (!strcmp(argv[argi], "-d") || !strcmp(argv[argi], "--disassemble")) {
+            disasm = 1;
+        } else if (!strcmp(argv[argi], "--fold")) {
+            fold = 1;
+        } else if (!strcmp(argv[argi], "--link")) {
+            link = 1;
+        } else if (!strcmp(argv[argi], "-b") || !strcmp(argv[argi], "--binary")) {
+            binary = 1;
+        } else if (!strcmp(argv[argi], "-z") || !strcmp(argv[argi], "--compress")) {
+            compress = 1;
+        } else if (!strcmp(argv[argi], "-r") || !strcmp(argv[argi], "--run")) {
+            run = 1;
+        } else if (!strcmp(argv[argi], "--batch")) {
+            batch = 1;
+        } else if (!strcmp(argv[argi], "--lockstep")) {
+            lockstep = 1;
+        } else if (!strcmp(argv[argi], "--assemble")) {
+            assemble = 1;
+        } else if (!strcmp(argv[argi], "--serve") && argi + 1 < argc) {
+            serveSocket = argv[++argi];
+        } else if (!strcmp(argv[argi], "--connect") && argi + 1 < argc) {
+            connectSocket = argv[++argi];
+        } else if (!strcmp(argv[argi], "--watch")) {
+            watch = 1;
+        } else if (!strcmp(argv[argi], "--timeout") && argi + 1 < argc) {
+            char *end;
+            timeout = strtod(argv[++argi], &end);
+            if (*end != '\0' || !(timeout > 0)) {
+                fprintf(stderr, "Error: invalid timeout '%s'\n", argv[argi]);
+                return 1;
+            }
+        } else if (!strcmp(argv[argi], "--max-insns") && argi + 1 < argc) {
+            char *end;
+            const char *n = argv[++argi];
+            runOptions.maxInsns = strtoull(n, &end, 10);
+            if (*end != '\0' || end == n || *n == '-' || runOptions.maxInsns >= NO_BUDGET) {
+                fprintf(stderr, "Error: invalid instruction count '%s'\n", n);
+                return 1;
+            }
+        } else if (!strcmp(argv[argi], "--break") && argi + 1 < argc) {
+            if (runOptions.numBreaks == MAX_BREAKS) {
+                fprintf(stderr, "Error: more than %d breakpoints\n", MAX_BREAKS);
+                return 1;
+            }
+            runOptions.breaks[runOptions.numBreaks++] = argv[++argi];
+        } else if (!strcmp(argv[argi], "--watchpoint") && argi + 1 < argc) {
+            if (runOptions.numWatchpoints == MAX_WATCHES) {
+                fprintf(stderr, "Error: more than %d watchpoints\n", MAX_WATCHES);
+                return 1;
+            }
+            runOptions.watchpoints[runOptions.numWatchpoints++] = argv[++argi];
+        } else if (!strcmp(argv[argi], "--profile") && argi + 1 < argc) {
+            runOptions.profileFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--cache-model") && argi + 1 < argc) {
+            if (!parse_cache_spec(argv[++argi], cacheConfig)) {
+                return 1;
+            }
+            runOptions.cache = cacheConfig;
+        } else if (!strcmp(argv[argi], "--input") && argi + 1 < argc) {
+            runOptions.inputFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--in-ring") && argi + 1 < argc) {
+            runOptions.inRing = argv[++argi];
+        } else if (!strcmp(argv[argi], "--out-ring") && argi + 1 < argc) {
+            runOptions.outRing = argv[++argi];
+        } else if (!strcmp(argv[argi], "--patch-fifo") && argi + 1 < argc) {
+            runOptions.patchFifo = argv[++argi];
+        } else if (!strcmp(argv[argi], "--record") && argi + 1 < argc) {
+            runOptions.recordFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--replay") && argi + 1 < argc) {
+            runOptions.replayFile = argv[++argi];
+        } else if (!strcmp(argv[argi], "--no-jit")) {
+            useJit = 0;
+        } else if (!strcmp(argv[argi], "--keyed-hash")) {
+            keyedHash = 1;
+        } else if (!strcmp(argv[argi], "--stats") || !strcmp(argv[argi], "--stats=json")) {
+            stats.enabled = 1;
+            stats.json = argv[argi][7] == '=';
+        } else {
+            fprintf(stderr, "Error: unknown option '%s'\n", argv[argi]);
+            usage(argv[0]);
+            return 1;
+        }
+        argi++;
+    }
+    if (serveSocket) {
+        if (argi < argc || connectSocket || watch || singlePass || optimize || pipeline || cachefile ||
+            object || listing || emitC || link || run || batch || stats.enabled || ifChanged || lowMemory) {
+            fprintf(stderr, "Error: --serve takes only -b and -j\n");
+            return 1;
+        }
+        init_lexer();
+        serve(serveSocket, binary, jobs);
+    }
+    if (connectSocket) {
+        if (argc - argi != 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        return connect_server(connectSocket, watch, argv[argi], argv[argi + 1]);
+    }
+    if (watch) {
+        fprintf(stderr, "Error: --watch goes with --connect\n");
+        return 1;
+    }
+    if (argc - argi < 2 - (run || batch)) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *infile = argv[argi];
+    const char *outfile = argv[argi + 1];
+    const RunOptions *ro = &runOptions;
+    if ((ro->profileFile || ro->inputFile || ro->cache || ro->recordFile || ro->replayFile || ro->numBreaks ||
+         ro->numWatchpoints || ro->patchFifo || ro->inRing || ro->outRing) && !run) {
+        fprintf(stderr, "Error: --profile, --cache-model, --input, --record, --replay, --break, --watchpoint, --patch-fifo, --in-ring and --out-ring go with -r\n");
+        return 1;
+    }
+    if ((ro->inRing || ro->outRing) && batch) {
+        fprintf(stderr, "Error: --in-ring and --out-ring are for one run, not --batch\n");
+        return 1;
+    }
+    if (ro->inRing && (ro->inputFile || ro->replayFile)) {
+        fprintf(stderr, "Error: --in-ring is the input, without --input or --replay\n");
+        return 1;
+    }
+    if (ro->inRing && ro->outRing && !strcmp(ro->inRing, ro->outRing)) {
+        fprintf(stderr, "Error: --in-ring and --out-ring need two files\n");
+        return 1;
+    }
+    if (ro->patchFifo && (ro->recordFile || ro->replayFile || batch)) {
+        fprintf(stderr, "Error: --patch-fifo changes the program as it runs, without --record, --replay or --batch\n");
+        return 1;
+    }
+    if (ro->replayFile && (ro->recordFile || ro->inputFile)) {
+        fprintf(stderr, "Error: --replay reads the input from the trace, without --record or --input\n");
+        return 1;
+    }
+    if (assemble && (!batch || run || link || emitC || pipeline || cachefile || timeout > 0)) {
+        fprintf(stderr, "Error: --assemble goes with --batch, without -r, --link, --emit-c, --pipeline, --cache or --timeout\n");
+        return 1;
+    }
+    if (ro->maxInsns != NO_BUDGET && (!(run || batch) || assemble)) {
+        fprintf(stderr, "Error: --max-insns goes with -r or --batch, without --assemble\n");
+        return 1;
+    }
+    if (lockstep && (!batch || assemble)) {
+        fprintf(stderr, "Error: --lockstep goes with --batch, without --assemble\n");
+        return 1;
+    }
+    if (profileUse && (batch || run || object || link)) {
+        fprintf(stderr, "Error: --profile-use can't be combined with --batch, -r, -c or --link\n");
+        return 1;
+    }
+    if (assemble && object && (singlePass || listing || poolReg >= 0 || dce || alignLoops || schedule)) {
+        fprintf(stderr, "Error: -c can't be combined with -s, -l, --pool, --dce, --align-loops or --schedule\n");
+        return 1;
+    }
+    if (symbolsFile && (batch || pipeline || cachefile || object || link || emitC)) {
+        fprintf(stderr, "Error: --symbols can't be combined with --batch, --pipeline, --cache, -c, --link or --emit-c\n");
+        return 1;
+    }
+    if (lowMemory && (singlePass || optimize || listing || cachefile || emitC || pipeline || symbolsFile ||
+                      object || link || run || batch || !strcmp(infile, "-"))) {
+        fprintf(stderr, "Error: --low-memory reads a file, without -s, -O, -l, --cache, --emit-c, --pipeline, --symbols, -c, --link, -r or --batch\n");
+        return 1;
+    }
+    if (ifChanged && (run || (batch && !assemble) || compress)) {
+        fprintf(stderr, "Error: --if-changed goes with assembly, not -r, --batch without --assemble or -z\n");
+        return 1;
+    }
+    if (compress && (object || link || listing || emitC || disasm || run || batch || !strcmp(outfile, "-"))) {
+        fprintf(stderr, "Error: -z writes an image file, not stdout, and can't be combined with -c, --link, -l, --emit-c, -d, -r or --batch\n");
+        return 1;
+    }
+    char *imageTmp = NULL;  // -z: where the image goes before it is compressed to outfile
+    if (compress) {
+        if (is_image_file(infile)) {
+            stats_begin("compress");
+            compress_image(infile, outfile, jobs);
+            stats_end();
+            if (stats.enabled) {
+                print_stats();
+            }
+            return 0;
+        }
+        size_t len = strlen(outfile);
+        imageTmp = malloc(len + 5);
+        if (!imageTmp) {
+            fprintf(stderr, "Error: out of memory.\n");
+            return 1;
+        }
+        memcpy(imageTmp, outfile, len);
+        memcpy(imageTmp + len, ".tmp", 5);
+        binary = 1;
+    }
+    AsmOptions asmOptions = { binary, singlePass, optimize, poolReg, dce, profileUse, alignLoops, schedule, symbolsFile,
+                              listing, object };
+    init_lexer();
+    if (fold && !disasm) {
+        fprintf(stderr, "Error: --fold goes with -d\n");
+        return 1;
+    }
+    if (disasm) {
+        if (run || batch || object || link || listing || optimize || binary || emitC || singlePass || cachefile ||
+            symbolsFile || pipeline || lowMemory) {
+            fprintf(stderr, "Error: -d can't be combined with -r, --batch, -c, --link, -l, -O, -b, --emit-c, -s, --cache, --symbols, --pipeline or --low-memory\n");
+            return 1;
+        }
+        stats_begin("disassemble");
+        disassemble_image(infile, outfile, fold, jobs);
+        stats_end();
+        if (stats.enabled) {
+            print_stats();
+        }
+        free_hashmap();
+        free_segments();
+        return 0;
+    }
+    if (batch) {
+        stats_begin("batch");
+        if (assemble) {
+            assemble_batch(infile, jobs, &asmOptions);
+        } else {
+            run_batch(infile, jobs, useJit, timeout, runOptions.maxInsns, lockstep);
+        }
+        stats_end();
+        if (stats.enabled) {
+            print_stats();
+        }
+        return 0;
+    }
+    if (run) {
+        stats_begin("run");
+        runOptions.useJit = useJit;
+        runOptions.symbolsFile = symbolsFile;
+        runOptions.passes = optimize ? &asmOptions : NULL;
+        run_program(infile, &runOptions);
+        stats_end();
+        if (stats.enabled) {
+            print_stats();
+        }
+        free_hashmap();
+        free_segments();
+        return 0;
+    }
+    if ((object || link) && (singlePass || cachefile || jobs > 1 || poolReg >= 0 || dce || alignLoops || schedule || pipeline)) {
+        fprintf(stderr, "Error: -c and --link can't be combined with -s, -j, --cache, --pool, --dce, --align-loops, --schedule or --pipeline\n");
         return 1;
     }
-    // Pass 1: validate instructions + populate label -> addresses hashmap
-    pass1(argv[1]);
-    // Pass 2: expand macros + replace labels with addreses
-    pass2(argv[1], argv[2]);
+    if (pipeline && (singlePass || optimize || listing || cachefile || emitC)) {
+        fprintf(stderr, "Error: --pipeline can't be combined with -s, -O, -l, --cache or --emit-c\n");
+        return 1;
+    }
+    if (emitC) {
+        if (object || link || listing || optimize || binary) {
+            fprintf(stderr, "Error: --emit-c can't be combined with -c, --link, -l, -O or -b\n");
+            return 1;
+        }
+        stats_begin("emit-c");
+        emit_c(infile, outfile);
+        stats_end();
+        if (stats.enabled) {
+            print_stats();
+        }
+        free_hashmap();
+        free_segments();
+        return 0;
+    }
+    if ((object || link) && listing) {
+        fprintf(stderr, "Error: -l can't be combined with -c or --link\n");
+        return 1;
+    }
+    if (link && optimize) {
+        fprintf(stderr, "Error: --link takes -O objects as they are, -O goes with -c\n");
+        return 1;
+    }
+
+    const char *target = imageTmp ? imageTmp : outfile;
+    if (link) {
+        // argv: output, then the objects in placement order
+        stats_begin("link");
+        link_objects(infile, argv + argi + 1, argc - argi - 1);
+        stats_end();
+    } else if (object) {
+        // both passes, relocations instead of label values
+        stats_begin("object");
+        assemble_object(infile, outfile, optimize);
+        stats_end();
+    } else if (pipeline) {
+        // read, size, expand and write at the same time
+        stats_begin("pipeline");
+        assemble_pipelined(infile, target, binary, jobs);
+        stats_end();
+    } else if (lowMemory) {
+        // labels and a sparse line index only; pass 2 preads its stretches
+        stats_begin("low-memory");
+        assemble_indexed(infile, target, binary, jobs);
+        stats_end();
+    } else if (!strcmp(infile, "-") && !binary && !optimize && !cachefile && !listing && !symbolsFile) {
+        // read once, emit as soon as references resolve
+        stats_begin("stream");
+        stream_assemble(infile, target);
+        stats_end();
+    } else if (singlePass || optimize || listing || symbolsFile || !strcmp(infile, "-")) {
+        // pass1 + pass2 over the IR as one phase; relaxation rewrites the IR
+        // between them, so -O always takes this path, and --symbols reads it
+        stats_begin("single-pass");
+        single_pass(infile, target, &asmOptions);
+        stats_end();
+    } else if (cachefile) {
+        // incremental: only changed blocks are sized and expanded
+        stats_begin("cached");
+        assemble_cached(infile, target, binary, jobs, cachefile);
+        stats_end();
+    } else if (jobs > 1) {
+        // both passes over input chunks on a thread pool
+        stats_begin("parallel");
+        assemble_parallel(infile, target, binary, jobs);
+        stats_end();
+    } else {
+        // Pass 1: validate instructions + populate label -> addresses hashmap
+        stats_begin("pass1");
+        pass1(infile);
+        stats_end();
+        // Pass 2: expand macros + replace labels with addreses
+        stats_begin("pass2");
+        pass2(target, binary, 0);
+        stats_end();
+    }
+    if (imageTmp) {
+        stats_begin("compress");
+        compress_image(imageTmp, outfile, jobs);
+        stats_end();
+        remove(imageTmp);
+        free(imageTmp);
+    }
+    if (stats.enabled) {
+        print_stats();
+    }
     // free memory!
     free_hashmap();
+    free_segments();
     return 0;
 }
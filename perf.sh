@@ -0,0 +1,91 @@
+# performance regression check: assembles and runs bench/programs against
+# their golden files (XOut.tk the assembly, X.out what the run prints), runs
+# the programs of bench/regress without and with -O against X.out and
+# X-O.out (what -O must not change, given its own layout), times
+# the assembler (bench/bench) and emulator (bench/suite) suites and the slow
+# inputs fuzz.sh found (bench/slow), appends the throughputs to
+# bench/perf-history.tsv and fails if any is more than THRESHOLD percent
+# (default 10) below the median of its last 5 runs there.
+#     sh perf.sh [THRESHOLD]
+threshold=${1:-10}
+history=bench/perf-history.tsv
+gcc -O2 -o bench/hw4 main.c -I uthash-master/src -pthread &&
+gcc -O2 -o bench/bench bench/bench.c -I . -I uthash-master/src -pthread &&
+gcc -O2 -o bench/suite bench/suite.c -I . -I uthash-master/src -pthread &&
+gcc -O2 -o bench/fuzz bench/fuzz.c -I . -I uthash-master/src -pthread || exit 1
+
+status=0
+out=$(mktemp) || exit 1
+for src in bench/programs/*.tk; do
+    case $src in *Out.tk) continue ;; esac
+    golden=${src%.tk}
+    if ! bench/hw4 "$src" "$out" || ! cmp -s "$out" "${golden}Out.tk"; then
+        echo "perf: $src assembles differently from ${golden}Out.tk"
+        status=1
+    fi
+    if ! bench/hw4 -r "$src" > "$out" || ! cmp -s "$out" "$golden.out"; then
+        echo "perf: $src runs differently from $golden.out"
+        status=1
+    fi
+done
+for src in bench/regress/*.tk; do
+    golden=${src%.tk}
+    if ! bench/hw4 -r "$src" > "$out" || ! cmp -s "$out" "$golden.out"; then
+        echo "perf: $src runs differently from $golden.out"
+        status=1
+    fi
+    if ! bench/hw4 -r -O "$src" > "$out" || ! cmp -s "$out" "$golden-O.out"; then
+        echo "perf: $src runs differently under -O from $golden-O.out"
+        status=1
+    fi
+done
+rm -f "$out"
+[ $status = 0 ] || exit 1
+
+# metric value lines: assembler lines/s per size and phase, MB/s per slow
+# input and stage, emulator MIPS per program and tier
+run=$(date +%Y-%m-%dT%H:%M:%S)
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+metrics=$({
+    bench/bench --sizes 100K,1M --seed 1 | awk 'NR > 1 { print "asm/" $1 "/" $2, $4 }'
+    bench/fuzz --check bench/slow | awk 'NR > 1 { print "slow/" $1 "/" $2, $4 }'
+    bench/suite --reps 5 | awk 'NR > 1 { print "emu/" $1 "/interp", $6; print "emu/" $1 "/jit", $8 }'
+}) || exit 1
+[ -n "$metrics" ] || exit 1
+
+# each metric against the median of its last 5 recorded values
+touch "$history"
+echo "$metrics" | awk -v threshold="$threshold" -v history="$history" '
+    BEGIN {
+        while ((getline line < history) > 0) {
+            split(line, f, "\t")
+            n = ++count[f[3]]
+            past[f[3], n] = f[4]
+        }
+    }
+    {
+        name = $1; value = $2; n = count[name]; k = 0
+        for (i = n > 5 ? n - 4 : 1; i <= n; i++) {
+            v[++k] = past[name, i]
+        }
+        for (i = 2; i <= k; i++) {
+            for (j = i; j > 1 && v[j - 1] > v[j]; j--) {
+                t = v[j]; v[j] = v[j - 1]; v[j - 1] = t
+            }
+        }
+        if (k == 0) {
+            printf "%-24s %14.1f  (no history)\n", name, value
+            next
+        }
+        median = k % 2 ? v[(k + 1) / 2] : (v[k / 2] + v[k / 2 + 1]) / 2
+        change = (value - median) / median * 100
+        flag = change < -threshold ? "  REGRESSION" : ""
+        printf "%-24s %14.1f  median %14.1f  %+6.1f%%%s\n", name, value, median, change, flag
+        if (flag != "") {
+            failed = 1
+        }
+    }
+    END { exit failed }'
+status=$?
+echo "$metrics" | awk -v run="$run" -v commit="$commit" '{ print run "\t" commit "\t" $1 "\t" $2 }' >> "$history"
+exit $status
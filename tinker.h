@@ -0,0 +1,71 @@
+/******************************************************************************
+ * tinker.h: the Tinker assembler as a library.
+ * Compile main.c with -DTINKER_LIBRARY and link the object into your
+ * program; its main is then tinker_main, and these are its only other
+ * external symbols:
+ *     cc -O2 -c -DTINKER_LIBRARY main.c -I uthash-master/src -o tinker.o
+ *     cc -O2 gen.c tinker.o -pthread
+ *
+ * Sources are assembled from memory into memory, as hw4 would assemble
+ * them to a file (-b for a .tko image, -O, --pool, --dce, --align-loops,
+ * --schedule). A context holds the output buffer and the messages of its
+ * last call and is reused from call to call, so a warm context assembles
+ * without growing them again.
+ * Contexts on different threads assemble concurrently, the label table and
+ * the IR being per thread; a context is used by one thread at a time.
+ *
+ *     TinkerContext *ctx = tinker_create();
+ *     const char *image;
+ *     size_t size;
+ *     if (tinker_assemble(ctx, src, len, NULL, &image, &size) != TINKER_OK) {
+ *         fputs(tinker_messages(ctx), stderr);
+ *     }
+ *     tinker_free(ctx);
+ ******************************************************************************/
+#ifndef TINKER_H
+#define TINKER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TinkerContext TinkerContext;
+
+typedef struct {
+    int binary;     // a .tko image instead of expanded assembly text (-b)
+    int optimize;   // peephole, stack coalescing and relaxation (-O)
+    int poolReg;    // with optimize, --pool through rN (0 to 30); -1 for none
+    int dce;        // with optimize, drop unreachable code (--dce)
+    int alignLoops; // with optimize, --align-loops N (a power of two, 4 to 4096); 0 for none
+    const char *schedule;   // with optimize, --schedule SPEC ("default", "load=4,mul=2", ...); NULL for none
+} TinkerOptions;
+
+enum {
+    TINKER_OK = 0,
+    TINKER_ERROR = 1    // an invalid line, an unencodable one (binary), or out of memory
+};
+
+// a new context, NULL if out of memory
+TinkerContext *tinker_create(void);
+
+// assemble the `len` bytes at `src` with `options` (NULL for text output);
+// on TINKER_OK *out and *outLen are the output, which stays valid until
+// the context's next call. Messages (warnings too) go to tinker_messages.
+int tinker_assemble(TinkerContext *ctx, const char *src, size_t len, const TinkerOptions *options,
+                    const char **out, size_t *outLen);
+
+// what the last call reported, one message per line ("" if nothing)
+const char *tinker_messages(const TinkerContext *ctx);
+
+void tinker_free(TinkerContext *ctx);
+
+// the hw4 command line
+int tinker_main(int argc, char *argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
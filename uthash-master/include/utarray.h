@@ -34,14 +34,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #ifdef __GNUC__
 #define UTARRAY_UNUSED __attribute__((__unused__))
+#define UTARRAY_PREFETCH(p) __builtin_prefetch(p)
 #else
 #define UTARRAY_UNUSED
+#define UTARRAY_PREFETCH(p) ((void)0)
 #endif
 
 #ifndef utarray_oom
 #define utarray_oom() exit(-1)
 #endif
 
+/* the capacity after n slots fill up; must be more than n */
+#ifndef utarray_grow
+#define utarray_grow(n) ((n) ? (2*(n)) : 8)
+#endif
+
 typedef void (ctor_f)(void *dst, const void *src);
 typedef void (dtor_f)(void *elt);
 typedef void (init_f)(void *elt);
@@ -56,6 +63,8 @@ typedef struct {
     unsigned i,n;/* i: index of next available slot, n: num slots */
     UT_icd icd;  /* initializer, copy and destructor functions */
     char *d;     /* n slots of size icd->sz*/
+    char *inl;   /* inline storage for the first ninl slots, or NULL */
+    unsigned ninl;
 } UT_array;
 
 #define utarray_init(a,_icd) do {                                             \
@@ -63,6 +72,14 @@ typedef struct {
   (a)->icd = *(_icd);                                                         \
 } while(0)
 
+#define utarray_init_inline(a,_icd,buf,len) do {                              \
+  utarray_init(a,_icd);                                                       \
+  (a)->inl = (char*)(buf);                                                    \
+  (a)->ninl = (unsigned)((len) / (a)->icd.sz);                                \
+  (a)->d = (a)->inl;                                                          \
+  (a)->n = (a)->ninl;                                                         \
+} while(0)
+
 #define utarray_done(a) do {                                                  \
   if ((a)->n) {                                                               \
     if ((a)->icd.dtor) {                                                      \
@@ -71,7 +88,9 @@ typedef struct {
         (a)->icd.dtor(utarray_eltptr(a,_ut_i));                               \
       }                                                                       \
     }                                                                         \
-    free((a)->d);                                                             \
+    if ((a)->d != (a)->inl) {                                                 \
+      free((a)->d);                                                           \
+    }                                                                         \
   }                                                                           \
   (a)->n=0;                                                                   \
 } while(0)
@@ -84,6 +103,15 @@ typedef struct {
   utarray_init(a,_icd);                                                       \
 } while(0)
 
+/* the first num slots are allocated with the UT_array itself */
+#define utarray_new_inline(a,_icd,num) do {                                   \
+  (a) = (UT_array*)malloc(sizeof(UT_array) + (num)*(_icd)->sz);              \
+  if ((a) == NULL) {                                                          \
+    utarray_oom();                                                            \
+  }                                                                           \
+  utarray_init_inline(a,_icd,(a)+1,(num)*(_icd)->sz);                        \
+} while(0)
+
 #define utarray_free(a) do {                                                  \
   utarray_done(a);                                                            \
   free(a);                                                                    \
@@ -92,8 +120,15 @@ typedef struct {
 #define utarray_reserve(a,by) do {                                            \
   if (((a)->i+(by)) > (a)->n) {                                               \
     char *utarray_tmp;                                                        \
-    while (((a)->i+(by)) > (a)->n) { (a)->n = ((a)->n ? (2*(a)->n) : 8); }    \
-    utarray_tmp=(char*)realloc((a)->d, (a)->n*(a)->icd.sz);                   \
+    while (((a)->i+(by)) > (a)->n) { (a)->n = utarray_grow((a)->n); }         \
+    if (((a)->inl != NULL) && ((a)->d == (a)->inl)) {                         \
+      utarray_tmp=(char*)malloc((a)->n*(a)->icd.sz);                          \
+      if (utarray_tmp != NULL) {                                              \
+        memcpy(utarray_tmp, (a)->d, (a)->i*(a)->icd.sz);                      \
+      }                                                                       \
+    } else {                                                                  \
+      utarray_tmp=(char*)realloc((a)->d, (a)->n*(a)->icd.sz);                 \
+    }                                                                         \
     if (utarray_tmp == NULL) {                                                \
       utarray_oom();                                                          \
     }                                                                         \
@@ -101,12 +136,62 @@ typedef struct {
   }                                                                           \
 } while(0)
 
+/* drop unused capacity, moving back into inline storage if the items fit */
+#define utarray_shrink_to_fit(a) do {                                         \
+  char *utarray_tmp;                                                          \
+  if (((a)->inl != NULL) && ((a)->i <= (a)->ninl)) {                          \
+    if ((a)->d != (a)->inl) {                                                 \
+      memcpy((a)->inl, (a)->d, (a)->i*(a)->icd.sz);                           \
+      free((a)->d);                                                           \
+      (a)->d = (a)->inl;                                                      \
+      (a)->n = (a)->ninl;                                                     \
+    }                                                                         \
+  } else if ((a)->n > (a)->i) {                                               \
+    if ((a)->i == 0) {                                                        \
+      free((a)->d);                                                           \
+      (a)->d = NULL;                                                          \
+    } else {                                                                  \
+      utarray_tmp=(char*)realloc((a)->d, (a)->i*(a)->icd.sz);                 \
+      if (utarray_tmp == NULL) {                                              \
+        utarray_oom();                                                        \
+      }                                                                       \
+      (a)->d=utarray_tmp;                                                     \
+    }                                                                         \
+    (a)->n = (a)->i;                                                          \
+  }                                                                           \
+} while(0)
+
 #define utarray_push_back(a,p) do {                                           \
   utarray_reserve(a,1);                                                       \
   if ((a)->icd.copy) { (a)->icd.copy( _utarray_eltptr(a,(a)->i++), p); }      \
   else { memcpy(_utarray_eltptr(a,(a)->i++), p, (a)->icd.sz); };              \
 } while(0)
 
+/* push num elements stored contiguously at p, with one memcpy if no copy */
+#define utarray_push_back_n(a,p,num) do {                                     \
+  unsigned _ut_i;                                                             \
+  utarray_reserve(a,num);                                                     \
+  if ((a)->icd.copy) {                                                        \
+    for (_ut_i = 0; _ut_i < (unsigned)(num); _ut_i++) {                       \
+      (a)->icd.copy(_utarray_eltptr(a, (a)->i + _ut_i),                       \
+                    (const char*)(p) + (_ut_i * (a)->icd.sz));                \
+    }                                                                         \
+  } else if ((num) > 0) {                                                     \
+    memcpy(_utarray_eltptr(a,(a)->i), p, (num)*(a)->icd.sz);                  \
+  }                                                                           \
+  (a)->i += (num);                                                            \
+} while(0)
+
+/* append num elements bitwise, bypassing icd.copy: the array takes over
+ * whatever the elements own */
+#define utarray_append_raw(a,p,num) do {                                      \
+  utarray_reserve(a,num);                                                     \
+  if ((num) > 0) {                                                            \
+    memcpy(_utarray_eltptr(a,(a)->i), p, (num)*(a)->icd.sz);                  \
+  }                                                                           \
+  (a)->i += (num);                                                            \
+} while(0)
+
 #define utarray_pop_back(a) do {                                              \
   if ((a)->icd.dtor) { (a)->icd.dtor( _utarray_eltptr(a,--((a)->i))); }       \
   else { (a)->i--; }                                                          \
@@ -225,6 +310,325 @@ typedef struct {
 #define utarray_back(a) (((a)->i) ? (_utarray_eltptr(a,(a)->i-1)) : NULL)
 #define utarray_eltidx(a,e) (((char*)(e) - (a)->d) / (a)->icd.sz)
 
+/* Eytzinger layout: the sorted elements in the breadth-first order of a
+ * complete binary search tree (the root, then its two children, ...), so a
+ * search walks forward through the array and the four levels below each step
+ * share one prefetched run of 16 elements. dst must be initialized with the
+ * same icd as the sorted src; it is replaced by the layout. */
+static void utarray_eyt_fill(UT_array *dst, const UT_array *src, unsigned *j, unsigned k) UTARRAY_UNUSED;
+static void utarray_eyt_fill(UT_array *dst, const UT_array *src, unsigned *j, unsigned k) {
+  if (k <= src->i) {
+    utarray_eyt_fill(dst, src, j, 2*k);
+    if (dst->icd.copy) {
+      dst->icd.copy(_utarray_eltptr(dst, k-1), _utarray_eltptr(src, *j));
+    } else {
+      memcpy(_utarray_eltptr(dst, k-1), _utarray_eltptr(src, *j), dst->icd.sz);
+    }
+    (*j)++;
+    utarray_eyt_fill(dst, src, j, 2*k+1);
+  }
+}
+
+#define utarray_eytzinger(dst,src) do {                                       \
+  unsigned _ut_j = 0;                                                         \
+  utarray_clear(dst);                                                         \
+  utarray_reserve(dst, utarray_len(src));                                     \
+  utarray_eyt_fill(dst, src, &_ut_j, 1);                                      \
+  (dst)->i = utarray_len(src);                                                \
+} while(0)
+
+/* the descent has no data-dependent branch; k ends as the path taken, whose
+ * last left turn (found by shifting off the trailing right turns) is the
+ * first element not less than v */
+#define _utarray_eyt_descend(a,k,less) do {                                   \
+  while ((k) <= (a)->i) {                                                     \
+    if (16*(k) <= (a)->i) {                                                   \
+      UTARRAY_PREFETCH(_utarray_eltptr(a, 16*(k)-1));                         \
+    }                                                                         \
+    (k) = 2*(k) + (unsigned)(less);                                           \
+  }                                                                           \
+  while ((k) & 1) {                                                           \
+    (k) >>= 1;                                                                \
+  }                                                                           \
+  (k) >>= 1;                                                                  \
+} while(0)
+
+static void *utarray_eyt_find(const UT_array *a, const void *v,
+                              int (*cmp)(const void *, const void *)) UTARRAY_UNUSED;
+static void *utarray_eyt_find(const UT_array *a, const void *v,
+                              int (*cmp)(const void *, const void *)) {
+  unsigned k = 1;
+  _utarray_eyt_descend(a, k, cmp(_utarray_eltptr(a, k-1), v) < 0);
+  if ((k == 0) || (cmp(_utarray_eltptr(a, k-1), v) != 0)) {
+    return NULL;
+  }
+  return _utarray_eltptr(a, k-1);
+}
+
+/* the same search on int elements, comparing inline instead of calling cmp */
+static int *utarray_eyt_find_int(const UT_array *a, int v) UTARRAY_UNUSED;
+static int *utarray_eyt_find_int(const UT_array *a, int v) {
+  const int *d = (const int *)a->d;
+  unsigned k = 1;
+  _utarray_eyt_descend(a, k, d[k-1] < v);
+  if ((k == 0) || (d[k-1] != v)) {
+    return NULL;
+  }
+  return (int *)d + (k-1);
+}
+
+#ifndef UTARRAY_NO_STDINT
+#include <stdint.h>  /* uint64_t */
+
+/* Radix sorts. utarray_radix_sort orders the elements by an unsigned integer
+ * of up to 64 bits that keyfcn(elt) returns, with a stable LSD radix sort a
+ * byte at a time; bytes in which all the keys agree take no pass. (To sort by
+ * a signed key, have keyfcn flip its sign bit, as utarray_int_key does.)
+ * utarray_radix_sort_str orders them by the string strfcn(elt) returns, with
+ * a stable MSD radix sort that finishes small buckets by insertion. The keys
+ * are extracted once, sorted with the element indexes, and the elements are
+ * then moved into place bitwise. Integer keys of at least
+ * UTARRAY_PARALLEL_MIN elements are first split by their leading byte, so
+ * that each bucket is sorted in cache. The _parallel variants, built with
+ * OpenMP, sort the buckets of such arrays on all threads; keyfcn and strfcn
+ * must then be thread-safe. */
+#ifndef UTARRAY_PARALLEL_MIN
+#define UTARRAY_PARALLEL_MIN 65536U
+#endif
+#ifndef UTARRAY_PARALLEL_FOR
+#if defined(_OPENMP)
+#define UTARRAY_PARALLEL_FOR _Pragma("omp parallel for schedule(static) if(_ut_par)")
+#define UTARRAY_PARALLEL_BUCKETS _Pragma("omp parallel for schedule(dynamic) if(_ut_par)")
+#else
+#define UTARRAY_PARALLEL_FOR
+#define UTARRAY_PARALLEL_BUCKETS
+#endif
+#endif
+
+typedef uint64_t (utarray_key_f)(const void *elt);
+typedef const char *(utarray_strkey_f)(const void *elt);
+
+#define utarray_radix_sort(a,keyfcn) utarray_radix_keys(a,keyfcn,0)
+#define utarray_radix_sort_parallel(a,keyfcn) utarray_radix_keys(a,keyfcn,1)
+#define utarray_radix_sort_str(a,strfcn) utarray_radix_strs(a,strfcn,0)
+#define utarray_radix_sort_str_parallel(a,strfcn) utarray_radix_strs(a,strfcn,1)
+
+/* the sorted indexes x select the new order of the elements of a */
+static void utarray_radix_move(UT_array *a, const unsigned *x, char *tmp, int _ut_par) UTARRAY_UNUSED;
+static void utarray_radix_move(UT_array *a, const unsigned *x, char *tmp, int _ut_par) {
+  int j;
+  (void)_ut_par;
+  UTARRAY_PARALLEL_FOR
+  for (j = 0; j < (int)a->i; j++) {
+    memcpy(tmp + (size_t)j * a->icd.sz, _utarray_eltptr(a, x[j]), a->icd.sz);
+  }
+  memcpy(a->d, tmp, (size_t)a->i * a->icd.sz);
+}
+
+/* stable LSD sort of the n keys k, with their indexes x, on the nb low bytes;
+ * k2 and x2 are scratch and the result is left in k and x */
+static void utarray_radix_lsd(uint64_t *k, unsigned *x, uint64_t *k2, unsigned *x2,
+                              unsigned n, unsigned nb) UTARRAY_UNUSED;
+static void utarray_radix_lsd(uint64_t *k, unsigned *x, uint64_t *k2, unsigned *x2,
+                              unsigned n, unsigned nb) {
+  unsigned c[8][256], i, d, b, sum, cnt, swapped = 0;
+  uint64_t *kt;
+  unsigned *xt;
+  if (n < 2) {
+    return;
+  }
+  memset(c, 0, sizeof(c));
+  for (i = 0; i < n; i++) {
+    for (d = 0; d < nb; d++) {
+      c[d][(k[i] >> (8U * d)) & 0xffU]++;
+    }
+  }
+  for (d = 0; d < nb; d++) {
+    if (c[d][(k[0] >> (8U * d)) & 0xffU] == n) {
+      continue;
+    }
+    for (sum = 0, b = 0; b < 256U; b++) {
+      cnt = c[d][b];
+      c[d][b] = sum;
+      sum += cnt;
+    }
+    for (i = 0; i < n; i++) {
+      b = c[d][(k[i] >> (8U * d)) & 0xffU]++;
+      k2[b] = k[i];
+      x2[b] = x[i];
+    }
+    kt = k; k = k2; k2 = kt;
+    xt = x; x = x2; x2 = xt;
+    swapped ^= 1U;
+  }
+  if (swapped) {
+    memcpy(k2, k, n * sizeof(uint64_t));
+    memcpy(x2, x, n * sizeof(unsigned));
+  }
+}
+
+static void utarray_radix_keys(UT_array *a, utarray_key_f *keyfcn, int parallel) UTARRAY_UNUSED;
+static void utarray_radix_keys(UT_array *a, utarray_key_f *keyfcn, int parallel) {
+  unsigned n = a->i, i, top, start[257], *x, *x2, *idx;
+  uint64_t *k, *k2, diff = 0;
+  int j, _ut_par = parallel && (n >= UTARRAY_PARALLEL_MIN);
+  char *buf;
+  if (n < 2) {
+    return;
+  }
+  buf = (char*)malloc((size_t)n * (2 * sizeof(uint64_t) + 2 * sizeof(unsigned) + a->icd.sz));
+  if (buf == NULL) {
+    utarray_oom();
+  }
+  k = (uint64_t*)(void*)buf;
+  k2 = k + n;
+  x = (unsigned*)(void*)(k2 + n);
+  x2 = x + n;
+  UTARRAY_PARALLEL_FOR
+  for (j = 0; j < (int)n; j++) {
+    k[j] = keyfcn(_utarray_eltptr(a, j));
+    x[j] = (unsigned)j;
+  }
+  if (n < UTARRAY_PARALLEL_MIN) {
+    utarray_radix_lsd(k, x, k2, x2, n, 8U);
+    idx = x;
+  } else {
+    /* one pass on the leading byte that differs, then each bucket alone,
+     * in cache, and on all threads if _ut_par */
+    for (i = 1; i < n; i++) {
+      diff |= k[i] ^ k[0];
+    }
+    for (top = 0; (top < 8U) && ((diff >> (8U * top)) > 0xffU); top++) {
+    }
+    memset(start, 0, sizeof(start));
+    for (i = 0; i < n; i++) {
+      start[((k[i] >> (8U * top)) & 0xffU) + 1]++;
+    }
+    for (i = 1; i < 257U; i++) {
+      start[i] += start[i-1];
+    }
+    for (i = 0; i < n; i++) {
+      unsigned b = start[(k[i] >> (8U * top)) & 0xffU]++;
+      k2[b] = k[i];
+      x2[b] = x[i];
+    }
+    for (i = 256U; i > 0; i--) {
+      start[i] = start[i-1];
+    }
+    start[0] = 0;
+    UTARRAY_PARALLEL_BUCKETS
+    for (j = 0; j < 256; j++) {
+      utarray_radix_lsd(k2 + start[j], x2 + start[j], k + start[j], x + start[j],
+                        start[j+1] - start[j], top);
+    }
+    idx = x2;
+  }
+  utarray_radix_move(a, idx, (char*)(x2 + n), _ut_par);
+  free(buf);
+}
+
+/* stable MSD sort of the n strings s from byte depth on, with their
+ * indexes x; s2 and x2 are scratch */
+static void utarray_radix_msd(const char **s, unsigned *x, const char **s2, unsigned *x2,
+                              unsigned n, size_t depth, int _ut_par) UTARRAY_UNUSED;
+static void utarray_radix_msd(const char **s, unsigned *x, const char **s2, unsigned *x2,
+                              unsigned n, size_t depth, int _ut_par) {
+  unsigned start[257], i, m, xv;
+  const char *sv;
+  int j;
+  (void)_ut_par;
+  if (n < 32U) {
+    for (i = 1; i < n; i++) {
+      sv = s[i];
+      xv = x[i];
+      for (m = i; (m > 0) && (strcmp(s[m-1] + depth, sv + depth) > 0); m--) {
+        s[m] = s[m-1];
+        x[m] = x[m-1];
+      }
+      s[m] = sv;
+      x[m] = xv;
+    }
+    return;
+  }
+  for (;;) {
+    memset(start, 0, sizeof(start));
+    for (i = 0; i < n; i++) {
+      start[(unsigned char)s[i][depth] + 1]++;
+    }
+    /* a byte all the strings share needs no pass */
+    for (i = 1; (i < 257U) && (start[i] != n); i++) {
+    }
+    if (i == 1U) {
+      return;
+    }
+    if (i == 257U) {
+      break;
+    }
+    depth++;
+  }
+  for (i = 1; i < 257U; i++) {
+    start[i] += start[i-1];
+  }
+  for (i = 0; i < n; i++) {
+    m = start[(unsigned char)s[i][depth]]++;
+    s2[m] = s[i];
+    x2[m] = x[i];
+  }
+  memcpy(s, s2, n * sizeof(char*));
+  memcpy(x, x2, n * sizeof(unsigned));
+  for (i = 256U; i > 0; i--) {
+    start[i] = start[i-1];
+  }
+  start[0] = 0;
+  /* bucket 0 holds the strings that end here, all equal */
+  UTARRAY_PARALLEL_BUCKETS
+  for (j = 1; j < 256; j++) {
+    if (start[j+1] - start[j] > 1U) {
+      utarray_radix_msd(s + start[j], x + start[j], s2 + start[j], x2 + start[j],
+                        start[j+1] - start[j], depth + 1, 0);
+    }
+  }
+}
+
+static void utarray_radix_strs(UT_array *a, utarray_strkey_f *strfcn, int parallel) UTARRAY_UNUSED;
+static void utarray_radix_strs(UT_array *a, utarray_strkey_f *strfcn, int parallel) {
+  unsigned n = a->i, *x, *x2;
+  const char **s, **s2;
+  int j, _ut_par = parallel && (n >= UTARRAY_PARALLEL_MIN);
+  char *buf;
+  if (n < 2) {
+    return;
+  }
+  buf = (char*)malloc((size_t)n * (2 * sizeof(char*) + 2 * sizeof(unsigned) + a->icd.sz));
+  if (buf == NULL) {
+    utarray_oom();
+  }
+  s = (const char**)(void*)buf;
+  s2 = s + n;
+  x = (unsigned*)(void*)(s2 + n);
+  x2 = x + n;
+  UTARRAY_PARALLEL_FOR
+  for (j = 0; j < (int)n; j++) {
+    s[j] = strfcn(_utarray_eltptr(a, j));
+    x[j] = (unsigned)j;
+  }
+  utarray_radix_msd(s, x, s2, x2, n, 0, _ut_par);
+  utarray_radix_move(a, x, (char*)(x2 + n), _ut_par);
+  free(buf);
+}
+
+/* key functions for ut_int_icd and ut_str_icd elements (NULL sorts as "") */
+static uint64_t utarray_int_key(const void *elt) UTARRAY_UNUSED;
+static uint64_t utarray_int_key(const void *elt) {
+  return (uint64_t)((unsigned)*(const int*)elt ^ ~(~0U >> 1));
+}
+static const char *utarray_str_key(const void *elt) UTARRAY_UNUSED;
+static const char *utarray_str_key(const void *elt) {
+  const char *s = *(char* const*)elt;
+  return (s != NULL) ? s : "";
+}
+#endif /* UTARRAY_NO_STDINT */
+
 /* last we pre-define a few icd for common utarrays of ints and strings */
 static void utarray_str_cpy(void *dst, const void *src) {
   char *const *srcc = (char *const *)src;
@@ -26,7 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define UTHASH_VERSION 2.3.0
 
-#include <string.h>   /* memcmp, memset, strlen */
+#include <string.h>   /* memcmp, memcpy, memset, strlen */
 #include <stddef.h>   /* ptrdiff_t */
 #include <stdlib.h>   /* exit */
 
@@ -94,18 +94,65 @@ do {
 #ifndef HASH_KEYCMP
 #define HASH_KEYCMP(a,b,n) memcmp(a,b,n)
 #endif
+#define HASH_KEY_EQ(a,b,n) (HASH_KEYCMP(a,b,n) == 0)
+/* an item's key (key, keylen) against the key sought (keyptr, n) */
+#define HASH_KEY_MATCH(key,keylen,keyptr,n)                                      \
+  (((keylen) == (n)) && HASH_KEY_EQ(key, keyptr, n))
 
+#if defined(HASH_STATS_FYI) && HASH_STATS_FYI
+/* the default fyi hooks pass the table's statistics to uthash_stats_fyi */
+#ifndef uthash_noexpand_fyi
+#define uthash_noexpand_fyi(tbl) HASH_STATS_EXPORT(tbl, "noexpand")
+#endif
+#ifndef uthash_expand_fyi
+#define uthash_expand_fyi(tbl) HASH_STATS_EXPORT(tbl, "expand")
+#endif
+#ifndef uthash_contract_fyi
+#define uthash_contract_fyi(tbl) HASH_STATS_EXPORT(tbl, "contract")
+#endif
+#endif
 #ifndef uthash_noexpand_fyi
 #define uthash_noexpand_fyi(tbl)          /* can be defined to log noexpand  */
 #endif
 #ifndef uthash_expand_fyi
 #define uthash_expand_fyi(tbl)            /* can be defined to log expands   */
 #endif
+#ifndef uthash_contract_fyi
+#define uthash_contract_fyi(tbl)          /* can be defined to log shrinks   */
+#endif
 
 #ifndef HASH_NONFATAL_OOM
 #define HASH_NONFATAL_OOM 0
 #endif
 
+#ifndef HASH_INCREMENTAL_RESIZE
+#define HASH_INCREMENTAL_RESIZE 0
+#endif
+
+#ifndef HASH_BUCKET_TAGS
+#define HASH_BUCKET_TAGS 0
+#endif
+
+#ifndef HASH_ALLOCATOR
+#define HASH_ALLOCATOR 0
+#endif
+
+#ifndef HASH_DENSE_INDEX
+#define HASH_DENSE_INDEX 0
+#endif
+
+#ifndef HASH_INORDER_INDEX
+#define HASH_INORDER_INDEX 0
+#endif
+
+#ifndef HASH_SEEDED
+#define HASH_SEEDED 0
+#endif
+
+#ifndef HASH_SHRINK
+#define HASH_SHRINK 0
+#endif
+
 #if HASH_NONFATAL_OOM
 /* malloc failures can be recovered from */
 
@@ -128,6 +175,74 @@ do {
 
 #endif
 
+#if HASH_ALLOCATOR
+/* each table keeps the allocator it was made with, for its buckets, bloom
+ * filter and itself; a NULL allocator means uthash_malloc and uthash_free */
+
+#ifndef uthash_table_allocator
+#define uthash_table_allocator(head) NULL /* allocator for a new table     */
+#endif
+
+#define HASH_ALLOC_MALLOC(alloc,sz)                                              \
+  (((alloc) != NULL) ? (alloc)->malloc_fn((alloc)->ctx, sz) : uthash_malloc(sz))
+#define HASH_ALLOC_FREE(alloc,ptr,sz)                                            \
+do {                                                                             \
+  const UT_hash_allocator *_haf_alloc = (alloc);                                 \
+  if (_haf_alloc != NULL) {                                                      \
+    _haf_alloc->free_fn(_haf_alloc->ctx, ptr, sz);                               \
+  } else {                                                                       \
+    uthash_free(ptr, sz);                                                        \
+  }                                                                              \
+} while (0)
+#define HASH_TBL_MALLOC(tbl,sz) HASH_ALLOC_MALLOC((tbl)->alloc, sz)
+#define HASH_TBL_FREE(tbl,ptr,sz) HASH_ALLOC_FREE((tbl)->alloc, ptr, sz)
+#define HASH_TABLE_ALLOC_DECL(head)                                              \
+  const UT_hash_allocator *_hmt_alloc = uthash_table_allocator(head);
+#define HASH_TABLE_MALLOC() HASH_ALLOC_MALLOC(_hmt_alloc, sizeof(UT_hash_table))
+#define HASH_TABLE_ALLOC_SET(tbl) (tbl)->alloc = _hmt_alloc;
+
+#else
+#define HASH_TBL_MALLOC(tbl,sz) uthash_malloc(sz)
+#define HASH_TBL_FREE(tbl,ptr,sz) uthash_free(ptr, sz)
+#define HASH_TABLE_ALLOC_DECL(head)
+#define HASH_TABLE_MALLOC() uthash_malloc(sizeof(UT_hash_table))
+#define HASH_TABLE_ALLOC_SET(tbl)
+#endif
+
+#if HASH_SEEDED
+/* each table takes a seed when it is made and mixes it into the bucket number
+ * of every hash value, so keys built to share the low bits of a known hash
+ * function scatter instead of piling into one chain. The hash values
+ * themselves don't change: they still move between tables (HASH_SELECT,
+ * HASH_ADD_FROM) and come from callers (the _BYHASHVALUE forms). */
+
+#ifndef uthash_table_seed
+#define uthash_table_seed(tbl) HASH_SEED_ADDRESS(tbl) /* seed for a new table */
+#endif
+
+/* the default seed: the table's heap address and a stack address, which both
+ * move from run to run under address space randomization. Define
+ * uthash_table_seed to draw from getrandom() or similar where that matters. */
+#define HASH_SEED_ADDRESS(tbl)                                                   \
+  HASH_SEED_MIX((unsigned)((size_t)(tbl) >> 4),                                  \
+                (unsigned)((size_t)&_hmt_stack >> 4) ^                           \
+                (unsigned)(((size_t)(tbl) >> 16) >> 16))
+
+/* lowbias32 (Wellons) of hashv ^ seed: every bit of the result depends on
+ * every bit of both */
+#define HASH_SEED_XS(x,r) ((x) ^ ((x) >> (r)))
+#define HASH_SEED_MIX(seed,hashv)                                                \
+  HASH_SEED_XS(HASH_SEED_XS(HASH_SEED_XS((unsigned)((hashv) ^ (seed)), 16)       \
+      * 0x7feb352dU, 15) * 0x846ca68bU, 16)
+#define HASH_BKT_HASH(tbl,hashv) HASH_SEED_MIX((tbl)->seed, hashv)
+#define HASH_TABLE_SEED_SET(tbl)                                                 \
+  { char _hmt_stack; (void)&_hmt_stack; (tbl)->seed = uthash_table_seed(tbl); }
+
+#else
+#define HASH_BKT_HASH(tbl,hashv) (hashv)
+#define HASH_TABLE_SEED_SET(tbl)
+#endif
+
 /* initial number of buckets */
 #define HASH_INITIAL_NUM_BUCKETS 32U     /* initial number of buckets        */
 #define HASH_INITIAL_NUM_BUCKETS_LOG2 5U /* lg2 of initial number of buckets */
@@ -141,30 +256,320 @@ do {
 #define HASH_ROLLBACK_BKT(hh, head, itemptrhh)                                   \
 do {                                                                             \
   struct UT_hash_handle *_hd_hh_item = (itemptrhh);                              \
-  unsigned _hd_bkt;                                                              \
-  HASH_TO_BKT(_hd_hh_item->hashv, (head)->hh.tbl->num_buckets, _hd_bkt);         \
-  (head)->hh.tbl->buckets[_hd_bkt].count++;                                      \
+  HASH_BKT((head)->hh.tbl, _hd_hh_item->hashv)->count++;                         \
   _hd_hh_item->hh_next = NULL;                                                   \
   _hd_hh_item->hh_prev = NULL;                                                   \
 } while (0)
 
+#if HASH_DENSE_INDEX
+/* HASH_DENSE_INDEX keeps, per table, an array of the items' hash handles in
+ * no particular order: dense[0] to dense[num_items-1]. An add appends to it,
+ * a delete moves the last entry into the hole, and each handle records its
+ * slot in dense_idx. HASH_DENSE_ITER and HASH_SELECT scan it, where the
+ * app-order list would make them chase hh.next from item to item. */
+#define HASH_DENSE_NONE 0xffffffffU      /* dense_idx of an item not indexed */
+#ifndef HASH_DENSE_AHEAD
+#define HASH_DENSE_AHEAD 8U              /* items prefetched ahead of a scan */
+#endif
+#define HASH_DENSE_ADD(tbl,addhh,idx,oomed)                                      \
+do {                                                                             \
+  unsigned _hda_i;                                                               \
+  if ((idx) >= (tbl)->dense_cap) {                                               \
+    unsigned _hda_cap = ((tbl)->dense_cap != 0U) ?                               \
+        2U * (tbl)->dense_cap : HASH_INITIAL_NUM_BUCKETS;                        \
+    struct UT_hash_handle **_hda_new = (struct UT_hash_handle**)HASH_TBL_MALLOC( \
+        tbl, _hda_cap * sizeof(struct UT_hash_handle*));                         \
+    if (_hda_new == NULL) {                                                      \
+      HASH_RECORD_OOM(oomed);                                                    \
+    } else {                                                                     \
+      for (_hda_i = 0; _hda_i < (tbl)->dense_cap; _hda_i++) {                    \
+        _hda_new[_hda_i] = (tbl)->dense[_hda_i];                                 \
+      }                                                                          \
+      HASH_DENSE_FREE(tbl);                                                      \
+      (tbl)->dense = _hda_new;                                                   \
+      (tbl)->dense_cap = _hda_cap;                                               \
+    }                                                                            \
+  }                                                                              \
+  if ((idx) < (tbl)->dense_cap) {                                                \
+    (tbl)->dense[idx] = (addhh);                                                 \
+    (addhh)->dense_idx = (idx);                                                  \
+  } else {                                                                       \
+    (addhh)->dense_idx = HASH_DENSE_NONE;                                        \
+  }                                                                              \
+} while (0)
+
+/* before num_items is decremented: the last entry fills the hole */
+#define HASH_DENSE_DEL(tbl,delhh)                                                \
+do {                                                                             \
+  unsigned _hdd_i = (delhh)->dense_idx;                                          \
+  if (_hdd_i != HASH_DENSE_NONE) {                                               \
+    struct UT_hash_handle *_hdd_last = (tbl)->dense[(tbl)->num_items - 1U];      \
+    (tbl)->dense[_hdd_i] = _hdd_last;                                            \
+    _hdd_last->dense_idx = _hdd_i;                                               \
+  }                                                                              \
+} while (0)
+/* newhh takes over the slot of oldhh */
+#define HASH_DENSE_SWAP(tbl,oldhh,newhh)                                         \
+do {                                                                             \
+  (newhh)->dense_idx = (oldhh)->dense_idx;                                       \
+  if ((oldhh)->dense_idx != HASH_DENSE_NONE) {                                   \
+    (tbl)->dense[(oldhh)->dense_idx] = (newhh);                                  \
+  }                                                                              \
+} while (0)
+#define HASH_DENSE_FREE(tbl)                                                     \
+do {                                                                             \
+  if ((tbl)->dense != NULL) {                                                    \
+    HASH_TBL_FREE(tbl, (tbl)->dense,                                             \
+                  (tbl)->dense_cap * sizeof(struct UT_hash_handle*));            \
+  }                                                                              \
+} while (0)
+#define HASH_DENSE_BYTES(tbl) ((tbl)->dense_cap * sizeof(struct UT_hash_handle*))
+/* prefetch the i-th item; i may run off either end (unsigned wraparound) */
+#define HASH_DENSE_PREFETCH(tbl,i)                                               \
+  (((i) < (tbl)->num_items) ? HASH_PREFETCH((tbl)->dense[i]) : (void)0)
+#define HASH_DENSE_ELMT(hh,head,i)                                               \
+  ELMT_FROM_HH((head)->hh.tbl, (head)->hh.tbl->dense[i])
+#define HASH_SELECT_SRC_LOOP(tbl,i,srchh)                                        \
+  for ((i) = 0; ((i) < (tbl)->num_items) && (((srchh) = (tbl)->dense[i]),        \
+       HASH_DENSE_PREFETCH(tbl, (i) + HASH_DENSE_AHEAD), 1); (i)++)
+#define HASH_FSCK_DENSE(hh,head,where)                                           \
+do {                                                                             \
+  unsigned _fd_i;                                                                \
+  for (_fd_i = 0; _fd_i < (head)->hh.tbl->num_items; ++_fd_i) {                  \
+    if ((_fd_i >= (head)->hh.tbl->dense_cap) ||                                  \
+        ((head)->hh.tbl->dense[_fd_i]->dense_idx != _fd_i) ||                    \
+        ((head)->hh.tbl->dense[_fd_i]->tbl != (head)->hh.tbl)) {                 \
+      HASH_OOPS("%s: invalid dense index entry %u\n", (where), _fd_i);           \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_DENSE_ADD(tbl,addhh,idx,oomed)
+#define HASH_DENSE_DEL(tbl,delhh)
+#define HASH_DENSE_SWAP(tbl,oldhh,newhh)
+#define HASH_DENSE_FREE(tbl)
+#define HASH_DENSE_BYTES(tbl) 0U
+#define HASH_SELECT_SRC_LOOP(tbl,i,srchh)                                        \
+  for ((i) = 0; (i) < (tbl)->num_buckets; (i)++)                                 \
+    for ((srchh) = (tbl)->buckets[i].hh_head; (srchh) != NULL;                   \
+         (srchh) = (srchh)->hh_next)
+#define HASH_FSCK_DENSE(hh,head,where)
+#endif
+
+#if HASH_INORDER_INDEX
+/* HASH_INORDER_INDEX keeps, per table, a skip list over the app-order list
+ * for the _INORDER adds. About one item in four has a node, linked into
+ * levels 1 and up (level 0 is the app-order list itself); an _INORDER add
+ * descends the levels to the last indexed item that doesn't compare greater
+ * than the new one, then walks the few items after it, so it calls cmpfcn
+ * O(log n) times rather than once per item ahead of the new one. The index
+ * only follows the app order, so it finds the same place as the walk does
+ * when the hash is sorted by cmpfcn. Plain adds append items without nodes,
+ * the sorts drop the index, and an _INORDER add rebuilds it in one pass once
+ * fewer than one item in HASH_SKIP_SPARSE has a node. Nodes come from the
+ * table's allocator; an item whose node can't be allocated isn't indexed. */
+#ifndef HASH_SKIP_MAX
+#define HASH_SKIP_MAX 16U                /* levels above the list: 4^16 items */
+#endif
+#define HASH_SKIP_SPARSE 16U
+#define HASH_SKIP_BYTES(lvl)                                                     \
+  (sizeof(UT_hash_skip) + 2U * (size_t)(lvl) * sizeof(UT_hash_skip*))
+#define HASH_SKIP_NEXT(node,i) ((node)->link[2U * (i)])
+#define HASH_SKIP_PREV(node,i) ((node)->link[2U * (i) + 1U])
+#define HASH_SKIP_INIT(addhh) ((addhh)->skip = NULL)
+
+/* a random level, 0 (no node) with probability 3/4 */
+#define HASH_SKIP_LEVEL(tbl,lvl)                                                 \
+do {                                                                             \
+  unsigned _hsl_r = ((tbl)->skip_rng != 0U) ? (tbl)->skip_rng : 0x9e3779b9U;     \
+  _hsl_r ^= _hsl_r << 13;                                                        \
+  _hsl_r ^= _hsl_r >> 17;                                                        \
+  _hsl_r ^= _hsl_r << 5;                                                         \
+  (tbl)->skip_rng = _hsl_r;                                                      \
+  for ((lvl) = 0; ((_hsl_r & 3U) == 0U) && ((lvl) < HASH_SKIP_MAX); (lvl)++) {   \
+    _hsl_r = (_hsl_r >> 2) | 0xc0000000U;                                        \
+  }                                                                              \
+} while (0)
+
+/* gives addhh a node after upd[i] at each of its levels, or none */
+#define HASH_SKIP_LINK(tbl,addhh,upd)                                            \
+do {                                                                             \
+  unsigned _hsk_lvl, _hsk_i;                                                     \
+  UT_hash_skip *_hsk_node, *_hsk_prev, *_hsk_next;                               \
+  HASH_SKIP_LEVEL(tbl, _hsk_lvl);                                                \
+  _hsk_node = (_hsk_lvl != 0U) ?                                                 \
+      (UT_hash_skip*)HASH_TBL_MALLOC(tbl, HASH_SKIP_BYTES(_hsk_lvl)) : NULL;     \
+  if (_hsk_node != NULL) {                                                       \
+    _hsk_node->item = (addhh);                                                   \
+    _hsk_node->level = _hsk_lvl;                                                 \
+    _hsk_node->link = (UT_hash_skip**)(void*)(_hsk_node + 1);                    \
+    for (_hsk_i = 0; _hsk_i < _hsk_lvl; _hsk_i++) {                              \
+      _hsk_prev = (_hsk_i < (tbl)->skip_levels) ? (upd)[_hsk_i] : NULL;          \
+      _hsk_next = (_hsk_prev != NULL) ? HASH_SKIP_NEXT(_hsk_prev, _hsk_i) :      \
+                                        (tbl)->skip_head[_hsk_i];                \
+      HASH_SKIP_NEXT(_hsk_node, _hsk_i) = _hsk_next;                             \
+      HASH_SKIP_PREV(_hsk_node, _hsk_i) = _hsk_prev;                             \
+      if (_hsk_next != NULL) {                                                   \
+        HASH_SKIP_PREV(_hsk_next, _hsk_i) = _hsk_node;                           \
+      }                                                                          \
+      if (_hsk_prev != NULL) {                                                   \
+        HASH_SKIP_NEXT(_hsk_prev, _hsk_i) = _hsk_node;                           \
+      } else {                                                                   \
+        (tbl)->skip_head[_hsk_i] = _hsk_node;                                    \
+      }                                                                          \
+    }                                                                            \
+    if (_hsk_lvl > (tbl)->skip_levels) {                                         \
+      (tbl)->skip_levels = _hsk_lvl;                                             \
+    }                                                                            \
+    (tbl)->skip_nodes++;                                                         \
+    (tbl)->skip_bytes += HASH_SKIP_BYTES(_hsk_lvl);                              \
+    (addhh)->skip = _hsk_node;                                                   \
+  }                                                                              \
+} while (0)
+
+/* before delhh leaves the app-order list; delhh itself isn't written to */
+#define HASH_SKIP_UNLINK(tbl,delhh)                                              \
+do {                                                                             \
+  UT_hash_skip *_hsu_node = (delhh)->skip;                                       \
+  unsigned _hsu_i;                                                               \
+  if (_hsu_node != NULL) {                                                       \
+    for (_hsu_i = 0; _hsu_i < _hsu_node->level; _hsu_i++) {                      \
+      if (HASH_SKIP_NEXT(_hsu_node, _hsu_i) != NULL) {                           \
+        HASH_SKIP_PREV(HASH_SKIP_NEXT(_hsu_node, _hsu_i), _hsu_i) =              \
+            HASH_SKIP_PREV(_hsu_node, _hsu_i);                                   \
+      }                                                                          \
+      if (HASH_SKIP_PREV(_hsu_node, _hsu_i) != NULL) {                           \
+        HASH_SKIP_NEXT(HASH_SKIP_PREV(_hsu_node, _hsu_i), _hsu_i) =              \
+            HASH_SKIP_NEXT(_hsu_node, _hsu_i);                                   \
+      } else {                                                                   \
+        (tbl)->skip_head[_hsu_i] = HASH_SKIP_NEXT(_hsu_node, _hsu_i);            \
+      }                                                                          \
+    }                                                                            \
+    (tbl)->skip_nodes--;                                                         \
+    (tbl)->skip_bytes -= HASH_SKIP_BYTES(_hsu_node->level);                      \
+    HASH_TBL_FREE(tbl, _hsu_node, HASH_SKIP_BYTES(_hsu_node->level));            \
+  }                                                                              \
+} while (0)
+
+/* newhh takes over the node of oldhh, if it has one */
+#define HASH_SKIP_SWAP(tbl,oldhh,newhh)                                          \
+do {                                                                             \
+  (newhh)->skip = (oldhh)->skip;                                                 \
+  if ((oldhh)->skip != NULL) {                                                   \
+    (oldhh)->skip->item = (newhh);                                               \
+  }                                                                              \
+} while (0)
+
+/* frees every node; the items' skip fields are reset only if reset is set,
+ * so the items needn't exist any more when a table is freed */
+#define HASH_SKIP_FREE(tbl,reset)                                                \
+do {                                                                             \
+  UT_hash_skip *_hsf_node = (tbl)->skip_head[0], *_hsf_next;                     \
+  unsigned _hsf_i;                                                               \
+  while (_hsf_node != NULL) {                                                    \
+    _hsf_next = HASH_SKIP_NEXT(_hsf_node, 0U);                                   \
+    if (reset) {                                                                 \
+      _hsf_node->item->skip = NULL;                                              \
+    }                                                                            \
+    HASH_TBL_FREE(tbl, _hsf_node, HASH_SKIP_BYTES(_hsf_node->level));            \
+    _hsf_node = _hsf_next;                                                       \
+  }                                                                              \
+  for (_hsf_i = 0U; _hsf_i < (tbl)->skip_levels; _hsf_i++) {                     \
+    (tbl)->skip_head[_hsf_i] = NULL;                                             \
+  }                                                                              \
+  (tbl)->skip_levels = 0;                                                        \
+  (tbl)->skip_nodes = 0;                                                         \
+  (tbl)->skip_bytes = 0;                                                         \
+} while (0)
+
+/* indexes the whole app-order list afresh, from its first item hh0 */
+#define HASH_SKIP_REBUILD(tbl,hh0)                                               \
+do {                                                                             \
+  UT_hash_skip *_hsr_last[HASH_SKIP_MAX];                                        \
+  UT_hash_handle *_hsr_hh;                                                       \
+  HASH_SKIP_FREE(tbl, 1);                                                        \
+  for (_hsr_hh = (hh0); _hsr_hh != NULL; _hsr_hh = (_hsr_hh->next != NULL) ?     \
+       HH_FROM_ELMT(tbl, _hsr_hh->next) : NULL) {                                \
+    HASH_SKIP_LINK(tbl, _hsr_hh, _hsr_last);                                     \
+    if (_hsr_hh->skip != NULL) {                                                 \
+      unsigned _hsr_i;                                                           \
+      for (_hsr_i = 0; _hsr_i < _hsr_hh->skip->level; _hsr_i++) {                \
+        _hsr_last[_hsr_i] = _hsr_hh->skip;                                       \
+      }                                                                          \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* sets iter to the item the _INORDER walk for add starts from (NULL if add
+ * goes last) and upd[i] to the last node of level i before add's place */
+#define HASH_SKIP_SEARCH(hh,head,add,cmpfcn,upd,iter)                            \
+do {                                                                             \
+  UT_hash_table *_hss_tbl = (head)->hh.tbl;                                      \
+  UT_hash_skip *_hss_x = NULL, *_hss_nxt;                                        \
+  unsigned _hss_i;                                                               \
+  int _hss_c;                                                                    \
+  if ((_hss_tbl->num_items >= 64U) &&                                            \
+      (_hss_tbl->skip_nodes * HASH_SKIP_SPARSE < _hss_tbl->num_items)) {         \
+    HASH_SKIP_REBUILD(_hss_tbl, &((head)->hh));                                  \
+  }                                                                              \
+  for (_hss_i = _hss_tbl->skip_levels; _hss_i-- > 0U; ) {                        \
+    for (;;) {                                                                   \
+      _hss_nxt = (_hss_x != NULL) ? HASH_SKIP_NEXT(_hss_x, _hss_i) :             \
+                                    _hss_tbl->skip_head[_hss_i];                 \
+      if (_hss_nxt == NULL) {                                                    \
+        break;                                                                   \
+      }                                                                          \
+      HASH_AKBI_CMP(head, ELMT_FROM_HH(_hss_tbl, _hss_nxt->item), add, cmpfcn, _hss_c); \
+      if (_hss_c > 0) {                                                          \
+        break;                                                                   \
+      }                                                                          \
+      _hss_x = _hss_nxt;                                                         \
+    }                                                                            \
+    (upd)[_hss_i] = _hss_x;                                                      \
+  }                                                                              \
+  (iter) = (_hss_x != NULL) ? _hss_x->item->next : (void*)(head);                \
+} while (0)
+#define HASH_SKIP_DECL UT_hash_skip *_hs_upd[HASH_SKIP_MAX];
+/* after the add: on a new table, skip_levels is 0 and upd isn't read */
+#define HASH_SKIP_ADDED(hh,head,add)                                             \
+do {                                                                             \
+  if (((head) != NULL) && ((add)->hh.tbl != NULL)) {                             \
+    HASH_SKIP_LINK((head)->hh.tbl, &(add)->hh, _hs_upd);                         \
+  }                                                                              \
+} while (0)
+#define HASH_SKIP_OVERHEAD(tbl) ((tbl)->skip_bytes)
+#else
+#define HASH_SKIP_INIT(addhh)
+#define HASH_SKIP_UNLINK(tbl,delhh)
+#define HASH_SKIP_SWAP(tbl,oldhh,newhh)
+#define HASH_SKIP_FREE(tbl,reset)
+#define HASH_SKIP_SEARCH(hh,head,add,cmpfcn,upd,iter) ((iter) = (void*)(head))
+#define HASH_SKIP_DECL
+#define HASH_SKIP_ADDED(hh,head,add)
+#define HASH_SKIP_OVERHEAD(tbl) 0U
+#endif
+
 #define HASH_VALUE(keyptr,keylen,hashv)                                          \
 do {                                                                             \
   HASH_FUNCTION(keyptr, keylen, hashv);                                          \
 } while (0)
 
-#define HASH_FIND_BYHASHVALUE(hh,head,keyptr,keylen,hashval,out)                 \
+#define HASH_FIND_BYHASHVALUE_EQ(hh,head,keyptr,keylen,hashval,out,keymatch)     \
 do {                                                                             \
   (out) = NULL;                                                                  \
   if (head) {                                                                    \
-    unsigned _hf_bkt;                                                            \
-    HASH_TO_BKT(hashval, (head)->hh.tbl->num_buckets, _hf_bkt);                  \
+    HASH_MIGRATE((head)->hh.tbl);                                                \
     if (HASH_BLOOM_TEST((head)->hh.tbl, hashval)) {                              \
-      HASH_FIND_IN_BKT((head)->hh.tbl, hh, (head)->hh.tbl->buckets[ _hf_bkt ], keyptr, keylen, hashval, out); \
+      UT_hash_bucket *_hf_bkt = HASH_BKT((head)->hh.tbl, hashval);               \
+      HASH_FIND_IN_BKT_EQ((head)->hh.tbl, hh, *_hf_bkt, keyptr, keylen, hashval, \
+                          out, keymatch);                                        \
     }                                                                            \
   }                                                                              \
 } while (0)
 
+#define HASH_FIND_BYHASHVALUE(hh,head,keyptr,keylen,hashval,out)                 \
+  HASH_FIND_BYHASHVALUE_EQ(hh, head, keyptr, keylen, hashval, out, HASH_KEY_MATCH)
+
 #define HASH_FIND(hh,head,keyptr,keylen,out)                                     \
 do {                                                                             \
   (out) = NULL;                                                                  \
@@ -175,13 +580,127 @@ do {
   }                                                                              \
 } while (0)
 
+/* HASH_FIND_BATCH looks up n keys at once: keys[i] points to the i-th key
+ * (keylen bytes) and out[i] is set to its item, or NULL. The keys go in
+ * groups of HASH_BATCH_SIZE: a group is hashed and its buckets prefetched,
+ * then the items at the heads of those chains are prefetched, and only then
+ * are the chains walked, so the cache misses of a group overlap instead of
+ * each waiting on the one before. */
+#ifndef HASH_BATCH_SIZE
+#define HASH_BATCH_SIZE 16U
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define HASH_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define HASH_PREFETCH(p) ((void)0)
+#endif
+
+#define HASH_FIND_BATCH_KEYS(hh,head,keys,keylen,strkeys,n,out)                  \
+do {                                                                             \
+  size_t _hb_i, _hb_j, _hb_m, _hb_n = (size_t)(n);                               \
+  unsigned _hb_hashv[HASH_BATCH_SIZE], _hb_len[HASH_BATCH_SIZE];                 \
+  for (_hb_i = 0; _hb_i < _hb_n; _hb_i += _hb_m) {                               \
+    _hb_m = (_hb_n - _hb_i < HASH_BATCH_SIZE) ? _hb_n - _hb_i : HASH_BATCH_SIZE; \
+    if (!(head)) {                                                               \
+      for (_hb_j = 0; _hb_j < _hb_m; _hb_j++) {                                  \
+        (out)[_hb_i + _hb_j] = NULL;                                             \
+      }                                                                          \
+      continue;                                                                  \
+    }                                                                            \
+    for (_hb_j = 0; _hb_j < _hb_m; _hb_j++) {                                    \
+      const void *_hb_key = (keys)[_hb_i + _hb_j];                               \
+      _hb_len[_hb_j] = (strkeys) ? (unsigned)uthash_strlen((const char*)_hb_key) \
+                                 : (unsigned)(keylen);                           \
+      HASH_VALUE(_hb_key, _hb_len[_hb_j], _hb_hashv[_hb_j]);                     \
+      HASH_PREFETCH(HASH_BKT((head)->hh.tbl, _hb_hashv[_hb_j]));                 \
+    }                                                                            \
+    for (_hb_j = 0; _hb_j < _hb_m; _hb_j++) {                                    \
+      HASH_PREFETCH(HASH_BKT((head)->hh.tbl, _hb_hashv[_hb_j])->hh_head);        \
+    }                                                                            \
+    for (_hb_j = 0; _hb_j < _hb_m; _hb_j++) {                                    \
+      HASH_FIND_BYHASHVALUE(hh, head, (keys)[_hb_i + _hb_j], _hb_len[_hb_j],     \
+                            _hb_hashv[_hb_j], (out)[_hb_i + _hb_j]);             \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+#define HASH_FIND_BATCH(hh,head,keys,keylen,n,out)                               \
+    HASH_FIND_BATCH_KEYS(hh, head, keys, keylen, 0, n, out)
+
 #ifdef HASH_BLOOM
+#ifndef HASH_BLOOM_BLOCKED
+#define HASH_BLOOM_BLOCKED 0
+#endif
+#if HASH_BLOOM_BLOCKED
+/* Blocked Bloom filter (-DHASH_BLOOM_BLOCKED=1). The 2^HASH_BLOOM bits are
+ * split into 64-byte blocks, aligned to cache lines. The high bits of the
+ * hash value pick a block, and each item sets one bit in each of its eight
+ * 64-bit words, chosen by multiplying the hash value by a per-word odd
+ * constant. A test thus reads one cache line, and its false positive rate
+ * is that of an 8-probe filter rather than a single bit. The test is one
+ * branch-free expression, which compilers can vectorize. */
+#if HASH_BLOOM < 9
+#error "HASH_BLOOM_BLOCKED needs HASH_BLOOM of at least 9 (one 512-bit block)"
+#endif
+#define HASH_BLOOM_BITLEN (1UL << HASH_BLOOM)
+#define HASH_BLOOM_BYTELEN ((HASH_BLOOM_BITLEN/8UL) + 64UL) /* room to align */
+#define HASH_BLOOM_MAKE(tbl,oomed)                                               \
+do {                                                                             \
+  (tbl)->bloom_nbits = HASH_BLOOM;                                               \
+  (tbl)->bloom_bv = (uint8_t*)HASH_TBL_MALLOC(tbl, HASH_BLOOM_BYTELEN);          \
+  if (!(tbl)->bloom_bv) {                                                        \
+    HASH_RECORD_OOM(oomed);                                                      \
+  } else {                                                                       \
+    uthash_bzero((tbl)->bloom_bv, HASH_BLOOM_BYTELEN);                           \
+    (tbl)->bloom_blocks = (uint64_t*)(void*)((tbl)->bloom_bv +                   \
+        ((64U - ((size_t)(tbl)->bloom_bv & 63U)) & 63U));                        \
+    (tbl)->bloom_sig = HASH_BLOOM_SIGNATURE;                                     \
+  }                                                                              \
+} while (0)
+
+#define HASH_BLOOM_FREE(tbl)                                                     \
+do {                                                                             \
+  HASH_TBL_FREE(tbl, (tbl)->bloom_bv, HASH_BLOOM_BYTELEN);                       \
+} while (0)
+
+#define HASH_BLOOM_BLOCK(tbl,hashv)                                              \
+  ((tbl)->bloom_blocks +                                                         \
+   8U * (size_t)(((uint64_t)(uint32_t)(hashv) * (HASH_BLOOM_BITLEN / 512UL)) >> 32))
+#define HASH_BLOOM_WORDBIT(hashv,salt)                                           \
+  ((uint64_t)1 << (((uint32_t)(hashv) * (uint32_t)(salt)) >> 26))
+#define HASH_BLOOM_WORD(b,i,hashv,salt)                                          \
+  ((b)[i] & HASH_BLOOM_WORDBIT(hashv, salt))
+
+#define HASH_BLOOM_ADD(tbl,hashv)                                                \
+do {                                                                             \
+  uint64_t *_hbl_b = HASH_BLOOM_BLOCK(tbl, hashv);                               \
+  _hbl_b[0] |= HASH_BLOOM_WORDBIT(hashv, 0x47b6137bU);                           \
+  _hbl_b[1] |= HASH_BLOOM_WORDBIT(hashv, 0x44974d91U);                           \
+  _hbl_b[2] |= HASH_BLOOM_WORDBIT(hashv, 0x8824ad5bU);                           \
+  _hbl_b[3] |= HASH_BLOOM_WORDBIT(hashv, 0xa2b7289dU);                           \
+  _hbl_b[4] |= HASH_BLOOM_WORDBIT(hashv, 0x705495c7U);                           \
+  _hbl_b[5] |= HASH_BLOOM_WORDBIT(hashv, 0x2df1424bU);                           \
+  _hbl_b[6] |= HASH_BLOOM_WORDBIT(hashv, 0x9efc4947U);                           \
+  _hbl_b[7] |= HASH_BLOOM_WORDBIT(hashv, 0x5c6bfb31U);                           \
+} while (0)
+
+#define HASH_BLOOM_TEST(tbl,hashv)                                               \
+  ((HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 0, hashv, 0x47b6137bU) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 1, hashv, 0x44974d91U) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 2, hashv, 0x8824ad5bU) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 3, hashv, 0xa2b7289dU) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 4, hashv, 0x705495c7U) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 5, hashv, 0x2df1424bU) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 6, hashv, 0x9efc4947U) != 0) & \
+   (HASH_BLOOM_WORD(HASH_BLOOM_BLOCK(tbl, hashv), 7, hashv, 0x5c6bfb31U) != 0))
+
+#else
 #define HASH_BLOOM_BITLEN (1UL << HASH_BLOOM)
 #define HASH_BLOOM_BYTELEN (HASH_BLOOM_BITLEN/8UL) + (((HASH_BLOOM_BITLEN%8UL)!=0UL) ? 1UL : 0UL)
 #define HASH_BLOOM_MAKE(tbl,oomed)                                               \
 do {                                                                             \
   (tbl)->bloom_nbits = HASH_BLOOM;                                               \
-  (tbl)->bloom_bv = (uint8_t*)uthash_malloc(HASH_BLOOM_BYTELEN);                 \
+  (tbl)->bloom_bv = (uint8_t*)HASH_TBL_MALLOC(tbl, HASH_BLOOM_BYTELEN);          \
   if (!(tbl)->bloom_bv) {                                                        \
     HASH_RECORD_OOM(oomed);                                                      \
   } else {                                                                       \
@@ -192,7 +711,7 @@ do {
 
 #define HASH_BLOOM_FREE(tbl)                                                     \
 do {                                                                             \
-  uthash_free((tbl)->bloom_bv, HASH_BLOOM_BYTELEN);                              \
+  HASH_TBL_FREE(tbl, (tbl)->bloom_bv, HASH_BLOOM_BYTELEN);                       \
 } while (0)
 
 #define HASH_BLOOM_BITSET(bv,idx) (bv[(idx)/8U] |= (1U << ((idx)%8U)))
@@ -204,6 +723,7 @@ do {
 #define HASH_BLOOM_TEST(tbl,hashv)                                               \
   HASH_BLOOM_BITTEST((tbl)->bloom_bv, ((hashv) & (uint32_t)((1UL << (tbl)->bloom_nbits) - 1U)))
 
+#endif
 #else
 #define HASH_BLOOM_MAKE(tbl,oomed)
 #define HASH_BLOOM_FREE(tbl)
@@ -214,30 +734,33 @@ do {
 
 #define HASH_MAKE_TABLE(hh,head,oomed)                                           \
 do {                                                                             \
-  (head)->hh.tbl = (UT_hash_table*)uthash_malloc(sizeof(UT_hash_table));         \
+  HASH_TABLE_ALLOC_DECL(head)                                                    \
+  (head)->hh.tbl = (UT_hash_table*)HASH_TABLE_MALLOC();                          \
   if (!(head)->hh.tbl) {                                                         \
     HASH_RECORD_OOM(oomed);                                                      \
   } else {                                                                       \
     uthash_bzero((head)->hh.tbl, sizeof(UT_hash_table));                         \
+    HASH_TABLE_ALLOC_SET((head)->hh.tbl)                                         \
+    HASH_TABLE_SEED_SET((head)->hh.tbl)                                          \
     (head)->hh.tbl->tail = &((head)->hh);                                        \
     (head)->hh.tbl->num_buckets = HASH_INITIAL_NUM_BUCKETS;                      \
     (head)->hh.tbl->log2_num_buckets = HASH_INITIAL_NUM_BUCKETS_LOG2;            \
     (head)->hh.tbl->hho = (char*)(&(head)->hh) - (char*)(head);                  \
-    (head)->hh.tbl->buckets = (UT_hash_bucket*)uthash_malloc(                    \
+    (head)->hh.tbl->buckets = (UT_hash_bucket*)HASH_TBL_MALLOC((head)->hh.tbl,   \
         HASH_INITIAL_NUM_BUCKETS * sizeof(struct UT_hash_bucket));               \
     (head)->hh.tbl->signature = HASH_SIGNATURE;                                  \
     if (!(head)->hh.tbl->buckets) {                                              \
       HASH_RECORD_OOM(oomed);                                                    \
-      uthash_free((head)->hh.tbl, sizeof(UT_hash_table));                        \
+      HASH_TBL_FREE((head)->hh.tbl, (head)->hh.tbl, sizeof(UT_hash_table));      \
     } else {                                                                     \
       uthash_bzero((head)->hh.tbl->buckets,                                      \
           HASH_INITIAL_NUM_BUCKETS * sizeof(struct UT_hash_bucket));             \
       HASH_BLOOM_MAKE((head)->hh.tbl, oomed);                                    \
       IF_HASH_NONFATAL_OOM(                                                      \
         if (oomed) {                                                             \
-          uthash_free((head)->hh.tbl->buckets,                                   \
+          HASH_TBL_FREE((head)->hh.tbl, (head)->hh.tbl->buckets,                 \
               HASH_INITIAL_NUM_BUCKETS*sizeof(struct UT_hash_bucket));           \
-          uthash_free((head)->hh.tbl, sizeof(UT_hash_table));                    \
+          HASH_TBL_FREE((head)->hh.tbl, (head)->hh.tbl, sizeof(UT_hash_table));  \
         }                                                                        \
       )                                                                          \
     }                                                                            \
@@ -278,6 +801,82 @@ do {
   HASH_REPLACE_BYHASHVALUE_INORDER(hh, head, fieldname, keylen_in, _hr_hashv, add, replaced, cmpfcn); \
 } while (0)
 
+/* Upserts. HASH_UPSERT is HASH_REPLACE without the delete and re-add: if an
+ * item has add's key, add takes over that item's place in its bucket chain
+ * and in the app order (where HASH_REPLACE would move add to the end), so only
+ * the links of its neighbours are rewritten, in O(1), and the table never
+ * expands. HASH_FIND_OR_ADD hashes keyptr once for both a find and, if that
+ * misses, an add of the item that make evaluates to (its fieldname must hold
+ * the key); out is the item found or added, or NULL if make gave NULL. */
+#define HASH_SWAP_HH(hh,head,oldhh,newhh,keyptr,keylen_in)                       \
+do {                                                                             \
+  struct UT_hash_handle *_hw_old = (oldhh), *_hw_new = (newhh);                  \
+  UT_hash_table *_hw_tbl = _hw_old->tbl;                                         \
+  UT_hash_bucket *_hw_bkt = HASH_BKT(_hw_tbl, _hw_old->hashv);                   \
+  _hw_new->tbl = _hw_tbl;                                                        \
+  _hw_new->prev = _hw_old->prev;                                                 \
+  _hw_new->next = _hw_old->next;                                                 \
+  _hw_new->hh_prev = _hw_old->hh_prev;                                           \
+  _hw_new->hh_next = _hw_old->hh_next;                                           \
+  _hw_new->key = (const void*) (keyptr);                                         \
+  _hw_new->keylen = (unsigned) (keylen_in);                                      \
+  _hw_new->hashv = _hw_old->hashv;                                               \
+  if (_hw_old->prev != NULL) {                                                   \
+    HH_FROM_ELMT(_hw_tbl, _hw_old->prev)->next = ELMT_FROM_HH(_hw_tbl, _hw_new); \
+  } else {                                                                       \
+    DECLTYPE_ASSIGN(head, ELMT_FROM_HH(_hw_tbl, _hw_new));                       \
+  }                                                                              \
+  if (_hw_old->next != NULL) {                                                   \
+    HH_FROM_ELMT(_hw_tbl, _hw_old->next)->prev = ELMT_FROM_HH(_hw_tbl, _hw_new); \
+  }                                                                              \
+  if (_hw_tbl->tail == _hw_old) {                                                \
+    _hw_tbl->tail = _hw_new;                                                     \
+  }                                                                              \
+  if (_hw_old->hh_prev != NULL) {                                                \
+    _hw_old->hh_prev->hh_next = _hw_new;                                         \
+  } else {                                                                       \
+    _hw_bkt->hh_head = _hw_new;                                                  \
+  }                                                                              \
+  if (_hw_old->hh_next != NULL) {                                                \
+    _hw_old->hh_next->hh_prev = _hw_new;                                         \
+  }                                                                              \
+  HASH_BKT_TAG_SWAP(_hw_bkt, _hw_old, _hw_new);                                  \
+  HASH_DENSE_SWAP(_hw_tbl, _hw_old, _hw_new);                                    \
+  HASH_SKIP_SWAP(_hw_tbl, _hw_old, _hw_new);                                     \
+} while (0)
+
+#define HASH_UPSERT_BYHASHVALUE(hh,head,fieldname,keylen_in,hashval,add,replaced)\
+do {                                                                             \
+  (replaced) = NULL;                                                             \
+  HASH_FIND_BYHASHVALUE(hh, head, &((add)->fieldname), keylen_in, hashval, replaced);\
+  if (replaced) {                                                                \
+    HASH_SWAP_HH(hh, head, &(replaced)->hh, &(add)->hh, &((add)->fieldname), keylen_in);\
+    HASH_FSCK(hh, head, "HASH_UPSERT_BYHASHVALUE");                              \
+  } else {                                                                       \
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, head, &((add)->fieldname), keylen_in, hashval, add);\
+  }                                                                              \
+} while (0)
+
+#define HASH_UPSERT(hh,head,fieldname,keylen_in,add,replaced)                    \
+do {                                                                             \
+  unsigned _hu_hashv;                                                            \
+  HASH_VALUE(&((add)->fieldname), keylen_in, _hu_hashv);                         \
+  HASH_UPSERT_BYHASHVALUE(hh, head, fieldname, keylen_in, _hu_hashv, add, replaced); \
+} while (0)
+
+#define HASH_FIND_OR_ADD(hh,head,fieldname,keyptr,keylen_in,out,make)            \
+do {                                                                             \
+  unsigned _hfa_hashv;                                                           \
+  HASH_VALUE(keyptr, keylen_in, _hfa_hashv);                                     \
+  HASH_FIND_BYHASHVALUE(hh, head, keyptr, keylen_in, _hfa_hashv, out);           \
+  if ((out) == NULL) {                                                           \
+    (out) = (make);                                                              \
+    if (out) {                                                                   \
+      HASH_ADD_KEYPTR_BYHASHVALUE(hh, head, &((out)->fieldname), keylen_in, _hfa_hashv, out); \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
 #define HASH_APPEND_LIST(hh, head, add)                                          \
 do {                                                                             \
   (add)->hh.next = NULL;                                                         \
@@ -295,6 +894,12 @@ do {
   } while ((_hs_iter = HH_FROM_ELMT((head)->hh.tbl, _hs_iter)->next));           \
 } while (0)
 
+/* out = cmpfcn(elt, add) */
+#define HASH_AKBI_CMP(head,elt,add,cmpfcn,out)                                   \
+do {                                                                             \
+  (out) = cmpfcn(DECLTYPE(head)(elt), add);                                      \
+} while (0)
+
 #ifdef NO_DECLTYPE
 #undef HASH_AKBI_INNER_LOOP
 #define HASH_AKBI_INNER_LOOP(hh,head,add,cmpfcn)                                 \
@@ -309,6 +914,14 @@ do {
     DECLTYPE_ASSIGN(head, _hs_saved_head);                                       \
   } while ((_hs_iter = HH_FROM_ELMT((head)->hh.tbl, _hs_iter)->next));           \
 } while (0)
+#undef HASH_AKBI_CMP
+#define HASH_AKBI_CMP(head,elt,add,cmpfcn,out)                                   \
+do {                                                                             \
+  char *_hs_saved_head = (char*)(head);                                          \
+  DECLTYPE_ASSIGN(head, elt);                                                    \
+  (out) = cmpfcn(head, add);                                                     \
+  DECLTYPE_ASSIGN(head, _hs_saved_head);                                         \
+} while (0)
 #endif
 
 #if HASH_NONFATAL_OOM
@@ -316,10 +929,14 @@ do {
 #define HASH_ADD_TO_TABLE(hh,head,keyptr,keylen_in,hashval,add,oomed)            \
 do {                                                                             \
   if (!(oomed)) {                                                                \
-    unsigned _ha_bkt;                                                            \
+    UT_hash_bucket *_ha_bkt;                                                     \
     (head)->hh.tbl->num_items++;                                                 \
-    HASH_TO_BKT(hashval, (head)->hh.tbl->num_buckets, _ha_bkt);                  \
-    HASH_ADD_TO_BKT((head)->hh.tbl->buckets[_ha_bkt], hh, &(add)->hh, oomed);    \
+    HASH_DENSE_ADD((head)->hh.tbl, &(add)->hh, (head)->hh.tbl->num_items - 1U, oomed); \
+    HASH_MIGRATE((head)->hh.tbl);                                                \
+    _ha_bkt = HASH_BKT((head)->hh.tbl, hashval);                                 \
+    if (!(oomed)) {                                                              \
+      HASH_ADD_TO_BKT(*_ha_bkt, hh, &(add)->hh, oomed);                          \
+    }                                                                            \
     if (oomed) {                                                                 \
       HASH_ROLLBACK_BKT(hh, head, &(add)->hh);                                   \
       HASH_DELETE_HH(hh, head, &(add)->hh);                                      \
@@ -339,10 +956,12 @@ do {
 
 #define HASH_ADD_TO_TABLE(hh,head,keyptr,keylen_in,hashval,add,oomed)            \
 do {                                                                             \
-  unsigned _ha_bkt;                                                              \
+  UT_hash_bucket *_ha_bkt;                                                       \
   (head)->hh.tbl->num_items++;                                                   \
-  HASH_TO_BKT(hashval, (head)->hh.tbl->num_buckets, _ha_bkt);                    \
-  HASH_ADD_TO_BKT((head)->hh.tbl->buckets[_ha_bkt], hh, &(add)->hh, oomed);      \
+  HASH_DENSE_ADD((head)->hh.tbl, &(add)->hh, (head)->hh.tbl->num_items - 1U, oomed); \
+  HASH_MIGRATE((head)->hh.tbl);                                                  \
+  _ha_bkt = HASH_BKT((head)->hh.tbl, hashval);                                   \
+  HASH_ADD_TO_BKT(*_ha_bkt, hh, &(add)->hh, oomed);                              \
   HASH_BLOOM_ADD((head)->hh.tbl, hashval);                                       \
   HASH_EMIT_KEY(hh, head, keyptr, keylen_in);                                    \
 } while (0)
@@ -353,9 +972,11 @@ do {
 #define HASH_ADD_KEYPTR_BYHASHVALUE_INORDER(hh,head,keyptr,keylen_in,hashval,add,cmpfcn) \
 do {                                                                             \
   IF_HASH_NONFATAL_OOM( int _ha_oomed = 0; )                                     \
+  HASH_SKIP_DECL                                                                 \
   (add)->hh.hashv = (hashval);                                                   \
   (add)->hh.key = (char*) (keyptr);                                              \
   (add)->hh.keylen = (unsigned) (keylen_in);                                     \
+  HASH_SKIP_INIT(&(add)->hh);                                                    \
   if (!(head)) {                                                                 \
     (add)->hh.next = NULL;                                                       \
     (add)->hh.prev = NULL;                                                       \
@@ -364,9 +985,12 @@ do {
       (head) = (add);                                                            \
     IF_HASH_NONFATAL_OOM( } )                                                    \
   } else {                                                                       \
-    void *_hs_iter = (head);                                                     \
+    void *_hs_iter;                                                              \
     (add)->hh.tbl = (head)->hh.tbl;                                              \
-    HASH_AKBI_INNER_LOOP(hh, head, add, cmpfcn);                                 \
+    HASH_SKIP_SEARCH(hh, head, add, cmpfcn, _hs_upd, _hs_iter);                  \
+    if (_hs_iter) {                                                              \
+      HASH_AKBI_INNER_LOOP(hh, head, add, cmpfcn);                               \
+    }                                                                            \
     if (_hs_iter) {                                                              \
       (add)->hh.next = _hs_iter;                                                 \
       if (((add)->hh.prev = HH_FROM_ELMT((head)->hh.tbl, _hs_iter)->prev)) {     \
@@ -380,6 +1004,7 @@ do {
     }                                                                            \
   }                                                                              \
   HASH_ADD_TO_TABLE(hh, head, keyptr, keylen_in, hashval, add, _ha_oomed);       \
+  HASH_SKIP_ADDED(hh, head, add);                                                \
   HASH_FSCK(hh, head, "HASH_ADD_KEYPTR_BYHASHVALUE_INORDER");                    \
 } while (0)
 
@@ -402,6 +1027,7 @@ do {
   (add)->hh.hashv = (hashval);                                                   \
   (add)->hh.key = (const void*) (keyptr);                                        \
   (add)->hh.keylen = (unsigned) (keylen_in);                                     \
+  HASH_SKIP_INIT(&(add)->hh);                                                    \
   if (!(head)) {                                                                 \
     (add)->hh.next = NULL;                                                       \
     (add)->hh.prev = NULL;                                                       \
@@ -435,6 +1061,21 @@ do {
   bkt = ((hashv) & ((num_bkts) - 1U));                                           \
 } while (0)
 
+/* HASH_BKT is the bucket that holds (or would hold) the items of hash value
+ * hashv. While an incremental resize is under way, that is the old bucket
+ * if it hasn't been migrated yet. */
+#if HASH_INCREMENTAL_RESIZE
+#define HASH_BKT(tbl,hashv)                                                      \
+  ((((tbl)->old_buckets != NULL) &&                                              \
+    ((HASH_BKT_HASH(tbl, hashv) & ((tbl)->old_num_buckets - 1U)) >=              \
+     (tbl)->migrate_pos)) ?                                                      \
+   &(tbl)->old_buckets[HASH_BKT_HASH(tbl, hashv) & ((tbl)->old_num_buckets - 1U)] : \
+   &(tbl)->buckets[HASH_BKT_HASH(tbl, hashv) & ((tbl)->num_buckets - 1U)])
+#else
+#define HASH_BKT(tbl,hashv)                                                      \
+  (&(tbl)->buckets[HASH_BKT_HASH(tbl, hashv) & ((tbl)->num_buckets - 1U)])
+#endif
+
 /* delete "delptr" from the hash table.
  * "the usual" patch-up process for the app-order doubly-linked-list.
  * The use of _hd_hh_del below deserves special explanation.
@@ -453,14 +1094,15 @@ do {
 #define HASH_DELETE_HH(hh,head,delptrhh)                                         \
 do {                                                                             \
   const struct UT_hash_handle *_hd_hh_del = (delptrhh);                          \
+  HASH_SKIP_UNLINK((head)->hh.tbl, _hd_hh_del);                                  \
   if ((_hd_hh_del->prev == NULL) && (_hd_hh_del->next == NULL)) {                \
     HASH_BLOOM_FREE((head)->hh.tbl);                                             \
-    uthash_free((head)->hh.tbl->buckets,                                         \
-                (head)->hh.tbl->num_buckets * sizeof(struct UT_hash_bucket));    \
-    uthash_free((head)->hh.tbl, sizeof(UT_hash_table));                          \
+    HASH_DENSE_FREE((head)->hh.tbl);                                             \
+    HASH_SKIP_FREE((head)->hh.tbl, 0);                                           \
+    HASH_FREE_BUCKETS((head)->hh.tbl);                                           \
+    HASH_TBL_FREE((head)->hh.tbl, (head)->hh.tbl, sizeof(UT_hash_table));        \
     (head) = NULL;                                                               \
   } else {                                                                       \
-    unsigned _hd_bkt;                                                            \
     if (_hd_hh_del == (head)->hh.tbl->tail) {                                    \
       (head)->hh.tbl->tail = HH_FROM_ELMT((head)->hh.tbl, _hd_hh_del->prev);     \
     }                                                                            \
@@ -472,9 +1114,11 @@ do {
     if (_hd_hh_del->next != NULL) {                                              \
       HH_FROM_ELMT((head)->hh.tbl, _hd_hh_del->next)->prev = _hd_hh_del->prev;   \
     }                                                                            \
-    HASH_TO_BKT(_hd_hh_del->hashv, (head)->hh.tbl->num_buckets, _hd_bkt);        \
-    HASH_DEL_IN_BKT((head)->hh.tbl->buckets[_hd_bkt], _hd_hh_del);               \
+    HASH_MIGRATE((head)->hh.tbl);                                                \
+    HASH_DEL_IN_BKT(*HASH_BKT((head)->hh.tbl, _hd_hh_del->hashv), _hd_hh_del);   \
+    HASH_DENSE_DEL((head)->hh.tbl, _hd_hh_del);                                  \
     (head)->hh.tbl->num_items--;                                                 \
+    HASH_SHRINK_BUCKETS((head)->hh.tbl);                                         \
   }                                                                              \
   HASH_FSCK(hh, head, "HASH_DELETE_HH");                                         \
 } while (0)
@@ -495,6 +1139,10 @@ do {
     unsigned _uthash_hrstr_keylen = (unsigned)uthash_strlen((add)->strfield);    \
     HASH_REPLACE(hh, head, strfield[0], _uthash_hrstr_keylen, add, replaced);    \
 } while (0)
+#define HASH_FIND_BATCH_STR(head,findstrs,n,out)                                 \
+    HASH_FIND_BATCH_KEYS(hh, head, findstrs, 0, 1, n, out)
+#define HASH_ADD_BULK_STR(head,strfield,items,n)                                 \
+    HASH_ADD_BULK_KEYS(hh, head, strfield[0], 0, 1, items, n)
 #define HASH_FIND_INT(head,findint,out)                                          \
     HASH_FIND(hh,head,findint,sizeof(int),out)
 #define HASH_ADD_INT(head,intfield,add)                                          \
@@ -507,6 +1155,121 @@ do {
     HASH_ADD(hh,head,ptrfield,sizeof(void *),add)
 #define HASH_REPLACE_PTR(head,ptrfield,add,replaced)                             \
     HASH_REPLACE(hh,head,ptrfield,sizeof(void *),add,replaced)
+
+/* Word keys: keys of 4 or 8 bytes, like int, long and pointer fields, are
+ * hashed with one multiply by 2^64/phi, keeping the high half (Fibonacci
+ * hashing), and compared as one word instead of with HASH_KEYCMP. They are
+ * copied out with memcpy, so they need not be aligned. The other key lengths
+ * fall back to HASH_FUNCTION and HASH_KEYCMP. A table uses word hashing if its items are added with the
+ * _WORD (or _FASTINT, _FASTPTR) forms, whatever HASH_FUNCTION is; it must then
+ * be searched and replaced with those forms too, since the other forms would
+ * hash the key differently. Deleting, iterating, sorting and selecting work
+ * on it as on any table. */
+#define HASH_WORD_PHI (((uint64_t)0x9E3779B9U << 32) | 0x7F4A7C15U)
+#define HASH_WORD(keyptr,keylen,hashv)                                           \
+do {                                                                             \
+  uint64_t _hw_k;                                                                \
+  uint32_t _hw_k4;                                                               \
+  if ((keylen) == 4U) {                                                          \
+    memcpy(&_hw_k4, (keyptr), 4);                                                \
+    _hw_k = _hw_k4;                                                              \
+    (hashv) = (unsigned)((_hw_k * HASH_WORD_PHI) >> 32);                         \
+  } else if ((keylen) == 8U) {                                                   \
+    memcpy(&_hw_k, (keyptr), 8);                                                 \
+    (hashv) = (unsigned)((_hw_k * HASH_WORD_PHI) >> 32);                         \
+  } else {                                                                       \
+    HASH_FUNCTION(keyptr, keylen, hashv);                                        \
+  }                                                                              \
+} while (0)
+
+/* a memcmp of a constant 4 or 8 bytes compiles to one load and compare of
+ * each key, without assuming they are aligned */
+#define HASH_WORD_EQ(a,b,n)                                                      \
+  (((n) == 4U) ? (memcmp(a, b, 4) == 0) :                                        \
+   ((n) == 8U) ? (memcmp(a, b, 8) == 0) :                                        \
+   HASH_KEY_EQ(a, b, n))
+#define HASH_WORD_MATCH(key,keylen,keyptr,n)                                     \
+  (((keylen) == (n)) && HASH_WORD_EQ(key, keyptr, n))
+
+#define HASH_FIND_WORD(hh,head,keyptr,keylen,out)                                \
+do {                                                                             \
+  (out) = NULL;                                                                  \
+  if (head) {                                                                    \
+    unsigned _hf_hashv;                                                          \
+    HASH_WORD(keyptr, keylen, _hf_hashv);                                        \
+    HASH_FIND_BYHASHVALUE_EQ(hh, head, keyptr, keylen, _hf_hashv, out, HASH_WORD_MATCH); \
+  }                                                                              \
+} while (0)
+
+#define HASH_ADD_WORD(hh,head,fieldname,keylen_in,add)                           \
+do {                                                                             \
+  unsigned _ha_hashv;                                                            \
+  HASH_WORD(&((add)->fieldname), keylen_in, _ha_hashv);                          \
+  HASH_ADD_KEYPTR_BYHASHVALUE(hh, head, &((add)->fieldname), keylen_in, _ha_hashv, add); \
+} while (0)
+
+#define HASH_REPLACE_WORD(hh,head,fieldname,keylen_in,add,replaced)              \
+do {                                                                             \
+  unsigned _hr_hashv;                                                            \
+  HASH_WORD(&((add)->fieldname), keylen_in, _hr_hashv);                          \
+  HASH_FIND_BYHASHVALUE_EQ(hh, head, &((add)->fieldname), keylen_in, _hr_hashv,  \
+                           replaced, HASH_WORD_MATCH);                           \
+  if (replaced) {                                                                \
+    HASH_DELETE(hh, head, replaced);                                             \
+  }                                                                              \
+  HASH_ADD_KEYPTR_BYHASHVALUE(hh, head, &((add)->fieldname), keylen_in, _hr_hashv, add); \
+} while (0)
+
+#define HASH_FIND_FASTINT(head,findint,out)                                      \
+    HASH_FIND_WORD(hh,head,findint,sizeof(int),out)
+#define HASH_ADD_FASTINT(head,intfield,add)                                      \
+    HASH_ADD_WORD(hh,head,intfield,sizeof(int),add)
+#define HASH_REPLACE_FASTINT(head,intfield,add,replaced)                         \
+    HASH_REPLACE_WORD(hh,head,intfield,sizeof(int),add,replaced)
+#define HASH_FIND_FASTPTR(head,findptr,out)                                      \
+    HASH_FIND_WORD(hh,head,findptr,sizeof(void *),out)
+#define HASH_ADD_FASTPTR(head,ptrfield,add)                                      \
+    HASH_ADD_WORD(hh,head,ptrfield,sizeof(void *),add)
+#define HASH_REPLACE_FASTPTR(head,ptrfield,add,replaced)                         \
+    HASH_REPLACE_WORD(hh,head,ptrfield,sizeof(void *),add,replaced)
+/* Fixed-length keys: in a table whose keys all have the same length, like a
+ * struct or a 16-byte id, the _FIXED forms compare keys without first
+ * comparing their lengths, and compare 4-, 8- and 16-byte keys with a memcmp
+ * of that constant length, which compilers turn into word loads even when
+ * keylen is a variable. Keys are hashed with HASH_FUNCTION as usual, so such
+ * a table can be built and searched with any of the other forms too; only
+ * an item added with a key of another length would go unnoticed (or be
+ * misread) by these. */
+#define HASH_FIXED_EQ(a,b,n)                                                     \
+  (((n) == 4U) ? (memcmp(a, b, 4) == 0) :                                        \
+   ((n) == 8U) ? (memcmp(a, b, 8) == 0) :                                        \
+   ((n) == 16U) ? (memcmp(a, b, 16) == 0) :                                      \
+   HASH_KEY_EQ(a, b, n))
+#define HASH_FIXED_MATCH(key,keylen,keyptr,n)                                    \
+  HASH_FIXED_EQ(key, keyptr, n)
+
+#define HASH_FIND_FIXED(hh,head,keyptr,keylen,out)                               \
+do {                                                                             \
+  (out) = NULL;                                                                  \
+  if (head) {                                                                    \
+    unsigned _hf_hashv;                                                          \
+    HASH_VALUE(keyptr, keylen, _hf_hashv);                                       \
+    HASH_FIND_BYHASHVALUE_EQ(hh, head, keyptr, keylen, _hf_hashv, out, HASH_FIXED_MATCH); \
+  }                                                                              \
+} while (0)
+
+#define HASH_REPLACE_FIXED(hh,head,fieldname,keylen_in,add,replaced)             \
+do {                                                                             \
+  unsigned _hr_hashv;                                                            \
+  HASH_VALUE(&((add)->fieldname), keylen_in, _hr_hashv);                         \
+  HASH_FIND_BYHASHVALUE_EQ(hh, head, &((add)->fieldname), keylen_in, _hr_hashv,  \
+                           replaced, HASH_FIXED_MATCH);                          \
+  if (replaced) {                                                                \
+    HASH_DELETE(hh, head, replaced);                                             \
+  }                                                                              \
+  HASH_ADD_KEYPTR_BYHASHVALUE(hh, head, &((add)->fieldname), keylen_in, _hr_hashv, add); \
+} while (0)
+
 #define HASH_DEL(head,delptr)                                                    \
     HASH_DELETE(hh,head,delptr)
 
@@ -532,6 +1295,11 @@ do {
           HASH_OOPS("%s: invalid hh_prev %p, actual %p\n",                       \
               (where), (void*)_thh->hh_prev, (void*)_prev);                      \
         }                                                                        \
+        if (HASH_BKT((head)->hh.tbl, _thh->hashv) !=                             \
+            &(head)->hh.tbl->buckets[_bkt_i]) {                                  \
+          HASH_OOPS("%s: item %p in the wrong bucket\n", (where), (void*)_thh);  \
+        }                                                                        \
+        HASH_FSCK_TAG(where, (head)->hh.tbl->buckets[_bkt_i], _bkt_count, _thh); \
         _bkt_count++;                                                            \
         _prev = (char*)(_thh);                                                   \
         _thh = _thh->hh_next;                                                    \
@@ -542,6 +1310,7 @@ do {
             (where), (head)->hh.tbl->buckets[_bkt_i].count, _bkt_count);         \
       }                                                                          \
     }                                                                            \
+    HASH_FSCK_OLD(hh, head, where, _count);                                      \
     if (_count != (head)->hh.tbl->num_items) {                                   \
       HASH_OOPS("%s: invalid hh item count %u, actual %u\n",                     \
           (where), (head)->hh.tbl->num_items, _count);                           \
@@ -562,16 +1331,100 @@ do {
       HASH_OOPS("%s: invalid app item count %u, actual %u\n",                    \
           (where), (head)->hh.tbl->num_items, _count);                           \
     }                                                                            \
+    HASH_FSCK_DENSE(hh, head, where);                                            \
+    HASH_FSCK_SKIP(hh, head, where);                                             \
+  }                                                                              \
+} while (0)
+#if HASH_INORDER_INDEX
+/* each level of the index is a well-linked list of nodes of that level or
+ * higher, and the nodes of level 1 come in app order */
+#define HASH_FSCK_SKIP(hh,head,where)                                            \
+do {                                                                             \
+  UT_hash_table *_fs_tbl = (head)->hh.tbl;                                       \
+  UT_hash_skip *_fs_node, *_fs_prev;                                             \
+  UT_hash_handle *_fs_hh;                                                        \
+  unsigned _fs_i, _fs_n;                                                         \
+  for (_fs_i = 0; _fs_i < HASH_SKIP_MAX; _fs_i++) {                              \
+    _fs_prev = NULL;                                                             \
+    _fs_n = 0;                                                                   \
+    for (_fs_node = _fs_tbl->skip_head[_fs_i]; _fs_node != NULL;                 \
+         _fs_node = HASH_SKIP_NEXT(_fs_node, _fs_i)) {                           \
+      if ((_fs_i >= _fs_tbl->skip_levels) || (_fs_node->level <= _fs_i) ||       \
+          (HASH_SKIP_PREV(_fs_node, _fs_i) != _fs_prev) ||                       \
+          (_fs_node->item->skip != _fs_node) || (_fs_node->item->tbl != _fs_tbl)) { \
+        HASH_OOPS("%s: invalid skip node %p at level %u\n",                      \
+            (where), (void*)_fs_node, _fs_i + 1U);                               \
+      }                                                                          \
+      _fs_prev = _fs_node;                                                       \
+      _fs_n++;                                                                   \
+    }                                                                            \
+    if ((_fs_i == 0U) && (_fs_n != _fs_tbl->skip_nodes)) {                       \
+      HASH_OOPS("%s: invalid skip node count %u, actual %u\n",                   \
+          (where), _fs_tbl->skip_nodes, _fs_n);                                  \
+    }                                                                            \
+  }                                                                              \
+  _fs_node = _fs_tbl->skip_head[0];                                              \
+  for (_fs_hh = &(head)->hh; _fs_hh != NULL; _fs_hh = (_fs_hh->next != NULL) ?   \
+       HH_FROM_ELMT(_fs_tbl, _fs_hh->next) : NULL) {                             \
+    if ((_fs_node != NULL) && (_fs_node->item == _fs_hh)) {                      \
+      _fs_node = HASH_SKIP_NEXT(_fs_node, 0U);                                   \
+    } else if (_fs_hh->skip != NULL) {                                           \
+      HASH_OOPS("%s: skip node of item %p out of order\n", (where), (void*)_fs_hh); \
+    }                                                                            \
   }                                                                              \
 } while (0)
 #else
-#define HASH_FSCK(hh,head,where)
+#define HASH_FSCK_SKIP(hh,head,where)
 #endif
-
-/* When compiled with -DHASH_EMIT_KEYS, length-prefixed keys are emitted to
- * the descriptor to which this macro is defined for tuning the hash function.
- * The app can #include <unistd.h> to get the prototype for write(2). */
-#ifdef HASH_EMIT_KEYS
+#if HASH_BUCKET_TAGS
+/* the i-th item of a chain must match the i-th tag of its bucket */
+#define HASH_FSCK_TAG(where,bkt,i,thh)                                           \
+do {                                                                             \
+  if (((i) < HASH_BUCKET_TAGS) && (((bkt).tag_hh[i] != (thh)) ||                 \
+                                   ((bkt).tag_hashv[i] != (thh)->hashv))) {      \
+    HASH_OOPS("%s: invalid bucket tag %u for item %p\n",                         \
+        (where), (unsigned)(i), (void*)(thh));                                   \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_FSCK_TAG(where,bkt,i,thh)
+#endif
+#if HASH_INCREMENTAL_RESIZE
+/* the old buckets of a resize under way: migrated ones must be empty */
+#define HASH_FSCK_OLD(hh,head,where,cnt)                                         \
+do {                                                                             \
+  UT_hash_table *_fo_tbl = (head)->hh.tbl;                                       \
+  struct UT_hash_handle *_fo_thh;                                                \
+  unsigned _fo_i;                                                                \
+  for (_fo_i = 0; _fo_tbl->old_buckets && _fo_i < _fo_tbl->old_num_buckets; ++_fo_i) { \
+    unsigned _fo_count = 0;                                                      \
+    for (_fo_thh = _fo_tbl->old_buckets[_fo_i].hh_head; _fo_thh;                 \
+         _fo_thh = _fo_thh->hh_next) {                                           \
+      if ((_fo_i < _fo_tbl->migrate_pos) ||                                      \
+          (HASH_BKT(_fo_tbl, _fo_thh->hashv) != &_fo_tbl->old_buckets[_fo_i])) { \
+        HASH_OOPS("%s: item %p in the wrong old bucket\n", (where), (void*)_fo_thh); \
+      }                                                                          \
+      HASH_FSCK_TAG(where, _fo_tbl->old_buckets[_fo_i], _fo_count, _fo_thh);     \
+      _fo_count++;                                                               \
+    }                                                                            \
+    if (_fo_tbl->old_buckets[_fo_i].count != _fo_count) {                        \
+      HASH_OOPS("%s: invalid old bucket count %u, actual %u\n",                  \
+          (where), _fo_tbl->old_buckets[_fo_i].count, _fo_count);                \
+    }                                                                            \
+    (cnt) += _fo_count;                                                          \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_FSCK_OLD(hh,head,where,cnt)
+#endif
+#else
+#define HASH_FSCK(hh,head,where)
+#endif
+
+/* When compiled with -DHASH_EMIT_KEYS, length-prefixed keys are emitted to
+ * the descriptor to which this macro is defined for tuning the hash function.
+ * The app can #include <unistd.h> to get the prototype for write(2). */
+#ifdef HASH_EMIT_KEYS
 #define HASH_EMIT_KEY(hh,head,keyptr,fieldlen)                                   \
 do {                                                                             \
   unsigned _klen = fieldlen;                                                     \
@@ -744,8 +1597,246 @@ do {
   hashv += hashv >> 6;                                                           \
 } while (0)
 
+/* wyhash by Wang Yi (final version 4, public domain), folded to 32 bits.
+ * It reads the key 4, 8 or 16 bytes at a time and mixes them with 64x64->128
+ * bit multiplies, so a short key costs two multiplies. Words are read in
+ * native byte order: hash values differ between little- and big-endian hosts.
+ * Needs uint64_t; the 128-bit product uses __int128 where it is available. */
+#if defined(UINT64_MAX)
+#if defined(__SIZEOF_INT128__)
+#define HASH_WYH_MUM(a,b)                                                        \
+do {                                                                             \
+  __extension__ unsigned __int128 _wm_r = (unsigned __int128)(a) * (b);          \
+  (a) = (uint64_t)_wm_r;                                                         \
+  (b) = (uint64_t)(_wm_r >> 64);                                                 \
+} while (0)
+#else
+#define HASH_WYH_MUM(a,b)                                                        \
+do {                                                                             \
+  uint64_t _wm_ha = (a) >> 32, _wm_hb = (b) >> 32;                               \
+  uint64_t _wm_la = (uint32_t)(a), _wm_lb = (uint32_t)(b);                       \
+  uint64_t _wm_hl = _wm_ha * _wm_lb, _wm_lh = _wm_la * _wm_lb;                   \
+  uint64_t _wm_t = _wm_lh + (_wm_hl << 32);                                      \
+  uint64_t _wm_lo = _wm_t + ((_wm_hb * _wm_la) << 32);                           \
+  (b) = _wm_ha * _wm_hb + (_wm_hl >> 32) + ((_wm_hb * _wm_la) >> 32)             \
+      + (_wm_t < _wm_lh) + (_wm_lo < _wm_t);                                     \
+  (a) = _wm_lo;                                                                  \
+} while (0)
+#endif
+/* seed = mix(p[0..7] ^ secret, p[8..15] ^ seed) */
+#define HASH_WYH_ROUND(p,secret,seed)                                            \
+do {                                                                             \
+  uint64_t _wr_a, _wr_b;                                                         \
+  memcpy(&_wr_a, (p), 8);                                                        \
+  memcpy(&_wr_b, (p) + 8, 8);                                                    \
+  _wr_a ^= (secret);                                                             \
+  _wr_b ^= (seed);                                                               \
+  HASH_WYH_MUM(_wr_a, _wr_b);                                                    \
+  (seed) = _wr_a ^ _wr_b;                                                        \
+} while (0)
+#define HASH_WYH(key,keylen,hashv)                                               \
+do {                                                                             \
+  const unsigned char *_wy_p = (const unsigned char*)(key);                      \
+  size_t _wy_len = (size_t)(keylen), _wy_i = _wy_len;                            \
+  uint64_t _wy_seed = 0xca813bf4c7abf0a9ULL, _wy_a, _wy_b;                       \
+  uint32_t _wy_w[4];                                                             \
+  if (_wy_len <= 16U) {                                                          \
+    if (_wy_len >= 4U) {                                                         \
+      size_t _wy_o = (_wy_len >> 3) << 2;                                        \
+      memcpy(&_wy_w[0], _wy_p, 4);                                               \
+      memcpy(&_wy_w[1], _wy_p + _wy_o, 4);                                       \
+      memcpy(&_wy_w[2], _wy_p + _wy_len - 4, 4);                                 \
+      memcpy(&_wy_w[3], _wy_p + _wy_len - 4 - _wy_o, 4);                         \
+      _wy_a = ((uint64_t)_wy_w[0] << 32) | _wy_w[1];                             \
+      _wy_b = ((uint64_t)_wy_w[2] << 32) | _wy_w[3];                             \
+    } else if (_wy_len > 0U) {                                                   \
+      _wy_a = ((uint64_t)_wy_p[0] << 16) | ((uint64_t)_wy_p[_wy_len >> 1] << 8)  \
+            | _wy_p[_wy_len - 1];                                                \
+      _wy_b = 0;                                                                 \
+    } else {                                                                     \
+      _wy_a = _wy_b = 0;                                                         \
+    }                                                                            \
+  } else {                                                                       \
+    if (_wy_i >= 48U) {                                                          \
+      uint64_t _wy_see1 = _wy_seed, _wy_see2 = _wy_seed;                         \
+      do {                                                                       \
+        HASH_WYH_ROUND(_wy_p, 0x8bb84b93962eacc9ULL, _wy_seed);                  \
+        HASH_WYH_ROUND(_wy_p + 16, 0x4b33a62ed433d4a3ULL, _wy_see1);             \
+        HASH_WYH_ROUND(_wy_p + 32, 0x4d5a2da51de1aa47ULL, _wy_see2);             \
+        _wy_p += 48;                                                             \
+        _wy_i -= 48U;                                                            \
+      } while (_wy_i >= 48U);                                                    \
+      _wy_seed ^= _wy_see1 ^ _wy_see2;                                           \
+    }                                                                            \
+    while (_wy_i > 16U) {                                                        \
+      HASH_WYH_ROUND(_wy_p, 0x8bb84b93962eacc9ULL, _wy_seed);                    \
+      _wy_p += 16;                                                               \
+      _wy_i -= 16U;                                                              \
+    }                                                                            \
+    memcpy(&_wy_a, _wy_p + _wy_i - 16, 8);                                       \
+    memcpy(&_wy_b, _wy_p + _wy_i - 8, 8);                                        \
+  }                                                                              \
+  _wy_a ^= 0x8bb84b93962eacc9ULL;                                                \
+  _wy_b ^= _wy_seed;                                                             \
+  HASH_WYH_MUM(_wy_a, _wy_b);                                                    \
+  _wy_a ^= 0x2d358dccaa6c78a5ULL ^ (uint64_t)_wy_len;                            \
+  _wy_b ^= 0x8bb84b93962eacc9ULL;                                                \
+  HASH_WYH_MUM(_wy_a, _wy_b);                                                    \
+  _wy_a ^= _wy_b;                                                                \
+  (hashv) = (unsigned)(_wy_a ^ (_wy_a >> 32));                                   \
+} while (0)
+#endif
+
+/* SipHash-1-3 (Aumasson, Bernstein), folded to 32 bits: a keyed hash for keys
+ * that come from untrusted input. Without the key, which nothing outside the
+ * process sees, nobody can pick keys that collide, in the low bits or at
+ * all. HASH_SIP_KEY is the 128-bit key as two uint64_t words; by default the
+ * program defines, and fills from a random source before the first hash,
+ *     uint64_t uthash_sip_key[2];
+ * Bytes are read little-endian whatever the host. Needs uint64_t. */
+#if defined(UINT64_MAX)
+#ifndef HASH_SIP_KEY
+#define HASH_SIP_KEY uthash_sip_key
+extern uint64_t uthash_sip_key[2];
+#endif
+#define HASH_SIP_ROTL(x,b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define HASH_SIP_ROUND(v0,v1,v2,v3)                                              \
+do {                                                                             \
+  (v0) += (v1); (v1) = HASH_SIP_ROTL(v1, 13); (v1) ^= (v0);                      \
+  (v0) = HASH_SIP_ROTL(v0, 32);                                                  \
+  (v2) += (v3); (v3) = HASH_SIP_ROTL(v3, 16); (v3) ^= (v2);                      \
+  (v0) += (v3); (v3) = HASH_SIP_ROTL(v3, 21); (v3) ^= (v0);                      \
+  (v2) += (v1); (v1) = HASH_SIP_ROTL(v1, 17); (v1) ^= (v2);                      \
+  (v2) = HASH_SIP_ROTL(v2, 32);                                                  \
+} while (0)
+#define HASH_SIP(key,keylen,hashv)                                               \
+do {                                                                             \
+  const unsigned char *_sp_p = (const unsigned char*)(key);                      \
+  size_t _sp_len = (size_t)(keylen), _sp_i;                                      \
+  uint64_t _sp_v0 = 0x736f6d6570736575ULL ^ (HASH_SIP_KEY)[0];                   \
+  uint64_t _sp_v1 = 0x646f72616e646f6dULL ^ (HASH_SIP_KEY)[1];                   \
+  uint64_t _sp_v2 = 0x6c7967656e657261ULL ^ (HASH_SIP_KEY)[0];                   \
+  uint64_t _sp_v3 = 0x7465646279746573ULL ^ (HASH_SIP_KEY)[1];                   \
+  uint64_t _sp_m;                                                                \
+  for (_sp_i = 0; _sp_i + 8U <= _sp_len; _sp_i += 8U) {                          \
+    _sp_m = (uint64_t)_sp_p[_sp_i] | ((uint64_t)_sp_p[_sp_i + 1] << 8)           \
+          | ((uint64_t)_sp_p[_sp_i + 2] << 16) | ((uint64_t)_sp_p[_sp_i + 3] << 24) \
+          | ((uint64_t)_sp_p[_sp_i + 4] << 32) | ((uint64_t)_sp_p[_sp_i + 5] << 40) \
+          | ((uint64_t)_sp_p[_sp_i + 6] << 48) | ((uint64_t)_sp_p[_sp_i + 7] << 56); \
+    _sp_v3 ^= _sp_m;                                                             \
+    HASH_SIP_ROUND(_sp_v0, _sp_v1, _sp_v2, _sp_v3);                              \
+    _sp_v0 ^= _sp_m;                                                             \
+  }                                                                              \
+  _sp_m = (uint64_t)_sp_len << 56;                                               \
+  switch (_sp_len & 7U) {                                                        \
+    case 7: _sp_m |= (uint64_t)_sp_p[_sp_i + 6] << 48; /* FALLTHROUGH */         \
+    case 6: _sp_m |= (uint64_t)_sp_p[_sp_i + 5] << 40; /* FALLTHROUGH */         \
+    case 5: _sp_m |= (uint64_t)_sp_p[_sp_i + 4] << 32; /* FALLTHROUGH */         \
+    case 4: _sp_m |= (uint64_t)_sp_p[_sp_i + 3] << 24; /* FALLTHROUGH */         \
+    case 3: _sp_m |= (uint64_t)_sp_p[_sp_i + 2] << 16; /* FALLTHROUGH */         \
+    case 2: _sp_m |= (uint64_t)_sp_p[_sp_i + 1] << 8;  /* FALLTHROUGH */         \
+    case 1: _sp_m |= (uint64_t)_sp_p[_sp_i];                                     \
+      break;                                                                     \
+    default:                                                                     \
+      break;                                                                     \
+  }                                                                              \
+  _sp_v3 ^= _sp_m;                                                               \
+  HASH_SIP_ROUND(_sp_v0, _sp_v1, _sp_v2, _sp_v3);                                \
+  _sp_v0 ^= _sp_m;                                                               \
+  _sp_v2 ^= 0xffU;                                                               \
+  HASH_SIP_ROUND(_sp_v0, _sp_v1, _sp_v2, _sp_v3);                                \
+  HASH_SIP_ROUND(_sp_v0, _sp_v1, _sp_v2, _sp_v3);                                \
+  HASH_SIP_ROUND(_sp_v0, _sp_v1, _sp_v2, _sp_v3);                                \
+  _sp_m = _sp_v0 ^ _sp_v1 ^ _sp_v2 ^ _sp_v3;                                     \
+  (hashv) = (unsigned)(_sp_m ^ (_sp_m >> 32));                                   \
+} while (0)
+#endif
+
 /* iterate over items in a known bucket to find desired item */
-#define HASH_FIND_IN_BKT(tbl,hh,head,keyptr,keylen_in,hashval,out)               \
+#if HASH_BUCKET_TAGS
+/* Bucket tags (-DHASH_BUCKET_TAGS=n). Each bucket also keeps the hash values
+ * of the first n items of its chain, and pointers to them, in chain order.
+ * A find compares those hash values without touching the items, so a
+ * non-matching item costs no cache miss unless it is past the first n; a
+ * chain longer than that is walked as usual from the n-th item. The bucket
+ * grows by 12 bytes per tag (on LP64), so n=4 makes it one 64-byte line. */
+#define HASH_FIND_IN_BKT_EQ(tbl,hh,head,keyptr,keylen_in,hashval,out,keymatch)   \
+do {                                                                             \
+  unsigned _hk_i, _hk_n = ((head).count < HASH_BUCKET_TAGS) ?                    \
+                          (head).count : HASH_BUCKET_TAGS;                       \
+  struct UT_hash_handle *_hk_thh = NULL;                                         \
+  (out) = NULL;                                                                  \
+  for (_hk_i = 0; _hk_i < _hk_n; _hk_i++) {                                      \
+    if ((head).tag_hashv[_hk_i] == (hashval)) {                                  \
+      _hk_thh = (head).tag_hh[_hk_i];                                            \
+      if (keymatch(_hk_thh->key, _hk_thh->keylen, keyptr, keylen_in)) {          \
+        break;                                                                   \
+      }                                                                          \
+      _hk_thh = NULL;                                                            \
+    }                                                                            \
+  }                                                                              \
+  if ((_hk_thh == NULL) && ((head).count > HASH_BUCKET_TAGS)) {                  \
+    _hk_thh = (head).tag_hh[HASH_BUCKET_TAGS - 1U]->hh_next;                     \
+    while (_hk_thh != NULL) {                                                    \
+      if ((_hk_thh->hashv == (hashval)) &&                                       \
+          keymatch(_hk_thh->key, _hk_thh->keylen, keyptr, keylen_in)) {          \
+        break;                                                                   \
+      }                                                                          \
+      _hk_thh = _hk_thh->hh_next;                                                \
+    }                                                                            \
+  }                                                                              \
+  if (_hk_thh != NULL) {                                                         \
+    DECLTYPE_ASSIGN(out, ELMT_FROM_HH(tbl, _hk_thh));                            \
+  }                                                                              \
+} while (0)
+
+/* addhh has just become the head of the chain of bkt */
+#define HASH_BKT_TAG_PUSH(bkt,addhh)                                             \
+do {                                                                             \
+  unsigned _ht_i;                                                                \
+  for (_ht_i = HASH_BUCKET_TAGS - 1U; _ht_i > 0U; _ht_i--) {                     \
+    (bkt)->tag_hashv[_ht_i] = (bkt)->tag_hashv[_ht_i - 1U];                      \
+    (bkt)->tag_hh[_ht_i] = (bkt)->tag_hh[_ht_i - 1U];                            \
+  }                                                                              \
+  (bkt)->tag_hashv[0] = (addhh)->hashv;                                          \
+  (bkt)->tag_hh[0] = (addhh);                                                    \
+} while (0)
+
+/* newhh has just replaced oldhh in the chain of bkt */
+#define HASH_BKT_TAG_SWAP(bkt,oldhh,newhh)                                       \
+do {                                                                             \
+  unsigned _ht_i;                                                                \
+  for (_ht_i = 0; _ht_i < HASH_BUCKET_TAGS; _ht_i++) {                           \
+    if ((bkt)->tag_hh[_ht_i] == (oldhh)) {                                       \
+      (bkt)->tag_hh[_ht_i] = (newhh);                                            \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* delhh has just been unlinked from the chain of bkt (and count lowered):
+ * close its tag's gap and tag the item that moved up into the last slot */
+#define HASH_BKT_TAG_DEL(bkt,delhh)                                              \
+do {                                                                             \
+  unsigned _ht_i, _ht_n = ((bkt)->count < HASH_BUCKET_TAGS) ?                    \
+                          (bkt)->count + 1U : HASH_BUCKET_TAGS;                  \
+  for (_ht_i = 0; (_ht_i < _ht_n) && ((bkt)->tag_hh[_ht_i] != (delhh)); _ht_i++) { \
+  }                                                                              \
+  if (_ht_i < _ht_n) {                                                           \
+    for (; _ht_i + 1U < HASH_BUCKET_TAGS; _ht_i++) {                             \
+      (bkt)->tag_hashv[_ht_i] = (bkt)->tag_hashv[_ht_i + 1U];                    \
+      (bkt)->tag_hh[_ht_i] = (bkt)->tag_hh[_ht_i + 1U];                          \
+    }                                                                            \
+    if ((bkt)->count >= HASH_BUCKET_TAGS) {                                      \
+      (bkt)->tag_hh[HASH_BUCKET_TAGS - 1U] = (HASH_BUCKET_TAGS > 1U) ?           \
+          (bkt)->tag_hh[(HASH_BUCKET_TAGS > 1U) ? HASH_BUCKET_TAGS - 2U : 0U]->hh_next : \
+          (bkt)->hh_head;                                                        \
+      (bkt)->tag_hashv[HASH_BUCKET_TAGS - 1U] =                                  \
+          (bkt)->tag_hh[HASH_BUCKET_TAGS - 1U]->hashv;                           \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_FIND_IN_BKT_EQ(tbl,hh,head,keyptr,keylen_in,hashval,out,keymatch)   \
 do {                                                                             \
   if ((head).hh_head != NULL) {                                                  \
     DECLTYPE_ASSIGN(out, ELMT_FROM_HH(tbl, (head).hh_head));                     \
@@ -753,8 +1844,8 @@ do {
     (out) = NULL;                                                                \
   }                                                                              \
   while ((out) != NULL) {                                                        \
-    if ((out)->hh.hashv == (hashval) && (out)->hh.keylen == (keylen_in)) {       \
-      if (HASH_KEYCMP((out)->hh.key, keyptr, keylen_in) == 0) {                  \
+    if ((out)->hh.hashv == (hashval)) {                                          \
+      if (keymatch((out)->hh.key, (out)->hh.keylen, keyptr, keylen_in)) {        \
         break;                                                                   \
       }                                                                          \
     }                                                                            \
@@ -766,6 +1857,14 @@ do {
   }                                                                              \
 } while (0)
 
+#define HASH_BKT_TAG_PUSH(bkt,addhh)
+#define HASH_BKT_TAG_SWAP(bkt,oldhh,newhh)
+#define HASH_BKT_TAG_DEL(bkt,delhh)
+#endif
+
+#define HASH_FIND_IN_BKT(tbl,hh,head,keyptr,keylen_in,hashval,out)               \
+  HASH_FIND_IN_BKT_EQ(tbl, hh, head, keyptr, keylen_in, hashval, out, HASH_KEY_MATCH)
+
 /* add an item to a bucket  */
 #define HASH_ADD_TO_BKT(head,hh,addhh,oomed)                                     \
 do {                                                                             \
@@ -777,6 +1876,7 @@ do {
     _ha_head->hh_head->hh_prev = (addhh);                                        \
   }                                                                              \
   _ha_head->hh_head = (addhh);                                                   \
+  HASH_BKT_TAG_PUSH(_ha_head, addhh);                                            \
   if ((_ha_head->count >= ((_ha_head->expand_mult + 1U) * HASH_BKT_CAPACITY_THRESH)) \
       && !(addhh)->tbl->noexpand) {                                              \
     HASH_EXPAND_BUCKETS(addhh,(addhh)->tbl, oomed);                              \
@@ -802,6 +1902,7 @@ do {
   if ((delhh)->hh_next) {                                                        \
     (delhh)->hh_next->hh_prev = (delhh)->hh_prev;                                \
   }                                                                              \
+  HASH_BKT_TAG_DEL(_hd_head, delhh);                                             \
 } while (0)
 
 /* Bucket expansion has the effect of doubling the number of buckets
@@ -833,57 +1934,265 @@ do {
  *      ceil(n/b) = (n>>lb) + ( (n & (b-1)) ? 1:0)
  *
  */
-#define HASH_EXPAND_BUCKETS(hh,tbl,oomed)                                        \
+#define HASH_RESIZE_BUCKETS(hh,tbl,lg2,oomed)                                    \
+do {                                                                             \
+  unsigned _hz_lg2 = (lg2);                                                      \
+  UT_hash_bucket *_hz_new_buckets = (UT_hash_bucket*)HASH_TBL_MALLOC(tbl,        \
+           sizeof(struct UT_hash_bucket) << _hz_lg2);                            \
+  if (!_hz_new_buckets) {                                                        \
+    HASH_RECORD_OOM(oomed);                                                      \
+  } else {                                                                       \
+    HASH_REDISTRIBUTE(tbl, _hz_new_buckets, _hz_lg2);                            \
+  }                                                                              \
+} while (0)
+
+/* moves every item of tbl into new_buckets, 2^lg2 of them, and frees the old
+ * ones */
+#define HASH_REDISTRIBUTE(tbl,new_buckets,lg2)                                   \
 do {                                                                             \
   unsigned _he_bkt;                                                              \
   unsigned _he_bkt_i;                                                            \
+  unsigned _he_lg2 = (lg2);                                                      \
+  unsigned _he_nbkts = 1U << _he_lg2;                                            \
   struct UT_hash_handle *_he_thh, *_he_hh_nxt;                                   \
-  UT_hash_bucket *_he_new_buckets, *_he_newbkt;                                  \
-  _he_new_buckets = (UT_hash_bucket*)uthash_malloc(                              \
-           sizeof(struct UT_hash_bucket) * (tbl)->num_buckets * 2U);             \
-  if (!_he_new_buckets) {                                                        \
-    HASH_RECORD_OOM(oomed);                                                      \
-  } else {                                                                       \
-    uthash_bzero(_he_new_buckets,                                                \
-        sizeof(struct UT_hash_bucket) * (tbl)->num_buckets * 2U);                \
-    (tbl)->ideal_chain_maxlen =                                                  \
-       ((tbl)->num_items >> ((tbl)->log2_num_buckets+1U)) +                      \
-       ((((tbl)->num_items & (((tbl)->num_buckets*2U)-1U)) != 0U) ? 1U : 0U);    \
-    (tbl)->nonideal_items = 0;                                                   \
-    for (_he_bkt_i = 0; _he_bkt_i < (tbl)->num_buckets; _he_bkt_i++) {           \
-      _he_thh = (tbl)->buckets[ _he_bkt_i ].hh_head;                             \
-      while (_he_thh != NULL) {                                                  \
-        _he_hh_nxt = _he_thh->hh_next;                                           \
-        HASH_TO_BKT(_he_thh->hashv, (tbl)->num_buckets * 2U, _he_bkt);           \
-        _he_newbkt = &(_he_new_buckets[_he_bkt]);                                \
-        if (++(_he_newbkt->count) > (tbl)->ideal_chain_maxlen) {                 \
+  UT_hash_bucket *_he_new_buckets = (new_buckets), *_he_newbkt;                  \
+  uthash_bzero(_he_new_buckets,                                                  \
+      sizeof(struct UT_hash_bucket) * _he_nbkts);                                \
+  (tbl)->ideal_chain_maxlen =                                                    \
+     ((tbl)->num_items >> _he_lg2) +                                             \
+     ((((tbl)->num_items & (_he_nbkts-1U)) != 0U) ? 1U : 0U);                    \
+  (tbl)->nonideal_items = 0;                                                     \
+  for (_he_bkt_i = 0; _he_bkt_i < (tbl)->num_buckets; _he_bkt_i++) {             \
+    _he_thh = (tbl)->buckets[ _he_bkt_i ].hh_head;                               \
+    while (_he_thh != NULL) {                                                    \
+      _he_hh_nxt = _he_thh->hh_next;                                             \
+      HASH_TO_BKT(HASH_BKT_HASH(tbl, _he_thh->hashv), _he_nbkts, _he_bkt);       \
+      _he_newbkt = &(_he_new_buckets[_he_bkt]);                                  \
+      if (++(_he_newbkt->count) > (tbl)->ideal_chain_maxlen) {                   \
+        (tbl)->nonideal_items++;                                                 \
+        if (_he_newbkt->count > _he_newbkt->expand_mult * (tbl)->ideal_chain_maxlen) { \
+          _he_newbkt->expand_mult++;                                             \
+        }                                                                        \
+      }                                                                          \
+      _he_thh->hh_prev = NULL;                                                   \
+      _he_thh->hh_next = _he_newbkt->hh_head;                                    \
+      if (_he_newbkt->hh_head != NULL) {                                         \
+        _he_newbkt->hh_head->hh_prev = _he_thh;                                  \
+      }                                                                          \
+      _he_newbkt->hh_head = _he_thh;                                             \
+      HASH_BKT_TAG_PUSH(_he_newbkt, _he_thh);                                    \
+      _he_thh = _he_hh_nxt;                                                      \
+    }                                                                            \
+  }                                                                              \
+  HASH_TBL_FREE(tbl, (tbl)->buckets,                                             \
+                (tbl)->num_buckets * sizeof(struct UT_hash_bucket));             \
+  (tbl)->num_buckets = _he_nbkts;                                                \
+  (tbl)->log2_num_buckets = _he_lg2;                                             \
+  (tbl)->buckets = _he_new_buckets;                                              \
+} while (0)
+
+/* once the items are redistributed: stop expanding if it isn't helping */
+#define HASH_EXPANDED(tbl)                                                       \
+do {                                                                             \
+  (tbl)->ineff_expands = ((tbl)->nonideal_items > ((tbl)->num_items >> 1)) ?     \
+      ((tbl)->ineff_expands+1U) : 0U;                                            \
+  if ((tbl)->ineff_expands > 1U) {                                               \
+    (tbl)->noexpand = 1;                                                         \
+    uthash_noexpand_fyi(tbl);                                                    \
+  }                                                                              \
+} while (0)
+
+#if HASH_INCREMENTAL_RESIZE
+/* Incremental resizing (-DHASH_INCREMENTAL_RESIZE=1). An expansion only
+ * allocates the doubled bucket array and keeps the old one beside it; every
+ * later add, find and delete first moves the items of the next
+ * HASH_MIGRATE_BUCKETS old buckets (in order, from migrate_pos) into the new
+ * array, and the old array is freed once it is empty. An item is always in
+ * exactly one place, HASH_BKT, so a lookup still searches a single chain. No
+ * single operation redistributes the whole hash, which bounds the latency
+ * of an insert on a large hash; in exchange finds modify the table, so even
+ * lookups must not run concurrently. Another expansion doesn't start until
+ * the current one has finished. */
+#ifndef HASH_MIGRATE_BUCKETS
+#define HASH_MIGRATE_BUCKETS 8U
+#endif
+
+#define HASH_MIGRATE(tbl)                                                        \
+do {                                                                             \
+  if ((tbl)->old_buckets != NULL) {                                              \
+    unsigned _hm_i, _hm_bkt;                                                     \
+    struct UT_hash_handle *_hm_thh, *_hm_hh_nxt;                                 \
+    UT_hash_bucket *_hm_newbkt;                                                  \
+    for (_hm_i = 0; (_hm_i < HASH_MIGRATE_BUCKETS) &&                            \
+         ((tbl)->migrate_pos < (tbl)->old_num_buckets); _hm_i++) {               \
+      _hm_thh = (tbl)->old_buckets[(tbl)->migrate_pos].hh_head;                  \
+      (tbl)->old_buckets[(tbl)->migrate_pos].hh_head = NULL;                     \
+      (tbl)->old_buckets[(tbl)->migrate_pos].count = 0;                          \
+      (tbl)->migrate_pos++;                                                      \
+      while (_hm_thh != NULL) {                                                  \
+        _hm_hh_nxt = _hm_thh->hh_next;                                           \
+        HASH_TO_BKT(HASH_BKT_HASH(tbl, _hm_thh->hashv), (tbl)->num_buckets,    \
+            _hm_bkt);                                                          \
+        _hm_newbkt = &((tbl)->buckets[_hm_bkt]);                                 \
+        if (++(_hm_newbkt->count) > (tbl)->ideal_chain_maxlen) {                 \
           (tbl)->nonideal_items++;                                               \
-          if (_he_newbkt->count > _he_newbkt->expand_mult * (tbl)->ideal_chain_maxlen) { \
-            _he_newbkt->expand_mult++;                                           \
+          if (_hm_newbkt->count > _hm_newbkt->expand_mult * (tbl)->ideal_chain_maxlen) { \
+            _hm_newbkt->expand_mult++;                                           \
           }                                                                      \
         }                                                                        \
-        _he_thh->hh_prev = NULL;                                                 \
-        _he_thh->hh_next = _he_newbkt->hh_head;                                  \
-        if (_he_newbkt->hh_head != NULL) {                                       \
-          _he_newbkt->hh_head->hh_prev = _he_thh;                                \
+        _hm_thh->hh_prev = NULL;                                                 \
+        _hm_thh->hh_next = _hm_newbkt->hh_head;                                  \
+        if (_hm_newbkt->hh_head != NULL) {                                       \
+          _hm_newbkt->hh_head->hh_prev = _hm_thh;                                \
         }                                                                        \
-        _he_newbkt->hh_head = _he_thh;                                           \
-        _he_thh = _he_hh_nxt;                                                    \
+        _hm_newbkt->hh_head = _hm_thh;                                           \
+        HASH_BKT_TAG_PUSH(_hm_newbkt, _hm_thh);                                  \
+        _hm_thh = _hm_hh_nxt;                                                    \
       }                                                                          \
     }                                                                            \
-    uthash_free((tbl)->buckets, (tbl)->num_buckets * sizeof(struct UT_hash_bucket)); \
-    (tbl)->num_buckets *= 2U;                                                    \
-    (tbl)->log2_num_buckets++;                                                   \
-    (tbl)->buckets = _he_new_buckets;                                            \
-    (tbl)->ineff_expands = ((tbl)->nonideal_items > ((tbl)->num_items >> 1)) ?   \
-        ((tbl)->ineff_expands+1U) : 0U;                                          \
-    if ((tbl)->ineff_expands > 1U) {                                             \
-      (tbl)->noexpand = 1;                                                       \
-      uthash_noexpand_fyi(tbl);                                                  \
+    if ((tbl)->migrate_pos == (tbl)->old_num_buckets) {                          \
+      HASH_TBL_FREE(tbl, (tbl)->old_buckets,                                     \
+                    (tbl)->old_num_buckets * sizeof(struct UT_hash_bucket));     \
+      (tbl)->old_buckets = NULL;                                                 \
+      HASH_EXPANDED(tbl);                                                        \
     }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* finish a resize under way, before walking or resizing all the buckets */
+#define HASH_MIGRATE_ALL(tbl)                                                    \
+do {                                                                             \
+  while ((tbl)->old_buckets != NULL) {                                           \
+    HASH_MIGRATE(tbl);                                                           \
+  }                                                                              \
+} while (0)
+
+#define HASH_FREE_BUCKETS(tbl)                                                   \
+do {                                                                             \
+  HASH_TBL_FREE(tbl, (tbl)->buckets,                                             \
+                (tbl)->num_buckets * sizeof(struct UT_hash_bucket));             \
+  if ((tbl)->old_buckets != NULL) {                                              \
+    HASH_TBL_FREE(tbl, (tbl)->old_buckets,                                       \
+                  (tbl)->old_num_buckets * sizeof(struct UT_hash_bucket));       \
+  }                                                                              \
+} while (0)
+
+#define HASH_OLD_BUCKETS_BYTES(tbl)                                              \
+  (((tbl)->old_buckets != NULL) ? ((tbl)->old_num_buckets * sizeof(UT_hash_bucket)) : 0U)
+
+#define HASH_EXPAND_BUCKETS(hh,tbl,oomed)                                        \
+do {                                                                             \
+  if ((tbl)->old_buckets == NULL) {                                              \
+    unsigned _hx_lg2 = (tbl)->log2_num_buckets + 1U;                             \
+    unsigned _hx_nbkts = 1U << _hx_lg2;                                          \
+    UT_hash_bucket *_hx_new_buckets = (UT_hash_bucket*)HASH_TBL_MALLOC(tbl,      \
+        sizeof(struct UT_hash_bucket) * _hx_nbkts);                              \
+    if (!_hx_new_buckets) {                                                      \
+      HASH_RECORD_OOM(oomed);                                                    \
+    } else {                                                                     \
+      uthash_bzero(_hx_new_buckets, sizeof(struct UT_hash_bucket) * _hx_nbkts);  \
+      (tbl)->ideal_chain_maxlen =                                                \
+         ((tbl)->num_items >> _hx_lg2) +                                         \
+         ((((tbl)->num_items & (_hx_nbkts-1U)) != 0U) ? 1U : 0U);                \
+      (tbl)->nonideal_items = 0;                                                 \
+      (tbl)->old_buckets = (tbl)->buckets;                                       \
+      (tbl)->old_num_buckets = (tbl)->num_buckets;                               \
+      (tbl)->migrate_pos = 0;                                                    \
+      (tbl)->buckets = _hx_new_buckets;                                          \
+      (tbl)->num_buckets = _hx_nbkts;                                            \
+      (tbl)->log2_num_buckets = _hx_lg2;                                         \
+      (tbl)->expansions++;                                                       \
+      uthash_expand_fyi(tbl);                                                    \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+#else
+#define HASH_MIGRATE(tbl)
+#define HASH_MIGRATE_ALL(tbl)
+#define HASH_FREE_BUCKETS(tbl)                                                   \
+  HASH_TBL_FREE(tbl, (tbl)->buckets, (tbl)->num_buckets * sizeof(struct UT_hash_bucket))
+#define HASH_OLD_BUCKETS_BYTES(tbl) 0U
+
+#define HASH_EXPAND_BUCKETS(hh,tbl,oomed)                                        \
+do {                                                                             \
+  IF_HASH_NONFATAL_OOM( int _hx_oomed = 0; )                                     \
+  HASH_RESIZE_BUCKETS(hh, tbl, (tbl)->log2_num_buckets + 1U, _hx_oomed);         \
+  IF_HASH_NONFATAL_OOM( if (_hx_oomed) { HASH_RECORD_OOM(oomed); } else )        \
+  {                                                                              \
+    (tbl)->expansions++;                                                         \
+    HASH_EXPANDED(tbl);                                                          \
     uthash_expand_fyi(tbl);                                                      \
   }                                                                              \
 } while (0)
+#endif
+
+#if HASH_SHRINK
+/* Bucket contraction (-DHASH_SHRINK=1). A delete that leaves fewer than one
+ * item per HASH_SHRINK_LOAD buckets halves the bucket array, down to
+ * HASH_INITIAL_NUM_BUCKETS. The halved table has under 2/HASH_SHRINK_LOAD
+ * items per bucket, far from the chains that expand it, and it halves again
+ * only once half of those items are gone too, so a table whose size hovers
+ * around a threshold doesn't keep resizing. Like an expansion, a halving
+ * moves every item, which deletes pay for in amortized constant time. If the
+ * smaller array can't be allocated, the table just stays as it is. With
+ * HASH_INCREMENTAL_RESIZE, no halving starts while an expansion is being
+ * migrated. */
+#ifndef HASH_SHRINK_LOAD
+#define HASH_SHRINK_LOAD 8U
+#endif
+
+#if HASH_INCREMENTAL_RESIZE
+#define HASH_SHRINK_READY(tbl) ((tbl)->old_buckets == NULL)
+#else
+#define HASH_SHRINK_READY(tbl) 1
+#endif
+
+#define HASH_SHRINK_BUCKETS(tbl)                                                 \
+do {                                                                             \
+  if (((tbl)->num_buckets > HASH_INITIAL_NUM_BUCKETS) &&                         \
+      ((tbl)->num_items < (tbl)->num_buckets / HASH_SHRINK_LOAD) &&              \
+      HASH_SHRINK_READY(tbl)) {                                                  \
+    UT_hash_bucket *_hk_new_buckets = (UT_hash_bucket*)HASH_TBL_MALLOC(tbl,      \
+        sizeof(struct UT_hash_bucket) * ((tbl)->num_buckets >> 1));              \
+    if (_hk_new_buckets != NULL) {                                               \
+      HASH_REDISTRIBUTE(tbl, _hk_new_buckets, (tbl)->log2_num_buckets - 1U);     \
+      (tbl)->ineff_expands = 0;                                                  \
+      (tbl)->contractions++;                                                     \
+      uthash_contract_fyi(tbl);                                                  \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#define HASH_CONTRACTIONS(tbl) ((tbl)->contractions)
+#else
+#define HASH_SHRINK_BUCKETS(tbl)
+#define HASH_CONTRACTIONS(tbl) 0U
+#endif
+
+/* HASH_RESERVE grows the bucket array of an existing hash up front so that
+ * at least num_bkts buckets are available (rounded up to a power of two).
+ * Callers that know roughly how many items are coming can use it right
+ * after the first add to skip the intermediate doublings that
+ * HASH_EXPAND_BUCKETS would otherwise perform one by one. It never
+ * shrinks the table, and it does nothing on an empty hash (there is no
+ * table to resize until the first item has been added). The expansion
+ * counters are untouched, so uthash_expand_fyi is not called. On a
+ * non-fatal OOM the table is simply left at its current size. */
+#define HASH_RESERVE(hh,head,num_bkts)                                           \
+do {                                                                             \
+  if (head) {                                                                    \
+    unsigned _hr_lg2 = (head)->hh.tbl->log2_num_buckets;                         \
+    IF_HASH_NONFATAL_OOM( int _hr_oomed = 0; )                                   \
+    HASH_MIGRATE_ALL((head)->hh.tbl);                                            \
+    while ((_hr_lg2 < 31U) && ((1U << _hr_lg2) < (unsigned)(num_bkts))) {        \
+      _hr_lg2++;                                                                 \
+    }                                                                            \
+    if (_hr_lg2 > (head)->hh.tbl->log2_num_buckets) {                            \
+      HASH_RESIZE_BUCKETS(hh, (head)->hh.tbl, _hr_lg2, _hr_oomed);               \
+      IF_HASH_NONFATAL_OOM( (void)_hr_oomed; )                                   \
+    }                                                                            \
+  }                                                                              \
+} while (0)
 
 
 /* This is an adaptation of Simon Tatham's O(n log(n)) mergesort */
@@ -970,10 +2279,164 @@ do {
       }                                                                          \
       _hs_insize *= 2U;                                                          \
     }                                                                            \
+    HASH_SKIP_FREE((head)->hh.tbl, 1);                                           \
     HASH_FSCK(hh, head, "HASH_SRT");                                             \
   }                                                                              \
 } while (0)
 
+/* HASH_SRT_ARRAY sorts like HASH_SRT (a stable mergesort, same cmpfcn), but
+ * over a temporary array of the hash handles instead of the list itself:
+ * short runs are insertion-sorted, then merged side by side in the array,
+ * and the list is relinked in one pass at the end. It takes two pointers of
+ * scratch space per item, from the table's allocator; if that allocation
+ * fails it falls back to HASH_SRT. */
+#ifndef HASH_SRT_RUN
+#define HASH_SRT_RUN 8U                  /* items insertion-sorted per run   */
+#endif
+#define HASH_SRT_CMP(head,tbl,cmpfcn,hha,hhb)                                    \
+  cmpfcn(DECLTYPE(head)(ELMT_FROM_HH(tbl, hha)),                                 \
+         DECLTYPE(head)(ELMT_FROM_HH(tbl, hhb)))
+#define HASH_SRT_RELINK(hh,head,tbl,hhs,n)                                       \
+do {                                                                             \
+  unsigned _hl_i;                                                                \
+  for (_hl_i = 0; _hl_i < (n); _hl_i++) {                                        \
+    (hhs)[_hl_i]->prev = (_hl_i > 0U) ?                                          \
+      ELMT_FROM_HH(tbl, (hhs)[_hl_i - 1U]) : NULL;                               \
+    (hhs)[_hl_i]->next = (_hl_i + 1U < (n)) ?                                    \
+      ELMT_FROM_HH(tbl, (hhs)[_hl_i + 1U]) : NULL;                               \
+  }                                                                              \
+  (tbl)->tail = (hhs)[(n) - 1U];                                                 \
+  DECLTYPE_ASSIGN(head, ELMT_FROM_HH(tbl, (hhs)[0]));                            \
+} while (0)
+#define HASH_SORT_ARRAY(head,cmpfcn) HASH_SRT_ARRAY(hh,head,cmpfcn)
+#define HASH_SRT_ARRAY(hh,head,cmpfcn)                                           \
+do {                                                                             \
+  unsigned _ha_n, _ha_i, _ha_j, _ha_w, _ha_lo, _ha_mid, _ha_hi, _ha_l, _ha_r;    \
+  struct UT_hash_handle **_ha_buf, **_ha_a, **_ha_b, **_ha_t, *_ha_hh;           \
+  UT_hash_table *_ha_tbl;                                                        \
+  if (head != NULL) {                                                            \
+    _ha_tbl = (head)->hh.tbl;                                                    \
+    _ha_n = _ha_tbl->num_items;                                                  \
+    _ha_buf = (struct UT_hash_handle**)HASH_TBL_MALLOC(_ha_tbl,                  \
+        2U * _ha_n * sizeof(struct UT_hash_handle*));                            \
+    if (_ha_buf == NULL) {                                                       \
+      HASH_SRT(hh, head, cmpfcn);                                                \
+    } else {                                                                     \
+      _ha_a = _ha_buf;                                                           \
+      _ha_b = _ha_buf + _ha_n;                                                   \
+      _ha_hh = &((head)->hh);                                                    \
+      for (_ha_i = 0; _ha_i < _ha_n; _ha_i++) {                                  \
+        _ha_a[_ha_i] = _ha_hh;                                                   \
+        _ha_hh = (_ha_hh->next != NULL) ?                                        \
+          HH_FROM_ELMT(_ha_tbl, _ha_hh->next) : NULL;                            \
+      }                                                                          \
+      for (_ha_lo = 0; _ha_lo < _ha_n; _ha_lo += HASH_SRT_RUN) {                 \
+        _ha_hi = (HASH_SRT_RUN < _ha_n - _ha_lo) ?                               \
+          _ha_lo + HASH_SRT_RUN : _ha_n;                                         \
+        for (_ha_i = _ha_lo + 1U; _ha_i < _ha_hi; _ha_i++) {                     \
+          _ha_hh = _ha_a[_ha_i];                                                 \
+          for (_ha_j = _ha_i; (_ha_j > _ha_lo) && (HASH_SRT_CMP(head,            \
+               _ha_tbl, cmpfcn, _ha_a[_ha_j - 1U], _ha_hh) > 0); _ha_j--) {      \
+            _ha_a[_ha_j] = _ha_a[_ha_j - 1U];                                    \
+          }                                                                      \
+          _ha_a[_ha_j] = _ha_hh;                                                 \
+        }                                                                        \
+      }                                                                          \
+      for (_ha_w = HASH_SRT_RUN; _ha_w < _ha_n; _ha_w *= 2U) {                   \
+        for (_ha_lo = 0; _ha_lo < _ha_n; _ha_lo += 2U * _ha_w) {                 \
+          _ha_mid = (_ha_w < _ha_n - _ha_lo) ? _ha_lo + _ha_w : _ha_n;           \
+          _ha_hi = (_ha_w < _ha_n - _ha_mid) ? _ha_mid + _ha_w : _ha_n;          \
+          _ha_l = _ha_lo;                                                        \
+          _ha_r = _ha_mid;                                                       \
+          for (_ha_i = _ha_lo; _ha_i < _ha_hi; _ha_i++) {                        \
+            if ((_ha_r < _ha_hi) && ((_ha_l == _ha_mid) || (HASH_SRT_CMP(head,   \
+                _ha_tbl, cmpfcn, _ha_a[_ha_r], _ha_a[_ha_l]) < 0))) {            \
+              _ha_b[_ha_i] = _ha_a[_ha_r++];                                     \
+            } else {                                                             \
+              _ha_b[_ha_i] = _ha_a[_ha_l++];                                     \
+            }                                                                    \
+          }                                                                      \
+        }                                                                        \
+        _ha_t = _ha_a;                                                           \
+        _ha_a = _ha_b;                                                           \
+        _ha_b = _ha_t;                                                           \
+      }                                                                          \
+      HASH_SRT_RELINK(hh, head, _ha_tbl, _ha_a, _ha_n);                          \
+      HASH_TBL_FREE(_ha_tbl, _ha_buf,                                            \
+          2U * _ha_n * sizeof(struct UT_hash_handle*));                          \
+    }                                                                            \
+    HASH_SKIP_FREE((head)->hh.tbl, 1);                                           \
+    HASH_FSCK(hh, head, "HASH_SRT_ARRAY");                                       \
+  }                                                                              \
+} while (0)
+
+/* HASH_SRT_RADIX orders the items by an unsigned integer of up to 64 bits
+ * that keyfcn(item) returns, with a stable LSD radix sort a byte at a time;
+ * bytes in which all the keys agree take no pass. (To sort by a signed key,
+ * have keyfcn flip its sign bit.) The scratch space, two keys and two
+ * pointers per item, comes from the table's allocator; with
+ * HASH_NONFATAL_OOM, the order is left as it was if that allocation fails. */
+#define HASH_SORT_RADIX(head,keyfcn) HASH_SRT_RADIX(hh,head,keyfcn)
+#define HASH_SRT_RADIX(hh,head,keyfcn)                                           \
+do {                                                                             \
+  unsigned _hr_n, _hr_i, _hr_d, _hr_b, _hr_sum, _hr_cnt;                         \
+  unsigned _hr_c[8][256];                                                        \
+  uint64_t *_hr_k, *_hr_k2, *_hr_kt;                                             \
+  struct UT_hash_handle **_hr_h, **_hr_h2, **_hr_ht, *_hr_hh;                    \
+  UT_hash_table *_hr_tbl;                                                        \
+  void *_hr_buf;                                                                 \
+  IF_HASH_NONFATAL_OOM( int _hr_oomed = 0; )                                     \
+  if (head != NULL) {                                                            \
+    _hr_tbl = (head)->hh.tbl;                                                    \
+    _hr_n = _hr_tbl->num_items;                                                  \
+    _hr_buf = HASH_TBL_MALLOC(_hr_tbl, 2U * _hr_n *                              \
+        (sizeof(uint64_t) + sizeof(struct UT_hash_handle*)));                    \
+    if (_hr_buf == NULL) {                                                       \
+      HASH_RECORD_OOM(_hr_oomed);                                                \
+      IF_HASH_NONFATAL_OOM( (void)_hr_oomed; )                                   \
+    } else {                                                                     \
+      _hr_k = (uint64_t*)_hr_buf;                                                \
+      _hr_k2 = _hr_k + _hr_n;                                                    \
+      _hr_h = (struct UT_hash_handle**)(void*)(_hr_k2 + _hr_n);                  \
+      _hr_h2 = _hr_h + _hr_n;                                                    \
+      uthash_bzero(_hr_c, sizeof(_hr_c));                                        \
+      _hr_hh = &((head)->hh);                                                    \
+      for (_hr_i = 0; _hr_i < _hr_n; _hr_i++) {                                  \
+        _hr_h[_hr_i] = _hr_hh;                                                   \
+        _hr_k[_hr_i] = (uint64_t)keyfcn(                                         \
+            DECLTYPE(head)(ELMT_FROM_HH(_hr_tbl, _hr_hh)));                      \
+        for (_hr_d = 0; _hr_d < 8U; _hr_d++) {                                   \
+          _hr_c[_hr_d][(_hr_k[_hr_i] >> (8U * _hr_d)) & 0xffU]++;                \
+        }                                                                        \
+        _hr_hh = (_hr_hh->next != NULL) ?                                        \
+          HH_FROM_ELMT(_hr_tbl, _hr_hh->next) : NULL;                            \
+      }                                                                          \
+      for (_hr_d = 0; _hr_d < 8U; _hr_d++) {                                     \
+        if (_hr_c[_hr_d][(_hr_k[0] >> (8U * _hr_d)) & 0xffU] == _hr_n) {         \
+          continue;                                                              \
+        }                                                                        \
+        for (_hr_sum = 0, _hr_b = 0; _hr_b < 256U; _hr_b++) {                    \
+          _hr_cnt = _hr_c[_hr_d][_hr_b];                                         \
+          _hr_c[_hr_d][_hr_b] = _hr_sum;                                         \
+          _hr_sum += _hr_cnt;                                                    \
+        }                                                                        \
+        for (_hr_i = 0; _hr_i < _hr_n; _hr_i++) {                                \
+          _hr_b = _hr_c[_hr_d][(_hr_k[_hr_i] >> (8U * _hr_d)) & 0xffU]++;        \
+          _hr_k2[_hr_b] = _hr_k[_hr_i];                                          \
+          _hr_h2[_hr_b] = _hr_h[_hr_i];                                          \
+        }                                                                        \
+        _hr_kt = _hr_k; _hr_k = _hr_k2; _hr_k2 = _hr_kt;                         \
+        _hr_ht = _hr_h; _hr_h = _hr_h2; _hr_h2 = _hr_ht;                         \
+      }                                                                          \
+      HASH_SRT_RELINK(hh, head, _hr_tbl, _hr_h, _hr_n);                          \
+      HASH_TBL_FREE(_hr_tbl, _hr_buf, 2U * _hr_n *                               \
+          (sizeof(uint64_t) + sizeof(struct UT_hash_handle*)));                  \
+    }                                                                            \
+    HASH_SKIP_FREE((head)->hh.tbl, 1);                                           \
+    HASH_FSCK(hh, head, "HASH_SRT_RADIX");                                       \
+  }                                                                              \
+} while (0)
+
 /* This function selects items from one hash into another hash.
  * The end result is that the selected items have dual presence
  * in both hashes. There is no copy of the items made; rather
@@ -981,80 +2444,412 @@ do {
  * hash handle that must be present in the structure. */
 #define HASH_SELECT(hh_dst, dst, hh_src, src, cond)                              \
 do {                                                                             \
-  unsigned _src_bkt, _dst_bkt;                                                   \
+  unsigned _src_bkt;                                                             \
   void *_last_elt = NULL, *_elt;                                                 \
-  UT_hash_handle *_src_hh, *_dst_hh, *_last_elt_hh=NULL;                         \
+  UT_hash_handle *_src_hh, *_last_elt_hh=NULL;                                   \
   ptrdiff_t _dst_hho = ((char*)(&(dst)->hh_dst) - (char*)(dst));                 \
   if ((src) != NULL) {                                                           \
-    for (_src_bkt=0; _src_bkt < (src)->hh_src.tbl->num_buckets; _src_bkt++) {    \
-      for (_src_hh = (src)->hh_src.tbl->buckets[_src_bkt].hh_head;               \
-        _src_hh != NULL;                                                         \
-        _src_hh = _src_hh->hh_next) {                                            \
+    HASH_MIGRATE_ALL((src)->hh_src.tbl);                                         \
+    HASH_SELECT_SRC_LOOP((src)->hh_src.tbl, _src_bkt, _src_hh) {                 \
         _elt = ELMT_FROM_HH((src)->hh_src.tbl, _src_hh);                         \
         if (cond(_elt)) {                                                        \
-          IF_HASH_NONFATAL_OOM( int _hs_oomed = 0; )                             \
-          _dst_hh = (UT_hash_handle*)(void*)(((char*)_elt) + _dst_hho);          \
-          _dst_hh->key = _src_hh->key;                                           \
-          _dst_hh->keylen = _src_hh->keylen;                                     \
-          _dst_hh->hashv = _src_hh->hashv;                                       \
-          _dst_hh->prev = _last_elt;                                             \
-          _dst_hh->next = NULL;                                                  \
-          if (_last_elt_hh != NULL) {                                            \
-            _last_elt_hh->next = _elt;                                           \
-          }                                                                      \
-          if ((dst) == NULL) {                                                   \
-            DECLTYPE_ASSIGN(dst, _elt);                                          \
-            HASH_MAKE_TABLE(hh_dst, dst, _hs_oomed);                             \
-            IF_HASH_NONFATAL_OOM(                                                \
-              if (_hs_oomed) {                                                   \
-                uthash_nonfatal_oom(_elt);                                       \
-                (dst) = NULL;                                                    \
-                continue;                                                        \
-              }                                                                  \
-            )                                                                    \
-          } else {                                                               \
-            _dst_hh->tbl = (dst)->hh_dst.tbl;                                    \
-          }                                                                      \
-          HASH_TO_BKT(_dst_hh->hashv, _dst_hh->tbl->num_buckets, _dst_bkt);      \
-          HASH_ADD_TO_BKT(_dst_hh->tbl->buckets[_dst_bkt], hh_dst, _dst_hh, _hs_oomed); \
-          (dst)->hh_dst.tbl->num_items++;                                        \
-          IF_HASH_NONFATAL_OOM(                                                  \
-            if (_hs_oomed) {                                                     \
-              HASH_ROLLBACK_BKT(hh_dst, dst, _dst_hh);                           \
-              HASH_DELETE_HH(hh_dst, dst, _dst_hh);                              \
-              _dst_hh->tbl = NULL;                                               \
-              uthash_nonfatal_oom(_elt);                                         \
-              continue;                                                          \
-            }                                                                    \
-          )                                                                      \
-          HASH_BLOOM_ADD(_dst_hh->tbl, _dst_hh->hashv);                          \
-          _last_elt = _elt;                                                      \
-          _last_elt_hh = _dst_hh;                                                \
+          HASH_SELECT_ADD(hh_dst, dst, _dst_hho, _elt, _src_hh, _last_elt, _last_elt_hh); \
         }                                                                        \
-      }                                                                          \
     }                                                                            \
   }                                                                              \
   HASH_FSCK(hh_dst, dst, "HASH_SELECT");                                         \
 } while (0)
 
+/* add elt, whose source handle is srchh, to dst after lastelt. This is the
+ * body of a loop, which it continues if the add fails on a non-fatal OOM. */
+#define HASH_SELECT_ADD(hh_dst,dst,dsthho,elt,srchh,lastelt,lastelthh)           \
+{                                                                                \
+  UT_hash_handle *_dst_hh;                                                       \
+  IF_HASH_NONFATAL_OOM( int _hs_oomed = 0; )                                     \
+  _dst_hh = (UT_hash_handle*)(void*)(((char*)(elt)) + (dsthho));                 \
+  _dst_hh->key = (srchh)->key;                                                   \
+  _dst_hh->keylen = (srchh)->keylen;                                             \
+  _dst_hh->hashv = (srchh)->hashv;                                               \
+  HASH_SKIP_INIT(_dst_hh);                                                       \
+  _dst_hh->prev = (lastelt);                                                     \
+  _dst_hh->next = NULL;                                                          \
+  if ((lastelthh) != NULL) {                                                     \
+    (lastelthh)->next = (elt);                                                   \
+  }                                                                              \
+  if ((dst) == NULL) {                                                           \
+    DECLTYPE_ASSIGN(dst, elt);                                                   \
+    HASH_MAKE_TABLE(hh_dst, dst, _hs_oomed);                                     \
+    IF_HASH_NONFATAL_OOM(                                                        \
+      if (_hs_oomed) {                                                           \
+        uthash_nonfatal_oom(elt);                                                \
+        (dst) = NULL;                                                            \
+        continue;                                                                \
+      }                                                                          \
+    )                                                                            \
+  } else {                                                                       \
+    _dst_hh->tbl = (dst)->hh_dst.tbl;                                            \
+  }                                                                              \
+  HASH_MIGRATE(_dst_hh->tbl);                                                    \
+  HASH_DENSE_ADD(_dst_hh->tbl, _dst_hh, _dst_hh->tbl->num_items, _hs_oomed);     \
+  IF_HASH_NONFATAL_OOM( if (!_hs_oomed) )                                        \
+  HASH_ADD_TO_BKT(*HASH_BKT(_dst_hh->tbl, _dst_hh->hashv), hh_dst, _dst_hh, _hs_oomed); \
+  (dst)->hh_dst.tbl->num_items++;                                                \
+  IF_HASH_NONFATAL_OOM(                                                          \
+    if (_hs_oomed) {                                                             \
+      HASH_ROLLBACK_BKT(hh_dst, dst, _dst_hh);                                   \
+      HASH_DELETE_HH(hh_dst, dst, _dst_hh);                                      \
+      _dst_hh->tbl = NULL;                                                       \
+      uthash_nonfatal_oom(elt);                                                  \
+      continue;                                                                  \
+    }                                                                            \
+  )                                                                              \
+  HASH_BLOOM_ADD(_dst_hh->tbl, _dst_hh->hashv);                                  \
+  (lastelt) = (elt);                                                             \
+  (lastelthh) = _dst_hh;                                                         \
+}
+
+/* Bulk builds. HASH_ADD_BULK adds the n items items[0] to items[n-1] (an
+ * array of item pointers) in that order, as HASH_ADD would one by one, but
+ * it hashes all the keys first, in a loop of its own, and then grows the
+ * bucket array once, to HASH_CNT + n buckets, so that linking the items
+ * into their buckets causes no further expansions. HASH_SELECT_PARALLEL
+ * selects like HASH_SELECT, reusing the source hash values: it evaluates
+ * cond on every source item in one loop, then reserves the buckets of dst
+ * for the items that matched and links them in. Built with OpenMP, the
+ * hashing and cond loops run on all threads (HASH_PARALLEL_FOR), so cond
+ * and HASH_FUNCTION must then be thread-safe; the linking is sequential. */
+#ifndef HASH_PARALLEL_FOR
+#if defined(_OPENMP)
+#define HASH_PARALLEL_FOR _Pragma("omp parallel for schedule(static)")
+#else
+#define HASH_PARALLEL_FOR
+#endif
+#endif
+#ifndef HASH_BULK_AHEAD
+#define HASH_BULK_AHEAD 8U               /* buckets prefetched ahead of links */
+#endif
+
+#define HASH_ADD_BULK_KEYS(hh,head,fieldname,keylen_in,strkeys,items,n)          \
+do {                                                                             \
+  size_t _hab_i, _hab_n = (size_t)(n);                                           \
+  HASH_PARALLEL_FOR                                                              \
+  for (_hab_i = 0; _hab_i < _hab_n; _hab_i++) {                                  \
+    UT_hash_handle *_hab_hh = &((items)[_hab_i]->hh);                            \
+    _hab_hh->key = &((items)[_hab_i]->fieldname);                                \
+    _hab_hh->keylen = (strkeys) ? (unsigned)uthash_strlen((const char*)_hab_hh->key) \
+                                : (unsigned)(keylen_in);                         \
+    HASH_VALUE(_hab_hh->key, _hab_hh->keylen, _hab_hh->hashv);                   \
+  }                                                                              \
+  HASH_ADD_BULK_FROM(hh, head, hh, items, _hab_n);                               \
+} while (0)
+
+#define HASH_ADD_BULK(hh,head,fieldname,keylen_in,items,n)                       \
+    HASH_ADD_BULK_KEYS(hh, head, fieldname, keylen_in, 0, items, n)
+
+/* Secondary hashes with the same key. HASH_ADD_FROM adds an item to head
+ * through handle hh_dst under the key, key length and hash value already in
+ * its handle hh_src, which must be in a hash (or have been filled in by a
+ * bulk build), so that the key is not hashed again; HASH_ADD_BULK_FROM does
+ * so for n items, growing the buckets once as HASH_ADD_BULK does. Both
+ * hashes must use the same hash function: a hash built with the _WORD forms
+ * takes its hash values from another such hash only. The item is found in
+ * the new hash as in the old one, with the key pointer of hh_src. */
+#define HASH_ADD_FROM(hh_dst,head,hh_src,add)                                    \
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh_dst, head, (add)->hh_src.key,                 \
+                                (add)->hh_src.keylen, (add)->hh_src.hashv, add)
+
+#define HASH_ADD_BULK_FROM(hh_dst,head,hh_src,items,n)                           \
+do {                                                                             \
+  size_t _habf_i, _habf_n = (size_t)(n);                                         \
+  for (_habf_i = 0; _habf_i < _habf_n; _habf_i++) {                              \
+    if (_habf_i == 1U) {                                                         \
+      HASH_RESERVE(hh_dst, head, HASH_CNT(hh_dst, head) + (_habf_n - 1U));       \
+    }                                                                            \
+    if (((head) != NULL) && (_habf_i + HASH_BULK_AHEAD < _habf_n)) {             \
+      HASH_PREFETCH(HASH_BKT((head)->hh_dst.tbl,                                 \
+                             (items)[_habf_i + HASH_BULK_AHEAD]->hh_src.hashv)); \
+    }                                                                            \
+    HASH_ADD_FROM(hh_dst, head, hh_src, (items)[_habf_i]);                       \
+  }                                                                              \
+} while (0)
+
+#define HASH_SELECT_PARALLEL(hh_dst, dst, hh_src, src, cond)                     \
+do {                                                                             \
+  unsigned _hsp_i, _hsp_n, _hsp_m;                                               \
+  void *_hsp_last = NULL, *_hsp_elt;                                             \
+  UT_hash_handle *_hsp_hh, *_hsp_last_hh = NULL, **_hsp_buf;                     \
+  unsigned char *_hsp_sel;                                                       \
+  UT_hash_table *_hsp_tbl;                                                       \
+  ptrdiff_t _hsp_hho = ((char*)(&(dst)->hh_dst) - (char*)(dst));                 \
+  if ((src) != NULL) {                                                           \
+    _hsp_tbl = (src)->hh_src.tbl;                                                \
+    HASH_MIGRATE_ALL(_hsp_tbl);                                                  \
+    _hsp_n = _hsp_tbl->num_items;                                                \
+    _hsp_buf = (UT_hash_handle**)HASH_TBL_MALLOC(_hsp_tbl,                       \
+        _hsp_n * (sizeof(UT_hash_handle*) + 1U));                                \
+    if (_hsp_buf == NULL) {                                                      \
+      HASH_SELECT(hh_dst, dst, hh_src, src, cond);                               \
+    } else {                                                                     \
+      _hsp_sel = (unsigned char*)(void*)(_hsp_buf + _hsp_n);                     \
+      _hsp_m = 0;                                                                \
+      HASH_SELECT_SRC_LOOP(_hsp_tbl, _hsp_i, _hsp_hh) {                          \
+        _hsp_buf[_hsp_m++] = _hsp_hh;                                            \
+      }                                                                          \
+      HASH_PARALLEL_FOR                                                          \
+      for (_hsp_i = 0; _hsp_i < _hsp_n; _hsp_i++) {                              \
+        _hsp_sel[_hsp_i] = cond(ELMT_FROM_HH(_hsp_tbl, _hsp_buf[_hsp_i])) ? 1U : 0U; \
+      }                                                                          \
+      for (_hsp_m = 0, _hsp_i = 0; _hsp_i < _hsp_n; _hsp_i++) {                  \
+        if (_hsp_sel[_hsp_i] != 0U) {                                            \
+          _hsp_buf[_hsp_m++] = _hsp_buf[_hsp_i];                                 \
+        }                                                                        \
+      }                                                                          \
+      for (_hsp_i = 0; _hsp_i < _hsp_m; _hsp_i++) {                              \
+        if (_hsp_i == 1U) {                                                      \
+          HASH_RESERVE(hh_dst, dst, HASH_CNT(hh_dst, dst) + (_hsp_m - 1U));      \
+        }                                                                        \
+        _hsp_hh = _hsp_buf[_hsp_i];                                              \
+        _hsp_elt = ELMT_FROM_HH(_hsp_tbl, _hsp_hh);                              \
+        HASH_SELECT_ADD(hh_dst, dst, _hsp_hho, _hsp_elt, _hsp_hh, _hsp_last, _hsp_last_hh); \
+      }                                                                          \
+      HASH_TBL_FREE(_hsp_tbl, _hsp_buf, _hsp_n * (sizeof(UT_hash_handle*) + 1U)); \
+      HASH_FSCK(hh_dst, dst, "HASH_SELECT_PARALLEL");                            \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* free a table's buckets and bookkeeping, but not its items */
+#define HASH_FREE_TABLE(tbl)                                                     \
+do {                                                                             \
+  HASH_BLOOM_FREE(tbl);                                                          \
+  HASH_DENSE_FREE(tbl);                                                          \
+  HASH_SKIP_FREE(tbl, 0);                                                        \
+  HASH_FREE_BUCKETS(tbl);                                                        \
+  HASH_TBL_FREE(tbl, tbl, sizeof(UT_hash_table));                                \
+} while (0)
+
 #define HASH_CLEAR(hh,head)                                                      \
 do {                                                                             \
   if ((head) != NULL) {                                                          \
-    HASH_BLOOM_FREE((head)->hh.tbl);                                             \
-    uthash_free((head)->hh.tbl->buckets,                                         \
-                (head)->hh.tbl->num_buckets*sizeof(struct UT_hash_bucket));      \
-    uthash_free((head)->hh.tbl, sizeof(UT_hash_table));                          \
+    HASH_FREE_TABLE((head)->hh.tbl);                                             \
     (head) = NULL;                                                               \
   }                                                                              \
 } while (0)
 
+/* Merging. HASH_MERGE moves every item of src into dst, in src's order, and
+ * leaves src empty. Items are found and linked under the key and hash value
+ * already in their handles, so no key is hashed again; both hashes must
+ * therefore hash keys the same way (a hash built with the _WORD forms merges
+ * only with another such hash). When dst already holds an item with the key,
+ * combine(dst_item, src_item) is called instead, and src_item, no longer in
+ * either hash, is the caller's to free (combine may free it). An empty dst
+ * simply takes over src's table.
+ *
+ * HASH_SPLIT moves the items of src into the 2^log2_parts hashes parts[0] to
+ * parts[2^log2_parts - 1], each item going to the part given by the top
+ * log2_parts bits of its hash value (HASH_PART), and leaves src empty. The
+ * parts must not hold any of src's keys already. The rule is the one
+ * utshard.h uses to pick a shard, so with log2_parts == UTSHARD_LOG2 the
+ * parts can be installed as its shards.
+ *
+ * HASH_MERGE_PARTS merges nsrc split hashes: the parts of source s are
+ * parts[(s << log2_parts) + p], and part p of every source is merged, with
+ * HASH_MERGE, into dst[p], which may be empty or hold a hash split the same
+ * way. The parts being disjoint, this loop runs on all threads when built
+ * with OpenMP (HASH_PARALLEL_FOR), and combine must then be thread-safe for
+ * items of different parts. For map-reduce aggregation, each thread splits
+ * its own hash when it is done, then one HASH_MERGE_PARTS folds them all. */
+#define HASH_PART(hashv,log2_parts)                                              \
+  (((log2_parts) == 0U) ? 0U : ((unsigned)(hashv) >> (32U - (log2_parts))))
+
+/* find the handle, in tbl, of the key keyptr with hash value hashval */
+#define HASH_FIND_HH(tbl,keyptr,keylen_in,hashval,outhh)                         \
+do {                                                                             \
+  (outhh) = NULL;                                                                \
+  HASH_MIGRATE(tbl);                                                             \
+  if (HASH_BLOOM_TEST(tbl, hashval)) {                                           \
+    (outhh) = HASH_BKT(tbl, hashval)->hh_head;                                   \
+    while (((outhh) != NULL) && (((outhh)->hashv != (hashval)) ||                \
+           !HASH_KEY_MATCH((outhh)->key, (outhh)->keylen, keyptr, keylen_in))) { \
+      (outhh) = (outhh)->hh_next;                                                \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+#define HASH_MERGE(hh,dst,src,combine)                                           \
+do {                                                                             \
+  UT_hash_table *_hmg_tbl;                                                       \
+  UT_hash_handle *_hmg_found;                                                    \
+  const void *_hmg_key;                                                          \
+  unsigned _hmg_keylen, _hmg_hashv;                                              \
+  void *_hmg_next;                                                               \
+  if ((dst) == NULL) {                                                           \
+    (dst) = (src);                                                               \
+    (src) = NULL;                                                                \
+  } else if ((src) != NULL) {                                                    \
+    _hmg_tbl = (src)->hh.tbl;                                                    \
+    while ((src) != NULL) {                                                      \
+      _hmg_next = (src)->hh.next;                                                \
+      _hmg_key = (src)->hh.key;                                                  \
+      _hmg_keylen = (src)->hh.keylen;                                            \
+      _hmg_hashv = (src)->hh.hashv;                                              \
+      HASH_FIND_HH((dst)->hh.tbl, _hmg_key, _hmg_keylen, _hmg_hashv, _hmg_found); \
+      if (_hmg_found != NULL) {                                                  \
+        combine(DECLTYPE(dst)ELMT_FROM_HH((dst)->hh.tbl, _hmg_found), (src));    \
+      } else {                                                                   \
+        HASH_ADD_KEYPTR_BYHASHVALUE(hh, dst, _hmg_key, _hmg_keylen, _hmg_hashv, src); \
+      }                                                                          \
+      DECLTYPE_ASSIGN(src, _hmg_next);                                           \
+    }                                                                            \
+    HASH_FREE_TABLE(_hmg_tbl);                                                   \
+    HASH_FSCK(hh, dst, "HASH_MERGE");                                            \
+  }                                                                              \
+} while (0)
+
+#define HASH_SPLIT(hh,src,parts,log2_parts)                                      \
+do {                                                                             \
+  UT_hash_table *_hsl_tbl;                                                       \
+  unsigned _hsl_p;                                                               \
+  void *_hsl_next;                                                               \
+  if ((src) != NULL) {                                                           \
+    _hsl_tbl = (src)->hh.tbl;                                                    \
+    while ((src) != NULL) {                                                      \
+      _hsl_next = (src)->hh.next;                                                \
+      _hsl_p = HASH_PART((src)->hh.hashv, (unsigned)(log2_parts));               \
+      HASH_ADD_KEYPTR_BYHASHVALUE(hh, (parts)[_hsl_p], (src)->hh.key,            \
+                                  (src)->hh.keylen, (src)->hh.hashv, src);       \
+      DECLTYPE_ASSIGN(src, _hsl_next);                                           \
+    }                                                                            \
+    HASH_FREE_TABLE(_hsl_tbl);                                                   \
+  }                                                                              \
+} while (0)
+
+#define HASH_MERGE_PARTS(hh,dst,parts,nsrc,log2_parts,combine)                   \
+do {                                                                             \
+  int _hmp_p, _hmp_np = (int)(1U << (unsigned)(log2_parts));                     \
+  HASH_PARALLEL_FOR                                                              \
+  for (_hmp_p = 0; _hmp_p < _hmp_np; _hmp_p++) {                                 \
+    size_t _hmp_s;                                                               \
+    for (_hmp_s = 0; _hmp_s < (size_t)(nsrc); _hmp_s++) {                        \
+      HASH_MERGE(hh, (dst)[_hmp_p],                                              \
+                 (parts)[(_hmp_s << (unsigned)(log2_parts)) + (size_t)_hmp_p], combine); \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
 #define HASH_OVERHEAD(hh,head)                                                   \
  (((head) != NULL) ? (                                                           \
  (size_t)(((head)->hh.tbl->num_items   * sizeof(UT_hash_handle))   +             \
           ((head)->hh.tbl->num_buckets * sizeof(UT_hash_bucket))   +             \
+           HASH_OLD_BUCKETS_BYTES((head)->hh.tbl)                  +             \
+           HASH_DENSE_BYTES((head)->hh.tbl)                        +             \
+           HASH_SKIP_OVERHEAD((head)->hh.tbl)                      +             \
            sizeof(UT_hash_table)                                   +             \
            (HASH_BLOOM_BYTELEN))) : 0U)
 
+/* HASH_STATS fills a UT_hash_stats with the shape of a hash: its size, a
+ * histogram of its chain lengths, the expansion counters, and how full its
+ * Bloom filter is. It walks the bucket array (and the Bloom filter), so it
+ * costs as much as a scan of the buckets; all fields are 0 for an empty
+ * hash. The load is in percent, since uthash uses no floating point. */
+#ifndef HASH_STATS_CHAINS
+#define HASH_STATS_CHAINS 16U            /* histogram slots, last is ">="    */
+#endif
+#define HASH_STATS(hh,head,stats)                                                \
+do {                                                                             \
+  if ((head) != NULL) {                                                          \
+    HASH_TBL_STATS((head)->hh.tbl, stats);                                       \
+  } else {                                                                       \
+    uthash_bzero((stats), sizeof(UT_hash_stats));                                \
+  }                                                                              \
+} while (0)
+
+#define HASH_TBL_STATS(tbl,stats)                                                \
+do {                                                                             \
+  UT_hash_stats *_hst_s = (stats);                                               \
+  unsigned _hst_i;                                                               \
+  uthash_bzero(_hst_s, sizeof(UT_hash_stats));                                   \
+  _hst_s->num_items = (tbl)->num_items;                                          \
+  _hst_s->num_buckets = (tbl)->num_buckets;                                      \
+  _hst_s->load_pct = (unsigned)(((unsigned long)(tbl)->num_items * 100UL) /      \
+                                (tbl)->num_buckets);                             \
+  for (_hst_i = 0; _hst_i < (tbl)->num_buckets; _hst_i++) {                      \
+    HASH_STATS_CHAIN(_hst_s, (tbl)->buckets[_hst_i].count);                      \
+  }                                                                              \
+  HASH_STATS_OLD(tbl, _hst_s);                                                   \
+  _hst_s->ideal_chain_maxlen = (tbl)->ideal_chain_maxlen;                        \
+  _hst_s->nonideal_items = (tbl)->nonideal_items;                                \
+  _hst_s->ineff_expands = (tbl)->ineff_expands;                                  \
+  _hst_s->noexpand = (tbl)->noexpand;                                            \
+  _hst_s->expansions = (tbl)->expansions;                                        \
+  _hst_s->contractions = HASH_CONTRACTIONS(tbl);                                 \
+  HASH_STATS_BLOOM(tbl, _hst_s);                                                 \
+  _hst_s->overhead = (size_t)(((tbl)->num_items * sizeof(UT_hash_handle)) +      \
+      ((tbl)->num_buckets * sizeof(UT_hash_bucket)) +                            \
+      HASH_OLD_BUCKETS_BYTES(tbl) + HASH_DENSE_BYTES(tbl) +                      \
+      sizeof(UT_hash_table) + (HASH_BLOOM_BYTELEN));                             \
+} while (0)
+
+#define HASH_STATS_CHAIN(s,len)                                                  \
+do {                                                                             \
+  unsigned _hsc_len = (len);                                                     \
+  (s)->chain_hist[(_hsc_len < HASH_STATS_CHAINS - 1U) ?                          \
+                  _hsc_len : HASH_STATS_CHAINS - 1U]++;                          \
+  if (_hsc_len > (s)->max_chain) {                                               \
+    (s)->max_chain = _hsc_len;                                                   \
+  }                                                                              \
+} while (0)
+
+/* during an incremental resize, old buckets not yet migrated count too */
+#if HASH_INCREMENTAL_RESIZE
+#define HASH_STATS_OLD(tbl,s)                                                    \
+do {                                                                             \
+  unsigned _hso_i;                                                               \
+  for (_hso_i = 0; ((tbl)->old_buckets != NULL) &&                               \
+       (_hso_i < (tbl)->old_num_buckets); _hso_i++) {                            \
+    if ((tbl)->old_buckets[_hso_i].count != 0U) {                                \
+      HASH_STATS_CHAIN(s, (tbl)->old_buckets[_hso_i].count);                     \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_STATS_OLD(tbl,s)
+#endif
+
+#ifdef HASH_BLOOM
+#if HASH_BLOOM_BLOCKED
+#define HASH_STATS_BLOOM_BITS(tbl) ((const uint8_t*)(const void*)(tbl)->bloom_blocks)
+#else
+#define HASH_STATS_BLOOM_BITS(tbl) ((const uint8_t*)(tbl)->bloom_bv)
+#endif
+#define HASH_STATS_BLOOM(tbl,s)                                                  \
+do {                                                                             \
+  unsigned long _hsb_i;                                                          \
+  unsigned _hsb_byte;                                                            \
+  (s)->bloom_nbits = HASH_BLOOM_BITLEN;                                          \
+  for (_hsb_i = 0; _hsb_i < HASH_BLOOM_BITLEN / 8UL; _hsb_i++) {                 \
+    for (_hsb_byte = HASH_STATS_BLOOM_BITS(tbl)[_hsb_i]; _hsb_byte != 0U;        \
+         _hsb_byte &= _hsb_byte - 1U) {                                          \
+      (s)->bloom_bits_set++;                                                     \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#else
+#define HASH_STATS_BLOOM(tbl,s)
+#endif
+
+/* for the HASH_STATS_FYI hooks: gather the stats of tbl and hand them, and
+ * what happened, to uthash_stats_fyi */
+#ifndef uthash_stats_fyi
+#define uthash_stats_fyi(stats,event)
+#endif
+#define HASH_STATS_EXPORT(tbl,event)                                             \
+do {                                                                             \
+  UT_hash_stats _hse_stats;                                                      \
+  HASH_TBL_STATS(tbl, &_hse_stats);                                              \
+  uthash_stats_fyi(&_hse_stats, event);                                          \
+} while (0)
+
 #ifdef NO_DECLTYPE
 #define HASH_ITER(hh,head,el,tmp)                                                \
 for(((el)=(head)), ((*(char**)(&(tmp)))=(char*)((head!=NULL)?(head)->hh.next:NULL)); \
@@ -1065,6 +2860,25 @@ for(((el)=(head)), ((tmp)=DECLTYPE(el)((head!=NULL)?(head)->hh.next:NULL));
   (el) != NULL; ((el)=(tmp)), ((tmp)=DECLTYPE(el)((tmp!=NULL)?(tmp)->hh.next:NULL)))
 #endif
 
+#if HASH_DENSE_INDEX
+/* visit the items through the dense index, last slot first, so the body may
+ * delete el; the order is that of the index, not the app order. i is an
+ * unsigned counter. HASH_DENSE_AT gives the i-th item, for i < HASH_CNT: split
+ * [0, HASH_CNT) into ranges to scan them in parallel while nobody writes */
+#ifdef NO_DECLTYPE
+#define HASH_DENSE_ITER(hh,head,el,i)                                            \
+for ((i) = HASH_CNT(hh, head); ((i) > 0U) &&                                     \
+  (((*(char**)(&(el))) = (char*)HASH_DENSE_ELMT(hh, head, --(i))),               \
+   HASH_DENSE_PREFETCH((head)->hh.tbl, (i) - HASH_DENSE_AHEAD), 1); )
+#else
+#define HASH_DENSE_ITER(hh,head,el,i)                                            \
+for ((i) = HASH_CNT(hh, head); ((i) > 0U) &&                                     \
+  (((el) = DECLTYPE(el)(HASH_DENSE_ELMT(hh, head, --(i)))),                      \
+   HASH_DENSE_PREFETCH((head)->hh.tbl, (i) - HASH_DENSE_AHEAD), 1); )
+#endif
+#define HASH_DENSE_AT(hh,head,i) HASH_DENSE_ELMT(hh, head, i)
+#endif
+
 /* obtain a count of items in the hash */
 #define HASH_COUNT(head) HASH_CNT(hh,head)
 #define HASH_CNT(hh,head) ((head != NULL)?((head)->hh.tbl->num_items):0U)
@@ -1087,12 +2901,52 @@ typedef struct UT_hash_bucket {
     */
    unsigned expand_mult;
 
+#if HASH_BUCKET_TAGS
+   /* the hash values of, and pointers to, the first items of the chain */
+   unsigned tag_hashv[HASH_BUCKET_TAGS];
+   struct UT_hash_handle *tag_hh[HASH_BUCKET_TAGS];
+#endif
 } UT_hash_bucket;
 
+#if HASH_INORDER_INDEX
+/* a node of the _INORDER skip list: link[2i] and link[2i+1] are the next
+ * and previous nodes at level i + 1, for i below level */
+typedef struct UT_hash_skip {
+   struct UT_hash_handle *item;      /* the item's handle               */
+   struct UT_hash_skip **link;       /* just after the node             */
+   unsigned level;
+} UT_hash_skip;
+#endif
+
 /* random signature used only to find hash tables in external analysis */
 #define HASH_SIGNATURE 0xa0111fe1u
 #define HASH_BLOOM_SIGNATURE 0xb12220f2u
 
+#if HASH_ALLOCATOR
+/* a per-table allocator: malloc_fn and free_fn get ctx as their first
+ * argument; free_fn also gets the size that was allocated */
+typedef struct UT_hash_allocator {
+   void *(*malloc_fn)(void *ctx, size_t sz);
+   void (*free_fn)(void *ctx, void *ptr, size_t sz);
+   void *ctx;
+} UT_hash_allocator;
+#endif
+
+/* filled in by HASH_STATS */
+typedef struct UT_hash_stats {
+   unsigned num_items, num_buckets;
+   unsigned load_pct;             /* 100 * num_items / num_buckets          */
+   unsigned max_chain;            /* the longest chain                      */
+   /* chain_hist[n] buckets hold n items; the last slot counts the longer */
+   unsigned chain_hist[HASH_STATS_CHAINS];
+   unsigned ideal_chain_maxlen, nonideal_items, ineff_expands, noexpand;
+   unsigned expansions;           /* bucket doublings so far                */
+   unsigned contractions;         /* bucket halvings so far (HASH_SHRINK)   */
+   unsigned long bloom_nbits;     /* size of the Bloom filter, or 0         */
+   unsigned long bloom_bits_set;  /* its bits that are set                  */
+   size_t overhead;               /* bytes, as HASH_OVERHEAD                */
+} UT_hash_stats;
+
 typedef struct UT_hash_table {
    UT_hash_bucket *buckets;
    unsigned num_buckets, log2_num_buckets;
@@ -1116,12 +2970,41 @@ typedef struct UT_hash_table {
     * function isn't a good fit for the key domain. When expansion is inhibited
     * the hash will still work, albeit no longer in constant time. */
    unsigned ineff_expands, noexpand;
+   unsigned expansions; /* bucket doublings so far, as HASH_STATS reports */
+#if HASH_SHRINK
+   unsigned contractions; /* bucket halvings so far, as HASH_STATS reports */
+#endif
 
    uint32_t signature; /* used only to find hash tables in external analysis */
+#if HASH_SEEDED
+   unsigned seed; /* from uthash_table_seed, mixed into bucket numbers      */
+#endif
+#if HASH_INCREMENTAL_RESIZE
+   /* during an incremental resize, the array being migrated into buckets:
+    * old buckets from migrate_pos on still hold their items */
+   UT_hash_bucket *old_buckets;
+   unsigned old_num_buckets, migrate_pos;
+#endif
+#if HASH_ALLOCATOR
+   const UT_hash_allocator *alloc; /* from uthash_table_allocator, or NULL   */
+#endif
+#if HASH_DENSE_INDEX
+   struct UT_hash_handle **dense; /* the items, dense[0] to [num_items-1]    */
+   unsigned dense_cap;            /* allocated length of dense              */
+#endif
+#if HASH_INORDER_INDEX
+   struct UT_hash_skip *skip_head[HASH_SKIP_MAX]; /* first node of each level */
+   unsigned skip_levels, skip_nodes;
+   unsigned skip_rng;             /* state of the node level generator      */
+   size_t skip_bytes;             /* allocated to the nodes                 */
+#endif
 #ifdef HASH_BLOOM
    uint32_t bloom_sig; /* used only to test bloom exists in external analysis */
    uint8_t *bloom_bv;
    uint8_t bloom_nbits;
+#if HASH_BLOOM_BLOCKED
+   uint64_t *bloom_blocks; /* bloom_bv rounded up to a cache line */
+#endif
 #endif
 
 } UT_hash_table;
@@ -1135,6 +3018,12 @@ typedef struct UT_hash_handle {
    const void *key;                  /* ptr to enclosing struct's key  */
    unsigned keylen;                  /* enclosing struct's key len     */
    unsigned hashv;                   /* result of hash-fcn(key)        */
+#if HASH_DENSE_INDEX
+   unsigned dense_idx;               /* slot in tbl->dense             */
+#endif
+#if HASH_INORDER_INDEX
+   struct UT_hash_skip *skip;        /* node in the _INORDER index     */
+#endif
 } UT_hash_handle;
 
 #endif /* UTHASH_H */
@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2003-2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* uthash.hpp: a typed C++11 front end to the uthash macros.
+ *
+ * ut::hash_table<T, Key, &T::field> owns items of type T, each holding its
+ * key in T::field and a UT_hash_handle named hh. The key type, the hash and
+ * the comparator are template parameters, so the key length is a constant
+ * and both the hash and the compare are resolved at compile time: integer,
+ * enum and pointer keys of 4 or 8 bytes use the HASH_WORD hash and ==, and
+ * other keys hash all their sizeof(Key) bytes with HASH_FUNCTION and
+ * compare them with a memcmp of constant length. Because the default hash
+ * of word keys is the HASH_WORD one, head() can still be handed to the
+ * _WORD/_FASTINT macros (and the other default to the plain ones) from C
+ * code. Keys must be trivially copyable, as uthash compares their bytes.
+ *
+ * The table allocates items with new and deletes them on erase, clear and
+ * destruction. It assumes uthash_fatal on out-of-memory (the default), not
+ * HASH_NONFATAL_OOM. */
+
+#ifndef UTHASH_HPP
+#define UTHASH_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "uthash.h"
+
+namespace ut {
+
+namespace detail {
+
+template <class Key>
+struct is_word_key {
+  static const bool value =
+    (std::is_integral<Key>::value || std::is_enum<Key>::value ||
+     std::is_pointer<Key>::value) && (sizeof(Key) == 4 || sizeof(Key) == 8);
+};
+
+template <std::size_t N> struct word_of;
+template <> struct word_of<4> { typedef uint32_t type; };
+template <> struct word_of<8> { typedef uint64_t type; };
+
+} /* namespace detail */
+
+/* the default hash: one multiply for word keys, HASH_FUNCTION otherwise */
+template <class Key, class Enable = void>
+struct hash {
+  unsigned operator()(const Key &k) const {
+    unsigned hashv;
+    HASH_FUNCTION(&k, (unsigned)sizeof(Key), hashv);
+    return hashv;
+  }
+};
+
+template <class Key>
+struct hash<Key, typename std::enable_if<detail::is_word_key<Key>::value>::type> {
+  unsigned operator()(const Key &k) const {
+    typename detail::word_of<sizeof(Key)>::type w;
+    std::memcpy(&w, &k, sizeof(Key));
+    return (unsigned)(((uint64_t)w * HASH_WORD_PHI) >> 32);
+  }
+};
+
+/* the default comparator: == for word-like keys, a memcmp otherwise */
+template <class Key, class Enable = void>
+struct key_equal {
+  bool operator()(const Key &a, const Key &b) const {
+    return std::memcmp(&a, &b, sizeof(Key)) == 0;
+  }
+};
+
+template <class Key>
+struct key_equal<Key, typename std::enable_if<std::is_integral<Key>::value ||
+                                              std::is_enum<Key>::value ||
+                                              std::is_pointer<Key>::value>::type> {
+  bool operator()(const Key &a, const Key &b) const { return a == b; }
+};
+
+template <class T, class Key, Key T::*KeyField,
+          class Hash = ut::hash<Key>, class Eq = ut::key_equal<Key> >
+class hash_table {
+  static_assert(std::is_trivially_copyable<Key>::value,
+                "uthash keys are compared as bytes: Key must be trivially copyable");
+
+  /* the keymatch argument of HASH_FIND_BYHASHVALUE_EQ; keys all have the
+   * same length, so only the key bytes are compared */
+  struct matcher {
+    const Eq &eq;
+    bool operator()(const void *a, unsigned, const void *b, unsigned) const {
+      return eq(*static_cast<const Key*>(a), *static_cast<const Key*>(b));
+    }
+  };
+
+public:
+  typedef T value_type;
+  typedef Key key_type;
+  typedef std::size_t size_type;
+
+  class iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T *pointer;
+    typedef T &reference;
+
+    iterator() : cur_(NULL) {}
+    explicit iterator(T *cur) : cur_(cur) {}
+    T &operator*() const { return *cur_; }
+    T *operator->() const { return cur_; }
+    iterator &operator++() { cur_ = static_cast<T*>(cur_->hh.next); return *this; }
+    iterator operator++(int) { iterator i(*this); ++*this; return i; }
+    bool operator==(const iterator &o) const { return cur_ == o.cur_; }
+    bool operator!=(const iterator &o) const { return cur_ != o.cur_; }
+  private:
+    T *cur_;
+  };
+
+  hash_table() : head_(NULL) {}
+  explicit hash_table(const Hash &h, const Eq &eq = Eq())
+    : head_(NULL), hash_(h), eq_(eq) {}
+  hash_table(const hash_table &) = delete;
+  hash_table &operator=(const hash_table &) = delete;
+  hash_table(hash_table &&o) : head_(o.head_), hash_(o.hash_), eq_(o.eq_) {
+    o.head_ = NULL;
+  }
+  hash_table &operator=(hash_table &&o) {
+    if (this != &o) {
+      clear();
+      head_ = o.head_;
+      hash_ = o.hash_;
+      eq_ = o.eq_;
+      o.head_ = NULL;
+    }
+    return *this;
+  }
+  ~hash_table() { clear(); }
+
+  size_type size() const { return HASH_COUNT(head_); }
+  bool empty() const { return head_ == NULL; }
+  iterator begin() const { return iterator(head_); }
+  iterator end() const { return iterator(); }
+
+  /* the first item, i.e. the head pointer the C macros work on */
+  T *head() const { return head_; }
+
+  T *find(const Key &k) const {
+    return find_hashed(k, hash_(k));
+  }
+
+  bool contains(const Key &k) const { return find(k) != NULL; }
+
+  /* insert and emplace add a new item unless its key is already present;
+   * the pair holds the item with that key and whether it was added */
+  std::pair<T*, bool> insert(const T &v) { return add(new T(v)); }
+  std::pair<T*, bool> insert(T &&v) { return add(new T(std::move(v))); }
+
+  template <class... Args>
+  std::pair<T*, bool> emplace(Args&&... args) {
+    return add(new T(std::forward<Args>(args)...));
+  }
+
+  /* erase(key) returns the number of items deleted, 0 or 1 */
+  size_type erase(const Key &k) {
+    T *it = find(k);
+    if (it == NULL) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+  void erase(T *it) {
+    HASH_DELETE(hh, head_, it);
+    delete it;
+  }
+
+  void clear() {
+    T *it, *tmp;
+    HASH_ITER(hh, head_, it, tmp) {
+      HASH_DELETE(hh, head_, it);
+      delete it;
+    }
+  }
+
+  /* HASH_RESERVE: needs at least one item in the table */
+  void reserve(unsigned num_bkts) { HASH_RESERVE(hh, head_, num_bkts); }
+
+private:
+  T *find_hashed(const Key &k, unsigned hashv) const {
+    T *out;
+    matcher m = { eq_ };
+    HASH_FIND_BYHASHVALUE_EQ(hh, head_, &k, (unsigned)sizeof(Key), hashv, out, m);
+    (void)m;
+    return out;
+  }
+
+  std::pair<T*, bool> add(T *item) {
+    const Key &k = item->*KeyField;
+    unsigned hashv = hash_(k);
+    T *found = find_hashed(k, hashv);
+    if (found != NULL) {
+      delete item;
+      return std::pair<T*, bool>(found, false);
+    }
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, head_, &(item->*KeyField),
+                                (unsigned)sizeof(Key), hashv, item);
+    return std::pair<T*, bool>(item, true);
+  }
+
+  T *head_;
+  Hash hash_;
+  Eq eq_;
+};
+
+} /* namespace ut */
+
+#endif /* UTHASH_HPP */
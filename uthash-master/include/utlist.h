@@ -27,13 +27,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define UTLIST_VERSION 2.3.0
 
 #include <assert.h>
+#include <stddef.h>  /* size_t */
 
 /*
  * This file contains macros to manipulate singly and doubly-linked lists.
  *
  * 1. LL_ macros:  singly-linked lists.
- * 2. DL_ macros:  doubly-linked lists.
- * 3. CDL_ macros: circular doubly-linked lists.
+ * 2. LLT_ macros: singly-linked lists kept through a head+tail descriptor.
+ * 3. DL_ macros:  doubly-linked lists.
+ * 4. CDL_ macros: circular doubly-linked lists.
+ * 5. UL_ macros:  unrolled lists, values kept in arrays of linked nodes.
  *
  * To use singly-linked lists, your structure must have a "next" pointer.
  * To use doubly-linked lists, your structure must "prev" and "next" pointers.
@@ -56,6 +59,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  * For doubly-linked lists, the append and delete macros are O(1)
  * For singly-linked lists, append and delete are O(n) but prepend is O(1)
+ * For LLT_ lists, append, prepend and delete-after are O(1)
  * The sort macro is O(n log(n)) for all types of single/double/circular lists.
  */
 
@@ -310,6 +314,160 @@ do {
   }                                                                                            \
 } while (0)
 
+/******************************************************************************
+ * Natural mergesort: the list is cut into the runs it already has (ascending *
+ * runs as they are, strictly descending ones reversed) and adjacent runs are *
+ * merged, smaller into larger, on a stack of at most 64 runs. A presorted    *
+ * list takes n-1 comparisons; two runs in order are concatenated after one.  *
+ * Stable, O(n log n) in the worst case. DL and CDL lists are sorted through  *
+ * their next pointers, then prev (and the circle) are restored in one walk.  *
+ *****************************************************************************/
+#define UTLIST_NS_NEXT(dst,elt,list,next)                                                      \
+  UTLIST_SV(elt,list); (dst) = UTLIST_NEXT(elt,list,next); UTLIST_RS(list)
+#define UTLIST_NS_LINK(elt,to,list,next)                                                       \
+  UTLIST_SV(elt,list); UTLIST_NEXTASGN(elt,list,to,next); UTLIST_RS(list)
+
+/* merge run a..atail with the run b..btail that follows it into h..t */
+#define UTLIST_NS_MERGE(a,atail,b,btail,h,t,list,cmp,next)                                    \
+do {                                                                                           \
+  if (cmp((atail),(b)) <= 0) {                                                                 \
+    UTLIST_NS_LINK(atail,b,list,next);                                                         \
+    (h) = (a); (t) = (btail);                                                                  \
+  } else {                                                                                     \
+    _ls_p = (a); _ls_q = (b); _ls_e = NULL;                                                    \
+    _ls_side = (cmp(_ls_p,_ls_q) <= 0);                                                        \
+    for (;;) {                                                                                 \
+      if (_ls_side) {                                                                          \
+        if (_ls_e) { UTLIST_NS_LINK(_ls_e,_ls_p,list,next); } else { (h) = _ls_p; }            \
+        do {                                                                                   \
+          _ls_e = _ls_p; UTLIST_NS_NEXT(_ls_p,_ls_e,list,next);                                \
+        } while (_ls_p && cmp(_ls_p,_ls_q) <= 0);                                              \
+        if (!_ls_p) { UTLIST_NS_LINK(_ls_e,_ls_q,list,next); (t) = (btail); break; }           \
+      } else {                                                                                 \
+        if (_ls_e) { UTLIST_NS_LINK(_ls_e,_ls_q,list,next); } else { (h) = _ls_q; }            \
+        do {                                                                                   \
+          _ls_e = _ls_q; UTLIST_NS_NEXT(_ls_q,_ls_e,list,next);                                \
+        } while (_ls_q && cmp(_ls_p,_ls_q) > 0);                                               \
+        if (!_ls_q) { UTLIST_NS_LINK(_ls_e,_ls_p,list,next); (t) = (atail); break; }           \
+      }                                                                                        \
+      _ls_side = !_ls_side;                                                                    \
+    }                                                                                          \
+  }                                                                                            \
+} while (0)
+
+/* sort the NULL-terminated list through next, leaving its last element in _ls_t */
+#define UTLIST_NS_SORT(list,cmp,next)                                                          \
+do {                                                                                           \
+  UTLIST_CASTASGN(_ls_nx,list);                                                                \
+  _ls_top = 0;                                                                                 \
+  while (_ls_nx) {                                                                             \
+    _ls_h = _ls_t = _ls_nx;                                                                    \
+    _ls_len = 1;                                                                               \
+    UTLIST_NS_NEXT(_ls_nx,_ls_t,list,next);                                                    \
+    if (_ls_nx && cmp(_ls_t,_ls_nx) > 0) {                                                     \
+      do {                                                                                     \
+        _ls_e = _ls_nx; UTLIST_NS_NEXT(_ls_nx,_ls_e,list,next);                                \
+        UTLIST_NS_LINK(_ls_e,_ls_h,list,next);                                                 \
+        _ls_h = _ls_e; _ls_len++;                                                              \
+      } while (_ls_nx && cmp(_ls_e,_ls_nx) > 0);                                               \
+    } else if (_ls_nx) {                                                                       \
+      do {                                                                                     \
+        _ls_t = _ls_nx; UTLIST_NS_NEXT(_ls_nx,_ls_t,list,next); _ls_len++;                     \
+      } while (_ls_nx && cmp(_ls_t,_ls_nx) <= 0);                                              \
+    }                                                                                          \
+    UTLIST_NS_LINK(_ls_t,NULL,list,next);                                                      \
+    for (;;) {                                                                                 \
+      for (_ls_rank = 0, _ls_n = _ls_len; _ls_n > 1; _ls_n >>= 1) { _ls_rank++; }              \
+      if (_ls_top == 0 || _ls_ranks[_ls_top-1] > _ls_rank) { break; }                          \
+      _ls_top--;                                                                               \
+      UTLIST_NS_MERGE(_ls_heads[_ls_top],_ls_tails[_ls_top],_ls_h,_ls_t,_ls_h,_ls_t,          \
+                      list,cmp,next);                                                          \
+      _ls_len += _ls_lens[_ls_top];                                                            \
+    }                                                                                          \
+    _ls_heads[_ls_top] = _ls_h; _ls_tails[_ls_top] = _ls_t;                                    \
+    _ls_lens[_ls_top] = _ls_len; _ls_ranks[_ls_top] = _ls_rank;                                \
+    _ls_top++;                                                                                 \
+  }                                                                                            \
+  _ls_top--;                                                                                   \
+  _ls_h = _ls_heads[_ls_top]; _ls_t = _ls_tails[_ls_top];                                      \
+  while (_ls_top > 0) {                                                                        \
+    _ls_top--;                                                                                 \
+    UTLIST_NS_MERGE(_ls_heads[_ls_top],_ls_tails[_ls_top],_ls_h,_ls_t,_ls_h,_ls_t,            \
+                    list,cmp,next);                                                            \
+  }                                                                                            \
+  UTLIST_CASTASGN(list,_ls_h);                                                                 \
+} while (0)
+
+#define UTLIST_NS_DECLS(list)                                                                  \
+  LDECLTYPE(list) _ls_heads[64];                                                               \
+  LDECLTYPE(list) _ls_tails[64];                                                               \
+  size_t _ls_lens[64];                                                                         \
+  unsigned char _ls_ranks[64];                                                                 \
+  LDECLTYPE(list) _ls_p;                                                                       \
+  LDECLTYPE(list) _ls_q;                                                                       \
+  LDECLTYPE(list) _ls_e;                                                                       \
+  LDECLTYPE(list) _ls_h;                                                                       \
+  LDECLTYPE(list) _ls_t;                                                                       \
+  LDECLTYPE(list) _ls_nx;                                                                      \
+  size_t _ls_len, _ls_n;                                                                       \
+  unsigned char _ls_rank;                                                                      \
+  int _ls_top, _ls_side
+
+#define LL_SORT_NATURAL(list, cmp)                                                             \
+    LL_SORT_NATURAL2(list, cmp, next)
+
+#define LL_SORT_NATURAL2(list, cmp, next)                                                      \
+do {                                                                                           \
+  UTLIST_NS_DECLS(list);                                                                       \
+  IF_NO_DECLTYPE(LDECLTYPE(list) _tmp;)                                                        \
+  if (list) {                                                                                  \
+    UTLIST_NS_SORT(list,cmp,next);                                                             \
+  }                                                                                            \
+} while (0)
+
+#define DL_SORT_NATURAL(list, cmp)                                                             \
+    DL_SORT_NATURAL2(list, cmp, prev, next)
+
+#define DL_SORT_NATURAL2(list, cmp, prev, next)                                                \
+do {                                                                                           \
+  UTLIST_NS_DECLS(list);                                                                       \
+  IF_NO_DECLTYPE(LDECLTYPE(list) _tmp;)                                                        \
+  if (list) {                                                                                  \
+    UTLIST_NS_SORT(list,cmp,next);                                                             \
+    _ls_p = NULL;                                                                              \
+    UTLIST_CASTASGN(_ls_e,list);                                                               \
+    while (_ls_e) {                                                                            \
+      UTLIST_SV(_ls_e,list); UTLIST_PREVASGN(_ls_e,list,_ls_p,prev);                           \
+      _ls_q = UTLIST_NEXT(_ls_e,list,next); UTLIST_RS(list);                                   \
+      _ls_p = _ls_e; _ls_e = _ls_q;                                                            \
+    }                                                                                          \
+    UTLIST_CASTASGN((list)->prev,_ls_t);                                                       \
+  }                                                                                            \
+} while (0)
+
+#define CDL_SORT_NATURAL(list, cmp)                                                            \
+    CDL_SORT_NATURAL2(list, cmp, prev, next)
+
+#define CDL_SORT_NATURAL2(list, cmp, prev, next)                                               \
+do {                                                                                           \
+  UTLIST_NS_DECLS(list);                                                                       \
+  LDECLTYPE(list) _tmp;                                                                        \
+  if (list) {                                                                                  \
+    UTLIST_CASTASGN(_ls_t,(list)->prev);                                                       \
+    UTLIST_NS_LINK(_ls_t,NULL,list,next);                                                      \
+    UTLIST_NS_SORT(list,cmp,next);                                                             \
+    _ls_p = _ls_t;                                                                             \
+    UTLIST_CASTASGN(_ls_e,list);                                                               \
+    while (_ls_e) {                                                                            \
+      UTLIST_SV(_ls_e,list); UTLIST_PREVASGN(_ls_e,list,_ls_p,prev);                           \
+      _ls_q = UTLIST_NEXT(_ls_e,list,next); UTLIST_RS(list);                                   \
+      _ls_p = _ls_e; _ls_e = _ls_q;                                                            \
+    }                                                                                          \
+    UTLIST_CASTASGN(_tmp,list);                                                                \
+    UTLIST_NS_LINK(_ls_t,_tmp,list,next);                                                      \
+  }                                                                                            \
+} while (0)
+
 /******************************************************************************
  * singly linked list macros (non-circular)                                   *
  *****************************************************************************/
@@ -617,6 +775,174 @@ do {
 
 #endif /* NO_DECLTYPE */
 
+/******************************************************************************
+ * singly linked list macros with a tail pointer                              *
+ * The list is a descriptor holding its head and tail (LLT_DECLARE), so       *
+ * append, prepend, concatenation and deleting the element after a given one  *
+ * are O(1): queues of singly-linked items stay linear. LLT_DELETE of an      *
+ * arbitrary element still walks to its predecessor.                          *
+ *****************************************************************************/
+/* declares the descriptor type name for lists of type, e.g. struct item */
+#define LLT_DECLARE(name,type)                                                                 \
+typedef struct name {                                                                          \
+  type *head, *tail, *tmp;                                                                     \
+} name
+
+#define LLT_INIT(l)                                                                            \
+do {                                                                                           \
+  (l).head = (l).tail = (l).tmp = NULL;                                                        \
+} while (0)
+
+#define LLT_EMPTY(l) ((l).head == NULL)
+
+#define LLT_PREPEND(l,add)                                                                     \
+    LLT_PREPEND2(l,add,next)
+
+#define LLT_PREPEND2(l,add,next)                                                               \
+do {                                                                                           \
+  (add)->next = (l).head;                                                                      \
+  (l).head = (add);                                                                            \
+  if ((l).tail == NULL) {                                                                      \
+    (l).tail = (add);                                                                          \
+  }                                                                                            \
+} while (0)
+
+#define LLT_APPEND(l,add)                                                                      \
+    LLT_APPEND2(l,add,next)
+
+#define LLT_APPEND2(l,add,next)                                                                \
+do {                                                                                           \
+  (add)->next = NULL;                                                                          \
+  if ((l).tail) {                                                                              \
+    (l).tail->next = (add);                                                                    \
+  } else {                                                                                     \
+    (l).head = (add);                                                                          \
+  }                                                                                            \
+  (l).tail = (add);                                                                            \
+} while (0)
+
+/* moves the elements of l2 to the end of l1, leaving l2 empty */
+#define LLT_CONCAT(l1,l2)                                                                      \
+    LLT_CONCAT2(l1,l2,next)
+
+#define LLT_CONCAT2(l1,l2,next)                                                                \
+do {                                                                                           \
+  if ((l2).head) {                                                                             \
+    if ((l1).tail) {                                                                           \
+      (l1).tail->next = (l2).head;                                                             \
+    } else {                                                                                   \
+      (l1).head = (l2).head;                                                                   \
+    }                                                                                          \
+    (l1).tail = (l2).tail;                                                                     \
+    LLT_INIT(l2);                                                                              \
+  }                                                                                            \
+} while (0)
+
+/* inserts add after el, or at the head if el is NULL */
+#define LLT_APPEND_ELEM(l,el,add)                                                              \
+    LLT_APPEND_ELEM2(l,el,add,next)
+
+#define LLT_APPEND_ELEM2(l,el,add,next)                                                        \
+do {                                                                                           \
+  if (el) {                                                                                    \
+    (add)->next = (el)->next;                                                                  \
+    (el)->next = (add);                                                                        \
+    if ((l).tail == (el)) {                                                                    \
+      (l).tail = (add);                                                                        \
+    }                                                                                          \
+  } else {                                                                                     \
+    LLT_PREPEND2(l,add,next);                                                                  \
+  }                                                                                            \
+} while (0)
+
+/* unlinks the head of the list into del, which is NULL if the list is empty */
+#define LLT_POP_FRONT(l,del)                                                                   \
+    LLT_POP_FRONT2(l,del,next)
+
+#define LLT_POP_FRONT2(l,del,next)                                                             \
+do {                                                                                           \
+  (del) = (l).head;                                                                            \
+  if (del) {                                                                                   \
+    (l).head = (del)->next;                                                                    \
+    if ((l).head == NULL) {                                                                    \
+      (l).tail = NULL;                                                                         \
+    }                                                                                          \
+  }                                                                                            \
+} while (0)
+
+/* unlinks the element after el (the head if el is NULL) into del, which is
+   NULL if there is none */
+#define LLT_DELETE_AFTER(l,el,del)                                                             \
+    LLT_DELETE_AFTER2(l,el,del,next)
+
+#define LLT_DELETE_AFTER2(l,el,del,next)                                                       \
+do {                                                                                           \
+  if (el) {                                                                                    \
+    (del) = (el)->next;                                                                        \
+    if (del) {                                                                                 \
+      (el)->next = (del)->next;                                                                \
+      if ((l).tail == (del)) {                                                                 \
+        (l).tail = (el);                                                                       \
+      }                                                                                        \
+    }                                                                                          \
+  } else {                                                                                     \
+    LLT_POP_FRONT2(l,del,next);                                                                \
+  }                                                                                            \
+} while (0)
+
+#define LLT_DELETE(l,del)                                                                      \
+    LLT_DELETE2(l,del,next)
+
+#define LLT_DELETE2(l,del,next)                                                                \
+do {                                                                                           \
+  if ((l).head == (del)) {                                                                     \
+    (l).head = (del)->next;                                                                    \
+    if ((l).tail == (del)) {                                                                   \
+      (l).tail = NULL;                                                                         \
+    }                                                                                          \
+  } else {                                                                                     \
+    (l).tmp = (l).head;                                                                        \
+    while ((l).tmp && ((l).tmp->next != (del))) {                                              \
+      (l).tmp = (l).tmp->next;                                                                 \
+    }                                                                                          \
+    if ((l).tmp) {                                                                             \
+      (l).tmp->next = (del)->next;                                                             \
+      if ((l).tail == (del)) {                                                                 \
+        (l).tail = (l).tmp;                                                                    \
+      }                                                                                        \
+    }                                                                                          \
+  }                                                                                            \
+} while (0)
+
+/* sorts like LL_SORT, then walks to the new tail */
+#define LLT_SORT(l,cmp)                                                                        \
+    LLT_SORT2(l,cmp,next)
+
+#define LLT_SORT2(l,cmp,next)                                                                  \
+do {                                                                                           \
+  LL_SORT2((l).head, cmp, next);                                                               \
+  for ((l).tail = (l).head; (l).tail && (l).tail->next; (l).tail = (l).tail->next) { }         \
+} while (0)
+
+#define LLT_COUNT(l,el,counter)                                                                \
+    LL_COUNT2((l).head,el,counter,next)
+
+#define LLT_COUNT2(l,el,counter,next)                                                          \
+    LL_COUNT2((l).head,el,counter,next)
+
+#define LLT_FOREACH(l,el)                                                                      \
+    LL_FOREACH2((l).head,el,next)
+
+#define LLT_FOREACH2(l,el,next)                                                                \
+    LL_FOREACH2((l).head,el,next)
+
+/* this version is safe for deleting the elements during iteration */
+#define LLT_FOREACH_SAFE(l,el,tmp)                                                             \
+    LL_FOREACH_SAFE2((l).head,el,tmp,next)
+
+#define LLT_FOREACH_SAFE2(l,el,tmp,next)                                                       \
+    LL_FOREACH_SAFE2((l).head,el,tmp,next)
+
 /******************************************************************************
  * doubly linked list macros (non-circular)                                   *
  *****************************************************************************/
@@ -1073,4 +1399,184 @@ do {
 } while (0)
 #endif /* NO_DECLTYPE */
 
+
+/******************************************************************************
+ * unrolled list macros                                                       *
+ * Values are stored in cache-line-sized nodes (UL_NODE_BYTES, including the  *
+ * node's links and count), so walking the list reads whole lines of values.  *
+ * A full node is split in two to insert; a node under half full is merged    *
+ * with the next one when that fits, and an empty node is freed.              *
+ *****************************************************************************/
+#include <stdlib.h>  /* malloc, free, exit */
+#include <string.h>  /* memcpy, memmove */
+
+#ifndef UL_NODE_BYTES
+#define UL_NODE_BYTES 64
+#endif
+#ifndef utlist_malloc
+#define utlist_malloc(sz) malloc(sz)
+#endif
+#ifndef utlist_free
+#define utlist_free(ptr,sz) free(ptr)
+#endif
+#ifndef utlist_oom
+#define utlist_oom() exit(-1)
+#endif
+
+#define UL_NODE_CAP(type)                                                                      \
+  ((UL_NODE_BYTES - 2 * sizeof(void*) - sizeof(unsigned)) / sizeof(type) > 0 ?                 \
+   (UL_NODE_BYTES - 2 * sizeof(void*) - sizeof(unsigned)) / sizeof(type) : 1)
+
+/* declares struct name_node and the list type name, holding values of type */
+#define UL_DECLARE(name,type)                                                                  \
+struct name##_node {                                                                           \
+  struct name##_node *next, *prev;                                                             \
+  unsigned n;                                                                                  \
+  type elts[UL_NODE_CAP(type)];                                                                \
+};                                                                                             \
+typedef struct name {                                                                          \
+  struct name##_node *head, *tail, *tmp;                                                       \
+  size_t count;                                                                                \
+} name
+
+#define UL_CAP(l) ((unsigned)(sizeof((l).head->elts) / sizeof((l).head->elts[0])))
+#define UL_COUNT(l) ((l).count)
+#define UL_EMPTY(l) ((l).count == 0)
+
+#define UL_INIT(l)                                                                             \
+do {                                                                                           \
+  (l).head = (l).tail = (l).tmp = NULL;                                                        \
+  (l).count = 0;                                                                               \
+} while (0)
+
+#define UL_FREE(l)                                                                             \
+do {                                                                                           \
+  while ((l).head) {                                                                           \
+    (l).tmp = (l).head;                                                                        \
+    (l).head = (l).head->next;                                                                 \
+    utlist_free((l).tmp, sizeof(*(l).tmp));                                                    \
+  }                                                                                            \
+  UL_INIT(l);                                                                                  \
+} while (0)
+
+/* a new empty node in (l).tmp */
+#define UL_NEW_NODE(l)                                                                         \
+do {                                                                                           \
+  void *_ul_v = utlist_malloc(sizeof(*(l).head));                                              \
+  if (_ul_v == NULL) { utlist_oom(); }                                                         \
+  memcpy(&(l).tmp, &_ul_v, sizeof(_ul_v));                                                     \
+  (l).tmp->next = (l).tmp->prev = NULL;                                                        \
+  (l).tmp->n = 0;                                                                              \
+} while (0)
+
+#define UL_APPEND(l,val)                                                                       \
+do {                                                                                           \
+  if (!(l).tail || (l).tail->n == UL_CAP(l)) {                                                 \
+    UL_NEW_NODE(l);                                                                            \
+    (l).tmp->prev = (l).tail;                                                                  \
+    if ((l).tail) { (l).tail->next = (l).tmp; } else { (l).head = (l).tmp; }                   \
+    (l).tail = (l).tmp;                                                                        \
+  }                                                                                            \
+  (l).tail->elts[(l).tail->n++] = (val);                                                       \
+  (l).count++;                                                                                 \
+} while (0)
+
+#define UL_PREPEND(l,val)                                                                      \
+do {                                                                                           \
+  if (!(l).head || (l).head->n == UL_CAP(l)) {                                                 \
+    UL_NEW_NODE(l);                                                                            \
+    (l).tmp->next = (l).head;                                                                  \
+    if ((l).head) { (l).head->prev = (l).tmp; } else { (l).tail = (l).tmp; }                   \
+    (l).head = (l).tmp;                                                                        \
+  }                                                                                            \
+  memmove((l).head->elts + 1, (l).head->elts, (l).head->n * sizeof((l).head->elts[0]));        \
+  (l).head->elts[0] = (val);                                                                   \
+  (l).head->n++;                                                                               \
+  (l).count++;                                                                                 \
+} while (0)
+
+/* position (nd,p) on the first value, or both NULL */
+#define UL_FIRST(l,nd,p)                                                                       \
+  ((nd) = (l).head, (p) = (nd) ? (nd)->elts : NULL)
+
+/* advance (nd,p) to the next value, or both NULL */
+#define UL_NEXT(nd,p)                                                                          \
+  ((p) + 1 < (nd)->elts + (nd)->n ? (void)(p)++ :                                              \
+   (void)((p) = ((nd) = (nd)->next) ? (nd)->elts : NULL))
+
+#define UL_FOREACH(l,nd,p)                                                                     \
+  for (UL_FIRST(l,nd,p); (p) != NULL; UL_NEXT(nd,p))
+
+#define UL_SEARCH_SCALAR(l,nd,p,val)                                                           \
+do {                                                                                           \
+  UL_FOREACH(l,nd,p) {                                                                         \
+    if (*(p) == (val)) { break; }                                                              \
+  }                                                                                            \
+} while (0)
+
+#define UL_SEARCH(l,nd,p,like,cmp)                                                             \
+do {                                                                                           \
+  UL_FOREACH(l,nd,p) {                                                                         \
+    if (cmp((p),(like)) == 0) { break; }                                                       \
+  }                                                                                            \
+} while (0)
+
+/* insert val before the value at (nd,p), or at the end of node nd if p is one
+   past its last value; (nd,p) is left on the new value */
+#define UL_INSERT(l,nd,p,val)                                                                  \
+do {                                                                                           \
+  unsigned _ul_i = (unsigned)((p) - (nd)->elts), _ul_h;                                        \
+  if ((nd)->n == UL_CAP(l)) {                                                                  \
+    UL_NEW_NODE(l);                                                                            \
+    _ul_h = (nd)->n / 2;                                                                       \
+    (l).tmp->n = (nd)->n - _ul_h;                                                              \
+    memcpy((l).tmp->elts, (nd)->elts + _ul_h, (l).tmp->n * sizeof((nd)->elts[0]));             \
+    (nd)->n = _ul_h;                                                                           \
+    (l).tmp->prev = (nd);                                                                      \
+    (l).tmp->next = (nd)->next;                                                                \
+    if ((nd)->next) { (nd)->next->prev = (l).tmp; } else { (l).tail = (l).tmp; }               \
+    (nd)->next = (l).tmp;                                                                      \
+    if (_ul_i > _ul_h) { (nd) = (l).tmp; _ul_i -= _ul_h; }                                     \
+  }                                                                                            \
+  memmove((nd)->elts + _ul_i + 1, (nd)->elts + _ul_i,                                          \
+          ((nd)->n - _ul_i) * sizeof((nd)->elts[0]));                                          \
+  (nd)->elts[_ul_i] = (val);                                                                   \
+  (nd)->n++;                                                                                   \
+  (l).count++;                                                                                 \
+  (p) = (nd)->elts + _ul_i;                                                                    \
+} while (0)
+
+/* delete the value at (nd,p); (nd,p) is left on the value after it, or NULL */
+#define UL_DELETE(l,nd,p)                                                                      \
+do {                                                                                           \
+  unsigned _ul_i = (unsigned)((p) - (nd)->elts);                                               \
+  memmove((nd)->elts + _ul_i, (nd)->elts + _ul_i + 1,                                          \
+          ((nd)->n - _ul_i - 1) * sizeof((nd)->elts[0]));                                      \
+  (nd)->n--;                                                                                   \
+  (l).count--;                                                                                 \
+  if ((nd)->n == 0) {                                                                          \
+    (l).tmp = (nd);                                                                            \
+    if ((nd)->prev) { (nd)->prev->next = (nd)->next; } else { (l).head = (nd)->next; }         \
+    if ((nd)->next) { (nd)->next->prev = (nd)->prev; } else { (l).tail = (nd)->prev; }         \
+    (nd) = (nd)->next;                                                                         \
+    utlist_free((l).tmp, sizeof(*(l).tmp));                                                    \
+    (p) = (nd) ? (nd)->elts : NULL;                                                            \
+  } else {                                                                                     \
+    if ((nd)->next && (nd)->n < UL_CAP(l) / 2 && (nd)->n + (nd)->next->n <= UL_CAP(l)) {       \
+      (l).tmp = (nd)->next;                                                                    \
+      memcpy((nd)->elts + (nd)->n, (l).tmp->elts, (l).tmp->n * sizeof((nd)->elts[0]));         \
+      (nd)->n += (l).tmp->n;                                                                   \
+      (nd)->next = (l).tmp->next;                                                              \
+      if ((nd)->next) { (nd)->next->prev = (nd); } else { (l).tail = (nd); }                   \
+      utlist_free((l).tmp, sizeof(*(l).tmp));                                                  \
+    }                                                                                          \
+    if (_ul_i < (nd)->n) {                                                                     \
+      (p) = (nd)->elts + _ul_i;                                                                \
+    } else {                                                                                   \
+      (nd) = (nd)->next;                                                                       \
+      (p) = (nd) ? (nd)->elts : NULL;                                                          \
+    }                                                                                          \
+  }                                                                                            \
+} while (0)
+
 #endif /* UTLIST_H */
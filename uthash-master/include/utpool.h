@@ -0,0 +1,205 @@
+/*
+Copyright (c) 2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef UTPOOL_H
+#define UTPOOL_H
+
+#define UTPOOL_VERSION 2.3.0
+
+/*
+ * This file contains a pool allocator for uthash tables built with
+ * -DHASH_ALLOCATOR=1. A pool carves blocks of power-of-two sizes out of large
+ * chunks; a freed block goes on a free list for its size, where the next
+ * allocation of that size picks it up. The bucket arrays of a table are all
+ * powers of two, so the arrays a table drops as it grows are reused by the
+ * next tables to grow. UTPOOL_RELEASE gives every chunk back at once, which
+ * ends every table (and item) allocated from the pool without visiting any of
+ * them. A pool does no locking; tables that share it need a common lock.
+ *
+ * Chunks come from utpool_chunk_malloc, which might be redefined to get them
+ * from NUMA-local memory, for instance.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * #define uthash_table_allocator(head) UTPOOL_ALLOCATOR(&pool)
+ * #include "utpool.h"
+ *
+ * UT_pool pool;
+ *
+ * typedef struct item {
+ *      int id;
+ *      UT_hash_handle hh;
+ * } item;
+ *
+ * int main() {
+ *      item *items = NULL, *i;
+ *      UTPOOL_INIT(&pool);
+ *      i = UTPOOL_MALLOC(&pool, sizeof *i);
+ *      i->id = 42;
+ *      HASH_ADD_INT(items, id, i);
+ *      UTPOOL_RELEASE(&pool);  (the table and its items are gone)
+ *      items = NULL;
+ * }
+ * --------------------------------------------------
+ */
+
+#ifndef HASH_ALLOCATOR
+#define HASH_ALLOCATOR 1
+#endif
+#if !HASH_ALLOCATOR
+#error "utpool.h needs HASH_ALLOCATOR: include it before uthash.h"
+#endif
+
+#include <stdlib.h>   /* malloc, free */
+#include "uthash.h"
+
+#ifndef utpool_chunk_malloc
+#define utpool_chunk_malloc(sz) malloc(sz)
+#endif
+#ifndef utpool_chunk_free
+#define utpool_chunk_free(ptr,sz) free(ptr)
+#endif
+
+#ifndef UTPOOL_CHUNK_SIZE
+#define UTPOOL_CHUNK_SIZE 65536U   /* bytes per chunk, header included      */
+#endif
+#define UTPOOL_MIN_LOG2 4U         /* smallest block: 16 bytes              */
+#define UTPOOL_CLASSES 48U         /* block sizes up to 2^47 bytes          */
+
+#ifdef __GNUC__
+#define UTPOOL_UNUSED __attribute__((__unused__))
+#else
+#define UTPOOL_UNUSED
+#endif
+
+typedef struct UT_pool_chunk {
+   struct UT_pool_chunk *next;
+   size_t size;                      /* bytes, this header included     */
+} UT_pool_chunk;
+
+/* chunk headers are rounded up to keep blocks 16-byte aligned */
+#define UTPOOL_HEADER ((sizeof(UT_pool_chunk) + 15U) & ~(size_t)15U)
+
+typedef struct UT_pool {
+   UT_hash_allocator alloc;          /* what uthash_table_allocator returns */
+   void *free_blocks[UTPOOL_CLASSES];/* freed blocks, by log2 of size     */
+   UT_pool_chunk *chunks;
+   char *next_block;                 /* unused space in the newest chunk  */
+   size_t left;
+} UT_pool;
+
+UTPOOL_UNUSED static unsigned utpool_class(size_t sz)
+{
+   unsigned c = UTPOOL_MIN_LOG2;
+   while ((c < UTPOOL_CLASSES) && (((size_t)1 << c) < sz)) {
+      c++;
+   }
+   return c;
+}
+
+/* a chunk of hdr + sz bytes linked into the pool, or NULL */
+UTPOOL_UNUSED static char *utpool_chunk(UT_pool *pool, size_t sz)
+{
+   UT_pool_chunk *chunk = (UT_pool_chunk*)utpool_chunk_malloc(UTPOOL_HEADER + sz);
+   if (chunk == NULL) {
+      return NULL;
+   }
+   chunk->next = pool->chunks;
+   chunk->size = UTPOOL_HEADER + sz;
+   pool->chunks = chunk;
+   return (char*)chunk + UTPOOL_HEADER;
+}
+
+UTPOOL_UNUSED static void *utpool_malloc(void *ctx, size_t sz)
+{
+   UT_pool *pool = (UT_pool*)ctx;
+   unsigned c = utpool_class(sz);
+   size_t bsz;
+   void *b;
+
+   if (c >= UTPOOL_CLASSES) {
+      return NULL;
+   }
+   if (pool->free_blocks[c] != NULL) {
+      b = pool->free_blocks[c];
+      pool->free_blocks[c] = *(void**)b;
+      return b;
+   }
+   bsz = (size_t)1 << c;
+   if (bsz > pool->left) {
+      if (bsz > (UTPOOL_CHUNK_SIZE - UTPOOL_HEADER) / 4U) {
+         /* big blocks get a chunk of their own */
+         return utpool_chunk(pool, bsz);
+      }
+      /* the rest of the old chunk is abandoned */
+      pool->next_block = utpool_chunk(pool, UTPOOL_CHUNK_SIZE - UTPOOL_HEADER);
+      if (pool->next_block == NULL) {
+         pool->left = 0;
+         return NULL;
+      }
+      pool->left = UTPOOL_CHUNK_SIZE - UTPOOL_HEADER;
+   }
+   b = pool->next_block;
+   pool->next_block += bsz;
+   pool->left -= bsz;
+   return b;
+}
+
+UTPOOL_UNUSED static void utpool_free(void *ctx, void *ptr, size_t sz)
+{
+   UT_pool *pool = (UT_pool*)ctx;
+   unsigned c = utpool_class(sz);
+   if (ptr != NULL) {
+      *(void**)ptr = pool->free_blocks[c];
+      pool->free_blocks[c] = ptr;
+   }
+}
+
+#define UTPOOL_ALLOCATOR(pool) (&(pool)->alloc)
+
+#define UTPOOL_INIT(pool)                                                        \
+do {                                                                             \
+  memset(pool, 0, sizeof(UT_pool));                                              \
+  (pool)->alloc.malloc_fn = utpool_malloc;                                       \
+  (pool)->alloc.free_fn = utpool_free;                                           \
+  (pool)->alloc.ctx = (pool);                                                    \
+} while (0)
+
+/* frees every chunk; the pool can be used again afterwards */
+#define UTPOOL_RELEASE(pool)                                                     \
+do {                                                                             \
+  UT_pool_chunk *_up_chunk, *_up_next;                                           \
+  for (_up_chunk = (pool)->chunks; _up_chunk != NULL; _up_chunk = _up_next) {    \
+    _up_next = _up_chunk->next;                                                  \
+    utpool_chunk_free(_up_chunk, _up_chunk->size);                               \
+  }                                                                              \
+  memset((pool)->free_blocks, 0, sizeof((pool)->free_blocks));                   \
+  (pool)->chunks = NULL;                                                         \
+  (pool)->next_block = NULL;                                                     \
+  (pool)->left = 0;                                                              \
+} while (0)
+
+/* for the items themselves, so one UTPOOL_RELEASE frees them too */
+#define UTPOOL_MALLOC(pool,sz) utpool_malloc(pool, sz)
+#define UTPOOL_FREE(pool,ptr,sz) utpool_free(pool, ptr, sz)
+
+#endif /* UTPOOL_H */
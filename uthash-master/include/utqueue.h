@@ -0,0 +1,426 @@
+/*
+Copyright (c) 2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef UTQUEUE_H
+#define UTQUEUE_H
+
+#define UTQUEUE_VERSION 2.3.0
+
+/*
+ * Bounded lock-free queues of fixed-size elements, for passing work between
+ * threads. Unlike utringbuffer, a full queue refuses a push instead of
+ * overwriting its oldest element.
+ *
+ * UT_spsc has one producer thread and one consumer thread. Each side keeps
+ * its own index and a cached copy of the other side's, on separate cache
+ * lines, so it reads the other side's line only when the cached copy says
+ * the queue is full (or empty). Batch pushes and pops move a run of elements
+ * with one or two memcpy calls and publish them with one index update.
+ *
+ * A UT_spsc can also be placed in memory shared between processes: with
+ * utspsc_init_at, its slots follow it in the block of utspsc_size bytes it
+ * is given instead of being allocated, so it holds no pointer, and any
+ * process that maps the block, wherever, uses it as it is.
+ *
+ * UT_mpmc allows any number of producers and consumers. Each slot carries a
+ * sequence number that says whether it is ready to be written or read in the
+ * current lap, so a push or pop claims its slot with one compare-and-swap.
+ *
+ * The try functions return at once, with 1 (or the number of elements moved)
+ * on success and 0 if the queue was full or empty. The blocking functions
+ * spin, then yield the CPU, until they succeed. Elements are copied bitwise.
+ * Capacities are rounded up to a power of two. Needs the GCC/Clang __atomic
+ * builtins.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * UT_spsc q;
+ * utspsc_init(&q, 1024, sizeof(int));
+ * producer thread:  utspsc_push(&q, &i);
+ * consumer thread:  utspsc_pop(&q, &i);
+ * utspsc_done(&q);
+ * --------------------------------------------------
+ */
+
+#include <stddef.h>  /* size_t */
+#include <stdlib.h>  /* malloc, exit */
+#include <string.h>  /* memcpy */
+#include <sched.h>   /* sched_yield */
+
+#ifdef __GNUC__
+#define UTQUEUE_UNUSED __attribute__((__unused__))
+#else
+#define UTQUEUE_UNUSED
+#endif
+
+#ifndef utqueue_oom
+#define utqueue_oom() exit(-1)
+#endif
+
+#ifndef UTQUEUE_PAD
+#define UTQUEUE_PAD 128U                 /* keeps the two sides' indexes apart */
+#endif
+#ifndef UTQUEUE_SPINS
+#define UTQUEUE_SPINS 64U                /* busy waits before yielding        */
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTQUEUE_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define UTQUEUE_RELAX() __asm__ __volatile__("yield")
+#else
+#define UTQUEUE_RELAX() ((void)0)
+#endif
+
+/* how a blocking call waits after its spins-th failed attempt */
+#ifndef utqueue_wait
+#define utqueue_wait(spins) do {                                              \
+  if ((spins) < UTQUEUE_SPINS) {                                              \
+    UTQUEUE_RELAX();                                                          \
+  } else {                                                                    \
+    sched_yield();                                                            \
+  }                                                                           \
+} while (0)
+#endif
+
+#define UTQUEUE_LOAD(p, order) __atomic_load_n(p, order)
+#define UTQUEUE_STORE(p, v, order) __atomic_store_n(p, v, order)
+
+static size_t utqueue_pow2(size_t n) UTQUEUE_UNUSED;
+static size_t utqueue_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+/* single producer, single consumer */
+typedef struct {
+  union {
+    struct {
+      size_t head;        /* next slot to write; written by the producer */
+      size_t tail_cache;  /* the producer's last look at tail */
+    } p;
+    char pad[UTQUEUE_PAD];
+  } prod;
+  union {
+    struct {
+      size_t tail;        /* next slot to read; written by the consumer */
+      size_t head_cache;  /* the consumer's last look at head */
+    } c;
+    char pad[UTQUEUE_PAD];
+  } cons;
+  size_t mask;            /* capacity - 1 */
+  size_t sz;              /* element size */
+  char *d;                /* the slots; NULL if they follow the queue (utspsc_init_at) */
+} UT_spsc;
+
+#define _utspsc_d(q) ((q)->d ? (q)->d : (char*)((q) + 1))
+
+/* bytes a queue placed with utspsc_init_at takes, its slots included */
+#define utspsc_size(capacity, sz) (sizeof(UT_spsc) + utqueue_pow2(capacity) * (sz))
+
+static void utspsc_init(UT_spsc *q, size_t capacity, size_t sz) UTQUEUE_UNUSED;
+static void utspsc_init(UT_spsc *q, size_t capacity, size_t sz) {
+  memset(q, 0, sizeof(*q));
+  q->mask = utqueue_pow2(capacity) - 1;
+  q->sz = sz;
+  q->d = (char*)malloc((q->mask + 1) * sz);
+  if (q->d == NULL) {
+    utqueue_oom();
+  }
+}
+
+/* init a queue in the utspsc_size(capacity, sz) bytes at q, which may be
+ * shared memory: nothing is allocated, and utspsc_done needn't be called */
+static void utspsc_init_at(UT_spsc *q, size_t capacity, size_t sz) UTQUEUE_UNUSED;
+static void utspsc_init_at(UT_spsc *q, size_t capacity, size_t sz) {
+  memset(q, 0, sizeof(*q));
+  q->mask = utqueue_pow2(capacity) - 1;
+  q->sz = sz;
+}
+
+static void utspsc_done(UT_spsc *q) UTQUEUE_UNUSED;
+static void utspsc_done(UT_spsc *q) {
+  free(q->d);
+  q->d = NULL;
+}
+
+/* pushes up to n elements from elts; returns how many (producer only) */
+static size_t utspsc_trypush_n(UT_spsc *q, const void *elts, size_t n) UTQUEUE_UNUSED;
+static size_t utspsc_trypush_n(UT_spsc *q, const void *elts, size_t n) {
+  size_t head = q->prod.p.head, room, at, first;
+  char *d = _utspsc_d(q);
+  room = q->mask + 1 - (head - q->prod.p.tail_cache);
+  if (room < n) {
+    q->prod.p.tail_cache = UTQUEUE_LOAD(&q->cons.c.tail, __ATOMIC_ACQUIRE);
+    room = q->mask + 1 - (head - q->prod.p.tail_cache);
+  }
+  if (n > room) {
+    n = room;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  at = head & q->mask;
+  first = (n < q->mask + 1 - at) ? n : q->mask + 1 - at;
+  memcpy(d + at * q->sz, elts, first * q->sz);
+  if (n > first) {
+    memcpy(d, (const char*)elts + first * q->sz, (n - first) * q->sz);
+  }
+  UTQUEUE_STORE(&q->prod.p.head, head + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+/* pops up to n elements into out; returns how many (consumer only) */
+static size_t utspsc_trypop_n(UT_spsc *q, void *out, size_t n) UTQUEUE_UNUSED;
+static size_t utspsc_trypop_n(UT_spsc *q, void *out, size_t n) {
+  size_t tail = q->cons.c.tail, avail, at, first;
+  char *d = _utspsc_d(q);
+  avail = q->cons.c.head_cache - tail;
+  if (avail < n) {
+    q->cons.c.head_cache = UTQUEUE_LOAD(&q->prod.p.head, __ATOMIC_ACQUIRE);
+    avail = q->cons.c.head_cache - tail;
+  }
+  if (n > avail) {
+    n = avail;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  at = tail & q->mask;
+  first = (n < q->mask + 1 - at) ? n : q->mask + 1 - at;
+  memcpy(out, d + at * q->sz, first * q->sz);
+  if (n > first) {
+    memcpy((char*)out + first * q->sz, d, (n - first) * q->sz);
+  }
+  UTQUEUE_STORE(&q->cons.c.tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+/* zero-copy pops (consumer only): the next elements in place, *n of them
+ * in a row (up to the end of the slots), NULL if there are none; they stay
+ * the consumer's until utspsc_skip(q, k) hands k of them back */
+static void *utspsc_peek_n(UT_spsc *q, size_t *n) UTQUEUE_UNUSED;
+static void *utspsc_peek_n(UT_spsc *q, size_t *n) {
+  size_t tail = q->cons.c.tail, avail, at;
+  avail = q->cons.c.head_cache - tail;
+  if (avail == 0) {
+    q->cons.c.head_cache = UTQUEUE_LOAD(&q->prod.p.head, __ATOMIC_ACQUIRE);
+    avail = q->cons.c.head_cache - tail;
+  }
+  if (avail == 0) {
+    *n = 0;
+    return NULL;
+  }
+  at = tail & q->mask;
+  *n = (avail < q->mask + 1 - at) ? avail : q->mask + 1 - at;
+  return _utspsc_d(q) + at * q->sz;
+}
+
+static void utspsc_skip(UT_spsc *q, size_t n) UTQUEUE_UNUSED;
+static void utspsc_skip(UT_spsc *q, size_t n) {
+  UTQUEUE_STORE(&q->cons.c.tail, q->cons.c.tail + n, __ATOMIC_RELEASE);
+}
+
+#define utspsc_trypush(q, elt) ((int)utspsc_trypush_n(q, elt, 1))
+#define utspsc_trypop(q, out) ((int)utspsc_trypop_n(q, out, 1))
+
+/* blocking: all n elements are pushed, or popped, before these return */
+static void utspsc_push_n(UT_spsc *q, const void *elts, size_t n) UTQUEUE_UNUSED;
+static void utspsc_push_n(UT_spsc *q, const void *elts, size_t n) {
+  size_t done, spins = 0;
+  while (n > 0) {
+    done = utspsc_trypush_n(q, elts, n);
+    if (done == 0) {
+      utqueue_wait(spins);
+      spins++;
+      continue;
+    }
+    spins = 0;
+    elts = (const char*)elts + done * q->sz;
+    n -= done;
+  }
+}
+
+static void utspsc_pop_n(UT_spsc *q, void *out, size_t n) UTQUEUE_UNUSED;
+static void utspsc_pop_n(UT_spsc *q, void *out, size_t n) {
+  size_t done, spins = 0;
+  while (n > 0) {
+    done = utspsc_trypop_n(q, out, n);
+    if (done == 0) {
+      utqueue_wait(spins);
+      spins++;
+      continue;
+    }
+    spins = 0;
+    out = (char*)out + done * q->sz;
+    n -= done;
+  }
+}
+
+#define utspsc_push(q, elt) utspsc_push_n(q, elt, 1)
+#define utspsc_pop(q, out) utspsc_pop_n(q, out, 1)
+
+/* a snapshot; exact only when neither side is running */
+#define utspsc_len(q) \
+  (UTQUEUE_LOAD(&(q)->prod.p.head, __ATOMIC_ACQUIRE) - UTQUEUE_LOAD(&(q)->cons.c.tail, __ATOMIC_ACQUIRE))
+
+/* multiple producers, multiple consumers */
+typedef struct {
+  union {
+    size_t pos;           /* next slot to claim for a push */
+    char pad[UTQUEUE_PAD];
+  } enq;
+  union {
+    size_t pos;           /* next slot to claim for a pop */
+    char pad[UTQUEUE_PAD];
+  } deq;
+  size_t mask;            /* capacity - 1 */
+  size_t sz;              /* element size */
+  size_t stride;          /* a slot: its sequence number, then the element */
+  char *d;
+} UT_mpmc;
+
+#define _utmpmc_seq(q, pos) ((size_t*)(void*)((q)->d + ((pos) & (q)->mask) * (q)->stride))
+#define _utmpmc_elt(q, pos) ((q)->d + ((pos) & (q)->mask) * (q)->stride + sizeof(size_t))
+
+static void utmpmc_init(UT_mpmc *q, size_t capacity, size_t sz) UTQUEUE_UNUSED;
+static void utmpmc_init(UT_mpmc *q, size_t capacity, size_t sz) {
+  size_t i;
+  memset(q, 0, sizeof(*q));
+  q->mask = utqueue_pow2(capacity < 2 ? 2 : capacity) - 1;
+  q->sz = sz;
+  q->stride = (sizeof(size_t) + sz + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  q->d = (char*)malloc((q->mask + 1) * q->stride);
+  if (q->d == NULL) {
+    utqueue_oom();
+  }
+  for (i = 0; i <= q->mask; i++) {
+    *_utmpmc_seq(q, i) = i;
+  }
+}
+
+static void utmpmc_done(UT_mpmc *q) UTQUEUE_UNUSED;
+static void utmpmc_done(UT_mpmc *q) {
+  free(q->d);
+  q->d = NULL;
+}
+
+static int utmpmc_trypush(UT_mpmc *q, const void *elt) UTQUEUE_UNUSED;
+static int utmpmc_trypush(UT_mpmc *q, const void *elt) {
+  size_t pos = UTQUEUE_LOAD(&q->enq.pos, __ATOMIC_RELAXED), seq;
+  ptrdiff_t dif;
+  for (;;) {
+    seq = UTQUEUE_LOAD(_utmpmc_seq(q, pos), __ATOMIC_ACQUIRE);
+    dif = (ptrdiff_t)(seq - pos);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->enq.pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return 0;                   /* the slot still holds last lap's element */
+    } else {
+      pos = UTQUEUE_LOAD(&q->enq.pos, __ATOMIC_RELAXED);
+    }
+  }
+  memcpy(_utmpmc_elt(q, pos), elt, q->sz);
+  UTQUEUE_STORE(_utmpmc_seq(q, pos), pos + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static int utmpmc_trypop(UT_mpmc *q, void *out) UTQUEUE_UNUSED;
+static int utmpmc_trypop(UT_mpmc *q, void *out) {
+  size_t pos = UTQUEUE_LOAD(&q->deq.pos, __ATOMIC_RELAXED), seq;
+  ptrdiff_t dif;
+  for (;;) {
+    seq = UTQUEUE_LOAD(_utmpmc_seq(q, pos), __ATOMIC_ACQUIRE);
+    dif = (ptrdiff_t)(seq - (pos + 1));
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&q->deq.pos, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      return 0;                   /* nothing pushed into the slot yet */
+    } else {
+      pos = UTQUEUE_LOAD(&q->deq.pos, __ATOMIC_RELAXED);
+    }
+  }
+  memcpy(out, _utmpmc_elt(q, pos), q->sz);
+  UTQUEUE_STORE(_utmpmc_seq(q, pos), pos + q->mask + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* batches claim their slots one at a time, so other threads' elements may
+ * interleave with them; they return how many were moved */
+static size_t utmpmc_trypush_n(UT_mpmc *q, const void *elts, size_t n) UTQUEUE_UNUSED;
+static size_t utmpmc_trypush_n(UT_mpmc *q, const void *elts, size_t n) {
+  size_t i;
+  for (i = 0; (i < n) && utmpmc_trypush(q, (const char*)elts + i * q->sz); i++) {
+  }
+  return i;
+}
+
+static size_t utmpmc_trypop_n(UT_mpmc *q, void *out, size_t n) UTQUEUE_UNUSED;
+static size_t utmpmc_trypop_n(UT_mpmc *q, void *out, size_t n) {
+  size_t i;
+  for (i = 0; (i < n) && utmpmc_trypop(q, (char*)out + i * q->sz); i++) {
+  }
+  return i;
+}
+
+static void utmpmc_push(UT_mpmc *q, const void *elt) UTQUEUE_UNUSED;
+static void utmpmc_push(UT_mpmc *q, const void *elt) {
+  size_t spins;
+  for (spins = 0; !utmpmc_trypush(q, elt); spins++) {
+    utqueue_wait(spins);
+  }
+}
+
+static void utmpmc_pop(UT_mpmc *q, void *out) UTQUEUE_UNUSED;
+static void utmpmc_pop(UT_mpmc *q, void *out) {
+  size_t spins;
+  for (spins = 0; !utmpmc_trypop(q, out); spins++) {
+    utqueue_wait(spins);
+  }
+}
+
+static void utmpmc_push_n(UT_mpmc *q, const void *elts, size_t n) UTQUEUE_UNUSED;
+static void utmpmc_push_n(UT_mpmc *q, const void *elts, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    utmpmc_push(q, (const char*)elts + i * q->sz);
+  }
+}
+
+static void utmpmc_pop_n(UT_mpmc *q, void *out, size_t n) UTQUEUE_UNUSED;
+static void utmpmc_pop_n(UT_mpmc *q, void *out, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    utmpmc_pop(q, (char*)out + i * q->sz);
+  }
+}
+
+#endif /* UTQUEUE_H */
@@ -0,0 +1,507 @@
+/*
+Copyright (c) 2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef UTSNAP_H
+#define UTSNAP_H
+
+#define UTSNAP_VERSION 2.3.0
+
+/*
+ * This file contains macros to save a hash to a file and to load it back
+ * without adding its items one by one. A snapshot holds a header, the items
+ * in app order, and the bucket chains, with every pointer of the hash handles
+ * stored as an item index. UTSNAP_LOAD maps the file (privately, so the file
+ * is never written) and fixes up the pointers in one pass over the items and
+ * one over the buckets; no key is hashed and the bucket array is never
+ * expanded. The items are then used in place, in the mapping.
+ *
+ * The items must be of fixed layout: each is saved as sizeof(*head) bytes,
+ * and its key must lie within it (HASH_ADD, HASH_ADD_STR with a char[] key,
+ * but not HASH_ADD_KEYPTR to a key elsewhere). Any other pointers in the
+ * items are saved as they are, and are meaningless in another process. The
+ * loading program must be built with the same item layout, compile options
+ * and HASH_FUNCTION as the saving one; the header records the item and
+ * handle sizes and the hash value of a probe key, and a snapshot that
+ * doesn't match is refused. The byte order is the machine's own. A
+ * HASH_SEEDED table's seed is saved with its bucket chains, and the loaded
+ * table keeps it.
+ *
+ * Items of a loaded hash can be deleted from it, but not freed; other items
+ * can be added to it as usual. UTSNAP_UNMAP clears the hash and unmaps the
+ * items. Saving doesn't change the hash, but it does write to the handles
+ * while it runs, so nothing else may use the hash at the time.
+ *
+ * Without mmap (-DUTSNAP_NO_MMAP=1), the snapshot is read into memory from
+ * uthash_malloc instead.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * #include "utsnap.h"
+ *
+ * typedef struct item {
+ *      char name[16];
+ *      int id;
+ *      UT_hash_handle hh;
+ * } item;
+ *
+ * int main() {
+ *      item *items = NULL, *i;
+ *      UT_snap snap;
+ *      int rc;
+ *      ... HASH_ADD_STR(items, name, i) ...
+ *      UTSNAP_SAVE(hh, items, "items.snap", rc);
+ *      ...
+ *      UTSNAP_LOAD(hh, items, "items.snap", &snap, rc);
+ *      if (rc == 0) {
+ *          HASH_FIND_STR(items, "bob", i);
+ *          ...
+ *          UTSNAP_UNMAP(hh, items, &snap);
+ *      }
+ * }
+ * --------------------------------------------------
+ */
+
+#include <errno.h>    /* errno, EINVAL, ENOMEM */
+#include <stdio.h>    /* FILE, fopen, fwrite, fclose, rename, remove */
+#include "uthash.h"
+
+#ifndef UTSNAP_NO_MMAP
+#define UTSNAP_NO_MMAP 0
+#endif
+#if !UTSNAP_NO_MMAP
+#include <fcntl.h>    /* open */
+#include <sys/mman.h> /* mmap, munmap */
+#include <sys/stat.h> /* fstat */
+#include <unistd.h>   /* close */
+#endif
+
+#ifdef __GNUC__
+#define UTSNAP_UNUSED __attribute__((__unused__))
+#else
+#define UTSNAP_UNUSED
+#endif
+
+#define UTSNAP_MAGIC 0x75747370U     /* "utsp", in the machine's byte order  */
+#define UTSNAP_FORMAT 2U
+#define UTSNAP_PROBE "uthash snapshot probe"
+#define UTSNAP_ALIGN 128U            /* offset of the items in the file      */
+#ifndef UTSNAP_BUFSIZE
+#define UTSNAP_BUFSIZE 65536U        /* bytes of items written at a time     */
+#endif
+
+typedef struct UT_snap_header {
+   uint32_t magic, format;
+   uint32_t probe_hashv;             /* HASH_VALUE of UTSNAP_PROBE        */
+   uint32_t item_size, hho, handle_size;
+   uint32_t num_items, num_buckets, log2_num_buckets;
+   uint32_t ideal_chain_maxlen, nonideal_items;
+   uint32_t ineff_expands, noexpand, expansions;
+   uint32_t seeded, seed;            /* HASH_SEEDED, and the table's seed  */
+   uint64_t items_off, buckets_off, file_size;
+} UT_snap_header;
+
+/* a bucket in the file: its first item's index + 1 (0 if empty) */
+typedef struct UT_snap_bucket {
+   uint32_t head, count, expand_mult;
+} UT_snap_bucket;
+
+typedef struct UT_snap {
+   void *map;                        /* the whole file, header first       */
+   size_t len;
+} UT_snap;
+
+/* a handle pointer as it is in a snapshot, and back */
+#define UTSNAP_IDX(hhp) ((hhp) ? (uintptr_t)(hhp)->tbl + 1U : (uintptr_t)0)
+#define UTSNAP_HH(items,size,hho,idx)                                            \
+  ((idx) ? (UT_hash_handle*)(void*)((items) + ((idx) - 1U) * (size) + (hho)) : NULL)
+
+UTSNAP_UNUSED static unsigned utsnap_probe(void)
+{
+   unsigned hashv;
+   HASH_VALUE(UTSNAP_PROBE, sizeof(UTSNAP_PROBE) - 1U, hashv);
+   return hashv;
+}
+
+/* writes the hash whose table is tbl (NULL if empty) to path: 0, or -1 with
+ * errno set. The handles' tbl fields hold the items' indexes meanwhile. */
+UTSNAP_UNUSED static int utsnap_save(UT_hash_table *tbl, const void *head,
+                                     size_t item_size, const char *path)
+{
+   static const char zeros[UTSNAP_ALIGN] = { 0 };
+   UT_snap_header hdr;
+   UT_snap_bucket *sb;
+   UT_hash_handle *hh, *shh;
+   char *buf, *tmp;
+   FILE *file;
+   size_t bufsz, tmpsz, per;
+   uintptr_t i, n = 0;
+   ptrdiff_t keyoff;
+   int rc = 0, err;
+
+   uthash_bzero(&hdr, sizeof(hdr));
+   if (tbl != NULL) {
+      HASH_MIGRATE_ALL(tbl);
+      n = tbl->num_items;
+      hdr.hho = (uint32_t)tbl->hho;
+      hdr.num_buckets = tbl->num_buckets;
+      hdr.log2_num_buckets = tbl->log2_num_buckets;
+      hdr.ideal_chain_maxlen = tbl->ideal_chain_maxlen;
+      hdr.nonideal_items = tbl->nonideal_items;
+      hdr.ineff_expands = tbl->ineff_expands;
+      hdr.noexpand = tbl->noexpand;
+      hdr.expansions = tbl->expansions;
+#if HASH_SEEDED
+      hdr.seed = tbl->seed;
+#endif
+   }
+   hdr.magic = UTSNAP_MAGIC;
+   hdr.format = UTSNAP_FORMAT;
+   hdr.seeded = HASH_SEEDED;
+   hdr.probe_hashv = utsnap_probe();
+   hdr.item_size = (uint32_t)item_size;
+   hdr.handle_size = (uint32_t)sizeof(UT_hash_handle);
+   hdr.num_items = (uint32_t)n;
+   hdr.items_off = UTSNAP_ALIGN;
+   hdr.buckets_off = hdr.items_off + (((uint64_t)n * item_size + 7U) & ~(uint64_t)7U);
+   hdr.file_size = hdr.buckets_off + (uint64_t)hdr.num_buckets * sizeof(UT_snap_bucket);
+
+   /* written beside path and renamed over it, so a hash loaded from path
+    * keeps its (old) file, and a failed save leaves path as it was */
+   tmpsz = strlen(path) + sizeof(".tmp");
+   per = (UTSNAP_BUFSIZE > item_size) ? UTSNAP_BUFSIZE / item_size : 1U;
+   bufsz = (per * item_size > UTSNAP_BUFSIZE) ? per * item_size : UTSNAP_BUFSIZE;
+   tmp = (char*)uthash_malloc(tmpsz);
+   buf = (char*)uthash_malloc(bufsz);
+   if ((tmp == NULL) || (buf == NULL)) {
+      if (tmp != NULL) {
+         uthash_free(tmp, tmpsz);
+      }
+      if (buf != NULL) {
+         uthash_free(buf, bufsz);
+      }
+      errno = ENOMEM;
+      return -1;
+   }
+   strcpy(tmp, path);
+   strcat(tmp, ".tmp");
+   if ((file = fopen(tmp, "wb")) == NULL) {
+      uthash_free(tmp, tmpsz);
+      uthash_free(buf, bufsz);
+      return -1;
+   }
+
+   /* number the items in their tbl fields; check that each key is inside */
+   for (i = 0, hh = (tbl != NULL) ? HH_FROM_ELMT(tbl, head) : NULL; hh != NULL;
+        i++, hh = (hh->next != NULL) ? HH_FROM_ELMT(tbl, hh->next) : NULL) {
+      keyoff = (const char*)hh->key - (const char*)ELMT_FROM_HH(tbl, hh);
+      if ((keyoff < 0) || ((size_t)keyoff + hh->keylen > item_size)) {
+         rc = -1;
+      }
+      hh->tbl = (UT_hash_table*)i;
+   }
+   if (rc != 0) {
+      errno = EINVAL;
+   } else if ((fwrite(&hdr, sizeof(hdr), 1, file) != 1) ||
+              (fwrite(zeros, UTSNAP_ALIGN - sizeof(hdr), 1, file) != 1)) {
+      rc = -1;
+   }
+
+   /* the items, with the handle pointers as indexes + 1, per at a time */
+   for (i = 0, hh = (tbl != NULL) ? HH_FROM_ELMT(tbl, head) : NULL;
+        (rc == 0) && (hh != NULL);
+        hh = (hh->next != NULL) ? HH_FROM_ELMT(tbl, hh->next) : NULL) {
+      memcpy(buf + i * item_size, ELMT_FROM_HH(tbl, hh), item_size);
+      shh = (UT_hash_handle*)(void*)(buf + i * item_size + tbl->hho);
+      shh->tbl = NULL;
+      shh->prev = NULL;
+      shh->next = NULL;
+      shh->hh_prev = (UT_hash_handle*)UTSNAP_IDX(hh->hh_prev);
+      shh->hh_next = (UT_hash_handle*)UTSNAP_IDX(hh->hh_next);
+      shh->key = (const void*)((const char*)hh->key - (const char*)ELMT_FROM_HH(tbl, hh));
+      HASH_SKIP_INIT(shh);
+      if (((++i == per) || (hh->next == NULL)) &&
+          (fwrite(buf, item_size, (size_t)i, file) != (size_t)i)) {
+         rc = -1;
+      }
+      i = (i == per) ? 0U : i;
+   }
+   if ((rc == 0) && (hdr.buckets_off - hdr.items_off > (uint64_t)n * item_size) &&
+       (fwrite(zeros, (size_t)(hdr.buckets_off - hdr.items_off - n * item_size), 1,
+               file) != 1)) {
+      rc = -1;
+   }
+
+   /* the bucket chains */
+   sb = (UT_snap_bucket*)(void*)buf;
+   per = bufsz / sizeof(UT_snap_bucket);
+   for (i = 0; (rc == 0) && (i < hdr.num_buckets); i++) {
+      sb[i % per].head = (uint32_t)UTSNAP_IDX(tbl->buckets[i].hh_head);
+      sb[i % per].count = tbl->buckets[i].count;
+      sb[i % per].expand_mult = tbl->buckets[i].expand_mult;
+      if (((i % per == per - 1U) || (i + 1U == hdr.num_buckets)) &&
+          (fwrite(sb, sizeof(UT_snap_bucket), i % per + 1U, file) != i % per + 1U)) {
+         rc = -1;
+      }
+   }
+
+   for (hh = (tbl != NULL) ? HH_FROM_ELMT(tbl, head) : NULL; hh != NULL;
+        hh = (hh->next != NULL) ? HH_FROM_ELMT(tbl, hh->next) : NULL) {
+      hh->tbl = tbl;
+   }
+   if ((fclose(file) != 0) && (rc == 0)) {
+      rc = -1;
+   }
+   if ((rc == 0) && (rename(tmp, path) != 0)) {
+      rc = -1;
+   }
+   if (rc != 0) {
+      err = errno;
+      remove(tmp);
+      errno = err;
+   }
+   uthash_free(tmp, tmpsz);
+   uthash_free(buf, bufsz);
+   return rc;
+}
+
+UTSNAP_UNUSED static void utsnap_unmap(UT_snap *snap)
+{
+   if (snap->map != NULL) {
+#if UTSNAP_NO_MMAP
+      uthash_free(snap->map, snap->len);
+#else
+      munmap(snap->map, snap->len);
+#endif
+   }
+   snap->map = NULL;
+   snap->len = 0;
+}
+
+/* maps path into snap and checks its header against the item type: 0, or
+ * -1 with errno set (EINVAL for a snapshot that doesn't match) */
+UTSNAP_UNUSED static int utsnap_map(const char *path, size_t item_size,
+                                    ptrdiff_t hho, UT_snap *snap)
+{
+   const UT_snap_header *hdr;
+#if UTSNAP_NO_MMAP
+   FILE *file;
+   long len;
+#else
+   struct stat st;
+   int fd;
+#endif
+
+   snap->map = NULL;
+   snap->len = 0;
+#if UTSNAP_NO_MMAP
+   if ((file = fopen(path, "rb")) == NULL) {
+      return -1;
+   }
+   if ((fseek(file, 0, SEEK_END) != 0) || ((len = ftell(file)) < 0) ||
+       (fseek(file, 0, SEEK_SET) != 0)) {
+      fclose(file);
+      return -1;
+   }
+   snap->len = (size_t)len;
+   if ((snap->len < sizeof(UT_snap_header)) ||
+       ((snap->map = uthash_malloc(snap->len)) == NULL)) {
+      fclose(file);
+      errno = (snap->len < sizeof(UT_snap_header)) ? EINVAL : ENOMEM;
+      return -1;
+   }
+   if (fread(snap->map, snap->len, 1, file) != 1) {
+      fclose(file);
+      utsnap_unmap(snap);
+      errno = EINVAL;
+      return -1;
+   }
+   fclose(file);
+#else
+   if ((fd = open(path, O_RDONLY)) < 0) {
+      return -1;
+   }
+   if (fstat(fd, &st) != 0) {
+      close(fd);
+      return -1;
+   }
+   if ((size_t)st.st_size < sizeof(UT_snap_header)) {
+      close(fd);
+      errno = EINVAL;
+      return -1;
+   }
+   snap->len = (size_t)st.st_size;
+   snap->map = mmap(NULL, snap->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (snap->map == MAP_FAILED) {
+      snap->map = NULL;
+      return -1;
+   }
+#endif
+
+   hdr = (const UT_snap_header*)snap->map;
+   if ((hdr->magic != UTSNAP_MAGIC) || (hdr->format != UTSNAP_FORMAT) ||
+       (hdr->probe_hashv != utsnap_probe()) || (hdr->item_size != item_size) ||
+       (hdr->handle_size != sizeof(UT_hash_handle)) || (hdr->seeded != HASH_SEEDED) ||
+       ((hdr->num_items != 0U) && ((ptrdiff_t)hdr->hho != hho)) ||
+       (hdr->file_size != snap->len) || (hdr->items_off != UTSNAP_ALIGN) ||
+       (hdr->buckets_off < hdr->items_off + (uint64_t)hdr->num_items * item_size) ||
+       (hdr->file_size != hdr->buckets_off +
+                          (uint64_t)hdr->num_buckets * sizeof(UT_snap_bucket)) ||
+       ((hdr->num_items != 0U) &&
+        ((hdr->log2_num_buckets > 31U) ||
+         (hdr->num_buckets != (1U << hdr->log2_num_buckets))))) {
+      utsnap_unmap(snap);
+      errno = EINVAL;
+      return -1;
+   }
+   return 0;
+}
+
+/* turns the indexes of the mapped items back into pointers and builds the
+ * buckets of tbl, a new table for them: 0, or -1 with errno set, leaving tbl
+ * with no items */
+UTSNAP_UNUSED static int utsnap_link(UT_hash_table *tbl, UT_snap *snap)
+{
+   const UT_snap_header *hdr = (const UT_snap_header*)snap->map;
+   const UT_snap_bucket *sb;
+   char *items = (char*)snap->map + hdr->items_off, *elt;
+   size_t sz = hdr->item_size;
+   uint32_t n = hdr->num_items, nb = hdr->num_buckets, i;
+   uintptr_t keyoff;
+   UT_hash_bucket *buckets;
+   UT_hash_handle *hh = NULL;
+   int oomed = 0;
+
+   buckets = (UT_hash_bucket*)HASH_TBL_MALLOC(tbl, nb * sizeof(UT_hash_bucket));
+   if (buckets == NULL) {
+      errno = ENOMEM;
+      return -1;
+   }
+   uthash_bzero(buckets, nb * sizeof(UT_hash_bucket));
+
+   for (i = 0, elt = items; (oomed == 0) && (i < n); i++, elt += sz) {
+      hh = (UT_hash_handle*)(void*)(elt + tbl->hho);
+      keyoff = (uintptr_t)hh->key;
+      if (((uintptr_t)hh->hh_prev > n) || ((uintptr_t)hh->hh_next > n) ||
+          (keyoff > sz) || (hh->keylen > sz - keyoff)) {
+         oomed = -1;
+         break;
+      }
+      hh->tbl = tbl;
+      hh->prev = (i > 0U) ? (void*)(elt - sz) : NULL;
+      hh->next = (i + 1U < n) ? (void*)(elt + sz) : NULL;
+      hh->hh_prev = UTSNAP_HH(items, sz, tbl->hho, (uintptr_t)hh->hh_prev);
+      hh->hh_next = UTSNAP_HH(items, sz, tbl->hho, (uintptr_t)hh->hh_next);
+      hh->key = elt + keyoff;
+      HASH_SKIP_INIT(hh);
+      HASH_DENSE_ADD(tbl, hh, i, oomed);
+      HASH_BLOOM_ADD(tbl, hh->hashv);
+   }
+   for (i = 0, sb = (const UT_snap_bucket*)(const void*)((char*)snap->map + hdr->buckets_off);
+        (oomed == 0) && (i < nb); i++, sb++) {
+      if (sb->head > n) {
+         oomed = -1;
+         break;
+      }
+      buckets[i].hh_head = UTSNAP_HH(items, sz, tbl->hho, (uintptr_t)sb->head);
+      buckets[i].count = sb->count;
+      buckets[i].expand_mult = sb->expand_mult;
+#if HASH_BUCKET_TAGS
+      {
+         UT_hash_handle *thh = buckets[i].hh_head;
+         unsigned t;
+         for (t = 0; (t < HASH_BUCKET_TAGS) && (thh != NULL); t++, thh = thh->hh_next) {
+            buckets[i].tag_hashv[t] = thh->hashv;
+            buckets[i].tag_hh[t] = thh;
+         }
+      }
+#endif
+   }
+   if (oomed != 0) {
+      HASH_TBL_FREE(tbl, buckets, nb * sizeof(UT_hash_bucket));
+      errno = (oomed > 0) ? ENOMEM : EINVAL;
+      return -1;
+   }
+
+   HASH_TBL_FREE(tbl, tbl->buckets, tbl->num_buckets * sizeof(UT_hash_bucket));
+   tbl->buckets = buckets;
+   tbl->num_buckets = nb;
+   tbl->log2_num_buckets = hdr->log2_num_buckets;
+   tbl->num_items = n;
+   tbl->tail = hh;
+   tbl->ideal_chain_maxlen = hdr->ideal_chain_maxlen;
+   tbl->nonideal_items = hdr->nonideal_items;
+   tbl->ineff_expands = hdr->ineff_expands;
+   tbl->noexpand = hdr->noexpand;
+   tbl->expansions = hdr->expansions;
+#if HASH_SEEDED
+   tbl->seed = hdr->seed;
+#endif
+   return 0;
+}
+
+/* rc is 0, or -1 with errno set */
+#define UTSNAP_SAVE(hh,head,path,rc)                                             \
+do {                                                                             \
+  (rc) = utsnap_save(((head) != NULL) ? (head)->hh.tbl : NULL, (head),           \
+                     sizeof(*(head)), path);                                     \
+} while (0)
+
+/* head must be NULL or a hash to be replaced; it isn't freed */
+#define UTSNAP_LOAD(hh,head,path,snap,rc)                                        \
+do {                                                                             \
+  IF_HASH_NONFATAL_OOM( int _us_oomed = 0; )                                     \
+  (head) = NULL;                                                                 \
+  (rc) = utsnap_map(path, sizeof(*(head)),                                       \
+                    ((char*)(&(head)->hh) - (char*)(head)), snap);               \
+  if (((rc) == 0) && (((UT_snap_header*)(snap)->map)->num_items == 0U)) {      \
+    utsnap_unmap(snap);                                                          \
+  } else if ((rc) == 0) {                                                        \
+    DECLTYPE_ASSIGN(head, (char*)(snap)->map +                                   \
+                          ((UT_snap_header*)(snap)->map)->items_off);            \
+    HASH_MAKE_TABLE(hh, head, _us_oomed);                                        \
+    IF_HASH_NONFATAL_OOM(                                                        \
+      if (_us_oomed) {                                                           \
+        (head) = NULL;                                                           \
+        errno = ENOMEM;                                                          \
+        (rc) = -1;                                                               \
+      } else                                                                     \
+    )                                                                            \
+    if (utsnap_link((head)->hh.tbl, snap) != 0) {                                \
+      HASH_CLEAR(hh, head);                                                      \
+      (rc) = -1;                                                                 \
+    }                                                                            \
+    if ((rc) != 0) {                                                             \
+      utsnap_unmap(snap);                                                        \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* clears the hash (any items added since the load are the app's to free
+ * first) and unmaps the snapshot's items */
+#define UTSNAP_UNMAP(hh,head,snap)                                               \
+do {                                                                             \
+  HASH_CLEAR(hh, head);                                                          \
+  utsnap_unmap(snap);                                                            \
+} while (0)
+
+#endif /* UTSNAP_H */
@@ -27,7 +27,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define UTSTACK_VERSION 2.3.0
 
 /*
- * This file contains macros to manipulate a singly-linked list as a stack.
+ * This file contains macros to manipulate a singly-linked list as a stack,
+ * and (VSTACK_*, below) macros for stacks of values kept in an array.
  *
  * To use utstack, your structure must have a "next" pointer.
  *
@@ -85,4 +86,96 @@ do {                                                                 \
   for ((el) = (head); el; (el) = (el)->next) { ++(counter); }        \
 } while (0)
 
+/*
+ * Array-backed stacks of values ("vstacks"). The elements are stored by value
+ * in one growable array, so a push is a store (plus an occasional realloc)
+ * and a pop is a load from the same cache lines the pushes just wrote.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * typedef VSTACK(int) int_stack;
+ *
+ * int main() {
+ *      int v, batch[3] = { 1, 2, 3 };
+ *      int_stack s;
+ *      VSTACK_INIT(s);
+ *      VSTACK_PUSH(s, 42);
+ *      VSTACK_PUSH_N(s, batch, 3);    // 3 is now on top
+ *      VSTACK_POP(s, v);              // v == 3
+ *      VSTACK_POP_N(s, batch, 2);     // batch[0] == 42, batch[1] == 1
+ *      assert(VSTACK_COUNT(s) == 1 && VSTACK_TOP(s) == 2);
+ *      VSTACK_FREE(s);
+ * }
+ * --------------------------------------------------
+ */
+#include <stdlib.h>  /* realloc, free, exit */
+#include <string.h>  /* memcpy */
+
+#ifndef utstack_oom
+#define utstack_oom() exit(-1)
+#endif
+
+#define VSTACK(type) struct { type *d; size_t n; size_t cap; }
+
+#define VSTACK_INIT(s)                                               \
+do {                                                                 \
+  (s).d = NULL;                                                      \
+  (s).n = (s).cap = 0;                                               \
+} while (0)
+
+#define VSTACK_FREE(s)                                               \
+do {                                                                 \
+  free((s).d);                                                       \
+  VSTACK_INIT(s);                                                    \
+} while (0)
+
+/* make room for num more elements; the array at least doubles */
+#define VSTACK_RESERVE(s,num)                                        \
+do {                                                                 \
+  if ((s).n + (size_t)(num) > (s).cap) {                             \
+    size_t _vs_cap = (s).cap ? (s).cap : 16;                         \
+    void *_vs_d;                                                     \
+    while (_vs_cap < (s).n + (size_t)(num)) { _vs_cap *= 2; }        \
+    _vs_d = realloc((s).d, _vs_cap * sizeof(*(s).d));                \
+    if (_vs_d == NULL) { utstack_oom(); }                            \
+    memcpy(&(s).d, &_vs_d, sizeof(_vs_d));                           \
+    (s).cap = _vs_cap;                                               \
+  }                                                                  \
+} while (0)
+
+#define VSTACK_PUSH(s,val)                                           \
+do {                                                                 \
+  if ((s).n == (s).cap) { VSTACK_RESERVE(s,1); }                     \
+  (s).d[(s).n++] = (val);                                            \
+} while (0)
+
+#define VSTACK_POP(s,result)                                         \
+do {                                                                 \
+  (result) = (s).d[--(s).n];                                         \
+} while (0)
+
+/* push src[0..num-1] in order, so src[num-1] ends up on top */
+#define VSTACK_PUSH_N(s,src,num)                                     \
+do {                                                                 \
+  VSTACK_RESERVE(s,num);                                             \
+  if ((num) > 0) {                                                   \
+    memcpy((s).d + (s).n, (src), (size_t)(num) * sizeof(*(s).d));    \
+  }                                                                  \
+  (s).n += (size_t)(num);                                            \
+} while (0)
+
+/* pop the top num elements into dst[0..num-1], in the order they were
+   pushed (the old top lands in dst[num-1]) */
+#define VSTACK_POP_N(s,dst,num)                                      \
+do {                                                                 \
+  (s).n -= (size_t)(num);                                            \
+  if ((num) > 0) {                                                   \
+    memcpy((dst), (s).d + (s).n, (size_t)(num) * sizeof(*(s).d));    \
+  }                                                                  \
+} while (0)
+
+#define VSTACK_CLEAR(s) ((s).n = 0)
+#define VSTACK_TOP(s) ((s).d[(s).n - 1])
+#define VSTACK_EMPTY(s) ((s).n == 0)
+#define VSTACK_COUNT(s) ((s).n)
+
 #endif /* UTSTACK_H */
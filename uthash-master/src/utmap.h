@@ -0,0 +1,380 @@
+/*
+Copyright (c) 2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef UTMAP_H
+#define UTMAP_H
+
+#define UTMAP_VERSION 2.3.0
+
+/*
+ * A non-intrusive hash map: keys and values of fixed sizes are copied into
+ * the map, so items need no UT_hash_handle and are not allocated one by
+ * one. All the entries sit in one open-addressed array, each a key followed
+ * by its value (aligned), and after them a control byte per slot: 0 if the
+ * slot is empty, or 0x80 plus 7 bits of the key's hash. A lookup starts at
+ * the slot the hash picks and compares a group of control bytes at a time
+ * with the hash bits (16 with SSE2, else 8 packed in a word), so the keys it
+ * reads are nearly always the one it looks for. There are no tombstones: a
+ * delete moves the entries after it back (backward shift), so lookups never
+ * probe past deleted slots and no rebuild is ever needed to clean up.
+ *
+ * Keys of 4 or 8 bytes are hashed with one multiply and compared as words;
+ * other keys are hashed with HASH_FUNCTION and compared with memcmp. Keys
+ * are compared bitwise, so padding in struct keys must be zeroed. A value
+ * size of 0 makes a set. The map holds at most 3/4 of its slots and doubles
+ * when full; pointers into it are valid only until the next utmap_put,
+ * utmap_add or utmap_del. Needs the GCC/Clang builtins.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * UT_map m;
+ * int k = 1, v = 100, *p;
+ * utmap_init(&m, sizeof(int), sizeof(int));
+ * utmap_put(&m, &k, &v);
+ * p = (int*)utmap_find(&m, &k);
+ * utmap_del(&m, &k);
+ * utmap_done(&m);
+ * --------------------------------------------------
+ */
+
+#include <stddef.h>  /* size_t */
+#include <stdlib.h>  /* malloc, exit */
+#include <string.h>  /* memcpy, memcmp, memset */
+
+#include "uthash.h"  /* HASH_FUNCTION, HASH_WORD_PHI */
+
+#ifdef __GNUC__
+#define UTMAP_UNUSED __attribute__((__unused__))
+#else
+#define UTMAP_UNUSED
+#endif
+
+#ifndef utmap_oom
+#define utmap_oom() exit(-1)
+#endif
+
+#define UTMAP_MIN_SLOTS 16U
+
+/* _utmap_match(g, c) has a bit set for each control byte of the group at g
+ * equal to c; the bit of byte j is j << _UTMAP_LANE */
+#if defined(__SSE2__) && !defined(UTMAP_NO_SIMD)
+#include <emmintrin.h>
+#define UTMAP_GROUP 16U
+#define _UTMAP_LANE 0
+static uint64_t _utmap_match(const unsigned char *g, unsigned char c) UTMAP_UNUSED;
+static uint64_t _utmap_match(const unsigned char *g, unsigned char c) {
+  __m128i v = _mm_loadu_si128((const __m128i*)(const void*)g);
+  return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)c)));
+}
+#else
+#define UTMAP_GROUP 8U
+#define _UTMAP_LANE 3
+static uint64_t _utmap_match(const unsigned char *g, unsigned char c) UTMAP_UNUSED;
+static uint64_t _utmap_match(const unsigned char *g, unsigned char c) {
+  const uint64_t lo7 = ((uint64_t)0x7F7F7F7FU << 32) | 0x7F7F7F7FU;
+  uint64_t w;
+  memcpy(&w, g, sizeof(w));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  w = __builtin_bswap64(w);
+#endif
+  w ^= (lo7 / 0x7FU) * c;  /* c in every byte */
+  /* 0x80 in each zero byte and nowhere else (no borrow between bytes) */
+  return ~(((w & lo7) + lo7) | w | lo7);
+}
+#endif
+
+typedef struct {
+  size_t cap;            /* slots, a power of two; 0 before the first put */
+  size_t len;            /* entries */
+  size_t ksz, vsz;       /* key and value sizes */
+  size_t voff;           /* offset of the value in an entry */
+  size_t esz;            /* entry size, key and value and padding */
+  unsigned shift;        /* 64 - log2(cap) */
+  char *slots;           /* cap entries, then the control bytes */
+  unsigned char *ctrl;   /* cap bytes, then the first UTMAP_GROUP-1 again */
+} UT_map;
+
+#define utmap_len(m) ((m)->len)
+#define utmap_val(m, e) ((void*)((char*)(e) + (m)->voff))
+
+#define utmap_new(m, ksz, vsz) do {                                           \
+  (m) = (UT_map*)malloc(sizeof(UT_map));                                      \
+  if ((m) == NULL) {                                                          \
+    utmap_oom();                                                              \
+  }                                                                           \
+  utmap_init(m, ksz, vsz);                                                    \
+} while (0)
+
+#define utmap_free(m) do {                                                    \
+  utmap_done(m);                                                              \
+  free(m);                                                                    \
+} while (0)
+
+/* the alignment an object of n bytes may need: its lowest set bit, up to 8 */
+static size_t _utmap_align(size_t n) UTMAP_UNUSED;
+static size_t _utmap_align(size_t n) {
+  size_t a = n & (~n + 1);
+  return (a == 0) ? 1 : (a > 8) ? 8 : a;
+}
+
+static void utmap_init(UT_map *m, size_t ksz, size_t vsz) UTMAP_UNUSED;
+static void utmap_init(UT_map *m, size_t ksz, size_t vsz) {
+  size_t va = _utmap_align(vsz), ea = _utmap_align(ksz);
+  memset(m, 0, sizeof(*m));
+  m->ksz = ksz;
+  m->vsz = vsz;
+  m->voff = (ksz + va - 1) & ~(va - 1);
+  if (va > ea) {
+    ea = va;
+  }
+  m->esz = (m->voff + vsz + ea - 1) & ~(ea - 1);
+}
+
+static void utmap_done(UT_map *m) UTMAP_UNUSED;
+static void utmap_done(UT_map *m) {
+  free(m->slots);
+  m->slots = NULL;
+  m->ctrl = NULL;
+  m->cap = m->len = 0;
+}
+
+static uint64_t _utmap_hash(const UT_map *m, const void *key) UTMAP_UNUSED;
+static uint64_t _utmap_hash(const UT_map *m, const void *key) {
+  uint64_t w;
+  uint32_t w4;
+  unsigned hashv;
+  if (m->ksz == 8) {
+    memcpy(&w, key, 8);
+  } else if (m->ksz == 4) {
+    memcpy(&w4, key, 4);
+    w = w4;
+  } else {
+    HASH_FUNCTION(key, (unsigned)m->ksz, hashv);
+    w = hashv;
+  }
+  return w * HASH_WORD_PHI;
+}
+
+/* the slot picks the top bits of the hash, the control byte the 7 below */
+#define _utmap_home(m, h) ((size_t)((h) >> (m)->shift))
+#define _utmap_tag(m, h) ((unsigned char)(0x80U | (((h) >> ((m)->shift - 7)) & 0x7FU)))
+#define _utmap_entry(m, i) ((m)->slots + (i) * (m)->esz)
+
+static int _utmap_keyeq(const UT_map *m, const void *a, const void *b) UTMAP_UNUSED;
+static int _utmap_keyeq(const UT_map *m, const void *a, const void *b) {
+  uint64_t x, y;
+  uint32_t x4, y4;
+  if (m->ksz == 8) {
+    memcpy(&x, a, 8);
+    memcpy(&y, b, 8);
+    return x == y;
+  }
+  if (m->ksz == 4) {
+    memcpy(&x4, a, 4);
+    memcpy(&y4, b, 4);
+    return x4 == y4;
+  }
+  return memcmp(a, b, m->ksz) == 0;
+}
+
+static void _utmap_set_ctrl(UT_map *m, size_t i, unsigned char c) UTMAP_UNUSED;
+static void _utmap_set_ctrl(UT_map *m, size_t i, unsigned char c) {
+  m->ctrl[i] = c;
+  if (i < UTMAP_GROUP - 1) {
+    m->ctrl[m->cap + i] = c;
+  }
+}
+
+/* the slot holding key, with *found = 1, or else the slot it would go in,
+ * the first empty one from its home slot on, with *found = 0; the map must
+ * have slots. Matches after the first empty slot of a group are ignored. */
+static size_t _utmap_probe(const UT_map *m, const void *key, uint64_t h, int *found) UTMAP_UNUSED;
+static size_t _utmap_probe(const UT_map *m, const void *key, uint64_t h, int *found) {
+  size_t mask = m->cap - 1, i = _utmap_home(m, h), j;
+  unsigned char tag = _utmap_tag(m, h);
+  uint64_t hits, empty;
+  for (;;) {
+    hits = _utmap_match(m->ctrl + i, tag);
+    empty = _utmap_match(m->ctrl + i, 0);
+    if (empty != 0) {
+      hits &= (empty & (~empty + 1)) - 1;
+    }
+    while (hits != 0) {
+      j = (i + ((size_t)__builtin_ctzll(hits) >> _UTMAP_LANE)) & mask;
+      if (_utmap_keyeq(m, _utmap_entry(m, j), key)) {
+        *found = 1;
+        return j;
+      }
+      hits &= hits - 1;
+    }
+    if (empty != 0) {
+      *found = 0;
+      return (i + ((size_t)__builtin_ctzll(empty) >> _UTMAP_LANE)) & mask;
+    }
+    i = (i + UTMAP_GROUP) & mask;
+  }
+}
+
+/* moves the entries into a new array of cap slots */
+static void _utmap_rehash(UT_map *m, size_t cap) UTMAP_UNUSED;
+static void _utmap_rehash(UT_map *m, size_t cap) {
+  char *old = m->slots;
+  unsigned char *oldctrl = m->ctrl;
+  size_t oldcap = m->cap, i, j;
+  unsigned shift = 64;
+  uint64_t h;
+  int found;
+  for (i = cap; i > 1; i >>= 1) {
+    shift--;
+  }
+  m->slots = (char*)malloc(cap * m->esz + cap + UTMAP_GROUP - 1);
+  if (m->slots == NULL) {
+    utmap_oom();
+  }
+  m->ctrl = (unsigned char*)m->slots + cap * m->esz;
+  memset(m->ctrl, 0, cap + UTMAP_GROUP - 1);
+  m->cap = cap;
+  m->shift = shift;
+  for (i = 0; i < oldcap; i++) {
+    if (oldctrl[i] != 0) {
+      h = _utmap_hash(m, old + i * m->esz);
+      j = _utmap_probe(m, old + i * m->esz, h, &found);
+      memcpy(_utmap_entry(m, j), old + i * m->esz, m->esz);
+      _utmap_set_ctrl(m, j, _utmap_tag(m, h));
+    }
+  }
+  free(old);
+}
+
+/* makes room for n entries in all without growing */
+static void utmap_reserve(UT_map *m, size_t n) UTMAP_UNUSED;
+static void utmap_reserve(UT_map *m, size_t n) {
+  size_t cap = UTMAP_MIN_SLOTS;
+  while (cap - cap / 4 < n) {
+    cap <<= 1;
+  }
+  if (cap > m->cap) {
+    _utmap_rehash(m, cap);
+  }
+}
+
+/* the value of key, or NULL */
+static void *utmap_find(const UT_map *m, const void *key) UTMAP_UNUSED;
+static void *utmap_find(const UT_map *m, const void *key) {
+  size_t i;
+  int found;
+  if (m->len == 0) {
+    return NULL;
+  }
+  i = _utmap_probe(m, key, _utmap_hash(m, key), &found);
+  return found ? (void*)(_utmap_entry(m, i) + m->voff) : NULL;
+}
+
+/* the value of key, added with a zeroed value if it was not there, which
+ * *added (if not NULL) says */
+static void *utmap_add(UT_map *m, const void *key, int *added) UTMAP_UNUSED;
+static void *utmap_add(UT_map *m, const void *key, int *added) {
+  uint64_t h = _utmap_hash(m, key);
+  size_t i = 0;
+  char *e;
+  int found = 0;
+  if (m->cap != 0) {
+    i = _utmap_probe(m, key, h, &found);
+  }
+  if (!found && m->len + 1 > m->cap - m->cap / 4) {
+    _utmap_rehash(m, (m->cap != 0) ? m->cap * 2 : UTMAP_MIN_SLOTS);
+    i = _utmap_probe(m, key, h, &found);
+  }
+  e = _utmap_entry(m, i);
+  if (!found) {
+    memcpy(e, key, m->ksz);
+    memset(e + m->voff, 0, m->vsz);
+    _utmap_set_ctrl(m, i, _utmap_tag(m, h));
+    m->len++;
+  }
+  if (added != NULL) {
+    *added = !found;
+  }
+  return e + m->voff;
+}
+
+/* sets the value of key to the vsz bytes at val; returns where it is kept */
+static void *utmap_put(UT_map *m, const void *key, const void *val) UTMAP_UNUSED;
+static void *utmap_put(UT_map *m, const void *key, const void *val) {
+  void *v = utmap_add(m, key, NULL);
+  memcpy(v, val, m->vsz);
+  return v;
+}
+
+/* removes key; returns 1 if it was there. Each entry after it, up to an
+ * empty slot, moves back into the hole if that is not before its home
+ * slot, so the probe sequences stay unbroken without tombstones. */
+static int utmap_del(UT_map *m, const void *key) UTMAP_UNUSED;
+static int utmap_del(UT_map *m, const void *key) {
+  size_t mask, i, j, home;
+  int found;
+  if (m->len == 0) {
+    return 0;
+  }
+  mask = m->cap - 1;
+  i = _utmap_probe(m, key, _utmap_hash(m, key), &found);
+  if (!found) {
+    return 0;
+  }
+  for (j = (i + 1) & mask; m->ctrl[j] != 0; j = (j + 1) & mask) {
+    home = _utmap_home(m, _utmap_hash(m, _utmap_entry(m, j)));
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      memcpy(_utmap_entry(m, i), _utmap_entry(m, j), m->esz);
+      _utmap_set_ctrl(m, i, m->ctrl[j]);
+      i = j;
+    }
+  }
+  _utmap_set_ctrl(m, i, 0);
+  m->len--;
+  return 1;
+}
+
+/* empties the map, keeping its slots */
+static void utmap_clear(UT_map *m) UTMAP_UNUSED;
+static void utmap_clear(UT_map *m) {
+  if (m->cap != 0) {
+    memset(m->ctrl, 0, m->cap + UTMAP_GROUP - 1);
+  }
+  m->len = 0;
+}
+
+/* the entry after e (the first if e is NULL), or NULL: the entry starts
+ * with its key, and utmap_val(m, e) is its value. Entries come in slot
+ * order. Deleting during a walk moves later entries back, so they may be
+ * skipped or seen twice; collect the keys and delete them afterwards. */
+static void *utmap_next(const UT_map *m, const void *e) UTMAP_UNUSED;
+static void *utmap_next(const UT_map *m, const void *e) {
+  size_t i = (e == NULL) ? 0 : (size_t)((const char*)e - m->slots) / m->esz + 1;
+  for (; i < m->cap; i++) {
+    if (m->ctrl[i] != 0) {
+      return _utmap_entry(m, i);
+    }
+  }
+  return NULL;
+}
+
+#endif /* UTMAP_H */
@@ -35,6 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 typedef struct {
     unsigned i;       /* index of next available slot; wraps at n */
     unsigned n;       /* capacity */
+    unsigned l;       /* number of elements, ending just before slot i */
     unsigned char f;  /* full */
     UT_icd icd;       /* initializer, copy and destructor functions */
     char *d;          /* n slots of size icd->sz */
@@ -49,19 +50,13 @@ typedef struct {
 
 #define utringbuffer_clear(a) do {                                        \
   if ((a)->icd.dtor) {                                                    \
-    if ((a)->f) {                                                         \
-      unsigned _ut_i;                                                     \
-      for (_ut_i = 0; _ut_i < (a)->n; ++_ut_i) {                          \
-        (a)->icd.dtor(utringbuffer_eltptr(a, _ut_i));                     \
-      }                                                                   \
-    } else {                                                              \
-      unsigned _ut_i;                                                     \
-      for (_ut_i = 0; _ut_i < (a)->i; ++_ut_i) {                          \
-        (a)->icd.dtor(utringbuffer_eltptr(a, _ut_i));                     \
-      }                                                                   \
+    unsigned _ut_i;                                                       \
+    for (_ut_i = 0; _ut_i < (a)->l; ++_ut_i) {                            \
+      (a)->icd.dtor(utringbuffer_eltptr(a, _ut_i));                       \
     }                                                                     \
   }                                                                       \
   (a)->i = 0;                                                             \
+  (a)->l = 0;                                                             \
   (a)->f = 0;                                                             \
 } while(0)
 
@@ -85,18 +80,75 @@ typedef struct {
   if ((a)->icd.dtor && (a)->f) { (a)->icd.dtor(_utringbuffer_internalptr(a,(a)->i)); }  \
   if ((a)->icd.copy) { (a)->icd.copy( _utringbuffer_internalptr(a,(a)->i), p); }        \
   else { memcpy(_utringbuffer_internalptr(a,(a)->i), p, (a)->icd.sz); };                \
-  if (++(a)->i == (a)->n) { (a)->i = 0; (a)->f = 1; }                                   \
+  if (++(a)->i == (a)->n) { (a)->i = 0; }                                               \
+  if (!(a)->f && ++(a)->l == (a)->n) { (a)->f = 1; }                                    \
 } while(0)
 
-#define utringbuffer_len(a) ((a)->f ? (a)->n : (a)->i)
-#define utringbuffer_empty(a) ((a)->i == 0 && !(a)->f)
+/* push the num elements at p, oldest first. Without icd.copy and icd.dtor
+ * they are copied with at most two memcpys: up to the end of the slots, then
+ * from slot 0 (and only the last n of them if num is more than the capacity) */
+#define utringbuffer_push_back_n(a,p,num) do {                                          \
+  unsigned _ut_num = (unsigned)(num), _ut_k;                                            \
+  const char *_ut_p = (const char*)(p);                                                 \
+  if ((a)->icd.copy || (a)->icd.dtor) {                                                 \
+    for (_ut_k = 0; _ut_k < _ut_num; _ut_k++) {                                         \
+      utringbuffer_push_back(a, _ut_p + (_ut_k * (a)->icd.sz));                         \
+    }                                                                                   \
+  } else if (_ut_num > 0 && (a)->n > 0) {                                               \
+    if (_ut_num > (a)->n) {                                                             \
+      _ut_p += (_ut_num - (a)->n) * (a)->icd.sz;                                        \
+      _ut_num = (a)->n;                                                                 \
+    }                                                                                   \
+    _ut_k = (a)->n - (a)->i;                                                            \
+    if (_ut_k > _ut_num) { _ut_k = _ut_num; }                                           \
+    memcpy(_utringbuffer_internalptr(a,(a)->i), _ut_p, _ut_k * (a)->icd.sz);            \
+    if (_ut_k < _ut_num) {                                                              \
+      memcpy((a)->d, _ut_p + (_ut_k * (a)->icd.sz), (_ut_num - _ut_k) * (a)->icd.sz);   \
+    }                                                                                   \
+    (a)->i = _utringbuffer_wrap(a, (a)->i + _ut_num);                                   \
+    (a)->l = ((a)->n - (a)->l > _ut_num) ? (a)->l + _ut_num : (a)->n;                   \
+    (a)->f = ((a)->l == (a)->n);                                                        \
+  }                                                                                     \
+} while(0)
+
+/* remove the num oldest elements (all of them if there are fewer), moving
+ * them bitwise to the array out, or destroying them if out is NULL. The
+ * move takes at most two memcpys; a moved element is not destroyed, so out
+ * takes over whatever icd.copy made for it */
+#define utringbuffer_pop_front_n(a,num,out) do {                                        \
+  unsigned _ut_num = ((unsigned)(num) < (a)->l) ? (unsigned)(num) : (a)->l, _ut_k;      \
+  unsigned _ut_s = _utringbuffer_start(a);                                              \
+  char *_ut_out = (char*)(out);                                                         \
+  if (_ut_out != NULL && _ut_num > 0) {                                                 \
+    _ut_k = (a)->n - _ut_s;                                                             \
+    if (_ut_k > _ut_num) { _ut_k = _ut_num; }                                           \
+    memcpy(_ut_out, _utringbuffer_internalptr(a,_ut_s), _ut_k * (a)->icd.sz);           \
+    if (_ut_k < _ut_num) {                                                              \
+      memcpy(_ut_out + (_ut_k * (a)->icd.sz), (a)->d, (_ut_num - _ut_k) * (a)->icd.sz); \
+    }                                                                                   \
+  } else if ((a)->icd.dtor) {                                                           \
+    for (_ut_k = 0; _ut_k < _ut_num; _ut_k++) {                                         \
+      (a)->icd.dtor(_utringbuffer_internalptr(a,_utringbuffer_wrap(a,_ut_s + _ut_k)));  \
+    }                                                                                   \
+  }                                                                                     \
+  (a)->l -= _ut_num;                                                                    \
+  if (_ut_num > 0) { (a)->f = 0; }                                                      \
+} while(0)
+
+#define utringbuffer_pop_front(a,out) utringbuffer_pop_front_n(a,1,out)
+
+#define utringbuffer_len(a) ((a)->l)
+#define utringbuffer_empty(a) ((a)->l == 0)
 #define utringbuffer_full(a) ((a)->f != 0)
 
-#define _utringbuffer_real_idx(a,j) ((a)->f ? ((j) + (a)->i) % (a)->n : (j))
+/* k below 3n, reduced to a slot: a mask if n is a power of two */
+#define _utringbuffer_wrap(a,k) ((((a)->n & ((a)->n - 1)) == 0) ? ((k) & ((a)->n - 1)) : ((k) % (a)->n))
+#define _utringbuffer_start(a) _utringbuffer_wrap(a, (a)->i + (a)->n - (a)->l)
+#define _utringbuffer_real_idx(a,j) _utringbuffer_wrap(a, (j) + (a)->i + (a)->n - (a)->l)
 #define _utringbuffer_internalptr(a,j) ((void*)((a)->d + ((a)->icd.sz * (j))))
 #define utringbuffer_eltptr(a,j) ((0 <= (j) && (j) < utringbuffer_len(a)) ? _utringbuffer_internalptr(a,_utringbuffer_real_idx(a,j)) : NULL)
 
-#define _utringbuffer_fake_idx(a,j) ((a)->f ? ((j) + (a)->n - (a)->i) % (a)->n : (j))
+#define _utringbuffer_fake_idx(a,j) _utringbuffer_wrap(a, (j) + (a)->n - (a)->i + (a)->l)
 #define _utringbuffer_internalidx(a,e) (((char*)(e) >= (a)->d) ? (((char*)(e) - (a)->d)/(a)->icd.sz) : -1)
 #define utringbuffer_eltidx(a,e) _utringbuffer_fake_idx(a, _utringbuffer_internalidx(a,e))
 
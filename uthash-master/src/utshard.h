@@ -0,0 +1,436 @@
+/*
+Copyright (c) 2022, Troy D. Hanson  https://troydhanson.github.io/uthash/
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER
+OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef UTSHARD_H
+#define UTSHARD_H
+
+#define UTSHARD_VERSION 2.3.0
+
+/*
+ * This file contains macros for a hash that many threads can use at once. It
+ * is made of 2^UTSHARD_LOG2 ordinary uthash tables (shards), each with its own
+ * read-write lock. The high bits of an item's hash value pick its shard, and
+ * the low bits its bucket within the shard, so threads working on different
+ * keys rarely wait on the same lock, and each shard expands its buckets on its
+ * own, holding only its own lock. Keys are hashed before any lock is taken.
+ *
+ * A pointer returned by SHARD_FIND stays valid only as long as no other
+ * thread deletes and frees the item; the application must know when that is
+ * safe. Finds take a read lock, so HASH_INCREMENTAL_RESIZE (whose finds
+ * modify the table) can't be used.
+ *
+ * With -DUTSHARD_EPOCH=1, finds take no lock at all (see "Lock-free finds"
+ * below); writers then take a plain mutex, and SHARD_DELETE and SHARD_REPLACE
+ * return only once no find can still be reading the removed item, so it may be
+ * freed right away. This mode needs the GCC/Clang __atomic builtins.
+ *
+ * ----------------.EXAMPLE -------------------------
+ * typedef struct item {
+ *      int id;
+ *      UT_hash_handle hh;
+ * } item;
+ *
+ * UTSHARD_TABLE(item) items;
+ *
+ * int main() {
+ *      item *i = malloc(sizeof *i), *found;
+ *      int id = 42;
+ *      SHARD_INIT(items);
+ *      i->id = id;
+ *      SHARD_ADD_INT(items, id, i);
+ *      SHARD_FIND_INT(items, &id, found);
+ *      SHARD_DEL(items, found);
+ *      free(found);
+ *      SHARD_DESTROY(items);
+ * }
+ * --------------------------------------------------
+ */
+
+#include <pthread.h>
+#include "uthash.h"
+
+#if HASH_INCREMENTAL_RESIZE
+#error "utshard.h finds under a read lock; HASH_INCREMENTAL_RESIZE needs a write lock"
+#endif
+
+#ifndef UTSHARD_LOG2
+#define UTSHARD_LOG2 4U                  /* 16 shards                        */
+#endif
+#ifndef UTSHARD_PAD
+#define UTSHARD_PAD 128U                 /* keeps shards' locks apart        */
+#endif
+#define UTSHARD_SHARDS (1U << UTSHARD_LOG2)
+
+#ifndef UTSHARD_EPOCH
+#define UTSHARD_EPOCH 0
+#endif
+
+#if UTSHARD_EPOCH && HASH_ALLOCATOR
+#error "UTSHARD_EPOCH delays frees through uthash_free, which HASH_ALLOCATOR tables bypass"
+#endif
+
+#if UTSHARD_EPOCH
+/* Lock-free finds. A find neither takes a lock nor writes to anything another
+ * thread reads; the two things it does need are kept per shard:
+ *
+ * - seq, a sequence count that writers make odd while they change the shard.
+ *   A find reads it first, and checks it is unchanged before it follows any
+ *   pointer it has read since; if not, the find starts over. So a find only
+ *   acts on pointers read while no writer was active, and a bucket expansion
+ *   (which relinks every chain) can't make it miss an item.
+ *
+ * - readers, counts of the finds in progress, split by thread over
+ *   UTSHARD_READER_SLOTS cache lines, and by the parity of the shard's epoch.
+ *   Before freeing anything a find might still hold (an old bucket array, a
+ *   deleted item), a writer flips the epoch twice, each time waiting for the
+ *   finds counted under the other parity to end. Until then the find holds a
+ *   pointer into memory that is still allocated, if stale.
+ *
+ * uthash_free is redefined to wait in this way when it is called by a SHARD_
+ * writer; define UTSHARD_FREE(ptr,sz) to change the function that then frees.
+ * A find that keeps failing to get a stable view (UTSHARD_READ_TRIES times)
+ * takes the writers' mutex instead. */
+#include <sched.h>                       /* sched_yield */
+
+#ifndef UTSHARD_READER_SLOTS
+#define UTSHARD_READER_SLOTS 16U
+#endif
+#ifndef UTSHARD_READ_TRIES
+#define UTSHARD_READ_TRIES 64U
+#endif
+#ifndef UTSHARD_FREE
+#define UTSHARD_FREE(ptr,sz) free(ptr)
+#endif
+
+struct utshard_epoch {
+  unsigned long seq;
+  unsigned long epoch;
+  union {
+    unsigned long n[2];
+    char pad[64];
+  } readers[UTSHARD_READER_SLOTS];
+};
+
+/* each thread counts its finds in one slot, picked on its first find */
+static __thread unsigned utshard_slot __attribute__((unused));
+static unsigned utshard_slots __attribute__((unused));
+#define UTSHARD_MY_SLOT()                                                        \
+  ((((utshard_slot != 0U) ? 0U :                                                 \
+     (utshard_slot = 1U + __atomic_fetch_add(&utshard_slots, 1U, __ATOMIC_RELAXED))), \
+    utshard_slot - 1U) % UTSHARD_READER_SLOTS)
+
+#define UTSHARD_READ_BEGIN(ep,slot,par)                                          \
+do {                                                                             \
+  (slot) = UTSHARD_MY_SLOT();                                                    \
+  (par) = (unsigned)(__atomic_load_n(&(ep).epoch, __ATOMIC_RELAXED) & 1U);       \
+  __atomic_fetch_add(&(ep).readers[slot].n[par], 1UL, __ATOMIC_SEQ_CST);         \
+} while (0)
+
+#define UTSHARD_READ_END(ep,slot,par)                                            \
+  __atomic_fetch_sub(&(ep).readers[slot].n[par], 1UL, __ATOMIC_RELEASE)
+
+/* true if nothing was written since the find read seq as s */
+#define UTSHARD_STILL(ep,s)                                                      \
+  (__atomic_thread_fence(__ATOMIC_ACQUIRE),                                      \
+   __atomic_load_n(&(ep).seq, __ATOMIC_RELAXED) == (s))
+
+/* wait for the finds that may hold memory unlinked before this call */
+#define UTSHARD_SYNCHRONIZE(epp)                                                 \
+do {                                                                             \
+  unsigned _us_flip, _us_i, _us_par;                                             \
+  for (_us_flip = 0; _us_flip < 2U; _us_flip++) {                                \
+    _us_par = (unsigned)(__atomic_fetch_add(&(epp)->epoch, 1UL, __ATOMIC_SEQ_CST) & 1U); \
+    for (_us_i = 0; _us_i < UTSHARD_READER_SLOTS; _us_i++) {                     \
+      while (__atomic_load_n(&(epp)->readers[_us_i].n[_us_par], __ATOMIC_ACQUIRE) != 0UL) { \
+        sched_yield();                                                           \
+      }                                                                          \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* Inside a SHARD_ writer, utshard_cur_ep is a local naming its shard, which
+ * hides this one; elsewhere uthash_free frees at once, as usual. */
+static struct utshard_epoch *const utshard_cur_ep __attribute__((unused)) = NULL;
+#undef uthash_free
+#define uthash_free(ptr,sz)                                                      \
+do {                                                                             \
+  if (utshard_cur_ep != NULL) {                                                  \
+    UTSHARD_SYNCHRONIZE(utshard_cur_ep);                                         \
+  }                                                                              \
+  UTSHARD_FREE(ptr, sz);                                                         \
+} while (0)
+
+#define UTSHARD_LOCK_T pthread_mutex_t
+#define UTSHARD_LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define UTSHARD_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define UTSHARD_EPOCH_FIELD struct utshard_epoch ep;
+
+#define SHARD_RDLOCK(sh)                                                         \
+do {                                                                             \
+  if (pthread_mutex_lock(&(sh).lock) != 0) {                                     \
+    uthash_fatal("can't get shard lock");                                        \
+  }                                                                              \
+} while (0)
+#define SHARD_RDUNLOCK(sh) pthread_mutex_unlock(&(sh).lock)
+
+#define SHARD_WRLOCK(sh)                                                         \
+do {                                                                             \
+  SHARD_RDLOCK(sh);                                                              \
+  __atomic_store_n(&(sh).ep.seq, (sh).ep.seq + 1UL, __ATOMIC_RELAXED);           \
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);                                       \
+} while (0)
+#define SHARD_WRUNLOCK(sh)                                                       \
+do {                                                                             \
+  __atomic_store_n(&(sh).ep.seq, (sh).ep.seq + 1UL, __ATOMIC_RELEASE);           \
+  SHARD_RDUNLOCK(sh);                                                            \
+} while (0)
+
+/* the removed item rem may be freed once this returns */
+#define SHARD_WRUNLOCK_RETIRE(sh,rem)                                            \
+do {                                                                             \
+  __atomic_store_n(&(sh).ep.seq, (sh).ep.seq + 1UL, __ATOMIC_RELEASE);           \
+  if ((rem) != NULL) {                                                           \
+    UTSHARD_SYNCHRONIZE(&(sh).ep);                                               \
+  }                                                                              \
+  SHARD_RDUNLOCK(sh);                                                            \
+} while (0)
+
+#define UTSHARD_WRITER(tbl,hashv)                                                \
+  struct utshard_epoch *utshard_cur_ep = &SHARD_OF(tbl, hashv).ep
+
+#else /* !UTSHARD_EPOCH */
+
+#define UTSHARD_LOCK_T pthread_rwlock_t
+#define UTSHARD_LOCK_INIT(l) pthread_rwlock_init(l, NULL)
+#define UTSHARD_LOCK_DESTROY(l) pthread_rwlock_destroy(l)
+#define UTSHARD_EPOCH_FIELD
+
+#define SHARD_RDLOCK(sh)                                                         \
+do {                                                                             \
+  if (pthread_rwlock_rdlock(&(sh).lock) != 0) {                                  \
+    uthash_fatal("can't get shard read lock");                                   \
+  }                                                                              \
+} while (0)
+#define SHARD_RDUNLOCK(sh) pthread_rwlock_unlock(&(sh).lock)
+
+#define SHARD_WRLOCK(sh)                                                         \
+do {                                                                             \
+  if (pthread_rwlock_wrlock(&(sh).lock) != 0) {                                  \
+    uthash_fatal("can't get shard write lock");                                  \
+  }                                                                              \
+} while (0)
+#define SHARD_WRUNLOCK(sh) pthread_rwlock_unlock(&(sh).lock)
+#define SHARD_WRUNLOCK_RETIRE(sh,rem) SHARD_WRUNLOCK(sh)
+#define UTSHARD_WRITER(tbl,hashv)
+
+#endif /* UTSHARD_EPOCH */
+
+#define UTSHARD_TABLE(type)                                                      \
+struct {                                                                         \
+  union {                                                                        \
+    struct {                                                                     \
+      type *head;                                                                \
+      UTSHARD_LOCK_T lock;                                                       \
+      UTSHARD_EPOCH_FIELD                                                        \
+    } s;                                                                         \
+    char pad[UTSHARD_PAD];                                                       \
+  } shard[UTSHARD_SHARDS];                                                       \
+}
+
+#if UTSHARD_LOG2 == 0
+#define SHARD_OF(tbl,hashv) ((tbl).shard[0].s)
+#else
+#define SHARD_OF(tbl,hashv) ((tbl).shard[(unsigned)(hashv) >> (32U - UTSHARD_LOG2)].s)
+#endif
+
+#define SHARD_INIT(tbl)                                                          \
+do {                                                                             \
+  unsigned _si_i;                                                                \
+  uthash_bzero(&(tbl), sizeof(tbl));                                             \
+  for (_si_i = 0; _si_i < UTSHARD_SHARDS; _si_i++) {                             \
+    if (UTSHARD_LOCK_INIT(&(tbl).shard[_si_i].s.lock) != 0) {                    \
+      uthash_fatal("can't create shard lock");                                   \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+
+/* the items must have been deleted first (see SHARD_HEAD) */
+#define SHARD_DESTROY(tbl)                                                       \
+do {                                                                             \
+  unsigned _sd_i;                                                                \
+  for (_sd_i = 0; _sd_i < UTSHARD_SHARDS; _sd_i++) {                             \
+    UTSHARD_LOCK_DESTROY(&(tbl).shard[_sd_i].s.lock);                            \
+  }                                                                              \
+} while (0)
+
+/* the uthash head of shard i, for when no other thread uses the table */
+#define SHARD_HEAD(tbl,i) ((tbl).shard[i].s.head)
+
+#if UTSHARD_EPOCH
+#define SHARD_FIND(hh,table,keyptr,keylen_in,out)                                \
+do {                                                                             \
+  unsigned _sf_hashv, _sf_slot, _sf_par, _sf_try, _sf_ok, _sf_n;                 \
+  unsigned long _sf_seq;                                                         \
+  UT_hash_table *_sf_tbl = NULL;                                                 \
+  UT_hash_bucket *_sf_bkts;                                                      \
+  struct UT_hash_handle *_sf_thh;                                                \
+  HASH_VALUE(keyptr, keylen_in, _sf_hashv);                                      \
+  for (_sf_try = 0; ; _sf_try++) {                                               \
+    (out) = NULL;                                                                \
+    if (_sf_try == UTSHARD_READ_TRIES) {                                         \
+      /* writers keep changing the shard: wait for them instead */               \
+      SHARD_RDLOCK(SHARD_OF(table, _sf_hashv));                                  \
+      HASH_FIND_BYHASHVALUE(hh, SHARD_OF(table, _sf_hashv).head, keyptr, keylen_in, _sf_hashv, out); \
+      SHARD_RDUNLOCK(SHARD_OF(table, _sf_hashv));                                \
+      break;                                                                     \
+    }                                                                            \
+    if (_sf_try != 0U) {                                                         \
+      sched_yield();                                                             \
+    }                                                                            \
+    /* (a retry leaves the read section, or it would hold up the writer) */      \
+    UTSHARD_READ_BEGIN(SHARD_OF(table, _sf_hashv).ep, _sf_slot, _sf_par);        \
+    _sf_seq = __atomic_load_n(&SHARD_OF(table, _sf_hashv).ep.seq, __ATOMIC_ACQUIRE); \
+    _sf_ok = ((_sf_seq & 1UL) == 0UL);                                           \
+    _sf_thh = NULL;                                                              \
+    if (_sf_ok) {                                                                \
+      (out) = __atomic_load_n(&SHARD_OF(table, _sf_hashv).head, __ATOMIC_RELAXED); \
+    }                                                                            \
+    if (((out) != NULL) && UTSHARD_STILL(SHARD_OF(table, _sf_hashv).ep, _sf_seq)) { \
+      _sf_tbl = __atomic_load_n(&(out)->hh.tbl, __ATOMIC_RELAXED);               \
+      if (UTSHARD_STILL(SHARD_OF(table, _sf_hashv).ep, _sf_seq)) {               \
+        _sf_bkts = __atomic_load_n(&_sf_tbl->buckets, __ATOMIC_RELAXED);         \
+        _sf_n = __atomic_load_n(&_sf_tbl->num_buckets, __ATOMIC_RELAXED);        \
+        if (UTSHARD_STILL(SHARD_OF(table, _sf_hashv).ep, _sf_seq)) {             \
+          _sf_thh = __atomic_load_n(&_sf_bkts[_sf_hashv & (_sf_n - 1U)].hh_head, \
+                                    __ATOMIC_RELAXED);                           \
+        }                                                                        \
+      }                                                                          \
+    }                                                                            \
+    (out) = NULL;                                                                \
+    while (_sf_thh != NULL) {                                                    \
+      if (!UTSHARD_STILL(SHARD_OF(table, _sf_hashv).ep, _sf_seq)) {              \
+        _sf_ok = 0;                                                              \
+        break;                                                                   \
+      }                                                                          \
+      if ((_sf_thh->hashv == _sf_hashv) && (_sf_thh->keylen == (unsigned)(keylen_in)) && \
+          (HASH_KEYCMP(_sf_thh->key, keyptr, keylen_in) == 0)) {                 \
+        break;                                                                   \
+      }                                                                          \
+      _sf_thh = __atomic_load_n(&_sf_thh->hh_next, __ATOMIC_RELAXED);            \
+    }                                                                            \
+    _sf_ok = _sf_ok && UTSHARD_STILL(SHARD_OF(table, _sf_hashv).ep, _sf_seq);    \
+    if (_sf_ok && (_sf_thh != NULL)) {                                           \
+      DECLTYPE_ASSIGN(out, ELMT_FROM_HH(_sf_tbl, _sf_thh));                      \
+    }                                                                            \
+    UTSHARD_READ_END(SHARD_OF(table, _sf_hashv).ep, _sf_slot, _sf_par);          \
+    if (_sf_ok) {                                                                \
+      break;                                                                     \
+    }                                                                            \
+  }                                                                              \
+} while (0)
+#else
+#define SHARD_FIND(hh,tbl,keyptr,keylen,out)                                     \
+do {                                                                             \
+  unsigned _sf_hashv;                                                            \
+  HASH_VALUE(keyptr, keylen, _sf_hashv);                                         \
+  SHARD_RDLOCK(SHARD_OF(tbl, _sf_hashv));                                        \
+  HASH_FIND_BYHASHVALUE(hh, SHARD_OF(tbl, _sf_hashv).head, keyptr, keylen, _sf_hashv, out); \
+  SHARD_RDUNLOCK(SHARD_OF(tbl, _sf_hashv));                                      \
+} while (0)
+#endif
+
+#define SHARD_ADD(hh,tbl,fieldname,keylen_in,add)                                \
+do {                                                                             \
+  unsigned _sa_hashv;                                                            \
+  HASH_VALUE(&((add)->fieldname), keylen_in, _sa_hashv);                         \
+  {                                                                              \
+    UTSHARD_WRITER(tbl, _sa_hashv);                                              \
+    SHARD_WRLOCK(SHARD_OF(tbl, _sa_hashv));                                      \
+    HASH_ADD_KEYPTR_BYHASHVALUE(hh, SHARD_OF(tbl, _sa_hashv).head,               \
+        &((add)->fieldname), keylen_in, _sa_hashv, add);                         \
+    SHARD_WRUNLOCK(SHARD_OF(tbl, _sa_hashv));                                    \
+  }                                                                              \
+} while (0)
+
+#define SHARD_REPLACE(hh,tbl,fieldname,keylen_in,add,replaced)                   \
+do {                                                                             \
+  unsigned _sr_hashv;                                                            \
+  HASH_VALUE(&((add)->fieldname), keylen_in, _sr_hashv);                         \
+  {                                                                              \
+    UTSHARD_WRITER(tbl, _sr_hashv);                                              \
+    SHARD_WRLOCK(SHARD_OF(tbl, _sr_hashv));                                      \
+    HASH_REPLACE_BYHASHVALUE(hh, SHARD_OF(tbl, _sr_hashv).head, fieldname,       \
+        keylen_in, _sr_hashv, add, replaced);                                    \
+    SHARD_WRUNLOCK_RETIRE(SHARD_OF(tbl, _sr_hashv), replaced);                   \
+  }                                                                              \
+} while (0)
+
+#define SHARD_DELETE(hh,tbl,delptr)                                              \
+do {                                                                             \
+  unsigned _sx_hashv = (delptr)->hh.hashv;                                       \
+  {                                                                              \
+    UTSHARD_WRITER(tbl, _sx_hashv);                                              \
+    SHARD_WRLOCK(SHARD_OF(tbl, _sx_hashv));                                      \
+    HASH_DELETE(hh, SHARD_OF(tbl, _sx_hashv).head, delptr);                      \
+    SHARD_WRUNLOCK_RETIRE(SHARD_OF(tbl, _sx_hashv), delptr);                     \
+  }                                                                              \
+} while (0)
+
+#define SHARD_CNT(hh,tbl,count)                                                  \
+do {                                                                             \
+  unsigned _sc_i;                                                                \
+  (count) = 0;                                                                   \
+  for (_sc_i = 0; _sc_i < UTSHARD_SHARDS; _sc_i++) {                             \
+    SHARD_RDLOCK((tbl).shard[_sc_i].s);                                          \
+    (count) += HASH_CNT(hh, (tbl).shard[_sc_i].s.head);                          \
+    SHARD_RDUNLOCK((tbl).shard[_sc_i].s);                                        \
+  }                                                                              \
+} while (0)
+
+/* convenience forms of the above, for the hash handle named hh */
+#define SHARD_FIND_INT(tbl,findint,out)                                          \
+    SHARD_FIND(hh, tbl, findint, sizeof(int), out)
+#define SHARD_ADD_INT(tbl,intfield,add)                                          \
+    SHARD_ADD(hh, tbl, intfield, sizeof(int), add)
+#define SHARD_REPLACE_INT(tbl,intfield,add,replaced)                             \
+    SHARD_REPLACE(hh, tbl, intfield, sizeof(int), add, replaced)
+#define SHARD_FIND_STR(tbl,findstr,out)                                          \
+do {                                                                             \
+  unsigned _uthash_sfstr_keylen = (unsigned)uthash_strlen(findstr);              \
+  SHARD_FIND(hh, tbl, findstr, _uthash_sfstr_keylen, out);                       \
+} while (0)
+#define SHARD_ADD_STR(tbl,strfield,add)                                          \
+do {                                                                             \
+  unsigned _uthash_sastr_keylen = (unsigned)uthash_strlen((add)->strfield);      \
+  SHARD_ADD(hh, tbl, strfield[0], _uthash_sastr_keylen, add);                    \
+} while (0)
+#define SHARD_REPLACE_STR(tbl,strfield,add,replaced)                             \
+do {                                                                             \
+  unsigned _uthash_srstr_keylen = (unsigned)uthash_strlen((add)->strfield);      \
+  SHARD_REPLACE(hh, tbl, strfield[0], _uthash_srstr_keylen, add, replaced);      \
+} while (0)
+#define SHARD_DEL(tbl,delptr)                                                    \
+    SHARD_DELETE(hh, tbl, delptr)
+#define SHARD_COUNT(tbl,count) SHARD_CNT(hh, tbl, count)
+
+#endif /* UTSHARD_H */
@@ -164,6 +164,264 @@ UTSTRING_UNUSED static void utstring_printf(UT_string *s, const char *fmt, ...)
    va_end(ap);
 }
 
+#ifndef UTSTRING_NO_STDINT
+#include <stdint.h>  /* uint64_t */
+
+/* Number appends: the digits are formed two at a time in a local buffer and
+ * copied in with one utstring_reserve, without the format parsing and retry
+ * of utstring_printf. Hex digits are lower case, with no prefix. */
+static const char _utstring_digit_pairs[201] =
+   "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+   "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+   "8081828384858687888990919293949596979899";
+
+UTSTRING_UNUSED static void _utstring_append_digits(UT_string *s, const char *p, size_t len) {
+   utstring_reserve(s, len + 1);
+   memcpy(&s->d[s->i], p, len);
+   s->i += len;
+   s->d[s->i] = '\0';
+}
+
+UTSTRING_UNUSED static void utstring_append_u64(UT_string *s, uint64_t v) {
+   char buf[20], *p = buf + sizeof(buf);
+   unsigned k;
+   while (v >= 100) {
+      k = (unsigned)(v % 100) * 2;
+      v /= 100;
+      *--p = _utstring_digit_pairs[k + 1];
+      *--p = _utstring_digit_pairs[k];
+   }
+   if (v >= 10) {
+      k = (unsigned)v * 2;
+      *--p = _utstring_digit_pairs[k + 1];
+      *--p = _utstring_digit_pairs[k];
+   } else {
+      *--p = (char)('0' + v);
+   }
+   _utstring_append_digits(s, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+UTSTRING_UNUSED static void utstring_append_int(UT_string *s, int64_t v) {
+   if (v < 0) {
+      utstring_reserve(s, 22);
+      s->d[s->i++] = '-';
+      utstring_append_u64(s, (uint64_t)0 - (uint64_t)v);
+   } else {
+      utstring_append_u64(s, (uint64_t)v);
+   }
+}
+
+UTSTRING_UNUSED static void utstring_append_hex(UT_string *s, uint64_t v) {
+   char buf[16], *p = buf + sizeof(buf);
+   do {
+      *--p = "0123456789abcdef"[v & 0xf];
+      v >>= 4;
+   } while (v != 0);
+   _utstring_append_digits(s, p, (size_t)(buf + sizeof(buf) - p));
+}
+#endif /* UTSTRING_NO_STDINT */
+
+/* Ropes: a string built as a list of chunks of (at least) UTSTRING_ROPE_CHUNK
+ * bytes, for strings too large to grow by realloc. An append fills the last
+ * chunk and starts new ones; nothing is ever moved. utstring_rope_flush
+ * writes the chunks to a descriptor with writev and empties the rope, and
+ * utstring_rope_materialize appends the whole rope to a UT_string with one
+ * utstring_reserve. The chunks are not null-terminated. */
+#ifndef UTSTRING_ROPE_CHUNK
+#define UTSTRING_ROPE_CHUNK 65536
+#endif
+
+typedef struct UT_string_chunk {
+    struct UT_string_chunk *next;
+    size_t n;  /* capacity of d */
+    size_t i;  /* bytes used */
+    char d[1];
+} UT_string_chunk;
+
+typedef struct {
+    UT_string_chunk *head;
+    UT_string_chunk *tail;
+    size_t len;    /* total bytes */
+    size_t chunk;  /* size of new chunks */
+} UT_string_rope;
+
+#define utstring_rope_len(r) ((r)->len)
+
+UTSTRING_UNUSED static void utstring_rope_init(UT_string_rope *r, size_t chunk) {
+   r->head = r->tail = NULL;
+   r->len = 0;
+   r->chunk = (chunk != 0) ? chunk : UTSTRING_ROPE_CHUNK;
+}
+
+/* a chunk of at least want bytes after the tail */
+UTSTRING_UNUSED static void _utstring_rope_grow(UT_string_rope *r, size_t want) {
+   size_t n = (want > r->chunk) ? want : r->chunk;
+   UT_string_chunk *c = (UT_string_chunk*)malloc(sizeof(UT_string_chunk) + n - 1);
+   if (c == NULL) {
+      utstring_oom();
+   }
+   c->next = NULL;
+   c->n = n;
+   c->i = 0;
+   if (r->tail != NULL) {
+      r->tail->next = c;
+   } else {
+      r->head = c;
+   }
+   r->tail = c;
+}
+
+UTSTRING_UNUSED static void utstring_rope_bincpy(UT_string_rope *r, const void *b, size_t l) {
+   const char *p = (const char*)b;
+   size_t k;
+   r->len += l;
+   while (l > 0) {
+      if (r->tail == NULL || r->tail->i == r->tail->n) {
+         _utstring_rope_grow(r, l);
+      }
+      k = r->tail->n - r->tail->i;
+      if (k > l) {
+         k = l;
+      }
+      memcpy(r->tail->d + r->tail->i, p, k);
+      r->tail->i += k;
+      p += k;
+      l -= k;
+   }
+}
+
+UTSTRING_UNUSED static void utstring_rope_concat(UT_string_rope *r, const UT_string *s) {
+   utstring_rope_bincpy(r, s->d, s->i);
+}
+
+UTSTRING_UNUSED static void utstring_rope_printf_va(UT_string_rope *r, const char *fmt, va_list ap) {
+   int n;
+   size_t room;
+   va_list cp;
+   for (;;) {
+      room = (r->tail != NULL) ? r->tail->n - r->tail->i : 0;
+#ifdef _WIN32
+      cp = ap;
+#else
+      va_copy(cp, ap);
+#endif
+      n = vsnprintf((room != 0) ? r->tail->d + r->tail->i : NULL, room, fmt, cp);
+      va_end(cp);
+      if (n < 0) {
+         return;
+      }
+      /* vsnprintf writes a terminator, so it needs a byte more than n */
+      if ((size_t)n < room) {
+         r->tail->i += (size_t)n;
+         r->len += (size_t)n;
+         return;
+      }
+      _utstring_rope_grow(r, (size_t)n + 1);
+   }
+}
+#ifdef __GNUC__
+static void utstring_rope_printf(UT_string_rope *r, const char *fmt, ...)
+  __attribute__ (( format( printf, 2, 3) ));
+#endif
+UTSTRING_UNUSED static void utstring_rope_printf(UT_string_rope *r, const char *fmt, ...) {
+   va_list ap;
+   va_start(ap,fmt);
+   utstring_rope_printf_va(r,fmt,ap);
+   va_end(ap);
+}
+
+/* appends the rope to s; the rope is unchanged */
+UTSTRING_UNUSED static void utstring_rope_materialize(const UT_string_rope *r, UT_string *s) {
+   const UT_string_chunk *c;
+   utstring_reserve(s, r->len + 1);
+   for (c = r->head; c != NULL; c = c->next) {
+      memcpy(&s->d[s->i], c->d, c->i);
+      s->i += c->i;
+   }
+   s->d[s->i] = '\0';
+}
+
+/* frees the chunks but the first, which is kept (emptied) for reuse */
+UTSTRING_UNUSED static void utstring_rope_clear(UT_string_rope *r) {
+   UT_string_chunk *c, *next;
+   if (r->head != NULL) {
+      for (c = r->head->next; c != NULL; c = next) {
+         next = c->next;
+         free(c);
+      }
+      r->head->next = NULL;
+      r->head->i = 0;
+      r->tail = r->head;
+   }
+   r->len = 0;
+}
+
+UTSTRING_UNUSED static void utstring_rope_done(UT_string_rope *r) {
+   utstring_rope_clear(r);
+   free(r->head);
+   r->head = r->tail = NULL;
+}
+
+#ifndef _WIN32
+#include <sys/uio.h>  /* writev */
+#include <limits.h>   /* IOV_MAX */
+#include <errno.h>
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+#define UTSTRING_ROPE_IOV ((IOV_MAX < 64) ? IOV_MAX : 64)
+
+/* writes the rope to fd, up to 64 chunks per writev, and clears it; returns
+ * 0, or -1 (errno set) if a write fails, leaving what wasn't written */
+UTSTRING_UNUSED static int utstring_rope_flush(UT_string_rope *r, int fd) {
+   struct iovec iov[UTSTRING_ROPE_IOV];
+   UT_string_chunk *c = r->head;
+   size_t skip = 0, done;
+   ssize_t w;
+   int n;
+   while (c != NULL) {
+      UT_string_chunk *e = c;
+      for (n = 0; (e != NULL) && (n < UTSTRING_ROPE_IOV); e = e->next) {
+         if (e->i > ((e == c) ? skip : 0)) {
+            iov[n].iov_base = e->d + ((e == c) ? skip : 0);
+            iov[n].iov_len = e->i - ((e == c) ? skip : 0);
+            n++;
+         }
+      }
+      if (n == 0) {
+         break;
+      }
+      w = writev(fd, iov, n);
+      if (w < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         /* drop what was written, so a retry doesn't repeat it */
+         while (r->head != c) {
+            UT_string_chunk *next = r->head->next;
+            r->len -= r->head->i;
+            free(r->head);
+            r->head = next;
+         }
+         if (skip != 0) {
+            memmove(c->d, c->d + skip, c->i - skip);
+            c->i -= skip;
+            r->len -= skip;
+         }
+         return -1;
+      }
+      /* advance past the w bytes written, which may end mid-chunk */
+      for (done = (size_t)w; (c != NULL) && (done >= c->i - skip); c = c->next) {
+         done -= c->i - skip;
+         skip = 0;
+      }
+      skip += done;
+   }
+   utstring_rope_clear(r);
+   return 0;
+}
+#endif
+
 /*******************************************************************************
  * begin substring search functions                                            *
  ******************************************************************************/
@@ -314,6 +572,226 @@ UTSTRING_UNUSED static long _utstring_findR(
 }
 
 
+/* The fast searches test sixteen candidate positions at a time for the
+ * needle's first and last bytes (with SSE2 or NEON where available) and
+ * compare only the candidates that pass. For needles of UTSTRING_KMP_MIN
+ * bytes or more, if comparing costs much more than the scan (periodic text),
+ * they fall back to the KMP search, so the worst case stays linear. */
+#ifndef UTSTRING_KMP_MIN
+#define UTSTRING_KMP_MIN 32
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define UTSTRING_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UTSTRING_NEON 1
+#endif
+
+/* bit k is set if P_Text[k] is P_First and P_Text[k + P_NeedleLen - 1] is
+ * P_Last, for k from 0 to 15 */
+UTSTRING_UNUSED static unsigned _utstring_Mask16(
+    const char *P_Text,
+    size_t P_NeedleLen,
+    char P_First,
+    char P_Last)
+{
+#if defined(UTSTRING_SSE2)
+    __m128i V_First = _mm_loadu_si128((const __m128i *)P_Text);
+    __m128i V_Last = _mm_loadu_si128((const __m128i *)(P_Text + P_NeedleLen - 1));
+    return (unsigned)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(V_First, _mm_set1_epi8(P_First)),
+        _mm_cmpeq_epi8(V_Last, _mm_set1_epi8(P_Last))));
+#elif defined(UTSTRING_NEON)
+    static const unsigned char V_Weights[16] =
+        {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t V_Eq = vandq_u8(
+        vceqq_u8(vld1q_u8((const unsigned char *)P_Text), vdupq_n_u8((unsigned char)P_First)),
+        vceqq_u8(vld1q_u8((const unsigned char *)P_Text + P_NeedleLen - 1),
+                 vdupq_n_u8((unsigned char)P_Last)));
+    uint8x16_t V_Bits = vandq_u8(V_Eq, vld1q_u8(V_Weights));
+    return (unsigned)vaddv_u8(vget_low_u8(V_Bits)) |
+           ((unsigned)vaddv_u8(vget_high_u8(V_Bits)) << 8);
+#else
+    unsigned k, V_Mask = 0;
+    for (k = 0; k < 16; k++)
+    {
+        if ( (P_Text[k] == P_First) && (P_Text[k + P_NeedleLen - 1] == P_Last) )
+        {
+            V_Mask |= 1U << k;
+        }
+    }
+    return V_Mask;
+#endif
+}
+
+#if defined(__GNUC__)
+#define _utstring_LowBit(m) ((unsigned)__builtin_ctz(m))
+#define _utstring_HighBit(m) (31U - (unsigned)__builtin_clz(m))
+#else
+UTSTRING_UNUSED static unsigned _utstring_LowBit(unsigned m)
+{
+    unsigned k = 0;
+    while ( !(m & 1U) ) { m >>= 1; k++; }
+    return k;
+}
+UTSTRING_UNUSED static unsigned _utstring_HighBit(unsigned m)
+{
+    unsigned k = 0;
+    while (m >>= 1) { k++; }
+    return k;
+}
+#endif
+
+
+/* Search data from left to right, using the KMP table (which may be NULL for
+ * needles shorter than UTSTRING_KMP_MIN) only if the filter does badly. */
+UTSTRING_UNUSED static long _utstring_findFast(
+    const char *P_Haystack,
+    size_t P_HaystackLen,
+    const char *P_Needle,
+    size_t P_NeedleLen,
+    long *P_KMP_Table)
+{
+    size_t V_Pos = 0, V_Last, V_Work = 0;
+    unsigned V_Mask, k;
+    const char *V_Hit;
+    long *V_Table;
+    long V_FindPosition;
+
+    if ( (P_NeedleLen == 0) || (P_NeedleLen > P_HaystackLen) )
+    {
+        return -1;
+    }
+    if (P_NeedleLen == 1)
+    {
+        V_Hit = (const char *)memchr(P_Haystack, P_Needle[0], P_HaystackLen);
+        return (V_Hit != NULL) ? (long)(V_Hit - P_Haystack) : -1;
+    }
+    V_Last = P_HaystackLen - P_NeedleLen;   /* last possible start */
+    for (; V_Pos + 15 <= V_Last; V_Pos += 16)
+    {
+        V_Mask = _utstring_Mask16(P_Haystack + V_Pos, P_NeedleLen,
+                                  P_Needle[0], P_Needle[P_NeedleLen - 1]);
+        while (V_Mask != 0)
+        {
+            k = _utstring_LowBit(V_Mask);
+            if (memcmp(P_Haystack + V_Pos + k + 1, P_Needle + 1, P_NeedleLen - 2) == 0)
+            {
+                return (long)(V_Pos + k);
+            }
+            V_Mask &= V_Mask - 1;
+            V_Work += P_NeedleLen;
+        }
+        if ( (P_NeedleLen >= UTSTRING_KMP_MIN) && (V_Work > 4 * V_Pos + 4096) )
+        {
+            V_Table = P_KMP_Table;
+            if (V_Table == NULL)
+            {
+                V_Table = (long *)malloc(sizeof(long) * (P_NeedleLen + 1));
+                if (V_Table == NULL)
+                {
+                    continue;
+                }
+                _utstring_BuildTable(P_Needle, P_NeedleLen, V_Table);
+            }
+            V_FindPosition = _utstring_find(P_Haystack + V_Pos + 16,
+                                            P_HaystackLen - V_Pos - 16,
+                                            P_Needle, P_NeedleLen, V_Table);
+            if (V_Table != P_KMP_Table)
+            {
+                free(V_Table);
+            }
+            return (V_FindPosition >= 0) ? V_FindPosition + (long)(V_Pos + 16) : -1;
+        }
+    }
+    for (; V_Pos <= V_Last; V_Pos++)
+    {
+        if ( (P_Haystack[V_Pos] == P_Needle[0]) &&
+             (memcmp(P_Haystack + V_Pos + 1, P_Needle + 1, P_NeedleLen - 1) == 0) )
+        {
+            return (long)V_Pos;
+        }
+    }
+    return -1;
+}
+
+
+/* Search data from right to left, as _utstring_findFast. */
+UTSTRING_UNUSED static long _utstring_findRFast(
+    const char *P_Haystack,
+    size_t P_HaystackLen,
+    const char *P_Needle,
+    size_t P_NeedleLen,
+    long *P_KMP_Table)
+{
+    size_t V_Top, V_Work = 0, V_Scanned = 0;
+    unsigned V_Mask, k;
+    long *V_Table;
+    long V_FindPosition;
+
+    if ( (P_NeedleLen == 0) || (P_NeedleLen > P_HaystackLen) )
+    {
+        return -1;
+    }
+    /* candidate starts V_Top - 15 to V_Top, V_Top + 1 being the lowest done */
+    V_Top = P_HaystackLen - P_NeedleLen;
+    for (; (V_Top >= 15) && (P_NeedleLen > 1); V_Top -= 16, V_Scanned += 16)
+    {
+        V_Mask = _utstring_Mask16(P_Haystack + V_Top - 15, P_NeedleLen,
+                                  P_Needle[0], P_Needle[P_NeedleLen - 1]);
+        while (V_Mask != 0)
+        {
+            k = _utstring_HighBit(V_Mask);
+            if (memcmp(P_Haystack + V_Top - 15 + k + 1, P_Needle + 1, P_NeedleLen - 2) == 0)
+            {
+                return (long)(V_Top - 15 + k);
+            }
+            V_Mask &= ~(1U << k);
+            V_Work += P_NeedleLen;
+        }
+        if ( (P_NeedleLen >= UTSTRING_KMP_MIN) && (V_Work > 4 * V_Scanned + 4096) &&
+             (V_Top >= 16) )
+        {
+            V_Table = P_KMP_Table;
+            if (V_Table == NULL)
+            {
+                V_Table = (long *)malloc(sizeof(long) * (P_NeedleLen + 1));
+                if (V_Table == NULL)
+                {
+                    continue;
+                }
+                _utstring_BuildTableR(P_Needle, P_NeedleLen, V_Table);
+            }
+            V_FindPosition = _utstring_findR(P_Haystack, V_Top - 16 + P_NeedleLen,
+                                             P_Needle, P_NeedleLen, V_Table);
+            if (V_Table != P_KMP_Table)
+            {
+                free(V_Table);
+            }
+            return V_FindPosition;
+        }
+        if (V_Top < 16)
+        {
+            return -1;
+        }
+    }
+    for (;; V_Top--)
+    {
+        if ( (P_Haystack[V_Top] == P_Needle[0]) &&
+             (memcmp(P_Haystack + V_Top + 1, P_Needle + 1, P_NeedleLen - 1) == 0) )
+        {
+            return (long)V_Top;
+        }
+        if (V_Top == 0)
+        {
+            return -1;
+        }
+    }
+}
+
+
 /* Search data from left to right. ( One time search mode. ) */
 UTSTRING_UNUSED static long utstring_find(
     UT_string *s,
@@ -323,7 +801,6 @@ UTSTRING_UNUSED static long utstring_find(
 {
     long V_StartPosition;
     long V_HaystackLen;
-    long *V_KMP_Table;
     long V_FindPosition = -1;
 
     if (P_StartPosition < 0)
@@ -337,22 +814,14 @@ UTSTRING_UNUSED static long utstring_find(
     V_HaystackLen = s->i - V_StartPosition;
     if ( (V_HaystackLen >= (long) P_NeedleLen) && (P_NeedleLen > 0) )
     {
-        V_KMP_Table = (long *)malloc(sizeof(long) * (P_NeedleLen + 1));
-        if (V_KMP_Table != NULL)
-        {
-            _utstring_BuildTable(P_Needle, P_NeedleLen, V_KMP_Table);
-
-            V_FindPosition = _utstring_find(s->d + V_StartPosition,
+        V_FindPosition = _utstring_findFast(s->d + V_StartPosition,
                                             V_HaystackLen,
                                             P_Needle,
                                             P_NeedleLen,
-                                            V_KMP_Table);
-            if (V_FindPosition >= 0)
-            {
-                V_FindPosition += V_StartPosition;
-            }
-
-            free(V_KMP_Table);
+                                            NULL);
+        if (V_FindPosition >= 0)
+        {
+            V_FindPosition += V_StartPosition;
         }
     }
 
@@ -369,7 +838,6 @@ UTSTRING_UNUSED static long utstring_findR(
 {
     long V_StartPosition;
     long V_HaystackLen;
-    long *V_KMP_Table;
     long V_FindPosition = -1;
 
     if (P_StartPosition < 0)
@@ -383,22 +851,92 @@ UTSTRING_UNUSED static long utstring_findR(
     V_HaystackLen = V_StartPosition + 1;
     if ( (V_HaystackLen >= (long) P_NeedleLen) && (P_NeedleLen > 0) )
     {
-        V_KMP_Table = (long *)malloc(sizeof(long) * (P_NeedleLen + 1));
-        if (V_KMP_Table != NULL)
-        {
-            _utstring_BuildTableR(P_Needle, P_NeedleLen, V_KMP_Table);
-
-            V_FindPosition = _utstring_findR(s->d,
+        V_FindPosition = _utstring_findRFast(s->d,
                                              V_HaystackLen,
                                              P_Needle,
                                              P_NeedleLen,
-                                             V_KMP_Table);
+                                             NULL);
+    }
+
+    return V_FindPosition;
+}
+
 
-            free(V_KMP_Table);
+/* A needle prepared for repeated searches: the KMP tables of the fallback
+ * are built once, and only for needles of UTSTRING_KMP_MIN bytes or more.
+ * The needle bytes are not copied. */
+typedef struct {
+    const char *d;
+    size_t len;
+    long *kmp;   /* forward KMP table, or NULL */
+    long *kmpR;  /* reverse KMP table, or NULL */
+} UT_string_needle;
+
+UTSTRING_UNUSED static void utstring_needle_init(
+    UT_string_needle *P_Needle,
+    const char *P_Bytes,
+    size_t P_Len)
+{
+    P_Needle->d = P_Bytes;
+    P_Needle->len = P_Len;
+    P_Needle->kmp = NULL;
+    P_Needle->kmpR = NULL;
+    if (P_Len >= UTSTRING_KMP_MIN)
+    {
+        P_Needle->kmp = (long *)malloc(2 * sizeof(long) * (P_Len + 1));
+        if (P_Needle->kmp == NULL)
+        {
+            utstring_oom();
         }
+        P_Needle->kmpR = P_Needle->kmp + (P_Len + 1);
+        _utstring_BuildTable(P_Bytes, P_Len, P_Needle->kmp);
+        _utstring_BuildTableR(P_Bytes, P_Len, P_Needle->kmpR);
     }
+}
 
-    return V_FindPosition;
+UTSTRING_UNUSED static void utstring_needle_done(UT_string_needle *P_Needle)
+{
+    free(P_Needle->kmp);
+    P_Needle->kmp = NULL;
+    P_Needle->kmpR = NULL;
+}
+
+
+/* Search data from left to right. ( Prepared needle mode. ) */
+UTSTRING_UNUSED static long utstring_find_needle(
+    UT_string *s,
+    long P_StartPosition,   /* Start from 0. -1 means last position. */
+    const UT_string_needle *P_Needle)
+{
+    long V_StartPosition;
+    long V_FindPosition;
+
+    V_StartPosition = (P_StartPosition < 0) ? (long)s->i + P_StartPosition : P_StartPosition;
+    if ( (V_StartPosition < 0) || (V_StartPosition > (long)s->i) )
+    {
+        return -1;
+    }
+    V_FindPosition = _utstring_findFast(s->d + V_StartPosition, s->i - V_StartPosition,
+                                        P_Needle->d, P_Needle->len, P_Needle->kmp);
+    return (V_FindPosition >= 0) ? V_FindPosition + V_StartPosition : -1;
+}
+
+
+/* Search data from right to left. ( Prepared needle mode. ) */
+UTSTRING_UNUSED static long utstring_findR_needle(
+    UT_string *s,
+    long P_StartPosition,   /* Start from 0. -1 means last position. */
+    const UT_string_needle *P_Needle)
+{
+    long V_StartPosition;
+
+    V_StartPosition = (P_StartPosition < 0) ? (long)s->i + P_StartPosition : P_StartPosition;
+    if ( (V_StartPosition < 0) || (V_StartPosition >= (long)s->i) )
+    {
+        return -1;
+    }
+    return _utstring_findRFast(s->d, V_StartPosition + 1,
+                               P_Needle->d, P_Needle->len, P_Needle->kmpR);
 }
 /*******************************************************************************
  * end substring search functions                                              *
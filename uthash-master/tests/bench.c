@@ -0,0 +1,671 @@
+#include <stdlib.h>   /* malloc */
+#include <sys/time.h> /* gettimeofday */
+#include <stdio.h>    /* printf */
+#include <string.h>   /* strcmp */
+#include <stdint.h>   /* uint64_t */
+#include <math.h>     /* exp, log */
+#include "uthash.h"
+#include "utarray.h"
+#include "utlist.h"
+#include "utringbuffer.h"
+#include "utstring.h"
+#include "utstack.h"
+#include "utmap.h"
+
+/* Times the operations of every container in the family over a range of
+ * sizes and key distributions, and prints one comma-separated line per
+ * (container, op, dist, n): nanoseconds per operation, the best of the
+ * rounds. Each round repeats a case until it has done at least MIN_OPS
+ * operations, so that small sizes are timed over more than a few
+ * microseconds. `make bench` builds it with -O2 and runs it.
+ *
+ * Distributions: seq (keys 0..n-1, visited in order), random (distinct
+ * random 64-bit keys, visited in a random order), zipf (the same keys,
+ * looked up with a Zipf-like skew, s = 1, so a few are hot), and str8,
+ * str32, str128 (distinct strings of that length, visited at random). A
+ * container is run on the distributions that make sense for it; the ring
+ * buffer and the stack take none ("-").
+ *
+ * usage: bench [-r rounds] [-n sizes] [-d dists] [-c containers]
+ * with comma-separated lists, sizes with an optional K or M suffix, e.g.
+ *   bench -n 1K,1M,100M -d random,zipf -c hash,array
+ * The default is -r 3 -n 1K,10K,100K,1M, every dist and every container
+ * (hash, map, array, list, ringbuffer, string, stack). The items of a hash
+ * are about 80 bytes each: 100M of them need 8 GB and more. */
+
+#define MIN_OPS 1000000U
+#define RB_CAPACITY 1024U
+#define RB_BATCH 64U
+
+enum dist { SEQ, RANDOM, ZIPF, STR8, STR32, STR128, NONE, NDISTS };
+static const char *dist_names[NDISTS] = {
+    "seq", "random", "zipf", "str8", "str32", "str128", "-"
+};
+static const unsigned str_lens[NDISTS] = { 0, 0, 0, 8, 32, 128, 0 };
+
+#define MAX_OPS 8
+typedef struct result {
+    const char *op[MAX_OPS];
+    double secs[MAX_OPS];   /* summed over the repetitions of a round */
+    double ops[MAX_OPS];
+    unsigned nops;
+} result;
+
+typedef struct keyset {
+    unsigned n;
+    enum dist d;
+    unsigned keylen;
+    uint64_t *ints;         /* int keys; miss keys at ints + n */
+    char *strs;             /* string keys, keylen apart; misses after them */
+    unsigned *order;        /* the visiting order of lookups */
+    unsigned *perm;         /* a permutation, for adds and deletes */
+} keyset;
+
+static double elapsed(struct timeval *tv1)
+{
+    struct timeval tv2;
+    gettimeofday(&tv2, NULL);
+    return (tv2.tv_sec - tv1->tv_sec) + (tv2.tv_usec - tv1->tv_usec) * 1e-6;
+}
+
+static void record(result *r, const char *op, double secs, double ops)
+{
+    unsigned i;
+    for (i = 0; (i < r->nops) && (strcmp(r->op[i], op) != 0); i++) {
+    }
+    if (i == r->nops) {
+        r->op[r->nops++] = op;
+    }
+    r->secs[i] += secs;
+    r->ops[i] += ops;
+}
+
+static void *xmalloc(size_t sz)
+{
+    void *p = malloc(sz ? sz : 1U);
+    if (p == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(-1);
+    }
+    return p;
+}
+
+/* splitmix64: a bijection, so distinct inputs give distinct keys */
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t rng_state = 1;
+static uint64_t rng(void)
+{
+    return mix64(rng_state++);
+}
+
+/* 0..n-1 with P(k) about proportional to 1/(k+1): inverts the continuous
+ * CDF ln(1+x)/ln(1+n), which is near enough for a benchmark and needs no
+ * table (so it works at 100M) */
+static unsigned zipf(unsigned n)
+{
+    double u = (double)(rng() >> 11) * (1.0 / 9007199254740992.0);
+    unsigned k = (unsigned)(exp(u * log((double)n + 1.0)) - 1.0);
+    return (k < n) ? k : n - 1U;
+}
+
+static void shuffle(unsigned *a, unsigned n)
+{
+    unsigned i, j, t;
+    for (i = n; i > 1U; i--) {
+        j = (unsigned)(rng() % i);
+        t = a[i - 1U];
+        a[i - 1U] = a[j];
+        a[j] = t;
+    }
+}
+
+static void make_keys(keyset *ks, unsigned n, enum dist d)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned i, j;
+    uint64_t v;
+    char *s;
+
+    memset(ks, 0, sizeof(*ks));
+    ks->n = n;
+    ks->d = d;
+    ks->keylen = str_lens[d] ? str_lens[d] : (unsigned)sizeof(uint64_t);
+    ks->order = (unsigned*)xmalloc(n * sizeof(unsigned));
+    ks->perm = (unsigned*)xmalloc(n * sizeof(unsigned));
+    for (i = 0; i < n; i++) {
+        ks->perm[i] = i;
+    }
+    if (d != SEQ) {
+        shuffle(ks->perm, n);
+    }
+    for (i = 0; i < n; i++) {
+        ks->order[i] = (d == SEQ) ? i : (d == ZIPF) ? zipf(n) : ks->perm[i];
+    }
+    if (str_lens[d] == 0U) {
+        ks->ints = (uint64_t*)xmalloc(2U * (size_t)n * sizeof(uint64_t));
+        for (i = 0; i < n; i++) {
+            /* hits have the top bit clear, misses set */
+            ks->ints[i] = (d == SEQ) ? i : (mix64(i) >> 1);
+            ks->ints[n + i] = (d == SEQ) ? (uint64_t)n + i : (mix64(i) | (1ULL << 63));
+        }
+    } else {
+        /* the hex digits of a distinct number, then filler; misses start
+         * with a character no hit starts with */
+        ks->strs = (char*)xmalloc(2U * (size_t)n * ks->keylen);
+        for (i = 0; i < 2U * n; i++) {
+            s = ks->strs + (size_t)i * ks->keylen;
+            v = mix64(i % n);
+            for (j = 0; j < ks->keylen; j++) {
+                s[j] = (j < 16U) ? hex[(v >> (4U * j)) & 15U] : (char)('g' + j % 20U);
+            }
+            if (i >= n) {
+                s[0] = '~';
+            }
+        }
+    }
+}
+
+static void free_keys(keyset *ks)
+{
+    free(ks->ints);
+    free(ks->strs);
+    free(ks->order);
+    free(ks->perm);
+}
+
+static const void *key_at(const keyset *ks, unsigned i)
+{
+    return ks->ints ? (const void*)&ks->ints[i]
+                    : (const void*)(ks->strs + (size_t)i * ks->keylen);
+}
+
+/* uthash: add, find hits and misses, a mix, iteration and deletion */
+typedef struct hitem {
+    const void *key;
+    UT_hash_handle hh;
+} hitem;
+
+static void bench_hash(const keyset *ks, result *r)
+{
+    hitem *items, *head = NULL, *it, *tmp;
+    unsigned i, live, n = ks->n, len = ks->keylen;
+    unsigned char *in;
+    unsigned long hits = 0;
+    struct timeval tv;
+
+    items = (hitem*)xmalloc(n * sizeof(hitem));
+    in = (unsigned char*)xmalloc(n);
+    for (i = 0; i < n; i++) {
+        items[i].key = key_at(ks, i);
+    }
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        it = &items[ks->perm[i]];
+        HASH_ADD_KEYPTR(hh, head, it->key, len, it);
+    }
+    record(r, "add", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        HASH_FIND(hh, head, key_at(ks, ks->order[i]), len, it);
+        hits += (it != NULL);
+    }
+    record(r, "find_hit", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        HASH_FIND(hh, head, key_at(ks, n + ks->order[i]), len, it);
+        hits += (it != NULL);
+    }
+    record(r, "find_miss", elapsed(&tv), n);
+
+    /* nine finds to one delete, or re-add of a key deleted before */
+    memset(in, 1, n);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        unsigned k = ks->order[i];
+        if (i % 10U == 9U) {
+            it = &items[k];
+            if (in[k]) {
+                HASH_DELETE(hh, head, it);
+            } else {
+                HASH_ADD_KEYPTR(hh, head, it->key, len, it);
+            }
+            in[k] ^= 1U;
+        } else {
+            HASH_FIND(hh, head, key_at(ks, k), len, it);
+            hits += (it != NULL);
+        }
+    }
+    record(r, "mixed", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    i = 0;
+    HASH_ITER(hh, head, it, tmp) {
+        i++;
+    }
+    record(r, "iter", elapsed(&tv), i);
+
+    live = HASH_CNT(hh, head);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        if (in[ks->perm[i]]) {
+            HASH_DELETE(hh, head, &items[ks->perm[i]]);
+        }
+    }
+    record(r, "delete", elapsed(&tv), live);
+    if ((head != NULL) || (hits == 0U)) {
+        fprintf(stderr, "hash: inconsistent\n");
+    }
+    free(in);
+    free(items);
+}
+
+/* utmap: the same operations as the hash, with the keys copied into the
+ * map and the key's index as the value */
+static void bench_map(const keyset *ks, result *r)
+{
+    UT_map m;
+    unsigned i, live, n = ks->n, *v;
+    unsigned char *in;
+    unsigned long hits = 0;
+    struct timeval tv;
+    void *e;
+
+    in = (unsigned char*)xmalloc(n);
+    utmap_init(&m, ks->keylen, sizeof(unsigned));
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utmap_put(&m, key_at(ks, ks->perm[i]), &ks->perm[i]);
+    }
+    record(r, "add", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        v = (unsigned*)utmap_find(&m, key_at(ks, ks->order[i]));
+        hits += (v != NULL);
+    }
+    record(r, "find_hit", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        v = (unsigned*)utmap_find(&m, key_at(ks, n + ks->order[i]));
+        hits += (v != NULL);
+    }
+    record(r, "find_miss", elapsed(&tv), n);
+
+    memset(in, 1, n);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        unsigned k = ks->order[i];
+        if (i % 10U == 9U) {
+            if (in[k]) {
+                utmap_del(&m, key_at(ks, k));
+            } else {
+                utmap_put(&m, key_at(ks, k), &k);
+            }
+            in[k] ^= 1U;
+        } else {
+            v = (unsigned*)utmap_find(&m, key_at(ks, k));
+            hits += (v != NULL);
+        }
+    }
+    record(r, "mixed", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    i = 0;
+    for (e = utmap_next(&m, NULL); e != NULL; e = utmap_next(&m, e)) {
+        i += (*(unsigned*)utmap_val(&m, e) < n);
+    }
+    record(r, "iter", elapsed(&tv), i);
+
+    live = (unsigned)utmap_len(&m);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        if (in[ks->perm[i]]) {
+            utmap_del(&m, key_at(ks, ks->perm[i]));
+        }
+    }
+    record(r, "delete", elapsed(&tv), live);
+    if ((utmap_len(&m) != 0U) || (hits == 0U)) {
+        fprintf(stderr, "map: inconsistent\n");
+    }
+    utmap_done(&m);
+    free(in);
+}
+
+/* utarray: push, random-access reads, iteration, sort, pop */
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+static const UT_icd u64_icd = { sizeof(uint64_t), NULL, NULL, NULL };
+
+static void bench_array(const keyset *ks, result *r)
+{
+    UT_array *a;
+    unsigned i, n = ks->n;
+    uint64_t sum = 0, *p;
+    struct timeval tv;
+
+    utarray_new(a, &u64_icd);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utarray_push_back(a, &ks->ints[ks->perm[i]]);
+    }
+    record(r, "push", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        sum += *(uint64_t*)utarray_eltptr(a, ks->order[i]);
+    }
+    record(r, "index", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (p = NULL; (p = (uint64_t*)utarray_next(a, p)) != NULL;) {
+        sum += *p;
+    }
+    record(r, "iter", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    utarray_sort(a, cmp_u64);
+    record(r, "sort", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utarray_pop_back(a);
+    }
+    record(r, "pop", elapsed(&tv), n);
+    if ((utarray_len(a) != 0U) || (sum == 1U)) {
+        fprintf(stderr, "array: inconsistent\n");
+    }
+    utarray_free(a);
+}
+
+/* utlist (doubly-linked): append, iteration, sort, delete in key order */
+typedef struct lnode {
+    uint64_t v;
+    struct lnode *prev, *next;
+} lnode;
+
+static int cmp_lnode(lnode *a, lnode *b)
+{
+    return (a->v < b->v) ? -1 : (a->v > b->v);
+}
+
+static void bench_list(const keyset *ks, result *r)
+{
+    lnode *nodes, *head = NULL, *el;
+    unsigned i, n = ks->n;
+    uint64_t sum = 0;
+    struct timeval tv;
+
+    nodes = (lnode*)xmalloc(n * sizeof(lnode));
+    for (i = 0; i < n; i++) {
+        nodes[i].v = ks->ints[i];
+    }
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        DL_APPEND(head, &nodes[ks->perm[i]]);
+    }
+    record(r, "append", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    DL_FOREACH(head, el) {
+        sum += el->v;
+    }
+    record(r, "iter", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    DL_SORT(head, cmp_lnode);
+    record(r, "sort", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        DL_DELETE(head, &nodes[ks->perm[i]]);
+    }
+    record(r, "delete", elapsed(&tv), n);
+    if ((head != NULL) || (sum == 1U)) {
+        fprintf(stderr, "list: inconsistent\n");
+    }
+    free(nodes);
+}
+
+/* utringbuffer of ints: single pushes into a full ring, batches of pushes,
+ * batches of pops */
+static void bench_ringbuffer(const keyset *ks, result *r)
+{
+    UT_ringbuffer *rb;
+    unsigned i, n = ks->n;
+    int batch[RB_BATCH], out[RB_BATCH];
+    double pop = 0.0;
+    struct timeval tv;
+
+    for (i = 0; i < RB_BATCH; i++) {
+        batch[i] = (int)i;
+    }
+    utringbuffer_new(rb, RB_CAPACITY, &ut_int_icd);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        int v = (int)i;
+        utringbuffer_push_back(rb, &v);
+    }
+    record(r, "push", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i += RB_BATCH) {
+        utringbuffer_push_back_n(rb, batch, RB_BATCH);
+    }
+    record(r, "push_n", elapsed(&tv), (n + RB_BATCH - 1U) / RB_BATCH * RB_BATCH);
+
+    for (i = 0; i < n; i += RB_CAPACITY) {
+        utringbuffer_clear(rb);
+        while (!utringbuffer_full(rb)) {
+            utringbuffer_push_back_n(rb, batch, RB_BATCH);
+        }
+        gettimeofday(&tv, NULL);
+        while (!utringbuffer_empty(rb)) {
+            utringbuffer_pop_front_n(rb, RB_BATCH, out);
+        }
+        pop += elapsed(&tv);
+    }
+    record(r, "pop_n", pop, (n + RB_CAPACITY - 1U) / RB_CAPACITY * RB_CAPACITY);
+    utringbuffer_free(rb);
+}
+
+/* utstring: appends of keylen bytes to a UT_string and to a rope, and
+ * small printfs */
+static void bench_string(const keyset *ks, result *r)
+{
+    UT_string *s;
+    UT_string_rope rope;
+    unsigned i, n = ks->n, len = ks->keylen;
+    struct timeval tv;
+
+    utstring_new(s);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utstring_bincpy(s, key_at(ks, ks->order[i]), len);
+    }
+    record(r, "bincpy", elapsed(&tv), n);
+
+    utstring_rope_init(&rope, 0);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utstring_rope_bincpy(&rope, key_at(ks, ks->order[i]), len);
+    }
+    record(r, "rope_bincpy", elapsed(&tv), n);
+    if (utstring_rope_len(&rope) != utstring_len(s)) {
+        fprintf(stderr, "string: inconsistent\n");
+    }
+    utstring_rope_done(&rope);
+
+    utstring_clear(s);
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        utstring_printf(s, "%u,", ks->order[i]);
+    }
+    record(r, "printf", elapsed(&tv), n);
+    utstring_free(s);
+}
+
+/* utstack: push and pop */
+typedef struct snode {
+    struct snode *next;
+} snode;
+
+static void bench_stack(const keyset *ks, result *r)
+{
+    snode *nodes, *top = NULL, *el;
+    unsigned i, n = ks->n;
+    struct timeval tv;
+
+    nodes = (snode*)xmalloc(n * sizeof(snode));
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        STACK_PUSH(top, &nodes[i]);
+    }
+    record(r, "push", elapsed(&tv), n);
+
+    gettimeofday(&tv, NULL);
+    for (i = 0; i < n; i++) {
+        STACK_POP(top, el);
+    }
+    record(r, "pop", elapsed(&tv), n);
+    if ((top != NULL) || (el != &nodes[0])) {
+        fprintf(stderr, "stack: inconsistent\n");
+    }
+    free(nodes);
+}
+
+typedef struct container {
+    const char *name;
+    void (*run)(const keyset *ks, result *r);
+    unsigned dists;         /* bit d set: run on dist d */
+} container;
+
+#define D(d) (1U << (d))
+static const container containers[] = {
+    { "hash", bench_hash, D(SEQ) | D(RANDOM) | D(ZIPF) | D(STR8) | D(STR32) | D(STR128) },
+    { "map", bench_map, D(SEQ) | D(RANDOM) | D(ZIPF) | D(STR8) | D(STR32) | D(STR128) },
+    { "array", bench_array, D(SEQ) | D(RANDOM) | D(ZIPF) },
+    { "list", bench_list, D(SEQ) | D(RANDOM) },
+    { "ringbuffer", bench_ringbuffer, D(NONE) },
+    { "string", bench_string, D(STR8) | D(STR32) | D(STR128) },
+    { "stack", bench_stack, D(NONE) },
+};
+#define NCONTAINERS (sizeof(containers) / sizeof(containers[0]))
+
+/* is name in the comma-separated list (NULL: everything is) */
+static int listed(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+    if (list == NULL) {
+        return 1;
+    }
+    while ((p = strstr(p, name)) != NULL) {
+        if (((p == list) || (p[-1] == ',')) && ((p[len] == ',') || (p[len] == '\0'))) {
+            return 1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+static unsigned parse_sizes(const char *list, unsigned *sizes, unsigned max)
+{
+    unsigned num = 0;
+    char *end;
+    unsigned long v;
+    while ((*list != '\0') && (num < max)) {
+        v = strtoul(list, &end, 10);
+        if ((*end == 'K') || (*end == 'k')) {
+            v *= 1000UL;
+            end++;
+        } else if ((*end == 'M') || (*end == 'm')) {
+            v *= 1000000UL;
+            end++;
+        }
+        if ((end == list) || (v == 0UL) || (v > 0xFFFFFFFFUL) ||
+            ((*end != ',') && (*end != '\0'))) {
+            return 0;
+        }
+        sizes[num++] = (unsigned)v;
+        list = (*end == ',') ? end + 1 : end;
+    }
+    return num;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned sizes[32] = { 1000U, 10000U, 100000U, 1000000U };
+    unsigned nsizes = 4, rounds = 3, reps, si, c, d, rd, rp, i;
+    const char *dists = NULL, *names = NULL;
+    double best[MAX_OPS];
+    result res;
+    keyset ks;
+    int argi;
+
+    for (argi = 1; argi + 1 < argc; argi += 2) {
+        if (strcmp(argv[argi], "-r") == 0) {
+            rounds = (unsigned)atoi(argv[argi + 1]);
+        } else if (strcmp(argv[argi], "-n") == 0) {
+            nsizes = parse_sizes(argv[argi + 1], sizes, 32U);
+        } else if (strcmp(argv[argi], "-d") == 0) {
+            dists = argv[argi + 1];
+        } else if (strcmp(argv[argi], "-c") == 0) {
+            names = argv[argi + 1];
+        } else {
+            break;
+        }
+    }
+    if ((argi != argc) || (rounds == 0U) || (nsizes == 0U)) {
+        fprintf(stderr, "usage: %s [-r rounds] [-n sizes] [-d dists] [-c containers]\n",
+                argv[0]);
+        return -1;
+    }
+
+    printf("container,op,dist,n,ns_per_op\n");
+    for (c = 0; c < NCONTAINERS; c++) {
+        if (!listed(names, containers[c].name)) {
+            continue;
+        }
+        for (d = 0; d < NDISTS; d++) {
+            if (!(containers[c].dists & D(d)) ||
+                ((d != NONE) && !listed(dists, dist_names[d]))) {
+                continue;
+            }
+            for (si = 0; si < nsizes; si++) {
+                make_keys(&ks, sizes[si], (enum dist)d);
+                reps = (sizes[si] < MIN_OPS) ? (MIN_OPS + sizes[si] - 1U) / sizes[si] : 1U;
+                for (rd = 0; rd < rounds; rd++) {
+                    memset(&res, 0, sizeof(res));
+                    for (rp = 0; rp < reps; rp++) {
+                        containers[c].run(&ks, &res);
+                    }
+                    for (i = 0; i < res.nops; i++) {
+                        double ns = res.secs[i] * 1e9 / res.ops[i];
+                        best[i] = ((rd == 0U) || (ns < best[i])) ? ns : best[i];
+                    }
+                }
+                for (i = 0; i < res.nops; i++) {
+                    printf("%s,%s,%s,%u,%.2f\n", containers[c].name, res.op[i],
+                           dist_names[d], sizes[si], best[i]);
+                }
+                fflush(stdout);
+                free_keys(&ks);
+            }
+        }
+    }
+    return 0;
+}
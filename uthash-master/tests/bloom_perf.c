@@ -21,6 +21,10 @@ int main(int argc,char *argv[])
     char linebuf[BUFLEN];
     FILE *file;
     int i=0,j,nloops=3,loopnum=0,miss;
+#ifdef HASH_BLOOM
+    unsigned hashv;
+    int misses,bloom_fp;
+#endif
     struct timeval tv1,tv2;
     long elapsed_usec;
     if (argc > 1) {
@@ -75,6 +79,28 @@ again:
     if (++loopnum < nloops) {
         goto again;
     }
+#ifdef HASH_BLOOM
+    /* false positives: lookups that missed, yet got past the filter */
+    if (fseek(file,0,SEEK_SET) == -1) {
+        fprintf(stderr,"fseek failed: %s\n", strerror(errno));
+    }
+    misses=0;
+    bloom_fp=0;
+    while (fgets(linebuf,BUFLEN,file) != NULL) {
+        linebuf[0]++;
+        if (linebuf[1] != '\0') {
+            linebuf[1]++;
+        }
+        HASH_FIND_STR(names,linebuf,name);
+        if (!name) {
+            misses++;
+            HASH_VALUE(linebuf, strlen(linebuf), hashv);
+            bloom_fp += HASH_BLOOM_TEST(names->hh.tbl, hashv) ? 1 : 0;
+        }
+    }
+    printf("bloom filter passed %d of %d misses (%.2f%% false positives)\n",
+           bloom_fp, misses, bloom_fp*100.0/misses);
+#endif
     fclose(file);
 
     return 0;
@@ -6,6 +6,7 @@ cc -I../src  -O3 -Wall   -m64    bloom_perf.c   -o bloom_perf.none
 for bits in $BITS
 do
 cc -I../src  -DHASH_BLOOM=$bits -O3 -Wall   -m64    bloom_perf.c   -o bloom_perf.$bits
+cc -I../src  -DHASH_BLOOM=$bits -DHASH_BLOOM_BLOCKED=1 -O3 -Wall   -m64    bloom_perf.c   -o bloom_perf.$bits.blocked
 done
 
 for bits in none $BITS
@@ -13,5 +14,10 @@ do
 echo
 echo "using $bits-bit filter:"
 ./bloom_perf.$bits 10
+if [ "$bits" != none ]; then
+echo
+echo "using $bits-bit blocked filter:"
+./bloom_perf.$bits.blocked 10
+fi
 done
 
@@ -0,0 +1,130 @@
+#include <stdlib.h>   /* malloc */
+#include <sys/time.h> /* gettimeofday */
+#include <stdio.h>    /* printf */
+#include <string.h>   /* strcmp */
+#include "uthash.h"
+
+/* Benchmarks the HASH_FUNCTION it is built with on a file of keys, each an
+ * unsigned length followed by that many bytes (as written by emit_keys or
+ * hashscan -k). The Makefile builds one hashbench.XXX per hash function and
+ * the hashbench script runs them all. Prints one line of comma-separated
+ * values: function, ideal fraction, items, buckets, duplicates, noexpand,
+ * longest chain, nanoseconds per add and per find (best of the rounds),
+ * and HASH_OVERHEAD in bytes. usage: hashbench.XXX [-r rounds] keyfile */
+
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+typedef struct key_rec {
+    UT_hash_handle hh;
+} key_rec;
+
+static double elapsed(struct timeval *tv1)
+{
+    struct timeval tv2;
+    gettimeofday(&tv2, NULL);
+    return (tv2.tv_sec - tv1->tv_sec) + (tv2.tv_usec - tv1->tv_usec) * 1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+    key_rec *recs, *hash = NULL, *found;
+    char **keys = NULL, *buf;
+    unsigned *lens = NULL, keylen, n = 0, max = 0, uniq = 0, i, r, rounds = 5;
+    unsigned long misses = 0;
+    double add = 0, find = 0, t;
+    struct timeval tv;
+    UT_hash_stats st;
+    FILE *file;
+    int argi = 1;
+
+    if ((argc > 3) && (strcmp(argv[1], "-r") == 0)) {
+        rounds = (unsigned)atoi(argv[2]);
+        argi = 3;
+    }
+    if ((argi != argc - 1) || (rounds == 0)) {
+        fprintf(stderr, "usage: %s [-r rounds] keyfile\n", argv[0]);
+        return -1;
+    }
+    if ((file = fopen(argv[argi], "rb")) == NULL) {
+        perror("can't open: ");
+        return -1;
+    }
+    while (fread(&keylen, sizeof(keylen), 1, file) == 1) {
+        if (n == max) {
+            max = max ? 2 * max : 1024;
+            keys = (char**)realloc(keys, max * sizeof(char*));
+            lens = (unsigned*)realloc(lens, max * sizeof(unsigned));
+            if ((keys == NULL) || (lens == NULL)) {
+                exit(-1);
+            }
+        }
+        if (((buf = (char*)malloc(keylen ? keylen : 1)) == NULL) ||
+            (fread(buf, 1, keylen, file) != keylen)) {
+            fprintf(stderr, "truncated key file\n");
+            return -1;
+        }
+        keys[n] = buf;
+        lens[n++] = keylen;
+    }
+    fclose(file);
+    if (n == 0) {
+        fprintf(stderr, "no keys\n");
+        return -1;
+    }
+
+    /* drop the duplicates, so each round adds the same set of unique keys */
+    recs = (key_rec*)malloc(n * sizeof(key_rec));
+    if (recs == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < n; i++) {
+        HASH_FIND(hh, hash, keys[i], lens[i], found);
+        if (found == NULL) {
+            keys[uniq] = keys[i];
+            lens[uniq] = lens[i];
+            HASH_ADD_KEYPTR(hh, hash, keys[uniq], lens[uniq], &recs[uniq]);
+            uniq++;
+        } else {
+            free(keys[i]);
+        }
+    }
+    HASH_CLEAR(hh, hash);
+
+    for (r = 0; r < rounds; r++) {
+        gettimeofday(&tv, NULL);
+        for (i = 0; i < uniq; i++) {
+            HASH_ADD_KEYPTR(hh, hash, keys[i], lens[i], &recs[i]);
+        }
+        t = elapsed(&tv);
+        add = (r == 0 || t < add) ? t : add;
+        gettimeofday(&tv, NULL);
+        for (i = 0; i < uniq; i++) {
+            HASH_FIND(hh, hash, keys[i], lens[i], found);
+            misses += (found == NULL);
+        }
+        t = elapsed(&tv);
+        find = (r == 0 || t < find) ? t : find;
+        if (r + 1 < rounds) {
+            HASH_CLEAR(hh, hash);
+        }
+    }
+    if (misses != 0) {
+        fprintf(stderr, "%lu keys not found\n", misses);
+        return -1;
+    }
+
+    HASH_STATS(hh, hash, &st);
+    printf("%s,%f,%u,%u,%u,%u,%u,%.1f,%.1f,%lu\n", XSTR(HASH_FUNCTION) + 5,
+           (double)(st.num_items - st.nonideal_items) / st.num_items,
+           st.num_items, st.num_buckets, n - uniq, st.noexpand, st.max_chain,
+           add * 1e9 / uniq, find * 1e9 / uniq, (unsigned long)st.overhead);
+    HASH_CLEAR(hh, hash);
+    for (i = 0; i < uniq; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    free(lens);
+    free(recs);
+    return 0;
+}
@@ -32,6 +32,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/ptrace.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <assert.h>
 
 #ifdef __FreeBSD__
@@ -65,6 +66,16 @@ typedef struct {
 const uint32_t sig = HASH_SIGNATURE;
 int verbose=0;
 int getkeys=0;
+unsigned profile_ms=0;   /* -p: sampling period; 0 for a one-shot scan */
+unsigned num_samples=0;  /* -n: samples to take; 0 for no limit */
+unsigned rescan_every=10;/* -r: look for new tables every this many samples */
+unsigned chain_flag=2*HASH_BKT_CAPACITY_THRESH; /* -c: flag chains this long */
+
+/* peer addresses of the signatures found by the last scan */
+char **tables=NULL;
+unsigned num_tables=0, max_tables=0;
+
+#define SCAN_CHUNK (1024*1024) /* bytes of peer memory read at a time */
 
 #define vv(...)  do {if (verbose>0) printf(__VA_ARGS__);} while(0)
 #define vvv(...) do {if (verbose>1) printf(__VA_ARGS__);} while(0)
@@ -138,13 +149,9 @@ static int read_mem(void *dst, pid_t pid, void *start, size_t len)
 #else
 static int read_mem(void *dst, int fd, off_t start, size_t len)
 {
-    int rc;
+    ssize_t rc=0;
     size_t bytes_read=0;
-    if (lseek(fd, start, SEEK_SET) == (off_t)-1) {
-        fprintf(stderr, "lseek failed: %s\n", strerror(errno));
-        return -1;
-    }
-    while ( len && ((rc=read(fd, (char*)dst+bytes_read, len)) > 0)) {
+    while ( len && ((rc=pread(fd, (char*)dst+bytes_read, len, start+bytes_read)) > 0)) {
         len -= rc;
         bytes_read += rc;
     }
@@ -152,7 +159,8 @@ static int read_mem(void *dst, int fd, off_t start, size_t len)
         vv("read_mem failed (%s)\n",strerror(errno));
     }
     if ((len != 0 && rc >= 0)) {
-        vv("INTERNAL ERROR\n");
+        vv("short read of peer memory\n");
+        return -1;
     }
     return (rc == -1) ? -1 : 0;
 }
@@ -164,6 +172,31 @@ static char *tbl_from_sig_addr(char *sig)
     return (sig - offsetof(UT_hash_table,signature));
 }
 
+static void add_table(char *peer_sig)
+{
+    if (num_tables == max_tables) {
+        max_tables = max_tables ? 2*max_tables : 16;
+        tables = (char**)realloc(tables, max_tables * sizeof(char*));
+        if (tables == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(-1);
+        }
+    }
+    tables[num_tables++] = peer_sig;
+}
+
+static void print_header(void)
+{
+    /*
+    Address            ideal    items  buckets mc fl bloom   sat fcn keys saved to
+    ------------------ ----- -------- -------- -- -- ----- ----- --- -------------
+    0x10aa4090           98% 10000000 32000000 10 ok             BER /tmp/9110-0.key
+    0x10abcdef          100% 10000000 32000000  9 NX    27   12% BER /tmp/9110-1.key
+    */
+    printf("Address            ideal    items  buckets mc fl bloom   sat fcn keys saved to\n");
+    printf("------------------ ----- -------- -------- -- -- ----- ----- --- -------------\n");
+}
+
 #define HS_BIT_TEST(v,i) (v[i/8] & (1U << (i%8)))
 static void found(int fd, char* peer_sig, pid_t pid)
 {
@@ -258,7 +291,7 @@ static void found(int fd, char* peer_sig, pid_t pid)
             peer_hh = (char*)hh.hh_next;
             peer_key = (const char*)(hh.key);
             /* malloc space to read the key, and read it */
-            if ( (key = (char*)malloc(sizeof(hh.keylen))) == NULL) {
+            if ( (key = (char*)malloc(hh.keylen ? hh.keylen : 1U)) == NULL) {
                 fprintf(stderr, "out of memory\n");
                 exit(-1);
             }
@@ -341,14 +374,6 @@ static void found(int fd, char* peer_sig, pid_t pid)
     }
     hash_fcn = hash_fcns[hash_fcn_winner];
 
-    /*
-    Address            ideal    items  buckets mc fl bloom   sat fcn keys saved to
-    ------------------ ----- -------- -------- -- -- ----- ----- --- -------------
-    0x10aa4090           98% 10000000 32000000 10 ok             BER /tmp/9110-0.key
-    0x10abcdef          100% 10000000 32000000  9 NX    27   12% BER /tmp/9110-1.key
-    */
-    printf("Address            ideal    items  buckets mc fl bloom   sat fcn keys saved to\n");
-    printf("------------------ ----- -------- -------- -- -- ----- ----- --- -------------\n");
     if (has_bloom_filter_fields) {
         printf("%-18p %4.0f%% %8u %8u %2u %2s %5u %4.0f%c %3s %s\n",
                (void*)peer_tbl,
@@ -439,7 +464,7 @@ static void sigscan(pid_t pid, void *start, void *end, uint32_t sig)
         /* iterate over the the page using the signature size and look for the sig */
         for (pos = buf; pos < (buf + page_size); pos += sizeof(sig)) {
             if (*(uint32_t *) pos == sig) {
-                found(pid, (char *) io_desc.piod_offs + (pos - buf), pid);
+                add_table((char *) io_desc.piod_offs + (pos - buf));
             }
         }
 
@@ -459,31 +484,32 @@ static void sigscan(pid_t pid, void *start, void *end, uint32_t sig)
     }
 }
 #else
-static void sigscan(int fd, off_t start, off_t end, uint32_t sig, pid_t pid)
+static void sigscan(int fd, off_t start, off_t end, uint32_t sig)
 {
-    int rlen;
-    uint32_t u;
-    off_t at=0;
+    static uint32_t *buf=NULL;
+    ssize_t rlen;
+    size_t i, len;
+    off_t at;
 
-    if (lseek(fd, start, SEEK_SET) == (off_t)-1) {
-        fprintf(stderr, "lseek failed: %s\n", strerror(errno));
-        return;
+    if ((buf == NULL) && ((buf = (uint32_t*)malloc(SCAN_CHUNK)) == NULL)) {
+        fprintf(stderr, "out of memory\n");
+        exit(-1);
     }
-
-    while ( (rlen = read(fd,&u,sizeof(u))) == sizeof(u)) {
-        if (!memcmp(&u,&sig,sizeof(u))) {
-            found(fd, (char*)(start+at),pid);
+    /* read the area a chunk at a time; a chunk that can't be read whole is
+     * scanned as far as it could be read, then skipped */
+    for (at = start; at < end; at += SCAN_CHUNK) {
+        len = ((end - at) < SCAN_CHUNK) ? (size_t)(end - at) : SCAN_CHUNK;
+        rlen = pread(fd, buf, len, at);
+        if (rlen <= 0) {
+            vvv("can't read %p-%p\n", (void*)at, (void*)(at+len));
+            continue;
         }
-        at += sizeof(u);
-        if ((off_t)(at + sizeof(u)) > end-start) {
-            break;
+        for (i = 0; i < (size_t)rlen / sizeof(uint32_t); i++) {
+            if (buf[i] == sig) {
+                add_table((char*)(at + i*sizeof(uint32_t)));
+            }
         }
     }
-
-    if (rlen == -1) {
-        //fprintf(stderr,"read failed: %s\n", strerror(errno));
-        //exit(-1);
-    }
 }
 #endif
 
@@ -556,6 +582,10 @@ static int scan(pid_t pid)
         vma = vmas[i];
         sigscan(pid, vma.start, vma.end, sig);
     }
+    print_header();
+    for(i=0; i<num_tables; i++) {
+        found(pid, tables[i], pid);
+    }
 
 die:
     vv("detaching and resuming peer\n");
@@ -565,36 +595,22 @@ die:
     return 0;
 }
 # else
-static int scan(pid_t pid)
+/* list the peer's readable, anonymous memory areas and scan them for tables */
+static void find_tables(pid_t pid, int memfd)
 {
     FILE *mapf;
-    char mapfile[30], memfile[30], line[100];
-    vma_t *vmas=NULL, vma;
-    unsigned i, num_vmas = 0;
-    int memfd;
+    char mapfile[30], line[100];
+    vma_t vma;
     void *pstart, *pend, *unused;
 
-    /* attach to the target process and wait for it to suspend */
-    vv("attaching to peer\n");
-    if (ptrace(PTRACE_ATTACH, pid, NULL, 0) == -1) {
-        fprintf(stderr,"failed to attach to %u: %s\n", (unsigned)pid, strerror(errno));
-        exit(-1);
-    }
-    vv("waiting for peer to suspend temporarily\n");
-    if (waitpid(pid,NULL,0) != pid) {
-        fprintf(stderr,"failed to wait for pid %u: %s\n",(unsigned)pid, strerror(errno));
-        goto die;
-    }
-
-    /* get ready to open its memory map. this gives us its valid memory areas */
+    num_tables = 0;
     snprintf(mapfile,sizeof(mapfile),"/proc/%u/maps",(unsigned)pid);
-    snprintf(memfile,sizeof(memfile),"/proc/%u/mem", (unsigned)pid);
     vv("opening peer memory map [%s]\n", mapfile);
     if ( (mapf = fopen(mapfile,"r")) == NULL) {
         fprintf(stderr,"failed to open %s: %s\n", mapfile, strerror(errno));
-        goto die;
+        return;
     }
-    vv("listing peer virtual memory areas\n");
+    vv("scanning peer memory for hash table signatures\n");
     while(fgets(line,sizeof(line),mapf)) {
         if (sscanf(line, "%p-%p %4c %p %5c", &pstart, &pend, vma.perms,
                    &unused, vma.device) == 5) {
@@ -606,41 +622,156 @@ static int scan(pid_t pid)
             if (memcmp(vma.device,"fd",2)==0) {
                 continue;    /* skip mapped files */
             }
-            vmas = (vma_t*)realloc(vmas, (num_vmas+1) * sizeof(vma_t));
-            if (vmas == NULL) {
-                exit(-1);
-            }
-            vmas[num_vmas++] = vma;
+            vvv("scanning %p-%p %.4s %.5s\n", pstart, pend, vma.perms, vma.device);
+            sigscan(memfd, vma.start, vma.end, sig);
         }
     }
-    vv("peer has %u virtual memory areas\n",num_vmas);
     fclose(mapf);
+    vv("found %u hash table signatures\n", num_tables);
+}
 
-    /* ok, open up its memory and start looking around in there */
-    vv("opening peer memory\n");
-    if ( (memfd=open(memfile,O_RDONLY)) == -1) {
-        fprintf(stderr,"failed to open %s: %s\n", memfile, strerror(errno));
-        goto die;
+/* one sample of a table: its counters and the chain lengths of its buckets,
+ * read with two bulk reads. Returns -1 if no table is there any more. */
+static int profile_table(int fd, char *peer_sig, unsigned *flagged)
+{
+    UT_hash_table tbl;
+    UT_hash_bucket *bkts;
+    char *peer_tbl = tbl_from_sig_addr(peer_sig);
+    unsigned i, items=0, max_chain=0, long_chains=0, hist[HASH_STATS_CHAINS];
+    int bad;
+
+    if ((read_mem(&tbl, fd, (off_t)peer_tbl, sizeof(tbl)) != 0) ||
+        (tbl.signature != HASH_SIGNATURE) || (tbl.num_buckets == 0) ||
+        (tbl.log2_num_buckets > 31) || (tbl.num_buckets != (1U << tbl.log2_num_buckets))) {
+        return -1;
     }
-    /* look for the hash signature */
-    vv("scanning peer memory for hash table signatures\n");
-    for(i=0; i<num_vmas; i++) {
-        vma = vmas[i];
-        pstart = (void*)vma.start;
-        pend = (void*)vma.end;
-        /*fprintf(stderr,"scanning %p-%p %.4s %.5s\n", pstart, pend,
-                  vma.perms, vma.device);*/
-        sigscan(memfd, vma.start, vma.end, sig, pid);
+    if ((bkts = (UT_hash_bucket*)malloc(tbl.num_buckets * sizeof(UT_hash_bucket))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(-1);
+    }
+    if (read_mem(bkts, fd, (off_t)tbl.buckets, tbl.num_buckets * sizeof(UT_hash_bucket)) != 0) {
+        free(bkts);
+        return -1;
+    }
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < tbl.num_buckets; i++) {
+        items += bkts[i].count;
+        hist[(bkts[i].count < HASH_STATS_CHAINS) ? bkts[i].count : HASH_STATS_CHAINS-1]++;
+        if (bkts[i].count > max_chain) {
+            max_chain = bkts[i].count;
+        }
+        if (bkts[i].count >= chain_flag) {
+            long_chains++;
+        }
+    }
+    free(bkts);
+    if (items != tbl.num_items) {
+        vv("%p: %u items in the buckets, %u in the table (torn read?)\n",
+           (void*)peer_tbl, items, tbl.num_items);
     }
+    bad = (tbl.noexpand || long_chains) ? 1 : 0;
+    *flagged += bad;
+    if (bad || verbose) {
+        printf("%-18p %4.0f%% %8u %8u %4u %5u %2s %4u ",
+               (void*)peer_tbl,
+               tbl.num_items ? (tbl.num_items - tbl.nonideal_items) * 100.0 / tbl.num_items : 100.0,
+               tbl.num_items, tbl.num_buckets, max_chain, long_chains,
+               tbl.noexpand ? "NX" : "ok", tbl.expansions);
+        for (i = 0; i < HASH_STATS_CHAINS; i++) {
+            printf("%s%u", i ? "/" : "", hist[i]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
 
-    /* done. close memory and detach. this resumes the target process */
-    close(memfd);
+static double now_secs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
 
-die:
+static int attach(pid_t pid)
+{
+    vv("attaching to peer\n");
+    if (ptrace(PTRACE_ATTACH, pid, NULL, 0) == -1) {
+        fprintf(stderr,"failed to attach to %u: %s\n", (unsigned)pid, strerror(errno));
+        return -1;
+    }
+    vv("waiting for peer to suspend temporarily\n");
+    if (waitpid(pid,NULL,0) != pid) {
+        fprintf(stderr,"failed to wait for pid %u: %s\n",(unsigned)pid, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void detach(pid_t pid)
+{
     vv("detaching and resuming peer\n");
     if (ptrace(PTRACE_DETACH, pid, NULL, 0) == -1) {
         fprintf(stderr,"failed to detach from %u: %s\n", (unsigned)pid, strerror(errno));
     }
+}
+
+/* sample every table every profile_ms, reporting those with chains of
+ * chain_flag items or more, or with expansion inhibited */
+static void profile(pid_t pid, int memfd)
+{
+    unsigned n, i, j, flagged;
+    double start = now_secs(), t;
+
+    for (n = 0; (num_samples == 0) || (n < num_samples); n++) {
+        if (n > 0) {
+            usleep(profile_ms * 1000U);
+        }
+        if (attach(pid) != 0) {
+            break;
+        }
+        t = now_secs();
+        if ((n % rescan_every) == 0) {
+            find_tables(pid, memfd);
+        }
+        printf("sample %u at %.1fs: %u tables\n", n, t - start, num_tables);
+        printf("Address            ideal    items  buckets   mc  long fl  exp chains 0/1/2/...\n");
+        printf("------------------ ----- -------- -------- ---- ----- -- ---- ----------------\n");
+        flagged = 0;
+        for (i = j = 0; i < num_tables; i++) {
+            if (profile_table(memfd, tables[i], &flagged) == 0) {
+                tables[j++] = tables[i];   /* keep the tables that are still there */
+            }
+        }
+        num_tables = j;
+        detach(pid);
+        printf("%u flagged, sample took %.3fs\n\n", flagged, now_secs() - t);
+        fflush(stdout);
+    }
+}
+
+static int scan(pid_t pid)
+{
+    char memfile[30];
+    unsigned i;
+    int memfd;
+
+    snprintf(memfile,sizeof(memfile),"/proc/%u/mem", (unsigned)pid);
+    vv("opening peer memory\n");
+    if ( (memfd=open(memfile,O_RDONLY)) == -1) {
+        fprintf(stderr,"failed to open %s: %s\n", memfile, strerror(errno));
+        return -1;
+    }
+    if (profile_ms) {
+        profile(pid, memfd);
+    } else if (attach(pid) == 0) {
+        find_tables(pid, memfd);
+        print_header();
+        for(i=0; i<num_tables; i++) {
+            found(memfd, tables[i], pid);
+        }
+        detach(pid);
+    }
+    close(memfd);
     return 0;
 }
 #endif
@@ -648,7 +779,7 @@ die:
 
 static int usage(const char *prog)
 {
-    fprintf(stderr,"usage: %s [-v] [-k] <pid>\n", prog);
+    fprintf(stderr,"usage: %s [-v] [-k] [-p ms [-n samples] [-r samples] [-c chain]] <pid>\n", prog);
     return -1;
 }
 
@@ -656,8 +787,20 @@ int main(int argc, char *argv[])
 {
     int opt;
 
-    while ( (opt = getopt(argc, argv, "kv")) != -1) {
+    while ( (opt = getopt(argc, argv, "kvp:n:r:c:")) != -1) {
         switch (opt) {
+            case 'p':
+                profile_ms = (unsigned)atoi(optarg);
+                break;
+            case 'n':
+                num_samples = (unsigned)atoi(optarg);
+                break;
+            case 'r':
+                rescan_every = (unsigned)atoi(optarg);
+                break;
+            case 'c':
+                chain_flag = (unsigned)atoi(optarg);
+                break;
             case 'v':
                 verbose++;
                 break;
@@ -669,6 +812,15 @@ int main(int argc, char *argv[])
         }
     }
 
+#ifdef __FreeBSD__
+    if (profile_ms) {
+        fprintf(stderr, "profiling (-p) is only supported on Linux\n");
+        return -1;
+    }
+#endif
+    if ((rescan_every == 0) || (chain_flag == 0)) {
+        return usage(argv[0]);
+    }
     if (optind < argc) {
         pid_t pid = atoi(argv[optind++]);
         return scan(pid);
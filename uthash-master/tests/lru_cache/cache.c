@@ -20,29 +20,78 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cache.h"
 #include "uthash.h"
 
+#define KEY_MAX_LENGTH		32
+
 /**
  * A cache entry
+
+    Entries live in their shard's slab and are reused in place on eviction.
+    The key is copied in, so a lookup's key compare stays next to the hash
+    handle instead of chasing another pointer; longer keys are cut to
+    KEY_MAX_LENGTH bytes.
  */
 struct foo_cache_entry {
-	char *key; /**<The key */
-	void *data; /**<Payload */
 	UT_hash_handle hh; /**<Hash Handle for uthash */
+	void *data; /**<Payload */
+	unsigned char referenced; /**<CLOCK bit, set by lookups */
+	char key[KEY_MAX_LENGTH + 1]; /**<The key, NUL terminated */
 };
-#define KEY_MAX_LENGTH		32
+
+#define FOO_CACHE_SHARDS	16	/**<Default shard count, a power of two */
+#define FOO_CACHE_MAX_SHARDS	256	/**<Shards are picked by hash bits 24-31 */
+#define FOO_CACHE_MIN_PER_SHARD	64	/**<Fewer shards for small caches */
+#define FOO_CACHE_LINE		64
+
+/**
+ * One independently locked part of a cache object.
+
+    Entries sit in a slab of max_entries slots, allocated up front, that
+    the clock hand sweeps when the shard is full: an entry whose referenced
+    bit is set has the bit cleared and gets another lap, the first one
+    found clear is evicted. Lookups only set the bit, so they can share the
+    read lock.
+ */
+struct foo_cache_shard {
+	pthread_rwlock_t lock; /**<Protects everything but the counters */
+	struct foo_cache_entry *entries; /**<Head pointer for uthash */
+	struct foo_cache_entry *slab; /**<Entry slots, used ones first */
+	size_t max_entries; /**<Size of the slab */
+	size_t used; /**<Occupied slots */
+	size_t hand; /**<Next slot the clock hand looks at */
+	unsigned long hits; /**<Updated atomically */
+	unsigned long misses; /**<Updated atomically */
+	unsigned long evictions; /**<Updated atomically */
+} __attribute__ ((aligned(FOO_CACHE_LINE)));
 
 /**
  * A cache object
  */
 struct foo_cache {
 	size_t max_entries; /**<Amount of entries this cache object can hold */
-	pthread_rwlock_t cache_lock; /**<A lock for concurrent access */
-	struct foo_cache_entry *entries; /**<Head pointer for uthash */
+	unsigned shard_mask; /**<Number of shards minus one */
+	struct foo_cache_shard *shards; /**<Shard array, one per cache line */
 	void (*free_cb) (void *element);/**<Callback function to free cache entries */
 };
 
+static void foo_cache_free_data(struct foo_cache *cache, void *data)
+{
+	if (cache->free_cb)
+		cache->free_cb(data);
+	else
+		free(data);
+}
+
+static struct foo_cache_shard *foo_cache_shard_of(struct foo_cache *cache,
+						  unsigned hashv)
+{
+	/* the low bits pick the bucket inside the shard's hash */
+	return &cache->shards[(hashv >> 24) & cache->shard_mask];
+}
+
 /** Creates a new cache object
 
     @param dst
@@ -51,35 +100,95 @@ struct foo_cache {
     @param capacity
     The maximum number of elements this cache object can hold
 
-    @return EINVAL if dst is NULL, ENOMEM if malloc fails, 0 otherwise
+    @param shards
+    How many independently locked shards to split the cache into, rounded
+    down to a power of two; 0 picks a default that keeps at least
+    FOO_CACHE_MIN_PER_SHARD entries per shard
+
+    @return EINVAL if dst is NULL or capacity is too small for the shards,
+    ENOMEM if malloc fails, 0 otherwise
 */
-int foo_cache_create(struct foo_cache **dst, const size_t capacity,
-		     void (*free_cb) (void *element))
+int foo_cache_create_sharded(struct foo_cache **dst, const size_t capacity,
+			     unsigned shards, void (*free_cb) (void *element))
 {
 	struct foo_cache *new = NULL;
-	int rv;
+	void *mem = NULL;
+	unsigned n, i;
+	int rv = ENOMEM;
 
 	if (!dst)
 		return EINVAL;
 
+	if (shards == 0) {
+		shards = FOO_CACHE_SHARDS;
+		while (shards > 1 && capacity / shards < FOO_CACHE_MIN_PER_SHARD)
+			shards /= 2;
+	}
+	if (shards > FOO_CACHE_MAX_SHARDS)
+		shards = FOO_CACHE_MAX_SHARDS;
+	for (n = 1; n * 2 <= shards; n *= 2) ;
+	if (capacity < n)
+		return EINVAL;
+
 	if ((new = malloc(sizeof(*new))) == NULL)
 		return ENOMEM;
 
-	if ((rv = pthread_rwlock_init(&(new->cache_lock), NULL)) != 0)
+	if ((rv = posix_memalign(&mem, FOO_CACHE_LINE,
+				 n * sizeof(*new->shards))) != 0)
 		goto err_out;
+	new->shards = mem;
+
+	for (i = 0; i < n; i++) {
+		struct foo_cache_shard *shard = &new->shards[i];
+
+		memset(shard, 0, sizeof(*shard));
+		/* spread the remainder over the first shards */
+		shard->max_entries = capacity / n + (i < capacity % n);
+		shard->slab = malloc(shard->max_entries * sizeof(*shard->slab));
+		if (!shard->slab) {
+			rv = ENOMEM;
+			goto err_shards;
+		}
+		if ((rv = pthread_rwlock_init(&(shard->lock), NULL)) != 0) {
+			free(shard->slab);
+			goto err_shards;
+		}
+	}
 
 	new->max_entries = capacity;
-	new->entries = NULL;
+	new->shard_mask = n - 1;
 	new->free_cb = free_cb;
 	*dst = new;
 	return 0;
 
+err_shards:
+	while (i-- > 0) {
+		(void)pthread_rwlock_destroy(&(new->shards[i].lock));
+		free(new->shards[i].slab);
+	}
+	free(new->shards);
 err_out:
 	if (new)
 		free(new);
 	return rv;
 }
 
+/** Creates a new cache object with the default number of shards
+
+    @param dst
+    Where the newly allocated cache object will be stored in
+
+    @param capacity
+    The maximum number of elements this cache object can hold
+
+    @return EINVAL if dst is NULL, ENOMEM if malloc fails, 0 otherwise
+*/
+int foo_cache_create(struct foo_cache **dst, const size_t capacity,
+		     void (*free_cb) (void *element))
+{
+	return foo_cache_create_sharded(dst, capacity, 0, free_cb);
+}
+
 /** Frees an allocated cache object
 
     @param cache
@@ -92,28 +201,29 @@ err_out:
 */
 int foo_cache_delete(struct foo_cache *cache, int keep_data)
 {
-	struct foo_cache_entry *entry, *tmp;
+	size_t j;
+	unsigned i;
 	int rv;
 
 	if (!cache)
 		return EINVAL;
 
-	rv = pthread_rwlock_wrlock(&(cache->cache_lock));
-	if (rv)
-		return rv;
+	for (i = 0; i <= cache->shard_mask; i++) {
+		struct foo_cache_shard *shard = &cache->shards[i];
 
-	if (keep_data) {
-		HASH_CLEAR(hh, cache->entries);
-	} else {
-		HASH_ITER(hh, cache->entries, entry, tmp) {
-			HASH_DEL(cache->entries, entry);
-			if (cache->free_cb)
-				cache->free_cb(entry->data);
-			free(entry);
-		}
+		rv = pthread_rwlock_wrlock(&(shard->lock));
+		if (rv)
+			return rv;
+
+		HASH_CLEAR(hh, shard->entries);
+		if (!keep_data)
+			for (j = 0; j < shard->used; j++)
+				foo_cache_free_data(cache, shard->slab[j].data);
+		(void)pthread_rwlock_unlock(&(shard->lock));
+		(void)pthread_rwlock_destroy(&(shard->lock));
+		free(shard->slab);
 	}
-	(void)pthread_rwlock_unlock(&(cache->cache_lock));
-	(void)pthread_rwlock_destroy(&(cache->cache_lock));
+	free(cache->shards);
 	free(cache);
 	cache = NULL;
 	return 0;
@@ -121,6 +231,10 @@ int foo_cache_delete(struct foo_cache *cache, int keep_data)
 
 /** Checks if a given key is in the cache
 
+    Only the key's shard is locked, and only for reading: a hit just sets
+    the entry's referenced bit, which spares it from the next sweep of the
+    clock hand.
+
     @param cache
     The cache object
 
@@ -139,31 +253,46 @@ int foo_cache_delete(struct foo_cache *cache, int keep_data)
 int foo_cache_lookup(struct foo_cache *cache, char *key, void *result)
 {
 	int rv;
+	struct foo_cache_shard *shard;
 	struct foo_cache_entry *tmp = NULL;
 	char **dirty_hack = result;
+	size_t key_len;
+	unsigned hashv;
 
 	if (!cache || !key || !result)
 		return EINVAL;
 
-	rv = pthread_rwlock_wrlock(&(cache->cache_lock));
+	key_len = strnlen(key, KEY_MAX_LENGTH);
+	HASH_VALUE(key, key_len, hashv);
+	shard = foo_cache_shard_of(cache, hashv);
+
+	rv = pthread_rwlock_rdlock(&(shard->lock));
 	if (rv)
 		return rv;
 
-	HASH_FIND_STR(cache->entries, key, tmp);
+	HASH_FIND_BYHASHVALUE(hh, shard->entries, key, key_len, hashv, tmp);
 	if (tmp) {
-		size_t key_len = strnlen(tmp->key, KEY_MAX_LENGTH);
-		HASH_DELETE(hh, cache->entries, tmp);
-		HASH_ADD_KEYPTR(hh, cache->entries, tmp->key, key_len, tmp);
+		/* test first, so hot entries don't bounce their cache line */
+		if (!__atomic_load_n(&tmp->referenced, __ATOMIC_RELAXED))
+			__atomic_store_n(&tmp->referenced, 1, __ATOMIC_RELAXED);
 		*dirty_hack = tmp->data;
+		__atomic_fetch_add(&shard->hits, 1, __ATOMIC_RELAXED);
 	} else {
 		*dirty_hack = result = NULL;
+		__atomic_fetch_add(&shard->misses, 1, __ATOMIC_RELAXED);
 	}
-	rv = pthread_rwlock_unlock(&(cache->cache_lock));
+	rv = pthread_rwlock_unlock(&(shard->lock));
 	return rv;
 }
 
 /** Inserts a given <key, value> pair into the cache
 
+    The key is copied into the entry. An entry already stored under <key>
+    gets the new data. When the key's shard is full, the clock hand picks
+    the entry to evict and the new pair takes over its slot; the data that
+    was replaced or evicted is passed to free_cb after the shard is
+    unlocked. Inserting never allocates.
+
     @param cache
     The cache object
 
@@ -173,49 +302,88 @@ int foo_cache_lookup(struct foo_cache *cache, char *key, void *result)
     @param data
     Data associated with <key>
 
-    @return EINVAL if cache is NULL, ENOMEM if malloc fails, 0 otherwise
+    @return EINVAL if cache is NULL, 0 otherwise
 */
 int foo_cache_insert(struct foo_cache *cache, char *key, void *data)
 {
+	struct foo_cache_shard *shard;
 	struct foo_cache_entry *entry = NULL;
-	struct foo_cache_entry *tmp_entry = NULL;
+	void *old_data = NULL;
 	size_t key_len = 0;
+	unsigned hashv;
 	int rv;
 
-	if (!cache || !data)
+	if (!cache || !key || !data)
 		return EINVAL;
 
-	if ((entry = malloc(sizeof(*entry))) == NULL)
-		return ENOMEM;
+	key_len = strnlen(key, KEY_MAX_LENGTH);
+	HASH_VALUE(key, key_len, hashv);
+	shard = foo_cache_shard_of(cache, hashv);
 
-	if ((rv = pthread_rwlock_wrlock(&(cache->cache_lock))) != 0)
-		goto err_out;
+	if ((rv = pthread_rwlock_wrlock(&(shard->lock))) != 0)
+		return rv;
 
-	entry->key = key;
-	entry->data = data;
-	key_len = strnlen(entry->key, KEY_MAX_LENGTH);
-	HASH_ADD_KEYPTR(hh, cache->entries, entry->key, key_len, entry);
-
-	if (HASH_COUNT(cache->entries) >= cache->max_entries) {
-		HASH_ITER(hh, cache->entries, entry, tmp_entry) {
-			HASH_DELETE(hh, cache->entries, entry);
-			if (cache->free_cb)
-				cache->free_cb(entry->data);
-			else
-				free(entry->data);
-			/* free(key->key) if data has been copied */
-			free(entry);
-			break;
+	HASH_FIND_BYHASHVALUE(hh, shard->entries, key, key_len, hashv, entry);
+	if (entry) {
+		old_data = entry->data;
+		entry->data = data;
+		goto out;
+	}
+	if (shard->used < shard->max_entries) {
+		entry = &shard->slab[shard->used++];
+	} else {
+		for (;;) {
+			entry = &shard->slab[shard->hand];
+			if (++shard->hand == shard->max_entries)
+				shard->hand = 0;
+			if (!__atomic_load_n(&entry->referenced, __ATOMIC_RELAXED))
+				break;
+			__atomic_store_n(&entry->referenced, 0, __ATOMIC_RELAXED);
 		}
+		HASH_DELETE(hh, shard->entries, entry);
+		old_data = entry->data;
+		__atomic_fetch_add(&shard->evictions, 1, __ATOMIC_RELAXED);
 	}
-
-	rv = pthread_rwlock_unlock(&(cache->cache_lock));
+	memcpy(entry->key, key, key_len);
+	entry->key[key_len] = '\0';
+	entry->data = data;
+	entry->referenced = 0;
+	HASH_ADD_KEYPTR_BYHASHVALUE(hh, shard->entries, entry->key, key_len,
+				    hashv, entry);
+
+out:
+	rv = pthread_rwlock_unlock(&(shard->lock));
+	if (old_data && old_data != data)
+		foo_cache_free_data(cache, old_data);
 	return rv;
+}
 
-err_out:
-	if (entry)
-		free(entry);
-	(void)pthread_rwlock_unlock(&(cache->cache_lock));
-	return rv;
+/** Reads the hit, miss and eviction counters of a cache object
+
+    @param cache
+    The cache object
 
+    @param stats
+    Where to store the counters, summed over all shards
+
+    @return EINVAL if cache or stats is NULL, 0 otherwise
+*/
+int foo_cache_stats(struct foo_cache *cache, struct foo_cache_stats *stats)
+{
+	unsigned i;
+
+	if (!cache || !stats)
+		return EINVAL;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i <= cache->shard_mask; i++) {
+		struct foo_cache_shard *shard = &cache->shards[i];
+
+		stats->hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+		stats->misses += __atomic_load_n(&shard->misses,
+						 __ATOMIC_RELAXED);
+		stats->evictions += __atomic_load_n(&shard->evictions,
+						    __ATOMIC_RELAXED);
+	}
+	return 0;
 }
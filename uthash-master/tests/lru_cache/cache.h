@@ -22,10 +22,24 @@
 
 struct foo_cache;
 
+/**
+ * Counters kept by a cache object, summed over its shards
+ */
+struct foo_cache_stats {
+	unsigned long hits; /**<Lookups that found their key */
+	unsigned long misses; /**<Lookups that did not */
+	unsigned long evictions; /**<Entries pushed out to make room */
+};
+
 extern int foo_cache_create(struct foo_cache **dst, const size_t capacity,
 			    void (*free_cb) (void *element));
+extern int foo_cache_create_sharded(struct foo_cache **dst,
+				    const size_t capacity, unsigned shards,
+				    void (*free_cb) (void *element));
 extern int foo_cache_delete(struct foo_cache *cache, int keep_data);
 extern int foo_cache_lookup(struct foo_cache *cache, char *key, void *result);
 extern int foo_cache_insert(struct foo_cache *cache, char *key, void *data);
+extern int foo_cache_stats(struct foo_cache *cache,
+			   struct foo_cache_stats *stats);
 
 #endif
@@ -3,11 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "cache.h"
 
 #define MAX_RANDOM_ENTRIES	32
 
+#define BENCH_KEYS		65536
+#define BENCH_CAPACITY		8192
+#define BENCH_LOOPS		1000000
+#define BENCH_MAX_THREADS	64
+
 struct key_record {
 	char *key;
 	char *value;
@@ -16,6 +22,7 @@ struct key_record {
 int generate_random_entry(struct key_record **entry);
 int generate_random_string(char **dst, const size_t len);
 void free_random_entry(void *entry);
+int bench(int max_threads);
 
 void *producer(void *arg)
 {
@@ -61,7 +68,7 @@ void *consumer(void *arg)
 	printf("\n\n");
 
 	do {
-		memset(key, 0, 64);
+		memset(key, 0, sizeof(key));
 		result = NULL;
 
 		printf("Enter key for lookup: ");
@@ -98,12 +105,15 @@ out:
 	pthread_exit(NULL);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
 	int rv;
 	struct foo_cache *cache = NULL;
 	pthread_t workers[2];
 
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return bench(argc > 2 ? atoi(argv[2]) : 8);
+
 	rv = foo_cache_create(&cache, MAX_RANDOM_ENTRIES / 2,
 			      free_random_entry);
 	if (rv) {
@@ -189,3 +199,100 @@ void free_random_entry(void *entry)
 	free(record);
 	record = NULL;
 }
+
+/*
+ * Benchmark: "cache bench [max_threads]" runs 1, 2, 4 ... max_threads threads
+ * doing lookups, 9 in 10 of them on a hot tenth of the keys, inserting the
+ * key on a miss. Each thread count runs on one shard, then on the default.
+ */
+
+static char bench_keys[BENCH_KEYS][33];
+
+static void bench_free(void *element)
+{
+	(void)element; /* the data is a key from bench_keys */
+}
+
+static void *bench_worker(void *arg)
+{
+	struct foo_cache *cache = arg;
+	unsigned x = (unsigned)(size_t)&x | 1u; /* per-thread seed */
+	char *result;
+	int i, idx;
+
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		if (x % 10 < 9)
+			idx = (int)((x >> 4) % (BENCH_KEYS / 10));
+		else
+			idx = (int)((x >> 4) % BENCH_KEYS);
+		if (foo_cache_lookup(cache, bench_keys[idx], &result))
+			exit(1);
+		if (!result &&
+		    foo_cache_insert(cache, bench_keys[idx], bench_keys[idx]))
+			exit(1);
+	}
+	return NULL;
+}
+
+static double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int bench(int max_threads)
+{
+	static const char alphanum[] =
+	    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	pthread_t workers[BENCH_MAX_THREADS];
+	struct foo_cache_stats stats;
+	struct foo_cache *cache;
+	double t0, elapsed;
+	int i, j, n;
+	unsigned shards;
+
+	if (max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+		fprintf(stderr, "max_threads must be 1 to %d\n",
+			BENCH_MAX_THREADS);
+		return 1;
+	}
+
+	for (i = 0; i < BENCH_KEYS; i++) {
+		for (j = 0; j < 32; j++)
+			bench_keys[i][j] =
+			    alphanum[rand() % (sizeof(alphanum) - 1)];
+		bench_keys[i][32] = '\0';
+	}
+
+	printf("threads  shards  Mops/s  hit%%   evictions\n");
+	for (n = 1; n <= max_threads; n *= 2) {
+		for (shards = 1; shards <= 16; shards *= 16) {
+			if (foo_cache_create_sharded(&cache, BENCH_CAPACITY,
+						     shards, bench_free)) {
+				fprintf(stderr, "Could not create cache\n");
+				return 1;
+			}
+			t0 = bench_now();
+			for (i = 0; i < n; i++)
+				if (pthread_create(&workers[i], NULL,
+						   bench_worker, cache))
+					return 1;
+			for (i = 0; i < n; i++)
+				pthread_join(workers[i], NULL);
+			elapsed = bench_now() - t0;
+
+			(void)foo_cache_stats(cache, &stats);
+			printf("%7d  %6u  %6.2f  %5.1f  %lu\n", n, shards,
+			       n * (double)BENCH_LOOPS / elapsed / 1e6,
+			       100.0 * stats.hits / (stats.hits + stats.misses),
+			       stats.evictions);
+			(void)foo_cache_delete(cache, 0);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdlib.h>   /* malloc */
+#include <sys/time.h> /* gettimeofday */
+#include <stdio.h>    /* printf */
+#include "uthash.h"
+
+/* times HASH_SRT, HASH_SRT_ARRAY and HASH_SRT_RADIX on n items (default 1M),
+ * each sort starting from the same shuffled order; usage: sort_perf [n] */
+
+typedef struct rec {
+    unsigned id;
+    unsigned shuffle;
+    UT_hash_handle hh;
+} rec;
+
+static int by_id(const rec *a, const rec *b)
+{
+    return (a->id < b->id) ? -1 : (a->id > b->id);
+}
+
+static unsigned id_key(const rec *r)
+{
+    return r->id;
+}
+
+static unsigned shuffle_key(const rec *r)
+{
+    return r->shuffle;
+}
+
+static double elapsed(struct timeval *tv1)
+{
+    struct timeval tv2;
+    gettimeofday(&tv2, NULL);
+    return (tv2.tv_sec - tv1->tv_sec) + (tv2.tv_usec - tv1->tv_usec) * 1e-6;
+}
+
+static int in_order(rec *r)
+{
+    for (; (r != NULL) && (r->hh.next != NULL); r = (rec*)r->hh.next) {
+        if (r->id > ((rec*)r->hh.next)->id) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    rec *recs = NULL, *all, *r, *tmp;
+    unsigned i, n = (argc > 1) ? (unsigned)atoi(argv[1]) : 1000000U;
+    struct timeval tv1;
+    double t;
+    int pass;
+
+    /* items in one array, added (and so linked) in random order */
+    if ((all = (rec*)malloc(n * sizeof(rec))) == NULL) {
+        exit(-1);
+    }
+    srand(1);
+    for (i = 0; i < n; i++) {
+        all[i].id = ((unsigned)rand() << 16) ^ (unsigned)rand();
+        all[i].shuffle = ((unsigned)rand() << 16) ^ (unsigned)rand();
+    }
+    for (i = 0; i < n; i++) {
+        HASH_ADD(hh, recs, shuffle, sizeof(unsigned), &all[i]);
+    }
+    HASH_SRT_RADIX(hh, recs, shuffle_key);
+
+    for (pass = 0; pass < 3; pass++) {
+        gettimeofday(&tv1, NULL);
+        switch (pass) {
+        case 0: HASH_SRT(hh, recs, by_id); break;
+        case 1: HASH_SRT_ARRAY(hh, recs, by_id); break;
+        default: HASH_SRT_RADIX(hh, recs, id_key); break;
+        }
+        t = elapsed(&tv1);
+        printf("%-15s %u items: %.3f s%s\n",
+               (pass == 0) ? "HASH_SRT" : (pass == 1) ? "HASH_SRT_ARRAY" : "HASH_SRT_RADIX",
+               n, t, in_order(recs) ? "" : " (NOT SORTED)");
+        HASH_SRT_RADIX(hh, recs, shuffle_key);
+    }
+
+    HASH_ITER(hh, recs, r, tmp) {
+        HASH_DEL(recs, r);
+    }
+    free(all);
+    return 0;
+}
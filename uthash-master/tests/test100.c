@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    char name[16];
+    UT_hash_handle hh;
+    UT_hash_handle ah;
+} example_user_t;
+
+int main()
+{
+    example_user_t *users = NULL, *names = NULL, *user, *tmp;
+    example_user_t *out[100];
+    const int *ids[100];
+    const char *strs[100];
+    char bufs[100][16];
+    int keys[100], i, found, right;
+
+    /* an empty hash finds nothing */
+    for (i = 0; i < 100; i++) {
+        keys[i] = i;
+        ids[i] = &keys[i];
+        out[i] = (example_user_t*)&keys[i];
+    }
+    HASH_FIND_BATCH(ah, users, ids, sizeof(int), 37, out);
+    for (i = 0, found = 0; i < 37; i++) {
+        found += (out[i] != NULL);
+    }
+    printf("empty: found %d, out[37] untouched: %s\n", found,
+           out[37] == (example_user_t*)&keys[37] ? "yes" : "no");
+
+    /* even ids 0..198 */
+    for (i = 0; i < 100; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = 2 * i;
+        snprintf(user->name, sizeof(user->name), "user%d", 2 * i);
+        HASH_ADD(ah, users, id, sizeof(int), user);
+        HASH_ADD_STR(names, name, user);
+    }
+
+    /* a batch of 100 spans several groups, and half the keys are missing */
+    for (i = 0, found = 0, right = 0; i < 100; i++) {
+        keys[i] = 99 - i;
+    }
+    HASH_FIND_BATCH(ah, users, ids, sizeof(int), 100, out);
+    for (i = 0; i < 100; i++) {
+        if (out[i] != NULL) {
+            found++;
+            right += (out[i]->id == keys[i]);
+        } else {
+            right += (keys[i] % 2 != 0);
+        }
+    }
+    printf("ints: found %d, right %d\n", found, right);
+
+    for (i = 0; i < 100; i++) {
+        snprintf(bufs[i], sizeof(bufs[i]), "user%d", i + 100);
+        strs[i] = bufs[i];
+    }
+    HASH_FIND_BATCH_STR(names, strs, 100, out);
+    for (i = 0, found = 0, right = 0; i < 100; i++) {
+        if (out[i] != NULL) {
+            found++;
+            right += (strcmp(out[i]->name, strs[i]) == 0);
+        }
+    }
+    printf("strings: found %d, right %d\n", found, right);
+
+    HASH_CLEAR(ah, users);
+    HASH_ITER(hh, names, user, tmp) {
+        HASH_DEL(names, user);
+        free(user);
+    }
+    return 0;
+}
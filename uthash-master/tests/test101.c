@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_DEBUG 1
+#define HASH_INCREMENTAL_RESIZE 1
+#include "uthash.h"
+
+#undef uthash_expand_fyi
+#define uthash_expand_fyi(tbl) printf("expanding to %u buckets\n", (tbl)->num_buckets)
+
+typedef struct example_user_t {
+    int id;
+    int cookie;
+    UT_hash_handle hh;
+} example_user_t;
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp;
+    int i, found, mid = 0;
+
+    for (i = 0; i < 1000; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        user->cookie = i * i;
+        HASH_ADD_INT(users, id, user);
+        /* in the middle of the migration to 128 buckets */
+        if ((users->hh.tbl->num_buckets == 128) &&
+            (users->hh.tbl->old_buckets != NULL) && !mid) {
+            mid = 1;
+            printf("migrating: %u of %u old buckets moved\n",
+                   users->hh.tbl->migrate_pos, users->hh.tbl->old_num_buckets);
+            for (found = 0, i = 0; i <= user->id; i++) {
+                HASH_FIND_INT(users, &i, tmp);
+                found += (tmp != NULL) && (tmp->cookie == i * i);
+                if (i == 3) {
+                    printf("after 4 finds: %u moved\n", users->hh.tbl->migrate_pos);
+                    HASH_FSCK(hh, users, "during migration");
+                }
+            }
+            i = user->id;
+            printf("found %d of %d, %s\n", found, i + 1,
+                   (users->hh.tbl->old_buckets == NULL) ? "migrated" : "migrating");
+        }
+    }
+
+    /* delete the odd ids, some of them while a migration is under way */
+    for (i = 1; i < 1000; i += 2) {
+        HASH_FIND_INT(users, &i, tmp);
+        if (tmp != NULL) {
+            HASH_DEL(users, tmp);
+            free(tmp);
+        }
+    }
+    HASH_FSCK(hh, users, "after deletes");
+
+    for (found = 0, i = 0; i < 1000; i++) {
+        HASH_FIND_INT(users, &i, tmp);
+        found += (tmp != NULL);
+    }
+    printf("%u items, %d found, %s\n", HASH_COUNT(users), found,
+           (users->hh.tbl->old_buckets == NULL) ? "migrated" : "migrating");
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    printf("%s\n", (users == NULL) ? "empty" : "not empty");
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_DEBUG 1
+#define HASH_BUCKET_TAGS 2
+/* few distinct hash values: long chains, and tags that match the wrong key */
+#define HASH_FUNCTION(a,n,hv) (hv = (unsigned)(*(const int*)(a) % 5))
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    UT_hash_handle hh;
+} example_user_t;
+
+static void count_found(example_user_t *users, const char *when)
+{
+    example_user_t *tmp;
+    int i, found = 0;
+    for (i = 0; i < 40; i++) {
+        HASH_FIND_INT(users, &i, tmp);
+        if (tmp != NULL) {
+            if (tmp->id != i) {
+                printf("found %d looking for %d\n", tmp->id, i);
+            }
+            found++;
+        }
+    }
+    printf("%s: %d found, %u in the hash\n", when, found, HASH_COUNT(users));
+}
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp;
+    int i;
+
+    for (i = 0; i < 20; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        HASH_ADD_INT(users, id, user);
+    }
+    count_found(users, "added");
+
+    /* delete from the front, the middle and the end of the chains */
+    for (i = 0; i < 20; i += 3) {
+        HASH_FIND_INT(users, &i, tmp);
+        HASH_DEL(users, tmp);
+        free(tmp);
+        HASH_FSCK(hh, users, "delete");
+    }
+    count_found(users, "deleted every third");
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+        HASH_FSCK(hh, users, "delete all");
+    }
+    count_found(users, "deleted all");
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_BLOOM 12
+#define HASH_BLOOM_BLOCKED 1
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    UT_hash_handle hh;
+} example_user_t;
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp;
+    unsigned hashv;
+    int i, passed = 0, found = 0;
+
+    for (i = 0; i < 200; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        HASH_ADD_INT(users, id, user);
+    }
+    printf("blocks %s aligned\n",
+           (((size_t)users->hh.tbl->bloom_blocks & 63U) == 0) ? "are" : "aren't");
+
+    /* every key that was added passes the filter */
+    for (i = 0; i < 200; i++) {
+        HASH_VALUE(&i, sizeof(int), hashv);
+        passed += HASH_BLOOM_TEST(users->hh.tbl, hashv) ? 1 : 0;
+        HASH_FIND_INT(users, &i, tmp);
+        found += (tmp != NULL);
+    }
+    printf("added: %d passed, %d found\n", passed, found);
+
+    /* 4096 bits for 200 keys: few of the others get through */
+    for (passed = 0, found = 0, i = 200; i < 10200; i++) {
+        HASH_VALUE(&i, sizeof(int), hashv);
+        passed += HASH_BLOOM_TEST(users->hh.tbl, hashv) ? 1 : 0;
+        HASH_FIND_INT(users, &i, tmp);
+        found += (tmp != NULL);
+    }
+    printf("others: %s 1%% passed, %d found\n", (passed < 100) ? "under" : "over", found);
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
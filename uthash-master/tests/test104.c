@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* per-table allocators (HASH_ALLOCATOR), and tables in a UT_pool */
+#define uthash_table_allocator(head) next_alloc
+#include "utpool.h"
+
+#undef uthash_malloc
+#undef uthash_free
+#define uthash_malloc(sz) (global_mallocs++, malloc(sz))
+#define uthash_free(ptr,sz) do { global_frees++; free(ptr); } while (0)
+
+typedef struct example_user_t {
+    int id;
+    int cookie;
+    UT_hash_handle hh;
+} example_user_t;
+
+static int global_mallocs, global_frees;
+static const UT_hash_allocator *next_alloc = NULL;
+
+/* a counting allocator: ctx points to the bytes outstanding */
+static void *count_malloc(void *ctx, size_t sz)
+{
+    size_t *outstanding = (size_t*)ctx;
+    size_t *p = (size_t*)malloc(sz + sizeof(size_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    *p = sz;
+    *outstanding += sz;
+    return p + 1;
+}
+static void count_free(void *ctx, void *ptr, size_t sz)
+{
+    size_t *outstanding = (size_t*)ctx;
+    size_t *p = (size_t*)ptr - 1;
+    if (*p != sz) {
+        printf("freed %u bytes of a %u byte block\n", (unsigned)sz, (unsigned)*p);
+    }
+    *outstanding -= sz;
+    free(p);
+}
+
+int main()
+{
+    example_user_t *users = NULL, *others = NULL, *pooled = NULL, *user, *tmp;
+    size_t outstanding = 0;
+    UT_hash_allocator counter;
+    UT_pool pool;
+    int i, round, found;
+
+    counter.malloc_fn = count_malloc;
+    counter.free_fn = count_free;
+    counter.ctx = &outstanding;
+
+    /* a table with the counting allocator, one with the default */
+    for (i = 0; i < 1000; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        next_alloc = &counter;
+        HASH_ADD_INT(users, id, user);
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        next_alloc = NULL;
+        HASH_ADD_INT(others, id, user);
+    }
+    printf("%u buckets, counted bytes %s the overhead less the handles\n",
+           users->hh.tbl->num_buckets,
+           (outstanding == HASH_OVERHEAD(hh, users) -
+            HASH_COUNT(users) * sizeof(UT_hash_handle)) ? "match" : "don't match");
+    printf("default table: %s\n", (global_mallocs > 0) ? "uthash_malloc" : "none");
+    global_mallocs = global_frees = 0;
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    printf("after deleting all: %u bytes outstanding, %d uthash_malloc %d uthash_free\n",
+           (unsigned)outstanding, global_mallocs, global_frees);
+    HASH_ITER(hh, others, user, tmp) {
+        HASH_DEL(others, user);
+        free(user);
+    }
+    printf("emptied default table: %s\n", (global_frees > 0) ? "uthash_free" : "none");
+
+    /* tables and items in a pool, released in bulk */
+    UTPOOL_INIT(&pool);
+    next_alloc = UTPOOL_ALLOCATOR(&pool);
+    global_mallocs = global_frees = 0;
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < 10000; i++) {
+            user = (example_user_t*)UTPOOL_MALLOC(&pool, sizeof(example_user_t));
+            if (user == NULL) {
+                exit(-1);
+            }
+            user->id = i;
+            user->cookie = i * round;
+            HASH_ADD_INT(pooled, id, user);
+        }
+        for (found = 0, i = 0; i < 10000; i++) {
+            HASH_FIND_INT(pooled, &i, user);
+            found += (user != NULL) && (user->cookie == i * round);
+        }
+        printf("round %d: found %d of %u in %u buckets\n", round, found,
+               HASH_COUNT(pooled), pooled->hh.tbl->num_buckets);
+        UTPOOL_RELEASE(&pool);
+        pooled = NULL;
+    }
+    printf("pool: %d uthash_malloc %d uthash_free\n", global_mallocs, global_frees);
+    return 0;
+}
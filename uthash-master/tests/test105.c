@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HASH_DEBUG 1
+#include "uthash.h"
+
+/* HASH_SRT_ARRAY and HASH_SRT_RADIX give the same (stable) order as HASH_SRT */
+
+typedef struct example_user_t {
+    int id;
+    int group;
+    UT_hash_handle hh;
+    UT_hash_handle alth;
+} example_user_t;
+
+static int by_group(const example_user_t *a, const example_user_t *b)
+{
+    return (a->group < b->group) ? -1 : (a->group > b->group);
+}
+
+static int rev_id(const example_user_t *a, const example_user_t *b)
+{
+    return b->id - a->id;
+}
+
+/* signed keys: flip the sign bit so negative groups sort first */
+static uint32_t group_key(const example_user_t *u)
+{
+    return (uint32_t)u->group ^ 0x80000000U;
+}
+
+static uint64_t high_key(const example_user_t *u)
+{
+    return (uint64_t)u->id << 40;
+}
+
+static int same_order(example_user_t *a, example_user_t *b)
+{
+    for (; (a != NULL) && (b != NULL);
+         a = (example_user_t*)a->hh.next, b = (example_user_t*)b->alth.next) {
+        if (a != b) {
+            return 0;
+        }
+    }
+    return (a == NULL) && (b == NULL);
+}
+
+int main()
+{
+    example_user_t *users = NULL, *alt = NULL, *user, *tmp;
+    int n, i, ok;
+    int sizes[] = {1, 2, 7, 8, 9, 100, 1000, 4097};
+
+    for (n = 0; n < (int)(sizeof(sizes) / sizeof(sizes[0])); n++) {
+        for (i = 0; i < sizes[n]; i++) {
+            user = (example_user_t*)malloc(sizeof(example_user_t));
+            if (user == NULL) {
+                exit(-1);
+            }
+            user->id = (i * 7919) % sizes[n];
+            user->group = ((i * 31) % 23) - 11;
+            HASH_ADD_INT(users, id, user);
+            HASH_ADD(alth, alt, id, sizeof(int), user);
+        }
+        ok = 1;
+        HASH_SRT(hh, users, by_group);
+        HASH_SRT_ARRAY(alth, alt, by_group);
+        ok &= same_order(users, alt);
+        HASH_SRT(hh, users, rev_id);
+        HASH_SRT(alth, alt, rev_id);
+        HASH_SRT(hh, users, by_group);
+        HASH_SRT_RADIX(alth, alt, group_key);
+        ok &= same_order(users, alt);
+        HASH_SRT_ARRAY(hh, users, rev_id);
+        HASH_SRT(alth, alt, rev_id);
+        ok &= same_order(users, alt);
+        HASH_SRT_RADIX(hh, users, high_key);
+        printf("%d items: %s, first %d last %d\n", sizes[n],
+               ok ? "same order" : "DIFFERENT", users->id,
+               ((example_user_t*)ELMT_FROM_HH(users->hh.tbl, users->hh.tbl->tail))->id);
+        HASH_CLEAR(alth, alt);
+        HASH_ITER(hh, users, user, tmp) {
+            HASH_DEL(users, user);
+            free(user);
+        }
+    }
+    HASH_SORT_ARRAY(users, by_group);
+    HASH_SORT_RADIX(users, group_key);
+    printf("empty hash: %s\n", (users == NULL) ? "still empty" : "not empty");
+    return 0;
+}
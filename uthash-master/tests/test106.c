@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the dense index (HASH_DENSE_INDEX): adds, deletes, replaces, selects,
+ * sorts and out-of-memory rollbacks keep dense[] in step with the table */
+#define HASH_DEBUG 1
+#define HASH_DENSE_INDEX 1
+#define HASH_NONFATAL_OOM 1
+
+static int fail_malloc;
+static int nonfatal_ooms;
+
+#define uthash_malloc(sz) (fail_malloc ? NULL : malloc(sz))
+#define uthash_nonfatal_oom(e) do { nonfatal_ooms++; } while (0)
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    int cookie;
+    UT_hash_handle hh;
+    UT_hash_handle ah;
+} example_user_t;
+
+#define EVENS(x) (((x)->id % 2) == 0)
+static int evens(void *userv)
+{
+    example_user_t *user = (example_user_t*)userv;
+    return EVENS(user);
+}
+
+static int idcmp(void *_a, void *_b)
+{
+    example_user_t *a = (example_user_t*)_a;
+    example_user_t *b = (example_user_t*)_b;
+    return (a->id - b->id);
+}
+
+int main()
+{
+    example_user_t *users = NULL, *ausers = NULL, *user, *replaced;
+    unsigned i, half;
+    int id;
+    long sum, lo, hi;
+
+    for (id = 0; id < 1000; id++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        user->cookie = id * id;
+        HASH_ADD_INT(users, id, user);
+    }
+    printf("count %u\n", HASH_COUNT(users));
+
+    /* delete every third item while iterating over the index */
+    HASH_DENSE_ITER(hh, users, user, i) {
+        if ((user->id % 3) == 0) {
+            HASH_DEL(users, user);
+            free(user);
+        }
+    }
+    printf("count after deletes %u\n", HASH_COUNT(users));
+
+    /* two halves of the index, as two threads would scan them */
+    sum = 0;
+    HASH_ITER(hh, users, user, replaced) {
+        sum += user->id;
+    }
+    half = HASH_COUNT(users) / 2U;
+    lo = hi = 0;
+    for (i = 0; i < half; i++) {
+        lo += ((example_user_t*)HASH_DENSE_AT(hh, users, i))->id;
+    }
+    for (i = half; i < HASH_COUNT(users); i++) {
+        hi += ((example_user_t*)HASH_DENSE_AT(hh, users, i))->id;
+    }
+    printf("sum %ld, by halves %s\n", sum, (lo + hi == sum) ? "same" : "DIFFERENT");
+
+    /* replace a few items */
+    for (id = 1; id < 20; id += 3) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        user->cookie = -id;
+        HASH_REPLACE_INT(users, id, user, replaced);
+        free(replaced);
+    }
+    id = 19;
+    HASH_FIND_INT(users, &id, user);
+    printf("replaced 19: cookie %d, count %u\n", user ? user->cookie : 0, HASH_COUNT(users));
+
+    /* the dense index survives sorting, and drives the select */
+    HASH_SORT(users, idcmp);
+    HASH_SELECT(ah, ausers, hh, users, evens);
+    HASH_SRT(ah, ausers, idcmp);
+    printf("selected %u evens:", HASH_CNT(ah, ausers));
+    i = 0;
+    for (user = ausers; user != NULL && i < 8; user = (example_user_t*)user->ah.next, i++) {
+        printf(" %d", user->id);
+    }
+    printf("\n");
+
+    /* an add whose index cannot grow is rolled back */
+    id = 1000;
+    while (HASH_COUNT(users) < users->hh.tbl->dense_cap) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id++;
+        user->cookie = 0;
+        HASH_ADD_INT(users, id, user);
+    }
+    user = (example_user_t*)malloc(sizeof(example_user_t));
+    if (user == NULL) {
+        exit(-1);
+    }
+    user->id = id;
+    fail_malloc = 1;
+    HASH_ADD_INT(users, id, user);
+    fail_malloc = 0;
+    HASH_FIND_INT(users, &id, replaced);
+    printf("oom %d, found %s, tbl %s, count %u\n", nonfatal_ooms,
+           replaced ? "yes" : "no", user->hh.tbl ? "set" : "NULL", HASH_COUNT(users));
+    HASH_ADD_INT(users, id, user);
+    printf("added on retry, count %u\n", HASH_COUNT(users));
+
+    HASH_CLEAR(ah, ausers);
+    HASH_ITER(hh, users, user, replaced) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    printf("count at end %u\n", HASH_COUNT(users));
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bulk builds (HASH_ADD_BULK, HASH_ADD_BULK_STR) and HASH_SELECT_PARALLEL:
+ * the same items, order and finds as one-by-one adds and HASH_SELECT */
+#define HASH_DEBUG 1
+#undef uthash_expand_fyi
+#define uthash_expand_fyi(tbl) expansions++
+static unsigned expansions;
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    char name[16];
+    UT_hash_handle hh;
+    UT_hash_handle ah;
+    UT_hash_handle bh;
+    UT_hash_handle ch;
+} example_user_t;
+
+#define NUSERS 5000
+
+static int evens(void *userv)
+{
+    example_user_t *user = (example_user_t*)userv;
+    return (user->id % 2) == 0;
+}
+
+int main()
+{
+    example_user_t *users = NULL, *names = NULL, *sel = NULL, *ref = NULL;
+    example_user_t **items, *user, *found, *a, *b;
+    int id, bad = 0;
+
+    items = (example_user_t**)malloc(NUSERS * sizeof(example_user_t*));
+    if (items == NULL) {
+        exit(-1);
+    }
+    for (id = 0; id < NUSERS; id++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        sprintf(user->name, "user%d", id);
+        items[id] = user;
+    }
+
+    /* the first ten one by one, the rest in bulk into the same hash */
+    for (id = 0; id < 10; id++) {
+        HASH_ADD_INT(users, id, items[id]);
+    }
+    expansions = 0;
+    HASH_ADD_BULK(hh, users, id, sizeof(int), items + 10, NUSERS - 10);
+    printf("count %u, buckets %u, expansions %u\n", HASH_COUNT(users),
+           users->hh.tbl->num_buckets, expansions);
+    for (id = 0, user = users; user != NULL; id++, user = (example_user_t*)user->hh.next) {
+        if (user->id != id) {
+            bad++;
+        }
+    }
+    for (id = 0; id < NUSERS; id++) {
+        HASH_FIND_INT(users, &id, found);
+        if (found != items[id]) {
+            bad++;
+        }
+    }
+    printf("int keys: %d bad\n", bad);
+
+    /* a second hash over the same items, keyed by name, from empty */
+    HASH_ADD_BULK_KEYS(ah, names, name[0], 0, 1, items, NUSERS);
+    HASH_FIND(ah, names, "user4321", strlen("user4321"), found);
+    printf("names %u, user4321 is %d\n", HASH_CNT(ah, names), found ? found->id : -1);
+    HASH_ADD_BULK(ah, names, id, sizeof(int), items, 0);
+    printf("empty bulk add, names %u\n", HASH_CNT(ah, names));
+
+    /* parallel select against HASH_SELECT: same items, same order */
+    HASH_SELECT_PARALLEL(bh, sel, hh, users, evens);
+    HASH_SELECT(ch, ref, hh, users, evens);
+    for (a = sel, b = ref; (a != NULL) && (b != NULL);
+         a = (example_user_t*)a->bh.next, b = (example_user_t*)b->ch.next) {
+        if (a != b) {
+            bad++;
+        }
+    }
+    printf("selected %u of %u, %s order\n", HASH_CNT(bh, sel), HASH_CNT(ch, ref),
+           (bad == 0 && a == NULL && b == NULL) ? "same" : "DIFFERENT");
+    id = 77;
+    HASH_FIND(bh, sel, &id, sizeof(int), found);
+    printf("77 %s\n", found ? "selected" : "not selected");
+
+    HASH_CLEAR(bh, sel);
+    HASH_CLEAR(ch, ref);
+    HASH_CLEAR(ah, names);
+    HASH_CLEAR(hh, users);
+    for (id = 0; id < NUSERS; id++) {
+        free(items[id]);
+    }
+    free(items);
+    return 0;
+}
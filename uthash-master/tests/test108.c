@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* HASH_STATS, and exporting it from the fyi hooks (HASH_STATS_FYI) */
+#define HASH_STATS_FYI 1
+#define HASH_BLOOM 12
+
+static int bad_hash;
+struct UT_hash_stats;
+static void stats_fyi(const struct UT_hash_stats *s, const char *event);
+
+#define HASH_FUNCTION(keyptr,keylen,hashv)                                       \
+do {                                                                             \
+  HASH_JEN(keyptr, keylen, hashv);                                               \
+  if (bad_hash) {                                                                \
+    (hashv) &= 0x80000000u;                                                      \
+  }                                                                              \
+} while (0)
+#define uthash_stats_fyi(stats,event) stats_fyi(stats, event)
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    UT_hash_handle hh;
+} example_user_t;
+
+static void stats_fyi(const UT_hash_stats *s, const char *event)
+{
+    printf("  %s: %u items, %u buckets, max chain %u, expansions %u, noexpand %u\n",
+           event, s->num_items, s->num_buckets, s->max_chain, s->expansions,
+           s->noexpand);
+}
+
+static void print_stats(example_user_t *users)
+{
+    UT_hash_stats s;
+    unsigned i, total = 0;
+    HASH_STATS(hh, users, &s);
+    printf("items %u, buckets %u, load %u%%, max chain %u\n", s.num_items,
+           s.num_buckets, s.load_pct, s.max_chain);
+    printf("chains:");
+    for (i = 0; i < HASH_STATS_CHAINS; i++) {
+        printf(" %u", s.chain_hist[i]);
+        total += s.chain_hist[i];
+    }
+    printf(" (%u buckets)\n", total);
+    printf("nonideal %u, ineff_expands %u, noexpand %u, expansions %u\n",
+           s.nonideal_items, s.ineff_expands, s.noexpand, s.expansions);
+    printf("bloom %lu of %lu bits set, overhead %s\n", s.bloom_bits_set,
+           s.bloom_nbits, (s.overhead == HASH_OVERHEAD(hh, users)) ? "ok" : "WRONG");
+}
+
+static example_user_t *fill(int n)
+{
+    example_user_t *users = NULL, *user;
+    int id;
+    for (id = 0; id < n; id++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        HASH_ADD_INT(users, id, user);
+    }
+    return users;
+}
+
+static void empty(example_user_t *users)
+{
+    example_user_t *user, *tmp;
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+}
+
+int main()
+{
+    example_user_t *users;
+
+    print_stats(NULL);
+
+    printf("good hash:\n");
+    users = fill(1000);
+    print_stats(users);
+    empty(users);
+
+    printf("bad hash:\n");
+    bad_hash = 1;
+    users = fill(1000);
+    print_stats(users);
+    empty(users);
+    return 0;
+}
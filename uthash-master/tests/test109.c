@@ -0,0 +1,72 @@
+#include <stdio.h>
+
+/* utarray inline storage, a 3/2 growth factor and utarray_shrink_to_fit */
+#define utarray_grow(n) ((n) < 4 ? 4 : (n) + (n)/2)
+#include "utarray.h"
+
+int main()
+{
+    struct {
+        UT_array a;
+        int buf[4];
+    } small;
+    UT_array *strs, heap;
+    int i, *p;
+    const char *s;
+    char **q;
+
+    utarray_init_inline(&small.a, &ut_int_icd, small.buf, sizeof(small.buf));
+    for (i = 0; i < 4; i++) {
+        utarray_push_back(&small.a, &i);
+    }
+    printf("4 pushed: n %u, %s\n", small.a.n,
+           (small.a.d == (char*)small.buf) ? "inline" : "heap");
+    for (i = 4; i < 10; i++) {
+        utarray_push_back(&small.a, &i);
+    }
+    printf("10 pushed: n %u, %s\n", small.a.n,
+           (small.a.d == (char*)small.buf) ? "inline" : "heap");
+    for (p = (int*)utarray_front(&small.a); p != NULL; p = (int*)utarray_next(&small.a, p)) {
+        printf("%d ", *p);
+    }
+    printf("\n");
+    utarray_shrink_to_fit(&small.a);
+    printf("shrunk: n %u, %s\n", small.a.n,
+           (small.a.d == (char*)small.buf) ? "inline" : "heap");
+    utarray_resize(&small.a, 3);
+    utarray_shrink_to_fit(&small.a);
+    printf("resized to 3 and shrunk: n %u, %s, back %d\n", small.a.n,
+           (small.a.d == (char*)small.buf) ? "inline" : "heap",
+           *(int*)utarray_back(&small.a));
+    utarray_done(&small.a);
+
+    utarray_new_inline(strs, &ut_str_icd, 2);
+    s = "hello";
+    utarray_push_back(strs, &s);
+    s = "world";
+    utarray_push_back(strs, &s);
+    printf("strs: n %u, %s\n", strs->n, (strs->d == (char*)(strs + 1)) ? "inline" : "heap");
+    s = "again";
+    utarray_push_back(strs, &s);
+    utarray_erase(strs, 0, 1);
+    utarray_shrink_to_fit(strs);
+    printf("strs: n %u, %s:", strs->n, (strs->d == (char*)(strs + 1)) ? "inline" : "heap");
+    for (q = NULL; (q = (char**)utarray_next(strs, q)) != NULL; ) {
+        printf(" %s", *q);
+    }
+    printf("\n");
+    utarray_free(strs);
+
+    utarray_init(&heap, &ut_int_icd);
+    for (i = 0; i < 5; i++) {
+        utarray_push_back(&heap, &i);
+    }
+    printf("heap: n %u", heap.n);
+    utarray_shrink_to_fit(&heap);
+    printf(", shrunk %u", heap.n);
+    utarray_clear(&heap);
+    utarray_shrink_to_fit(&heap);
+    printf(", cleared and shrunk %u %s\n", heap.n, heap.d ? "buffer" : "NULL");
+    utarray_done(&heap);
+    return 0;
+}
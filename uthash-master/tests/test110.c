@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utarray.h"
+
+/* utarray_push_back_n and utarray_append_raw */
+int main()
+{
+    UT_array *nums, *strs;
+    int vals[6] = {5, 4, 3, 2, 1, 0}, *p;
+    const char *words[3] = {"alpha", "beta", "gamma"};
+    char *owned[2], **s;
+
+    utarray_new(nums, &ut_int_icd);
+    utarray_push_back_n(nums, vals, 6);
+    utarray_push_back_n(nums, vals, 0);
+    utarray_push_back_n(nums, vals + 3, 3);
+    for (p = (int*)utarray_front(nums); p != NULL; p = (int*)utarray_next(nums, p)) {
+        printf("%d ", *p);
+    }
+    printf("len: %u\n", utarray_len(nums));
+    utarray_append_raw(nums, vals, 2);
+    printf("back %d, len: %u\n", *(int*)utarray_back(nums), utarray_len(nums));
+    utarray_free(nums);
+
+    /* push_back_n deep-copies through icd.copy; append_raw hands over */
+    utarray_new(strs, &ut_str_icd);
+    utarray_push_back_n(strs, words, 3);
+    owned[0] = (char*)malloc(6);
+    owned[1] = (char*)malloc(6);
+    if ((owned[0] == NULL) || (owned[1] == NULL)) {
+        exit(-1);
+    }
+    strcpy(owned[0], "delta");
+    strcpy(owned[1], "omega");
+    utarray_append_raw(strs, owned, 2);
+    for (s = (char**)utarray_front(strs); s != NULL; s = (char**)utarray_next(strs, s)) {
+        printf("%s%s ", *s, (*s == (char*)words[0]) ? "(not copied)" : "");
+    }
+    printf("len: %u\n", utarray_len(strs));
+    utarray_free(strs);
+    return 0;
+}
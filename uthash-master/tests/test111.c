@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include "utarray.h"
+
+/* Eytzinger layout: utarray_eyt_find and utarray_eyt_find_int agree with
+ * utarray_find for every key present and absent, at every size up to 70 */
+static int intcmp(const void *a, const void *b)
+{
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+static int strsort(const void *a, const void *b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int main()
+{
+    UT_array *sorted, *eyt, *strs, *estrs;
+    int n, v, *p, *q, bad = 0;
+    char buf[16], *s, **f;
+
+    utarray_new(sorted, &ut_int_icd);
+    utarray_new(eyt, &ut_int_icd);
+    for (n = 0; n <= 70; n++) {
+        utarray_clear(sorted);
+        for (v = 0; v < n; v++) {
+            int x = 3 * v;
+            utarray_push_back(sorted, &x);
+        }
+        utarray_eytzinger(eyt, sorted);
+        for (v = -1; v <= 3 * n; v++) {
+            p = n ? (int*)utarray_find(sorted, &v, intcmp) : NULL;
+            q = (int*)utarray_eyt_find(eyt, &v, intcmp);
+            if ((p == NULL) != (q == NULL) || (q != NULL && *q != v)) {
+                bad++;
+            }
+            if (utarray_eyt_find_int(eyt, v) != q) {
+                bad++;
+            }
+        }
+    }
+    printf("ints: %u in layout, %d bad\n", utarray_len(eyt), bad);
+    printf("layout of 0..207 by 3:");
+    for (p = (int*)utarray_front(eyt); p != NULL && utarray_eltidx(eyt, p) < 10;
+         p = (int*)utarray_next(eyt, p)) {
+        printf(" %d", *p);
+    }
+    printf(" ...\n");
+
+    utarray_new(strs, &ut_str_icd);
+    utarray_new(estrs, &ut_str_icd);
+    for (v = 0; v < 100; v++) {
+        sprintf(buf, "key%d", v);
+        s = buf;
+        utarray_push_back(strs, &s);
+    }
+    utarray_sort(strs, strsort);
+    utarray_eytzinger(estrs, strs);
+    s = buf;
+    strcpy(buf, "key42");
+    f = (char**)utarray_eyt_find(estrs, &s, strsort);
+    printf("%s %s", buf, f ? "found" : "missing");
+    strcpy(buf, "key420");
+    f = (char**)utarray_eyt_find(estrs, &s, strsort);
+    printf(", %s %s\n", buf, f ? "found" : "missing");
+
+    utarray_free(sorted);
+    utarray_free(eyt);
+    utarray_free(strs);
+    utarray_free(estrs);
+    return 0;
+}
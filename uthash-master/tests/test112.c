@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utarray.h"
+
+/* utarray radix sorts agree with utarray_sort and are stable, below and
+ * above UTARRAY_PARALLEL_MIN */
+typedef struct {
+    int key;
+    unsigned seq;
+} rec_t;
+
+static const UT_icd rec_icd = {sizeof(rec_t), NULL, NULL, NULL};
+
+static uint64_t rec_key(const void *elt)
+{
+    return utarray_int_key(&((const rec_t*)elt)->key);
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+    const rec_t *x = (const rec_t*)a, *y = (const rec_t*)b;
+    if (x->key != y->key) {
+        return (x->key < y->key) ? -1 : 1;
+    }
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static int strsort(const void *a, const void *b)
+{
+    return strcmp(utarray_str_key(a), utarray_str_key(b));
+}
+
+static int check_recs(unsigned n, int parallel)
+{
+    UT_array *a, *b;
+    rec_t r;
+    int bad;
+    utarray_new(a, &rec_icd);
+    utarray_new(b, &rec_icd);
+    for (r.seq = 0; r.seq < n; r.seq++) {
+        r.key = (rand() % 2001) - 1000;
+        if (r.seq % 7 == 0) {
+            r.key *= 1000000;
+        }
+        utarray_push_back(a, &r);
+    }
+    utarray_concat(b, a);
+    if (n > 0) {
+        utarray_sort(b, rec_cmp);   /* seq breaks ties: the stable order */
+    }
+    if (parallel) {
+        utarray_radix_sort_parallel(a, rec_key);
+    } else {
+        utarray_radix_sort(a, rec_key);
+    }
+    bad = (n > 0) && memcmp(a->d, b->d, n * sizeof(rec_t));
+    utarray_free(a);
+    utarray_free(b);
+    return bad;
+}
+
+static int check_strs(unsigned n, int parallel)
+{
+    UT_array *a, *b;
+    char buf[32], *s;
+    unsigned i;
+    int bad = 0;
+    utarray_new(a, &ut_str_icd);
+    utarray_new(b, &ut_str_icd);
+    for (i = 0; i < n; i++) {
+        sprintf(buf, "%s%d", (i % 3) ? "common/prefix/" : "", rand() % 500);
+        s = (i % 97 == 5) ? NULL : buf;
+        utarray_push_back(a, &s);
+    }
+    utarray_concat(b, a);
+    if (n > 0) {
+        utarray_sort(b, strsort);
+    }
+    if (parallel) {
+        utarray_radix_sort_str_parallel(a, utarray_str_key);
+    } else {
+        utarray_radix_sort_str(a, utarray_str_key);
+    }
+    for (i = 0; i < n; i++) {
+        if (strsort(utarray_eltptr(a, i), utarray_eltptr(b, i)) != 0) {
+            bad = 1;
+        }
+    }
+    utarray_free(a);
+    utarray_free(b);
+    return bad;
+}
+
+int main()
+{
+    unsigned sizes[] = {0, 1, 2, 31, 32, 1000, 70000};
+    unsigned i;
+    UT_array *nums;
+    int v, *p;
+
+    srand(1);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        printf("%u: recs %s %s, strs %s %s\n", sizes[i],
+               check_recs(sizes[i], 0) ? "BAD" : "ok", check_recs(sizes[i], 1) ? "BAD" : "ok",
+               check_strs(sizes[i], 0) ? "BAD" : "ok", check_strs(sizes[i], 1) ? "BAD" : "ok");
+    }
+
+    utarray_new(nums, &ut_int_icd);
+    for (v = 5; v >= -5; v -= 2) {
+        utarray_push_back(nums, &v);
+    }
+    utarray_radix_sort(nums, utarray_int_key);
+    for (p = (int*)utarray_front(nums); p != NULL; p = (int*)utarray_next(nums, p)) {
+        printf("%d ", *p);
+    }
+    printf("\n");
+    utarray_free(nums);
+    return 0;
+}
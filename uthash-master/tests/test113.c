@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include "utstring.h"
+
+/* prepared needles, and searches long enough for the SIMD blocks and the
+ * KMP fallback on periodic text */
+int main()
+{
+    UT_string *s;
+    UT_string_needle nd, big;
+    long pos;
+    int i, n = 0;
+    char pat[41];
+
+    utstring_new(s);
+    for (i = 0; i < 50; i++) {
+        utstring_printf(s, "line %d: %s\n", i, (i % 7 == 3) ? "ERROR disk" : "ok");
+    }
+    utstring_needle_init(&nd, "ERROR", 5);
+    for (pos = 0; (pos = utstring_find_needle(s, pos, &nd)) >= 0; pos++) {
+        n++;
+    }
+    printf("%d errors, first at %ld, last at %ld\n", n, utstring_find_needle(s, 0, &nd),
+           utstring_findR_needle(s, -1, &nd));
+    printf("from 100: %ld, find %ld\n", utstring_find_needle(s, 100, &nd),
+           utstring_find(s, 100, "ERROR", 5));
+    utstring_needle_done(&nd);
+
+    /* 4000 a's, then the pattern of 40 a's with a b in the middle: every
+     * position passes the first/last byte filter, which takes the KMP path */
+    utstring_clear(s);
+    for (i = 0; i < 4000; i++) {
+        utstring_bincpy(s, "a", 1);
+    }
+    memset(pat, 'a', 40);
+    pat[20] = 'b';
+    pat[40] = '\0';
+    utstring_bincpy(s, pat, 40);
+    utstring_bincpy(s, "ab", 2);
+    utstring_needle_init(&big, pat, 40);
+    printf("len %u: %ld %ld %ld %ld\n", (unsigned)utstring_len(s),
+           utstring_find_needle(s, 0, &big), utstring_find(s, 0, pat, 40),
+           utstring_findR_needle(s, -1, &big), utstring_findR(s, -1, pat, 40));
+    printf("past it: %ld, before it: %ld\n", utstring_find_needle(s, 4001, &big),
+           utstring_findR_needle(s, 4038, &big));
+    utstring_needle_done(&big);
+    utstring_free(s);
+    return 0;
+}
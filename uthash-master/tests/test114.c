@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <limits.h>
+#include "utstring.h"
+
+/* utstring_append_int, utstring_append_u64 and utstring_append_hex agree
+ * with utstring_printf */
+int main()
+{
+    UT_string *a, *b;
+    int64_t ints[] = {0, 7, -7, 10, 99, 100, -100, 12345, 2147483647,
+                      -2147483647 - 1, INT64_MAX, INT64_MIN
+                     };
+    uint64_t v;
+    unsigned i, bad = 0;
+
+    utstring_new(a);
+    utstring_new(b);
+    for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+        utstring_append_int(a, ints[i]);
+        utstring_bincpy(a, " ", 1);
+        utstring_printf(b, "%lld ", (long long)ints[i]);
+    }
+    printf("%s\n%s\n", utstring_body(a), strcmp(utstring_body(a), utstring_body(b)) ? "DIFFERENT" : "same");
+
+    utstring_clear(a);
+    utstring_append_u64(a, UINT64_MAX);
+    utstring_bincpy(a, " 0x", 3);
+    utstring_append_hex(a, UINT64_MAX);
+    utstring_bincpy(a, " 0x", 3);
+    utstring_append_hex(a, 0);
+    utstring_bincpy(a, " r", 2);
+    utstring_append_int(a, 31);
+    printf("%s (len %u)\n", utstring_body(a), (unsigned)utstring_len(a));
+
+    /* powers of ten and of sixteen, and their neighbours */
+    for (v = 1; v != 0 && v < UINT64_MAX / 10; v *= 10) {
+        utstring_clear(a);
+        utstring_clear(b);
+        utstring_append_u64(a, v - 1);
+        utstring_append_u64(a, v);
+        utstring_append_hex(a, v + 1);
+        utstring_printf(b, "%llu%llu%llx", (unsigned long long)(v - 1),
+                        (unsigned long long)v, (unsigned long long)(v + 1));
+        bad += (strcmp(utstring_body(a), utstring_body(b)) != 0);
+    }
+    printf("%u bad\n", bad);
+    utstring_free(a);
+    utstring_free(b);
+    return 0;
+}
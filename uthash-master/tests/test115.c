@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "utqueue.h"
+
+/* UT_spsc and UT_mpmc between threads: nothing lost, duplicated or (for
+ * the SPSC queue) reordered */
+#define NITEMS 200000
+#define NPROD 3
+#define NCONS 2
+
+static UT_spsc sq;
+static UT_mpmc mq;
+static unsigned long consumed[NCONS];
+static unsigned char seen[NPROD * NITEMS];
+
+static void *spsc_producer(void *arg)
+{
+    unsigned batch[7], i, j, n;
+    (void)arg;
+    for (i = 0; i < NITEMS; i += n) {
+        n = (i % 3 == 0 || NITEMS - i < 7) ? 1 : 7;
+        for (j = 0; j < n; j++) {
+            batch[j] = i + j;
+        }
+        if (n == 1) {
+            utspsc_push(&sq, batch);
+        } else {
+            utspsc_push_n(&sq, batch, n);
+        }
+    }
+    return NULL;
+}
+
+static void *mpmc_producer(void *arg)
+{
+    unsigned base = (unsigned)(size_t)arg * NITEMS, i, v;
+    for (i = 0; i < NITEMS; i++) {
+        v = base + i;
+        utmpmc_push(&mq, &v);
+    }
+    return NULL;
+}
+
+static void *mpmc_consumer(void *arg)
+{
+    unsigned v, id = (unsigned)(size_t)arg;
+    for (;;) {
+        utmpmc_pop(&mq, &v);
+        if (v == ~0U) {
+            return NULL;
+        }
+        seen[v]++;
+        consumed[id]++;
+    }
+}
+
+int main()
+{
+    pthread_t prod[NPROD], cons[NCONS];
+    unsigned v, next = 0, got[16], n, i, stop = ~0U, bad = 0, batches = 0;
+    unsigned long total = 0;
+
+    /* SPSC, one element and batches each way */
+    utspsc_init(&sq, 100, sizeof(unsigned));
+    printf("spsc capacity %u\n", (unsigned)(sq.mask + 1));
+    pthread_create(&prod[0], NULL, spsc_producer, NULL);
+    while (next < NITEMS) {
+        if (next % 2) {
+            n = (unsigned)utspsc_trypop_n(&sq, got, 16);
+            batches += (n > 1);
+        } else {
+            utspsc_pop(&sq, got);
+            n = 1;
+        }
+        for (i = 0; i < n; i++) {
+            if (got[i] != next++) {
+                bad++;
+            }
+        }
+    }
+    pthread_join(prod[0], NULL);
+    printf("spsc: %u received in order, %u out of order, empty %d\n", next, bad,
+           utspsc_trypop(&sq, &v) == 0);
+    utspsc_done(&sq);
+
+    /* MPMC */
+    utmpmc_init(&mq, 64, sizeof(unsigned));
+    for (i = 0; i < NCONS; i++) {
+        pthread_create(&cons[i], NULL, mpmc_consumer, (void*)(size_t)i);
+    }
+    for (i = 0; i < NPROD; i++) {
+        pthread_create(&prod[i], NULL, mpmc_producer, (void*)(size_t)i);
+    }
+    for (i = 0; i < NPROD; i++) {
+        pthread_join(prod[i], NULL);
+    }
+    for (i = 0; i < NCONS; i++) {
+        utmpmc_push(&mq, &stop);
+    }
+    for (i = 0; i < NCONS; i++) {
+        pthread_join(cons[i], NULL);
+        total += consumed[i];
+    }
+    for (bad = 0, i = 0; i < NPROD * NITEMS; i++) {
+        bad += (seen[i] != 1);
+    }
+    printf("mpmc: %lu received, %u lost or duplicated\n", total, bad);
+
+    /* non-blocking: fill, refuse, drain */
+    for (n = 0; utmpmc_trypush(&mq, &n); n++) {
+    }
+    printf("mpmc took %u before full, batch pop %u\n", n,
+           (unsigned)utmpmc_trypop_n(&mq, got, 16));
+    utmpmc_done(&mq);
+    return 0;
+}
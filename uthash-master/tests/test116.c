@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include "utstack.h"
+
+/* VSTACK: array-backed value stacks, one element and bulk, with growth */
+typedef struct point {
+    int x, y;
+} point;
+
+typedef VSTACK(int) int_stack;
+
+int main()
+{
+    int_stack s;
+    VSTACK(point) ps;
+    point p, pts[3] = { {1, 2}, {3, 4}, {5, 6} };
+    int i, v, sum = 0, bad = 0, batch[100];
+
+    VSTACK_INIT(s);
+    printf("empty %d, count %u\n", VSTACK_EMPTY(s), (unsigned)VSTACK_COUNT(s));
+    for (i = 0; i < 1000; i++) {
+        VSTACK_PUSH(s, i);
+    }
+    printf("count %u, top %d, cap %u\n", (unsigned)VSTACK_COUNT(s), VSTACK_TOP(s),
+           (unsigned)s.cap);
+    for (i = 999; i >= 900; i--) {
+        VSTACK_POP(s, v);
+        bad += (v != i);
+    }
+    VSTACK_POP_N(s, batch, 100);
+    for (i = 0; i < 100; i++) {
+        bad += (batch[i] != 800 + i);
+    }
+    VSTACK_PUSH_N(s, batch, 100);
+    VSTACK_PUSH_N(s, batch, 0);
+    printf("count %u, top %d, %d out of order\n", (unsigned)VSTACK_COUNT(s),
+           VSTACK_TOP(s), bad);
+    while (!VSTACK_EMPTY(s)) {
+        VSTACK_POP(s, v);
+        sum += v;
+    }
+    printf("sum %d\n", sum);
+
+    /* reserve up front, then no growth */
+    VSTACK_CLEAR(s);
+    VSTACK_RESERVE(s, 5000);
+    v = (int)s.cap;
+    for (i = 0; i < 5000; i++) {
+        VSTACK_PUSH(s, i);
+    }
+    printf("reserved %s\n", (int)s.cap == v ? "held" : "grew");
+    VSTACK_FREE(s);
+    printf("freed, count %u\n", (unsigned)VSTACK_COUNT(s));
+
+    /* structs by value */
+    VSTACK_INIT(ps);
+    VSTACK_PUSH_N(ps, pts, 3);
+    p.x = 7;
+    p.y = 8;
+    VSTACK_PUSH(ps, p);
+    VSTACK_POP(ps, p);
+    printf("popped (%d,%d), top (%d,%d)\n", p.x, p.y, VSTACK_TOP(ps).x, VSTACK_TOP(ps).y);
+    VSTACK_FREE(ps);
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utlist.h"
+
+/* LL/DL/CDL_SORT_NATURAL: the same order as LL/DL/CDL_SORT (stable) on
+ * random, presorted, reversed and nearly sorted lists, with few comparisons
+ * on the presorted ones */
+typedef struct el {
+    int key, seq;
+    struct el *next, *prev;
+    struct el *n2, *p2;
+} el;
+
+#define NELTS 2000
+
+static unsigned long compares;
+
+static int keycmp(el *a, el *b)
+{
+    compares++;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+int main()
+{
+    static el elts[NELTS], copy[NELTS];
+    el *ll, *dl, *cdl, *ref, *e;
+    int i, shape, bad;
+    const char *shapes[] = { "random", "sorted", "reversed", "nearly sorted", "few keys" };
+
+    srand(42);
+    for (shape = 0; shape < 5; shape++) {
+        for (i = 0; i < NELTS; i++) {
+            elts[i].seq = i;
+            elts[i].key = shape == 0 ? rand() % 100000 :
+                          shape == 1 ? i :
+                          shape == 2 ? NELTS - i :
+                          shape == 3 ? i + ((i % 97) == 0 ? -50 : 0) :
+                          rand() % 4;
+            copy[i] = elts[i];
+        }
+        /* reference: DL_SORT through n2/p2 on the copies */
+        ref = NULL;
+        for (i = 0; i < NELTS; i++) {
+            DL_APPEND2(ref, &copy[i], p2, n2);
+        }
+        DL_SORT2(ref, keycmp, p2, n2);
+
+        bad = 0;
+        ll = NULL;
+        for (i = 0; i < NELTS; i++) {
+            LL_APPEND(ll, &elts[i]);
+        }
+        compares = 0;
+        LL_SORT_NATURAL(ll, keycmp);
+        for (e = ll, dl = ref; (e != NULL) && (dl != NULL); e = e->next, dl = dl->n2) {
+            bad += (e->key != dl->key) || (e->seq != dl->seq);
+        }
+        bad += (e != NULL) || (dl != NULL);
+        printf("%s: LL %s", shapes[shape], bad ? "WRONG" : "ok");
+        if (shape == 1 || shape == 2) {
+            printf(" (%lu compares)", compares);
+        }
+
+        dl = NULL;
+        for (i = 0; i < NELTS; i++) {
+            DL_APPEND(dl, &elts[i]);
+        }
+        DL_SORT_NATURAL(dl, keycmp);
+        bad = 0;
+        for (e = dl, cdl = ref; (e != NULL) && (cdl != NULL); e = e->next, cdl = cdl->n2) {
+            bad += (e->key != cdl->key) || (e->seq != cdl->seq) ||
+                   (e != dl && e->prev->next != e);
+        }
+        bad += (e != NULL) || (cdl != NULL) || (dl->prev->next != NULL);
+        printf(", DL %s", bad ? "WRONG" : "ok");
+
+        cdl = NULL;
+        for (i = 0; i < NELTS; i++) {
+            CDL_APPEND(cdl, &elts[i]);
+        }
+        CDL_SORT_NATURAL(cdl, keycmp);
+        bad = 0;
+        e = cdl;
+        dl = ref;
+        do {
+            bad += (e->key != dl->key) || (e->seq != dl->seq) || (e->prev->next != e);
+            e = e->next;
+            dl = dl->n2;
+        } while (e != cdl && dl != NULL);
+        bad += (e != cdl) || (dl != NULL);
+        printf(", CDL %s\n", bad ? "WRONG" : "ok");
+    }
+
+    /* short lists */
+    ll = NULL;
+    LL_SORT_NATURAL(ll, keycmp);
+    elts[0].key = 1;
+    LL_APPEND(ll, &elts[0]);
+    LL_SORT_NATURAL(ll, keycmp);
+    elts[1].key = 0;
+    LL_APPEND(ll, &elts[1]);
+    LL_SORT_NATURAL(ll, keycmp);
+    printf("two: %d %d, end %s\n", ll->key, ll->next->key, ll->next->next ? "linked" : "NULL");
+    cdl = NULL;
+    CDL_APPEND(cdl, &elts[0]);
+    CDL_SORT_NATURAL(cdl, keycmp);
+    printf("one circular: %s\n", (cdl->next == cdl && cdl->prev == cdl) ? "ok" : "WRONG");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include "utlist.h"
+
+/* UL_ unrolled lists: append, prepend, insert (with node splits), delete
+ * (with merges), iterate and search, checked against a plain array */
+typedef struct point {
+    int x, y;
+} point;
+
+UL_DECLARE(int_list, int);
+UL_DECLARE(point_list, point);
+
+#define NVALS 1000
+
+static int ref[2 * NVALS + 10], nref;
+
+static int check(int_list *l)
+{
+    struct int_list_node *nd;
+    int *p, i = 0, bad = 0;
+    size_t nodes = 0;
+    UL_FOREACH(*l, nd, p) {
+        bad += (i >= nref) || (*p != ref[i]);
+        i++;
+    }
+    for (nd = l->head; nd != NULL; nd = nd->next) {
+        bad += (nd->n == 0) || (nd->next ? nd->next->prev != nd : l->tail != nd);
+        nodes++;
+    }
+    bad += (i != nref) || (UL_COUNT(*l) != (size_t)nref);
+    if (bad) {
+        printf("list differs at %d\n", i);
+    }
+    return (int)nodes;
+}
+
+static int ptcmp(point *a, point *b)
+{
+    return (a->x != b->x) || (a->y != b->y);
+}
+
+int main()
+{
+    int_list l;
+    point_list pl;
+    struct int_list_node *nd;
+    struct point_list_node *pnd;
+    int *p, i, k, nodes;
+    point pt, *pp;
+
+    printf("%u ints, %u points per node\n", UL_CAP(l), UL_CAP(pl));
+    UL_INIT(l);
+    printf("empty %d\n", UL_EMPTY(l));
+    for (i = 0; i < NVALS; i++) {
+        UL_APPEND(l, i);
+        ref[nref++] = i;
+    }
+    nodes = check(&l);
+    printf("appended %u in %d nodes\n", (unsigned)UL_COUNT(l), nodes);
+
+    /* prepend a few */
+    for (i = 1; i <= 3; i++) {
+        UL_PREPEND(l, -i);
+        for (k = nref; k > 0; k--) {
+            ref[k] = ref[k - 1];
+        }
+        ref[0] = -i;
+        nref++;
+    }
+    check(&l);
+    printf("prepended, first %d\n", l.head->elts[0]);
+
+    /* insert 5000+v before every multiple of 10, splitting full nodes */
+    for (UL_FIRST(l, nd, p); p != NULL; UL_NEXT(nd, p)) {
+        if (*p >= 0 && *p % 10 == 0) {
+            UL_INSERT(l, nd, p, 5000 + *p);
+            UL_NEXT(nd, p);     /* back on the value it went before */
+        }
+    }
+    for (i = 0, k = 0; i < nref; i++) {
+        if (ref[i] >= 0 && ref[i] % 10 == 0) {
+            k++;
+        }
+    }
+    for (i = nref - 1; i >= 0; i--) {
+        ref[i + k] = ref[i];
+        if (ref[i] >= 0 && ref[i] % 10 == 0) {
+            k--;
+            ref[i + k] = 5000 + ref[i];
+        }
+    }
+    nref += NVALS / 10;
+    nodes = check(&l);
+    printf("inserted, %u values in %d nodes\n", (unsigned)UL_COUNT(l), nodes);
+
+    /* delete the odd values while walking */
+    UL_FIRST(l, nd, p);
+    while (p != NULL) {
+        if (*p & 1) {
+            UL_DELETE(l, nd, p);
+        } else {
+            UL_NEXT(nd, p);
+        }
+    }
+    for (i = 0, k = 0; i < nref; i++) {
+        if (!(ref[i] & 1)) {
+            ref[k++] = ref[i];
+        }
+    }
+    nref = k;
+    nodes = check(&l);
+    printf("deleted odds, %u values in %d nodes\n", (unsigned)UL_COUNT(l), nodes);
+
+    UL_SEARCH_SCALAR(l, nd, p, 5990);
+    printf("5990 %s\n", p ? "found" : "missing");
+    UL_SEARCH_SCALAR(l, nd, p, 7);
+    printf("7 %s\n", p ? "found" : "missing");
+
+    /* delete everything from the front */
+    UL_FIRST(l, nd, p);
+    while (p != NULL) {
+        UL_DELETE(l, nd, p);
+    }
+    printf("emptied: count %u, head %s, tail %s\n", (unsigned)UL_COUNT(l),
+           l.head ? "set" : "NULL", l.tail ? "set" : "NULL");
+    UL_FREE(l);
+
+    /* structs by value */
+    UL_INIT(pl);
+    for (i = 0; i < 20; i++) {
+        pt.x = i;
+        pt.y = i * i;
+        UL_APPEND(pl, pt);
+    }
+    pt.x = 7;
+    pt.y = 49;
+    UL_SEARCH(pl, pnd, pp, &pt, ptcmp);
+    printf("point (7,49) %s\n", pp ? "found" : "missing");
+    UL_FREE(pl);
+    printf("freed, empty %d\n", UL_EMPTY(pl));
+    return 0;
+}
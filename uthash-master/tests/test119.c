@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* word keys: HASH_ADD_FASTINT/FASTPTR and the _WORD forms, with the same
+ * finds, replaces and deletes as the HASH_FUNCTION tables, through expansions */
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    int cookie;
+    UT_hash_handle hh;
+} example_user_t;
+
+typedef struct ptr_item {
+    void *ptr;
+    long big;
+    UT_hash_handle hh;
+    UT_hash_handle bh;
+} ptr_item;
+
+#define NUSERS 10000
+
+int main()
+{
+    example_user_t *users = NULL, *user, *found, *replaced;
+    ptr_item *ptrs = NULL, *bigs = NULL, *items, *pi;
+    int i, bad = 0;
+    long big;
+    char *base;
+
+    for (i = 0; i < NUSERS; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i * 3;
+        user->cookie = i;
+        HASH_ADD_FASTINT(users, id, user);
+    }
+    printf("%u users, %u buckets\n", HASH_COUNT(users), users->hh.tbl->num_buckets);
+    for (i = 0; i < 3 * NUSERS; i++) {
+        HASH_FIND_FASTINT(users, &i, found);
+        if ((i % 3 == 0) != (found != NULL) || (found && found->cookie != i / 3)) {
+            bad++;
+        }
+    }
+    i = -1;
+    HASH_FIND_FASTINT(users, &i, found);
+    printf("finds: %d wrong, -1 %s\n", bad, found ? "found" : "not found");
+
+    /* replace one, delete the odd cookies */
+    user = (example_user_t*)malloc(sizeof(example_user_t));
+    if (user == NULL) {
+        exit(-1);
+    }
+    user->id = 30;
+    user->cookie = -10;
+    HASH_REPLACE_FASTINT(users, id, user, replaced);
+    printf("replaced cookie %d\n", replaced ? replaced->cookie : 0);
+    free(replaced);
+    i = 30;
+    HASH_FIND_FASTINT(users, &i, found);
+    printf("30 has cookie %d\n", found ? found->cookie : 0);
+    HASH_ITER(hh, users, user, found) {
+        if (user->cookie & 1) {
+            HASH_DEL(users, user);
+            free(user);
+        }
+    }
+    for (bad = 0, i = 0; i < 3 * NUSERS; i += 3) {
+        HASH_FIND_FASTINT(users, &i, found);
+        if ((found != NULL) != ((i / 3) % 2 == 0)) {
+            bad++;
+        }
+    }
+    printf("after deletes: %u users, %d wrong\n", HASH_COUNT(users), bad);
+
+    /* pointer keys, and an 8-byte key through a second handle */
+    items = (ptr_item*)calloc(NUSERS, sizeof(ptr_item));
+    base = (char*)malloc(NUSERS);
+    if ((items == NULL) || (base == NULL)) {
+        exit(-1);
+    }
+    for (i = 0; i < NUSERS; i++) {
+        items[i].ptr = base + i;
+        items[i].big = (long)i << 33;
+        HASH_ADD_FASTPTR(ptrs, ptr, &items[i]);
+        HASH_ADD_WORD(bh, bigs, big, sizeof(long), &items[i]);
+    }
+    for (bad = 0, i = 0; i < NUSERS; i++) {
+        void *key = base + i;
+        HASH_FIND_FASTPTR(ptrs, &key, pi);
+        bad += (pi != &items[i]);
+        big = (long)i << 33;
+        HASH_FIND_WORD(bh, bigs, &big, sizeof(long), pi);
+        bad += (pi != &items[i]);
+    }
+    big = 1;
+    HASH_FIND_WORD(bh, bigs, &big, sizeof(long), pi);
+    printf("ptr and long keys: %d wrong, 1 %s\n", bad, pi ? "found" : "not found");
+
+    HASH_CLEAR(bh, bigs);
+    HASH_CLEAR(hh, ptrs);
+    free(items);
+    free(base);
+    HASH_ITER(hh, users, user, found) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* secondary hashes over the same keys (HASH_ADD_FROM, HASH_ADD_BULK_FROM):
+ * the items are found through every handle, and no key is hashed again */
+static unsigned hashes;
+
+#define HASH_FUNCTION(keyptr,keylen,hashv)                                       \
+do {                                                                             \
+  hashes++;                                                                      \
+  HASH_JEN(keyptr, keylen, hashv);                                               \
+} while (0)
+#include "uthash.h"
+
+typedef struct example_user_t {
+    char name[16];
+    int id;
+    UT_hash_handle hh;
+    UT_hash_handle ah;
+    UT_hash_handle bh;
+} example_user_t;
+
+#define NUSERS 1000
+
+int main()
+{
+    example_user_t *users = NULL, *odd = NULL, *all = NULL;
+    example_user_t **items, *user, *tmp, *found;
+    char name[16];
+    int id, n = 0, bad = 0;
+
+    items = (example_user_t**)malloc(NUSERS * sizeof(example_user_t*));
+    if (items == NULL) {
+        exit(-1);
+    }
+    for (id = 0; id < NUSERS; id++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        sprintf(user->name, "user%d", id);
+        HASH_ADD_STR(users, name, user);
+    }
+    printf("%u users, %u hashes\n", HASH_COUNT(users), hashes);
+
+    /* one by one: the odd users, through ah */
+    hashes = 0;
+    HASH_ITER(hh, users, user, tmp) {
+        if (user->id % 2) {
+            HASH_ADD_FROM(ah, odd, hh, user);
+        }
+    }
+    printf("odd: %u users, %u hashes\n", HASH_CNT(ah, odd), hashes);
+
+    /* in bulk: every user, through bh, in the order of users */
+    hashes = 0;
+    HASH_ITER(hh, users, user, tmp) {
+        items[n++] = user;
+    }
+    HASH_ADD_BULK_FROM(bh, all, hh, items, n);
+    printf("all: %u users, %u buckets, %u hashes\n", HASH_CNT(bh, all),
+           all->bh.tbl->num_buckets, hashes);
+    for (n = 0, user = all; user != NULL; user = (example_user_t*)user->bh.next) {
+        if (user != items[n++]) {
+            bad++;
+        }
+    }
+
+    for (id = 0; id < NUSERS; id++) {
+        sprintf(name, "user%d", id);
+        HASH_FIND(bh, all, name, strlen(name), found);
+        if ((found == NULL) || (found->id != id)) {
+            bad++;
+        }
+        HASH_FIND(ah, odd, name, strlen(name), found);
+        if ((found != NULL) != (id % 2)) {
+            bad++;
+        }
+    }
+    printf("finds: %d bad\n", bad);
+
+    HASH_CLEAR(ah, odd);
+    HASH_CLEAR(bh, all);
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    free(items);
+    return 0;
+}
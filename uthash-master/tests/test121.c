@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* snapshots (utsnap.h): a saved hash loads back with the same items, order
+ * and finds; it can be changed and saved again; bad snapshots are refused */
+#include "utsnap.h"
+
+typedef struct example_user_t {
+    char name[16];
+    int id;
+    UT_hash_handle hh;
+} example_user_t;
+
+typedef struct other_t {
+    int id;
+    UT_hash_handle hh;
+} other_t;
+
+#define NUSERS 1000
+
+static int check(example_user_t *users, int *ids, int n)
+{
+    example_user_t *user, *found;
+    int i = 0, bad = 0;
+
+    for (user = users; user != NULL; user = (example_user_t*)user->hh.next) {
+        if ((i >= n) || (user->id != ids[i++])) {
+            bad++;
+        }
+        HASH_FIND_STR(users, user->name, found);
+        if (found != user) {
+            bad++;
+        }
+    }
+    HASH_FIND_STR(users, "nobody", found);
+    return bad + (i != n) + (found != NULL) + (HASH_COUNT(users) != (unsigned)n);
+}
+
+int main()
+{
+    example_user_t *users = NULL, *loaded = NULL, *again = NULL, *user, *tmp;
+    other_t *others = NULL;
+    UT_snap snap, snap2;
+    int ids[NUSERS + 1], n = 0, id, rc;
+    static char outside[] = "outside";
+
+    for (id = 0; id < NUSERS; id++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = id;
+        sprintf(user->name, "user%d", id);
+        HASH_ADD_STR(users, name, user);
+    }
+    HASH_ITER(hh, users, user, tmp) {
+        if (user->id % 3 == 0) {
+            HASH_DEL(users, user);
+            free(user);
+        } else {
+            ids[n++] = user->id;
+        }
+    }
+
+    UTSNAP_SAVE(hh, users, "test121.snap", rc);
+    printf("save: %d, original %d bad\n", rc, check(users, ids, n));
+    UTSNAP_LOAD(hh, loaded, "test121.snap", &snap, rc);
+    HASH_FSCK(hh, loaded, "load");
+    printf("load: %d, %u users, %u buckets, %d bad\n", rc, HASH_COUNT(loaded),
+           loaded->hh.tbl->num_buckets, check(loaded, ids, n));
+
+    /* change the loaded hash and snapshot it in turn */
+    HASH_FIND_STR(loaded, "user1", user);
+    HASH_DEL(loaded, user);
+    memmove(ids, ids + 1, (size_t)(n - 1) * sizeof(int));
+    user = (example_user_t*)malloc(sizeof(example_user_t));
+    if (user == NULL) {
+        exit(-1);
+    }
+    user->id = NUSERS;
+    strcpy(user->name, "newcomer");
+    HASH_ADD_STR(loaded, name, user);
+    ids[n - 1] = NUSERS;
+    UTSNAP_SAVE(hh, loaded, "test121.snap", rc);
+    HASH_DEL(loaded, user);
+    free(user);
+    UTSNAP_UNMAP(hh, loaded, &snap);
+    UTSNAP_LOAD(hh, again, "test121.snap", &snap2, rc);
+    HASH_FIND_STR(again, "newcomer", user);
+    printf("reload: %d, %u users, %d bad, newcomer %d\n", rc, HASH_COUNT(again),
+           check(again, ids, n), user ? user->id : -1);
+    UTSNAP_UNMAP(hh, again, &snap2);
+
+    /* a snapshot of another item type, or of no file, isn't loaded */
+    UTSNAP_LOAD(hh, others, "test121.snap", &snap, rc);
+    printf("other type: %d, %s\n", rc, (errno == EINVAL) ? "EINVAL" : "?");
+    UTSNAP_LOAD(hh, others, "test121.missing", &snap, rc);
+    printf("no file: %d, %s\n", rc, others ? "loaded" : "nothing loaded");
+
+    /* an empty hash, and one whose key is outside its item */
+    UTSNAP_SAVE(hh, others, "test121.snap", rc);
+    UTSNAP_LOAD(hh, others, "test121.snap", &snap, rc);
+    printf("empty: %d, %u items\n", rc, HASH_COUNT(others));
+    HASH_FIND_STR(users, "user2", user);
+    HASH_DEL(users, user);
+    HASH_ADD_KEYPTR(hh, users, outside, strlen(outside), user);
+    UTSNAP_SAVE(hh, users, "test121.snap", rc);
+    printf("key outside: %d, %s\n", rc, (errno == EINVAL) ? "EINVAL" : "?");
+    HASH_FIND_STR(users, "outside", tmp);
+    printf("still found: %s\n", (tmp == user) ? "yes" : "no");
+    remove("test121.snap");
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* HASH_INORDER_INDEX: _INORDER adds through the skip list keep the hash in
+ * order with O(log n) comparisons, across deletes, replaces and sorts */
+#define HASH_INORDER_INDEX 1
+#include "uthash.h"
+
+typedef struct example_user_t {
+    int id;
+    int cookie;
+    UT_hash_handle hh;
+} example_user_t;
+
+#define NUSERS 5000
+
+static unsigned long cmps;
+
+static int ascending(example_user_t *a, example_user_t *b)
+{
+    cmps++;
+    return (a->id < b->id) ? -1 : (a->id > b->id);
+}
+
+static int descending(example_user_t *a, example_user_t *b)
+{
+    return ascending(b, a);
+}
+
+/* items out of order under cmp, and whether equal ids kept cookie order */
+static int unsorted(example_user_t *users, int (*cmp)(example_user_t*, example_user_t*))
+{
+    example_user_t *user;
+    int bad = 0;
+    for (user = users; (user != NULL) && (user->hh.next != NULL);
+         user = (example_user_t*)user->hh.next) {
+        int c = cmp(user, (example_user_t*)user->hh.next);
+        if ((c > 0) || ((c == 0) && (user->cookie > ((example_user_t*)user->hh.next)->cookie))) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp, *replaced;
+    unsigned r = 12345;
+    int i, found = 0;
+
+    cmps = 0;
+    for (i = 0; i < NUSERS; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        r = r * 1103515245U + 12345U;
+        user->id = (int)((r >> 8) % (NUSERS / 2));   /* with duplicates */
+        user->cookie = i;
+        HASH_ADD_INORDER(hh, users, id, sizeof(int), user, ascending);
+    }
+    printf("%u users, %d out of order, %s comparisons per add\n", HASH_COUNT(users),
+           unsorted(users, ascending), (cmps < 40UL * NUSERS) ? "few" : "MANY");
+
+    /* deletes unlink nodes; later adds still land in order */
+    HASH_ITER(hh, users, user, tmp) {
+        if (user->cookie % 3 == 0) {
+            HASH_DEL(users, user);
+            free(user);
+        }
+    }
+    for (i = 0; i < 1000; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i * 7 % (NUSERS / 2);
+        user->cookie = NUSERS + i;
+        HASH_ADD_INORDER(hh, users, id, sizeof(int), user, ascending);
+    }
+    printf("after deletes and adds: %u users, %d out of order\n", HASH_COUNT(users),
+           unsorted(users, ascending));
+
+    /* a replace is a delete and an ordered add */
+    user = (example_user_t*)malloc(sizeof(example_user_t));
+    if (user == NULL) {
+        exit(-1);
+    }
+    user->id = 1242;
+    user->cookie = 2 * NUSERS;
+    HASH_REPLACE_INORDER(hh, users, id, sizeof(int), user, replaced, ascending);
+    if (replaced != NULL) {
+        free(replaced);
+    }
+    HASH_FIND_INT(users, &user->id, tmp);
+    printf("replaced: %d out of order, 1242 has cookie %d\n",
+           unsorted(users, ascending), tmp ? tmp->cookie : -1);
+
+    /* a sort drops the index; adds in the new order rebuild it */
+    HASH_SRT(hh, users, descending);
+    cmps = 0;
+    for (i = 0; i < 1000; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = -1 - i;   /* at the tail */
+        user->cookie = 3 * NUSERS + i;
+        HASH_ADD_INORDER(hh, users, id, sizeof(int), user, descending);
+    }
+    printf("sorted descending, then adds: %u users, %d out of order, %s comparisons\n",
+           HASH_COUNT(users), unsorted(users, descending),
+           (cmps < 40UL * 1000) ? "few" : "MANY");
+
+    for (i = 0; i < NUSERS / 2; i++) {
+        HASH_FIND_INT(users, &i, user);
+        found += (user != NULL);
+    }
+    printf("%d of the first ids found\n", found);
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utlist.h"
+
+/* LLT_ lists: O(1) append, prepend, concat and delete-after through a
+ * head+tail descriptor, with the tail kept right by every operation */
+typedef struct el {
+    int id;
+    struct el *next;
+    struct el *link;
+} el;
+
+LLT_DECLARE(el_list, el);
+
+#define NELS 100000
+
+static int idcmp(void *a, void *b)
+{
+    return ((el*)a)->id - ((el*)b)->id;
+}
+
+/* prints the ids (up to 12), and whether the tail is the last element */
+static void show(const char *what, el_list *l)
+{
+    el *e, *last = NULL;
+    int n = 0;
+    printf("%s:", what);
+    LLT_FOREACH(*l, e) {
+        if (n++ < 12) {
+            printf(" %d", e->id);
+        }
+        last = e;
+    }
+    printf("%s (%d), tail %s\n", (n > 12) ? " ..." : "", n,
+           (l->tail == last) ? "ok" : "WRONG");
+}
+
+int main()
+{
+    el *els, *e, *tmp, *del;
+    el_list q, r, l2;
+    int i, count, sum;
+
+    els = (el*)malloc(NELS * sizeof(el));
+    if (els == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < NELS; i++) {
+        els[i].id = i;
+    }
+
+    /* a queue: the appends don't walk the list */
+    LLT_INIT(q);
+    printf("empty %d\n", LLT_EMPTY(q));
+    for (i = 0; i < NELS; i++) {
+        LLT_APPEND(q, &els[i]);
+    }
+    LLT_COUNT(q, e, count);
+    printf("queued %d, tail %d\n", count, q.tail->id);
+    sum = 0;
+    for (i = 0; i < NELS - 5; i++) {
+        LLT_POP_FRONT(q, del);
+        sum += (del->id == i) ? 0 : 1;
+        if (i % 2) {
+            LLT_APPEND(q, del);   /* requeue the odd ones */
+        }
+    }
+    printf("popped %d, %d out of order\n", NELS - 5, sum);
+    LLT_COUNT(q, e, count);
+    printf("left %d, head %d, tail %d\n", count, q.head->id, q.tail->id);
+    while (!LLT_EMPTY(q)) {
+        LLT_POP_FRONT(q, del);
+    }
+    LLT_POP_FRONT(q, del);
+    printf("drained: %s\n", (q.head || q.tail || del) ? "WRONG" : "ok");
+
+    /* prepend, insert after, and delete after (including the tail) */
+    LLT_INIT(r);
+    for (i = 0; i < 5; i++) {
+        LLT_PREPEND(r, &els[i]);
+    }
+    show("prepended", &r);
+    tmp = &els[0];
+    LLT_APPEND_ELEM(r, tmp, &els[10]);
+    tmp = &els[3];
+    LLT_APPEND_ELEM(r, tmp, &els[11]);
+    show("inserted after 0 and 3", &r);
+    tmp = &els[0];
+    LLT_DELETE_AFTER(r, tmp, del);
+    show("deleted after 0 (the tail)", &r);
+    LLT_DELETE_AFTER(r, tmp, del);
+    printf("nothing after the tail: %s\n", del ? "WRONG" : "ok");
+    tmp = NULL;
+    LLT_DELETE_AFTER(r, tmp, del);
+    show("deleted after NULL (the head)", &r);
+
+    /* delete anywhere, concat and sort */
+    LLT_DELETE(r, &els[0]);
+    show("deleted 0", &r);
+    LLT_DELETE(r, &els[2]);
+    show("deleted 2", &r);
+    LLT_INIT(l2);
+    for (i = 20; i < 25; i++) {
+        LLT_APPEND(l2, &els[i]);
+    }
+    LLT_CONCAT(r, l2);
+    show("concatenated 20..24", &r);
+    printf("second list empty %d\n", LLT_EMPTY(l2));
+    LLT_CONCAT(l2, r);
+    show("concatenated into an empty list", &l2);
+    LLT_PREPEND(l2, &els[99]);
+    LLT_SORT(l2, idcmp);
+    show("sorted", &l2);
+    LLT_FOREACH_SAFE(l2, e, tmp) {
+        if (e->id % 2) {
+            LLT_DELETE(l2, e);
+        }
+    }
+    show("odd ones deleted", &l2);
+
+    /* the 2 forms, through another link field */
+    LLT_INIT(r);
+    for (i = 0; i < 4; i++) {
+        LLT_APPEND2(r, &els[i], link);
+    }
+    LLT_POP_FRONT2(r, del, link);
+    LLT_DELETE2(r, &els[3], link);
+    printf("through link:");
+    LLT_FOREACH2(r, e, link) {
+        printf(" %d", e->id);
+    }
+    printf(", tail %d\n", r.tail->id);
+
+    free(els);
+    return 0;
+}
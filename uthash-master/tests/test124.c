@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/* seeded tables (HASH_SEEDED): keys whose hash values all share their low
+ * bits still spread over the buckets, and the hash values keep working
+ * across tables with different seeds; and the SipHash-1-3 keyed hash */
+#define HASH_SEEDED 1
+
+/* fixed seeds, so the chains below come out the same every run */
+static unsigned next_seed = 1;
+#define uthash_table_seed(tbl) (next_seed++ * 0x9e3779b9U)
+
+/* every hash value is a multiple of 4096: unseeded, all of them would share
+ * bucket 0 until the table had more than 4096 buckets */
+#define HASH_FUNCTION(keyptr,keylen,hashv)                                       \
+do {                                                                             \
+  (hashv) = (unsigned)(*(const int*)(keyptr)) << 12;                             \
+} while (0)
+
+#include "uthash.h"
+
+uint64_t uthash_sip_key[2];
+
+typedef struct item {
+    int id;
+    UT_hash_handle hh;
+    UT_hash_handle ah;
+} item;
+
+#define NITEMS 2000
+
+static unsigned max_chain(const UT_hash_table *tbl)
+{
+    unsigned i, max = 0;
+    for (i = 0; i < tbl->num_buckets; i++) {
+        if (tbl->buckets[i].count > max) {
+            max = tbl->buckets[i].count;
+        }
+    }
+    return max;
+}
+
+#define EVENS(e) ((((item*)(e))->id & 1) == 0)
+
+int main()
+{
+    item *items, *users = NULL, *evens = NULL, *found;
+    int i, n, missing;
+    unsigned hashv, len;
+    unsigned char msg[33];
+    static const unsigned lens[] = { 0, 1, 7, 8, 9, 15, 16, 33 };
+
+    items = (item*)malloc(NITEMS * sizeof(item));
+    if (items == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < NITEMS; i++) {
+        items[i].id = i;
+        HASH_ADD_INT(users, id, &items[i]);
+    }
+    printf("seeded: %u items, %u buckets, longest chain %u, noexpand %u\n",
+           HASH_COUNT(users), users->hh.tbl->num_buckets,
+           max_chain(users->hh.tbl), users->hh.tbl->noexpand);
+    missing = 0;
+    for (i = 0; i < NITEMS; i++) {
+        HASH_FIND_INT(users, &i, found);
+        missing += (found != &items[i]);
+    }
+    printf("found all %s\n", missing ? "no" : "yes");
+
+    /* the selected items keep their hash values in a table seeded apart */
+    HASH_SELECT(ah, evens, hh, users, EVENS);
+    printf("seeds differ %s\n",
+           (evens->ah.tbl->seed != users->hh.tbl->seed) ? "yes" : "no");
+    n = missing = 0;
+    for (i = 0; i < NITEMS; i++) {
+        HASH_FIND(ah, evens, &i, sizeof(int), found);
+        n += (found != NULL);
+        missing += ((found != NULL) != EVENS(&items[i]));
+    }
+    printf("evens: %d found, %d wrong, longest chain %u\n", n, missing,
+           max_chain(evens->ah.tbl));
+
+    /* deletes find their buckets too */
+    for (i = 0; i < NITEMS; i += 3) {
+        HASH_DELETE(hh, users, &items[i]);
+    }
+    missing = 0;
+    for (i = 0; i < NITEMS; i++) {
+        HASH_FIND_INT(users, &i, found);
+        missing += ((found != NULL) != (i % 3 != 0));
+    }
+    printf("after deletes: %u items, %d wrong\n", HASH_COUNT(users), missing);
+    HASH_CLEAR(ah, evens);
+    HASH_CLEAR(hh, users);
+
+    /* SipHash-1-3 with the reference key 00 01 .. 0f, of 00 01 .. len-1 */
+    uthash_sip_key[0] = 0x0706050403020100ULL;
+    uthash_sip_key[1] = 0x0f0e0d0c0b0a0908ULL;
+    for (i = 0; i < (int)sizeof(msg); i++) {
+        msg[i] = (unsigned char)i;
+    }
+    for (i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++) {
+        len = lens[i];
+        HASH_SIP(msg, len, hashv);
+        printf("sip %2u: %08x\n", len, hashv);
+    }
+    uthash_sip_key[1] ^= 1;
+    HASH_SIP(msg, 8U, hashv);
+    printf("sip  8, other key: %s\n", (hashv != 0xbbb90f9fU) ? "differs" : "same");
+    free(items);
+    return 0;
+}
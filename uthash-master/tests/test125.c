@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* bucket contraction (HASH_SHRINK): mass deletions halve the buckets back,
+ * with hysteresis, and the items left are still found */
+#define HASH_SHRINK 1
+#define uthash_contract_fyi(tbl) contractions++
+static unsigned contractions;
+#include "uthash.h"
+
+typedef struct item {
+    int id;
+    UT_hash_handle hh;
+} item;
+
+#define NITEMS 10000
+
+static void show(const char *what, item *items)
+{
+    UT_hash_stats st;
+    HASH_STATS(hh, items, &st);
+    printf("%s: %u items, %u buckets, %u expansions, %u contractions\n", what,
+           st.num_items, st.num_buckets, st.expansions, st.contractions);
+}
+
+static int check(item *items, item *all, int keep_mod)
+{
+    int i, wrong = 0;
+    item *found;
+    for (i = 0; i < NITEMS; i++) {
+        HASH_FIND_INT(items, &i, found);
+        wrong += ((found != NULL) != (i % keep_mod == 0));
+        wrong += ((found != NULL) && (found != &all[i]));
+    }
+    return wrong;
+}
+
+int main()
+{
+    item *all, *items = NULL, *it;
+    unsigned buckets;
+    int i;
+
+    all = (item*)malloc(NITEMS * sizeof(item));
+    if (all == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < NITEMS; i++) {
+        all[i].id = i;
+        HASH_ADD_INT(items, id, &all[i]);
+    }
+    show("added", items);
+
+    /* keep every 100th: the buckets follow the items down */
+    for (i = 0; i < NITEMS; i++) {
+        if (i % 100 != 0) {
+            HASH_DEL(items, &all[i]);
+        }
+    }
+    show("deleted 99%", items);
+    printf("contract hook %u, wrong %d\n", contractions, check(items, all, 100));
+
+    /* churn around the size: a few more deletes and re-adds don't resize */
+    buckets = items->hh.tbl->num_buckets;
+    for (i = 0; i < 2000; i++) {
+        it = &all[(i % 100) * 100];
+        HASH_DEL(items, it);
+        HASH_ADD_INT(items, id, it);
+    }
+    printf("churn: buckets %s\n", (items->hh.tbl->num_buckets == buckets) ? "unchanged" : "CHANGED");
+
+    /* down to one item, then the table grows again as usual */
+    for (i = 100; i < NITEMS; i += 100) {
+        HASH_DEL(items, &all[i]);
+    }
+    show("one left", items);
+    for (i = 1; i < NITEMS; i++) {
+        HASH_ADD_INT(items, id, &all[i]);
+    }
+    show("re-added", items);
+    printf("wrong %d\n", check(items, all, 1));
+    HASH_CLEAR(hh, items);
+    free(all);
+    return 0;
+}
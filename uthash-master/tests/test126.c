@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* fixed-length keys: the _FIXED forms find and replace 16-, 8- and 12-byte
+ * struct keys in tables built with HASH_ADD, and agree with HASH_FIND */
+#include "uthash.h"
+
+typedef struct {
+    uint32_t src, dst, port, proto;
+} flow_key;
+
+typedef struct flow {
+    flow_key key;
+    int n;
+    UT_hash_handle hh;
+} flow;
+
+typedef struct pair {
+    uint32_t key[3];
+    UT_hash_handle hh;
+} pair;
+
+#define NITEMS 5000
+
+static flow_key make_key(int i)
+{
+    flow_key k;
+    memset(&k, 0, sizeof(k));
+    k.src = (uint32_t)i;
+    k.dst = (uint32_t)i * 7U;
+    k.port = 80U;
+    k.proto = 6U;
+    return k;
+}
+
+int main()
+{
+    flow *flows = NULL, *all, *f, *g, *replaced, *tmp;
+    pair *pairs = NULL, *pall, *p;
+    flow_key k;
+    uint64_t id;
+    int i, found, wrong;
+
+    all = (flow*)calloc(NITEMS, sizeof(flow));
+    pall = (pair*)calloc(NITEMS, sizeof(pair));
+    if ((all == NULL) || (pall == NULL)) {
+        exit(-1);
+    }
+    for (i = 0; i < NITEMS; i++) {
+        all[i].key = make_key(i);
+        HASH_ADD(hh, flows, key, sizeof(flow_key), &all[i]);
+    }
+    found = wrong = 0;
+    for (i = 0; i < 2 * NITEMS; i++) {
+        k = make_key(i);
+        HASH_FIND_FIXED(hh, flows, &k, sizeof(flow_key), f);
+        HASH_FIND(hh, flows, &k, sizeof(flow_key), g);
+        found += (f != NULL);
+        wrong += (f != g) || ((f != NULL) && (f != &all[i]));
+    }
+    printf("16-byte keys: %d found, %d wrong\n", found, wrong);
+
+    /* replacing swaps in the new item */
+    f = (flow*)calloc(1, sizeof(flow));
+    if (f == NULL) {
+        exit(-1);
+    }
+    f->key = make_key(42);
+    f->n = 1;
+    HASH_REPLACE_FIXED(hh, flows, key, sizeof(flow_key), f, replaced);
+    HASH_FIND_FIXED(hh, flows, &f->key, sizeof(flow_key), g);
+    printf("replaced %s, found new %s, count %u\n",
+           (replaced == &all[42]) ? "old" : "?", (g == f) ? "yes" : "no",
+           HASH_COUNT(flows));
+
+    /* the key length can be a variable: 8-byte keys read through it */
+    HASH_CLEAR(hh, flows);
+    free(f);
+    for (i = 0; i < NITEMS; i++) {
+        HASH_ADD(hh, flows, key, sizeof(uint64_t), &all[i]);
+    }
+    found = 0;
+    for (i = 0; i < NITEMS; i++) {
+        memcpy(&id, &all[i].key, sizeof(id));
+        HASH_FIND_FIXED(hh, flows, &id, (unsigned)sizeof(id), f);
+        found += (f == &all[i]);
+    }
+    printf("8-byte keys: %d found\n", found);
+
+    /* other lengths compare with HASH_KEYCMP */
+    for (i = 0; i < NITEMS; i++) {
+        pall[i].key[0] = (uint32_t)i;
+        pall[i].key[2] = (uint32_t)(NITEMS - i);
+        HASH_ADD(hh, pairs, key, sizeof(pall[i].key), &pall[i]);
+    }
+    found = 0;
+    for (i = 0; i < NITEMS; i++) {
+        HASH_FIND_FIXED(hh, pairs, pall[i].key, sizeof(pall[i].key), p);
+        found += (p == &pall[i]);
+    }
+    printf("12-byte keys: %d found\n", found);
+
+    HASH_ITER(hh, flows, f, tmp) {
+        HASH_DEL(flows, f);
+    }
+    HASH_CLEAR(hh, pairs);
+    free(pall);
+    free(all);
+    return 0;
+}
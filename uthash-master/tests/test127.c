@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* in-place upserts (HASH_UPSERT): the new item takes the replaced one's
+ * place in the app order, the head and tail included, and is found by its
+ * key; and counting words with HASH_FIND_OR_ADD */
+#include "uthash.h"
+
+typedef struct item {
+    int id;
+    int version;
+    UT_hash_handle hh;
+} item;
+
+typedef struct counter {
+    char word[16];
+    int n;
+    UT_hash_handle hh;
+} counter;
+
+#define NITEMS 1000
+
+static item *make_item(int id, int version)
+{
+    item *it = (item*)malloc(sizeof(item));
+    if (it == NULL) {
+        exit(-1);
+    }
+    it->id = id;
+    it->version = version;
+    return it;
+}
+
+static counter *make_counter(const char *word)
+{
+    counter *c = (counter*)calloc(1, sizeof(counter));
+    if (c == NULL) {
+        exit(-1);
+    }
+    strcpy(c->word, word);
+    return c;
+}
+
+int main()
+{
+    item *items = NULL, *it, *replaced, *tmp;
+    counter *counts = NULL, *c, *ctmp;
+    unsigned buckets;
+    int i, expect, wrong, updates = 0;
+    static const char *words[] = { "the", "cat", "sat", "on", "the", "mat",
+                                   "the", "end", "cat" };
+
+    for (i = 0; i < NITEMS; i++) {
+        it = make_item(i, 0);
+        HASH_ADD_INT(items, id, it);
+    }
+    buckets = items->hh.tbl->num_buckets;
+
+    /* upsert every third id, then the first and the last */
+    for (i = 0; i < NITEMS; i += 3) {
+        it = make_item(i, 1);
+        HASH_UPSERT(hh, items, id, sizeof(int), it, replaced);
+        updates += (replaced != NULL) && (replaced->id == i);
+        free(replaced);
+    }
+    it = make_item(0, 2);
+    HASH_UPSERT(hh, items, id, sizeof(int), it, replaced);
+    free(replaced);
+    it = make_item(NITEMS - 1, 2);
+    HASH_UPSERT(hh, items, id, sizeof(int), it, replaced);
+    free(replaced);
+    printf("updates %d, head %d v%d, count %u, buckets %s\n", updates,
+           items->id, items->version, HASH_COUNT(items),
+           (items->hh.tbl->num_buckets == buckets) ? "unchanged" : "CHANGED");
+
+    /* still in the order added, each found at its latest version */
+    expect = 0;
+    wrong = 0;
+    HASH_ITER(hh, items, it, tmp) {
+        item *found;
+        wrong += (it->id != expect);
+        wrong += (it->version != ((expect == 0 || expect == NITEMS - 1) ? 2 :
+                                  (expect % 3 == 0) ? 1 : 0));
+        HASH_FIND_INT(items, &expect, found);
+        wrong += (found != it);
+        expect++;
+    }
+    printf("in order %s, tail %d, wrong %d\n", (expect == NITEMS) ? "yes" : "no",
+           ((item*)ELMT_FROM_HH(items->hh.tbl, items->hh.tbl->tail))->id, wrong);
+
+    /* an upsert of a new key adds it at the end */
+    it = make_item(NITEMS, 0);
+    HASH_UPSERT(hh, items, id, sizeof(int), it, replaced);
+    printf("new key: replaced %s, count %u\n", replaced ? "something" : "nothing",
+           HASH_COUNT(items));
+    HASH_ITER(hh, items, it, tmp) {
+        HASH_DEL(items, it);
+        free(it);
+    }
+
+    /* counting: make runs only for words not seen yet */
+    for (i = 0; i < (int)(sizeof(words) / sizeof(words[0])); i++) {
+        HASH_FIND_OR_ADD(hh, counts, word, words[i], strlen(words[i]), c,
+                         make_counter(words[i]));
+        c->n++;
+    }
+    HASH_ITER(hh, counts, c, ctmp) {
+        printf("%s %d\n", c->word, c->n);
+        HASH_DEL(counts, c);
+        free(c);
+    }
+    return 0;
+}
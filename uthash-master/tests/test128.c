@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "utringbuffer.h"
+
+/* utringbuffer bulk pushes and pops, with power-of-two and other
+ * capacities, checked against a plain array model; and pops of elements
+ * with a copy and dtor */
+
+#define MODEL_MAX 100000
+
+static int model[MODEL_MAX];
+static unsigned model_start, model_end;
+
+static int check(UT_ringbuffer *rb)
+{
+    unsigned j;
+    int *p, wrong = 0;
+    wrong += (utringbuffer_len(rb) != model_end - model_start);
+    for (j = 0; j < utringbuffer_len(rb); j++) {
+        p = (int*)utringbuffer_eltptr(rb, j);
+        wrong += (*p != model[model_start + j]);
+        wrong += (utringbuffer_eltidx(rb, p) != j);
+    }
+    p = (int*)utringbuffer_back(rb);
+    wrong += (p != NULL) && (*p != model[model_end - 1]);
+    wrong += (utringbuffer_full(rb) != 0) != (utringbuffer_len(rb) == rb->n);
+    return wrong;
+}
+
+static void run(unsigned cap)
+{
+    UT_ringbuffer rb;
+    int in[40], out[40];
+    unsigned round, k, num, popped;
+    int next = 0, wrong = 0;
+
+    utringbuffer_init(&rb, cap, &ut_int_icd);
+    model_start = model_end = 0;
+    for (round = 0; round < 500; round++) {
+        num = (round * 7U) % 23U;
+        for (k = 0; k < num; k++) {
+            in[k] = next++;
+            model[model_end++] = in[k];
+        }
+        if ((round % 5U) == 0) {
+            for (k = 0; k < num; k++) {
+                utringbuffer_push_back(&rb, &in[k]);
+            }
+        } else {
+            utringbuffer_push_back_n(&rb, in, num);
+        }
+        if (model_end - model_start > cap) {
+            model_start = model_end - cap;
+        }
+        wrong += check(&rb);
+
+        num = (round * 5U) % 17U;
+        popped = (num < model_end - model_start) ? num : model_end - model_start;
+        utringbuffer_pop_front_n(&rb, num, out);
+        for (k = 0; k < popped; k++) {
+            wrong += (out[k] != model[model_start++]);
+        }
+        wrong += check(&rb);
+    }
+    printf("capacity %u: %d pushed, %u left, wrong %d\n", cap, next,
+           utringbuffer_len(&rb), wrong);
+    utringbuffer_done(&rb);
+}
+
+int main()
+{
+    UT_ringbuffer *strs;
+    char *s, *got = NULL, **p;
+    char *batch[3];
+
+    run(8);
+    run(13);
+    run(32);
+
+    /* copied in with strdup: pops move the copies out, or free them */
+    utringbuffer_new(strs, 4, &ut_str_icd);
+    batch[0] = "one";
+    batch[1] = "two";
+    batch[2] = "three";
+    utringbuffer_push_back_n(strs, batch, 3);
+    s = "four";
+    utringbuffer_push_back(strs, &s);
+    s = "five";
+    utringbuffer_push_back(strs, &s);
+    utringbuffer_pop_front(strs, &got);
+    printf("popped %s, %u left\n", got ? got : "nothing", utringbuffer_len(strs));
+    free(got);
+    utringbuffer_pop_front_n(strs, 2, NULL);
+    utringbuffer_push_back_n(strs, batch, 3);
+    p = NULL;
+    while ((p = (char**)utringbuffer_next(strs, p))) {
+        printf("%s%s", *p, (utringbuffer_back(strs) == (void*)p) ? "\n" : " ");
+    }
+    utringbuffer_free(strs);
+    return 0;
+}
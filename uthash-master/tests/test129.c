@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "utstring.h"
+
+/* ropes (UT_string_rope): appends and printfs across small chunks, then
+ * materialized into a UT_string and flushed with writev, both matching the
+ * same text built in a UT_string; and an append larger than a chunk */
+
+static void build(UT_string_rope *r, UT_string *s)
+{
+    static const char word[] = "abcdefghijklmnopqrstuvwxyz";
+    int i;
+    for (i = 0; i < 2000; i++) {
+        utstring_rope_bincpy(r, word, (size_t)(i % 27));
+        utstring_bincpy(s, word, (size_t)(i % 27));
+        utstring_rope_printf(r, "[%d:%s]", i, (i % 100 == 0) ? "hundred" : "");
+        utstring_printf(s, "[%d:%s]", i, (i % 100 == 0) ? "hundred" : "");
+    }
+}
+
+int main()
+{
+    UT_string_rope r;
+    UT_string *want, *got;
+    UT_string_chunk *c;
+    FILE *f;
+    char *big, *back;
+    size_t chunks = 0, n;
+
+    utstring_new(want);
+    utstring_new(got);
+    utstring_rope_init(&r, 64);
+    build(&r, want);
+    for (c = r.head; c != NULL; c = c->next) {
+        chunks++;
+    }
+    utstring_rope_materialize(&r, got);
+    printf("len %lu, more than 100 chunks %s, materialized %s\n",
+           (unsigned long)utstring_rope_len(&r), (chunks > 100) ? "yes" : "no",
+           (utstring_len(got) == utstring_len(want) &&
+            memcmp(utstring_body(got), utstring_body(want), utstring_len(want)) == 0) ?
+           "same" : "DIFFERENT");
+
+    /* flush to a file, read it back; the rope is empty afterwards */
+    f = tmpfile();
+    if (f == NULL) {
+        exit(-1);
+    }
+    if (utstring_rope_flush(&r, fileno(f)) != 0) {
+        printf("flush failed\n");
+    }
+    printf("after flush: len %lu\n", (unsigned long)utstring_rope_len(&r));
+    back = (char*)malloc(utstring_len(want) + 1);
+    if (back == NULL) {
+        exit(-1);
+    }
+    rewind(f);
+    n = fread(back, 1, utstring_len(want) + 1, f);
+    printf("flushed %s\n", (n == utstring_len(want) &&
+           memcmp(back, utstring_body(want), n) == 0) ? "same" : "DIFFERENT");
+    fclose(f);
+    free(back);
+
+    /* reuse after the flush, with one append of 10000 bytes */
+    big = (char*)malloc(10000);
+    if (big == NULL) {
+        exit(-1);
+    }
+    memset(big, 'x', 10000);
+    utstring_rope_bincpy(&r, "head ", 5);
+    utstring_rope_bincpy(&r, big, 10000);
+    utstring_rope_printf(&r, " tail %d", 42);
+    utstring_clear(got);
+    utstring_rope_materialize(&r, got);
+    printf("big: len %lu, ends \"%s\"\n", (unsigned long)utstring_len(got),
+           utstring_body(got) + utstring_len(got) - 13);
+    free(big);
+    utstring_rope_done(&r);
+    utstring_free(got);
+    utstring_free(want);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+/* uthash.hpp: int keys (word hash, shared with HASH_FIND_INT), struct keys
+ * (HASH_FUNCTION and memcmp), a custom hash and comparator; move-only
+ * values inserted and emplaced, duplicates rejected, erase and iteration */
+#include "uthash.hpp"
+
+struct user {
+    int id;
+    std::string name;
+    UT_hash_handle hh;
+    user(int i, const std::string &n) : id(i), name(n) {}
+    user(user &&o) : id(o.id), name(std::move(o.name)) {}
+};
+
+struct point {
+    int16_t x, y, z;
+};
+
+struct voxel {
+    point at;
+    int n;
+    UT_hash_handle hh;
+    voxel(point p, int v) : at(p), n(v) {}
+};
+
+/* case-insensitive 8-byte tags: the hash and compare fold ASCII case */
+struct tag8 {
+    char c[8];
+};
+
+struct fold_hash {
+    unsigned operator()(const tag8 &t) const {
+        unsigned h = 0;
+        for (int i = 0; i < 8; i++) {
+            h = h * 31U + (unsigned)(t.c[i] | 0x20);
+        }
+        return h;
+    }
+};
+
+struct fold_eq {
+    bool operator()(const tag8 &a, const tag8 &b) const {
+        for (int i = 0; i < 8; i++) {
+            if ((a.c[i] | 0x20) != (b.c[i] | 0x20)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct tagged {
+    tag8 tag;
+    UT_hash_handle hh;
+};
+
+static tag8 make_tag(const char *s)
+{
+    tag8 t;
+    size_t n = strlen(s);
+    memset(&t, 0, sizeof(t));
+    memcpy(t.c, s, (n < sizeof(t.c)) ? n : sizeof(t.c));
+    return t;
+}
+
+#define NITEMS 10000
+
+int main()
+{
+    typedef ut::hash_table<user, int, &user::id> user_table;
+    user_table users;
+    user *u;
+    int i, found = 0, dups = 0, wrong = 0;
+
+    for (i = 0; i < NITEMS; i++) {
+        if (i % 2 == 0) {
+            users.insert(user(i, "u" + std::to_string(i)));
+        } else {
+            users.emplace(i, "u" + std::to_string(i));
+        }
+    }
+    dups += !users.emplace(7, "again").second;
+    dups += !users.insert(user(8, "again")).second;
+    for (i = 0; i < NITEMS; i++) {
+        u = users.find(i);
+        found += (u != NULL);
+        wrong += (u == NULL) || (u->name != "u" + std::to_string(i));
+    }
+    /* the same table through the C macros */
+    i = NITEMS / 2;
+    HASH_FIND_FASTINT(users.head(), &i, u);
+    printf("users: %u, found %d, wrong %d, rejected %d, fastint %s\n",
+           (unsigned)users.size(), found, wrong, dups,
+           (u == users.find(i)) ? "same" : "DIFFERENT");
+
+    for (i = 0; i < NITEMS; i += 3) {
+        users.erase(i);
+    }
+    found = 0;
+    wrong = 0;
+    i = 1;
+    for (user_table::iterator it = users.begin(); it != users.end(); ++it) {
+        while (i % 3 == 0) {
+            i++;
+        }
+        wrong += (it->id != i);
+        i++;
+        found++;
+    }
+    printf("after erase: %u, iterated %d in order, wrong %d, erase missing %u\n",
+           (unsigned)users.size(), found, wrong, (unsigned)users.erase(0));
+
+    /* moving the table hands over the items */
+    user_table moved(std::move(users));
+    printf("moved: %u and %u\n", (unsigned)moved.size(), (unsigned)users.size());
+
+    ut::hash_table<voxel, point, &voxel::at> grid;
+    for (i = 0; i < NITEMS; i++) {
+        point p = { (int16_t)(i % 21), (int16_t)(i / 21 % 21), (int16_t)(i / 441) };
+        grid.emplace(p, i);
+    }
+    found = 0;
+    for (i = 0; i < NITEMS; i++) {
+        point p = { (int16_t)(i % 21), (int16_t)(i / 21 % 21), (int16_t)(i / 441) };
+        voxel *v = grid.find(p);
+        found += (v != NULL) && (v->n == i);
+    }
+    grid.reserve(1U << 16);
+    point p = { 1, 2, 3 };
+    printf("voxels: %u, found %d, contains (1,2,3) %s, buckets %u\n",
+           (unsigned)grid.size(), found, grid.contains(p) ? "yes" : "no",
+           grid.head()->hh.tbl->num_buckets);
+
+    ut::hash_table<tagged, tag8, &tagged::tag, fold_hash, fold_eq> tags;
+    static const char *names[] = { "Alpha", "beta", "ALPHA", "Gamma", "BETA", "delta" };
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        tagged t;
+        t.tag = make_tag(names[i]);
+        tags.insert(t);
+    }
+    printf("tags: %u, gamma %s, epsilon %s\n", (unsigned)tags.size(),
+           tags.contains(make_tag("gAmMa")) ? "yes" : "no",
+           tags.contains(make_tag("epsilon")) ? "yes" : "no");
+    for (ut::hash_table<tagged, tag8, &tagged::tag, fold_hash, fold_eq>::iterator it =
+             tags.begin(); it != tags.end(); it++) {
+        printf("%.8s\n", it->tag.c);
+    }
+    tags.clear();
+    printf("cleared: %s\n", tags.empty() ? "empty" : "not empty");
+    return 0;
+}
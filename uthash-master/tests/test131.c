@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* merging (HASH_MERGE, HASH_SPLIT, HASH_MERGE_PARTS): threads count keys in
+ * tables of their own, split them by hash, and the parts are merged and
+ * checked against a single-threaded count; string keys merge too */
+#include "uthash.h"
+
+typedef struct count {
+    int key;
+    int n;
+    UT_hash_handle hh;
+} count;
+
+typedef struct name {
+    char s[16];
+    int n;
+    UT_hash_handle hh;
+} name;
+
+#define NTHREADS 4
+#define LOG2_PARTS 3
+#define NKEYS 10000
+#define PER_THREAD 20000
+
+static count *parts[NTHREADS << LOG2_PARTS];
+static int expect[NKEYS];
+static unsigned freed;
+
+static void add_counts(count *into, count *from)
+{
+    into->n += from->n;
+    free(from);
+    freed++;
+}
+
+static void add_names(name *into, name *from)
+{
+    into->n += from->n;
+    free(from);
+}
+
+static int key_of(int t, int i)
+{
+    return (int)(((unsigned)(t * PER_THREAD + i) * 2654435761U) % NKEYS);
+}
+
+static void *worker(void *arg)
+{
+    int t = (int)(size_t)arg, i, k;
+    count *local = NULL, *c;
+
+    for (i = 0; i < PER_THREAD; i++) {
+        k = key_of(t, i);
+        HASH_FIND_INT(local, &k, c);
+        if (c == NULL) {
+            c = (count*)malloc(sizeof(count));
+            if (c == NULL) {
+                exit(-1);
+            }
+            c->key = k;
+            c->n = 0;
+            HASH_ADD_INT(local, key, c);
+        }
+        c->n++;
+    }
+    HASH_SPLIT(hh, local, &parts[t << LOG2_PARTS], LOG2_PARTS);
+    return NULL;
+}
+
+static name *make_name(const char *s, int n)
+{
+    name *nm = (name*)calloc(1, sizeof(name));
+    if (nm == NULL) {
+        exit(-1);
+    }
+    strcpy(nm->s, s);
+    nm->n = n;
+    return nm;
+}
+
+int main()
+{
+    pthread_t tid[NTHREADS];
+    count *out[1 << LOG2_PARTS], *c, *tmp, *all = NULL;
+    name *a = NULL, *b = NULL, *empty = NULL, *nm, *ntmp;
+    unsigned total = 0;
+    int t, i, p, wrong = 0, keys = 0;
+    static const char *wa[] = { "red", "green", "blue" };
+    static const char *wb[] = { "blue", "cyan", "red", "black" };
+
+    for (t = 0; t < NTHREADS; t++) {
+        for (i = 0; i < PER_THREAD; i++) {
+            expect[key_of(t, i)]++;
+        }
+        if (pthread_create(&tid[t], NULL, worker, (void*)(size_t)t) != 0) {
+            exit(-1);
+        }
+    }
+    for (t = 0; t < NTHREADS; t++) {
+        pthread_join(tid[t], NULL);
+    }
+    memset(out, 0, sizeof(out));
+    HASH_MERGE_PARTS(hh, out, parts, NTHREADS, LOG2_PARTS, add_counts);
+
+    for (p = 0; p < (1 << LOG2_PARTS); p++) {
+        HASH_ITER(hh, out[p], c, tmp) {
+            wrong += (HASH_PART(c->hh.hashv, LOG2_PARTS) != (unsigned)p);
+            wrong += (c->n != expect[c->key]);
+            expect[c->key] = -1;
+        }
+        total += HASH_COUNT(out[p]);
+    }
+    for (i = 0; i < NTHREADS << LOG2_PARTS; i++) {
+        wrong += (parts[i] != NULL);
+    }
+    for (i = 0; i < NKEYS; i++) {
+        keys += (expect[i] != 0);
+        wrong += (expect[i] > 0);
+    }
+    printf("parts: %u keys (of %d seen), %u combined, wrong %d\n", total, keys,
+           freed, wrong);
+
+    /* the disjoint parts fold into one table; the first is taken over */
+    for (p = 0; p < (1 << LOG2_PARTS); p++) {
+        HASH_MERGE(hh, all, out[p], add_counts);
+    }
+    i = 1234;
+    HASH_FIND_INT(all, &i, c);
+    printf("one table: %u keys, key 1234 counted %d\n", HASH_COUNT(all),
+           (c != NULL) ? c->n : -1);
+    HASH_ITER(hh, all, c, tmp) {
+        HASH_DEL(all, c);
+        free(c);
+    }
+
+    /* string keys: b merged into a, in b's order after a's own */
+    for (i = 0; i < 3; i++) {
+        nm = make_name(wa[i], 1);
+        HASH_ADD_STR(a, s, nm);
+    }
+    for (i = 0; i < 4; i++) {
+        nm = make_name(wb[i], 10);
+        HASH_ADD_STR(b, s, nm);
+    }
+    HASH_MERGE(hh, a, b, add_names);
+    HASH_MERGE(hh, a, empty, add_names);
+    printf("b %s, %u names:", (b == NULL) ? "empty" : "NOT EMPTY", HASH_COUNT(a));
+    HASH_ITER(hh, a, nm, ntmp) {
+        printf(" %s=%d", nm->s, nm->n);
+    }
+    printf("\n");
+    HASH_FIND_STR(a, "cyan", nm);
+    printf("cyan found %s\n", (nm != NULL) ? "yes" : "no");
+    HASH_ITER(hh, a, nm, ntmp) {
+        HASH_DEL(a, nm);
+        free(nm);
+    }
+    return 0;
+}
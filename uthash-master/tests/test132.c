@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "utqueue.h"
+
+/* a UT_spsc placed in a shared file mapping (utspsc_init_at): a child
+ * process maps the file again, at another address, and pushes through it;
+ * the parent pops with utspsc_pop and with utspsc_peek_n/utspsc_skip,
+ * seeing every value once and in order */
+#define NITEMS 100000
+#define CAPACITY 100
+
+static UT_spsc *map_queue(int fd, size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        exit(-1);
+    }
+    return (UT_spsc*)p;
+}
+
+static void produce(int fd, size_t size, const UT_spsc *parent)
+{
+    UT_spsc *q = map_queue(fd, size);
+    unsigned batch[5], i, j, n;
+    if (q == parent) {
+        _exit(1);
+    }
+    for (i = 0; i < NITEMS; i += n) {
+        n = (i % 2 == 0 || NITEMS - i < 5) ? 1 : 5;
+        for (j = 0; j < n; j++) {
+            batch[j] = i + j;
+        }
+        utspsc_push_n(q, batch, n);
+    }
+    _exit(0);
+}
+
+int main()
+{
+    FILE *f = tmpfile();
+    size_t size = utspsc_size(CAPACITY, sizeof(unsigned)), n, k, spins = 0;
+    UT_spsc *q;
+    unsigned expect = 0, v, *p;
+    int wrong = 0, status;
+    pid_t child;
+
+    if (f == NULL || ftruncate(fileno(f), (off_t)size) != 0) {
+        exit(-1);
+    }
+    printf("size %s\n", (size == sizeof(UT_spsc) + 128 * sizeof(unsigned)) ? "ok" : "WRONG");
+    q = map_queue(fileno(f), size);
+    utspsc_init_at(q, CAPACITY, sizeof(unsigned));
+    child = fork();
+    if (child < 0) {
+        exit(-1);
+    }
+    if (child == 0) {
+        produce(fileno(f), size, q);
+    }
+    while (expect < NITEMS) {
+        if (expect % 1000 < 500) {
+            utspsc_pop(q, &v);
+            wrong += (v != expect++);
+            continue;
+        }
+        p = (unsigned*)utspsc_peek_n(q, &n);
+        if (p == NULL) {
+            utqueue_wait(spins);
+            spins++;
+            continue;
+        }
+        spins = 0;
+        for (k = 0; k < n; k++) {
+            wrong += (p[k] != expect++);
+        }
+        utspsc_skip(q, n);
+    }
+    waitpid(child, &status, 0);
+    printf("capacity %u, %u values, wrong %d, left %u, producer %s\n",
+           (unsigned)(q->mask + 1), expect, wrong, (unsigned)utspsc_len(q),
+           (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? "mapped elsewhere" : "FAILED");
+    munmap(q, size);
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utmap.h"
+
+/* UT_map against a plain array: random puts, adds and deletes of int keys
+ * through several doublings, checking every key after each round, then a
+ * walk; and a map with 20-byte keys emptied again by deletes */
+#define NKEYS 5000
+#define ROUNDS 20
+
+typedef struct {
+    char name[16];
+    int n;
+} name_key;
+
+static unsigned seed = 1;
+static unsigned rnd(void)
+{
+    seed = seed * 1103515245U + 12345U;
+    return (seed >> 8) & 0xFFFFFF;
+}
+
+int main()
+{
+    UT_map m, *names;
+    static int model[NKEYS];
+    static char present[NKEYS];
+    int k, v, *p, wrong = 0, added, r, i;
+    double *d;
+    long sum = 0, msum = 0;
+    size_t count = 0, mcount = 0, cap;
+    void *e;
+    name_key nk;
+
+    utmap_init(&m, sizeof(int), sizeof(int));
+    for (r = 0; r < ROUNDS; r++) {
+        for (i = 0; i < 2000; i++) {
+            k = (int)(rnd() % (unsigned)((r + 1) * (NKEYS / ROUNDS)));
+            switch (rnd() % 4) {
+            case 0:
+            case 1:
+                v = (int)rnd();
+                utmap_put(&m, &k, &v);
+                model[k] = v;
+                present[k] = 1;
+                break;
+            case 2:
+                p = (int*)utmap_add(&m, &k, &added);
+                wrong += (added == present[k]) || (*p != (present[k] ? model[k] : 0));
+                present[k] = 1;
+                model[k] = *p;
+                break;
+            default:
+                wrong += (utmap_del(&m, &k) != present[k]);
+                present[k] = 0;
+                break;
+            }
+        }
+        for (k = 0; k < NKEYS; k++) {
+            p = (int*)utmap_find(&m, &k);
+            wrong += present[k] ? (p == NULL || *p != model[k]) : (p != NULL);
+        }
+    }
+    for (k = 0; k < NKEYS; k++) {
+        if (present[k]) {
+            mcount++;
+            msum += model[k];
+        }
+    }
+    for (e = utmap_next(&m, NULL); e != NULL; e = utmap_next(&m, e)) {
+        count++;
+        sum += *(int*)utmap_val(&m, e);
+    }
+    printf("ints: len %s, walk %s, wrong %d\n",
+           (utmap_len(&m) == mcount) ? "ok" : "WRONG",
+           (count == mcount && sum == msum) ? "ok" : "WRONG", wrong);
+    cap = m.cap;
+    utmap_clear(&m);
+    k = 7;
+    printf("cleared: len %u, find %s, slots kept %s\n", (unsigned)utmap_len(&m),
+           (utmap_find(&m, &k) == NULL) ? "none" : "FOUND", (m.cap == cap) ? "yes" : "no");
+    utmap_done(&m);
+
+    /* 20-byte keys, hashed with HASH_FUNCTION; the value is a double */
+    utmap_new(names, sizeof(name_key), sizeof(double));
+    utmap_reserve(names, 1000);
+    cap = names->cap;
+    memset(&nk, 0, sizeof(nk));
+    for (i = 0; i < 1000; i++) {
+        sprintf(nk.name, "name%d", i % 100);
+        nk.n = i / 100;
+        *(double*)utmap_add(names, &nk, NULL) = i * 0.5;
+    }
+    wrong = 0;
+    for (i = 999; i >= 0; i -= 2) {
+        sprintf(nk.name, "name%d", i % 100);
+        nk.n = i / 100;
+        wrong += (utmap_del(names, &nk) != 1);
+    }
+    for (i = 0; i < 1000; i++) {
+        sprintf(nk.name, "name%d", i % 100);
+        nk.n = i / 100;
+        d = (double*)utmap_find(names, &nk);
+        wrong += (i % 2) ? (d != NULL) : (d == NULL || *d != i * 0.5);
+    }
+    printf("names: len %u, entry %u bytes, grew %s, wrong %d\n",
+           (unsigned)utmap_len(names), (unsigned)names->esz,
+           (names->cap == cap) ? "no" : "yes", wrong);
+    utmap_free(names);
+    return 0;
+}
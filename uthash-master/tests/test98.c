@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "uthash.h"
+
+/* count bucket expansions so we can show HASH_RESERVE avoids them */
+static unsigned expands = 0;
+#undef uthash_expand_fyi
+#define uthash_expand_fyi(tbl) expands++
+
+typedef struct example_user_t {
+    int id;
+    UT_hash_handle hh;
+} example_user_t;
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp;
+    int i;
+
+    /* reserving on an empty hash is a no-op */
+    HASH_RESERVE(hh, users, 1000);
+    printf("empty: %s\n", (users == NULL) ? "null" : "non-null");
+
+    user = (example_user_t*)malloc(sizeof(example_user_t));
+    if (user == NULL) {
+        exit(-1);
+    }
+    user->id = 0;
+    HASH_ADD_INT(users, id, user);
+    printf("initial buckets: %u\n", users->hh.tbl->num_buckets);
+
+    /* request is rounded up to a power of two */
+    HASH_RESERVE(hh, users, 5000);
+    printf("reserved buckets: %u (log2 %u)\n", users->hh.tbl->num_buckets,
+           users->hh.tbl->log2_num_buckets);
+
+    /* a smaller request never shrinks the table */
+    HASH_RESERVE(hh, users, 16);
+    printf("after smaller reserve: %u\n", users->hh.tbl->num_buckets);
+
+    for (i = 1; i < 10000; i++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        user->id = i;
+        HASH_ADD_INT(users, id, user);
+    }
+    printf("count: %u buckets: %u expands: %u\n", HASH_COUNT(users),
+           users->hh.tbl->num_buckets, expands);
+
+    /* reserving on a populated hash redistributes the items */
+    HASH_RESERVE(hh, users, 20000);
+    printf("re-reserved buckets: %u expands: %u\n",
+           users->hh.tbl->num_buckets, expands);
+    for (i = 0; i < 10000; i++) {
+        HASH_FIND_INT(users, &i, user);
+        if (user == NULL || user->id != i) {
+            printf("lost %d\n", i);
+        }
+    }
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_FUNCTION(s,len,hashv) HASH_WYH(s, len, hashv)
+#include "uthash.h"
+
+/* keys of every length from 0 to 99 bytes, so all of HASH_WYH's paths run */
+typedef struct example_user_t {
+    char key[100];
+    size_t len;
+    UT_hash_handle hh;
+} example_user_t;
+
+int main()
+{
+    example_user_t *users = NULL, *user, *tmp;
+    char key[100];
+    size_t len;
+    unsigned h1, h2;
+    int found = 0, distinct = 1;
+
+    for (len = 0; len < 100; len++) {
+        user = (example_user_t*)malloc(sizeof(example_user_t));
+        if (user == NULL) {
+            exit(-1);
+        }
+        memset(user->key, 'a' + (int)(len % 26), sizeof(user->key));
+        user->len = len;
+        HASH_ADD_KEYPTR(hh, users, user->key, len, user);
+    }
+    for (len = 0; len < 100; len++) {
+        memset(key, 'a' + (int)(len % 26), sizeof(key));
+        HASH_FIND(hh, users, key, len, user);
+        if (user != NULL && user->len == len) {
+            found++;
+        }
+    }
+    printf("added %u, found %d\n", HASH_COUNT(users), found);
+
+    /* one flipped bit anywhere in a key changes its hash */
+    memset(key, 'x', sizeof(key));
+    for (len = 1; len < 100; len++) {
+        size_t i;
+        HASH_VALUE(key, len, h1);
+        for (i = 0; i < len; i++) {
+            key[i] ^= 1;
+            HASH_VALUE(key, len, h2);
+            key[i] ^= 1;
+            if (h1 == h2) {
+                distinct = 0;
+            }
+        }
+    }
+    printf("bit flips change the hash: %s\n", distinct ? "yes" : "no");
+
+    HASH_ITER(hh, users, user, tmp) {
+        HASH_DEL(users, user);
+        free(user);
+    }
+    return 0;
+}
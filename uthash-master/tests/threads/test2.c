@@ -2,19 +2,19 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <time.h>
 #include <pthread.h>
-#include "uthash.h"
+#include "utshard.h"
 
 #undef uthash_noexpand_fyi
 #define uthash_noexpand_fyi(tbl) fprintf(stderr,"warning: bucket expansion inhibited\n");
 
-#define LOOPS 100000
-#define NTHREADS 2
+/* throughput of n threads doing finds (9 in 10) and adds (1 in 10) on one
+ * hash behind one rwlock, then on a sharded hash; usage: test2 [maxthreads] */
+
+#define LOOPS 1000000
+#define KEYS 100000
+#define MAXTHREADS 64
 
 typedef struct {
   int i;
@@ -22,54 +22,137 @@ typedef struct {
   UT_hash_handle hh;
 } elt;
 
-elt *elts=NULL; /* this is our hash table which two threads will use */
+elt *elts=NULL; /* the hash behind a single lock */
 pthread_rwlock_t lock;
+UTSHARD_TABLE(elt) shards; /* the sharded hash */
+int sharded;
 
 void *thread_routine( void *arg ) {
-  int keepgoing=0;
-  /* TODO write me */
-  return NULL;
+    long t = (long)arg, num_found=0;
+    int i, k;
+    elt *e;
+
+    for(i=0; i<LOOPS; i++) {
+      k = (int)(((unsigned)i * 2654435761U + (unsigned)t) % KEYS);
+      if (i % 10 == 9) {
+        /* each thread adds its own keys, so adds never collide */
+        e = malloc(sizeof(elt));
+        if (!e) exit(-1);
+        e->i = KEYS + (int)t * LOOPS + i;
+        e->v = 0;
+        if (sharded) {
+          SHARD_ADD_INT(shards, i, e);
+        } else {
+          if (pthread_rwlock_wrlock(&lock) != 0) {
+            fprintf(stderr,"can't acquire write lock\n");
+            exit(-1);
+          }
+          HASH_ADD_INT(elts, i, e);
+          pthread_rwlock_unlock(&lock);
+        }
+      } else if (sharded) {
+        SHARD_FIND_INT(shards, &k, e);
+        if (e) num_found++;
+      } else {
+        if (pthread_rwlock_rdlock(&lock) != 0) {
+          fprintf(stderr,"can't acquire read lock\n");
+          exit(-1);
+        }
+        HASH_FIND_INT(elts, &k, e);
+        if (e) num_found++;
+        pthread_rwlock_unlock(&lock);
+      }
+    }
+    return (void*)num_found;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void empty_tables(void) {
+    elt *e, *tmp;
+    unsigned s;
+    HASH_ITER(hh, elts, e, tmp) {
+      HASH_DEL(elts, e);
+      free(e);
+    }
+    for(s=0; s<UTSHARD_SHARDS; s++) {
+      HASH_ITER(hh, SHARD_HEAD(shards, s), e, tmp) {
+        HASH_DEL(SHARD_HEAD(shards, s), e);
+        free(e);
+      }
+    }
 }
 
-int main() {
-    unsigned i;
-    long num_added=0;
+int main(int argc, char *argv[]) {
+    int i, maxthreads = (argc > 1) ? atoi(argv[1]) : 8;
+    long n, num_found;
+    unsigned count;
     int status;
-    pthread_t thread[NTHREADS];
+    pthread_t thread[MAXTHREADS];
     void *thread_result;
-    elt tmp, *e;
+    double t0, elapsed;
+    elt *e;
 
+    if (maxthreads < 1 || maxthreads > MAXTHREADS) {
+      fprintf(stderr,"maxthreads must be 1 to %d\n", MAXTHREADS);
+      exit(-1);
+    }
     if (pthread_rwlock_init(&lock,NULL) != 0) {
       fprintf(stderr,"lock init failed\n");
       exit(-1);
     }
+    SHARD_INIT(shards);
 
-    /* populate it to start */
-    for(i=0; i<LOOPS; i++) {
-      e = malloc(sizeof(elt));
-      if (!e) exit(-1);
-      e->i = i;
-      e->v = 0;
-      HASH_ADD_INT(elts, i, e);
-    }
+    printf("threads  table    Mops/s  found    final count\n");
+    for(n=1; n<=maxthreads; n*=2) {
+      for(sharded=0; sharded<2; sharded++) {
+        /* populate it to start */
+        for(i=0; i<KEYS; i++) {
+          e = malloc(sizeof(elt));
+          if (!e) exit(-1);
+          e->i = i;
+          e->v = 0;
+          if (sharded) {
+            SHARD_ADD_INT(shards, i, e);
+          } else {
+            HASH_ADD_INT(elts, i, e);
+          }
+        }
 
-    for(i=0; i<NTHREADS; i++) {
-      if (( status = pthread_create( &thread[i], NULL, thread_routine, NULL) )) {
-          printf("failure: status %d\n", status);
-          exit(-1);
-      }
-    }
+        t0 = now();
+        for(i=0; i<n; i++) {
+          if (( status = pthread_create( &thread[i], NULL, thread_routine, (void*)(long)i) )) {
+              printf("failure: status %d\n", status);
+              exit(-1);
+          }
+        }
+        num_found = 0;
+        for(i=0; i<n; i++) {
+          status = pthread_join( thread[i], &thread_result );
+          num_found += (long)thread_result;
+        }
+        elapsed = now() - t0;
 
-    for(i=0; i<NTHREADS; i++) {
-      status = pthread_join( thread[i], &thread_result );
-      printf("thread result: %d %ld\n", status, (long)thread_result);
+        if (sharded) {
+          SHARD_COUNT(shards, count);
+        } else {
+          count = HASH_COUNT(elts);
+        }
+        printf("%7ld  %-7s %7.2f  %s  %u\n", n, sharded ? "sharded" : "rwlock",
+               n * LOOPS / elapsed / 1e6,
+               (num_found == n * (LOOPS - LOOPS/10)) ? "all  " : "SOME ", count);
+        empty_tables();
+      }
     }
 
-    i = HASH_COUNT(elts);
-    printf("final count of items in hash: %u\n", i);
-
+    SHARD_DESTROY(shards);
     if (pthread_rwlock_destroy(&lock) != 0) {
       fprintf(stderr,"lock destroy failed\n");
       exit(-1);
     }
+    return 0;
 }
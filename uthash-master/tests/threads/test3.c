@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define UTSHARD_EPOCH 1
+#include "utshard.h"
+
+/* lock-free finds (UTSHARD_EPOCH) while writers add, replace, delete and
+ * free items, and the shards expand: the stable keys must always be found */
+
+#define STABLE 1000
+#define CHURN 20000
+#define ROUNDS 5
+#define NREADERS 3
+#define NWRITERS 2
+
+typedef struct {
+  int i;
+  int v;
+  UT_hash_handle hh;
+} elt;
+
+UTSHARD_TABLE(elt) elts;
+volatile int writers_done;
+
+void *reader( void *arg ) {
+    long missed = 0;
+    int i, passes = 0;
+    elt *e;
+    (void)arg;
+
+    while (!writers_done || passes < 2) {
+      for(i=0; i<STABLE; i++) {
+        SHARD_FIND_INT(elts, &i, e);
+        if (!e) missed++;
+      }
+      passes++;
+    }
+    return (void*)missed;
+}
+
+void *writer( void *arg ) {
+    long w = (long)arg;
+    int i, r, k;
+    elt *e, *replaced;
+
+    for(r=0; r<ROUNDS; r++) {
+      for(i=0; i<CHURN; i++) {
+        e = (elt*)malloc(sizeof(elt));
+        if (!e) exit(-1);
+        e->i = STABLE + (int)w * CHURN + i;
+        e->v = r;
+        SHARD_ADD_INT(elts, i, e);
+        if (i % 10 == 0) {
+          /* swap in a fresh copy of a stable key */
+          e = (elt*)malloc(sizeof(elt));
+          if (!e) exit(-1);
+          e->i = i % STABLE;
+          e->v = r;
+          SHARD_REPLACE_INT(elts, i, e, replaced);
+          free(replaced);
+        }
+      }
+      for(i=0; i<CHURN; i++) {
+        k = STABLE + (int)w * CHURN + i;
+        SHARD_FIND_INT(elts, &k, e);
+        if (!e) {
+          printf("writer %ld lost key %d\n", w, k);
+          exit(-1);
+        }
+        SHARD_DEL(elts, e);
+        free(e);
+      }
+    }
+    return NULL;
+}
+
+int main() {
+    long i;
+    unsigned count;
+    pthread_t readers[NREADERS], writers[NWRITERS];
+    void *result;
+    elt *e, *tmp;
+
+    SHARD_INIT(elts);
+    for(i=0; i<STABLE; i++) {
+      e = (elt*)malloc(sizeof(elt));
+      if (!e) exit(-1);
+      e->i = (int)i;
+      e->v = 0;
+      SHARD_ADD_INT(elts, i, e);
+    }
+
+    for(i=0; i<NREADERS; i++) {
+      if (pthread_create(&readers[i], NULL, reader, NULL)) exit(-1);
+    }
+    for(i=0; i<NWRITERS; i++) {
+      if (pthread_create(&writers[i], NULL, writer, (void*)i)) exit(-1);
+    }
+    for(i=0; i<NWRITERS; i++) {
+      pthread_join(writers[i], NULL);
+    }
+    writers_done = 1;
+    for(i=0; i<NREADERS; i++) {
+      pthread_join(readers[i], &result);
+      printf("reader %ld: %ld stable keys missed\n", i, (long)result);
+    }
+
+    SHARD_COUNT(elts, count);
+    printf("final count of items in hash: %u\n", count);
+    for(i=0; i<UTSHARD_SHARDS; i++) {
+      HASH_ITER(hh, SHARD_HEAD(elts, i), e, tmp) {
+        HASH_DEL(SHARD_HEAD(elts, i), e);
+        free(e);
+      }
+    }
+    SHARD_DESTROY(elts);
+    return 0;
+}